@@ -5,6 +5,11 @@ PATCH := 1
 ABIVER := 1
 BUILDMODE := dynamic
 HARDENING := yes
+# Single-binary profile: BUILDMODE=static LTO=yes EMBED_MODULES="hints stats ..."
+# compiles the listed C modules into kresd, so startup skips their dlopen()
+# and LTO can inline layer hooks into the resolve loop.
+EMBED_MODULES ?=
+LTO ?= no
 
 # Paths
 PREFIX ?= /usr/local
@@ -34,3 +39,6 @@ endif
 ifeq (,$(findstring -fsanitize=address,$(CFLAGS)))
 	BUILD_CFLAGS += -D_FORTIFY_SOURCE=2
 endif
+ifeq ($(LTO), yes)
+	BUILD_CFLAGS += -flto
+endif
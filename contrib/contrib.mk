@@ -5,6 +5,8 @@ contrib_SOURCES := \
 	contrib/ccan/json/json.c \
 	contrib/ucw/mempool.c \
 	contrib/murmurhash3/murmurhash3.c \
+	contrib/hash/hash.c \
+	contrib/hash/siphash.c \
 	contrib/base32hex.c \
 	contrib/base64.c
 contrib_CFLAGS := -fPIC
@@ -0,0 +1,158 @@
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "hash.h"
+#include "siphash.h"
+#include "contrib/murmurhash3/murmurhash3.h"
+
+/* 64-bit-lane hash after the xxHash64 round structure, placed in the
+ * public domain by Yann Collet. Loads go through memcpy, which compilers
+ * turn into single unaligned reads where the platform allows them. */
+
+#define PRIME64_1 0x9e3779b185ebca87ULL
+#define PRIME64_2 0xc2b2ae3d27d4eb4fULL
+#define PRIME64_3 0x165667b19e3779f9ULL
+#define PRIME64_4 0x85ebca77c2b2ae63ULL
+#define PRIME64_5 0x27d4eb2f165667c5ULL
+
+static inline uint64_t rotl64(uint64_t x, int8_t r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t load64(const char *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t load32(const char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t round64(uint64_t acc, uint64_t lane)
+{
+    acc += lane * PRIME64_2;
+    acc = rotl64(acc, 31);
+    return acc * PRIME64_1;
+}
+
+static uint32_t hash_wide(const char *data, size_t len)
+{
+    const char *p = data;
+    const char *end = data + len;
+    uint64_t h;
+
+    if (len >= 32) {
+        uint64_t v1 = PRIME64_1 + PRIME64_2;
+        uint64_t v2 = PRIME64_2;
+        uint64_t v3 = 0;
+        uint64_t v4 = -PRIME64_1;
+        do {
+            v1 = round64(v1, load64(p));      p += 8;
+            v2 = round64(v2, load64(p));      p += 8;
+            v3 = round64(v3, load64(p));      p += 8;
+            v4 = round64(v4, load64(p));      p += 8;
+        } while (p + 32 <= end);
+        h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        h = (h ^ round64(0, v1)) * PRIME64_1 + PRIME64_4;
+        h = (h ^ round64(0, v2)) * PRIME64_1 + PRIME64_4;
+        h = (h ^ round64(0, v3)) * PRIME64_1 + PRIME64_4;
+        h = (h ^ round64(0, v4)) * PRIME64_1 + PRIME64_4;
+    } else {
+        h = PRIME64_5;
+    }
+
+    h += (uint64_t)len;
+
+    while (p + 8 <= end) {
+        h ^= round64(0, load64(p));
+        h = rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+        p += 8;
+    }
+    if (p + 4 <= end) {
+        h ^= (uint64_t)load32(p) * PRIME64_1;
+        h = rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+    }
+    while (p < end) {
+        h ^= (uint8_t)*p * PRIME64_5;
+        h = rotl64(h, 11) * PRIME64_1;
+        p += 1;
+    }
+
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return (uint32_t)h ^ (uint32_t)(h >> 32);
+}
+
+static uint32_t hash_resolve(const char *data, size_t len);
+
+/** Resolved at first call, see hash_resolve(). */
+static uint32_t (*hash_fast_impl)(const char *, size_t) = hash_resolve;
+
+static uint32_t hash_resolve(const char *data, size_t len)
+{
+    /* 32-bit targets multiply 64-bit lanes in software, murmur wins there. */
+    if (sizeof(size_t) >= sizeof(uint64_t)) {
+        hash_fast_impl = hash_wide;
+    } else {
+        hash_fast_impl = (uint32_t (*)(const char *, size_t))hash;
+    }
+    return hash_fast_impl(data, len);
+}
+
+uint32_t hash_fast(const char *data, size_t len)
+{
+    return hash_fast_impl(data, len);
+}
+
+static uint8_t keyed_secret[SIPHASH_KEY_SIZE];
+static int keyed_ready = 0;
+
+/** Draw the per-process secret, mixing in a weak fallback if urandom fails. */
+static void keyed_init(void)
+{
+    FILE *fp = fopen("/dev/urandom", "r");
+    if (fp) {
+        if (fread(keyed_secret, sizeof(keyed_secret), 1, fp) != 1) {
+            /* Fall through to the weak mix below. */
+        }
+        fclose(fp);
+    }
+    struct timespec ts = { 0 };
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t mix[2] = {
+        (uint64_t)ts.tv_sec ^ (uint64_t)getpid(),
+        (uint64_t)ts.tv_nsec ^ (uint64_t)(uintptr_t)&keyed_secret
+    };
+    for (size_t i = 0; i < sizeof(keyed_secret); ++i) {
+        keyed_secret[i] ^= ((uint8_t *)mix)[i];
+    }
+    keyed_ready = 1;
+}
+
+void hash_keyed_init(void)
+{
+    if (!keyed_ready) {
+        keyed_init();
+    }
+}
+
+uint32_t hash_keyed(const char *data, size_t len)
+{
+    if (!keyed_ready) {
+        keyed_init();
+    }
+    const uint64_t h = siphash13(keyed_secret, data, len);
+    return (uint32_t)h ^ (uint32_t)(h >> 32);
+}
@@ -0,0 +1,32 @@
+/* Hash function front-end for in-memory tables.
+ *
+ * Two entry points with different contracts:
+ *
+ * - hash_fast() is the throughput choice for keys an attacker cannot pick.
+ *   It is resolved once at first use to the widest variant the platform
+ *   runs well, so callers always get the best lane width without ifdefs.
+ *
+ * - hash_keyed() folds the key through SipHash-1-3 with a secret drawn
+ *   once per process, so tables keyed by attacker-controlled input
+ *   (query names, source addresses) cannot be flooded into collisions.
+ *   A forking caller that shares keyed tables between its children must
+ *   call hash_keyed_init() before forking, so all of them inherit one
+ *   secret instead of each lazily drawing its own.
+ *
+ * Neither is stable across processes or restarts; anything persisted to
+ * disk must keep using the plain murmurhash3 hash(). */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/** Fast unkeyed hash, dispatched at first use. Not stable across runs. */
+uint32_t hash_fast(const char *data, size_t len);
+
+/** Keyed hash for attacker-controlled keys, secret drawn once per process. */
+uint32_t hash_keyed(const char *data, size_t len);
+
+/** Draw the hash_keyed() secret now instead of lazily at first use.
+  * Call before fork() when the children share keyed tables. */
+void hash_keyed_init(void);
@@ -0,0 +1,72 @@
+/* SipHash-1-3, derived from the SipHash reference implementation
+ * placed in the public domain by Jean-Philippe Aumasson and
+ * Daniel J. Bernstein. */
+
+#include <string.h>
+
+#include "siphash.h"
+
+static inline uint64_t rotl64(uint64_t x, int8_t r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read_le64(const uint8_t *p)
+{
+    return  (uint64_t)p[0]       | ((uint64_t)p[1] << 8)  |
+           ((uint64_t)p[2] << 16) | ((uint64_t)p[3] << 24) |
+           ((uint64_t)p[4] << 32) | ((uint64_t)p[5] << 40) |
+           ((uint64_t)p[6] << 48) | ((uint64_t)p[7] << 56);
+}
+
+#define SIPROUND \
+    do { \
+        v0 += v1; v1 = rotl64(v1, 13); v1 ^= v0; v0 = rotl64(v0, 32); \
+        v2 += v3; v3 = rotl64(v3, 16); v3 ^= v2; \
+        v0 += v3; v3 = rotl64(v3, 21); v3 ^= v0; \
+        v2 += v1; v1 = rotl64(v1, 17); v1 ^= v2; v2 = rotl64(v2, 32); \
+    } while (0)
+
+uint64_t siphash13(const uint8_t key[SIPHASH_KEY_SIZE], const void *data, size_t len)
+{
+    const uint64_t k0 = read_le64(key);
+    const uint64_t k1 = read_le64(key + 8);
+
+    uint64_t v0 = 0x736f6d6570736575ULL ^ k0;
+    uint64_t v1 = 0x646f72616e646f6dULL ^ k1;
+    uint64_t v2 = 0x6c7967656e657261ULL ^ k0;
+    uint64_t v3 = 0x7465646279746573ULL ^ k1;
+
+    const uint8_t *in = (const uint8_t *)data;
+    const uint8_t *end = in + (len & ~(size_t)7);
+
+    for (; in != end; in += 8) {
+        const uint64_t m = read_le64(in);
+        v3 ^= m;
+        SIPROUND;
+        v0 ^= m;
+    }
+
+    uint64_t b = (uint64_t)len << 56;
+    switch (len & 7) {
+        case 7: b |= (uint64_t)in[6] << 48; /* fallthrough */
+        case 6: b |= (uint64_t)in[5] << 40; /* fallthrough */
+        case 5: b |= (uint64_t)in[4] << 32; /* fallthrough */
+        case 4: b |= (uint64_t)in[3] << 24; /* fallthrough */
+        case 3: b |= (uint64_t)in[2] << 16; /* fallthrough */
+        case 2: b |= (uint64_t)in[1] << 8;  /* fallthrough */
+        case 1: b |= (uint64_t)in[0];       /* fallthrough */
+        case 0: break;
+    }
+
+    v3 ^= b;
+    SIPROUND;
+    v0 ^= b;
+
+    v2 ^= 0xff;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+
+    return v0 ^ v1 ^ v2 ^ v3;
+}
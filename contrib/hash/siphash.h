@@ -0,0 +1,13 @@
+/* SipHash-1-3, derived from the SipHash reference implementation
+ * placed in the public domain by Jean-Philippe Aumasson and
+ * Daniel J. Bernstein. */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define SIPHASH_KEY_SIZE 16
+
+/** Keyed 64-bit hash of the data with a 16-byte secret key. */
+uint64_t siphash13(const uint8_t key[SIPHASH_KEY_SIZE], const void *data, size_t len);
@@ -15,6 +15,11 @@
  */
 
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/time.h>
 #include <uv.h>
 #include <contrib/cleanup.h>
 #include <libknot/descriptor.h>
@@ -62,8 +67,8 @@ static int mod_list(lua_State *L)
 {
 	struct engine *engine = engine_luaget(L);
 	lua_newtable(L);
-	for (unsigned i = 0; i < engine->modules.len; ++i) {
-		struct kr_module *module = engine->modules.at[i];
+	for (unsigned i = 0; i < engine->modules->len; ++i) {
+		struct kr_module *module = engine->modules->at[i];
 		lua_pushstring(L, module->name);
 		lua_rawseti(L, -2, i + 1);
 	}
@@ -349,6 +354,148 @@ static int net_pipeline(lua_State *L)
 	return 1;
 }
 
+/** Set UDP probe race interval (happy-eyeballs for upstream queries). */
+static int net_race(lua_State *L)
+{
+	struct worker_ctx *worker = wrk_luaget(L);
+	if (!worker) {
+		return 0;
+	}
+	if (!lua_isnumber(L, 1)) {
+		lua_pushnumber(L, worker->udp_race);
+		return 1;
+	}
+	int interval = lua_tointeger(L, 1);
+	if (interval < 0 || interval > KR_CONN_RETRY) {
+		format_error(L, "race interval must be within <0, KR_CONN_RETRY>");
+		lua_error(L);
+	}
+	worker->udp_race = interval;
+	lua_pushnumber(L, interval);
+	return 1;
+}
+
+/** Route UDP clients to forks by query name or flow hash. */
+static int net_affinity(lua_State *L)
+{
+	struct engine *engine = engine_luaget(L);
+	struct worker_ctx *worker = wrk_luaget(L);
+	if (!engine || !worker) {
+		return 0;
+	}
+	bool by_flow = false;
+	if (lua_gettop(L) > 0) {
+		if (!lua_isstring(L, 1)) {
+			format_error(L, "expected 'affinity([string mode])'");
+			lua_error(L);
+		}
+		const char *mode = lua_tostring(L, 1);
+		if (strcmp(mode, "flow") == 0) {
+			by_flow = true;
+		} else if (strcmp(mode, "name") != 0) {
+			format_error(L, "mode must be 'name' or 'flow'");
+			lua_error(L);
+		}
+	}
+	int ret = network_affinity(&engine->net, worker->count, by_flow);
+	if (ret != 0) {
+		format_error(L, kr_strerror(ret));
+		lua_error(L);
+	}
+	lua_pushboolean(L, true);
+	return 1;
+}
+
+/** Set response rate limit per source prefix. */
+static int net_ratelimit(lua_State *L)
+{
+	struct worker_ctx *worker = wrk_luaget(L);
+	if (!worker) {
+		return 0;
+	}
+	if (!lua_isnumber(L, 1)) {
+		lua_pushnumber(L, worker->rrl_rate);
+		return 1;
+	}
+	int rate = lua_tointeger(L, 1);
+	if (rate < 0) {
+		format_error(L, "ratelimit must be >= 0 queries per second");
+		lua_error(L);
+	}
+	worker->rrl_rate = rate;
+	if (lua_isnumber(L, 2)) {
+		int slip = lua_tointeger(L, 2);
+		if (slip < 0) {
+			format_error(L, "slip must be >= 0");
+			lua_error(L);
+		}
+		worker->rrl_slip = slip;
+	}
+	lua_pushnumber(L, rate);
+	return 1;
+}
+
+/** Configure admission control and its load-shedding policy. */
+static int net_overload(lua_State *L)
+{
+	static const char *policies[] = { "off", "drop", "tc", "servfail" };
+	struct worker_ctx *worker = wrk_luaget(L);
+	if (!worker) {
+		return 0;
+	}
+	if (lua_gettop(L) == 0) {
+		lua_newtable(L);
+		lua_pushstring(L, policies[worker->load.policy]);
+		lua_setfield(L, -2, "policy");
+		lua_pushnumber(L, worker->load.max_tasks);
+		lua_setfield(L, -2, "tasks");
+		lua_pushnumber(L, worker->load.max_lag);
+		lua_setfield(L, -2, "lag");
+		lua_pushnumber(L, worker->load.shed);
+		lua_setfield(L, -2, "shed");
+		lua_pushnumber(L, worker->mem.budget / 1048576);
+		lua_setfield(L, -2, "mem");
+		lua_pushnumber(L, worker->mem.live);
+		lua_setfield(L, -2, "mem_live");
+		lua_pushnumber(L, worker->mem.high_water);
+		lua_setfield(L, -2, "mem_peak");
+		lua_pushnumber(L, worker->mem.spilled);
+		lua_setfield(L, -2, "mem_spilled");
+		return 1;
+	}
+	int max_tasks = lua_tointeger(L, 1);
+	if (!lua_isnumber(L, 1) || max_tasks < 0) {
+		format_error(L, "expected 'overload(max_tasks, [policy], [max_lag_ms], [max_mem_mb])'");
+		lua_error(L);
+	}
+	unsigned policy = SHED_TC;
+	if (lua_isstring(L, 2)) {
+		const char *name = lua_tostring(L, 2);
+		policy = SHED_NONE;
+		for (unsigned i = 0; i < sizeof(policies)/sizeof(policies[0]); ++i) {
+			if (strcmp(name, policies[i]) == 0) {
+				policy = i;
+				break;
+			}
+		}
+		if (policy == SHED_NONE && strcmp(name, "off") != 0) {
+			format_error(L, "policy must be 'off', 'drop', 'tc' or 'servfail'");
+			lua_error(L);
+		}
+	}
+	worker->load.max_tasks = max_tasks;
+	worker->load.max_lag = lua_isnumber(L, 3) ? lua_tointeger(L, 3) : 0;
+	worker->mem.budget = lua_isnumber(L, 4) ? (size_t)lua_tointeger(L, 4) * 1048576 : 0;
+	worker->load.policy = (max_tasks > 0 || worker->load.max_lag > 0 ||
+	                       worker->mem.budget > 0) ? policy : SHED_NONE;
+	if (worker->load.policy == SHED_NONE && worker->load.lag_timer_init) {
+		uv_timer_stop(&worker->load.lag_timer);
+		worker->load.lag = 0;
+	}
+	lua_pushboolean(L, worker->load.policy != SHED_NONE);
+	return 1;
+}
+
 static int net_tls(lua_State *L)
 {
 	struct engine *engine = engine_luaget(L);
@@ -389,6 +536,47 @@ static int net_tls(lua_State *L)
 	return 1;
 }
 
+/** @internal Visitor pushing map keys into the table on top of the Lua stack. */
+static int net_tls_client_get(const char *key, void *val, void *ext)
+{
+	lua_State *L = ext;
+	lua_pushstring(L, key);
+	lua_rawseti(L, -2, lua_rawlen(L, -2) + 1);
+	return kr_ok();
+}
+
+/** Configure upstream addresses that require DNS-over-TLS. */
+static int net_tls_client(lua_State *L)
+{
+	struct engine *engine = engine_luaget(L);
+	struct network *net = &engine->net;
+
+	/* Return current list. */
+	if (lua_gettop(L) == 0) {
+		lua_newtable(L);
+		map_walk(&net->tls_client, net_tls_client_get, L);
+		return 1;
+	}
+
+	if (!lua_istable(L, 1)) {
+		format_error(L, "net.tls_client takes a table of upstream addresses");
+		lua_error(L);
+	}
+
+	/* Replace the set; queries to these addresses then go over
+	 * persistent TLS connections, see worker_tls_connected(). */
+	map_clear(&net->tls_client);
+	lua_pushnil(L);
+	while (lua_next(L, 1) != 0) {
+		if (lua_isstring(L, -1)) {
+			map_set(&net->tls_client, lua_tostring(L, -1), (void *)1);
+		}
+		lua_pop(L, 1);
+	}
+	lua_pushboolean(L, true);
+	return 1;
+}
+
 int lib_net(lua_State *L)
 {
 	static const luaL_Reg lib[] = {
@@ -398,7 +586,12 @@ int lib_net(lua_State *L)
 		{ "interfaces",   net_interfaces },
 		{ "bufsize",      net_bufsize },
 		{ "tcp_pipeline", net_pipeline },
+		{ "race",         net_race },
+		{ "affinity",     net_affinity },
+		{ "ratelimit",    net_ratelimit },
+		{ "overload",     net_overload },
 		{ "tls",          net_tls },
+		{ "tls_client",   net_tls_client },
 		{ NULL, NULL }
 	};
 	register_lib(L, "net", lib);
@@ -448,6 +641,37 @@ static int cache_stats(lua_State *L)
 	lua_setfield(L, -2, "insert");
 	lua_pushnumber(L, cache->stats.delete);
 	lua_setfield(L, -2, "delete");
+	/* Breakdown by entry tag */
+	static const char *tag_name[KR_CACHE_TAGCOUNT] = { "rr", "pkt", "sig", "other" };
+	for (unsigned i = 0; i < KR_CACHE_TAGCOUNT; ++i) {
+		lua_newtable(L);
+		lua_pushnumber(L, cache->stats.tag[i].hit);
+		lua_setfield(L, -2, "hit");
+		lua_pushnumber(L, cache->stats.tag[i].miss);
+		lua_setfield(L, -2, "miss");
+		lua_pushnumber(L, cache->stats.tag[i].insert);
+		lua_setfield(L, -2, "insert");
+		lua_pushnumber(L, cache->stats.tag[i].delete);
+		lua_setfield(L, -2, "delete");
+		lua_setfield(L, -2, tag_name[i]);
+	}
+	/* Storage backend utilization */
+	struct kr_cdb_stats backend;
+	if (kr_cache_is_open(cache) && cache->api->stats &&
+	    cache->api->stats(cache->db, &backend) == 0) {
+		lua_pushnumber(L, backend.capacity);
+		lua_setfield(L, -2, "capacity");
+		lua_pushnumber(L, backend.used);
+		lua_setfield(L, -2, "used");
+		lua_pushnumber(L, backend.fragmented);
+		lua_setfield(L, -2, "fragmented");
+		lua_pushnumber(L, backend.commits);
+		lua_setfield(L, -2, "commits");
+		lua_pushnumber(L, backend.failed);
+		lua_setfield(L, -2, "failed");
+		lua_pushnumber(L, backend.hugepages);
+		lua_setfield(L, -2, "hugepages");
+	}
 	return 1;
 }
 
@@ -476,7 +700,7 @@ static int cache_open(lua_State *L)
 	/* Check parameters */
 	int n = lua_gettop(L);
 	if (n < 1 || !lua_isnumber(L, 1)) {
-		format_error(L, "expected 'open(number max_size, string config = \"\")'");
+		format_error(L, "expected 'open(number max_size, string config = \"\", number shards = 1, boolean hugepages = false, boolean prefetch = false)'");
 		lua_error(L);
 	}
 
@@ -499,12 +723,31 @@ static int cache_open(lua_State *L)
 		(conf && strlen(conf)) ? conf : ".",
 		cache_size
 	};
+	if (n > 2 && lua_isnumber(L, 3)) {
+		opts.shards = lua_tointeger(L, 3);
+	}
+	if (n > 3 && lua_isboolean(L, 4)) {
+		opts.hugepages = lua_toboolean(L, 4);
+	}
+	if (n > 4 && lua_isboolean(L, 5)) {
+		opts.prefetch = lua_toboolean(L, 5);
+	}
 	int ret = kr_cache_open(&engine->resolver.cache, api, &opts, engine->pool);
 	if (ret != 0) {
 		format_error(L, "can't open cache");
 		lua_error(L);
 	}
 
+	/* The negative-lookup filter doesn't see inserts from other
+	 * processes, so it's only useful without forked workers. */
+	struct worker_ctx *worker = wrk_luaget(L);
+	if (worker && worker->count == 1) {
+		(void) kr_cache_filter(&engine->resolver.cache, true);
+	}
+
+	/* Insertions are applied from loop idle time, see flush_deferred(). */
+	(void) kr_cache_defer(&engine->resolver.cache, true);
+
 	/* Store current configuration */
 	lua_getglobal(L, "cache");
 	lua_pushstring(L, "current_size");
@@ -558,34 +801,33 @@ static int cache_prefixed(struct kr_cache *cache, const char *args, knot_db_val_
 	return kr_cache_match(cache, namespace, buf, results, maxresults);
 }
 
-/** @internal Delete iterated key. */
+/** @internal Delete a subtree of records.
+ * An explicit 'name namespace' argument limits the removal to one
+ * namespace, otherwise records, signatures and packets all go. */
 static int cache_remove_prefix(struct kr_cache *cache, const char *args)
 {
-	/* Check if we can remove */
-	if (!cache || !cache->api || !cache->api->remove) {
-		return kr_error(ENOSYS);
+	/* Decode parameters */
+	uint8_t tags[] = { KR_CACHE_RR, KR_CACHE_SIG, KR_CACHE_PKT };
+	unsigned tagcount = sizeof(tags);
+	char *extra = (char *)strchr(args, ' ');
+	if (extra != NULL) {
+		extra[0] = '\0';
+		tags[0] = extra[1];
+		tagcount = 1;
 	}
-	static knot_db_val_t result_set[1000];
-	int ret = cache_prefixed(cache, args, result_set, 1000);
-	if (ret < 0) {
-		return ret;
+	uint8_t buf[KNOT_DNAME_MAXLEN];
+	if (!knot_dname_from_str(buf, args, sizeof(buf))) {
+		return kr_error(EINVAL);
 	}
-	/* Duplicate result set as we're going to remove it
-	 * which will invalidate result set. */
-	for (int i = 0; i < ret; ++i) {
-		void *dst = malloc(result_set[i].len);
-		if (!dst) {
-			return kr_error(ENOMEM);
+	int removed = 0;
+	for (unsigned i = 0; i < tagcount; ++i) {
+		int ret = kr_cache_remove_subtree(cache, tags[i], buf, 1000);
+		if (ret < 0) {
+			return ret;
 		}
-		memcpy(dst, result_set[i].data, result_set[i].len);
-		result_set[i].data = dst;
-	}
-	cache->api->remove(cache->db, result_set, ret);
-	/* Free keys */
-	for (int i = 0; i < ret; ++i) {
-		free(result_set[i].data);
+		removed += ret;
 	}
-	return ret;
+	return removed;
 }
 
 /** Prune expired/invalid records. */
@@ -618,6 +860,138 @@ static int cache_prune(lua_State *L)
 	return 1;
 }
 
+/** Collect one batch of expired records. */
+static int cache_gc(lua_State *L)
+{
+	struct engine *engine = engine_luaget(L);
+	struct kr_cache *cache = &engine->resolver.cache;
+	if (!kr_cache_is_open(cache)) {
+		return 0;
+	}
+
+	/* Check parameters */
+	int batch = 0;
+	int n = lua_gettop(L);
+	if (n >= 1 && lua_isnumber(L, 1)) {
+		batch = lua_tointeger(L, 1);
+	}
+
+	int ret = kr_cache_gc(cache, batch);
+	if (ret < 0) {
+		format_error(L, kr_strerror(ret));
+		lua_error(L);
+	}
+	lua_pushinteger(L, ret);
+	return 1;
+}
+
+/** Dump a warmup snapshot of the cache. */
+static int cache_snapshot(lua_State *L)
+{
+	struct engine *engine = engine_luaget(L);
+	struct kr_cache *cache = &engine->resolver.cache;
+	if (!kr_cache_is_open(cache)) {
+		return 0;
+	}
+
+	/* Check parameters */
+	int n = lua_gettop(L);
+	if (n < 1 || !lua_isstring(L, 1)) {
+		format_error(L, "expected 'snapshot(string path)'");
+		lua_error(L);
+	}
+
+	int ret = kr_cache_snapshot(cache, lua_tostring(L, 1));
+	if (ret < 0) {
+		format_error(L, kr_strerror(ret));
+		lua_error(L);
+	}
+	lua_pushinteger(L, ret);
+	return 1;
+}
+
+/** @internal Resolve a path/descriptor argument to a descriptor.
+ * A number is taken as an already open descriptor (e.g. a connected
+ * socket), a string is opened with the given flags. */
+static int cache_stream_fd(lua_State *L, int idx, int flags, bool *opened)
+{
+	*opened = false;
+	if (lua_type(L, idx) == LUA_TNUMBER) {
+		return lua_tointeger(L, idx);
+	}
+	if (lua_type(L, idx) != LUA_TSTRING) {
+		return kr_error(EINVAL);
+	}
+	int fd = open(lua_tostring(L, idx), flags, 0644);
+	if (fd < 0) {
+		return kr_error(errno);
+	}
+	*opened = true;
+	return fd;
+}
+
+/** Stream live records to a file or a connected descriptor. */
+static int cache_export(lua_State *L)
+{
+	struct engine *engine = engine_luaget(L);
+	struct kr_cache *cache = &engine->resolver.cache;
+	if (!kr_cache_is_open(cache)) {
+		return 0;
+	}
+
+	/* Check parameters */
+	int n = lua_gettop(L);
+	if (n < 1) {
+		format_error(L, "expected 'export(string path|number fd[, number rank[, number ttl]])'");
+		lua_error(L);
+	}
+	uint8_t min_rank = (n >= 2 && lua_isnumber(L, 2)) ? lua_tointeger(L, 2) : 0;
+	uint32_t min_ttl = (n >= 3 && lua_isnumber(L, 3)) ? lua_tointeger(L, 3) : 0;
+
+	bool opened = false;
+	int fd = cache_stream_fd(L, 1, O_WRONLY|O_CREAT|O_TRUNC, &opened);
+	int ret = fd < 0 ? fd : kr_cache_export(cache, fd, min_rank, min_ttl);
+	if (opened) {
+		close(fd);
+	}
+	if (ret < 0) {
+		format_error(L, kr_strerror(ret));
+		lua_error(L);
+	}
+	lua_pushinteger(L, ret);
+	return 1;
+}
+
+/** Bulk-load records from a file or a connected descriptor. */
+static int cache_import(lua_State *L)
+{
+	struct engine *engine = engine_luaget(L);
+	struct kr_cache *cache = &engine->resolver.cache;
+	if (!kr_cache_is_open(cache)) {
+		return 0;
+	}
+
+	/* Check parameters */
+	int n = lua_gettop(L);
+	if (n < 1) {
+		format_error(L, "expected 'import(string path|number fd)'");
+		lua_error(L);
+	}
+
+	bool opened = false;
+	int fd = cache_stream_fd(L, 1, O_RDONLY, &opened);
+	int ret = fd < 0 ? fd : kr_cache_import(cache, fd);
+	if (opened) {
+		close(fd);
+	}
+	if (ret < 0) {
+		format_error(L, kr_strerror(ret));
+		lua_error(L);
+	}
+	lua_pushinteger(L, ret);
+	return 1;
+}
+
 /** Clear all records. */
 static int cache_clear(lua_State *L)
 {
@@ -652,17 +1026,52 @@ static int cache_clear(lua_State *L)
 		lua_error(L);
 	}
 
-	/* Clear reputation tables */
-	lru_deinit(engine->resolver.cache_rtt);
-	lru_deinit(engine->resolver.cache_rep);
-	lru_init(engine->resolver.cache_rtt, LRU_RTT_SIZE);
-	lru_init(engine->resolver.cache_rep, LRU_REP_SIZE);
+	/* Clear reputation tables; reset keeps them valid
+	 * even when they live in the shared fork segment. */
+	lru_reset(engine->resolver.cache_rtt);
+	lru_reset(engine->resolver.cache_rep);
 	lru_deinit(engine->resolver.cache_cookie);
 	lru_init(engine->resolver.cache_cookie, LRU_COOKIES_SIZE);
 	lua_pushboolean(L, true);
 	return 1;
 }
 
+/** Clamp remaining TTL of a subtree. */
+static int cache_expire(lua_State *L)
+{
+	struct engine *engine = engine_luaget(L);
+	struct kr_cache *cache = &engine->resolver.cache;
+	if (!kr_cache_is_open(cache)) {
+		return 0;
+	}
+
+	/* Check parameters */
+	int n = lua_gettop(L);
+	if (n < 1 || !lua_isstring(L, 1)) {
+		format_error(L, "expected 'expire(string name[, number ttl])'");
+		lua_error(L);
+	}
+	uint32_t maxttl = (n >= 2 && lua_isnumber(L, 2)) ? lua_tointeger(L, 2) : 0;
+	uint8_t buf[KNOT_DNAME_MAXLEN];
+	if (!knot_dname_from_str(buf, lua_tostring(L, 1), sizeof(buf))) {
+		format_error(L, "invalid name");
+		lua_error(L);
+	}
+
+	const uint8_t tags[] = { KR_CACHE_RR, KR_CACHE_SIG, KR_CACHE_PKT };
+	int adjusted = 0;
+	for (unsigned i = 0; i < sizeof(tags); ++i) {
+		int ret = kr_cache_ttl_subtree(cache, tags[i], buf, maxttl, 1000);
+		if (ret < 0) {
+			format_error(L, kr_strerror(ret));
+			lua_error(L);
+		}
+		adjusted += ret;
+	}
+	lua_pushinteger(L, adjusted);
+	return 1;
+}
+
 /** @internal Dump cache key into table on Lua stack. */
 static void cache_dump_key(lua_State *L, knot_db_val_t *key)
 {
@@ -734,6 +1143,27 @@ static int cache_get(lua_State *L)
 	return 1;
 }
 
+/** Register a zone anchor for cache key compression. */
+static int cache_anchor(lua_State *L)
+{
+	if (lua_gettop(L) < 1 || !lua_isstring(L, 1)) {
+		format_error(L, "expected 'cache.anchor(string zone)'");
+		lua_error(L);
+	}
+	uint8_t zone[KNOT_DNAME_MAXLEN];
+	if (!knot_dname_from_str(zone, lua_tostring(L, 1), sizeof(zone))) {
+		format_error(L, "invalid zone name");
+		lua_error(L);
+	}
+	struct engine *engine = engine_luaget(L);
+	if (kr_cache_anchor(&engine->resolver.cache, zone) != 0) {
+		format_error(L, "can't add anchor (cache closed or table full)");
+		lua_error(L);
+	}
+	lua_pushboolean(L, 1);
+	return 1;
+}
+
 int lib_cache(lua_State *L)
 {
 	static const luaL_Reg lib[] = {
@@ -743,8 +1173,14 @@ int lib_cache(lua_State *L)
 		{ "open",   cache_open },
 		{ "close",  cache_close },
 		{ "prune",  cache_prune },
+		{ "gc",     cache_gc },
+		{ "snapshot", cache_snapshot },
+		{ "export", cache_export },
+		{ "import", cache_import },
 		{ "clear",  cache_clear },
+		{ "expire", cache_expire },
 		{ "get",    cache_get },
+		{ "anchor", cache_anchor },
 		{ NULL, NULL }
 	};
 
@@ -1087,6 +1523,22 @@ static int wrk_stats(lua_State *L)
 	lua_setfield(L, -2, "dropped");
 	lua_pushnumber(L, worker->stats.timeout);
 	lua_setfield(L, -2, "timeout");
+	lua_pushnumber(L, worker->stats.grafted);
+	lua_setfield(L, -2, "grafted");
+	/* Freelist occupancy and trimming counters. */
+	lua_pushnumber(L, worker->pool_mp.len);
+	lua_setfield(L, -2, "pool_mp");
+	lua_pushnumber(L, worker->pool_ioreq.len);
+	lua_setfield(L, -2, "pool_ioreq");
+	lua_pushnumber(L, worker->pool_sessions.len);
+	lua_setfield(L, -2, "pool_sessions");
+	lua_pushnumber(L, worker->pool_rbufs.len);
+	lua_setfield(L, -2, "pool_rbufs");
+	lua_pushnumber(L, worker->pool_mp.trimmed + worker->pool_ioreq.trimmed +
+	                  worker->pool_sessions.trimmed + worker->pool_rbufs.trimmed);
+	lua_setfield(L, -2, "pool_trimmed");
+	lua_pushnumber(L, worker->pool_ioreq.refills + worker->pool_sessions.refills);
+	lua_setfield(L, -2, "pool_refills");
 	/* Add subset of rusage that represents counters. */
 	uv_rusage_t rusage;
 	if (uv_getrusage(&rusage) == 0) {
@@ -1110,11 +1562,167 @@ static int wrk_stats(lua_State *L)
 	return 1;
 }
 
+/** Slow-query log: worker.slowlog(ms) sets the threshold (0 disables),
+  * worker.slowlog() drains and returns the recorded entries. */
+static int wrk_slowlog(lua_State *L)
+{
+	struct worker_ctx *worker = wrk_luaget(L);
+	if (!worker) {
+		return 0;
+	}
+	if (lua_gettop(L) > 0) {
+		if (!lua_isnumber(L, 1)) {
+			format_error(L, "expected 'slowlog(number ms)'");
+			lua_error(L);
+		}
+		worker->slowlog.threshold_us = lua_tonumber(L, 1) * 1000;
+		worker->slowlog.head = worker->slowlog.len = 0;
+		lua_pushboolean(L, 1);
+		return 1;
+	}
+	lua_newtable(L);
+	/* Walk the ring oldest first. */
+	size_t len = worker->slowlog.len;
+	size_t first = (SLOWLOG_COUNT + worker->slowlog.head - len) % SLOWLOG_COUNT;
+	for (size_t i = 0; i < len; ++i) {
+		struct slow_query *entry = &worker->slowlog.q[(first + i) % SLOWLOG_COUNT];
+		lua_newtable(L);
+		char qname_str[KNOT_DNAME_TXT_MAXLEN];
+		if (knot_dname_to_str(qname_str, entry->qname, sizeof(qname_str))) {
+			lua_pushstring(L, qname_str);
+			lua_setfield(L, -2, "qname");
+		}
+		lua_pushnumber(L, entry->qtype);
+		lua_setfield(L, -2, "qtype");
+		lua_pushnumber(L, entry->elapsed_us / 1000.0);
+		lua_setfield(L, -2, "ms");
+		lua_pushnumber(L, entry->round_trips);
+		lua_setfield(L, -2, "round_trips");
+		lua_pushnumber(L, entry->pool_bytes);
+		lua_setfield(L, -2, "pool_bytes");
+		const char *ns_str = kr_straddr((const struct sockaddr *)&entry->last_ns);
+		if (ns_str) {
+			lua_pushstring(L, ns_str);
+			lua_setfield(L, -2, "last_ns");
+		}
+		if (entry->trace_len > 0) {
+			static const char *phase_name[KR_TRACE_COUNT] = {
+				"submit", "consume", "produce", "send", "finish"
+			};
+			lua_newtable(L);
+			for (unsigned t = 0; t < entry->trace_len; ++t) {
+				lua_newtable(L);
+				lua_pushstring(L, phase_name[entry->trace[t].phase % KR_TRACE_COUNT]);
+				lua_setfield(L, -2, "phase");
+				lua_pushnumber(L, entry->trace[t].us);
+				lua_setfield(L, -2, "us");
+				lua_rawseti(L, -2, t + 1);
+			}
+			lua_setfield(L, -2, "trace");
+		}
+		lua_rawseti(L, -2, i + 1);
+	}
+	/* Reading drains the buffer. */
+	worker->slowlog.head = worker->slowlog.len = 0;
+	return 1;
+}
+
+/** Loop-lag watchdog: worker.stalls(ms) arms it with a per-turn busy budget
+  * (0 disarms), worker.stalls() returns the counters with per-cause
+  * attribution. */
+static int wrk_stalls(lua_State *L)
+{
+	struct worker_ctx *worker = wrk_luaget(L);
+	if (!worker) {
+		return 0;
+	}
+	if (lua_gettop(L) > 0) {
+		if (!lua_isnumber(L, 1)) {
+			format_error(L, "expected 'stalls(number ms)'");
+			lua_error(L);
+		}
+		int ret = worker_watchdog(worker, lua_tonumber(L, 1));
+		lua_pushboolean(L, ret == 0);
+		return 1;
+	}
+	lua_newtable(L);
+	lua_pushnumber(L, worker->watchdog.budget_ns / 1000000.0);
+	lua_setfield(L, -2, "budget_ms");
+	lua_pushnumber(L, worker->watchdog.stalls);
+	lua_setfield(L, -2, "count");
+	lua_pushnumber(L, worker->watchdog.worst_ns / 1000000.0);
+	lua_setfield(L, -2, "worst_ms");
+	lua_newtable(L);
+	for (unsigned i = 0; i < WATCHDOG_SLOTS; ++i) {
+		const struct stall_source *s = &worker->watchdog.source[i];
+		if (s->name[0] == '\0') {
+			break;
+		}
+		lua_newtable(L);
+		lua_pushnumber(L, s->count);
+		lua_setfield(L, -2, "count");
+		lua_pushnumber(L, s->ns / 1000000.0);
+		lua_setfield(L, -2, "ms");
+		lua_setfield(L, -2, s->name);
+	}
+	lua_setfield(L, -2, "sources");
+	return 1;
+}
+
+/** @internal Async-signal-safe sample of the current resolution phase. */
+static void profile_sample(int signum)
+{
+	kr_activity_samples[kr_activity] += 1;
+}
+
+/** Sampling profiler: worker.profile(hz) starts wall-clock sampling of the
+  * current resolution phase (0 stops it), worker.profile() returns the
+  * per-phase sample counts. */
+static int wrk_profile(lua_State *L)
+{
+	static const char *phase_name[KR_ACTIVITY_COUNT] = {
+		"idle", "begin", "reset", "finish", "consume", "produce"
+	};
+	if (lua_gettop(L) > 0) {
+		if (!lua_isnumber(L, 1)) {
+			format_error(L, "expected 'profile(number hz)'");
+			lua_error(L);
+		}
+		int hz = lua_tonumber(L, 1);
+		struct itimerval tv;
+		memset(&tv, 0, sizeof(tv));
+		if (hz > 0) {
+			memset(kr_activity_samples, 0, sizeof(kr_activity_samples));
+			struct sigaction sa;
+			memset(&sa, 0, sizeof(sa));
+			sa.sa_handler = profile_sample;
+			sa.sa_flags = SA_RESTART;
+			sigaction(SIGALRM, &sa, NULL);
+			tv.it_interval.tv_usec = 1000000 / hz;
+			tv.it_value = tv.it_interval;
+		} else {
+			signal(SIGALRM, SIG_IGN);
+		}
+		setitimer(ITIMER_REAL, &tv, NULL);
+		lua_pushboolean(L, 1);
+		return 1;
+	}
+	lua_newtable(L);
+	for (unsigned i = 0; i < KR_ACTIVITY_COUNT; ++i) {
+		lua_pushnumber(L, kr_activity_samples[i]);
+		lua_setfield(L, -2, phase_name[i]);
+	}
+	return 1;
+}
+
 int lib_worker(lua_State *L)
 {
 	static const luaL_Reg lib[] = {
 		{ "resolve",  wrk_resolve },
 		{ "stats",    wrk_stats },
+		{ "slowlog",  wrk_slowlog },
+		{ "stalls",   wrk_stalls },
+		{ "profile",  wrk_profile },
 		{ NULL, NULL }
 	};
 	register_lib(L, "worker", lib);
@@ -10,9 +10,26 @@ kresd_SOURCES := \
 
 kresd_DIST := daemon/lua/kres.lua daemon/lua/trust_anchors.lua
 
-# Embedded resources
+# Compile selected C modules into the binary (see EMBED_MODULES in config.mk).
+# Their symbols must stay in the dynamic table, as module loading resolves
+# them from the program itself before trying dlopen().
+ifneq ($(strip $(EMBED_MODULES)),)
+kresd_SOURCES += $(foreach m,$(EMBED_MODULES),$(wildcard modules/$(m)/*.c))
+kresd_LDFLAGS += -Wl,--export-dynamic
+endif
+
+# Embedded resources, precompiled to LuaJIT bytecode when the compiler
+# is around so forks skip parsing the bundled scripts at startup.
+LUAJIT_BIN ?= $(shell command -v luajit 2>/dev/null)
+ifneq ($(LUAJIT_BIN),)
+%.inc: %.lua
+	@$(LUAJIT_BIN) -b -g $< $<.raw
+	@$(call quiet,XXD,$<) $<.raw > $@
+	@$(RM) $<.raw
+else
 %.inc: %.lua
 	@$(call quiet,XXD,$<) $< > $@
+endif
 ifeq ($(AMALG), yes)
 kresd.amalg.c: daemon/lua/sandbox.inc daemon/lua/config.inc
 else
@@ -19,6 +19,9 @@
 #include <ccan/asprintf/asprintf.h>
 #include <uv.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
 #include <grp.h>
 #include <pwd.h>
 #include <zscanner/scanner.h>
@@ -444,13 +447,23 @@ static int l_trampoline(lua_State *L)
  * Engine API.
  */
 
+/** @internal Parsed keys are heap-allocated, free them on eviction. */
+static void dnskey_cache_evict(void *baton, void *val)
+{
+	kr_dnssec_key_free((struct dseckey **)val);
+}
+
 static int init_resolver(struct engine *engine)
 {
 	/* Open resolution context */
 	engine->resolver.trust_anchors = map_make();
 	engine->resolver.negative_anchors = map_make();
 	engine->resolver.pool = engine->pool;
-	engine->resolver.modules = &engine->modules;
+	engine->modules = modules_gen_new();
+	if (!engine->modules) {
+		return kr_error(ENOMEM);
+	}
+	engine->resolver.modules = engine->modules;
 	/* Create OPT RR */
 	engine->resolver.opt_rr = mm_alloc(engine->pool, sizeof(knot_rrset_t));
 	if (!engine->resolver.opt_rr) {
@@ -461,7 +474,7 @@ static int init_resolver(struct engine *engine)
 	kr_zonecut_init(&engine->resolver.root_hints, (const uint8_t *)"", engine->pool);
 	kr_zonecut_set_sbelt(&engine->resolver, &engine->resolver.root_hints);
 	/* Open NS rtt + reputation cache */
-	engine->resolver.cache_rtt = mm_alloc(engine->pool, lru_size(kr_nsrep_lru_t, LRU_RTT_SIZE));
+	engine->resolver.cache_rtt = mm_alloc(engine->pool, lru_size(kr_nsrep_rtt_lru_t, LRU_RTT_SIZE));
 	if (engine->resolver.cache_rtt) {
 		lru_init(engine->resolver.cache_rtt, LRU_RTT_SIZE);
 	}
@@ -469,10 +482,19 @@ static int init_resolver(struct engine *engine)
 	if (engine->resolver.cache_rep) {
 		lru_init(engine->resolver.cache_rep, LRU_REP_SIZE);
 	}
+	engine->resolver.cache_busy = mm_alloc(engine->pool, lru_size(kr_zonecut_busy_lru_t, LRU_BUSY_SIZE));
+	if (engine->resolver.cache_busy) {
+		lru_init(engine->resolver.cache_busy, LRU_BUSY_SIZE);
+	}
 	engine->resolver.cache_cookie = mm_alloc(engine->pool, lru_size(kr_cookie_lru_t, LRU_COOKIES_SIZE));
 	if (engine->resolver.cache_cookie) {
 		lru_init(engine->resolver.cache_cookie, LRU_COOKIES_SIZE);
 	}
+	engine->resolver.cache_dnskey = mm_alloc(engine->pool, lru_size(kr_dnskey_lru_t, LRU_DNSKEY_SIZE));
+	if (engine->resolver.cache_dnskey) {
+		lru_init(engine->resolver.cache_dnskey, LRU_DNSKEY_SIZE);
+		engine->resolver.cache_dnskey->evict = dnskey_cache_evict;
+	}
 
 	/* Load basic modules */
 	engine_register(engine, "iterate", NULL, NULL);
@@ -523,22 +545,117 @@ static int init_state(struct engine *engine)
 	return kr_ok();
 }
 
+static void flush_deferred(uv_check_t *handle)
+{
+	struct engine *engine = handle->data;
+	struct kr_cache *cache = &engine->resolver.cache;
+	if (!kr_cache_is_open(cache)) {
+		return;
+	}
+	/* Answers for this loop turn are already sent, apply queued
+	 * insertions now so their latency stays off the response path. */
+	if (cache->defer.count > 0) {
+		int ret = kr_cache_commit(cache, 0);
+		if (ret == kr_error(ENOSPC)) {
+			ret = kr_cache_clear(cache);
+			if (ret != 0 && ret != kr_error(EEXIST)) {
+				kr_log_error("[cache] failed to clear cache: %s\n", kr_strerror(ret));
+			}
+		}
+	}
+	/* Commit any write batch the backend staged during this turn.
+	 * The LMDB write mutex is shared between the forked workers, so a
+	 * staged transaction must never be held while this loop sits idle
+	 * in poll - it would block every other fork's writes. */
+	kr_cache_sync(cache);
+}
+
 static void update_state(uv_timer_t *handle)
 {
 	struct engine *engine = handle->data;
 
 	/* Walk RTT table, clearing all entries with bad score
 	 * to compensate for intermittent network issues or temporary bad behaviour. */
-	kr_nsrep_lru_t *table = engine->resolver.cache_rtt;
+	kr_nsrep_rtt_lru_t *table = engine->resolver.cache_rtt;
+	uint32_t now = time(NULL);
 	for (size_t i = 0; i < table->size; ++i) {
 		if (!table->slots[i].key)
 			continue;
-		if (table->slots[i].data > KR_NS_LONG) {
+		if (kr_nsrep_rtt_score(&table->slots[i].data, now) > KR_NS_LONG) {
 			lru_evict(table, i);
 		}
 	}
 }
 
+/*
+ * Module list generations.
+ *
+ * The module array is read in many places -- property dispatch, layer
+ * compilation, stats walks -- and mutated by load/unload on the control
+ * path, possibly from a callback that is itself iterating the list.
+ * Updates therefore never touch the published array: writers build a new
+ * generation and flip a single pointer, so any reader keeps a consistent
+ * snapshot, and replaced generations are reclaimed only at the next
+ * event-loop turn (see gc_step), when no reader from the previous turn
+ * can still hold one.  The layer dispatch tables follow the same scheme
+ * with in-flight requests pinning their generation, see
+ * kr_context_compile_layers().
+ */
+
+/** @internal Allocate an empty module list generation. */
+static module_array_t *modules_gen_new(void)
+{
+	module_array_t *list = malloc(sizeof(*list));
+	if (list) {
+		array_init(*list);
+	}
+	return list;
+}
+
+static void modules_gen_free(module_array_t *list)
+{
+	if (list) {
+		array_clear(*list);
+		free(list);
+	}
+}
+
+/** @internal Clone the current generation (module pointers only). */
+static module_array_t *modules_gen_clone(const module_array_t *current)
+{
+	module_array_t *next = modules_gen_new();
+	if (!next) {
+		return NULL;
+	}
+	for (size_t i = 0; i < current->len; ++i) {
+		if (array_push(*next, current->at[i]) < 0) {
+			modules_gen_free(next);
+			return NULL;
+		}
+	}
+	return next;
+}
+
+/** @internal Publish a new generation and park the replaced one. */
+static void modules_gen_flip(struct engine *engine, module_array_t *next)
+{
+	module_array_t *old = engine->modules;
+	engine->modules = next;
+	engine->resolver.modules = next;
+	if (old && array_push(engine->modules_retired, old) < 0) {
+		modules_gen_free(old); /* OOM, grace period degraded. */
+	}
+}
+
+/** @internal Free replaced generations, called at loop-turn boundaries. */
+static void modules_gen_reclaim(struct engine *engine)
+{
+	for (size_t i = 0; i < engine->modules_retired.len; ++i) {
+		modules_gen_free(engine->modules_retired.at[i]);
+	}
+	engine->modules_retired.len = 0;
+}
+
 int engine_init(struct engine *engine, knot_mm_t *pool)
 {
 	if (engine == NULL) {
@@ -565,6 +682,89 @@ int engine_init(struct engine *engine, knot_mm_t *pool)
 	return ret;
 }
 
+struct engine_shm_slot *engine_shm_create(int forks)
+{
+	if (forks < 2) {
+		return NULL;
+	}
+#if defined(MAP_ANONYMOUS) || defined(MAP_ANON)
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+	void *shm = mmap(NULL, forks * sizeof(struct engine_shm_slot),
+	                 PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	if (shm == MAP_FAILED) {
+		return NULL;
+	}
+	memset(shm, 0, forks * sizeof(struct engine_shm_slot));
+	return shm;
+#else
+	return NULL;
+#endif
+}
+
+void engine_shm_free(struct engine_shm_slot *shm, int forks)
+{
+	if (shm) {
+		munmap(shm, forks * sizeof(struct engine_shm_slot));
+	}
+}
+
+/** Layout of the shared NS reputation segment: the RTT table, then the
+ * reputation table, both with inline keys (see lru_init_inline()).
+ * Updates from the forks are unsynchronised on purpose - a torn entry
+ * reads as a miss - the tables are approximate either way. */
+struct engine_shm_nsrep {
+	size_t size;       /**< Total mapping length. */
+	size_t rep_offset; /**< Offset of the reputation table in data[]. */
+	char data[];
+};
+
+struct engine_shm_nsrep *engine_shm_nsrep_create(int forks)
+{
+	if (forks < 2) {
+		return NULL;
+	}
+#if defined(MAP_ANONYMOUS) || defined(MAP_ANON)
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+	const size_t rtt_len = lru_size_inline(kr_nsrep_rtt_lru_t, LRU_RTT_SIZE, LRU_RTT_KEY_LEN);
+	const size_t rep_len = lru_size_inline(kr_nsrep_lru_t, LRU_REP_SIZE, LRU_REP_KEY_LEN);
+	const size_t total = sizeof(struct engine_shm_nsrep) + rtt_len + rep_len;
+	struct engine_shm_nsrep *shm = mmap(NULL, total,
+	                 PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	if (shm == MAP_FAILED) {
+		return NULL;
+	}
+	shm->size = total;
+	shm->rep_offset = rtt_len;
+	lru_init_inline((kr_nsrep_rtt_lru_t *)shm->data, LRU_RTT_SIZE, LRU_RTT_KEY_LEN);
+	lru_init_inline((kr_nsrep_lru_t *)(shm->data + shm->rep_offset), LRU_REP_SIZE, LRU_REP_KEY_LEN);
+	return shm;
+#else
+	return NULL;
+#endif
+}
+
+void engine_shm_nsrep_attach(struct engine *engine, struct engine_shm_nsrep *shm)
+{
+	if (!engine || !shm) {
+		return;
+	}
+	/* The pool-allocated private tables are abandoned here,
+	 * they are reclaimed with the engine pool. */
+	engine->resolver.cache_rtt = (kr_nsrep_rtt_lru_t *)shm->data;
+	engine->resolver.cache_rep = (kr_nsrep_lru_t *)(shm->data + shm->rep_offset);
+}
+
+void engine_shm_nsrep_free(struct engine_shm_nsrep *shm)
+{
+	if (shm) {
+		munmap(shm, shm->size);
+	}
+}
+
 static void engine_unload(struct engine *engine, struct kr_module *module)
 {
 	/* Unregister module */
@@ -591,7 +791,9 @@ void engine_deinit(struct engine *engine)
 	kr_cache_close(&engine->resolver.cache);
 	lru_deinit(engine->resolver.cache_rtt);
 	lru_deinit(engine->resolver.cache_rep);
+	lru_deinit(engine->resolver.cache_busy);
 	lru_deinit(engine->resolver.cache_cookie);
+	lru_deinit(engine->resolver.cache_dnskey);
 
 	/* Clear IPC pipes */
 	for (size_t i = 0; i < engine->ipc_set.len; ++i) {
@@ -599,15 +801,21 @@ void engine_deinit(struct engine *engine)
 	}
 
 	/* Unload modules and engine. */
-	for (size_t i = 0; i < engine->modules.len; ++i) {
-		engine_unload(engine, engine->modules.at[i]);
+	if (engine->modules) {
+		for (size_t i = 0; i < engine->modules->len; ++i) {
+			engine_unload(engine, engine->modules->at[i]);
+		}
 	}
 	if (engine->L) {
 		lua_close(engine->L);
 	}
 
 	/* Free data structures */
-	array_clear(engine->modules);
+	modules_gen_free(engine->modules);
+	engine->modules = NULL;
+	modules_gen_reclaim(engine);
+	array_clear(engine->modules_retired);
+	kr_context_free_layers(&engine->resolver);
 	array_clear(engine->backends);
 	array_clear(engine->ipc_set);
 	kr_ta_clear(&engine->resolver.trust_anchors);
@@ -657,9 +865,59 @@ int engine_ipc(struct engine *engine, const char *expr)
 /* Execute byte code */
 #define l_dobytecode(L, arr, len, name) \
 	(luaL_loadbuffer((L), (arr), (len), (name)) || lua_pcall((L), 0, LUA_MULTRET, 0))
+
+/** @internal lua_dump() writer into an open stream. */
+static int l_chunk_writer(lua_State *L, const void *p, size_t sz, void *ud)
+{
+	return fwrite(p, 1, sz, (FILE *)ud) == sz ? 0 : -1;
+}
+
+/** @internal Load the config file, preferring a fresh compiled snapshot
+  * next to it. The first fork to compile writes the snapshot atomically,
+  * so its siblings (and the next restart) skip parsing; everything is
+  * best effort and falls back to the plain source on any mismatch. */
+static int l_loadconfig_cached(lua_State *L, const char *path)
+{
+	char cache_path[512];
+	struct stat st_src, st_cache;
+	int len = snprintf(cache_path, sizeof(cache_path), "%s.cache", path);
+	if (len <= 0 || (size_t)len >= sizeof(cache_path) || stat(path, &st_src) != 0) {
+		return luaL_loadfile(L, path);
+	}
+	if (stat(cache_path, &st_cache) == 0 && st_cache.st_mtime >= st_src.st_mtime) {
+		if (luaL_loadfile(L, cache_path) == 0) {
+			return 0;
+		}
+		lua_pop(L, 1); /* Corrupt or foreign bytecode, recompile. */
+	}
+	int ret = luaL_loadfile(L, path);
+	if (ret == 0) {
+		char tmp_path[512 + 8];
+		snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", cache_path);
+		int fd = mkstemp(tmp_path);
+		if (fd >= 0) {
+			FILE *fp = fdopen(fd, "w");
+			lua_pushvalue(L, -1);
+			if (fp && lua_dump(L, l_chunk_writer, fp) == 0) {
+				fclose(fp);
+				rename(tmp_path, cache_path);
+			} else {
+				if (fp) {
+					fclose(fp);
+				} else {
+					close(fd);
+				}
+				unlink(tmp_path);
+			}
+			lua_pop(L, 1);
+		}
+	}
+	return ret;
+}
+
 /** Load file in a sandbox environment. */
 #define l_dosandboxfile(L, filename) \
-	(luaL_loadfile((L), (filename)) || engine_pcall((L), 0))
+	(l_loadconfig_cached((L), (filename)) || engine_pcall((L), 0))
 
 static int engine_loadconf(struct engine *engine, const char *config_path)
 {
@@ -701,6 +959,27 @@ static int engine_loadconf(struct engine *engine, const char *config_path)
 	return ret;
 }
 
+/** GC step budget per loop turn (ns) and step granularity (KB). */
+#define GC_STEP_BUDGET (200 * 1000)
+#define GC_STEP_SIZE 16
+
+/** @internal Run bounded incremental GC right before the loop sleeps,
+  * so collection debt is paid in sub-millisecond slices instead of
+  * full-cycle stalls in the middle of query processing. */
+static void gc_step(uv_prepare_t *handle)
+{
+	struct engine *engine = handle->data;
+	/* Loop-turn boundary: no reader from the previous turn survives,
+	 * replaced module list generations can be reclaimed. */
+	modules_gen_reclaim(engine);
+	const uint64_t start = uv_hrtime();
+	do {
+		if (lua_gc(engine->L, LUA_GCSTEP, GC_STEP_SIZE)) {
+			break; /* Collection cycle finished. */
+		}
+	} while (uv_hrtime() - start < GC_STEP_BUDGET);
+}
+
 int engine_start(struct engine *engine, const char *config_path)
 {
 	/* Load configuration. */
@@ -725,6 +1004,24 @@ int engine_start(struct engine *engine, const char *config_path)
 		uv_timer_start(timer, update_state, CLEANUP_TIMER, CLEANUP_TIMER);
 	}
 
+	/* Apply write-behind cache insertions after each loop turn. */
+	uv_check_t *check = malloc(sizeof(*check));
+	if (check) {
+		uv_check_init(uv_default_loop(), check);
+		check->data = engine;
+		engine->flusher = check;
+		uv_check_start(check, flush_deferred);
+	}
+
+	/* Pay GC debt in small slices before each poll. */
+	uv_prepare_t *stepper = malloc(sizeof(*stepper));
+	if (stepper) {
+		uv_prepare_init(uv_default_loop(), stepper);
+		stepper->data = engine;
+		engine->gc_stepper = stepper;
+		uv_prepare_start(stepper, gc_step);
+	}
+
 	return kr_ok();
 }
 
@@ -737,6 +1034,14 @@ void engine_stop(struct engine *engine)
 		uv_timer_stop(engine->updater);
 		uv_close((uv_handle_t *)engine->updater, (uv_close_cb) free);
 	}
+	if (engine->flusher) {
+		uv_check_stop(engine->flusher);
+		uv_close((uv_handle_t *)engine->flusher, (uv_close_cb) free);
+	}
+	if (engine->gc_stepper) {
+		uv_prepare_stop(engine->gc_stepper);
+		uv_close((uv_handle_t *)engine->gc_stepper, (uv_close_cb) free);
+	}
 	uv_stop(uv_default_loop());
 }
 
@@ -786,7 +1091,7 @@ int engine_register(struct engine *engine, const char *name, const char *precede
 	/* Make sure module is unloaded */
 	(void) engine_unregister(engine, name);
 	/* Find the index of referenced module. */
-	module_array_t *mod_list = &engine->modules;
+	module_array_t *mod_list = engine->modules;
 	size_t ref_pos = mod_list->len;
 	if (precedence && ref) {
 		ref_pos = module_find(mod_list, ref);
@@ -809,44 +1114,62 @@ int engine_register(struct engine *engine, const char *name, const char *precede
 		free(module);
 		return ret;
 	}
-	if (array_push(engine->modules, module) < 0) {
+	/* Build the next module list generation. */
+	module_array_t *next = modules_gen_clone(mod_list);
+	if (!next || array_push(*next, module) < 0) {
+		modules_gen_free(next);
 		engine_unload(engine, module);
 		return kr_error(ENOMEM);
 	}
 	/* Evaluate precedence operator */
 	if (precedence) {
-		struct kr_module **arr = mod_list->at;
-		size_t emplacement = mod_list->len;
+		struct kr_module **arr = next->at;
+		size_t emplacement = next->len;
 		if (strcasecmp(precedence, ">") == 0) {
-			if (ref_pos + 1 < mod_list->len)
+			if (ref_pos + 1 < next->len)
 				emplacement = ref_pos + 1; /* Insert after target */
 		}
 		if (strcasecmp(precedence, "<") == 0) {
 			emplacement = ref_pos; /* Insert at target */
 		}
 		/* Move the tail if it has some elements. */
-		if (emplacement + 1 < mod_list->len) {
-			memmove(&arr[emplacement + 1], &arr[emplacement], sizeof(*arr) * (mod_list->len - (emplacement + 1)));
+		if (emplacement + 1 < next->len) {
+			memmove(&arr[emplacement + 1], &arr[emplacement], sizeof(*arr) * (next->len - (emplacement + 1)));
 			arr[emplacement] = module;
 		}
 	}
+	modules_gen_flip(engine, next);
 
 	/* Register properties */
 	if (module->props || module->config) {
-		return register_properties(engine, module);
+		ret = register_properties(engine, module);
+		if (ret != 0) {
+			return ret;
+		}
 	}
 
-	return kr_ok();
+	return kr_context_compile_layers(&engine->resolver);
 }
 
 int engine_unregister(struct engine *engine, const char *name)
 {
-	module_array_t *mod_list = &engine->modules;
+	module_array_t *mod_list = engine->modules;
 	size_t found = module_find(mod_list, name);
 	if (found < mod_list->len) {
-		engine_unload(engine, mod_list->at[found]);
-		array_del(*mod_list, found);
-		return kr_ok();
+		struct kr_module *module = mod_list->at[found];
+		module_array_t *next = modules_gen_clone(mod_list);
+		if (!next) {
+			return kr_error(ENOMEM);
+		}
+		array_del(*next, found);
+		modules_gen_flip(engine, next);
+		/* Flip the dispatch tables first, then clear the Lua world;
+		 * binary teardown waits for in-flight requests to drain. */
+		int ret = kr_context_compile_layers(&engine->resolver);
+		lua_pushnil(engine->L);
+		lua_setglobal(engine->L, name);
+		kr_context_retire_module(&engine->resolver, module);
+		return ret;
 	}
 
 	return kr_error(ENOENT);
@@ -23,12 +23,27 @@
 #ifndef LRU_REP_SIZE
 #define LRU_REP_SIZE (LRU_RTT_SIZE / 4) /**< NS reputation cache size */
 #endif
+#ifndef LRU_RTT_KEY_LEN
+#define LRU_RTT_KEY_LEN 16 /**< NS RTT cache key, a raw IPv4/IPv6 address. */
+#endif
+#ifndef LRU_REP_KEY_LEN
+#define LRU_REP_KEY_LEN 255 /**< NS reputation cache key, a dname in wire format. */
+#endif
+#ifndef LRU_BUSY_SIZE
+#define LRU_BUSY_SIZE (LRU_RTT_SIZE / 16) /**< Failing zone cut concurrency table size. */
+#endif
 #ifndef LRU_COOKIES_SIZE
 #define LRU_COOKIES_SIZE LRU_RTT_SIZE /**< DNS cookies cache size. */
 #endif
+#ifndef LRU_DNSKEY_SIZE
+#define LRU_DNSKEY_SIZE (LRU_RTT_SIZE / 8) /**< Parsed DNSKEY cache size. */
+#endif
 #ifndef MP_FREELIST_SIZE
 #define MP_FREELIST_SIZE 64 /**< Maximum length of the worker mempool freelist */
 #endif
+#ifndef MP_REFILL_COUNT
+#define MP_REFILL_COUNT 16 /**< Objects allocated per bulk freelist refill */
+#endif
 #ifndef RECVMMSG_BATCH
 #define RECVMMSG_BATCH 4
 #endif
@@ -38,6 +53,14 @@
 #ifndef MAX_PIPELINED
 #define MAX_PIPELINED 100
 #endif
+#ifndef SLOWLOG_COUNT
+#define SLOWLOG_COUNT 128
+/** Outgoing UDP handles kept bound between queries, per worker */
+#define UDP_POOL_MAXLEN 64 /**< Slow-query ring buffer length. */
+#endif
+#ifndef ENGINE_SHM_COUNTERS
+#define ENGINE_SHM_COUNTERS 64 /**< Counters per slot in the shared stats segment. */
+#endif
 
 /*
  * @internal These are forward decls to allow building modules with engine but without Lua.
@@ -51,19 +74,49 @@ struct lua_State;
 /* @internal Array of file descriptors shorthand. */
 typedef array_t(int) fd_array_t;
 
+/** Per-fork slot in the shared stats segment.
+ * Slots are cache-line aligned, so each fork can bump its own counters
+ * without false sharing or locks; readers sum over the slots lazily. */
+struct engine_shm_slot {
+    size_t counter[ENGINE_SHM_COUNTERS];
+} __attribute__((aligned(64)));
+
 struct engine {
     struct kr_context resolver;
     struct network net;
-    module_array_t modules;
+    /** Current module list generation. Updates flip this pointer instead of
+      * mutating the array in place, see the note above modules_gen_flip(). */
+    module_array_t *modules;
+    array_t(module_array_t *) modules_retired; /**< Replaced generations, freed at the next loop turn. */
     array_t(const struct kr_cdb_api *) backends;
     fd_array_t ipc_set;
     knot_mm_t *pool;
     uv_timer_t *updater;
+    uv_check_t *flusher;
+    uv_prepare_t *gc_stepper; /**< Bounded Lua GC steps before the loop sleeps. */
+    struct engine_shm_slot *shm_stats; /**< Shared stats slots, one per fork (NULL unless forked). */
+    int shm_stats_len;                 /**< Number of slots in the segment. */
+    int shm_stats_id;                  /**< Slot owned by this fork. */
     struct lua_State *L;
 };
 
 int engine_init(struct engine *engine, knot_mm_t *pool);
 void engine_deinit(struct engine *engine);
+/** Map an anonymous shared stats segment with one slot per fork.
+  * Must be called before the processes split, the mapping is inherited. */
+struct engine_shm_slot *engine_shm_create(int forks);
+/** Unmap the shared stats segment. */
+void engine_shm_free(struct engine_shm_slot *shm, int forks);
+/** Shared NS RTT/reputation tables, one segment for all forks. */
+struct engine_shm_nsrep;
+/** Map and initialize the shared NS reputation segment.
+  * Must be called before the processes split, the mapping is inherited
+  * at the same address so the inline-key tables work from every fork. */
+struct engine_shm_nsrep *engine_shm_nsrep_create(int forks);
+/** Point the resolver NS caches into the shared segment. */
+void engine_shm_nsrep_attach(struct engine *engine, struct engine_shm_nsrep *shm);
+/** Unmap the shared NS reputation segment. */
+void engine_shm_nsrep_free(struct engine_shm_nsrep *shm);
 /** @warning This function leaves 1 string result on stack. */
 int engine_cmd(struct lua_State *L, const char *str, bool raw);
 int engine_ipc(struct engine *engine, const char *expr);
@@ -214,13 +214,13 @@ static knot_layer_api_t *l_ffi_layer_create(lua_State *L, struct kr_module *modu
 	knot_layer_api_t *api = malloc(api_length);
 	if (api) {
 		memset(api, 0, api_length);
+		/* Hooks absent in the Lua module stay NULL, so the layer
+		 * dispatch tables skip the module for those hooks entirely. */
 		LAYER_REGISTER(L, api, begin);
 		LAYER_REGISTER(L, api, finish);
 		LAYER_REGISTER(L, api, consume);
 		LAYER_REGISTER(L, api, produce);
 		LAYER_REGISTER(L, api, reset);
-		/* Begin is always set, as it initializes layer baton. */
-		api->begin = l_ffi_layer_begin;
 		api->data = module;
 	}
 	return api;
@@ -15,9 +15,11 @@
  */
 
 #include <string.h>
+#include <sys/socket.h>
 #include <libknot/errcode.h>
 #include <contrib/ucw/lib.h>
 #include <contrib/ucw/mempool.h>
+#include <contrib/wire.h>
 #include <assert.h>
 
 #include "daemon/io.h"
@@ -49,14 +51,25 @@ static void check_bufsize(uv_handle_t* handle)
 static void session_clear(struct session *s)
 {
 	assert(s->outgoing || s->tasks.len == 0);
-	array_clear(s->tasks);
+	/* The task list is backed by the session pool, the memory goes
+	 * away wholesale with it. */
+	array_init(s->tasks);
 	tls_free(s->tls_ctx);
 	memset(s, 0, sizeof(*s));
 }
 
+void session_pool_reset(struct session *s)
+{
+	if (s->pool.ctx && s->tasks.len == 0) {
+		array_init(s->tasks);
+		mp_flush(s->pool.ctx);
+	}
+}
+
 void session_free(struct session *s)
 {
 	if (s) {
+		free(s->rbuf);
 		session_clear(s);
 		free(s);
 	}
@@ -67,16 +80,66 @@ struct session *session_new(void)
 	return calloc(1, sizeof(struct session));
 }
 
+uint8_t *tcp_rbuf_borrow(struct worker_ctx *worker)
+{
+	uint8_t *rbuf = NULL;
+	if (worker->pool_rbufs.len > 0) {
+		rbuf = array_tail(worker->pool_rbufs);
+		array_pop(worker->pool_rbufs);
+		mp_freelist_mark(&worker->pool_rbufs);
+		kr_asan_unpoison(rbuf, TCP_RBUF_SIZE);
+	} else {
+		rbuf = malloc(TCP_RBUF_SIZE);
+	}
+	return rbuf;
+}
+
+void tcp_rbuf_release(struct worker_ctx *worker, uint8_t *rbuf)
+{
+	if (!rbuf) {
+		return;
+	}
+	if (worker->pool_rbufs.len < MP_FREELIST_SIZE) {
+		array_push(worker->pool_rbufs, rbuf);
+		kr_asan_poison(rbuf, TCP_RBUF_SIZE);
+		worker_trim_arm(worker);
+	} else {
+		free(rbuf);
+	}
+}
+
 static struct session *session_borrow(struct worker_ctx *worker)
 {
 	struct session *s = NULL;
 	if (worker->pool_sessions.len > 0) {
 		s = array_tail(worker->pool_sessions);
 		array_pop(worker->pool_sessions);
+		mp_freelist_mark(&worker->pool_sessions);
 		kr_asan_unpoison(s, sizeof(*s));
 	} else {
+		/* Refill in bulk, see req_borrow() for rationale. */
+		for (unsigned i = 0; i < MP_REFILL_COUNT - 1; ++i) {
+			struct session *extra = session_new();
+			if (!extra || array_push(worker->pool_sessions, extra) < 0) {
+				session_free(extra);
+				break;
+			}
+			kr_asan_poison(extra, sizeof(*extra));
+		}
+		worker->pool_sessions.refills += 1;
 		s = session_new();
 	}
+	if (!s) {
+		return NULL;
+	}
+	/* Transient per-connection state draws from a borrowed mempool,
+	 * reset wholesale instead of being freed piecemeal. */
+	s->pool.ctx = worker_mp_borrow(worker);
+	if (!s->pool.ctx) {
+		session_free(s);
+		return NULL;
+	}
+	s->pool.alloc = (knot_mm_alloc_t) mp_alloc;
 	return s;
 }
 
@@ -85,23 +148,118 @@ static void session_release(struct worker_ctx *worker, struct session *s)
 	if (!s) {
 		return;
 	}
+	tcp_rbuf_release(worker, s->rbuf);
+	s->rbuf = NULL;
+	worker_mp_release(worker, s->pool.ctx);
+	s->pool.ctx = NULL;
 	if (worker->pool_sessions.len < MP_FREELIST_SIZE) {
 		session_clear(s);
 		array_push(worker->pool_sessions, s);
 		kr_asan_poison(s, sizeof(*s));
+		worker_trim_arm(worker);
 	} else {
 		session_free(s);
 	}
 }
 
+/* Client connections are tracked in an intrusive activity list with the most
+ * recently active session at head, so connection shedding under pressure can
+ * start with the one idle for the longest time. */
+
+static void tcp_idle_unlink(struct worker_ctx *worker, struct session *s)
+{
+	if (worker->tcp_idle_head != s && !s->idle_prev) {
+		return; /* Not tracked. */
+	}
+	if (s->idle_prev) {
+		s->idle_prev->idle_next = s->idle_next;
+	} else {
+		worker->tcp_idle_head = s->idle_next;
+	}
+	if (s->idle_next) {
+		s->idle_next->idle_prev = s->idle_prev;
+	} else {
+		worker->tcp_idle_tail = s->idle_prev;
+	}
+	s->idle_next = s->idle_prev = NULL;
+	worker->tcp_clients -= 1;
+}
+
+static void tcp_idle_touch(struct worker_ctx *worker, struct session *s)
+{
+	tcp_idle_unlink(worker, s);
+	s->idle_next = worker->tcp_idle_head;
+	if (worker->tcp_idle_head) {
+		worker->tcp_idle_head->idle_prev = s;
+	}
+	worker->tcp_idle_head = s;
+	if (!worker->tcp_idle_tail) {
+		worker->tcp_idle_tail = s;
+	}
+	worker->tcp_clients += 1;
+}
+
+/* Sessions with more pipelined queries buffered than their drain quantum
+ * wait in a FIFO for the next round, each round gives every queued session
+ * one quantum, so a single flooding client shares the loop with everyone
+ * else instead of running its whole backlog to exhaustion. */
+
+static void tcp_drain_arm(struct worker_ctx *worker);
+
+static void tcp_drain_unlink(struct worker_ctx *worker, struct session *s)
+{
+	if (worker->tcp_drain_head != s && !s->drain_prev) {
+		return; /* Not queued. */
+	}
+	if (s->drain_prev) {
+		s->drain_prev->drain_next = s->drain_next;
+	} else {
+		worker->tcp_drain_head = s->drain_next;
+	}
+	if (s->drain_next) {
+		s->drain_next->drain_prev = s->drain_prev;
+	} else {
+		worker->tcp_drain_tail = s->drain_prev;
+	}
+	s->drain_next = s->drain_prev = NULL;
+}
+
+void tcp_drain_push(struct worker_ctx *worker, struct session *s)
+{
+	if (worker->tcp_drain_head == s || s->drain_prev) {
+		return; /* Already queued, keep its position. */
+	}
+	s->drain_prev = worker->tcp_drain_tail;
+	if (worker->tcp_drain_tail) {
+		worker->tcp_drain_tail->drain_next = s;
+	} else {
+		worker->tcp_drain_head = s;
+	}
+	worker->tcp_drain_tail = s;
+	tcp_drain_arm(worker);
+}
+
 static uv_stream_t *handle_alloc(uv_loop_t *loop)
 {
-	uv_stream_t *handle = calloc(1, sizeof(*handle));
-	if (!handle) {
-		return NULL;
+	/* Client handles churn with connections, recycle them through the
+	 * worker freelist instead of a malloc/free pair per connection. */
+	struct worker_ctx *worker = loop->data;
+	if (worker) {
+		return worker_ioreq_borrow(worker);
 	}
+	return calloc(1, sizeof(uv_tcp_t));
+}
 
-	return handle;
+/** @internal Close callback for handles owned by the worker freelist. */
+static void handle_release(uv_handle_t *handle)
+{
+	struct worker_ctx *worker = handle->loop->data;
+	io_deinit(handle);
+	if (worker) {
+		worker_ioreq_release(worker, handle);
+	} else {
+		free(handle);
+	}
 }
 
 static void handle_getbuf(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf)
@@ -115,8 +273,23 @@ static void handle_getbuf(uv_handle_t* handle, size_t suggested_size, uv_buf_t*
 	uv_loop_t *loop = handle->loop;
 	struct worker_ctx *worker = loop->data;
 	buf->base = (char *)worker->wire_buf;
+	/* Plaintext stream reads go directly into a per-session buffer, so DNS
+	 * message framing happens in place without a reassembly copy.
+	 * TLS sessions keep the shared buffer for ciphertext, the decrypted
+	 * payload is buffered by the session after the TLS layer. */
+	if (handle->type == UV_TCP && !session->has_tls) {
+		if (!session->rbuf) {
+			session->rbuf = tcp_rbuf_borrow(worker);
+			session->rbuf_end = 0;
+		}
+		if (session->rbuf) {
+			buf->base = (char *)session->rbuf + session->rbuf_end;
+			buf->len = MIN(suggested_size, TCP_RBUF_SIZE - session->rbuf_end);
+		} else {
+			buf->len = MIN(suggested_size, 4096);
+		}
 	/* Limit TCP stream buffer size to 4K for granularity in batches of incoming queries. */
-	if (handle->type == UV_TCP) {
+	} else if (handle->type == UV_TCP) {
 		buf->len = MIN(suggested_size, 4096);
 	/* Regular buffer size for subrequests. */
 	} else if (session->outgoing) {
@@ -127,6 +300,128 @@ static void handle_getbuf(uv_handle_t* handle, size_t suggested_size, uv_buf_t*
 	}
 }
 
+/** @internal Cheap sanity check on the raw datagram before any knot_pkt
+  * machinery or allocation runs, so garbage floods pay one compare, not a
+  * parse.  The conditions fold into a single branch: header-sized, QR
+  * matching the direction, OPCODE a standard query and (for inbound
+  * queries) exactly one question. */
+static bool wire_sane(const uint8_t *wire, ssize_t len, bool outgoing)
+{
+	if (len < KNOT_WIRE_HEADER_SIZE) {
+		return false;
+	}
+	const uint32_t flags = wire_read_u16(wire + 2);
+	const uint32_t qdcount = wire_read_u16(wire + 4);
+	/* QR is bit 15, OPCODE bits 14-11 of the flags word.  Answers are
+	 * only required to be answers; unusual counts are left to the
+	 * pairing checks, as some servers send REFUSED without a question. */
+	const uint32_t mismatch = outgoing
+		? (flags >> 11) ^ 0x10
+		: (flags >> 11) | (qdcount ^ 1);
+	return mismatch == 0;
+}
+
+/** @internal Process single datagram, either from the packet cache fast path
+  * (filling the answer buffer) or through the regular worker submission. */
+static void udp_dispatch(struct worker_ctx *worker, uv_handle_t *handle,
+	char *base, ssize_t nread, const struct sockaddr *addr,
+	uint8_t *answer, size_t *answer_len)
+{
+	*answer_len = 0;
+	/* Reject trivially invalid packets before they cost anything. */
+	struct session *session = handle->data;
+	if (!wire_sane((const uint8_t *)base, nread, session && session->outgoing)) {
+		worker->stats.dropped += 1;
+		return;
+	}
+	/* Rate-limit by source prefix before anything is allocated. */
+	if (worker_rrl_check(worker, addr, (const uint8_t *)base, nread,
+	                     answer, answer_len) != 0) {
+		return; /* Dropped, or a truncated answer was filled in (SLIP). */
+	}
+	knot_pkt_t *query = knot_pkt_new(base, nread, &worker->pkt_pool);
+	if (!query) {
+		return;
+	}
+	query->max_size = KNOT_WIRE_MAX_PKTSIZE;
+	/* Try to answer from the packet cache without spawning a task. */
+	if (worker_answer_cached(worker, handle, query, addr, answer, answer_len) == 0) {
+		return;
+	}
+	*answer_len = 0;
+	/* Shed queries that would start a new resolution when the fork is
+	 * saturated; cache hits above keep being served throughout. */
+	if (!(session && session->outgoing) &&
+	    worker_overload_check(worker, (const uint8_t *)base, nread,
+	                          answer, answer_len) != 0) {
+		return; /* Shed, or a TC/SERVFAIL answer was filled in. */
+	}
+	worker_submit(worker, handle, query, addr);
+}
+
+#if defined(__linux__)
+/* Keep draining within one callback bounded, so other events aren't starved. */
+#define UDP_DRAIN_ROUNDS 8
+
+/** @internal Drain the master socket with recvmmsg() and flush cached answers
+  * in a single sendmmsg(). Runs after the datagram handed over by libuv has
+  * been processed, so the shared wire buffer is free for reuse. */
+static void udp_drain(struct worker_ctx *worker, uv_udp_t *handle)
+{
+	uv_os_fd_t fd = 0;
+	if (uv_fileno((uv_handle_t *)handle, &fd) != 0) {
+		return;
+	}
+	for (unsigned round = 0; round < UDP_DRAIN_ROUNDS; ++round) {
+		struct mmsghdr msgv[RECVMMSG_BATCH];
+		struct iovec iov[RECVMMSG_BATCH];
+		struct sockaddr_storage addr[RECVMMSG_BATCH];
+		memset(msgv, 0, sizeof(msgv));
+		for (unsigned i = 0; i < RECVMMSG_BATCH; ++i) {
+			iov[i].iov_base = worker->wire_buf + i * KNOT_WIRE_MAX_PKTSIZE;
+			iov[i].iov_len = KNOT_WIRE_MAX_PKTSIZE;
+			msgv[i].msg_hdr.msg_iov = &iov[i];
+			msgv[i].msg_hdr.msg_iovlen = 1;
+			msgv[i].msg_hdr.msg_name = &addr[i];
+			msgv[i].msg_hdr.msg_namelen = sizeof(addr[i]);
+		}
+		int rcvd = recvmmsg(fd, msgv, RECVMMSG_BATCH, MSG_DONTWAIT, NULL);
+		if (rcvd <= 0) {
+			return;
+		}
+		/* Process the batch, collecting cached answers for one flush. */
+		struct mmsghdr outv[RECVMMSG_BATCH];
+		struct iovec out_iov[RECVMMSG_BATCH];
+		uint8_t out_pkt[RECVMMSG_BATCH][KNOT_WIRE_MIN_PKTSIZE];
+		unsigned out_count = 0;
+		memset(outv, 0, sizeof(outv));
+		for (int i = 0; i < rcvd; ++i) {
+			size_t answer_len = 0;
+			udp_dispatch(worker, (uv_handle_t *)handle,
+			             iov[i].iov_base, msgv[i].msg_len,
+			             (struct sockaddr *)&addr[i],
+			             out_pkt[out_count], &answer_len);
+			if (answer_len > 0) {
+				out_iov[out_count].iov_base = out_pkt[out_count];
+				out_iov[out_count].iov_len = answer_len;
+				outv[out_count].msg_hdr.msg_iov = &out_iov[out_count];
+				outv[out_count].msg_hdr.msg_iovlen = 1;
+				outv[out_count].msg_hdr.msg_name = &addr[i];
+				outv[out_count].msg_hdr.msg_namelen = msgv[i].msg_hdr.msg_namelen;
+				out_count += 1;
+			}
+		}
+		if (out_count > 0) {
+			(void) sendmmsg(fd, outv, out_count, 0);
+		}
+		mp_flush(worker->pkt_pool.ctx);
+		if (rcvd < RECVMMSG_BATCH) {
+			return; /* Socket is drained. */
+		}
+	}
+}
+#endif
+
 void udp_recv(uv_udp_t *handle, ssize_t nread, const uv_buf_t *buf,
 	const struct sockaddr *addr, unsigned flags)
 {
@@ -139,11 +434,21 @@ void udp_recv(uv_udp_t *handle, ssize_t nread, const uv_buf_t *buf,
 		return;
 	}
 
-	knot_pkt_t *query = knot_pkt_new(buf->base, nread, &worker->pkt_pool);
-	if (query) {
-		query->max_size = KNOT_WIRE_MAX_PKTSIZE;
-		worker_submit(worker, (uv_handle_t *)handle, query, addr);
+	uint8_t answer[KNOT_WIRE_MIN_PKTSIZE];
+	size_t answer_len = 0;
+	udp_dispatch(worker, (uv_handle_t *)handle, buf->base, nread, addr,
+	             answer, &answer_len);
+	if (answer_len > 0) {
+		uv_buf_t sendbuf = { (char *)answer, answer_len };
+		(void) uv_udp_try_send(handle, &sendbuf, 1, addr);
+	}
+#if defined(__linux__)
+	/* Drain remaining datagrams on master sockets in batches. */
+	struct session *session = ((uv_handle_t *)handle)->data;
+	if (session && !session->outgoing) {
+		udp_drain(worker, handle);
 	}
+#endif
 	mp_flush(worker->pkt_pool.ctx);
 }
 
@@ -185,7 +490,24 @@ int udp_bindfd(uv_udp_t *handle, int fd)
 static void tcp_timeout(uv_handle_t *timer)
 {
 	uv_handle_t *handle = timer->data;
-	uv_close(handle, io_free);
+	uv_close(handle, handle_release);
+}
+
+/* The idle timeout halves for every TCP_CLIENTS_PRESSURE accepted client
+ * connections, so floods age out fast instead of pinning fds and sessions
+ * until the nominal deadline. Past TCP_CLIENTS_MAX every new connection
+ * additionally sheds the longest-idle one. */
+#define TCP_CLIENTS_PRESSURE 1000
+#define TCP_CLIENTS_MAX 10000
+
+static uint64_t tcp_idle_timeout(struct worker_ctx *worker)
+{
+	uint64_t timeout = KR_CONN_RTT_MAX / 2;
+	unsigned pressure = worker->tcp_clients / TCP_CLIENTS_PRESSURE;
+	while (pressure-- > 0 && timeout > 1) {
+		timeout /= 2;
+	}
+	return timeout;
 }
 
 static void tcp_timeout_trigger(uv_timer_t *timer)
@@ -193,12 +515,84 @@ static void tcp_timeout_trigger(uv_timer_t *timer)
 	uv_handle_t *handle = timer->data;
 	struct session *session = handle->data;
 	if (session->tasks.len > 0) {
+		struct worker_ctx *worker = timer->loop->data;
+		uv_timer_set_repeat(timer, tcp_idle_timeout(worker));
 		uv_timer_again(timer);
 	} else {
 		uv_close((uv_handle_t *)timer, tcp_timeout);
 	}
 }
 
+/* Stop the stream after a processing error.
+ * Stop reading and close after the last outstanding message is processed. */
+static void tcp_fail(struct worker_ctx *worker, uv_handle_t *handle)
+{
+	struct session *s = handle->data;
+	worker_end_tcp(worker, handle);
+	if (!s->outgoing && !uv_is_closing((uv_handle_t *)&s->timeout)) {
+		uv_timer_stop(&s->timeout);
+		if (s->tasks.len == 0) {
+			uv_close((uv_handle_t *)&s->timeout, tcp_timeout);
+		} else { /* If there are tasks running, defer until they finish. */
+			uv_timer_start(&s->timeout, tcp_timeout_trigger, 1, KR_CONN_RTT_MAX/2);
+		}
+	}
+}
+
+/* Give every queued session one quantum, then yield back to the event loop
+ * so timers and fresh I/O interleave with the buffered backlogs. Sessions
+ * with queries left requeue at the tail, see worker_drain_tcp(). */
+static void tcp_drain_round(uv_timer_t *timer)
+{
+	struct worker_ctx *worker = timer->data;
+	struct session *last = worker->tcp_drain_tail;
+	bool done = false;
+	while (!done && worker->tcp_drain_head) {
+		struct session *s = worker->tcp_drain_head;
+		done = (s == last);
+		tcp_drain_unlink(worker, s);
+		uv_handle_t *handle = s->timeout.data;
+		if (!handle || uv_is_closing(handle)) {
+			continue;
+		}
+		int ret = worker_drain_tcp(worker, (uv_stream_t *)handle, TCP_DRAIN_QUANTUM);
+		if (ret < 0) {
+			tcp_fail(worker, handle);
+		}
+	}
+	if (worker->tcp_drain_head) {
+		tcp_drain_arm(worker);
+	}
+	mp_flush(worker->pkt_pool.ctx);
+}
+
+static void tcp_drain_arm(struct worker_ctx *worker)
+{
+	if (!worker->tcp_drain_timer_init) {
+		uv_timer_init(worker->loop, &worker->tcp_drain_timer);
+		worker->tcp_drain_timer.data = worker;
+		worker->tcp_drain_timer_init = true;
+	}
+	if (!uv_is_active((uv_handle_t *)&worker->tcp_drain_timer)) {
+		uv_timer_start(&worker->tcp_drain_timer, tcp_drain_round, 0, 0);
+	}
+}
+
+/** Close the client connection that has been idle for the longest time. */
+static void tcp_shed_idle(struct worker_ctx *worker)
+{
+	struct session *s = worker->tcp_idle_tail;
+	while (s && s->tasks.len > 0) {
+		s = s->idle_prev;
+	}
+	if (!s || uv_is_closing((uv_handle_t *)&s->timeout)) {
+		return;
+	}
+	tcp_idle_unlink(worker, s);
+	uv_timer_stop(&s->timeout);
+	uv_close((uv_handle_t *)&s->timeout, tcp_timeout);
+}
+
 static void tcp_recv(uv_stream_t *handle, ssize_t nread, const uv_buf_t *buf)
 {
 	uv_loop_t *loop = handle->loop;
@@ -213,20 +607,11 @@ static void tcp_recv(uv_stream_t *handle, ssize_t nread, const uv_buf_t *buf)
 		ret = worker_process_tcp(worker, handle, (const uint8_t *)buf->base, nread);
 	}
 	if (ret < 0) {
-		worker_end_tcp(worker, (uv_handle_t *)handle);
-		/* Exceeded per-connection quota for outstanding requests
-		 * stop reading from stream and close after last message is processed. */
-		if (!s->outgoing && !uv_is_closing((uv_handle_t *)&s->timeout)) {
-			uv_timer_stop(&s->timeout);
-			if (s->tasks.len == 0) {
-				uv_close((uv_handle_t *)&s->timeout, tcp_timeout);
-			} else { /* If there are tasks running, defer until they finish. */
-				uv_timer_start(&s->timeout, tcp_timeout_trigger, 1, KR_CONN_RTT_MAX/2);
-			}
-		}
+		tcp_fail(worker, (uv_handle_t *)handle);
 	/* Connection spawned more than one request, reset its deadline for next query. */
 	} else if (ret > 0 && !s->outgoing) {
 		uv_timer_again(&s->timeout);
+		tcp_idle_touch(worker, s); /* Refresh position in the activity list. */
 	}
 	mp_flush(worker->pkt_pool.ctx);
 }
@@ -241,9 +626,9 @@ static void _tcp_accept(uv_stream_t *master, int status, bool tls)
 		return;
 	}
 	memset(client, 0, sizeof(*client));
-	io_create(master->loop, (uv_handle_t *)client, SOCK_STREAM);
+	io_create(master->loop, (uv_handle_t *)client, SOCK_STREAM, AF_UNSPEC);
 	if (uv_accept(master, client) != 0) {
-		uv_close((uv_handle_t *)client, io_free);
+		uv_close((uv_handle_t *)client, handle_release);
 		return;
 	}
 
@@ -255,10 +640,16 @@ static void _tcp_accept(uv_stream_t *master, int status, bool tls)
 	if (tls && !session->tls_ctx) {
 		session->tls_ctx = tls_new(master->loop->data);
 	}
+	struct worker_ctx *worker = master->loop->data;
+	tcp_idle_touch(worker, session);
+	if (worker->tcp_clients > TCP_CLIENTS_MAX) {
+		tcp_shed_idle(worker);
+	}
 	uv_timer_t *timer = &session->timeout;
 	uv_timer_init(master->loop, timer);
 	timer->data = client;
-	uv_timer_start(timer, tcp_timeout_trigger, KR_CONN_RTT_MAX/2, KR_CONN_RTT_MAX/2);
+	const uint64_t timeout = tcp_idle_timeout(worker);
+	uv_timer_start(timer, tcp_timeout_trigger, timeout, timeout);
 	io_start_read((uv_handle_t *)client);
 }
 
@@ -281,6 +672,11 @@ static int set_tcp_option(uv_handle_t *handle, int option, int val)
 	return 0; /* N/A */
 }
 
+/* Linux 4.11+, the header may lag behind the kernel. */
+#if defined(__linux__) && !defined(TCP_FASTOPEN_CONNECT)
+#define TCP_FASTOPEN_CONNECT 30
+#endif
+
 static int tcp_bind_finalize(uv_handle_t *handle)
 {
 	/* TCP_FASTOPEN enables 1 RTT connection resumptions. */
@@ -344,6 +740,13 @@ static int _tcp_bindfd(uv_tcp_t *handle, int fd, uv_connection_cb connection)
 		return ret;
 	}
 
+	/* TCP_DEFER_ACCEPT delays accepting connections until there is readable data. */
+#ifdef TCP_DEFER_ACCEPT
+	if (set_tcp_option((uv_handle_t *)handle, TCP_DEFER_ACCEPT, KR_CONN_RTT_MAX/1000) != 0) {
+		kr_log_info("[ io ] tcp_bindfd (defer_accept): %s\n", strerror(errno));
+	}
+#endif
+
 	ret = uv_listen((uv_stream_t *)handle, 16, connection);
 	if (ret != 0) {
 		return ret;
@@ -361,12 +764,24 @@ int tcp_bindfd_tls(uv_tcp_t *handle, int fd)
 	return _tcp_bindfd(handle, fd, tls_accept);
 }
 
-void io_create(uv_loop_t *loop, uv_handle_t *handle, int type)
+void io_create(uv_loop_t *loop, uv_handle_t *handle, int type, int family)
 {
 	if (type == SOCK_DGRAM) {
 		uv_udp_init(loop, (uv_udp_t *)handle);
 	} else {
+		/* When the address family is known up front, create the socket
+		 * early so client-side Fast Open can be armed before connect() -
+		 * the query then rides in the SYN on resumed connections. */
+#if defined(UV_VERSION_HEX) && UV_VERSION_HEX >= 0x010700 && defined(TCP_FASTOPEN_CONNECT)
+		if (family != AF_UNSPEC && uv_tcp_init_ex(loop, (uv_tcp_t *)handle, family) == 0) {
+			(void) set_tcp_option(handle, TCP_FASTOPEN_CONNECT, 1);
+		} else {
+			uv_tcp_init(loop, (uv_tcp_t *)handle);
+		}
+#else
+		(void) family;
 		uv_tcp_init(loop, (uv_tcp_t *)handle);
+#endif
 		uv_tcp_nodelay((uv_tcp_t *)handle, 1);
 	}
 
@@ -383,6 +798,10 @@ void io_deinit(uv_handle_t *handle)
 	uv_loop_t *loop = handle->loop;
 	if (loop && loop->data) {
 		struct worker_ctx *worker = loop->data;
+		if (handle->data) {
+			tcp_idle_unlink(worker, handle->data);
+			tcp_drain_unlink(worker, handle->data);
+		}
 		session_release(worker, handle->data);
 	} else {
 		session_free(handle->data);
@@ -21,8 +21,22 @@
 #include "lib/generic/array.h"
 
 struct qr_task;
+struct worker_ctx;
 struct tls_ctx_t;
 
+/** Stream read buffer size, fits the largest length-prefixed DNS message. */
+#define TCP_RBUF_SIZE (sizeof(uint16_t) + KNOT_WIRE_MAX_PKTSIZE)
+
+/** Queued response bytes per session before reading stops (backpressure).
+  * A slow (or deliberately stalled) reader otherwise keeps submitting
+  * queries whose answers pile up in the libuv send queue. */
+#define SESSION_WRITEQ_MAX (64 * 1024)
+
+/** Pipelined queries drained from one stream session per scheduling round.
+  * Sessions with more queries buffered take turns round-robin, so one heavy
+  * pipeliner cannot monopolize the event loop. */
+#define TCP_DRAIN_QUANTUM 4
+
 /* Per-session (TCP or UDP) persistent structure,
  * that exists between remote counterpart and a local socket.
  */
@@ -30,15 +44,40 @@ struct session {
 	bool outgoing;
 	bool throttled;
 	bool has_tls;
+	bool parked;   /**< Outgoing connection is idle in the worker's warm pool. */
+	bool muxed;    /**< Outgoing connection is published for query multiplexing. */
+	bool reusable; /**< Outgoing connection delivered a whole answer and may be pooled. */
+	uint64_t parked_since; /**< Loop timestamp when the connection was parked. */
+	uint16_t udp_uses;     /**< Queries served since the UDP handle was bound. */
+	char peer[64];         /**< Peer address key while the connection is pooled. */
+	uint8_t *rbuf;         /**< Stream read buffer, messages are framed in place. */
+	uint32_t rbuf_end;     /**< Number of buffered bytes. */
+	uint32_t write_queued; /**< Response bytes in the libuv send queue, see SESSION_WRITEQ_MAX. */
+	struct session *idle_next; /**< Links in the worker's client activity list. */
+	struct session *idle_prev;
+	struct session *drain_next; /**< Links in the worker's fair drain queue. */
+	struct session *drain_prev;
 	uv_timer_t timeout;
-	struct qr_task *buffering;
 	struct tls_ctx_t *tls_ctx;
-	array_t(struct qr_task *) tasks;
+	knot_mm_t pool; /**< Per-connection pool for transient state, see session_pool_reset(). */
+	array_t(struct qr_task *) tasks; /**< Allocated from the session pool. */
 };
 
 void session_free(struct session *s);
 struct session *session_new(void);
 
+/*! Wholesale-reset the session's transient state once the task list drains,
+ *  the per-connection pool equivalent of what kr_request::pool does per query. */
+void session_pool_reset(struct session *s);
+
+/*! Borrow a stream read buffer from the worker freelist. */
+uint8_t *tcp_rbuf_borrow(struct worker_ctx *worker);
+/*! Return a stream read buffer to the worker freelist. */
+void tcp_rbuf_release(struct worker_ctx *worker, uint8_t *rbuf);
+
+/*! Queue a session with buffered queries for the next fair drain round. */
+void tcp_drain_push(struct worker_ctx *worker, struct session *s);
+
 int udp_bind(uv_udp_t *handle, struct sockaddr *addr);
 int udp_bindfd(uv_udp_t *handle, int fd);
 int tcp_bind(uv_tcp_t *handle, struct sockaddr *addr);
@@ -46,7 +85,7 @@ int tcp_bind_tls(uv_tcp_t *handle, struct sockaddr *addr);
 int tcp_bindfd(uv_tcp_t *handle, int fd);
 int tcp_bindfd_tls(uv_tcp_t *handle, int fd);
 
-void io_create(uv_loop_t *loop, uv_handle_t *handle, int type);
+void io_create(uv_loop_t *loop, uv_handle_t *handle, int type, int family);
 void io_deinit(uv_handle_t *handle);
 void io_free(uv_handle_t *handle);
 
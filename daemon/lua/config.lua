@@ -13,4 +13,9 @@ end
 -- Open cache if not set/disabled
 if not cache.current_size then
 	cache.size = 100 * MB
-end
\ No newline at end of file
+end
+-- Collect expired records in small batches,
+-- so the cache doesn't bloat with dead entries
+event.recurrent(10 * sec, function ()
+	cache.gc()
+end)
\ No newline at end of file
@@ -210,32 +210,33 @@ struct kr_query {
 	uint32_t flags;
 	uint32_t secret;
 	uint16_t fails;
-	struct timeval timestamp;
+	uint16_t priority;
 	struct kr_zonecut zone_cut;
 	uint8_t _stub[]; /* Do not touch */
 };
 struct kr_rplan {
 	uint8_t _stub[]; /* Do not touch */
 };
+struct kr_layer_set;
 struct kr_request {
 	struct kr_context *ctx;
 	knot_pkt_t *answer;
 	struct kr_query *current_query;
+	struct kr_layer_set *layers;
+	uint32_t options;
+	int state;
 	struct {
 		const knot_rrset_t *key;
 		const struct sockaddr *addr;
 		const struct sockaddr *dst_addr;
 		const knot_pkt_t *packet;
 		const knot_rrset_t *opt;
+		bool tcp;
 	} qsource;
 	struct {
 	    unsigned rtt;
 	    const struct sockaddr *addr;
 	} upstream;
-	uint32_t options;
-	int state;
-	rr_array_t authority;
-	rr_array_t additional;
 	uint8_t _stub[]; /* Do not touch */
 };
 struct kr_context
@@ -300,11 +301,51 @@ int kr_pkt_recycle(knot_pkt_t *pkt);
 const char *kr_inaddr(const struct sockaddr *addr);
 int kr_inaddr_family(const struct sockaddr *addr);
 int kr_inaddr_len(const struct sockaddr *addr);
+const char *kr_straddr_buf(const struct sockaddr *addr, char *buf, size_t maxlen);
 int kr_straddr_family(const char *addr);
 int kr_straddr_subnet(void *dst, const char *addr);
 int kr_bitcmp(const char *a, const char *b, int bits);
 int kr_family_len(int family);
 int kr_rrarray_add(rr_array_t *array, const knot_rrset_t *rr, void *pool);
+/* Compiled suffix sets */
+struct kr_suffix_set;
+struct kr_suffix_set *kr_suffix_set_create(void);
+void kr_suffix_set_free(struct kr_suffix_set *set);
+int kr_suffix_set_add(struct kr_suffix_set *set, const knot_dname_t *name);
+int kr_suffix_set_compile(struct kr_suffix_set *set);
+int kr_suffix_set_match(struct kr_suffix_set *set, const knot_dname_t *name);
+/* Filter rule bytecode */
+struct kr_dafvm;
+enum kr_dafvm_op {
+	KR_DAFVM_TRUE = 1, KR_DAFVM_QNAME, KR_DAFVM_SRC, KR_DAFVM_DST,
+	KR_DAFVM_AND, KR_DAFVM_OR, KR_DAFVM_RET
+};
+struct kr_dafvm *kr_dafvm_create(unsigned memo_size);
+void kr_dafvm_free(struct kr_dafvm *vm);
+int kr_dafvm_suffix(struct kr_dafvm *vm, const knot_dname_t *name);
+int kr_dafvm_subnet(struct kr_dafvm *vm, const char *subnet);
+int kr_dafvm_emit(struct kr_dafvm *vm, int op, int operand);
+void kr_dafvm_clear(struct kr_dafvm *vm);
+int kr_dafvm_match(struct kr_dafvm *vm, const knot_dname_t *qname,
+                   const struct sockaddr *src, const struct sockaddr *dst);
+/* Subnet index */
+struct kr_lpm;
+struct kr_lpm *kr_lpm_create(void);
+void kr_lpm_free(struct kr_lpm *lpm);
+int kr_lpm_add(struct kr_lpm *lpm, const char *subnet, int value);
+int kr_lpm_compile(struct kr_lpm *lpm);
+int kr_lpm_match(struct kr_lpm *lpm, const struct sockaddr *addr);
+/* Address renumbering */
+struct kr_renumber;
+struct kr_renumber *kr_renumber_create(void);
+void kr_renumber_free(struct kr_renumber *r);
+int kr_renumber_prefix(struct kr_renumber *r, const uint8_t *subnet, int bitlen,
+                       const uint8_t *target, int target_len);
+int kr_renumber_name(struct kr_renumber *r, const knot_dname_t *owner,
+                     const uint8_t *target, int target_len);
+int kr_renumber_answer(struct kr_renumber *r, knot_pkt_t *answer);
+/* Scratch memory */
+void *kr_request_scratch(struct kr_request *request, size_t size);
 /* Trust anchors */
 knot_rrset_t *kr_ta_get(map_t *trust_anchors, const knot_dname_t *name);
 int kr_ta_add(map_t *trust_anchors, const knot_dname_t *name, uint16_t type,
@@ -324,12 +365,28 @@ local query_flag = ffi.new('struct query_flag')
 
 -- Metatype for sockaddr
 local addr_buf = ffi.new('char[16]')
+-- Rendered addresses are cached (weakly), the resolver keeps talking
+-- to the same small set of servers so conversions repeat constantly
+local straddr_buf = ffi.new('char[46]')
+local straddr_cache = setmetatable({}, {__mode = 'v'})
+local function straddr(sa)
+	local key = ffi.string(C.kr_inaddr(sa), C.kr_inaddr_len(sa))
+	local str = straddr_cache[key]
+	if not str then
+		local ret = C.kr_straddr_buf(sa, straddr_buf, 46)
+		if ret == nil then return nil end
+		str = ffi.string(ret)
+		straddr_cache[key] = str
+	end
+	return str
+end
 local sockaddr_t = ffi.typeof('struct sockaddr')
 ffi.metatype( sockaddr_t, {
 	__index = {
 		len = function(sa) return C.kr_inaddr_len(sa) end,
 		ip = function (sa) return C.kr_inaddr(sa) end,
 		family = function (sa) return C.kr_inaddr_family(sa) end,
+		tostring = straddr,
 	}
 })
 
@@ -451,6 +508,11 @@ ffi.metatype( kr_request_t, {
 			if req.current_query == nil then return nil end
 			return req.current_query
 		end,
+		-- Scratch memory released together with the request
+		scratch = function(req, size)
+			assert(req)
+			return C.kr_request_scratch(req, size)
+		end,
 		resolved = function(req)
 			assert(req)
 			local qry = C.kr_rplan_resolved(C.kr_resolve_plan(req))
@@ -474,9 +536,12 @@ ffi.metatype( kr_request_t, {
 	},
 })
 
--- Pretty print for domain name
+-- Pretty print for domain name (rendered into a fixed buffer, no malloc)
+local dname_str_buf = ffi.new('char[?]', 1025)
 local function dname2str(dname)
-	return ffi.string(ffi.gc(C.knot_dname_to_str(nil, dname, 0), C.free))
+	local str = C.knot_dname_to_str(dname_str_buf, dname, 1025)
+	if str == nil then return nil end
+	return ffi.string(str)
 end
 
 -- Pretty print for RR
@@ -491,6 +556,30 @@ local function rr2str(rr)
 		dname2str(rr.owner), rr.ttl, rr.type, #rr.rdata, rdata)
 end
 
+-- Cache typed casts of hook arguments per address. The daemon recycles
+-- requests and packets from freelists, so the same pointers come back
+-- constantly and a weak-valued cache avoids a cdata allocation per hook.
+local pkt_ptr_t = ffi.typeof('knot_pkt_t *')
+local request_ptr_t = ffi.typeof('struct kr_request *')
+local pkt_cast_cache = setmetatable({}, {__mode = 'v'})
+local request_cast_cache = setmetatable({}, {__mode = 'v'})
+local function pkt_cast(udata)
+	local pkt = pkt_cast_cache[udata]
+	if pkt == nil then
+		pkt = ffi.cast(pkt_ptr_t, udata)
+		pkt_cast_cache[udata] = pkt
+	end
+	return pkt
+end
+local function request_cast(udata)
+	local req = request_cast_cache[udata]
+	if req == nil then
+		req = ffi.cast(request_ptr_t, udata)
+		request_cast_cache[udata] = req
+	end
+	return req
+end
+
 -- Module API
 local kres = {
 	-- Constants
@@ -501,8 +590,8 @@ local kres = {
 	query = query_flag,
 	NOOP = 0, YIELD = 0, CONSUME = 1, PRODUCE = 2, DONE = 4, FAIL = 8,
 	-- Metatypes
-	pkt_t = function (udata) return ffi.cast('knot_pkt_t *', udata) end,
-	request_t = function (udata) return ffi.cast('struct kr_request *', udata) end,
+	pkt_t = pkt_cast,
+	request_t = request_cast,
 	-- Global API functions
 	str2dname = function(name)
 		local dname = ffi.gc(C.knot_dname_from_str(nil, name, 0), C.free)
@@ -17,9 +17,17 @@
 #include <stdlib.h>
 #include <string.h>
 #include <getopt.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#ifdef __linux__
+#include <sched.h>
+#endif
 #include <uv.h>
 #include <assert.h>
 #include <contrib/cleanup.h>
+#include <contrib/hash/hash.h>
+#include <contrib/wire.h>
 #include <contrib/ucw/mempool.h>
 #include <contrib/ccan/asprintf/asprintf.h>
 #include <libknot/error.h>
@@ -47,6 +55,99 @@
 static bool g_quiet = false;
 static bool g_interactive = true;
 
+/*
+ * Binary control protocol.
+ *
+ * High-frequency telemetry polls (stats, cache counters, slow-log drain,
+ * health checks) are served on the control socket without touching the Lua
+ * state.  A request is a NUL byte (never valid Lua source) followed by a
+ * single opcode character; the Lua REPL keeps working on the same socket
+ * for everything else.  Replies carry a fixed header "KR" + version +
+ * echoed opcode + payload length, integers in network byte order.
+ */
+#define BINPROTO_MAGIC   0x00
+#define BINPROTO_VERSION 1
+
+static FILE *binproto_hdr(FILE *out, uint8_t opcode, uint32_t len)
+{
+	uint8_t hdr[8] = { 'K', 'R', BINPROTO_VERSION, opcode };
+	wire_write_u32(hdr + 4, len);
+	fwrite(hdr, sizeof(hdr), 1, out);
+	return out;
+}
+
+static void binproto_cmd(struct engine *engine, struct worker_ctx *worker,
+                         uint8_t opcode, FILE *out)
+{
+	uint8_t scratch[8];
+	switch (opcode) {
+	case 'p': /* Ping, header alone is the liveness proof. */
+		binproto_hdr(out, opcode, 0);
+		break;
+	case 's': { /* Worker counters, fixed order. */
+		const uint64_t vals[] = {
+			worker->stats.concurrent, worker->stats.udp,
+			worker->stats.tcp, worker->stats.ipv4,
+			worker->stats.ipv6, worker->stats.queries,
+			worker->stats.dropped, worker->stats.timeout,
+			worker->load.shed
+		};
+		binproto_hdr(out, opcode, sizeof(vals));
+		for (size_t i = 0; i < sizeof(vals) / sizeof(vals[0]); ++i) {
+			wire_write_u64(scratch, vals[i]);
+			fwrite(scratch, sizeof(uint64_t), 1, out);
+		}
+		break;
+	}
+	case 'c': { /* Cache counters and occupancy. */
+		const struct kr_cache *cache = &engine->resolver.cache;
+		const uint32_t vals[] = {
+			cache->stats.hit, cache->stats.miss,
+			cache->stats.insert, cache->stats.delete,
+			cache->admit.usage
+		};
+		binproto_hdr(out, opcode, sizeof(vals));
+		for (size_t i = 0; i < sizeof(vals) / sizeof(vals[0]); ++i) {
+			wire_write_u32(scratch, vals[i]);
+			fwrite(scratch, sizeof(uint32_t), 1, out);
+		}
+		break;
+	}
+	case 'l': { /* Drain the slow-query ring, oldest first. */
+		uint32_t payload = sizeof(uint32_t);
+		size_t first = (worker->slowlog.head + SLOWLOG_COUNT
+		                - worker->slowlog.len) % SLOWLOG_COUNT;
+		for (size_t i = 0; i < worker->slowlog.len; ++i) {
+			const struct slow_query *sq =
+				&worker->slowlog.q[(first + i) % SLOWLOG_COUNT];
+			payload += 2 * sizeof(uint32_t) + 2 * sizeof(uint16_t)
+			         + 1 + knot_dname_size(sq->qname);
+		}
+		binproto_hdr(out, opcode, payload);
+		wire_write_u32(scratch, worker->slowlog.len);
+		fwrite(scratch, sizeof(uint32_t), 1, out);
+		for (size_t i = 0; i < worker->slowlog.len; ++i) {
+			const struct slow_query *sq =
+				&worker->slowlog.q[(first + i) % SLOWLOG_COUNT];
+			wire_write_u32(scratch, sq->elapsed_us);
+			wire_write_u32(scratch + 4, 0); /* Reserved. */
+			fwrite(scratch, 2 * sizeof(uint32_t), 1, out);
+			wire_write_u16(scratch, sq->qtype);
+			wire_write_u16(scratch + 2, sq->round_trips);
+			fwrite(scratch, 2 * sizeof(uint16_t), 1, out);
+			scratch[0] = knot_dname_size(sq->qname);
+			fwrite(scratch, 1, 1, out);
+			fwrite(sq->qname, scratch[0], 1, out);
+		}
+		worker->slowlog.head = worker->slowlog.len = 0;
+		break;
+	}
+	default: /* Unknown opcode, echoed as zero. */
+		binproto_hdr(out, 0, 0);
+		break;
+	}
+}
+
 /*
  * TTY control
  */
@@ -67,6 +168,17 @@ static void tty_read(uv_stream_t *stream, ssize_t nread, const uv_buf_t *buf)
 			out = outerr = fdopen(dup_fd, "w");
 		}
 	}
+	/* Binary commands bypass the interpreter entirely. */
+	if (stream && buf && nread >= 2 && (uint8_t)buf->base[0] == BINPROTO_MAGIC) {
+		struct engine *engine = stream->data;
+		binproto_cmd(engine, stream->loop->data, buf->base[1], out);
+		fflush(out);
+		free(buf->base);
+		if (stream_fd != STDIN_FILENO) {
+			fclose(out);
+		}
+		return;
+	}
 	/* Execute */
 	if (stream && buf && nread > 0) {
 		char *cmd = buf->base;
@@ -224,6 +336,150 @@ static void signal_handler(uv_signal_t *handle, int signum)
 	uv_signal_stop(handle);
 }
 
+/*
+ * Hot-standby handoff.
+ *
+ * Every fork serves a handoff socket at handoff/<fork_id> in the rundir.
+ * A replacement instance started with -H/--handoff connects to it instead
+ * of binding addresses itself, inherits duplicates of the listening
+ * sockets over SCM_RIGHTS, and writes a single readiness byte back once
+ * its engine (and with it the shared cache) is up.  Only then does the
+ * predecessor close its listeners and drain in-flight queries before
+ * exiting.  The inherited descriptors refer to the very same sockets, so
+ * datagrams queued during the switch are read by the successor and the
+ * deploy costs no queries.
+ */
+
+/** Interval between checks whether the drained instance is idle (ms). */
+#define HANDOFF_DRAIN_INTERVAL 100
+
+static struct {
+	uv_poll_t listener;
+	uv_poll_t conn;
+	uv_timer_t drain;
+	int listen_fd;
+	int conn_fd;
+} g_handoff = { .listen_fd = -1, .conn_fd = -1 };
+
+static void handoff_path(struct sockaddr_un *sa, int fork_id)
+{
+	memset(sa, 0, sizeof(*sa));
+	sa->sun_family = AF_UNIX;
+	snprintf(sa->sun_path, sizeof(sa->sun_path), "handoff/%d", fork_id);
+}
+
+static void handoff_drain_check(uv_timer_t *timer)
+{
+	struct worker_ctx *worker = timer->loop->data;
+	if (worker->stats.concurrent == 0) {
+		uv_timer_stop(timer);
+		uv_stop(timer->loop);
+	}
+}
+
+/** The successor signalled readiness (or died), stop accepting and drain. */
+static void handoff_conn_activity(uv_poll_t *handle, int status, int events)
+{
+	struct engine *engine = handle->data;
+	uv_poll_stop(handle);
+	uint8_t ready = 0;
+	const bool ok = status == 0 &&
+		read(g_handoff.conn_fd, &ready, sizeof(ready)) == sizeof(ready) &&
+		ready == 1;
+	close(g_handoff.conn_fd);
+	g_handoff.conn_fd = -1;
+	if (!ok) { /* Successor never came up, keep serving. */
+		kr_log_error("[system] handoff: replacement not ready, resuming\n");
+		return;
+	}
+	kr_log_info("[system] handoff: successor ready, draining\n");
+	/* Close the handoff listener without unlinking its path, the
+	 * successor has already replaced it with its own socket. */
+	uv_poll_stop(&g_handoff.listener);
+	close(g_handoff.listen_fd);
+	g_handoff.listen_fd = -1;
+	network_pause(&engine->net);
+	uv_timer_init(handle->loop, &g_handoff.drain);
+	uv_timer_start(&g_handoff.drain, handoff_drain_check,
+	               HANDOFF_DRAIN_INTERVAL, HANDOFF_DRAIN_INTERVAL);
+}
+
+static void handoff_listener_activity(uv_poll_t *handle, int status, int events)
+{
+	struct engine *engine = handle->data;
+	if (status != 0) {
+		return;
+	}
+	int conn = accept(g_handoff.listen_fd, NULL, NULL);
+	if (conn < 0) {
+		return;
+	}
+	if (g_handoff.conn_fd != -1) { /* One takeover at a time. */
+		close(conn);
+		return;
+	}
+	if (network_handoff_export(&engine->net, conn) != 0) {
+		kr_log_error("[system] handoff: %s\n", strerror(errno));
+		close(conn);
+		return;
+	}
+	g_handoff.conn_fd = conn;
+	g_handoff.conn.data = engine;
+	if (uv_poll_init(handle->loop, &g_handoff.conn, conn) != 0 ||
+	    uv_poll_start(&g_handoff.conn, UV_READABLE, handoff_conn_activity) != 0) {
+		close(conn);
+		g_handoff.conn_fd = -1;
+	}
+}
+
+static int handoff_serve(uv_loop_t *loop, struct engine *engine, int fork_id)
+{
+	(void) mkdir("handoff", S_IRWXU|S_IRWXG);
+	struct sockaddr_un sa;
+	handoff_path(&sa, fork_id);
+	int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sock < 0) {
+		return kr_error(errno);
+	}
+	unlink(sa.sun_path); /* Replace leftover of a previous instance. */
+	if (bind(sock, (struct sockaddr *)&sa, sizeof(sa)) != 0 ||
+	    listen(sock, 1) != 0) {
+		close(sock);
+		return kr_error(errno);
+	}
+	g_handoff.listen_fd = sock;
+	g_handoff.listener.data = engine;
+	if (uv_poll_init(loop, &g_handoff.listener, sock) != 0 ||
+	    uv_poll_start(&g_handoff.listener, UV_READABLE, handoff_listener_activity) != 0) {
+		close(sock);
+		g_handoff.listen_fd = -1;
+		return kr_error(EINVAL);
+	}
+	return kr_ok();
+}
+
+/** Inherit listening sockets from a running instance.
+  * Returns the connected socket for the later readiness byte. */
+static int handoff_takeover(struct network *net, int fork_id)
+{
+	struct sockaddr_un sa;
+	handoff_path(&sa, fork_id);
+	int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sock < 0) {
+		return kr_error(errno);
+	}
+	if (connect(sock, (struct sockaddr *)&sa, sizeof(sa)) != 0) {
+		close(sock);
+		return kr_error(errno);
+	}
+	int ret = network_handoff_import(net, sock);
+	if (ret != 0) {
+		close(sock);
+		return ret;
+	}
+	return sock;
+}
+
 static const char *set_addr(char *addr, int *port)
 {
 	char *p = strchr(addr, '#');
@@ -239,6 +495,29 @@ static const char *set_addr(char *addr, int *port)
  * Server operation.
  */
 
+#ifdef __linux__
+/* Pin the process to one CPU, spreading consecutive forks over consecutive
+ * processors.  This must happen before the engine and worker pools are
+ * allocated, so that first-touch placement makes them local to the NUMA node
+ * of the pinned CPU.  Operators can align NIC IRQ/RSS queues with the same
+ * CPUs to keep packet processing on one node end to end. */
+static void pin_worker(int fork_id, int forks)
+{
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	if (forks < 2 || ncpu < 2) {
+		return;
+	}
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(fork_id % ncpu, &set);
+	if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+		kr_log_error("[system] failed to set worker affinity: %s\n", strerror(errno));
+	} else if (kr_debug_status()) {
+		kr_log_info("[system] worker %d pinned to cpu %ld\n", fork_id, fork_id % ncpu);
+	}
+}
+#endif
+
 static int fork_workers(fd_array_t *ipc_set, int forks)
 {
 	/* Fork subprocesses if requested */
@@ -282,6 +561,7 @@ static void help(int argc, char *argv[])
 	       " -c, --config=[path]  Config file path (relative to [rundir]) (default: config).\n"
 	       " -k, --keyfile=[path] File containing trust anchors (DS or DNSKEY).\n"
 	       " -f, --forks=N        Start N forks sharing the configuration.\n"
+	       " -H, --handoff        Take over sockets from a running instance, then drain it.\n"
 	       " -q, --quiet          Quiet output, no prompt in interactive mode.\n"
 	       " -v, --verbose        Run in verbose mode.\n"
 	       " -V, --version        Print version of the server.\n"
@@ -364,6 +644,7 @@ int main(int argc, char **argv)
 	const char *config = NULL;
 	char *keyfile_buf = NULL;
 	int control_fd = -1;
+	bool handoff = false;
 
 	/* Long options. */
 	int c = 0, li = 0, ret = 0;
@@ -375,13 +656,14 @@ int main(int argc, char **argv)
 		{"config", required_argument, 0, 'c'},
 		{"keyfile",required_argument, 0, 'k'},
 		{"forks",required_argument,   0, 'f'},
+		{"handoff",    no_argument,   0, 'H'},
 		{"verbose",    no_argument,   0, 'v'},
 		{"quiet",      no_argument,   0, 'q'},
 		{"version",   no_argument,    0, 'V'},
 		{"help",      no_argument,    0, 'h'},
 		{0, 0, 0, 0}
 	};
-	while ((c = getopt_long(argc, argv, "a:t:S:T:c:f:k:vqVh", opts, &li)) != -1) {
+	while ((c = getopt_long(argc, argv, "a:t:S:T:c:f:Hk:vqVh", opts, &li)) != -1) {
 		switch (c)
 		{
 		case 'a':
@@ -408,6 +690,9 @@ int main(int argc, char **argv)
 				return EXIT_FAILURE;
 			}
 			break;
+		case 'H':
+			handoff = true;
+			break;
 		case 'k':
 			keyfile_buf = malloc(PATH_MAX);
 			if (!keyfile_buf) {
@@ -515,11 +800,29 @@ int main(int argc, char **argv)
 	/* Connect forks with local socket */
 	fd_array_t ipc_set;
 	array_init(ipc_set);
+	/* Map the shared stats segment, forks inherit it. */
+	struct engine_shm_slot *shm_stats = engine_shm_create(forks);
+	if (forks > 1 && !shm_stats) {
+		kr_log_error("[system] failed to map shared stats: %s\n", strerror(errno));
+	}
+	/* Map the shared NS reputation tables, so the forks pool
+	 * what they learn about nameservers instead of probing
+	 * every one of them once per fork. The tables are probed with the
+	 * keyed hash, so its secret must be drawn before forking - forks
+	 * drawing their own would disagree on slots for the same key. */
+	hash_keyed_init();
+	struct engine_shm_nsrep *shm_nsrep = engine_shm_nsrep_create(forks);
+	if (forks > 1 && !shm_nsrep) {
+		kr_log_error("[system] failed to map shared NS reputation: %s\n", strerror(errno));
+	}
 	/* Fork subprocesses if requested */
 	int fork_id = fork_workers(&ipc_set, forks);
 	if (fork_id < 0) {
 		return EXIT_FAILURE;
 	}
+#ifdef __linux__
+	pin_worker(fork_id, forks);
+#endif
 
 	kr_crypto_init();
 
@@ -534,55 +837,71 @@ int main(int argc, char **argv)
 		kr_log_error("[system] failed to initialize engine: %s\n", kr_strerror(ret));
 		return EXIT_FAILURE;
 	}
+	engine.shm_stats = shm_stats;
+	engine.shm_stats_len = forks;
+	engine.shm_stats_id = fork_id;
+	engine_shm_nsrep_attach(&engine, shm_nsrep);
 	/* Create worker */
 	struct worker_ctx *worker = worker_create(&engine, &pool, fork_id, forks);
 	if (!worker) {
 		kr_log_error("[system] not enough memory\n");
 		return EXIT_FAILURE;
 	}
-	/* Bind to passed fds and run */
-	for (size_t i = 0; i < fd_set.len; ++i) {
-		ret = network_listen_fd(&engine.net, fd_set.at[i], false);
-		if (ret != 0) {
-			kr_log_error("[system] listen on fd=%d %s\n", fd_set.at[i], kr_strerror(ret));
-			ret = EXIT_FAILURE;
-			break;
+	/* Inherit sockets from a running instance instead of binding anew,
+	 * then fall through to the address list when there is none. */
+	int handoff_sock = -1;
+	if (handoff) {
+		handoff_sock = handoff_takeover(&engine.net, fork_id);
+		if (handoff_sock < 0) {
+			kr_log_error("[system] handoff: no instance to take over: %s\n",
+			             kr_strerror(handoff_sock));
 		}
 	}
-	/* Do the same for TLS */
-	for (size_t i = 0; i < tls_fd_set.len; ++i) {
-		ret = network_listen_fd(&engine.net, tls_fd_set.at[i], true);
-		if (ret != 0) {
-			kr_log_error("[system] TLS listen on fd=%d %s\n", tls_fd_set.at[i], kr_strerror(ret));
-			ret = EXIT_FAILURE;
-			break;
-		}
-	}
-	/* Bind to sockets and run */
-	if (ret == 0) {
-		for (size_t i = 0; i < addr_set.len; ++i) {
-			int port = 53;
-			const char *addr = set_addr(addr_set.at[i], &port);
-			ret = network_listen(&engine.net, addr, (uint16_t)port, NET_UDP|NET_TCP);
+	if (handoff_sock < 0) {
+		/* Bind to passed fds and run */
+		for (size_t i = 0; i < fd_set.len; ++i) {
+			ret = network_listen_fd(&engine.net, fd_set.at[i], false);
 			if (ret != 0) {
-				kr_log_error("[system] bind to '%s#%d' %s\n", addr, port, kr_strerror(ret));
+				kr_log_error("[system] listen on fd=%d %s\n", fd_set.at[i], kr_strerror(ret));
 				ret = EXIT_FAILURE;
 				break;
 			}
 		}
-	}
-	/* Bind to TLS sockets */
-	if (ret == 0) {
-		for (size_t i = 0; i < tls_set.len; ++i) {
-			int port = KR_DNS_TLS_PORT;
-			const char *addr = set_addr(tls_set.at[i], &port);
-			ret = network_listen(&engine.net, addr, (uint16_t)port, NET_TCP|NET_TLS);
+		/* Do the same for TLS */
+		for (size_t i = 0; i < tls_fd_set.len; ++i) {
+			ret = network_listen_fd(&engine.net, tls_fd_set.at[i], true);
 			if (ret != 0) {
-				kr_log_error("[system] bind to '%s#%d' (TLS) %s\n", addr, port, kr_strerror(ret));
+				kr_log_error("[system] TLS listen on fd=%d %s\n", tls_fd_set.at[i], kr_strerror(ret));
 				ret = EXIT_FAILURE;
 				break;
 			}
 		}
+		/* Bind to sockets and run */
+		if (ret == 0) {
+			for (size_t i = 0; i < addr_set.len; ++i) {
+				int port = 53;
+				const char *addr = set_addr(addr_set.at[i], &port);
+				ret = network_listen(&engine.net, addr, (uint16_t)port, NET_UDP|NET_TCP);
+				if (ret != 0) {
+					kr_log_error("[system] bind to '%s#%d' %s\n", addr, port, kr_strerror(ret));
+					ret = EXIT_FAILURE;
+					break;
+				}
+			}
+		}
+		/* Bind to TLS sockets */
+		if (ret == 0) {
+			for (size_t i = 0; i < tls_set.len; ++i) {
+				int port = KR_DNS_TLS_PORT;
+				const char *addr = set_addr(tls_set.at[i], &port);
+				ret = network_listen(&engine.net, addr, (uint16_t)port, NET_TCP|NET_TLS);
+				if (ret != 0) {
+					kr_log_error("[system] bind to '%s#%d' (TLS) %s\n", addr, port, kr_strerror(ret));
+					ret = EXIT_FAILURE;
+					break;
+				}
+			}
+		}
 	}
 
 	/* Block signals. */
@@ -607,6 +926,19 @@ int main(int argc, char **argv)
 				engine_cmd(engine.L, cmd, false);
 				lua_settop(engine.L, 0);
 			}
+			/* Engine and cache are up, tell the predecessor to drain. */
+			if (handoff_sock >= 0) {
+				uint8_t ready = 1;
+				if (write(handoff_sock, &ready, sizeof(ready)) != sizeof(ready)) {
+					kr_log_error("[system] handoff: %s\n", strerror(errno));
+				}
+				close(handoff_sock);
+			}
+			/* Serve the handoff socket for the next deploy. */
+			if (handoff_serve(loop, &engine, fork_id) != 0) {
+				kr_log_error("[system] handoff: failed to create socket: %s\n",
+				             strerror(errno));
+			}
 			/* Run the event loop */
 			ret = run_worker(loop, &engine, &ipc_set, fork_id == 0, control_fd);
 		}
@@ -617,6 +949,8 @@ int main(int argc, char **argv)
 	}
 	/* Cleanup. */
 	engine_deinit(&engine);
+	engine_shm_free(shm_stats, forks);
+	engine_shm_nsrep_free(shm_nsrep);
 	worker_reclaim(worker);
 	mp_delete(pool.ctx);
 	array_clear(addr_set);
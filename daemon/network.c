@@ -16,6 +16,11 @@
 
 #include <unistd.h>
 #include <assert.h>
+#include <errno.h>
+#include <sys/socket.h>
+#if __linux__
+#include <linux/filter.h>
+#endif
 #include "daemon/network.h"
 #include "daemon/worker.h"
 #include "daemon/io.h"
@@ -48,6 +53,8 @@ void network_init(struct network *net, uv_loop_t *loop)
 	if (net != NULL) {
 		net->loop = loop;
 		net->endpoints = map_make();
+		net->tls_client = map_make();
+		net->tls_sessions = map_make();
 	}
 }
 
@@ -96,12 +103,41 @@ static int free_key(const char *key, void *val, void *ext)
 	return kr_ok();
 }
 
+/** Value destructor for maps holding plain allocations. */
+static int free_val(const char *key, void *val, void *ext)
+{
+	free(val);
+	return kr_ok();
+}
+
+/** Endpoint visitor closing handles asynchronously (see @file map.h) */
+static int pause_key(const char *key, void *val, void *ext)
+{
+	endpoint_array_t *ep_array = val;
+	for (size_t i = ep_array->len; i--;) {
+		close_endpoint(ep_array->at[i], false);
+	}
+	return 0;
+}
+
+void network_pause(struct network *net)
+{
+	if (net != NULL) {
+		map_walk(&net->endpoints, pause_key, 0);
+		map_walk(&net->endpoints, free_key, 0);
+		map_clear(&net->endpoints);
+	}
+}
+
 void network_deinit(struct network *net)
 {
 	if (net != NULL) {
 		map_walk(&net->endpoints, close_key, 0);
 		map_walk(&net->endpoints, free_key, 0);
 		map_clear(&net->endpoints);
+		map_clear(&net->tls_client);
+		map_walk(&net->tls_sessions, free_val, 0);
+		map_clear(&net->tls_sessions);
 		tls_credentials_free(net->tls_credentials);
 		net->tls_credentials = NULL;
 	}
@@ -342,3 +378,196 @@ int network_close(struct network *net, const char *addr, uint16_t port)
 
 	return kr_ok();
 }
+
+#if (__linux__ && defined(SO_ATTACH_REUSEPORT_CBPF))
+/** @internal Attach a reuseport program routing datagrams to forks.
+  *
+  * Name mode folds two 32bit words of the QNAME region (payload offsets
+  * 12 and 16) into the fork index, so every fork owns a slice of the
+  * keyspace and its caches relearn only that slice. An out-of-bounds
+  * load on a tiny query makes the program return 0, which is still
+  * deterministic for a given name, just not spread.
+  *
+  * Flow mode reduces the kernel flow hash modulo the *configured* fork
+  * count. The kernel default does the same modulo the number of sockets
+  * currently in the group, so one fork leaving reshuffles every flow;
+  * with a constant divisor the mapping never moves, and a slot whose
+  * socket is gone falls back to the kernel's default pick, so only the
+  * dead fork's share is disturbed until it rebinds. */
+static int endpoint_affinity(uv_udp_t *handle, int count, bool by_flow)
+{
+	uv_os_fd_t fd = 0;
+	if (uv_fileno((uv_handle_t *)handle, &fd) != 0) {
+		return kr_error(EINVAL);
+	}
+	struct sock_filter prog_name[] = {
+		BPF_STMT(BPF_LD  | BPF_W | BPF_ABS, 16),
+		BPF_STMT(BPF_MISC | BPF_TAX, 0),
+		BPF_STMT(BPF_LD  | BPF_W | BPF_ABS, 12),
+		BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+		BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, count),
+		BPF_STMT(BPF_RET | BPF_A, 0),
+	};
+	struct sock_filter prog_flow[] = {
+		BPF_STMT(BPF_LD  | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_RXHASH),
+		BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, count),
+		BPF_STMT(BPF_RET | BPF_A, 0),
+	};
+	struct sock_fprog fprog = {
+		by_flow ? sizeof(prog_flow) / sizeof(prog_flow[0])
+		        : sizeof(prog_name) / sizeof(prog_name[0]),
+		by_flow ? prog_flow : prog_name
+	};
+	if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &fprog, sizeof(fprog)) != 0) {
+		return kr_error(errno);
+	}
+	return kr_ok();
+}
+
+struct affinity_ctx {
+	int count;
+	bool by_flow;
+	int ret;
+};
+
+/** Endpoint visitor (see @file map.h) */
+static int affinity_key(const char *key, void *val, void *ext)
+{
+	endpoint_array_t *ep_array = val;
+	struct affinity_ctx *ctx = ext;
+	for (size_t i = ep_array->len; i--;) {
+		struct endpoint *ep = ep_array->at[i];
+		if (ep->udp) {
+			int ret = endpoint_affinity(ep->udp, ctx->count, ctx->by_flow);
+			if (ret != 0 && ctx->ret == 0) {
+				ctx->ret = ret;
+			}
+		}
+	}
+	return 0;
+}
+
+int network_affinity(struct network *net, int count, bool by_flow)
+{
+	if (!net || count <= 0) {
+		return kr_error(EINVAL);
+	}
+	struct affinity_ctx ctx = { count, by_flow, kr_ok() };
+	map_walk(&net->endpoints, affinity_key, &ctx);
+	return ctx.ret;
+}
+#else
+int network_affinity(struct network *net, int count, bool by_flow)
+{
+	return kr_error(ENOTSUP);
+}
+#endif
+
+/* Each listening socket travels as one sendmsg() with a single data byte
+ * (non-zero for TLS endpoints) and the descriptor in SCM_RIGHTS ancillary
+ * data; a trailing byte without a descriptor terminates the stream.  The
+ * receiver re-derives address, port and socket type from the descriptor
+ * itself (see network_listen_fd), so the flag byte only carries what the
+ * socket cannot tell. */
+
+/** @internal Send one descriptor with a flag byte over a local socket. */
+static int handoff_send(int sock, int fd, uint8_t flag)
+{
+	char cbuf[CMSG_SPACE(sizeof(int))];
+	memset(cbuf, 0, sizeof(cbuf));
+	struct iovec iov = { &flag, sizeof(flag) };
+	struct msghdr msg = {
+		.msg_iov = &iov, .msg_iovlen = 1,
+		.msg_control = cbuf, .msg_controllen = sizeof(cbuf)
+	};
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+	if (sendmsg(sock, &msg, 0) < 0) {
+		return kr_error(errno);
+	}
+	return kr_ok();
+}
+
+struct handoff_ctx {
+	int sock;
+	int ret;
+};
+
+/** Endpoint visitor (see @file map.h) */
+static int handoff_key(const char *key, void *val, void *ext)
+{
+	endpoint_array_t *ep_array = val;
+	struct handoff_ctx *ctx = ext;
+	for (size_t i = ep_array->len; i--;) {
+		struct endpoint *ep = ep_array->at[i];
+		uv_os_fd_t fd = 0;
+		if (ep->udp && uv_fileno((uv_handle_t *)ep->udp, &fd) == 0) {
+			int ret = handoff_send(ctx->sock, fd, 0);
+			if (ret != 0 && ctx->ret == 0) {
+				ctx->ret = ret;
+			}
+		}
+		if (ep->tcp && uv_fileno((uv_handle_t *)ep->tcp, &fd) == 0) {
+			int ret = handoff_send(ctx->sock, fd, (ep->flags & NET_TLS) ? 1 : 0);
+			if (ret != 0 && ctx->ret == 0) {
+				ctx->ret = ret;
+			}
+		}
+	}
+	return 0;
+}
+
+int network_handoff_export(struct network *net, int sock)
+{
+	if (!net || sock < 0) {
+		return kr_error(EINVAL);
+	}
+	struct handoff_ctx ctx = { sock, kr_ok() };
+	map_walk(&net->endpoints, handoff_key, &ctx);
+	/* Terminate with a flag byte carrying no descriptor. */
+	uint8_t end = 0;
+	if (ctx.ret == 0 && write(sock, &end, sizeof(end)) != sizeof(end)) {
+		ctx.ret = kr_error(errno);
+	}
+	return ctx.ret;
+}
+
+int network_handoff_import(struct network *net, int sock)
+{
+	if (!net || sock < 0) {
+		return kr_error(EINVAL);
+	}
+	size_t count = 0;
+	for (;;) {
+		uint8_t flag = 0;
+		char cbuf[CMSG_SPACE(sizeof(int))];
+		struct iovec iov = { &flag, sizeof(flag) };
+		struct msghdr msg = {
+			.msg_iov = &iov, .msg_iovlen = 1,
+			.msg_control = cbuf, .msg_controllen = sizeof(cbuf)
+		};
+		ssize_t rb = recvmsg(sock, &msg, 0);
+		if (rb < 0 && (errno == EAGAIN || errno == EINTR)) {
+			continue;
+		}
+		if (rb <= 0) {
+			return kr_error(rb < 0 ? errno : EPIPE);
+		}
+		struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+		if (!cmsg || cmsg->cmsg_type != SCM_RIGHTS) {
+			break; /* Terminator, no descriptor attached. */
+		}
+		int fd = -1;
+		memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+		int ret = network_listen_fd(net, fd, flag != 0);
+		if (ret != 0) {
+			close(fd);
+			return ret;
+		}
+		count += 1;
+	}
+	return count > 0 ? kr_ok() : kr_error(ENOENT);
+}
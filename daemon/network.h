@@ -44,6 +44,8 @@ struct network {
 	uv_loop_t *loop;
 	map_t endpoints;
 	struct tls_credentials *tls_credentials;
+	map_t tls_client;   /**< Upstreams that require DNS-over-TLS, keyed by address string. */
+	map_t tls_sessions; /**< Cached client TLS session data per upstream, see tls_client_new(). */
 };
 
 void network_init(struct network *net, uv_loop_t *loop);
@@ -51,5 +53,28 @@ void network_deinit(struct network *net);
 int network_listen_fd(struct network *net, int fd, bool use_tls);
 int network_listen(struct network *net, const char *addr, uint16_t port, uint32_t flags);
 int network_close(struct network *net, const char *addr, uint16_t port);
+
+/**
+ * Route datagrams to forks deterministically instead of by the kernel's
+ * membership-sensitive default. Name mode hashes the query name, so each
+ * fork owns a keyspace slice and its caches stay hot on it; flow mode
+ * (by_flow) keeps the kernel flow hash but pins the divisor to the fork
+ * count, so restarting one fork no longer reshuffles every other flow.
+ * Attaches a SO_REUSEPORT BPF program to all bound UDP endpoints;
+ * Linux-only, returns ENOTSUP elsewhere.
+ */
+int network_affinity(struct network *net, int count, bool by_flow);
 int network_set_tls_cert(struct network *net, const char *cert);
 int network_set_tls_key(struct network *net, const char *key);
+
+/** Close all listening endpoints, leaving established streams and the rest
+  * of the network state alive so in-flight queries can still be answered. */
+void network_pause(struct network *net);
+
+/** Send duplicates of all listening sockets to a peer over a connected
+  * local socket (SCM_RIGHTS), terminated by a byte without a descriptor. */
+int network_handoff_export(struct network *net, int sock);
+
+/** Receive listening sockets sent by network_handoff_export() and start
+  * listening on them.  Fails with ENOENT if the peer sent none. */
+int network_handoff_import(struct network *net, int sock);
@@ -39,6 +39,7 @@ static const char *priorities = "NORMAL";
 struct tls_ctx_t {
 	gnutls_session_t session;
 	bool handshake_done;
+	bool client; /**< Outgoing (upstream) session, see tls_client_new(). */
 
 	uv_stream_t *handle;
 
@@ -48,6 +49,8 @@ struct tls_ctx_t {
 	ssize_t consumed;
 	uint8_t recv_buf[4096];
 	struct tls_credentials *credentials;
+	struct worker_ctx *worker; /**< Owning worker, for the client session cache. */
+	char peer[INET6_ADDRSTRLEN]; /**< Upstream address, key in the session cache. */
 };
 
 /** @internal Debugging facility. */
@@ -70,18 +73,34 @@ tls_setup_logging(bool verbose)
 	gnutls_global_set_log_level(verbose ? 1 : 0);
 }
 
-static ssize_t kres_gnutls_push(gnutls_transport_ptr_t h, const void *buf, size_t len)
+/** Scatter-gather push, coalesces all queued TLS records into one write call. */
+#define TLS_PUSH_MAXIOV 16
+
+static ssize_t kres_gnutls_vec_push(gnutls_transport_ptr_t h, const giovec_t *iov, int iovcnt)
 {
 	struct tls_ctx_t *t = (struct tls_ctx_t *)h;
-	const uv_buf_t ub = {(void *)buf, len};
 
-	DEBUG_MSG("[tls] push %zu <%p>\n", len, h);
 	if (t == NULL) {
 		errno = EFAULT;
 		return -1;
 	}
+	if (iovcnt <= 0) {
+		return 0;
+	}
+
+	/* uv_buf_t mirrors iovec, map the vectors on the stack.
+	 * A partial push is fine, GnuTLS resubmits what wasn't written. */
+	uv_buf_t ub[TLS_PUSH_MAXIOV];
+	const int cnt = MIN(iovcnt, TLS_PUSH_MAXIOV);
+	size_t total = 0;
+	for (int i = 0; i < cnt; ++i) {
+		ub[i].base = iov[i].iov_base;
+		ub[i].len = iov[i].iov_len;
+		total += iov[i].iov_len;
+	}
 
-	int ret = uv_try_write(t->handle, &ub, 1);
+	DEBUG_MSG("[tls] push %zu in %d vectors <%p>\n", total, cnt, h);
+	int ret = uv_try_write(t->handle, ub, cnt);
 	if (ret > 0) {
 		return (ssize_t) ret;
 	}
@@ -151,9 +170,17 @@ struct tls_ctx_t *tls_new(struct worker_ctx *worker)
 		tls_free(tls);
 		return NULL;
 	}
+	/* Enable session resumption with tickets, a reconnecting client then
+	 * skips the expensive key exchange. All sessions share the credentials'
+	 * ticket key, so tickets survive until the certificate is replaced. */
+	err = gnutls_session_ticket_enable_server(tls->session, &tls->credentials->ticket_key);
+	if (err < 0) {
+		kr_log_error("[tls] warning: session tickets not available: %s (%d)\n",
+			     gnutls_strerror_name(err), err);
+	}
 
 	gnutls_transport_set_pull_function(tls->session, kres_gnutls_pull);
-	gnutls_transport_set_push_function(tls->session, kres_gnutls_push);
+	gnutls_transport_set_vec_push_function(tls->session, kres_gnutls_vec_push);
 	gnutls_transport_set_ptr(tls->session, tls);
 	return tls;
 }
@@ -174,6 +201,117 @@ void tls_free(struct tls_ctx_t *tls)
 	free(tls);
 }
 
+/** @internal Cached session data for resumption, value in net->tls_sessions. */
+struct tls_session_data {
+	size_t len;
+	uint8_t data[];
+};
+
+/** @internal Anonymous client credentials, shared by all upstream sessions. */
+static gnutls_certificate_credentials_t tls_client_credentials(void)
+{
+	static gnutls_certificate_credentials_t creds = NULL;
+	if (!creds) {
+		if (gnutls_certificate_allocate_credentials(&creds) != GNUTLS_E_SUCCESS) {
+			return NULL;
+		}
+		gnutls_certificate_set_x509_system_trust(creds);
+	}
+	return creds;
+}
+
+struct tls_ctx_t *tls_client_new(struct worker_ctx *worker, const struct sockaddr *peer)
+{
+	gnutls_certificate_credentials_t creds = tls_client_credentials();
+	if (!creds) {
+		return NULL;
+	}
+	struct tls_ctx_t *tls = calloc(1, sizeof(struct tls_ctx_t));
+	if (tls == NULL) {
+		return NULL;
+	}
+	int err = gnutls_init(&tls->session, GNUTLS_CLIENT | GNUTLS_NONBLOCK);
+	if (err < 0) {
+		kr_log_error("[tls] gnutls_init(): %s (%d)\n", gnutls_strerror_name(err), err);
+		tls_free(tls);
+		return NULL;
+	}
+	tls->client = true;
+	tls->worker = worker;
+	err = gnutls_credentials_set(tls->session, GNUTLS_CRD_CERTIFICATE, creds);
+	if (err == 0) {
+		const char *errpos = NULL;
+		err = gnutls_priority_set_direct(tls->session, priorities, &errpos);
+	}
+	if (err < 0) {
+		kr_log_error("[tls] client session setup failed: %s (%d)\n",
+		             gnutls_strerror_name(err), err);
+		tls_free(tls);
+		return NULL;
+	}
+	/* Resume a cached session to this upstream if we have one,
+	 * skipping the full key exchange on reconnect. */
+	if (kr_straddr_buf(peer, tls->peer, sizeof(tls->peer))) {
+		map_t *cache = &worker->engine->net.tls_sessions;
+		struct tls_session_data *data = map_get(cache, tls->peer);
+		if (data) {
+			gnutls_session_set_data(tls->session, data->data, data->len);
+		}
+	}
+	gnutls_transport_set_pull_function(tls->session, kres_gnutls_pull);
+	gnutls_transport_set_vec_push_function(tls->session, kres_gnutls_vec_push);
+	gnutls_transport_set_ptr(tls->session, tls);
+	return tls;
+}
+
+/** @internal Stash session data of a completed handshake for resumption. */
+static void tls_client_session_save(struct tls_ctx_t *tls)
+{
+	if (tls->peer[0] == '\0') {
+		return;
+	}
+	gnutls_datum_t session_data = { NULL, 0 };
+	if (gnutls_session_get_data2(tls->session, &session_data) != GNUTLS_E_SUCCESS) {
+		return;
+	}
+	struct tls_session_data *copy = malloc(sizeof(*copy) + session_data.size);
+	if (copy) {
+		map_t *cache = &tls->worker->engine->net.tls_sessions;
+		copy->len = session_data.size;
+		memcpy(copy->data, session_data.data, session_data.size);
+		free(map_get(cache, tls->peer));
+		if (map_set(cache, tls->peer, copy) != 0) {
+			free(copy);
+		}
+	}
+	gnutls_free(session_data.data);
+}
+
+int tls_client_connect(struct worker_ctx *worker, uv_stream_t *handle)
+{
+	struct session *session = handle->data;
+	struct tls_ctx_t *tls = session->tls_ctx;
+	if (!tls || !tls->client) {
+		return kr_error(EINVAL);
+	}
+	tls->handle = handle;
+	/* Send our flight; the handshake then continues from tls_process()
+	 * as the server records arrive. A resumed session may even complete
+	 * right away. */
+	int err = gnutls_handshake(tls->session);
+	if (err == GNUTLS_E_SUCCESS) {
+		tls->handshake_done = true;
+		tls_client_session_save(tls);
+		return worker_tls_connected(worker, (uv_handle_t *)handle);
+	}
+	if (err == GNUTLS_E_AGAIN || !gnutls_error_is_fatal(err)) {
+		return kr_ok();
+	}
+	kr_log_error("[tls] client handshake failed: %s (%d)\n",
+	             gnutls_strerror_name(err), err);
+	return kr_error(EIO);
+}
+
 int tls_push(struct qr_task *task, uv_handle_t* handle, knot_pkt_t * pkt)
 {
 	if (!pkt || !handle || !handle->data) {
@@ -188,10 +326,12 @@ int tls_push(struct qr_task *task, uv_handle_t* handle, knot_pkt_t * pkt)
 		return kr_error(ENOENT);
 	}
 
+	/* Queue the length prefix and the message while corked, so they leave
+	 * as a single TLS record flushed with one vectored write. */
 	gnutls_record_cork(tls_p->session);
 	ssize_t count = 0;
-	if ((count = gnutls_record_send(tls_p->session, &pkt_size, sizeof(pkt_size)) < 0) ||
-	    (count = gnutls_record_send(tls_p->session, pkt->wire, pkt->size) < 0)) {
+	if ((count = gnutls_record_send(tls_p->session, &pkt_size, sizeof(pkt_size))) < 0 ||
+	    (count = gnutls_record_send(tls_p->session, pkt->wire, pkt->size)) < 0) {
 		kr_log_error("[tls] gnutls_record_send failed: %s (%zd)\n", gnutls_strerror_name(count), count);
 		return kr_error(EIO);
 	}
@@ -236,6 +376,13 @@ int tls_process(struct worker_ctx *worker, uv_stream_t *handle, const uint8_t *b
 		int err = gnutls_handshake(tls_p->session);
 		if (err == GNUTLS_E_SUCCESS) {
 			tls_p->handshake_done = true;
+			if (tls_p->client) {
+				/* Flush the queries that waited for the
+				 * handshake, and stash the session data so
+				 * the next connection resumes. */
+				tls_client_session_save(tls_p);
+				worker_tls_connected(worker, (uv_handle_t *)handle);
+			}
 		} else if (err == GNUTLS_E_AGAIN) {
 			return 0; /* No data, bail out */
 		} else if (err < 0 && gnutls_error_is_fatal(err)) {
@@ -386,6 +533,15 @@ int tls_certificate_set(struct network *net, const char *tls_cert, const char *t
 		tls_credentials_free(tls_credentials);
 		return kr_error(ENOMEM);
 	}
+
+	/* Fresh ticket key for session resumption, old sessions can't resume
+	 * after a certificate change which is the conservative choice. */
+	if ((err = gnutls_session_ticket_key_generate(&tls_credentials->ticket_key)) != GNUTLS_E_SUCCESS) {
+		kr_log_error("[tls] gnutls_session_ticket_key_generate() failed: (%d) %s\n",
+			     err, gnutls_strerror_name(err));
+		tls_credentials_free(tls_credentials);
+		return kr_error(EINVAL);
+	}
 	
 	if ((err = gnutls_certificate_set_x509_key_file(tls_credentials->credentials,
 							tls_cert, tls_key, GNUTLS_X509_FMT_PEM)) < 0) {
@@ -445,6 +601,11 @@ void tls_credentials_free(struct tls_credentials *tls_credentials) {
 	if (tls_credentials->tls_key) {
 		free(tls_credentials->tls_key);
 	}
+	if (tls_credentials->ticket_key.data) {
+		/* The key protects all resumable sessions, wipe it. */
+		memset(tls_credentials->ticket_key.data, 0, tls_credentials->ticket_key.size);
+		gnutls_free(tls_credentials->ticket_key.data);
+	}
 	free(tls_credentials);
 }
 
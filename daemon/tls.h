@@ -27,6 +27,7 @@ struct tls_credentials {
 	char *tls_cert;
 	char *tls_key;
 	gnutls_certificate_credentials_t credentials;
+	gnutls_datum_t ticket_key; /**< Session ticket key for TLS resumption (RFC 5077). */
 };
 
 /*! Toggle verbose logging from TLS context. */
@@ -35,6 +36,13 @@ void tls_setup_logging(bool verbose);
 /*! Create an empty TLS context in query context */
 struct tls_ctx_t* tls_new(struct worker_ctx *worker);
 
+/*! Create a client (upstream) TLS context, resuming a cached session to the peer if possible. */
+struct tls_ctx_t *tls_client_new(struct worker_ctx *worker, const struct sockaddr *peer);
+
+/*! Start the client handshake once the TCP connection is established.
+ *  Queued queries are sent via worker_tls_connected() when it completes. */
+int tls_client_connect(struct worker_ctx *worker, uv_stream_t *handle);
+
 /*! Close a TLS context */
 void tls_free(struct tls_ctx_t* tls);
 
@@ -21,36 +21,23 @@
 #include <contrib/ucw/lib.h>
 #include <contrib/ucw/mempool.h>
 #include <contrib/wire.h>
+#include <contrib/hash/hash.h>
 #if defined(__GLIBC__) && defined(_GNU_SOURCE)
 #include <malloc.h>
 #endif
 #include <assert.h>
 #include <sys/types.h>
+#include <sys/time.h>
 #include <unistd.h>
 #include "lib/utils.h"
 #include "lib/layer.h"
 #include "daemon/worker.h"
+#include "lib/probes.h"
 #include "daemon/bindings.h"
 #include "daemon/engine.h"
 #include "daemon/io.h"
 #include "daemon/tls.h"
 
-/* @internal Union of various libuv objects for freelist. */
-struct req
-{
-	union {
-		/* Socket handles, these have session as their `handle->data` and own it. */
-		uv_udp_t      udp;
-		uv_tcp_t      tcp;
-		/* I/O events, these have only a reference to the task they're operating on. */
-		uv_udp_send_t send;
-		uv_write_t    write;
-		uv_connect_t  connect;
-		/* Timer events */
-		uv_timer_t    timer;
-	} as;
-};
-
 /** @internal Debugging facility. */
 #ifdef DEBUG
 #define DEBUG_MSG(fmt...) printf("[daem] " fmt)
@@ -82,8 +69,22 @@ static inline struct req *req_borrow(struct worker_ctx *worker)
 	if (worker->pool_ioreq.len > 0) {
 		req = array_tail(worker->pool_ioreq);
 		array_pop(worker->pool_ioreq);
+		mp_freelist_mark(&worker->pool_ioreq);
 		kr_asan_unpoison(req, sizeof(*req));
 	} else {
+		/* Refill in bulk; a batch allocated together costs one
+		 * allocator round trip and keeps churning objects on
+		 * neighbouring cache lines.  The trim timer returns any
+		 * over-provisioned tail. */
+		for (unsigned i = 0; i < MP_REFILL_COUNT - 1; ++i) {
+			struct req *extra = malloc(sizeof(*extra));
+			if (!extra || array_push(worker->pool_ioreq, extra) < 0) {
+				free(extra);
+				break;
+			}
+			kr_asan_poison(extra, sizeof(*extra));
+		}
+		worker->pool_ioreq.refills += 1;
 		req = malloc(sizeof(*req));
 	}
 	return req;
@@ -94,27 +95,149 @@ static inline void req_release(struct worker_ctx *worker, struct req *req)
 	if (!req || worker->pool_ioreq.len < 4 * MP_FREELIST_SIZE) {
 		array_push(worker->pool_ioreq, req);
 		kr_asan_poison(req, sizeof(*req));
+		worker_trim_arm(worker);
 	} else {
 		free(req);
 	}
 }
 
+/** Small answer-slot size; covers UDP answers bounded by the default
+  * advertised payload, see wirebuf_borrow(). */
+#define WIREBUF_SMALL_SIZE KR_EDNS_PAYLOAD
+
+/** @internal Borrow a pooled answer wire buffer of at least @a max_size.
+ * The answer is assembled in place and the send path references the
+ * buffer directly, so recycled slots stay cache-hot across requests
+ * instead of paging in fresh mempool memory per answer.  Slots come in
+ * two classes: payload-bounded UDP answers take a small slot, only TCP
+ * answers and clients advertising a large payload pin a full-size one,
+ * so per-response memory is bounded by what the transport can carry. */
+static inline uint8_t *wirebuf_borrow(struct worker_ctx *worker, size_t max_size, bool *is_small)
+{
+	*is_small = max_size <= WIREBUF_SMALL_SIZE;
+	mp_freelist_t *list = *is_small ? &worker->pool_wirebufs_sm : &worker->pool_wirebufs;
+	const size_t slot_size = *is_small ? WIREBUF_SMALL_SIZE : KNOT_WIRE_MAX_PKTSIZE;
+	uint8_t *wire = NULL;
+	if (list->len > 0) {
+		wire = array_tail(*list);
+		array_pop(*list);
+		mp_freelist_mark(list);
+		kr_asan_unpoison(wire, slot_size);
+	} else {
+		list->refills += 1;
+		wire = malloc(slot_size);
+	}
+	return wire;
+}
+
+static inline void wirebuf_release(struct worker_ctx *worker, uint8_t *wire, bool is_small)
+{
+	mp_freelist_t *list = is_small ? &worker->pool_wirebufs_sm : &worker->pool_wirebufs;
+	if (list->len < MP_FREELIST_SIZE) {
+		array_push(*list, wire);
+		kr_asan_poison(wire, is_small ? WIREBUF_SMALL_SIZE : KNOT_WIRE_MAX_PKTSIZE);
+		worker_trim_arm(worker);
+	} else {
+		free(wire);
+	}
+}
+
+/** @internal Borrow an I/O event request, preferring the slot embedded
+ * in the task.  A standard query has one event in flight at a time, so
+ * it never touches the freelist and the request shares the task's cache
+ * lines; overlapping events spill to the pool. */
+static inline struct req *task_req_borrow(struct qr_task *task)
+{
+	if (!task->ioreq_busy) {
+		task->ioreq_busy = true;
+		return &task->ioreq;
+	}
+	return req_borrow(task->worker);
+}
+
+/** @internal Counterpart of task_req_borrow(), must precede the final unref. */
+static inline void task_req_release(struct qr_task *task, struct req *req)
+{
+	if (req == &task->ioreq) {
+		task->ioreq_busy = false;
+	} else {
+		req_release(task->worker, req);
+	}
+}
+
+void *worker_ioreq_borrow(struct worker_ctx *worker)
+{
+	return req_borrow(worker);
+}
+
+void worker_ioreq_release(struct worker_ctx *worker, void *req)
+{
+	req_release(worker, (struct req *)req);
+}
+
+/* Outgoing UDP handles are recycled between queries to skip the
+ * socket()/bind()/close() round on every cold lookup.  Reusing a source
+ * port trades away part of its randomization, so a handle serves at most
+ * UDP_POOL_REUSE_MAX queries before it is closed and a fresh port bound;
+ * the QNAME case check covers the remaining window. */
+#define UDP_POOL_REUSE_MAX 256
+
+static uv_handle_t *udp_pool_borrow(struct worker_ctx *worker)
+{
+	if (worker->udp_pool_len == 0) {
+		return NULL;
+	}
+	worker->udp_pool_len -= 1;
+	return worker->udp_pool[worker->udp_pool_len];
+}
+
+/** @internal Park a finished outgoing UDP handle, detaching its task. */
+static int udp_pool_park(struct worker_ctx *worker, uv_handle_t *handle)
+{
+	struct session *session = handle->data;
+	if (worker->udp_pool_len >= UDP_POOL_MAXLEN || session->tasks.len != 1 ||
+	    session->udp_uses >= UDP_POOL_REUSE_MAX) {
+		return kr_error(ENOSPC);
+	}
+	uv_udp_recv_stop((uv_udp_t *)handle);
+	struct qr_task *task = session->tasks.at[0];
+	session->tasks.len = 0;
+	session_pool_reset(session);
+	worker->udp_pool[worker->udp_pool_len] = handle;
+	worker->udp_pool_len += 1;
+	qr_task_unref(task);
+	return 0;
+}
+
 /*! @internal Create a UDP/TCP handle */
-static uv_handle_t *ioreq_spawn(struct qr_task *task, int socktype)
+static uv_handle_t *ioreq_spawn(struct qr_task *task, int socktype, int family)
 {
 	if (task->pending_count >= MAX_PENDING) {
 		return NULL;
 	}
-	/* Create connection for iterative query */
-	uv_handle_t *handle = (uv_handle_t *)req_borrow(task->worker);
+	/* Create connection for iterative query, preferring a pooled one. */
+	uv_handle_t *handle = NULL;
+	if (socktype == SOCK_DGRAM) {
+		handle = udp_pool_borrow(task->worker);
+	}
 	if (!handle) {
-		return NULL;
+		handle = (uv_handle_t *)req_borrow(task->worker);
+		if (!handle) {
+			return NULL;
+		}
+		io_create(task->worker->loop, handle, socktype, family);
 	}
-	io_create(task->worker->loop, handle, socktype);
 	/* Set current handle as a subrequest type. */
 	struct session *session = handle->data;
 	session->outgoing = true;
-	int ret = array_push(session->tasks, task);
+	if (socktype == SOCK_DGRAM) {
+		session->udp_uses += 1;
+	}
+	int ret = array_reserve_mm(session->tasks, session->tasks.len + 1,
+	                           kr_memreserve, &session->pool);
+	if (ret == 0) {
+		ret = array_push(session->tasks, task);
+	}
 	if (ret < 0) {
 		io_deinit(handle);
 		req_release(task->worker, (struct req *)handle);
@@ -127,29 +250,234 @@ static uv_handle_t *ioreq_spawn(struct qr_task *task, int socktype)
 	return handle;
 }
 
+static void tcp_busy_unreg(struct worker_ctx *worker, struct session *session);
+
 static void ioreq_on_close(uv_handle_t *handle)
 {
 	struct worker_ctx *worker = get_worker();
-	/* Handle-type events own a session, must close it. */
+	/* Handle-type events own a session, must close it.
+	 * Multiplexed connections detach their tasks before the close,
+	 * see ioreq_kill(). */
 	struct session *session = handle->data;
-	struct qr_task *task = session->tasks.at[0];
+	struct qr_task *task = session->tasks.len > 0 ? session->tasks.at[0] : NULL;
+	tcp_busy_unreg(worker, session);
+	io_deinit(handle);
+	if (task) {
+		qr_task_unref(task);
+	}
+	req_release(worker, (struct req *)handle);
+}
+
+/* Keep a few finished outgoing TCP connections warm, so that truncated
+ * answers and consecutive queries to the same server skip the handshake. */
+#define TCP_POOL_MAXLEN 16   /* Warm connections kept per worker */
+#define TCP_POOL_TTL 10000   /* Idle warm connection lifetime (ms) */
+#define TCP_MUX_QUERIES 32   /* In-flight queries multiplexed on one connection */
+
+/** @internal Pool key is the textual peer address and port. */
+static int tcp_pool_key(char *dst, size_t maxlen, const struct sockaddr *addr)
+{
+	char inaddr[INET6_ADDRSTRLEN];
+	if (!kr_straddr_buf(addr, inaddr, sizeof(inaddr))) {
+		return kr_error(EINVAL);
+	}
+	uint16_t port = 0;
+	if (addr->sa_family == AF_INET6) {
+		port = ((const struct sockaddr_in6 *)addr)->sin6_port;
+	} else {
+		port = ((const struct sockaddr_in *)addr)->sin_port;
+	}
+	int len = snprintf(dst, maxlen, "%s#%hu", inaddr, ntohs(port));
+	if (len < 0 || (size_t)len >= maxlen) {
+		return kr_error(ENOSPC);
+	}
+	return len;
+}
+
+/** @internal Close a pooled connection, it has no task attached. */
+static void tcp_pool_on_close(uv_handle_t *handle)
+{
+	struct worker_ctx *worker = get_worker();
 	io_deinit(handle);
-	qr_task_unref(task);
 	req_release(worker, (struct req *)handle);
 }
 
-static void ioreq_kill(uv_handle_t *req)
+static void tcp_pool_evict(struct worker_ctx *worker, uv_handle_t *handle)
+{
+	struct session *session = handle->data;
+	assert(session->parked);
+	map_del(&worker->tcp_pool, session->peer);
+	worker->tcp_pool_len -= 1;
+	session->parked = false;
+	if (!uv_is_closing(handle)) {
+		uv_close(handle, tcp_pool_on_close);
+	}
+}
+
+static int tcp_pool_collect(const char *key, void *val, void *baton)
+{
+	uv_handle_t *handle = val;
+	struct session *session = handle->data;
+	struct worker_ctx *worker = get_worker();
+	if (uv_now(worker->loop) - session->parked_since >= TCP_POOL_TTL) {
+		array_push(*(array_t(uv_handle_t *) *)baton, handle);
+	}
+	return 0;
+}
+
+static void tcp_pool_sweep(uv_timer_t *timer)
+{
+	struct worker_ctx *worker = timer->data;
+	/* Collect first, the map must not be altered during the walk. */
+	array_t(uv_handle_t *) expired;
+	array_init(expired);
+	map_walk(&worker->tcp_pool, tcp_pool_collect, &expired);
+	for (size_t i = 0; i < expired.len; ++i) {
+		tcp_pool_evict(worker, expired.at[i]);
+	}
+	array_clear(expired);
+	if (worker->tcp_pool_len == 0) {
+		uv_timer_stop(timer);
+	}
+}
+
+/* An established outgoing connection is published in a busy table keyed like
+ * the warm pool, so consecutive queries to the same server multiplex on it
+ * instead of opening their own. Answers are matched back by message ID, the
+ * session task list doubles as the pending table (see worker_drain_tcp()). */
+
+/** @internal Publish a connected upstream session for query multiplexing. */
+static void tcp_busy_reg(struct worker_ctx *worker, uv_handle_t *handle)
+{
+	struct session *session = handle->data;
+	if (session->muxed || !session->outgoing) {
+		return;
+	}
+	struct sockaddr_storage addr;
+	int addr_len = sizeof(addr);
+	if (uv_tcp_getpeername((uv_tcp_t *)handle, (struct sockaddr *)&addr, &addr_len) != 0 ||
+	    tcp_pool_key(session->peer, sizeof(session->peer), (struct sockaddr *)&addr) < 0) {
+		return;
+	}
+	if (map_contains(&worker->tcp_busy, session->peer)) {
+		return; /* Keep one shared connection per server. */
+	}
+	if (map_set(&worker->tcp_busy, session->peer, handle) == 0) {
+		session->muxed = true;
+		worker->tcp_busy_len += 1;
+	}
+}
+
+/** @internal Unpublish the session, e.g. before parking or closing it. */
+static void tcp_busy_unreg(struct worker_ctx *worker, struct session *session)
+{
+	if (!session->muxed) {
+		return;
+	}
+	map_del(&worker->tcp_busy, session->peer);
+	worker->tcp_busy_len -= 1;
+	session->muxed = false;
+}
+
+/** @internal Park a healthy finished connection in the pool, detaching its task. */
+static int tcp_pool_park(struct worker_ctx *worker, uv_handle_t *handle)
+{
+	struct session *session = handle->data;
+	if (worker->tcp_pool_len >= TCP_POOL_MAXLEN || session->tasks.len != 0) {
+		return kr_error(ENOSPC);
+	}
+	struct sockaddr_storage addr;
+	int addr_len = sizeof(addr);
+	if (uv_tcp_getpeername((uv_tcp_t *)handle, (struct sockaddr *)&addr, &addr_len) != 0 ||
+	    tcp_pool_key(session->peer, sizeof(session->peer), (struct sockaddr *)&addr) < 0) {
+		return kr_error(EINVAL);
+	}
+	if (map_contains(&worker->tcp_pool, session->peer)) {
+		return kr_error(EEXIST); /* Keep one warm connection per server. */
+	}
+	if (map_set(&worker->tcp_pool, session->peer, handle) != 0) {
+		return kr_error(ENOMEM);
+	}
+	/* The pool owns the connection now, the last task detached already. */
+	tcp_busy_unreg(worker, session);
+	session->parked = true;
+	session->reusable = false;
+	session->parked_since = uv_now(worker->loop);
+	worker->tcp_pool_len += 1;
+	/* Evict connections idle for too long periodically. */
+	if (!worker->tcp_pool_timer_init) {
+		uv_timer_init(worker->loop, &worker->tcp_pool_timer);
+		worker->tcp_pool_timer.data = worker;
+		worker->tcp_pool_timer_init = true;
+	}
+	if (!uv_is_active((uv_handle_t *)&worker->tcp_pool_timer)) {
+		uv_timer_start(&worker->tcp_pool_timer, tcp_pool_sweep,
+		               TCP_POOL_TTL / 2, TCP_POOL_TTL / 2);
+	}
+	return 0;
+}
+
+/** @internal Take a warm connection to given server out of the pool, if any. */
+static uv_handle_t *tcp_pool_borrow(struct worker_ctx *worker, const struct sockaddr *addr)
+{
+	if (worker->tcp_pool_len == 0) {
+		return NULL;
+	}
+	char key[sizeof(((struct session *)NULL)->peer)];
+	if (tcp_pool_key(key, sizeof(key), addr) < 0) {
+		return NULL;
+	}
+	uv_handle_t *handle = map_get(&worker->tcp_pool, key);
+	if (handle) {
+		struct session *session = handle->data;
+		map_del(&worker->tcp_pool, key);
+		worker->tcp_pool_len -= 1;
+		session->parked = false;
+	}
+	return handle;
+}
+
+static void ioreq_kill(uv_handle_t *req, struct qr_task *task)
 {
 	assert(req);
-	if (!uv_is_closing(req)) {
-		uv_close(req, ioreq_on_close);
+	if (uv_is_closing(req)) {
+		return;
+	}
+	/* A connection that has just delivered a whole answer is kept warm
+	 * for the next query to the same server instead of being torn down. */
+	struct session *session = req->data;
+	if (req->type == UV_TCP) {
+		if (session->outgoing) {
+			/* Detach just this task, the connection may carry
+			 * other multiplexed queries (see tcp_busy_attach()). */
+			for (size_t i = 0; i < session->tasks.len; ++i) {
+				if (session->tasks.at[i] == task) {
+					array_del(session->tasks, i);
+					qr_task_unref(task);
+					break;
+				}
+			}
+			if (session->tasks.len > 0) {
+				return; /* Keep it for the remaining queries. */
+			}
+			session_pool_reset(session);
+			if (session->reusable &&
+			    tcp_pool_park(get_worker(), req) == 0) {
+				return;
+			}
+		}
+	} else if (req->type == UV_UDP) {
+		if (session->outgoing && udp_pool_park(get_worker(), req) == 0) {
+			return;
+		}
 	}
+	uv_close(req, ioreq_on_close);
 }
 
 static void ioreq_killall(struct qr_task *task)
 {
 	for (size_t i = 0; i < task->pending_count; ++i) {
-		ioreq_kill(task->pending[i]);
+		ioreq_kill(task->pending[i], task);
 	}
 	task->pending_count = 0;
 }
@@ -185,6 +513,7 @@ static inline struct mempool *pool_borrow(struct worker_ctx *worker)
 	if (worker->pool_mp.len > 0) {
 		mp = array_tail(worker->pool_mp);
 		array_pop(worker->pool_mp);
+		mp_freelist_mark(&worker->pool_mp);
 		mp_poison(mp, 0);
 	} else { /* No mempool on the freelist, create new one */
 		mp = mp_new (4 * CPU_PAGE_SIZE);
@@ -197,13 +526,97 @@ static inline void pool_release(struct worker_ctx *worker, struct mempool *mp)
 	/* Return mempool to ring or free it if it's full */
 	if (worker->pool_mp.len < MP_FREELIST_SIZE) {
 		mp_flush(mp);
+		/* Give back chunks a large answer grew, so one fat request
+		 * doesn't pin its high-water memory on the freelist forever. */
+		mp_shrink(mp, 4 * CPU_PAGE_SIZE);
 		array_push(worker->pool_mp, mp);
 		mp_poison(mp, 1);
+		worker_trim_arm(worker);
 	} else {
 		mp_delete(mp);
 	}
 }
 
+/** @internal Re-measure the task's pool and charge growth to the worker's
+  * memory accounting. Called at borrow and after every resolution step, so
+  * worker->mem.live tracks aggregate request memory at step granularity. */
+static void pool_account(struct qr_task *task)
+{
+	struct worker_ctx *worker = task->worker;
+	const size_t total = mp_total_size(task->req.pool.ctx);
+	if (total > task->pool_seen) {
+		worker->mem.live += total - task->pool_seen;
+		task->pool_seen = total;
+		if (worker->mem.live > worker->mem.high_water) {
+			worker->mem.high_water = worker->mem.live;
+		}
+	}
+}
+
+struct mempool *worker_mp_borrow(struct worker_ctx *worker)
+{
+	return pool_borrow(worker);
+}
+
+void worker_mp_release(struct worker_ctx *worker, struct mempool *mp)
+{
+	if (mp) {
+		pool_release(worker, mp);
+	}
+}
+
+/** Trim interval; a cold freelist object survives at most two of these. */
+#define MP_TRIM_INTERVAL 10000
+
+/** @internal Free the cold tail of a freelist, i.e. as many objects as
+  * were never borrowed since the last trim, and restart the watermark. */
+#define trim_freelist(list, type, cb) \
+	while ((list).low > 0 && (list).len > 0) { \
+		type *elm = array_tail(list); \
+		array_pop(list); \
+		kr_asan_unpoison(elm, sizeof(type)); \
+		cb(elm); \
+		(list).low -= 1; \
+		(list).trimmed += 1; \
+	} \
+	(list).low = (list).len
+
+static void pool_trim(uv_timer_t *timer)
+{
+	struct worker_ctx *worker = timer->data;
+	trim_freelist(worker->pool_mp, struct mempool, mp_delete);
+	trim_freelist(worker->pool_ioreq, struct req, free);
+	trim_freelist(worker->pool_sessions, struct session, session_free);
+	trim_freelist(worker->pool_rbufs, uint8_t, free);
+	trim_freelist(worker->pool_wirebufs, uint8_t, free);
+	trim_freelist(worker->pool_wirebufs_sm, uint8_t, free);
+#if defined(__GLIBC__) && defined(_GNU_SOURCE)
+	malloc_trim(0); /* Give the freed pages back to the OS. */
+#endif
+	/* Nothing pooled, the next release arms the timer again. */
+	if (worker->pool_mp.len + worker->pool_ioreq.len +
+	    worker->pool_sessions.len + worker->pool_rbufs.len +
+	    worker->pool_wirebufs.len + worker->pool_wirebufs_sm.len == 0) {
+		uv_timer_stop(timer);
+	}
+}
+
+void worker_trim_arm(struct worker_ctx *worker)
+{
+	if (!worker->loop) {
+		return;
+	}
+	if (!worker->trim_timer_init) {
+		uv_timer_init(worker->loop, &worker->trim_timer);
+		worker->trim_timer.data = worker;
+		worker->trim_timer_init = true;
+	}
+	if (!uv_is_active((uv_handle_t *)&worker->trim_timer)) {
+		uv_timer_start(&worker->trim_timer, pool_trim,
+		               MP_TRIM_INTERVAL, MP_TRIM_INTERVAL);
+	}
+}
+
 /** @internal Get key from current outgoing subrequest. */
 static int subreq_key(char *dst, knot_pkt_t *pkt)
 {
@@ -241,11 +654,15 @@ static struct qr_task *qr_task_create(struct worker_ctx *worker, uv_handle_t *ha
 	}
 	pktbuf->size = 0;
 	task->req.answer = NULL;
+	task->answer_buf = NULL;
+	task->answer_buf_small = false;
 	task->pktbuf = pktbuf;
 	array_init(task->waiting);
+	array_init(task->dedup_queue);
+	task->dedup_leading = false;
 	task->addrlist = NULL;
 	task->pending_count = 0;
-	task->bytes_remaining = 0;
+	task->ioreq_busy = false;
 	task->iter_count = 0;
 	task->timeouts = 0;
 	task->refs = 1;
@@ -254,11 +671,16 @@ static struct qr_task *qr_task_create(struct worker_ctx *worker, uv_handle_t *ha
 	task->worker = worker;
 	task->session = NULL;
 	task->source.handle = handle;
-	task->timeout = NULL;
+	task->timer_next = NULL;
+	task->timer_prev = NULL;
+	task->timer_deadline = 0;
+	task->timer_cb = NULL;
 	task->on_complete = NULL;
+	task->created_ns = uv_hrtime();
 	task->req.qsource.key = NULL;
 	task->req.qsource.addr = NULL;
 	task->req.qsource.dst_addr = NULL;
+	task->req.qsource.tcp = false;
 	/* Remember query source addr */
 	if (addr) {
 		size_t addr_len = sizeof(struct sockaddr_in);
@@ -282,12 +704,23 @@ static struct qr_task *qr_task_create(struct worker_ctx *worker, uv_handle_t *ha
 			if (uv_tcp_getsockname((uv_tcp_t *)handle, dst_addr, &addr_len) == 0) {
 				task->req.qsource.dst_addr = dst_addr;
 			}
+			task->req.qsource.tcp = true;
 		}
 	}
 	worker->stats.concurrent += 1;
+	task->pool_seen = 0;
+	pool_account(task);
+	task->pool_base = task->pool_seen;
 	return task;
 }
 
+/** @internal Whether a whole length-prefixed message is buffered. */
+static bool session_has_query(struct session *session)
+{
+	return session->rbuf && session->rbuf_end >= sizeof(uint16_t) &&
+	       wire_read_u16(session->rbuf) <= session->rbuf_end - sizeof(uint16_t);
+}
+
 /* This is called when the task refcount is zero, free memory. */
 static void qr_task_free(struct qr_task *task)
 {
@@ -297,9 +730,11 @@ static void qr_task_free(struct qr_task *task)
 		for (size_t i = 0; i < session->tasks.len; ++i) {
 			if (session->tasks.at[i] == task) {
 				array_del(session->tasks, i);
-				break;		
+				break;
 			}
 		}
+		/* Last in-flight query done, reset the connection scratch. */
+		session_pool_reset(session);
 		/* Start reading again if the session is throttled and
 		 * the number of outgoing requests is below watermark. */
 		uv_handle_t *handle = task->source.handle;
@@ -308,18 +743,36 @@ static void qr_task_free(struct qr_task *task)
 				io_start_read(handle);
 				session->throttled = false;
 			}
+			/* Queries buffered past the pipeline quota were waiting
+			 * for capacity, not bytes, requeue them for draining. */
+			if (!uv_is_closing(handle) && !session->outgoing &&
+			    session_has_query(session)) {
+				tcp_drain_push(task->worker, session);
+			}
 		}
 	}
 	/* Update stats */
 	struct worker_ctx *worker = task->worker;
 	worker->stats.concurrent -= 1;
+	/* Return the answer buffer; any send referencing it has completed
+	 * by now, the pending I/O held a task reference. */
+	if (task->answer_buf) {
+		wirebuf_release(worker, task->answer_buf, task->answer_buf_small);
+	}
+	/* Settle the memory accounting: give back the charged bytes and
+	 * remember growth past the borrow-time size as spill. */
+	pool_account(task);
+	worker->mem.live -= task->pool_seen;
+	if (task->pool_seen > task->pool_base) {
+		worker->mem.spilled += task->pool_seen - task->pool_base;
+	}
 	/* Return mempool to ring or free it if it's full */
 	pool_release(worker, task->req.pool.ctx);
 	/* @note The 'task' is invalidated from now on. */
-	/* Decommit memory every once in a while */
+	/* Decommit memory every once in a while. The Lua heap needs no
+	 * full collection here, the engine GC stepper keeps up with it. */
 	static int mp_delete_count = 0;
 	if (++mp_delete_count == 100000) {
-		lua_gc(worker->engine->L, LUA_GCCOLLECT, 0);
 #if defined(__GLIBC__) && defined(_GNU_SOURCE)
 		malloc_trim(0);
 #endif
@@ -337,10 +790,20 @@ static int qr_task_start(struct qr_task *task, knot_pkt_t *query)
 		answer_max = MAX(knot_edns_get_payload(query->opt_rr), KNOT_WIRE_MIN_PKTSIZE);
 	}
 
-	knot_pkt_t *answer = knot_pkt_new(NULL, answer_max, &task->req.pool);
+	/* Assemble the answer in a pooled send buffer, the socket writes
+	 * reference it in place so no final copy is needed. */
+	bool is_small = false;
+	uint8_t *wire = wirebuf_borrow(task->worker, answer_max, &is_small);
+	if (!wire) {
+		return kr_error(ENOMEM);
+	}
+	knot_pkt_t *answer = knot_pkt_new(wire, answer_max, &task->req.pool);
 	if (!answer) {
+		wirebuf_release(task->worker, wire, is_small);
 		return kr_error(ENOMEM);
 	}
+	task->answer_buf = wire;
+	task->answer_buf_small = is_small;
 	task->req.answer = answer;
 
 	/* Remember query source TSIG key */
@@ -357,6 +820,11 @@ static int qr_task_start(struct qr_task *task, knot_pkt_t *query)
 	struct worker_ctx *worker = task->worker;
 	struct engine *engine = worker->engine;
 	kr_resolve_begin(&task->req, &engine->resolver, answer);
+	/* Arm the timing trace while the slow-log is recording, so slow
+	 * entries carry the why along with the how long. */
+	if (worker->slowlog.threshold_us > 0) {
+		kr_resolve_trace(&task->req);
+	}
 	worker->stats.queries += 1;
 	/* Throttle outbound queries only when high pressure */
 	if (worker->stats.concurrent < QUERY_RATE_THRESHOLD) {
@@ -368,17 +836,18 @@ static int qr_task_start(struct qr_task *task, knot_pkt_t *query)
 /*@ Register qr_task within session. */
 static int qr_task_register(struct qr_task *task, struct session *session)
 {
-	int ret = array_reserve(session->tasks, session->tasks.len + 1);
+	int ret = array_reserve_mm(session->tasks, session->tasks.len + 1,
+	                           kr_memreserve, &session->pool);
 	if (ret != 0) {
 		return kr_error(ENOMEM);
 	}
 	array_push(session->tasks, task);
 	task->session = session;
-	/* Soft-limit on parallel queries, there is no "slow down" RCODE
+	/* Limit on parallel queries, there is no "slow down" RCODE
 	 * that we could use to signalize to client, but we can stop reading,
-	 * an in effect shrink TCP window size. To get more precise throttling,
-	 * we would need to copy remainder of the unread buffer and reassemble
-	 * when resuming reading. This is NYI.  */
+	 * an in effect shrink TCP window size. Queries already read stay
+	 * framed in the session buffer and drain as capacity frees up,
+	 * see worker_drain_tcp(). */
 	if (session->tasks.len >= task->worker->tcp_pipeline_max) {
 		uv_handle_t *handle = task->source.handle;
 		if (handle && !session->throttled && !uv_is_closing(handle)) {
@@ -416,10 +885,15 @@ static int qr_task_on_send(struct qr_task *task, uv_handle_t *handle, int status
 				knot_pkt_clear(pktbuf);
 				pktbuf->size = 0;
 			}
-			io_start_read(handle); /* Start reading new query */
+			/* A backpressured session stays read-stopped until its
+			 * send queue drains, see qr_task_send(). */
+			struct session *session = handle->data;
+			if (!session || session->write_queued < SESSION_WRITEQ_MAX) {
+				io_start_read(handle); /* Start reading new query */
+			}
 		}
 	} else {
-		assert(task->timeout == NULL);
+		assert(task->timer_cb == NULL);
 		qr_task_complete(task);
 	}
 	return status;
@@ -427,24 +901,30 @@ static int qr_task_on_send(struct qr_task *task, uv_handle_t *handle, int status
 
 static void on_send(uv_udp_send_t *req, int status)
 {
-	struct worker_ctx *worker = get_worker();
 	struct qr_task *task = req->data;
 	if (qr_valid_handle(task, (uv_handle_t *)req->handle)) {
 		qr_task_on_send(task, (uv_handle_t *)req->handle, status);
 	}
+	task_req_release(task, (struct req *)req);
 	qr_task_unref(task);
-	req_release(worker, (struct req *)req);
 }
 
 static void on_write(uv_write_t *req, int status)
 {
-	struct worker_ctx *worker = get_worker();
 	struct qr_task *task = req->data;
-	if (qr_valid_handle(task, (uv_handle_t *)req->handle)) {
-		qr_task_on_send(task, (uv_handle_t *)req->handle, status);
+	struct req *ioreq = (struct req *)req;
+	uv_handle_t *handle = (uv_handle_t *)req->handle;
+	if (qr_valid_handle(task, handle)) {
+		/* Drain the queued-byte account before the send hook decides
+		 * whether the session may read again. */
+		struct session *session = handle->data;
+		if (session && ioreq->queued > 0) {
+			session->write_queued -= MIN(ioreq->queued, session->write_queued);
+		}
+		qr_task_on_send(task, handle, status);
 	}
+	task_req_release(task, ioreq);
 	qr_task_unref(task);
-	req_release(worker, (struct req *)req);
 }
 
 static int qr_task_send(struct qr_task *task, uv_handle_t *handle, struct sockaddr *addr, knot_pkt_t *pkt)
@@ -453,6 +933,11 @@ static int qr_task_send(struct qr_task *task, uv_handle_t *handle, struct sockad
 		return qr_task_on_send(task, handle, kr_error(EIO));
 	}
 
+	/* Outgoing subqueries are QR=0, answers to the client are QR=1. */
+	if (knot_wire_get_qr(pkt->wire) == 0) {
+		kr_resolve_trace_add(&task->req, KR_TRACE_SEND);
+	}
+
 	/* Synchronous push to TLS context, bypassing event loop. */
 	struct session *session = handle->data;
 	if (session->has_tls) {
@@ -461,10 +946,6 @@ static int qr_task_send(struct qr_task *task, uv_handle_t *handle, struct sockad
 	}
 
 	int ret = 0;
-	struct req *send_req = req_borrow(task->worker);
-	if (!send_req) {
-		return qr_task_on_send(task, handle, kr_error(ENOMEM));
-	}
 	if (knot_wire_get_qr(pkt->wire) == 0) {
 		/*
 		 * Query must be finalised using destination address before
@@ -487,23 +968,67 @@ static int qr_task_send(struct qr_task *task, uv_handle_t *handle, struct sockad
 	}
 	/* Send using given protocol */
 	ret = 0;
+	struct req *send_req = NULL;
 	if (handle->type == UV_UDP) {
+		send_req = task_req_borrow(task);
+		if (!send_req) {
+			return qr_task_on_send(task, handle, kr_error(ENOMEM));
+		}
 		uv_buf_t buf = { (char *)pkt->wire, pkt->size };
 		send_req->as.send.data = task;
 		ret = uv_udp_send(&send_req->as.send, (uv_udp_t *)handle, &buf, 1, addr, &on_send);
 	} else {
+		/* Vectored [length prefix][message wire] referencing the packet
+		 * buffer directly.  Try a synchronous write first; on an
+		 * uncongested socket - the common case - it completes inline
+		 * with no request allocation or callback round trip. */
 		uint16_t pkt_size = htons(pkt->size);
 		uv_buf_t buf[2] = {
 			{ (char *)&pkt_size, sizeof(pkt_size) },
 			{ (char *)pkt->wire, pkt->size }
 		};
-		send_req->as.write.data = task;
-		ret = uv_write(&send_req->as.write, (uv_stream_t *)handle, buf, 2, &on_write);
+		const size_t total = sizeof(pkt_size) + pkt->size;
+		int nwr = uv_try_write((uv_stream_t *)handle, buf, 2);
+		if (nwr == (int)total) {
+			qr_task_on_send(task, handle, 0);
+		} else {
+			send_req = task_req_borrow(task);
+			if (!send_req) {
+				return qr_task_on_send(task, handle, kr_error(ENOMEM));
+			}
+			/* The prefix moves into the write request, it must
+			 * outlive the queued send. */
+			send_req->len_prefix = pkt_size;
+			buf[0].base = (char *)&send_req->len_prefix;
+			if (nwr > 0) { /* Queue only the unwritten tail. */
+				size_t skip = nwr;
+				for (unsigned i = 0; i < 2; ++i) {
+					size_t adv = MIN(skip, buf[i].len);
+					buf[i].base += adv;
+					buf[i].len -= adv;
+					skip -= adv;
+				}
+			}
+			send_req->as.write.data = task;
+			ret = uv_write(&send_req->as.write, (uv_stream_t *)handle, buf, 2, &on_write);
+			if (ret == 0) {
+				/* Account queued bytes; a session whose queue
+				 * grows past the bound stops reading until
+				 * completions drain it, see on_write(). */
+				send_req->queued = total - (nwr > 0 ? (size_t)nwr : 0);
+				session->write_queued += send_req->queued;
+				if (session->write_queued >= SESSION_WRITEQ_MAX) {
+					io_stop_read(handle);
+				}
+			}
+		}
 	}
-	if (ret == 0) {
-		qr_task_ref(task); /* Pending ioreq on current task */
-	} else {
-		req_release(task->worker, send_req);
+	if (send_req) {
+		if (ret == 0) {
+			qr_task_ref(task); /* Pending ioreq on current task */
+		} else {
+			task_req_release(task, send_req);
+		}
 	}
 
 	/* Update statistics */
@@ -525,51 +1050,265 @@ static void on_connect(uv_connect_t *req, int status)
 	struct worker_ctx *worker = get_worker();
 	struct qr_task *task = req->data;
 	uv_stream_t *handle = req->handle;
-	if (qr_valid_handle(task, (uv_handle_t *)req->handle)) {
+	/* Return the request up front, the send below can then reuse
+	 * the slot embedded in the task. */
+	task_req_release(task, (struct req *)req);
+	if (qr_valid_handle(task, (uv_handle_t *)handle)) {
 		if (status == 0) {
-			struct sockaddr_storage addr;
-			int addr_len = sizeof(addr);
-			uv_tcp_getpeername((uv_tcp_t *)handle, (struct sockaddr *)&addr, &addr_len);
-			qr_task_send(task, (uv_handle_t *)handle, (struct sockaddr *)&addr, task->pktbuf);
+			struct session *session = handle->data;
+			if (session->has_tls) {
+				/* Hold the query until the handshake is done;
+				 * the connection is published for multiplexing
+				 * from worker_tls_connected() only then. */
+				if (tls_client_connect(worker, handle) != 0) {
+					qr_task_step(task, task->addrlist, NULL);
+				}
+			} else {
+				/* Publish the fresh connection for multiplexing. */
+				tcp_busy_reg(worker, (uv_handle_t *)handle);
+				struct sockaddr_storage addr;
+				int addr_len = sizeof(addr);
+				uv_tcp_getpeername((uv_tcp_t *)handle, (struct sockaddr *)&addr, &addr_len);
+				qr_task_send(task, (uv_handle_t *)handle, (struct sockaddr *)&addr, task->pktbuf);
+			}
 		} else {
 			qr_task_step(task, task->addrlist, NULL);
 		}
 	}
 	qr_task_unref(task);
-	req_release(worker, (struct req *)req);
 }
 
-static void on_timer_close(uv_handle_t *handle)
+/** @internal Send query on an established connection, mirrors a completed on_connect(). */
+static int tcp_task_resume(struct qr_task *task, uv_handle_t *handle)
+{
+	struct session *session = handle->data;
+	if (task->pending_count >= MAX_PENDING ||
+	    array_reserve_mm(session->tasks, session->tasks.len + 1,
+	                     kr_memreserve, &session->pool) != 0 ||
+	    array_push(session->tasks, task) < 0) {
+		return kr_error(ENOSPC);
+	}
+	qr_task_ref(task);
+	task->pending[task->pending_count] = handle;
+	task->pending_count += 1;
+	/* Publish the connection, consecutive queries to this server
+	 * multiplex on it instead of opening their own. */
+	tcp_busy_reg(task->worker, handle);
+	struct sockaddr_storage addr;
+	int addr_len = sizeof(addr);
+	uv_tcp_getpeername((uv_tcp_t *)handle, (struct sockaddr *)&addr, &addr_len);
+	return qr_task_send(task, handle, (struct sockaddr *)&addr, task->pktbuf);
+}
+
+/** @internal Ride an already connected upstream session, if one is published.
+  * Answers are matched back by message ID, so an ID collision or a full
+  * pending table falls back to a separate connection. */
+static int tcp_busy_attach(struct qr_task *task, const struct sockaddr *addr)
+{
+	struct worker_ctx *worker = task->worker;
+	if (worker->tcp_busy_len == 0) {
+		return kr_error(ENOENT);
+	}
+	char key[sizeof(((struct session *)NULL)->peer)];
+	if (tcp_pool_key(key, sizeof(key), addr) < 0) {
+		return kr_error(EINVAL);
+	}
+	uv_handle_t *handle = map_get(&worker->tcp_busy, key);
+	if (!handle || uv_is_closing(handle)) {
+		return kr_error(ENOENT);
+	}
+	struct session *session = handle->data;
+	if (session->tasks.len >= TCP_MUX_QUERIES) {
+		return kr_error(ENOSPC);
+	}
+	const uint16_t msg_id = knot_wire_get_id(task->pktbuf->wire);
+	for (size_t i = 0; i < session->tasks.len; ++i) {
+		struct qr_task *pending = session->tasks.at[i];
+		if (knot_wire_get_id(pending->pktbuf->wire) == msg_id) {
+			return kr_error(EEXIST);
+		}
+	}
+	return tcp_task_resume(task, handle);
+}
+
+/* Deadlines of all tasks hang off a single hashed timer wheel per worker
+ * instead of a libuv timer handle per task. Arming and disarming is O(1)
+ * list linkage and deadlines fire with at most one tick of slack. */
+
+static inline struct qr_task **wheel_slot(struct worker_ctx *worker, uint64_t deadline)
+{
+	return &worker->wheel[(deadline / TIMER_WHEEL_TICK) % TIMER_WHEEL_SLOTS];
+}
+
+static void wheel_tick(uv_timer_t *timer);
+
+static int timer_start(struct qr_task *task, task_timer_cb cb, uint64_t timeout)
+{
+	assert(task->timer_cb == NULL);
+	struct worker_ctx *worker = task->worker;
+	/* Lazy driver setup, it runs only while any deadline is armed. */
+	if (!worker->wheel_timer_init) {
+		uv_timer_init(worker->loop, &worker->wheel_timer);
+		worker->wheel_timer.data = worker;
+		worker->wheel_timer_init = true;
+	}
+	if (worker->wheel_len == 0) {
+		worker->wheel_time = uv_now(worker->loop) / TIMER_WHEEL_TICK;
+		int ret = uv_timer_start(&worker->wheel_timer, wheel_tick,
+		                         TIMER_WHEEL_TICK, TIMER_WHEEL_TICK);
+		if (ret != 0) {
+			return kr_error(ENOMEM);
+		}
+	}
+	task->timer_deadline = uv_now(worker->loop) + timeout;
+	/* The sweep resumes at wheel_time + 1, so a deadline hashing into the
+	 * current tick's slot would wait a full wheel revolution. Push it to the
+	 * next tick; disarming recomputes the slot from the stored deadline, so
+	 * the deadline itself must move, not just the slot choice. */
+	if (task->timer_deadline / TIMER_WHEEL_TICK <= worker->wheel_time) {
+		task->timer_deadline = (worker->wheel_time + 1) * TIMER_WHEEL_TICK;
+	}
+	task->timer_cb = cb;
+	/* Link at the slot head. */
+	struct qr_task **slot = wheel_slot(worker, task->timer_deadline);
+	task->timer_prev = NULL;
+	task->timer_next = *slot;
+	if (*slot) {
+		(*slot)->timer_prev = task;
+	}
+	*slot = task;
+	worker->wheel_len += 1;
+	qr_task_ref(task); /* Wheel entry borrows task */
+	return 0;
+}
+
+static void timer_disarm(struct qr_task *task)
 {
-	struct qr_task *task = handle->data;
-	req_release(task->worker, (struct req *)handle);
+	if (task->timer_cb == NULL) {
+		return;
+	}
+	struct worker_ctx *worker = task->worker;
+	struct qr_task **slot = wheel_slot(worker, task->timer_deadline);
+	if (task->timer_prev) {
+		task->timer_prev->timer_next = task->timer_next;
+	} else {
+		*slot = task->timer_next;
+	}
+	if (task->timer_next) {
+		task->timer_next->timer_prev = task->timer_prev;
+	}
+	task->timer_next = task->timer_prev = NULL;
+	task->timer_cb = NULL;
+	worker->wheel_len -= 1;
+	if (worker->wheel_len == 0) {
+		uv_timer_stop(&worker->wheel_timer);
+	}
 	qr_task_unref(task);
 }
 
-/* This is called when I/O timeouts */
-static void on_timeout(uv_timer_t *req)
+static void wheel_tick(uv_timer_t *timer)
 {
-	struct qr_task *task = req->data;
+	struct worker_ctx *worker = timer->data;
+	const uint64_t now = uv_now(worker->loop);
+	const uint64_t now_tick = now / TIMER_WHEEL_TICK;
+	/* Sweep all slots elapsed since the last run, at most one revolution. */
+	uint64_t from = worker->wheel_time + 1;
+	if (now_tick - worker->wheel_time > TIMER_WHEEL_SLOTS) {
+		from = now_tick - TIMER_WHEEL_SLOTS + 1;
+	}
+	for (uint64_t t = from; t <= now_tick; ++t) {
+		struct qr_task **head = &worker->wheel[t % TIMER_WHEEL_SLOTS];
+		/* Detach expired entries first, callbacks may rearm into this slot.
+		 * Entries belonging to a later revolution stay. Expiry compares
+		 * bucket indices, not instants: each slot is visited once per
+		 * revolution, so a deadline an instant past 'now' in the swept
+		 * bucket must fire now or it waits a whole revolution. One tick
+		 * of early slack is the granularity the wheel guarantees anyway. */
+		struct qr_task *expired = NULL;
+		struct qr_task *node = *head;
+		while (node) {
+			struct qr_task *next = node->timer_next;
+			if (node->timer_deadline / TIMER_WHEEL_TICK <= t) {
+				if (node->timer_prev) {
+					node->timer_prev->timer_next = node->timer_next;
+				} else {
+					*head = node->timer_next;
+				}
+				if (node->timer_next) {
+					node->timer_next->timer_prev = node->timer_prev;
+				}
+				node->timer_prev = NULL;
+				node->timer_next = expired;
+				expired = node;
+				worker->wheel_len -= 1;
+			}
+			node = next;
+		}
+		while (expired) {
+			struct qr_task *task = expired;
+			expired = task->timer_next;
+			task->timer_next = NULL;
+			task_timer_cb cb = task->timer_cb;
+			task->timer_cb = NULL;
+			cb(task);
+			qr_task_unref(task); /* Wheel entry reference */
+		}
+	}
+	worker->wheel_time = now_tick;
+	if (worker->wheel_len == 0) {
+		uv_timer_stop(timer);
+	}
+}
+
+/* During an upstream outage a whole cohort of tasks expires within the
+ * same wheel tick, all pointing at the same dead server.  Applying the
+ * nsrep timeout penalty per task would multiply both the RTT-table
+ * updates and the penalty itself by the number of victims, so record
+ * the servers penalized in the current tick and let only the first
+ * expiration per server through. */
+static bool timeout_coalesce(struct worker_ctx *worker, const struct sockaddr *choice)
+{
+	const uint64_t tick = uv_now(worker->loop) / TIMER_WHEEL_TICK;
+	if (worker->penalized_tick != tick) {
+		worker->penalized_tick = tick;
+		worker->penalized_len = 0;
+	}
+	for (unsigned i = 0; i < worker->penalized_len; ++i) {
+		const struct sockaddr *seen = (const struct sockaddr *)&worker->penalized[i];
+		if (seen->sa_family == choice->sa_family &&
+		    memcmp(kr_inaddr(seen), kr_inaddr(choice), kr_inaddr_len(choice)) == 0) {
+			return false;
+		}
+	}
+	if (worker->penalized_len < TIMEOUT_COALESCE_MAX) {
+		memcpy(&worker->penalized[worker->penalized_len], choice,
+		       sizeof(worker->penalized[0]));
+		worker->penalized_len += 1;
+	}
+	return true;
+}
 
-	/* Penalize all tried nameservers with a timeout. */
+/* This is called when I/O timeouts */
+static void on_timeout(struct qr_task *task)
+{
+	/* Penalize all tried nameservers with a timeout,
+	 * at most once per server per wheel tick. */
 	struct worker_ctx *worker = task->worker;
 	if (task->leading && task->pending_count > 0) {
 		struct kr_query *qry = array_tail(task->req.rplan.pending);
 		struct sockaddr_in6 *addrlist = (struct sockaddr_in6 *)task->addrlist;
 		for (uint16_t i = 0; i < MIN(task->pending_count, task->addrlist_count); ++i) {
 			struct sockaddr *choice = (struct sockaddr *)(&addrlist[i]);
+			if (!timeout_coalesce(worker, choice)) {
+				continue;
+			}
 			WITH_DEBUG {
-				char addr_str[INET6_ADDRSTRLEN];
-				inet_ntop(choice->sa_family, kr_inaddr(choice), addr_str, sizeof(addr_str));
-				QRDEBUG(qry, "wrkr", "=> server: '%s' flagged as 'bad'\n", addr_str);
+				QRDEBUG(qry, "wrkr", "=> server: '%s' flagged as 'bad'\n", kr_straddr(choice));
 			}
 			kr_nsrep_update_rtt(&qry->ns, choice, KR_NS_TIMEOUT,
 					    worker->engine->resolver.cache_rtt, KR_NS_UPDATE);
 		}
 	}
-	/* Release timer handle */
-	task->timeout = NULL;
-	uv_close((uv_handle_t *)req, on_timer_close); /* Return borrowed task here */
 	/* Interrupt current pending request. */
 	task->timeouts += 1;
 	worker->stats.timeout += 1;
@@ -579,7 +1318,7 @@ static void on_timeout(uv_timer_t *req)
 static bool retransmit(struct qr_task *task)
 {
 	if (task && task->addrlist && task->addrlist_count > 0) {
-		uv_handle_t *subreq = ioreq_spawn(task, SOCK_DGRAM);
+		uv_handle_t *subreq = ioreq_spawn(task, SOCK_DGRAM, AF_UNSPEC);
 		if (subreq) { /* Create connection for iterative query */
 			struct sockaddr_in6 *choice = &((struct sockaddr_in6 *)task->addrlist)[task->addrlist_turn];
 			if (qr_task_send(task, subreq, (struct sockaddr *)choice, task->pktbuf) == 0) {
@@ -591,53 +1330,38 @@ static bool retransmit(struct qr_task *task)
 	return false;
 }
 
-static void on_retransmit(uv_timer_t *req)
+/** Retransmit backoff schedule, in multiples of the base interval.
+  * Each step sends one packet to the next address in the list, so the
+  * server rotation is interleaved with the backoff.  The base interval
+  * comes from the srtt estimate of the first server and the whole round
+  * is bounded by retry_deadline, so a struggling server gets at most a
+  * few progressively spaced packets before the task fails over. */
+static const uint8_t retry_backoff[] = { 1, 2, 4, 8 };
+
+static void on_retransmit(struct qr_task *task)
 {
-	struct qr_task *task = req->data;
 	assert(task->finished == false);
-	assert(task->timeout != NULL);
-
-	uv_timer_stop(req);
-	if (!retransmit(req->data)) {
-		/* Not possible to spawn request, start timeout timer with remaining deadline. */
-		uint64_t timeout = KR_CONN_RTT_MAX - task->pending_count * KR_CONN_RETRY;
-		uv_timer_start(req, on_timeout, timeout, 0);
-	} else {
-		uv_timer_start(req, on_retransmit, KR_CONN_RETRY, 0);
-	}
-}
 
-static int timer_start(struct qr_task *task, uv_timer_cb cb, uint64_t timeout, uint64_t repeat)
-{
-	assert(task->timeout == NULL);
-	struct worker_ctx *worker = task->worker;
-	uv_timer_t *timer = (uv_timer_t *)req_borrow(worker);
-	if (!timer) {
-		return kr_error(ENOMEM);
+	const uint64_t now = uv_now(task->worker->loop);
+	if (now >= task->retry_deadline || !retransmit(task)) {
+		/* Budget exhausted or not possible to spawn a request,
+		 * wait out the remaining deadline. */
+		const uint64_t remains = task->retry_deadline > now
+			? task->retry_deadline - now : 0;
+		timer_start(task, on_timeout, remains);
+		return;
 	}
-	uv_timer_init(worker->loop, timer);
-	int ret = uv_timer_start(timer, cb, timeout, repeat);
-	if (ret != 0) {
-		uv_timer_stop(timer);
-		req_release(worker, (struct req *)timer);
-		return kr_error(ENOMEM);
+	if (task->retry_round + 1 < sizeof(retry_backoff)) {
+		task->retry_round += 1;
 	}
-	timer->data = task;
-	qr_task_ref(task);
-	task->timeout = timer;
-	return 0;
+	uint64_t next = (uint64_t)task->retry_base * retry_backoff[task->retry_round];
+	timer_start(task, on_retransmit, MIN(next, task->retry_deadline - now));
 }
 
 static void subreq_finalize(struct qr_task *task, const struct sockaddr *packet_source, knot_pkt_t *pkt)
 {
-	/* Close pending timer */
-	if (task->timeout) {
-		/* Timer was running so it holds reference to task, make sure the timer event
-		 * never fires and release the reference on timer close instead. */
-		uv_timer_stop(task->timeout);
-		uv_close((uv_handle_t *)task->timeout, on_timer_close);
-		task->timeout = NULL;
-	}
+	/* Disarm pending deadline */
+	timer_disarm(task);
 	ioreq_killall(task);
 	/* Clear from outgoing table. */
 	if (!task->leading)
@@ -696,22 +1420,208 @@ static bool subreq_enqueue(struct qr_task *task)
 	return false;
 }
 
+/** @internal Attach task as a waiter to an identical in-flight client query, if any.
+  * This avoids a thundering herd of identical recursions when a popular
+  * record expires, all duplicates are answered from the single round trip. */
+static bool dedup_enqueue(struct worker_ctx *worker, struct qr_task *task, knot_pkt_t *query)
+{
+	char key[KR_RRKEY_LEN];
+	if (kr_rrkey(key, knot_pkt_qname(query), knot_pkt_qtype(query), knot_pkt_qclass(query)) <= 0) {
+		return false;
+	}
+	struct qr_task *leader = map_get(&worker->dedup, key);
+	if (!leader || leader->finished) {
+		return false;
+	}
+	/* Keep a copy of the query, the task is restarted with it later. */
+	if (query != task->pktbuf && knot_pkt_copy(task->pktbuf, query) != 0) {
+		return false;
+	}
+	int ret = array_reserve_mm(leader->dedup_queue, leader->dedup_queue.len + 1,
+	                           kr_memreserve, &leader->req.pool);
+	if (ret != 0) {
+		return false;
+	}
+	array_push(leader->dedup_queue, task);
+	qr_task_ref(task);
+	return true;
+}
+
+/** @internal Announce task as the leader for its client question. */
+static void dedup_lead(struct worker_ctx *worker, struct qr_task *task, knot_pkt_t *query)
+{
+	char key[KR_RRKEY_LEN];
+	if (kr_rrkey(key, knot_pkt_qname(query), knot_pkt_qtype(query), knot_pkt_qclass(query)) > 0 &&
+	    !map_contains(&worker->dedup, key)) {
+		memcpy(task->dedup_key, key, sizeof(key));
+		map_set(&worker->dedup, key, task);
+		task->dedup_leading = true;
+	}
+}
+
+/** @internal Answer a parked duplicate straight from the leader's finished
+  * answer. Only safe when the wire is reusable as-is: identical question
+  * bytes (0x20-style case included), matching EDNS expectations and no
+  * per-client records; the answer must also fit the duplicate's buffer.
+  * Returns false to fall back to re-resolution from cache. */
+static bool dedup_graft(struct qr_task *task, struct qr_task *follower)
+{
+	knot_pkt_t *answer = task->req.answer;
+	knot_pkt_t *query = follower->pktbuf;
+	struct kr_request *req = &follower->req;
+	/* Per-client records must not leak between clients. */
+	if (req->qsource.key || query->tsig_rr) {
+		return false;
+	}
+	if (answer->opt_rr &&
+	    knot_edns_has_option(answer->opt_rr, KNOT_EDNS_OPTION_COOKIE)) {
+		return false;
+	}
+	/* EDNS presence and the DO bit must match what this client asked. */
+	if ((req->qsource.opt != NULL) != knot_pkt_has_edns(answer)) {
+		return false;
+	}
+	if (req->qsource.opt &&
+	    knot_edns_do(req->qsource.opt) != knot_edns_do(answer->opt_rr)) {
+		return false;
+	}
+	/* The question must match byte for byte, case included. */
+	const knot_dname_t *qname = knot_pkt_qname(answer);
+	const knot_dname_t *f_qname = knot_pkt_qname(query);
+	if (!qname || !f_qname ||
+	    memcmp(qname, f_qname, knot_dname_size(qname)) != 0) {
+		return false;
+	}
+	if (kr_resolve_graft(req, answer) != KNOT_STATE_DONE) {
+		return false;
+	}
+	knot_wire_set_id(req->answer->wire, knot_wire_get_id(query->wire));
+	follower->finished = true;
+	task->worker->stats.grafted += 1;
+	(void) qr_task_send(follower, follower->source.handle,
+	                    (struct sockaddr *)&follower->source.addr, req->answer);
+	return true;
+}
+
+/** @internal Clear leadership and answer the waiting duplicates.
+  * Compatible duplicates get a verbatim copy of the leader's answer, so the
+  * upstream response is parsed and validated once for all of them; the rest
+  * re-resolve from the freshly stashed cache without asking upstream. */
+static void dedup_finalize(struct qr_task *task, int state)
+{
+	if (!task->dedup_leading) {
+		return;
+	}
+	map_del(&task->worker->dedup, task->dedup_key);
+	task->dedup_leading = false;
+	const bool graftable = (state == KNOT_STATE_DONE);
+	for (size_t i = 0; i < task->dedup_queue.len; ++i) {
+		struct qr_task *follower = task->dedup_queue.at[i];
+		if (!graftable || !dedup_graft(task, follower)) {
+			qr_task_step(follower, NULL, follower->pktbuf);
+		}
+		qr_task_unref(follower);
+	}
+	task->dedup_queue.len = 0;
+}
+
+/** @internal Schedule asynchronous refresh of entries that were served stale,
+  * detached from the client request. The refresh bypasses cache lookups,
+  * so it can not be served stale again. */
+static void task_refresh_stale(struct qr_task *task)
+{
+	struct worker_ctx *worker = task->worker;
+	struct kr_rplan *rplan = &task->req.rplan;
+	for (size_t i = 0; i < rplan->resolved.len; ++i) {
+		struct kr_query *qry = rplan->resolved.at[i];
+		if (!(qry->flags & QUERY_STALE)) {
+			continue;
+		}
+		knot_pkt_t *query = knot_pkt_new(NULL, KNOT_WIRE_MIN_PKTSIZE, &worker->pkt_pool);
+		if (!query) {
+			return;
+		}
+		knot_pkt_put_question(query, qry->sname, qry->sclass, qry->stype);
+		knot_wire_set_rd(query->wire);
+		worker_resolve(worker, query, QUERY_NO_CACHE, NULL, NULL);
+	}
+}
+
+/** @internal Record an answer that crossed the slow-log threshold. */
+static void slowlog_record(struct qr_task *task, uint64_t elapsed_us)
+{
+	struct worker_ctx *worker = task->worker;
+	struct slow_query *entry = &worker->slowlog.q[worker->slowlog.head];
+	const knot_dname_t *qname = knot_pkt_qname(task->req.answer);
+	if (qname) {
+		memcpy(entry->qname, qname, knot_dname_size(qname));
+	} else {
+		entry->qname[0] = '\0';
+	}
+	entry->qtype = knot_pkt_qtype(task->req.answer);
+	entry->elapsed_us = elapsed_us;
+	entry->pool_bytes = mp_total_size(task->req.pool.ctx);
+	struct kr_rplan *rplan = &task->req.rplan;
+	entry->round_trips = rplan->resolved.len;
+	memset(&entry->last_ns, 0, sizeof(entry->last_ns));
+	if (rplan->resolved.len > 0) {
+		struct kr_query *last = array_tail(rplan->resolved);
+		if (last->ns.addr[0].ip.sa_family != AF_UNSPEC) {
+			memcpy(&entry->last_ns, &last->ns.addr[0], sizeof(entry->last_ns));
+		}
+	}
+	entry->trace_len = task->req.trace.len;
+	if (entry->trace_len > 0) {
+		memcpy(entry->trace, task->req.trace.ev,
+		       entry->trace_len * sizeof(entry->trace[0]));
+	}
+	worker->slowlog.head = (worker->slowlog.head + 1) % SLOWLOG_COUNT;
+	if (worker->slowlog.len < SLOWLOG_COUNT) {
+		worker->slowlog.len += 1;
+	}
+}
+
 static int qr_task_finalize(struct qr_task *task, int state)
 {
 	assert(task && task->leading == false);
 	kr_resolve_finish(&task->req, state);
 	task->finished = true;
+	const uint64_t elapsed_us = (uv_hrtime() - task->created_ns) / 1000;
+	KR_PROBE4(query_finish, task, knot_pkt_qname(task->req.answer),
+	          knot_pkt_qtype(task->req.answer), elapsed_us);
+	if (task->worker->slowlog.threshold_us != 0 &&
+	    elapsed_us >= task->worker->slowlog.threshold_us) {
+		slowlog_record(task, elapsed_us);
+	}
+	/* Wake up duplicate queries waiting for this answer. */
+	dedup_finalize(task, state);
+	/* Refresh entries served past expiration in the background. */
+	task_refresh_stale(task);
 	/* Send back answer */
 	(void) qr_task_send(task, task->source.handle, (struct sockaddr *)&task->source.addr, task->req.answer);
 	return state == KNOT_STATE_DONE ? 0 : kr_error(EIO);
 }
 
+/** @internal Whether the address is configured as a DNS-over-TLS upstream. */
+static bool upstream_has_tls(struct worker_ctx *worker, const struct sockaddr *addr)
+{
+	if (!addr) {
+		return false;
+	}
+	char key[INET6_ADDRSTRLEN];
+	if (!kr_straddr_buf(addr, key, sizeof(key))) {
+		return false;
+	}
+	return map_contains(&worker->engine->net.tls_client, key);
+}
+
 static int qr_task_step(struct qr_task *task, const struct sockaddr *packet_source, knot_pkt_t *packet)
 {
 	/* No more steps after we're finished. */
 	if (!task || task->finished) {
 		return kr_error(ESTALE);
 	}
+	KR_PROBE2(task_step, task, packet_source);
 	/* Close pending I/O requests */
 	subreq_finalize(task, packet_source, packet);
 	/* Consume input and produce next query */
@@ -727,6 +1637,16 @@ static int qr_task_step(struct qr_task *task, const struct sockaddr *packet_sour
 		}
 	}
 
+	/* The layers allocated from the request pool, re-measure it. */
+	pool_account(task);
+
+	/* A module parked the request on an external operation, see
+	 * kr_resolve_await().  The task keeps its mempool and resumes
+	 * via worker_resume() once the operation completes. */
+	if (state == KNOT_STATE_YIELD && task->req.async.pending) {
+		return kr_ok();
+	}
+
 	/* We're done, no more iterations needed */
 	if (state & (KNOT_STATE_DONE|KNOT_STATE_FAIL)) {
 		return qr_task_finalize(task, state);
@@ -741,6 +1661,13 @@ static int qr_task_step(struct qr_task *task, const struct sockaddr *packet_sour
 		choice += 1;
 	}
 
+	/* Upstreams configured for DNS-over-TLS always go over a stream. */
+	const bool want_tls = upstream_has_tls(task->worker,
+			packet_source ? packet_source : task->addrlist);
+	if (want_tls) {
+		sock_type = SOCK_STREAM;
+	}
+
 	/* Start fast retransmit with UDP, otherwise connect. */
 	int ret = 0;
 	if (sock_type == SOCK_DGRAM) {
@@ -762,7 +1689,20 @@ static int qr_task_step(struct qr_task *task, const struct sockaddr *packet_sour
 			} else {
 				timeout = KR_CONN_RETRY;
 			}
-			ret = timer_start(task, on_retransmit, timeout, 0);
+			/* Optionally race the two best-scoring addresses a few
+			 * milliseconds apart instead of waiting out the retry
+			 * interval. The retransmit rotates to the runner-up
+			 * address, and the loser is cancelled with the other
+			 * pending I/O when the first answer arrives. */
+			struct worker_ctx *worker = task->worker;
+			if (worker->udp_race > 0 && task->addrlist_count > 1) {
+				timeout = MIN(timeout, worker->udp_race);
+			}
+			/* Arm the backoff schedule and the budget for this round. */
+			task->retry_base = timeout;
+			task->retry_round = 0;
+			task->retry_deadline = uv_now(worker->loop) + KR_CONN_RTT_MAX;
+			ret = timer_start(task, on_retransmit, timeout);
 		} else {
 			return qr_task_step(task, NULL, NULL);
 		}
@@ -771,22 +1711,52 @@ static int qr_task_step(struct qr_task *task, const struct sockaddr *packet_sour
 		 */
 		subreq_lead(task);
 	} else {
-		uv_connect_t *conn = (uv_connect_t *)req_borrow(task->worker);
-		if (!conn) {
-			return qr_task_step(task, NULL, NULL);
-		}
-		uv_handle_t *client = ioreq_spawn(task, sock_type);
-		if (!client) {
-			req_release(task->worker, (struct req *)conn);
-			return qr_task_step(task, NULL, NULL);
+		/* Multiplex on an already connected upstream if possible,
+		 * or reuse a warm pooled connection, which skips the
+		 * handshake after truncated answers. */
+		const struct sockaddr *peer = packet_source ? packet_source : task->addrlist;
+		bool attached = tcp_busy_attach(task, peer) == 0;
+		if (!attached) {
+			uv_handle_t *warm = tcp_pool_borrow(task->worker, peer);
+			if (warm) {
+				attached = tcp_task_resume(task, warm) == 0;
+				if (!attached) {
+					uv_close(warm, tcp_pool_on_close);
+				}
+			}
 		}
-		conn->data = task;
-		if (uv_tcp_connect(conn, (uv_tcp_t *)client, packet_source?packet_source:task->addrlist, on_connect) != 0) {
-			req_release(task->worker, (struct req *)conn);
-			return qr_task_step(task, NULL, NULL);
+		if (attached) {
+			ret = timer_start(task, on_timeout, KR_CONN_RTT_MAX);
+		} else {
+			uv_connect_t *conn = (uv_connect_t *)task_req_borrow(task);
+			if (!conn) {
+				return qr_task_step(task, NULL, NULL);
+			}
+			uv_handle_t *client = ioreq_spawn(task, sock_type, peer->sa_family);
+			if (!client) {
+				task_req_release(task, (struct req *)conn);
+				return qr_task_step(task, NULL, NULL);
+			}
+			if (want_tls) {
+				/* The handshake starts from on_connect() and
+				 * the query is sent when it completes, see
+				 * worker_tls_connected(). */
+				struct session *session = client->data;
+				session->tls_ctx = tls_client_new(task->worker, peer);
+				if (!session->tls_ctx) {
+					task_req_release(task, (struct req *)conn);
+					return qr_task_step(task, NULL, NULL);
+				}
+				session->has_tls = true;
+			}
+			conn->data = task;
+			if (uv_tcp_connect(conn, (uv_tcp_t *)client, packet_source?packet_source:task->addrlist, on_connect) != 0) {
+				task_req_release(task, (struct req *)conn);
+				return qr_task_step(task, NULL, NULL);
+			}
+			qr_task_ref(task); /* Connect request borrows task */
+			ret = timer_start(task, on_timeout, KR_CONN_RTT_MAX);
 		}
-		qr_task_ref(task); /* Connect request borrows task */
-		ret = timer_start(task, on_timeout, KR_CONN_RTT_MAX, 0);
 	}
 
 	/* Start next step with timeout, fatal if can't start a timer. */
@@ -797,20 +1767,488 @@ static int qr_task_step(struct qr_task *task, const struct sockaddr *packet_sour
 	return 0;
 }
 
-static int parse_packet(knot_pkt_t *query)
+/** @internal Skip wire-format name, returns offset past the name or -1 on malformed wire.
+  * A compression pointer terminates the name when @a allow_ptr; otherwise it is
+  * rejected, so names taken for further processing are plain labels ending with
+  * the root - a pointer must never reach the cache-key or echo paths, its first
+  * byte would be read as a 192-byte label. */
+static ssize_t wire_skip_name(const uint8_t *wire, size_t size, size_t pos, bool allow_ptr)
+{
+	while (pos < size) {
+		const uint8_t len = wire[pos];
+		if (len == 0) {
+			return pos + 1;
+		}
+		if ((len & 0xc0) == 0xc0) {
+			if (!allow_ptr) {
+				return -1;
+			}
+			return (pos + 2 <= size) ? (ssize_t)(pos + 2) : -1;
+		}
+		if ((len & 0xc0) != 0) {
+			return -1;
+		}
+		pos += len + 1;
+	}
+	return -1;
+}
+
+/** @internal Rewrite TTLs in cached wire by cache drift and strip the OPT record,
+  * as the client didn't advertise EDNS. */
+static int answer_patch(uint8_t *wire, size_t *size, uint32_t drift)
+{
+	/* Fixed part of a record after the owner name: type, class, ttl, rdlength. */
+	const size_t rr_fixed = 2 * sizeof(uint16_t) + sizeof(uint32_t) + sizeof(uint16_t);
+	size_t pos = KNOT_WIRE_HEADER_SIZE;
+	/* Skip question section. */
+	for (unsigned i = knot_wire_get_qdcount(wire); i > 0; --i) {
+		ssize_t skip = wire_skip_name(wire, *size, pos, true);
+		if (skip < 0 || skip + 2 * sizeof(uint16_t) > *size) {
+			return kr_error(EMSGSIZE);
+		}
+		pos = skip + 2 * sizeof(uint16_t);
+	}
+	/* Walk answer, authority and additional records. */
+	unsigned rrcount = knot_wire_get_ancount(wire) + knot_wire_get_nscount(wire)
+	                 + knot_wire_get_arcount(wire);
+	for (unsigned i = 0; i < rrcount; ++i) {
+		ssize_t skip = wire_skip_name(wire, *size, pos, true);
+		if (skip < 0 || skip + rr_fixed > *size) {
+			return kr_error(EMSGSIZE);
+		}
+		const uint16_t type = wire_read_u16(wire + skip);
+		const uint32_t ttl = wire_read_u32(wire + skip + 2 * sizeof(uint16_t));
+		const uint16_t rdlen = wire_read_u16(wire + skip + rr_fixed - sizeof(uint16_t));
+		size_t next = skip + rr_fixed + rdlen;
+		if (next > *size) {
+			return kr_error(EMSGSIZE);
+		}
+		if (type == KNOT_RRTYPE_OPT) {
+			memmove(wire + pos, wire + next, *size - next);
+			*size -= next - pos;
+			knot_wire_set_arcount(wire, knot_wire_get_arcount(wire) - 1);
+			continue; /* Stripped, record at 'pos' changed. */
+		}
+		/* TTL decays by the time spent in cache. */
+		wire_write_u32(wire + skip + 2 * sizeof(uint16_t), ttl > drift ? ttl - drift : 0);
+		pos = next;
+	}
+	return kr_ok();
+}
+
+int worker_answer_cached(struct worker_ctx *worker, uv_handle_t *handle,
+		knot_pkt_t *query, const struct sockaddr *addr,
+		uint8_t *dst, size_t *dst_len)
+{
+	if (!worker || !handle || !query || !addr || !dst || !dst_len) {
+		return kr_error(EINVAL);
+	}
+	struct session *session = handle->data;
+	if (session->outgoing || handle->type != UV_UDP) {
+		return kr_error(EINVAL);
+	}
+	struct kr_cache *cache = &worker->engine->resolver.cache;
+	if (!kr_cache_is_open(cache)) {
+		return kr_error(ENOENT);
+	}
+	/* Take only plain well-formed queries, EDNS or TSIG need the full pipeline. */
+	const uint8_t *wire = query->wire;
+	if (query->size < KNOT_WIRE_HEADER_SIZE ||
+	    knot_wire_get_qr(wire) || knot_wire_get_tc(wire) ||
+	    knot_wire_get_opcode(wire) != KNOT_OPCODE_QUERY ||
+	    knot_wire_get_qdcount(wire) != 1 ||
+	    knot_wire_get_ancount(wire) != 0 ||
+	    knot_wire_get_nscount(wire) != 0 ||
+	    knot_wire_get_arcount(wire) != 0) {
+		return kr_error(ENOENT);
+	}
+	/* Parse question directly from the wire to avoid packet allocations. */
+	const uint8_t *qptr = wire + KNOT_WIRE_HEADER_SIZE;
+	const ssize_t qend = wire_skip_name(wire, query->size, KNOT_WIRE_HEADER_SIZE, false);
+	if (qend < 0 || qend + 2 * sizeof(uint16_t) != query->size) {
+		return kr_error(ENOENT); /* Malformed or compressed question. */
+	}
+	const size_t qname_len = qend - KNOT_WIRE_HEADER_SIZE;
+	const uint16_t qtype = wire_read_u16(wire + qend);
+	const uint16_t qclass = wire_read_u16(wire + qend + sizeof(uint16_t));
+	if (qclass != KNOT_CLASS_IN || qname_len > KNOT_DNAME_MAXLEN) {
+		return kr_error(ENOENT);
+	}
+	/* Lookup uses lowercased name, the answer echoes the original spelling. */
+	uint8_t qname[KNOT_DNAME_MAXLEN];
+	memcpy(qname, qptr, qname_len);
+	knot_dname_to_lower(qname);
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	uint32_t drift = now.tv_sec;
+	struct kr_cache_entry *entry = NULL;
+	int ret = kr_cache_peek(cache, KR_CACHE_PKT, qname, qtype, &entry, &drift);
+	if (ret != 0) {
+		return kr_error(ENOENT);
+	}
+	/* Without the validator in the loop, take only entries that need
+	 * no rank checks or wildcard expansion proofs. */
+	if (entry->rank == KR_RANK_BAD || (entry->flags & KR_CACHE_FLAG_WCARD_PROOF) ||
+	    entry->count > KNOT_WIRE_MIN_PKTSIZE) {
+		return kr_error(ENOENT);
+	}
+	/* Copy out of the cache, patching must not touch the database pages. */
+	size_t size = entry->count;
+	memcpy(dst, entry->data, size);
+	if (answer_patch(dst, &size, drift) != 0) {
+		return kr_error(ENOENT);
+	}
+	/* Restore message id, question spelling and header bits for the client. */
+	const ssize_t cached_qend = wire_skip_name(dst, size, KNOT_WIRE_HEADER_SIZE, false);
+	if (cached_qend < 0 || cached_qend - KNOT_WIRE_HEADER_SIZE != qname_len) {
+		return kr_error(ENOENT);
+	}
+	memcpy(dst + KNOT_WIRE_HEADER_SIZE, qptr, qname_len);
+	knot_wire_set_id(dst, knot_wire_get_id(wire));
+	if (knot_wire_get_rd(wire)) {
+		knot_wire_set_rd(dst);
+	} else {
+		knot_wire_clear_rd(dst);
+	}
+	knot_wire_set_qr(dst);
+	knot_wire_clear_aa(dst);
+	knot_wire_set_ra(dst);
+	*dst_len = size;
+	worker->stats.queries += 1;
+	return kr_ok();
+}
+
+/** @internal Build a minimal header-only reply from the query wire, echoing
+  * the question when it is intact and uncompressed. Needs at least a whole
+  * header in msg and KNOT_WIRE_MIN_PKTSIZE bytes of room in dst.
+  * An rcode < 0 leaves the query rcode untouched. */
+static size_t wire_reply(const uint8_t *msg, ssize_t len, uint8_t *dst, bool tc, int rcode)
+{
+	size_t size = KNOT_WIRE_HEADER_SIZE;
+	const ssize_t qend = wire_skip_name(msg, len, KNOT_WIRE_HEADER_SIZE, false);
+	if (knot_wire_get_qdcount(msg) == 1 && qend > 0 &&
+	    qend + 2 * sizeof(uint16_t) <= (size_t)len) {
+		size = qend + 2 * sizeof(uint16_t);
+	}
+	memcpy(dst, msg, size);
+	knot_wire_set_qr(dst);
+	if (tc) {
+		knot_wire_set_tc(dst);
+	}
+	if (rcode >= 0) {
+		knot_wire_set_rcode(dst, rcode);
+	}
+	knot_wire_set_qdcount(dst, size > KNOT_WIRE_HEADER_SIZE ? 1 : 0);
+	knot_wire_set_ancount(dst, 0);
+	knot_wire_set_nscount(dst, 0);
+	knot_wire_set_arcount(dst, 0);
+	return size;
+}
+
+int worker_rrl_check(struct worker_ctx *worker, const struct sockaddr *addr,
+		const uint8_t *msg, ssize_t len, uint8_t *dst, size_t *dst_len)
+{
+	if (!worker || worker->rrl_rate == 0 || !addr) {
+		return kr_ok();
+	}
+	if (!worker->rrl) { /* Allocated on first use, freed in worker_reclaim() */
+		worker->rrl = calloc(RRL_BUCKETS, sizeof(*worker->rrl));
+		if (!worker->rrl) {
+			return kr_ok(); /* Fail open. */
+		}
+	}
+	/* Hash the masked source prefix, the family byte keeps v4/v6 apart. */
+	uint8_t prefix[1 + sizeof(struct in6_addr)] = { addr->sa_family };
+	const int bits = addr->sa_family == AF_INET6 ? RRL_V6_PREFIX : RRL_V4_PREFIX;
+	memcpy(prefix + 1, kr_inaddr(addr), bits / 8);
+	const uint32_t key = hash_keyed((const char *)prefix, sizeof(prefix));
+	struct rrl_bucket *bucket = &worker->rrl[key & (RRL_BUCKETS - 1)];
+	/* Refill once a second, a colliding prefix simply takes the bucket over. */
+	const uint32_t now = uv_now(worker->loop) / 1000;
+	if (bucket->key != key || bucket->epoch != now) {
+		if (bucket->key != key) {
+			bucket->slipped = 0;
+		}
+		bucket->key = key;
+		bucket->epoch = now;
+		bucket->tokens = worker->rrl_rate;
+	}
+	if (bucket->tokens > 0) {
+		bucket->tokens -= 1;
+		return kr_ok();
+	}
+	worker->stats.dropped += 1;
+	/* SLIP: answer every Nth limited query with a truncated response,
+	 * so legitimate clients behind a spoofed prefix retry over TCP. */
+	if (dst && dst_len && worker->rrl_slip > 0 &&
+	    ++bucket->slipped >= worker->rrl_slip && len >= KNOT_WIRE_HEADER_SIZE) {
+		bucket->slipped = 0;
+		*dst_len = wire_reply(msg, len, dst, true, -1);
+	}
+	return kr_error(EBUSY);
+}
+
+/** @internal Measure event-loop lag: a repeating timer fires late by exactly
+  * the time the loop spent not getting around to its callbacks. */
+static void lag_probe(uv_timer_t *timer)
+{
+	struct worker_ctx *worker = timer->data;
+	const uint64_t now = uv_now(timer->loop);
+	worker->load.lag = now > worker->load.lag_next ? now - worker->load.lag_next : 0;
+	worker->load.lag_next = now + LOADCHECK_INTERVAL;
+}
+
+/*
+ * Event-loop lag watchdog, see worker.stalls().
+ *
+ * The check handle runs right after the poll phase and the prepare handle
+ * right before the next one, so between them lies everything the loop did
+ * in one turn.  The poll phase itself contains both the epoll wait and the
+ * I/O callbacks; the wait is subtracted using the timeout the loop asked
+ * for, so a turn kept busy by I/O work is charged while an idle wait is
+ * not.  Each turn the per-layer timing tables are differenced against a
+ * snapshot; when a turn blows the budget, the hook that advanced the most
+ * names the culprit, and a turn no layer dominates is booked as '(loop)'
+ * (I/O parsing, cache flush, Lua GC, timers).
+ */
+
+/** @internal Difference one timing table against the snapshot, tracking the
+  * entry that advanced the most. The snapshot is refreshed in the same pass. */
+static void watchdog_scan(const layer_timing_array_t *table, const char *hook,
+                          uint64_t *snap, size_t *pos,
+                          uint64_t *best, const struct kr_layer_timing **who,
+                          const char **who_hook)
+{
+	for (size_t i = 0; i < table->len; ++i, ++*pos) {
+		/* A counter below the snapshot means it was reset meanwhile. */
+		uint64_t delta = table->at[i].ns >= snap[*pos]
+		               ? table->at[i].ns - snap[*pos] : 0;
+		snap[*pos] = table->at[i].ns;
+		if (best && delta > *best) {
+			*best = delta;
+			*who = &table->at[i];
+			*who_hook = hook;
+		}
+	}
+}
+
+/** @internal Refresh the timing snapshot; returns false right after a dispatch
+  * generation flip, when the fresh snapshot has no previous turn to diff. */
+static bool watchdog_resnap(struct worker_ctx *worker)
+{
+	struct kr_layer_set *layers = worker->engine->resolver.layers;
+	if (!layers) {
+		return false;
+	}
+	size_t len = layers->time_begin.len + layers->time_reset.len +
+	             layers->time_finish.len + layers->time_consume.len +
+	             layers->time_produce.len;
+	if (layers == worker->watchdog.layer_gen &&
+	    len == worker->watchdog.layer_snap_len) {
+		return true;
+	}
+	uint64_t *snap = realloc(worker->watchdog.layer_snap, len * sizeof(*snap));
+	if (!snap && len > 0) {
+		return false;
+	}
+	worker->watchdog.layer_snap = snap;
+	worker->watchdog.layer_snap_len = len;
+	worker->watchdog.layer_gen = layers;
+	/* Prime from the current counters, a zero base would misattribute
+	 * the whole history to the next turn. */
+	size_t pos = 0;
+	watchdog_scan(&layers->time_begin, NULL, snap, &pos, NULL, NULL, NULL);
+	watchdog_scan(&layers->time_reset, NULL, snap, &pos, NULL, NULL, NULL);
+	watchdog_scan(&layers->time_finish, NULL, snap, &pos, NULL, NULL, NULL);
+	watchdog_scan(&layers->time_consume, NULL, snap, &pos, NULL, NULL, NULL);
+	watchdog_scan(&layers->time_produce, NULL, snap, &pos, NULL, NULL, NULL);
+	return false;
+}
+
+/** @internal Book a stalled turn under its attribution counter. */
+static void watchdog_record(struct worker_ctx *worker, const char *name, uint64_t busy)
+{
+	for (unsigned i = 0; i < WATCHDOG_SLOTS; ++i) {
+		struct stall_source *s = &worker->watchdog.source[i];
+		if (s->name[0] == '\0') {
+			strncpy(s->name, name, sizeof(s->name) - 1);
+		} else if (strcmp(s->name, name) != 0) {
+			continue;
+		}
+		s->count += 1;
+		s->ns += busy;
+		return;
+	}
+	/* Table full, the tail slot catches the rest. */
+	struct stall_source *s = &worker->watchdog.source[WATCHDOG_SLOTS - 1];
+	s->count += 1;
+	s->ns += busy;
+}
+
+static void watchdog_on_check(uv_check_t *handle)
+{
+	struct worker_ctx *worker = handle->data;
+	const uint64_t now = uv_hrtime();
+	if (worker->watchdog.poll_mark != 0) {
+		uint64_t span = now - worker->watchdog.poll_mark;
+		uint64_t wait = MIN(span, worker->watchdog.poll_wait);
+		worker->watchdog.busy_ns += span - wait;
+		worker->watchdog.poll_mark = 0;
+	}
+	worker->watchdog.busy_mark = now;
+}
+
+static void watchdog_on_prepare(uv_prepare_t *handle)
+{
+	struct worker_ctx *worker = handle->data;
+	const uint64_t now = uv_hrtime();
+	if (worker->watchdog.busy_mark != 0) {
+		worker->watchdog.busy_ns += now - worker->watchdog.busy_mark;
+		worker->watchdog.busy_mark = 0;
+	}
+	/* Diff the layer timings over the turn that just ended. */
+	uint64_t best = 0;
+	const struct kr_layer_timing *who = NULL;
+	const char *who_hook = NULL;
+	if (watchdog_resnap(worker)) {
+		size_t pos = 0;
+		struct kr_layer_set *layers = worker->watchdog.layer_gen;
+		uint64_t *snap = worker->watchdog.layer_snap;
+		watchdog_scan(&layers->time_begin, "begin", snap, &pos, &best, &who, &who_hook);
+		watchdog_scan(&layers->time_reset, "reset", snap, &pos, &best, &who, &who_hook);
+		watchdog_scan(&layers->time_finish, "finish", snap, &pos, &best, &who, &who_hook);
+		watchdog_scan(&layers->time_consume, "consume", snap, &pos, &best, &who, &who_hook);
+		watchdog_scan(&layers->time_produce, "produce", snap, &pos, &best, &who, &who_hook);
+	}
+	const uint64_t busy = worker->watchdog.busy_ns;
+	worker->watchdog.busy_ns = 0;
+	if (busy > worker->watchdog.budget_ns) {
+		worker->watchdog.stalls += 1;
+		if (busy > worker->watchdog.worst_ns) {
+			worker->watchdog.worst_ns = busy;
+		}
+		if (who && 2 * best >= busy) {
+			char name[sizeof(worker->watchdog.source[0].name)];
+			snprintf(name, sizeof(name), "%s.%s", who->module->name, who_hook);
+			watchdog_record(worker, name, busy);
+		} else {
+			watchdog_record(worker, "(loop)", busy);
+		}
+	}
+	/* Entering the poll phase, remember how long the loop meant to sleep. */
+	worker->watchdog.poll_mark = now;
+	int timeout = uv_backend_timeout(handle->loop);
+	worker->watchdog.poll_wait = timeout < 0 ? UINT64_MAX : (uint64_t)timeout * 1000000;
+}
+
+int worker_watchdog(struct worker_ctx *worker, unsigned budget_ms)
+{
+	if (!worker) {
+		return kr_error(EINVAL);
+	}
+	if (budget_ms == 0) {
+		if (worker->watchdog.init) {
+			uv_prepare_stop(&worker->watchdog.prepare);
+			uv_check_stop(&worker->watchdog.check);
+		}
+		worker->watchdog.budget_ns = 0;
+		return kr_ok();
+	}
+	if (!worker->watchdog.init) {
+		uv_prepare_init(worker->loop, &worker->watchdog.prepare);
+		uv_check_init(worker->loop, &worker->watchdog.check);
+		worker->watchdog.prepare.data = worker;
+		worker->watchdog.check.data = worker;
+		worker->watchdog.init = true;
+	}
+	worker->watchdog.budget_ns = (uint64_t)budget_ms * 1000000;
+	worker->watchdog.poll_mark = worker->watchdog.busy_mark = 0;
+	worker->watchdog.busy_ns = 0;
+	worker->watchdog.stalls = 0;
+	worker->watchdog.worst_ns = 0;
+	memset(worker->watchdog.source, 0, sizeof(worker->watchdog.source));
+	/* Attribution reads the layer timing tables, make sure they count. */
+	struct kr_context *ctx = &worker->engine->resolver;
+	if (!ctx->layers && kr_context_compile_layers(ctx) != 0) {
+		return kr_error(ENOMEM);
+	}
+	ctx->layers->timing = true;
+	uv_prepare_start(&worker->watchdog.prepare, watchdog_on_prepare);
+	uv_check_start(&worker->watchdog.check, watchdog_on_check);
+	return kr_ok();
+}
+
+/** @internal Whether an admission watermark is crossed. */
+static bool worker_overloaded(struct worker_ctx *worker)
+{
+	if (worker->load.policy == SHED_NONE) {
+		return false;
+	}
+	if (worker->load.max_tasks > 0 &&
+	    worker->stats.concurrent >= worker->load.max_tasks) {
+		return true;
+	}
+	if (worker->mem.budget > 0 && worker->mem.live >= worker->mem.budget) {
+		return true;
+	}
+	return worker->load.max_lag > 0 && worker->load.lag >= worker->load.max_lag;
+}
+
+int worker_overload_check(struct worker_ctx *worker, const uint8_t *msg,
+		ssize_t len, uint8_t *dst, size_t *dst_len)
+{
+	if (!worker || worker->load.policy == SHED_NONE) {
+		return kr_ok();
+	}
+	/* Lazy probe setup, it runs only while shedding is configured. */
+	if (worker->load.max_lag > 0) {
+		if (!worker->load.lag_timer_init) {
+			uv_timer_init(worker->loop, &worker->load.lag_timer);
+			worker->load.lag_timer.data = worker;
+			worker->load.lag_timer_init = true;
+		}
+		if (!uv_is_active((uv_handle_t *)&worker->load.lag_timer)) {
+			worker->load.lag_next = uv_now(worker->loop) + LOADCHECK_INTERVAL;
+			uv_timer_start(&worker->load.lag_timer, lag_probe,
+			               LOADCHECK_INTERVAL, LOADCHECK_INTERVAL);
+		}
+	}
+	if (!worker_overloaded(worker)) {
+		return kr_ok();
+	}
+	worker->load.shed += 1;
+	worker->stats.dropped += 1;
+	if (dst && dst_len && len >= KNOT_WIRE_HEADER_SIZE) {
+		switch (worker->load.policy) {
+		case SHED_TC:
+			*dst_len = wire_reply(msg, len, dst, true, -1);
+			break;
+		case SHED_SERVFAIL:
+			*dst_len = wire_reply(msg, len, dst, false, KNOT_RCODE_SERVFAIL);
+			break;
+		default:
+			break; /* Shed silently. */
+		}
+	}
+	return kr_error(EBUSY);
+}
+
+static int parse_packet(knot_pkt_t *query, bool question_only)
 {
 	if (!query){
 		return kr_error(EINVAL);
 	}
 
-	/* Parse query packet. */
-	int ret = knot_pkt_parse(query, 0);
+	/* Parse query packet. Upstream answers get only their question parsed,
+	 * the iterate layer fills in the sections once cheap checks pass. */
+	int ret = question_only ? knot_pkt_parse_question(query)
+	                        : knot_pkt_parse(query, 0);
 	if (ret != KNOT_EOK) {
 		return kr_error(EPROTO); /* Ignore malformed query. */
 	}
 
 	/* Check if at least header is parsed. */
-	if (query->parsed < query->size) {
+	if (!question_only && query->parsed < query->size) {
 		return kr_error(EMSGSIZE);
 	}
 
@@ -827,7 +2265,7 @@ int worker_submit(struct worker_ctx *worker, uv_handle_t *handle, knot_pkt_t *ms
 	assert(session);
 
 	/* Parse packet */
-	int ret = parse_packet(msg);
+	int ret = parse_packet(msg, session->outgoing);
 
 	/* Start new task on listening sockets, or resume if this is subrequest */
 	struct qr_task *task = NULL;
@@ -846,6 +2284,12 @@ int worker_submit(struct worker_ctx *worker, uv_handle_t *handle, knot_pkt_t *ms
 			qr_task_free(task);
 			return kr_error(ENOMEM);
 		}
+		KR_PROBE3(query_submit, task, knot_pkt_qname(msg), knot_pkt_qtype(msg));
+		/* Attach to an identical in-flight query, or lead one. */
+		if (dedup_enqueue(worker, task, msg)) {
+			return kr_ok(); /* Notified when the leader finishes. */
+		}
+		dedup_lead(worker, task, msg);
 	} else {
 		task = session->tasks.len > 0 ? array_tail(session->tasks) : NULL;
 	}
@@ -854,19 +2298,22 @@ int worker_submit(struct worker_ctx *worker, uv_handle_t *handle, knot_pkt_t *ms
 	return qr_task_step(task, addr, msg);
 }
 
-/* Return DNS/TCP message size. */
-static int msg_size(const uint8_t *msg)
-{
-		return wire_read_u16(msg);
-}
-
-/* If buffering, close last task as it isn't live yet. */
-static void discard_buffered(struct session *session)
+int worker_tls_connected(struct worker_ctx *worker, uv_handle_t *handle)
 {
-	if (session->buffering) {
-		qr_task_free(session->buffering);
-		session->buffering = NULL;
+	if (!worker || !handle || !handle->data) {
+		return kr_error(EINVAL);
+	}
+	struct session *session = handle->data;
+	/* Only now can the connection take multiplexed queries. */
+	tcp_busy_reg(worker, handle);
+	struct sockaddr_storage addr;
+	int addr_len = sizeof(addr);
+	uv_tcp_getpeername((uv_tcp_t *)handle, (struct sockaddr *)&addr, &addr_len);
+	for (size_t i = 0; i < session->tasks.len; ++i) {
+		struct qr_task *task = session->tasks.at[i];
+		qr_task_send(task, handle, (struct sockaddr *)&addr, task->pktbuf);
 	}
+	return kr_ok();
 }
 
 int worker_end_tcp(struct worker_ctx *worker, uv_handle_t *handle)
@@ -879,9 +2326,15 @@ int worker_end_tcp(struct worker_ctx *worker, uv_handle_t *handle)
 	 * borrowed the task from parent session. */
 	struct session *session = handle->data;
 	if (session->outgoing) {
-		worker_submit(worker, (uv_handle_t *)handle, NULL, NULL);	
-	} else {
-		discard_buffered(session);
+		/* Unpublish the connection first, so the failed-over queries
+		 * don't multiplex right back onto it, then step every pending
+		 * task; each step detaches its task, see ioreq_kill(). */
+		tcp_busy_unreg(worker, session);
+		session->reusable = false;
+		size_t bound = session->tasks.len;
+		while (session->tasks.len > 0 && bound-- > 0) {
+			worker_submit(worker, (uv_handle_t *)handle, NULL, NULL);
+		}
 	}
 	return 0;
 }
@@ -893,6 +2346,12 @@ int worker_process_tcp(struct worker_ctx *worker, uv_stream_t *handle, const uin
 	}
 	/* Connection error or forced disconnect */
 	struct session *session = handle->data;
+	/* Any activity on a parked connection evicts it from the warm pool,
+	 * be it a server-side close or a stray late answer nobody waits for. */
+	if (session->parked) {
+		tcp_pool_evict(worker, (uv_handle_t *)handle);
+		return 0;
+	}
 	if (len <= 0 || !msg) {
 		/* If we have pending tasks, we must dissociate them from the
 		 * connection so they don't try to access closed and freed handle.
@@ -909,102 +2368,139 @@ int worker_process_tcp(struct worker_ctx *worker, uv_stream_t *handle, const uin
 		return kr_error(ECONNRESET);
 	}
 
-	int submitted = 0;
-	ssize_t nbytes = 0;
-	struct qr_task *task = session->buffering;
-
-	/* If this is a new query, create a new task that we can use
-	 * to buffer incoming message until it's complete. */
-	if (!session->outgoing) {
-		if (!task) {
-			/* Get TCP peer name, keep zeroed address if it fails. */
-			struct sockaddr_storage addr;
-			memset(&addr, 0, sizeof(addr));
-			int addr_len = sizeof(addr);
-			uv_tcp_getpeername((uv_tcp_t *)handle, (struct sockaddr *)&addr, &addr_len);
-			task = qr_task_create(worker, (uv_handle_t *)handle, (struct sockaddr *)&addr);
-			if (!task) {
-				return kr_error(ENOMEM);
-			}
-			session->buffering = task;
+	/* Plaintext stream reads land directly in the session buffer, only
+	 * data decrypted by the TLS layer has to be appended here. */
+	if (!session->rbuf) {
+		session->rbuf = tcp_rbuf_borrow(worker);
+		session->rbuf_end = 0;
+		if (!session->rbuf) {
+			return kr_error(ENOMEM);
 		}
-	} else {
-		assert(session->tasks.len > 0);
-		task = array_tail(session->tasks);
 	}
-	/* At this point session must have either created new task or it's already assigned. */
-	assert(task);
-	assert(len > 0);
-	/* Start reading DNS/TCP message length */
-	knot_pkt_t *pkt_buf = task->pktbuf;
-	if (task->bytes_remaining == 0 && pkt_buf->size == 0) {
-		knot_pkt_clear(pkt_buf);
-		/* Read only one byte as TCP fragment may end at a 1B boundary
-		 * which would lead to OOB read or improper reassembly length. */
-		pkt_buf->size = 1;
-		pkt_buf->wire[0] = msg[0];
-		len -= 1;
-		msg += 1;
-		if (len == 0) {
-			return 0;
-		}
-	}
-	/* Finish reading DNS/TCP message length. */
-	if (task->bytes_remaining == 0 && pkt_buf->size == 1) {
-		pkt_buf->wire[1] = msg[0];
-		nbytes = msg_size(pkt_buf->wire);
-		len -= 1;
-		msg += 1;
-		/* Cut off fragment length and start reading DNS message. */
-		pkt_buf->size = 0;
-		task->bytes_remaining = nbytes;
-	}
-	/* Message is too long, can't process it. */
-	ssize_t to_read = MIN(len, task->bytes_remaining);
-	if (pkt_buf->size + to_read > pkt_buf->max_size) {
-		pkt_buf->size = 0;
-		task->bytes_remaining = 0;
-		return kr_error(EMSGSIZE);
+	if (msg != session->rbuf + session->rbuf_end) {
+		if (session->rbuf_end + len > TCP_RBUF_SIZE) {
+			return kr_error(EMSGSIZE);
+		}
+		memcpy(session->rbuf + session->rbuf_end, msg, len);
 	}
-	/* Buffer message and check if it's complete */
-	memcpy(pkt_buf->wire + pkt_buf->size, msg, to_read);
-	pkt_buf->size += to_read;
-	if (to_read >= task->bytes_remaining) {
-		task->bytes_remaining = 0;
-		/* Parse the packet and start resolving complete query */
-		int ret = parse_packet(pkt_buf);
-		if (ret == 0 && !session->outgoing) {
-			ret = qr_task_start(task, pkt_buf);
-			if (ret != 0) {
-				return ret;
+	session->rbuf_end += len;
+	return worker_drain_tcp(worker, handle, TCP_DRAIN_QUANTUM);
+}
+
+int worker_drain_tcp(struct worker_ctx *worker, uv_stream_t *handle, int budget)
+{
+	if (!worker || !handle) {
+		return kr_error(EINVAL);
+	}
+	struct session *session = handle->data;
+	/* Process messages framed in the buffer, up to the budget. Each query
+	 * runs as an independent task and writes its response back when it
+	 * completes, so a slow query at the head of the stream doesn't hold
+	 * back the pipelined queries behind it. */
+	int submitted = 0;
+	int ret = 0;
+	uint32_t pos = 0;
+	while (session->rbuf && session->rbuf_end - pos >= sizeof(uint16_t)) {
+		if (!session->outgoing && (submitted >= budget ||
+		    session->tasks.len >= worker->tcp_pipeline_max)) {
+			break; /* Budget or quota spent, the rest keeps for the next round. */
+		}
+		const uint16_t msg_len = wire_read_u16(session->rbuf + pos);
+		if (session->rbuf_end - pos - sizeof(uint16_t) < msg_len) {
+			break; /* Incomplete message, wait for the next read. */
+		}
+		uint8_t *wire = session->rbuf + pos + sizeof(uint16_t);
+		pos += sizeof(uint16_t) + msg_len;
+		/* The parser gets a zero-copy view over the buffered frame,
+		 * resolution copies whatever it keeps into the task pool. */
+		knot_pkt_t *query = knot_pkt_new(wire, msg_len, &worker->pkt_pool);
+		if (!query) {
+			ret = kr_error(ENOMEM);
+			break;
+		}
+		ret = parse_packet(query, session->outgoing);
+		if (ret != 0) {
+			break; /* Malformed message breaks the stream. */
+		}
+		if (session->outgoing) {
+			/* A whole answer arrived, the connection is healthy and may be pooled. */
+			session->reusable = true;
+			/* Match the answer to its query by message ID, the
+			 * connection may be multiplexed. An unmatched ID means
+			 * the query timed out meanwhile, drop the answer. */
+			const uint16_t msg_id = knot_wire_get_id(query->wire);
+			struct qr_task *task = NULL;
+			for (size_t i = session->tasks.len; i --> 0;) {
+				struct qr_task *pending = session->tasks.at[i];
+				if (knot_wire_get_id(pending->pktbuf->wire) == msg_id) {
+					task = pending;
+					break;
+				}
 			}
-			ret = qr_task_register(task, session);
-			if (ret != 0) {
-				return ret;
+			if (task) {
+				ret = qr_task_step(task, NULL, query);
 			}
-			/* Task is now registered in session, clear temporary. */
-			session->buffering = NULL;
-			submitted += 1;
+			/* The last step may have parked or closed the
+			 * connection, the leftover buffer is then stale. */
+			if (session->parked || uv_is_closing((uv_handle_t *)handle)) {
+				break;
+			}
+			continue;
+		}
+		/* Shed stream queries silently when saturated, the pipeline
+		 * quota and write backpressure do the graceful part here. */
+		if (worker_overloaded(worker)) {
+			worker->load.shed += 1;
+			worker->stats.dropped += 1;
+			continue;
+		}
+		/* Get TCP peer name, keep zeroed address if it fails. */
+		struct sockaddr_storage addr;
+		memset(&addr, 0, sizeof(addr));
+		int addr_len = sizeof(addr);
+		uv_tcp_getpeername((uv_tcp_t *)handle, (struct sockaddr *)&addr, &addr_len);
+		struct qr_task *task = qr_task_create(worker, (uv_handle_t *)handle, (struct sockaddr *)&addr);
+		if (!task) {
+			ret = kr_error(ENOMEM);
+			break;
 		}
-		/* Start only new queries, not subrequests that are already pending */
+		ret = qr_task_start(task, query);
 		if (ret == 0) {
-			ret = qr_task_step(task, NULL, pkt_buf);
+			ret = qr_task_register(task, session);
 		}
-		/* Process next message part in the stream if no error so far */
 		if (ret != 0) {
-			return ret;
+			qr_task_free(task);
+			break;
 		}
-		if (len - to_read > 0 && !session->outgoing) {
-			ret = worker_process_tcp(worker, handle, msg + to_read, len - to_read);
-			if (ret < 0) {
-				return ret;
-			}
-			submitted += ret;
+		submitted += 1;
+		/* Attach to an identical in-flight query, or lead one.
+		 * A failed client query must not drop the pipelined queries
+		 * queued behind it, its answer has been sent by the task
+		 * finalization already. */
+		if (!dedup_enqueue(worker, task, query)) {
+			dedup_lead(worker, task, query);
+			(void) qr_task_step(task, NULL, query);
 		}
-	} else {
-		task->bytes_remaining -= to_read;	
 	}
-	return submitted;
+	/* Keep the incomplete tail at the buffer start for the next read,
+	 * or return the buffer to the freelist once it's drained. */
+	if (pos > 0 && session->rbuf_end > pos) {
+		memmove(session->rbuf, session->rbuf + pos, session->rbuf_end - pos);
+	}
+	session->rbuf_end -= pos;
+	if (session->rbuf_end == 0) {
+		tcp_rbuf_release(worker, session->rbuf);
+		session->rbuf = NULL;
+	}
+	/* More whole queries are buffered; take a turn in the drain queue
+	 * rather than running them all here, so concurrent sessions share
+	 * the loop fairly. A session stalled on the pipeline quota requeues
+	 * once capacity frees up instead, see qr_task_free(). */
+	if (ret == 0 && !session->outgoing && session_has_query(session) &&
+	    session->tasks.len < worker->tcp_pipeline_max) {
+		tcp_drain_push(worker, session);
+	}
+	return ret != 0 ? ret : submitted;
 }
 
 int worker_resolve(struct worker_ctx *worker, knot_pkt_t *query, unsigned options, worker_cb_t on_complete, void *baton)
@@ -1030,21 +2526,69 @@ int worker_resolve(struct worker_ctx *worker, knot_pkt_t *query, unsigned option
 	return qr_task_step(task, NULL, query);
 }
 
+int worker_resume(struct worker_ctx *worker, struct kr_request *req)
+{
+	if (!worker || !req) {
+		return kr_error(EINVAL);
+	}
+	if (!req->async.pending) {
+		return kr_error(ENOENT);
+	}
+	/* The request is embedded as the first member of its task. */
+	struct qr_task *task = (struct qr_task *)req;
+	/* Unpark; the resolver resumes the pickled layer, which takes the
+	 * finished operation with kr_resolve_complete(). */
+	req->async.pending = false;
+	return qr_task_step(task, NULL, NULL);
+}
+
 /** Reserve worker buffers */
 static int worker_reserve(struct worker_ctx *worker, size_t ring_maxlen)
 {
 	array_init(worker->pool_mp);
 	array_init(worker->pool_ioreq);
 	array_init(worker->pool_sessions);
+	array_init(worker->pool_rbufs);
+	array_init(worker->pool_wirebufs);
+	array_init(worker->pool_wirebufs_sm);
+	worker->pool_mp.low = worker->pool_mp.trimmed = 0;
+	worker->pool_ioreq.low = worker->pool_ioreq.trimmed = 0;
+	worker->pool_sessions.low = worker->pool_sessions.trimmed = 0;
+	worker->pool_rbufs.low = worker->pool_rbufs.trimmed = 0;
+	worker->pool_wirebufs.low = worker->pool_wirebufs.trimmed = 0;
+	worker->pool_wirebufs_sm.low = worker->pool_wirebufs_sm.trimmed = 0;
+	worker->trim_timer_init = false;
+	worker->slowlog.head = worker->slowlog.len = 0;
+	worker->slowlog.threshold_us = 0;
 	if (array_reserve(worker->pool_mp, ring_maxlen) ||
 		array_reserve(worker->pool_ioreq, ring_maxlen) ||
-		array_reserve(worker->pool_sessions, ring_maxlen))
+		array_reserve(worker->pool_sessions, ring_maxlen) ||
+		array_reserve(worker->pool_rbufs, ring_maxlen) ||
+		array_reserve(worker->pool_wirebufs, ring_maxlen) ||
+		array_reserve(worker->pool_wirebufs_sm, ring_maxlen))
 		return kr_error(ENOMEM);
 	memset(&worker->pkt_pool, 0, sizeof(worker->pkt_pool));
 	worker->pkt_pool.ctx = mp_new (4 * sizeof(knot_pkt_t));
 	worker->pkt_pool.alloc = (knot_mm_alloc_t) mp_alloc;
 	worker->outgoing = map_make();
+	worker->dedup = map_make();
+	worker->tcp_pool = map_make();
+	worker->tcp_pool_len = 0;
+	worker->tcp_busy = map_make();
+	worker->tcp_busy_len = 0;
+	worker->udp_pool_len = 0;
+	worker->tcp_clients = 0;
+	worker->tcp_idle_head = worker->tcp_idle_tail = NULL;
+	worker->tcp_drain_head = worker->tcp_drain_tail = NULL;
+	worker->tcp_drain_timer_init = false;
+	worker->tcp_pool_timer_init = false;
 	worker->tcp_pipeline_max = MAX_PIPELINED;
+	worker->udp_race = 0;
+	worker->rrl_rate = 0;
+	worker->rrl_slip = 2;
+	worker->rrl = NULL;
+	worker->load.policy = SHED_NONE;
+	worker->load.lag_timer_init = false;
 	return kr_ok();
 }
 
@@ -1061,9 +2605,27 @@ void worker_reclaim(struct worker_ctx *worker)
 	reclaim_freelist(worker->pool_mp, struct mempool, mp_delete);
 	reclaim_freelist(worker->pool_ioreq, struct req, free);
 	reclaim_freelist(worker->pool_sessions, struct session, session_free);
+	reclaim_freelist(worker->pool_rbufs, uint8_t, free);
+	reclaim_freelist(worker->pool_wirebufs, uint8_t, free);
+	reclaim_freelist(worker->pool_wirebufs_sm, uint8_t, free);
+	worker->pool_mp.low = 0;
+	worker->pool_ioreq.low = 0;
+	worker->pool_sessions.low = 0;
+	worker->pool_rbufs.low = 0;
+	worker->pool_wirebufs.low = 0;
+	worker->pool_wirebufs_sm.low = 0;
 	mp_delete(worker->pkt_pool.ctx);
 	worker->pkt_pool.ctx = NULL;
 	map_clear(&worker->outgoing);
+	map_clear(&worker->dedup);
+	map_clear(&worker->tcp_pool);
+	map_clear(&worker->tcp_busy);
+	free(worker->rrl);
+	worker->rrl = NULL;
+	free(worker->watchdog.layer_snap);
+	worker->watchdog.layer_snap = NULL;
+	worker->watchdog.layer_snap_len = 0;
+	worker->watchdog.layer_gen = NULL;
 }
 
 struct worker_ctx *worker_create(struct engine *engine, knot_mm_t *pool,
@@ -37,6 +37,53 @@ struct worker_ctx *worker_create(struct engine *engine, knot_mm_t *pool,
 int worker_submit(struct worker_ctx *worker, uv_handle_t *handle, knot_pkt_t *query,
 		const struct sockaddr* addr);
 
+/**
+ * Try to answer a UDP query directly from the packet cache.
+ * This bypasses task creation and the layer pipeline for plain
+ * (EDNS-less) queries with a fresh whole-packet cache entry.
+ * The answer is written to dst (at least KNOT_WIRE_MIN_PKTSIZE bytes)
+ * and the caller is responsible for sending it back.
+ * @return 0 if the answer was produced, an error code otherwise
+ *         (the caller should submit the query normally)
+ */
+int worker_answer_cached(struct worker_ctx *worker, uv_handle_t *handle,
+		knot_pkt_t *query, const struct sockaddr *addr,
+		uint8_t *dst, size_t *dst_len);
+
+/**
+ * Check the response rate limit for an incoming client datagram.
+ * Token buckets are keyed by masked source prefix, so a spoofed-source flood
+ * is contained to its prefix and rejected before anything is allocated.
+ * @return 0 when the query passes. Otherwise it is over limit and must not
+ *         be submitted; when dst_len was set, a truncated answer (SLIP) has
+ *         been written to dst (at least KNOT_WIRE_MIN_PKTSIZE bytes) and
+ *         should be sent back instead of silence.
+ */
+int worker_rrl_check(struct worker_ctx *worker, const struct sockaddr *addr,
+		const uint8_t *msg, ssize_t len, uint8_t *dst, size_t *dst_len);
+
+/**
+ * Admission control for queries that would start a new resolution.
+ * Sheds load by the configured policy once the live task count or the
+ * event-loop lag crosses its watermark, before any task is allocated.
+ * @return 0 when the query is admitted. Otherwise it must not be submitted;
+ *         when dst_len was set, a truncated or SERVFAIL answer has been
+ *         written to dst (at least KNOT_WIRE_MIN_PKTSIZE bytes) and should
+ *         be sent back instead of silence.
+ */
+int worker_overload_check(struct worker_ctx *worker, const uint8_t *msg,
+		ssize_t len, uint8_t *dst, size_t *dst_len);
+
+/**
+ * Arm (or with 0, disarm) the event-loop lag watchdog.
+ * A prepare/check pair brackets the poll phase, so the busy time of every
+ * loop turn is measured; turns busier than the budget are counted and
+ * attributed to the layer hook that advanced the most in that turn,
+ * see worker.stalls(). Arming enables the layer timing accounting.
+ * @return 0 or an error code.
+ */
+int worker_watchdog(struct worker_ctx *worker, unsigned budget_ms);
+
 /**
  * Process incoming DNS/TCP message fragment(s).
  * If the fragment contains only a partial message, it is buffered.
@@ -46,12 +93,29 @@ int worker_submit(struct worker_ctx *worker, uv_handle_t *handle, knot_pkt_t *qu
 int worker_process_tcp(struct worker_ctx *worker, uv_stream_t *handle,
 		const uint8_t *msg, ssize_t len);
 
+/**
+ * Submit up to @a budget queries already framed in the session read buffer.
+ * Queries past the budget or the pipeline quota stay buffered and the
+ * session requeues for the next drain round, so concurrent sessions share
+ * the event loop fairly.
+ * @return number of queries submitted or an error code
+ */
+int worker_drain_tcp(struct worker_ctx *worker, uv_stream_t *handle, int budget);
+
 /**
  * End current DNS/TCP session, this disassociates pending tasks from this session
  * which may be freely closed afterwards.
  */
 int worker_end_tcp(struct worker_ctx *worker, uv_handle_t *handle);
 
+/**
+ * Flush queries that waited for a client TLS handshake on an outgoing
+ * connection, and publish it for multiplexing; called by the TLS layer
+ * when the handshake completes.
+ * @return 0 or an error code
+ */
+int worker_tls_connected(struct worker_ctx *worker, uv_handle_t *handle);
+
 /**
  * Schedule query for resolution.
  * @return 0 or an error code
@@ -59,17 +123,119 @@ int worker_end_tcp(struct worker_ctx *worker, uv_handle_t *handle);
 int worker_resolve(struct worker_ctx *worker, knot_pkt_t *query, unsigned options,
 		worker_cb_t on_complete, void *baton);
 
+/**
+ * Resume a request parked by kr_resolve_await().
+ * Must be called on the loop thread, once the awaited operation finished.
+ * @return 0, ENOENT if the request isn't parked
+ */
+int worker_resume(struct worker_ctx *worker, struct kr_request *req);
+
 /** Collect worker mempools */
 void worker_reclaim(struct worker_ctx *worker);
 
+/** Make sure the periodic freelist trimming is scheduled. */
+void worker_trim_arm(struct worker_ctx *worker);
+
+/** Borrow a fixed-size I/O object (handle/request union) from the worker
+  * freelist.  The freelist refills in bulk, so hot-path borrows don't pay
+  * a malloc each. */
+void *worker_ioreq_borrow(struct worker_ctx *worker);
+
+/** Return a borrowed I/O object to the worker freelist. */
+void worker_ioreq_release(struct worker_ctx *worker, void *req);
+
+struct mempool;
+
+/** Borrow a mempool from the worker freelist (shared with request pools). */
+struct mempool *worker_mp_borrow(struct worker_ctx *worker);
+
+/** Return a borrowed mempool, flushed, to the worker freelist. */
+void worker_mp_release(struct worker_ctx *worker, struct mempool *mp);
+
 
 /** @cond internal */
 
 /** Number of request within timeout window. */
 #define MAX_PENDING KR_NSREP_MAXADDR
 
-/** Freelist of available mempools. */
-typedef array_t(void *) mp_freelist_t;
+/** Timer wheel geometry, deadlines up to TIMER_WHEEL_TICK * TIMER_WHEEL_SLOTS ms
+  * fit in one revolution and fire with at most one tick of slack. */
+#define TIMER_WHEEL_TICK 16
+#define TIMER_WHEEL_SLOTS 256
+
+/** Upstreams whose timeout penalty can be coalesced within one wheel tick. */
+#define TIMEOUT_COALESCE_MAX 16
+
+/** Response rate limiting geometry, must be a power of two. */
+#define RRL_BUCKETS 4096
+#define RRL_V4_PREFIX 24
+#define RRL_V6_PREFIX 56
+
+/** Event-loop lag probe period for admission control (ms). */
+#define LOADCHECK_INTERVAL 500
+
+/** Load-shedding policies for admission control, see net.overload(). */
+enum worker_shed_policy {
+	SHED_NONE = 0,  /**< Admission control disabled. */
+	SHED_DROP,      /**< Shed over-watermark queries silently. */
+	SHED_TC,        /**< Answer with TC=1, clients retry over TCP elsewhere. */
+	SHED_SERVFAIL,  /**< Answer SERVFAIL immediately. */
+};
+
+/** Token bucket for one source prefix (colliding prefixes take it over). */
+struct rrl_bucket {
+	uint32_t key;     /**< Prefix hash, detects bucket takeover. */
+	uint32_t epoch;   /**< Second of the last refill. */
+	uint32_t tokens;  /**< Remaining tokens in this epoch. */
+	uint32_t slipped; /**< Limited answers since the last SLIP. */
+};
+
+/** Task deadline callback. */
+typedef void (*task_timer_cb)(struct qr_task *);
+
+/** Freelist of reusable objects. The leading members mirror array_t(void *)
+  * so the array macros apply unchanged; the rest tracks occupancy so cold
+  * tails can be trimmed instead of pinning spike-time RSS forever. */
+typedef struct {
+	void **at;
+	size_t len;
+	size_t cap;
+	size_t low;     /**< Smallest length since the last trim (the cold tail). */
+	size_t trimmed; /**< Total objects freed by trimming. */
+	size_t refills; /**< Bulk refills performed (list found empty on borrow). */
+} mp_freelist_t;
+
+/** Note freelist occupancy after a pop; whatever never dips below
+  * the recorded minimum was not needed during the whole interval. */
+static inline void mp_freelist_mark(mp_freelist_t *list)
+{
+	if (list->len < list->low) {
+		list->low = list->len;
+	}
+}
+
+/** One slow-query record, see worker.slowlog(). */
+struct slow_query {
+	uint8_t qname[KNOT_DNAME_MAXLEN];
+	uint16_t qtype;
+	uint32_t elapsed_us;
+	uint32_t pool_bytes;         /**< Request pool size when the answer finished. */
+	uint16_t round_trips;        /**< Subqueries resolved upstream for this request. */
+	struct sockaddr_in6 last_ns; /**< Final upstream address (AF_UNSPEC when cached). */
+	uint8_t trace_len;           /**< Recorded timing trace events. */
+	struct kr_trace_event trace[KR_TRACE_LEN]; /**< Timing trace copy, see kr_resolve_trace(). */
+};
+
+#ifndef WATCHDOG_SLOTS
+#define WATCHDOG_SLOTS 8 /**< Distinct stall sources tracked, see worker.stalls(). */
+#endif
+
+/** One stall attribution counter, see worker.stalls(). */
+struct stall_source {
+	char name[32]; /**< 'module.hook' of the dominant layer, or '(loop)'. */
+	size_t count;  /**< Stalled loop turns attributed here. */
+	uint64_t ns;   /**< Busy time of those turns. */
+};
 
 /** \details Worker state is meant to persist during the whole life of daemon. */
 struct worker_ctx {
@@ -78,6 +244,26 @@ struct worker_ctx {
 	int id;
 	int count;
 	unsigned tcp_pipeline_max;
+	unsigned udp_race; /**< Delay (ms) before probing the second-best address, 0 disables racing. */
+	unsigned rrl_rate; /**< RRL: queries per second per source prefix, 0 disables limiting. */
+	unsigned rrl_slip; /**< RRL: every Nth limited answer is truncated instead of dropped. */
+	struct rrl_bucket *rrl; /**< Token bucket table, allocated on first use. */
+	struct {
+		unsigned policy;    /**< Shed policy, see enum worker_shed_policy. */
+		unsigned max_tasks; /**< Admission watermark on live tasks, 0 disables. */
+		unsigned max_lag;   /**< Admission watermark on loop lag (ms), 0 disables. */
+		unsigned lag;       /**< Last measured event-loop lag (ms). */
+		uint64_t lag_next;  /**< Expected loop time of the next lag probe. */
+		uv_timer_t lag_timer; /**< Lag probe, runs only while shedding is enabled. */
+		bool lag_timer_init;
+		size_t shed;        /**< Queries shed by admission control. */
+	} load;
+	struct {
+		size_t budget;     /**< Live request-pool bytes that trip admission control, 0 disables. */
+		size_t live;       /**< Bytes held by request pools currently on loan. */
+		size_t high_water; /**< Largest live value seen since start. */
+		size_t spilled;    /**< Bytes requests grew past their borrow-time pool size, cumulative. */
+	} mem;
 #if __linux__
 	uint8_t wire_buf[RECVMMSG_BATCH * KNOT_WIRE_MAX_PKTSIZE];
 #else
@@ -92,14 +278,83 @@ struct worker_ctx {
 		size_t queries;
 		size_t dropped;
 		size_t timeout;
+		size_t grafted; /**< Duplicate client queries answered by copying the leader's answer. */
 	} stats;
 	map_t outgoing;
+	map_t dedup; /**< Leading tasks for identical in-flight client queries. */
+	unsigned tcp_clients; /**< Number of accepted client connections. */
+	struct session *tcp_idle_head; /**< Client sessions, most recently active first. */
+	struct session *tcp_idle_tail;
+	struct session *tcp_drain_head; /**< Sessions with buffered queries awaiting a drain round. */
+	struct session *tcp_drain_tail;
+	uv_timer_t tcp_drain_timer; /**< Zero-delay round driver, armed only while the queue is non-empty. */
+	bool tcp_drain_timer_init;
+	map_t tcp_pool; /**< Warm outgoing TCP connections, keyed by peer address. */
+	unsigned tcp_pool_len;
+	map_t tcp_busy; /**< Connected outgoing TCP sessions open for multiplexing. */
+	unsigned tcp_busy_len;
+	uv_handle_t *udp_pool[UDP_POOL_MAXLEN]; /**< Bound outgoing UDP handles kept for reuse. */
+	size_t udp_pool_len;
+	uv_timer_t tcp_pool_timer; /**< Periodic idle eviction for the warm pool. */
+	bool tcp_pool_timer_init;
+	struct qr_task *wheel[TIMER_WHEEL_SLOTS]; /**< Hashed timer wheel with task deadlines. */
+	unsigned wheel_len;     /**< Number of armed deadlines. */
+	uint64_t wheel_time;    /**< Last processed wheel tick. */
+	uv_timer_t wheel_timer; /**< Wheel driver, runs only while deadlines are armed. */
+	bool wheel_timer_init;
+	struct sockaddr_in6 penalized[TIMEOUT_COALESCE_MAX]; /**< Upstreams already penalized this tick. */
+	unsigned penalized_len;
+	uint64_t penalized_tick; /**< Wheel tick the recorded penalties belong to. */
 	mp_freelist_t pool_mp;
 	mp_freelist_t pool_ioreq;
 	mp_freelist_t pool_sessions;
+	mp_freelist_t pool_rbufs; /**< Stream read buffers for in-place framing. */
+	mp_freelist_t pool_wirebufs; /**< Answer wire buffers, assembled and sent in place. */
+	mp_freelist_t pool_wirebufs_sm; /**< Small slots for payload-bounded UDP answers. */
+	uv_timer_t trim_timer; /**< Periodic trimming of cold freelist tails. */
+	bool trim_timer_init;
+	struct {
+		struct slow_query q[SLOWLOG_COUNT]; /**< Fixed ring, oldest entries overwritten. */
+		size_t head;           /**< Next write position. */
+		size_t len;            /**< Occupied entries, up to SLOWLOG_COUNT. */
+		uint32_t threshold_us; /**< Record answers slower than this, 0 disables. */
+	} slowlog;
+	struct {
+		uint64_t budget_ns; /**< Busy budget per loop turn, 0 disables the watchdog. */
+		uint64_t poll_mark; /**< Entered the poll phase (hrtime). */
+		uint64_t poll_wait; /**< Expected poll wait at that point. */
+		uint64_t busy_mark; /**< Poll returned, callbacks running. */
+		uint64_t busy_ns;   /**< Busy time accumulated over the current turn. */
+		size_t stalls;      /**< Loop turns that blew the budget. */
+		uint64_t worst_ns;  /**< Busiest turn seen since arming. */
+		struct stall_source source[WATCHDOG_SLOTS]; /**< Stall counters by cause. */
+		uint64_t *layer_snap;  /**< Cumulative layer timings at the last turn. */
+		size_t layer_snap_len;
+		struct kr_layer_set *layer_gen; /**< Dispatch generation the snapshot indexes. */
+		uv_prepare_t prepare; /**< Turn boundary: account, judge, re-arm. */
+		uv_check_t check;     /**< Poll return: the busy segment starts. */
+		bool init;
+	} watchdog;
 	knot_mm_t pkt_pool;
 };
 
+/* @internal Union of various libuv objects, pooled on a freelist
+ * or embedded in the task for the common single-event case. */
+struct req
+{
+	union {
+		/* Socket handles, these have session as their `handle->data` and own it. */
+		uv_udp_t      udp;
+		uv_tcp_t      tcp;
+		/* I/O events, these have only a reference to the task they're operating on. */
+		uv_udp_send_t send;
+		uv_write_t    write;
+		uv_connect_t  connect;
+	} as;
+	uint16_t len_prefix; /**< TCP message length prefix, must outlive a queued write. */
+	uint32_t queued;     /**< Bytes accounted in session->write_queued by this write. */
+};
+
 /** Query resolution task. */
 struct qr_task
 {
@@ -107,18 +362,32 @@ struct qr_task
 	struct worker_ctx *worker;
 	struct session *session;
 	knot_pkt_t *pktbuf;
+	uint8_t *answer_buf; /**< Pooled wire slot backing req.answer, see wirebuf_borrow(). */
+	bool answer_buf_small; /**< The slot came from the small size class. */
 	array_t(struct qr_task *) waiting;
+	array_t(struct qr_task *) dedup_queue; /**< Duplicate client queries waiting for this task. */
+	char dedup_key[KR_RRKEY_LEN];
 	uv_handle_t *pending[MAX_PENDING];
+	struct req ioreq; /**< Embedded I/O event request, see task_req_borrow().
+	                   *   Socket handles stay on the freelist, they outlive the task. */
 	uint16_t pending_count;
 	uint16_t addrlist_count;
 	uint16_t addrlist_turn;
 	uint16_t timeouts;
 	uint16_t iter_count;
-	uint16_t bytes_remaining;
+	size_t pool_base; /**< Pool size when borrowed, growth past it is spill. */
+	size_t pool_seen; /**< Pool bytes charged to worker->mem.live so far. */
+	uint16_t retry_base;        /**< Base retransmit interval of the current round (ms). */
+	uint8_t retry_round;        /**< Backoff schedule position, see retry_backoff[]. */
+	uint64_t retry_deadline;    /**< Absolute budget for the round in loop time. */
 	struct sockaddr *addrlist;
-	uv_timer_t *timeout;
+	struct qr_task *timer_next; /**< Links in the timer wheel slot. */
+	struct qr_task *timer_prev;
+	uint64_t timer_deadline;    /**< Absolute deadline in loop time. */
+	task_timer_cb timer_cb;     /**< Armed deadline callback, NULL when idle. */
 	worker_cb_t on_complete;
 	void *baton;
+	uint64_t created_ns; /**< Creation time, feeds the query_finish tracepoint. */
 	struct {
 		union {
 			struct sockaddr_in ip4;
@@ -133,6 +402,8 @@ struct qr_task
 	uint32_t refs;
 	bool finished : 1;
 	bool leading  : 1;
+	bool dedup_leading : 1;
+	bool ioreq_busy : 1; /**< The embedded request is in flight. */
 };
 
 /** @endcond */
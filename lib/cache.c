@@ -15,6 +15,7 @@
  */
 
 #include <assert.h>
+#include <stdio.h>
 #include <time.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -26,7 +27,10 @@
 #include <libknot/rrtype/rrsig.h>
 
 #include "contrib/cleanup.h"
+#include "contrib/hash/hash.h"
+#include "contrib/wire.h"
 #include "lib/cache.h"
+#include "lib/probes.h"
 #include "lib/cdb_lmdb.h"
 #include "lib/defines.h"
 #include "lib/utils.h"
@@ -35,12 +39,33 @@
 #define KEY_VERSION "V\x02"
 /* Key size */
 #define KEY_HSIZE (sizeof(uint8_t) + sizeof(uint16_t))
-#define KEY_SIZE (KEY_HSIZE + KNOT_DNAME_MAXLEN)
+#define KEY_SCOPE_MAXLEN (sizeof(uint8_t) + 16) /* Optional ECS partition suffix */
+#define KEY_SIZE (KEY_HSIZE + KNOT_DNAME_MAXLEN + KEY_SCOPE_MAXLEN)
+/* Expiry index key size */
+#define KEY_EXP_HSIZE (sizeof(uint8_t) + sizeof(uint32_t))
+#define KEY_EXP_SIZE (KEY_EXP_HSIZE + KEY_SIZE)
+/* Expiry index entries processed per GC batch */
+#define GC_BATCH_MAX 64
+/* Admission control, see admit_entry() */
+#define ADMIT_THRESHOLD 80 /* Occupancy percent where admission control engages */
+#define ADMIT_REFRESH 512  /* Insertions between occupancy refreshes */
+#define ADMIT_TTL_GRACE 300 /* TTL at which rejection odds are halved */
+/* Negative-lookup filter geometry (1M bits, 3 probes) */
+#define FILTER_BYTES (1 << 17)
+#define FILTER_BITS (FILTER_BYTES * 8)
+#define FILTER_HASHES 3
+/* Warmup snapshot format, see kr_cache_snapshot() */
+#define SNAPSHOT_MAGIC "KRS\x01"
+#define SNAPSHOT_FILE "warmup.snapshot"
+#define SNAPSHOT_MAXCOUNT (1 << 16)
 
 /* Shorthand for operations on cache backend */
 #define cache_isvalid(cache) ((cache) && (cache)->api && (cache)->db)
 #define cache_op(cache, op, ...) (cache)->api->op((cache)->db, ## __VA_ARGS__)
 
+static void defer_drop(struct kr_cache *cache);
+static int cache_restore(struct kr_cache *cache, const char *path);
+
 /** @internal Removes all records from cache. */
 static inline int cache_purge(struct kr_cache *cache)
 {
@@ -92,22 +117,52 @@ int kr_cache_open(struct kr_cache *cache, const struct kr_cdb_api *api, struct k
 		return ret;
 	}
 	memset(&cache->stats, 0, sizeof(cache->stats));
+	cache->filter = NULL;
+	cache->scope_len = 0;
+	cache->anchors.count = 0;
+	memset(&cache->defer, 0, sizeof(cache->defer));
+	memset(&cache->admit, 0, sizeof(cache->admit));
 	/* Check cache ABI version */
 	(void) assert_right_version(cache);
+	/* Bulk-load the warmup snapshot if one was left for us.
+	 * It is consumed, so a stale snapshot can't be loaded twice. */
+	if (opts && opts->path && cache_op(cache, count) <= 1) {
+		auto_free char *snapshot = kr_strcatdup(2, opts->path, "/" SNAPSHOT_FILE);
+		if (snapshot) {
+			int loaded = cache_restore(cache, snapshot);
+			unlink(snapshot);
+			if (loaded > 0) {
+				kr_cache_sync(cache);
+				kr_log_info("[cache] warmed up, %d records from snapshot\n", loaded);
+			}
+		}
+	}
 	return 0;
 }
 
 void kr_cache_close(struct kr_cache *cache)
 {
 	if (cache_isvalid(cache)) {
+		if (cache->defer.count > 0) {
+			(void) kr_cache_commit(cache, 0);
+		}
+		defer_drop(cache);
 		cache_op(cache, close);
 		cache->db = NULL;
 	}
+	free(cache->filter);
+	cache->filter = NULL;
 }
 
 void kr_cache_sync(struct kr_cache *cache)
 {
-	if (cache_isvalid(cache) && cache->api->sync) {
+	if (!cache_isvalid(cache)) {
+		return;
+	}
+	if (cache->defer.count > 0) {
+		(void) kr_cache_commit(cache, 0);
+	}
+	if (cache->api->sync) {
 		cache_op(cache, sync);
 	}
 }
@@ -117,7 +172,8 @@ void kr_cache_sync(struct kr_cache *cache)
  * The name is lowercased and label order is reverted for easy prefix search.
  * e.g. '\x03nic\x02cz\x00' is saved as '\0x00cz\x00nic\x00'
  */
-static size_t cache_key(uint8_t *buf, uint8_t tag, const knot_dname_t *name, uint16_t rrtype)
+static inline size_t cache_key(const struct kr_cache *cache, uint8_t *buf, uint8_t tag,
+                               const knot_dname_t *name, uint16_t rrtype)
 {
 	/* Convert to lookup format */
 	int ret = knot_dname_lf(buf, name, NULL);
@@ -126,19 +182,137 @@ static size_t cache_key(uint8_t *buf, uint8_t tag, const knot_dname_t *name, uin
 	}
 	/* Write tag + type */
 	uint8_t name_len = buf[0];
+	/* Compress a configured zone anchor: drop the shared suffix and key by
+	 * anchor index, the lowercase tag twin marks the compressed namespace. */
+	if (!(tag & KR_CACHE_USER) && cache->anchors.count > 0) {
+		int best = -1;
+		for (unsigned i = 0; i < cache->anchors.count; ++i) {
+			const uint8_t alen = cache->anchors.len[i];
+			if (alen <= name_len &&
+			    (best < 0 || alen > cache->anchors.len[best]) &&
+			    memcmp(buf + 1, cache->anchors.lf[i], alen) == 0) {
+				best = i;
+			}
+		}
+		if (best >= 0) {
+			const uint8_t alen = cache->anchors.len[best];
+			memmove(buf + 2, buf + 1 + alen, name_len - alen);
+			buf[1] = best;
+			name_len = 1 + name_len - alen;
+			tag |= 0x20;
+		}
+	}
 	buf[0] = tag;
 	memcpy(buf + sizeof(uint8_t) + name_len, &rrtype, sizeof(uint16_t));
-	return name_len + KEY_HSIZE;
+	size_t len = name_len + KEY_HSIZE;
+	/* Suffix with the scope partition; the shared cache keys are unchanged. */
+	if (cache->scope_len > 0) {
+		buf[len] = cache->scope_len;
+		const size_t scope_bytes = (cache->scope_len + 7) / 8;
+		memcpy(buf + len + 1, cache->scope, scope_bytes);
+		len += 1 + scope_bytes;
+	}
+	return len;
+}
+
+/**
+ * @internal Expiry index key as { u8 tag, be32 deadline, primary key }
+ * The deadline is big-endian, so lexicographic key order equals deadline order.
+ */
+static size_t expiry_key(uint8_t *buf, uint32_t deadline, const uint8_t *key, size_t key_len)
+{
+	buf[0] = KR_CACHE_EXP;
+	wire_write_u32(buf + 1, deadline);
+	memcpy(buf + KEY_EXP_HSIZE, key, key_len);
+	return KEY_EXP_HSIZE + key_len;
+}
+
+/** @internal Compute filter probe positions with double hashing.
+ * The second hash skips the tag byte, so the probe pair stays independent. */
+static void filter_probes(const uint8_t *key, size_t len, uint32_t probe[FILTER_HASHES])
+{
+	uint32_t h1 = hash_keyed((const char *)key, len);
+	uint32_t h2 = hash_keyed((const char *)key + 1, len - 1) | 1;
+	for (int i = 0; i < FILTER_HASHES; ++i) {
+		probe[i] = (h1 + i * h2) % FILTER_BITS;
+	}
+}
+
+static void filter_add(struct kr_cache *cache, const uint8_t *key, size_t len)
+{
+	uint32_t probe[FILTER_HASHES];
+	filter_probes(key, len, probe);
+	for (int i = 0; i < FILTER_HASHES; ++i) {
+		cache->filter[probe[i] / 8] |= 1 << (probe[i] % 8);
+	}
+}
+
+static bool filter_mayhave(struct kr_cache *cache, const uint8_t *key, size_t len)
+{
+	uint32_t probe[FILTER_HASHES];
+	filter_probes(key, len, probe);
+	for (int i = 0; i < FILTER_HASHES; ++i) {
+		if ((cache->filter[probe[i] / 8] & (1 << (probe[i] % 8))) == 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+int kr_cache_filter(struct kr_cache *cache, bool enable)
+{
+	if (!cache_isvalid(cache)) {
+		return kr_error(EINVAL);
+	}
+	if (!enable) {
+		free(cache->filter);
+		cache->filter = NULL;
+		return kr_ok();
+	}
+	if (cache->filter) {
+		return kr_ok();
+	}
+	/* Only the version key may exist, pre-existing records
+	 * would turn into false misses. */
+	if (cache_op(cache, count) > 1) {
+		return kr_error(EEXIST);
+	}
+	cache->filter = calloc(FILTER_BYTES, 1);
+	if (!cache->filter) {
+		return kr_error(ENOMEM);
+	}
+	return kr_ok();
+}
+
+void kr_cache_scope_set(struct kr_cache *cache, const uint8_t *scope, uint8_t scope_len)
+{
+	if (!cache) {
+		return;
+	}
+	if (!scope || scope_len == 0) {
+		cache->scope_len = 0;
+		return;
+	}
+	if (scope_len > 128) {
+		scope_len = 128;
+	}
+	memcpy(cache->scope, scope, (scope_len + 7) / 8);
+	cache->scope_len = scope_len;
 }
 
-static struct kr_cache_entry *lookup(struct kr_cache *cache, uint8_t tag, const knot_dname_t *name, uint16_t type)
+static inline struct kr_cache_entry *lookup(struct kr_cache *cache, uint8_t tag, const knot_dname_t *name, uint16_t type)
 {
 	if (!name || !cache) {
 		return NULL;
 	}
 
 	uint8_t keybuf[KEY_SIZE];
-	size_t key_len = cache_key(keybuf, tag, name, type);
+	size_t key_len = cache_key(cache, keybuf, tag, name, type);
+
+	/* Definite misses are filtered without touching the store. */
+	if (cache->filter && key_len > 0 && !filter_mayhave(cache, keybuf, key_len)) {
+		return NULL;
+	}
 
 	/* Look up and return value */
 	knot_db_val_t key = { keybuf, key_len };
@@ -171,16 +345,22 @@ static int check_lifetime(struct kr_cache_entry *found, uint32_t *timestamp)
 	return kr_error(ESTALE);
 }
 
-int kr_cache_peek(struct kr_cache *cache, uint8_t tag, const knot_dname_t *name, uint16_t type,
-                  struct kr_cache_entry **entry, uint32_t *timestamp)
+/** @internal Shared peek body; inlined into the per-tag codecs below,
+ * where the constant tag folds the stats-bucket and key-layout branches. */
+static inline int peek_impl(struct kr_cache *cache, const uint8_t tag,
+                            const knot_dname_t *name, uint16_t type,
+                            struct kr_cache_entry **entry, uint32_t *timestamp)
 {
 	if (!cache_isvalid(cache) || !name || !entry) {
 		return kr_error(EINVAL);
 	}
 
+	unsigned tix = kr_cache_tag_index(tag);
 	struct kr_cache_entry *found = lookup(cache, tag, name, type);
 	if (!found) {
 		cache->stats.miss += 1;
+		cache->stats.tag[tix].miss += 1;
+		KR_PROBE2(cache_miss, name, type);
 		return kr_error(ENOENT);
 	}
 
@@ -189,8 +369,12 @@ int kr_cache_peek(struct kr_cache *cache, uint8_t tag, const knot_dname_t *name,
 	int ret = check_lifetime(found, timestamp);
 	if (ret == 0) {
 		cache->stats.hit += 1;
+		cache->stats.tag[tix].hit += 1;
+		KR_PROBE2(cache_hit, name, type);
 	} else {
 		cache->stats.miss += 1;
+		cache->stats.tag[tix].miss += 1;
+		KR_PROBE2(cache_miss, name, type);
 	}
 	return ret;
 }
@@ -202,16 +386,197 @@ static void entry_write(struct kr_cache_entry *dst, struct kr_cache_entry *heade
 		memcpy(dst->data, data.data, data.len);
 }
 
-int kr_cache_insert(struct kr_cache *cache, uint8_t tag, const knot_dname_t *name, uint16_t type,
-                    struct kr_cache_entry *header, knot_db_val_t data)
+/** @internal Write the expiry index entry for given record key. */
+static void write_expiry(struct kr_cache *cache, const uint8_t *key, size_t key_len,
+                         const struct kr_cache_entry *header)
+{
+	uint8_t expbuf[KEY_EXP_SIZE];
+	knot_db_val_t expkey = { expbuf, expiry_key(expbuf, header->timestamp + header->ttl, key, key_len) };
+	uint8_t dummy = 0;
+	knot_db_val_t expval = { &dummy, sizeof(dummy) };
+	(void) cache_op(cache, write, &expkey, &expval, 1);
+}
+
+/** @internal Write-behind insertion, allocated in one block. */
+struct defer_op
+{
+	uint16_t key_len;
+	uint32_t entry_len;
+	uint8_t data[]; /**< Key bytes followed by the serialized entry. */
+};
+
+static int defer_push(struct kr_cache *cache, const uint8_t *key, size_t key_len,
+                      struct kr_cache_entry *header, knot_db_val_t data)
+{
+	struct defer_op *op = malloc(sizeof(*op) + key_len + sizeof(*header) + data.len);
+	if (!op) {
+		return kr_error(ENOMEM);
+	}
+	op->key_len = key_len;
+	op->entry_len = sizeof(*header) + data.len;
+	memcpy(op->data, key, key_len);
+	entry_write((struct kr_cache_entry *)(op->data + key_len), header, data);
+	cache->defer.ops[cache->defer.count] = op;
+	cache->defer.count += 1;
+	return kr_ok();
+}
+
+static void defer_drop(struct kr_cache *cache)
+{
+	for (uint16_t i = 0; i < cache->defer.count; ++i) {
+		free(cache->defer.ops[i]);
+	}
+	cache->defer.count = 0;
+}
+
+int kr_cache_defer(struct kr_cache *cache, bool enable)
+{
+	if (!cache_isvalid(cache)) {
+		return kr_error(EINVAL);
+	}
+	if (!enable) {
+		defer_drop(cache);
+	}
+	cache->defer.enabled = enable;
+	return kr_ok();
+}
+
+int kr_cache_commit(struct kr_cache *cache, int maxops)
+{
+	if (!cache_isvalid(cache)) {
+		return kr_error(EINVAL);
+	}
+	int todo = cache->defer.count;
+	if (maxops > 0 && maxops < todo) {
+		todo = maxops;
+	}
+	int applied = 0;
+	int ret = 0;
+	/* Apply the whole batch with one vectored storage write; backends
+	 * turn it into a single transaction or pipelined command. */
+	if (todo > 1) {
+		knot_db_val_t keys[KR_CACHE_DEFER_MAXOPS];
+		knot_db_val_t vals[KR_CACHE_DEFER_MAXOPS];
+		for (int i = 0; i < todo; ++i) {
+			struct defer_op *op = cache->defer.ops[i];
+			keys[i].data = op->data;
+			keys[i].len = op->key_len;
+			vals[i].data = op->data + op->key_len;
+			vals[i].len = op->entry_len;
+		}
+		if (cache_op(cache, write, keys, vals, todo) == 0) {
+			for (int i = 0; i < todo; ++i) {
+				struct defer_op *op = cache->defer.ops[i];
+				struct kr_cache_entry header;
+				memcpy(&header, op->data + op->key_len, sizeof(header));
+				write_expiry(cache, op->data, op->key_len, &header);
+				free(op);
+			}
+			applied = todo;
+		}
+		/* On failure fall through to the one-by-one path, so a bad
+		 * entry doesn't wedge the whole queue. */
+	}
+	while (applied < todo) {
+		struct defer_op *op = cache->defer.ops[applied];
+		knot_db_val_t key = { op->data, op->key_len };
+		knot_db_val_t val = { op->data + op->key_len, op->entry_len };
+		ret = cache_op(cache, write, &key, &val, 1);
+		if (ret != 0) {
+			break; /* Keep the rest queued. */
+		}
+		/* The serialized header may be unaligned, copy it out. */
+		struct kr_cache_entry header;
+		memcpy(&header, op->data + op->key_len, sizeof(header));
+		write_expiry(cache, op->data, op->key_len, &header);
+		free(op);
+		applied += 1;
+	}
+	if (applied > 0) {
+		memmove(&cache->defer.ops[0], &cache->defer.ops[applied],
+			(cache->defer.count - applied) * sizeof(cache->defer.ops[0]));
+		cache->defer.count -= applied;
+	}
+	return applied > 0 ? applied : ret;
+}
+
+int kr_cache_anchor(struct kr_cache *cache, const knot_dname_t *zone)
+{
+	if (!cache_isvalid(cache) || !zone) {
+		return kr_error(EINVAL);
+	}
+	if (cache->anchors.count >= KR_CACHE_ANCHOR_MAX) {
+		return kr_error(ENOSPC);
+	}
+	uint8_t lf[KNOT_DNAME_MAXLEN];
+	if (knot_dname_lf(lf, zone, NULL) != 0 || lf[0] == 0) {
+		return kr_error(EINVAL);
+	}
+	const unsigned i = cache->anchors.count;
+	cache->anchors.len[i] = lf[0];
+	memcpy(cache->anchors.lf[i], lf + 1, lf[0]);
+	cache->anchors.count += 1;
+	return kr_ok();
+}
+
+/** @internal Storage occupancy in percent.
+ * The backend stats call opens a read transaction, so the value is cached
+ * and refreshed only once per ADMIT_REFRESH insertions. */
+static unsigned cache_usage(struct kr_cache *cache)
+{
+	if (!cache->api->stats) {
+		return 0;
+	}
+	if (cache->admit.tick == 0) {
+		struct kr_cdb_stats stats;
+		if (cache_op(cache, stats, &stats) == 0 && stats.capacity > 0) {
+			/* Allocated-but-unused pages count too, the backend
+			 * can't grow past them under a full map. */
+			cache->admit.usage = 100 * (stats.used + stats.fragmented) / stats.capacity;
+		}
+	}
+	cache->admit.tick = (cache->admit.tick + 1) % ADMIT_REFRESH;
+	return cache->admit.usage;
+}
+
+/** @internal Rank-aware admission control.
+ * Everything is admitted while there's headroom. Under space pressure
+ * low-rank records are probabilistically rejected, with the odds rising
+ * linearly as the store fills, so a burst of random-subdomain junk can't
+ * push out authoritative and validated records it will never match again.
+ * Long TTLs temper the rejection, as such records amortize their slot. */
+static bool admit_entry(struct kr_cache *cache, const struct kr_cache_entry *header)
+{
+	const unsigned usage = cache_usage(cache);
+	if (usage < ADMIT_THRESHOLD || header->rank >= KR_RANK_AUTH) {
+		return true;
+	}
+	unsigned reject = (usage - ADMIT_THRESHOLD) * 100 / (100 - ADMIT_THRESHOLD);
+	if (header->rank >= KR_RANK_NONAUTH) {
+		reject /= 2; /* Parent-side data still saves a delegation walk. */
+	}
+	if (header->ttl >= ADMIT_TTL_GRACE) {
+		reject /= 2;
+	}
+	return kr_rand_uint(100) >= reject;
+}
+
+/** @internal Shared insert body, see peek_impl() on the specialization. */
+static inline int insert_impl(struct kr_cache *cache, const uint8_t tag,
+                              const knot_dname_t *name, uint16_t type,
+                              struct kr_cache_entry *header, knot_db_val_t data)
 {
 	if (!cache_isvalid(cache) || !name || !header) {
 		return kr_error(EINVAL);
 	}
+	if (!admit_entry(cache, header)) {
+		/* Not an error for the caller, the answer path goes on. */
+		return kr_ok();
+	}
 
 	/* Prepare key/value for insertion. */
 	uint8_t keybuf[KEY_SIZE];
-	size_t key_len = cache_key(keybuf, tag, name, type);
+	size_t key_len = cache_key(cache, keybuf, tag, name, type);
 	if (key_len == 0) {
 		return kr_error(EILSEQ);
 	}
@@ -219,16 +584,29 @@ int kr_cache_insert(struct kr_cache *cache, uint8_t tag, const knot_dname_t *nam
 	knot_db_val_t key = { keybuf, key_len };
 	knot_db_val_t entry = { NULL, sizeof(*header) + data.len };
 
-	/* LMDB can do late write and avoid copy */
 	int ret = 0;
 	cache->stats.insert += 1;
+	cache->stats.tag[kr_cache_tag_index(tag)].insert += 1;
+
+	/* Queue a write-behind insertion when enabled and there's room,
+	 * so storage latency doesn't add to the response time. */
+	if (cache->defer.enabled && cache->defer.count < KR_CACHE_DEFER_MAXOPS &&
+	    defer_push(cache, keybuf, key_len, header, data) == 0) {
+		if (cache->filter) {
+			filter_add(cache, keybuf, key_len);
+		}
+		return kr_ok();
+	}
+
+	/* LMDB can do late write and avoid copy */
 	if (cache->api == kr_cdb_lmdb()) {
 		ret = cache_op(cache, write, &key, &entry, 1);
 		if (ret != 0) {
 			return ret;
 		}
 		entry_write(entry.data, header, data);
-		ret = cache_op(cache, sync); /* Make sure the entry is comitted. */
+		/* Inserts are coalesced by the backend and committed in
+		 * batches, kr_cache_sync() forces a flush. */
 	} else {
 		/* Other backends must prepare contiguous data first */
 		auto_free char *buffer = malloc(entry.len);
@@ -237,9 +615,66 @@ int kr_cache_insert(struct kr_cache *cache, uint8_t tag, const knot_dname_t *nam
 		ret = cache_op(cache, write, &key, &entry, 1);
 	}
 
+	if (ret == 0 && cache->filter) {
+		filter_add(cache, keybuf, key_len);
+	}
+
+	/* Maintain the TTL-ordered expiry index for incremental GC.
+	 * Stale index entries (e.g. after a record refresh) are dropped
+	 * by the GC, so they needn't be tracked here. */
+	if (ret == 0) {
+		write_expiry(cache, keybuf, key_len, header);
+	}
+
 	return ret;
 }
 
+/** @internal Compile-time tag specializations of the hot codec paths.
+ * Instantiated the way the lib/generic containers are: within each
+ * instance the tag is a literal, so kr_cache_tag_index() and the
+ * anchor-compression branch in cache_key() constant-fold and every
+ * cache layer gets a straight-line encode/decode path. */
+#define CACHE_CODEC_DEFINE(codec, TAG) \
+static int peek_ ## codec(struct kr_cache *cache, const knot_dname_t *name, uint16_t type, \
+                          struct kr_cache_entry **entry, uint32_t *timestamp) \
+{ \
+	return peek_impl(cache, TAG, name, type, entry, timestamp); \
+} \
+static int insert_ ## codec(struct kr_cache *cache, const knot_dname_t *name, uint16_t type, \
+                            struct kr_cache_entry *header, knot_db_val_t data) \
+{ \
+	return insert_impl(cache, TAG, name, type, header, data); \
+}
+
+CACHE_CODEC_DEFINE(rr, KR_CACHE_RR)
+CACHE_CODEC_DEFINE(pkt, KR_CACHE_PKT)
+CACHE_CODEC_DEFINE(sig, KR_CACHE_SIG)
+#undef CACHE_CODEC_DEFINE
+
+int kr_cache_peek(struct kr_cache *cache, uint8_t tag, const knot_dname_t *name, uint16_t type,
+                  struct kr_cache_entry **entry, uint32_t *timestamp)
+{
+	/* The layers pass literal tags, so this single hoisted dispatch
+	 * predicts perfectly and replaces per-operation tag branching. */
+	switch (tag) {
+	case KR_CACHE_RR:  return peek_rr(cache, name, type, entry, timestamp);
+	case KR_CACHE_PKT: return peek_pkt(cache, name, type, entry, timestamp);
+	case KR_CACHE_SIG: return peek_sig(cache, name, type, entry, timestamp);
+	default:           return peek_impl(cache, tag, name, type, entry, timestamp);
+	}
+}
+
+int kr_cache_insert(struct kr_cache *cache, uint8_t tag, const knot_dname_t *name, uint16_t type,
+                    struct kr_cache_entry *header, knot_db_val_t data)
+{
+	switch (tag) {
+	case KR_CACHE_RR:  return insert_rr(cache, name, type, header, data);
+	case KR_CACHE_PKT: return insert_pkt(cache, name, type, header, data);
+	case KR_CACHE_SIG: return insert_sig(cache, name, type, header, data);
+	default:           return insert_impl(cache, tag, name, type, header, data);
+	}
+}
+
 int kr_cache_remove(struct kr_cache *cache, uint8_t tag, const knot_dname_t *name, uint16_t type)
 {
 	if (!cache_isvalid(cache) || !name ) {
@@ -247,12 +682,15 @@ int kr_cache_remove(struct kr_cache *cache, uint8_t tag, const knot_dname_t *nam
 	}
 
 	uint8_t keybuf[KEY_SIZE];
-	size_t key_len = cache_key(keybuf, tag, name, type);
+	size_t key_len = cache_key(cache, keybuf, tag, name, type);
 	if (key_len == 0) {
 		return kr_error(EILSEQ);
 	}
 	knot_db_val_t key = { keybuf, key_len };
 	cache->stats.delete += 1;
+	cache->stats.tag[kr_cache_tag_index(tag)].delete += 1;
+	/* The filter keeps the key bits set, removed entries
+	 * merely cost a backend lookup again. */
 	return cache_op(cache, remove, &key, 1);
 }
 
@@ -261,10 +699,343 @@ int kr_cache_clear(struct kr_cache *cache)
 	if (!cache_isvalid(cache)) {
 		return kr_error(EINVAL);
 	}
+	defer_drop(cache); /* Queued insertions would be purged anyway. */
 	int ret = cache_purge(cache);
 	if (ret == 0) {
 		ret = assert_right_version(cache);
 	}
+	/* The store is empty again, so the filter can start over. */
+	if (cache->filter) {
+		memset(cache->filter, 0, FILTER_BYTES);
+	}
+	return ret;
+}
+
+int kr_cache_gc(struct kr_cache *cache, int batch)
+{
+	if (!cache_isvalid(cache)) {
+		return kr_error(EINVAL);
+	}
+	if (!cache->api->match) {
+		return kr_error(ENOSYS);
+	}
+	if (batch <= 0 || batch > GC_BATCH_MAX) {
+		batch = GC_BATCH_MAX;
+	}
+
+	/* Under space pressure the sweep turns rank-weighted: records
+	 * nearest their deadline are inspected early and evicted before
+	 * expiry unless authoritative or validated, so junk makes room
+	 * for records worth keeping. */
+	bool pressure = false;
+	if (cache->api->stats) {
+		struct kr_cdb_stats st;
+		if (cache_op(cache, stats, &st) == 0 && st.capacity > 0) {
+			pressure = 100 * (st.used + st.fragmented) / st.capacity >= ADMIT_THRESHOLD;
+		}
+	}
+
+	/* Scan the expiry index from the oldest deadline.
+	 * The keys are copied out, as any subsequent write operation
+	 * invalidates values returned by the match. */
+	uint8_t tag = KR_CACHE_EXP;
+	knot_db_val_t prefix = { &tag, sizeof(tag) };
+	knot_db_val_t found[GC_BATCH_MAX];
+	int count = cache_op(cache, match, &prefix, found, batch);
+	if (count <= 0) {
+		return count == kr_error(ENOENT) ? 0 : count;
+	}
+	auto_free uint8_t *keys = malloc(count * KEY_EXP_SIZE);
+	if (!keys) {
+		return kr_error(ENOMEM);
+	}
+	uint32_t now = time(NULL);
+	int scanned = 0;
+	for (int i = 0; i < count; ++i) {
+		if (found[i].len < KEY_EXP_HSIZE || found[i].len > KEY_EXP_SIZE) {
+			continue; /* Malformed index entry, shouldn't happen. */
+		}
+		const uint8_t *data = found[i].data;
+		if (wire_read_u32(data + 1) > now && !pressure) {
+			/* Still alive. The index is deadline-ordered only within
+			 * a storage shard, so the scan mustn't stop here. */
+			continue;
+		}
+		memcpy(keys + scanned * KEY_EXP_SIZE, data, found[i].len);
+		found[scanned].len = found[i].len;
+		scanned += 1;
+	}
+
+	/* Gather keys to drop. A record may have been refreshed since its
+	 * index entry was written, in which case only the index entry goes.
+	 * Primary keys are deduplicated, as removing a missing key would
+	 * abort the whole batch. */
+	knot_db_val_t drop[2 * GC_BATCH_MAX];
+	int dropped = 0;
+	for (int i = 0; i < scanned; ++i) {
+		knot_db_val_t expkey = { keys + i * KEY_EXP_SIZE, found[i].len };
+		knot_db_val_t key = { (uint8_t *)expkey.data + KEY_EXP_HSIZE, expkey.len - KEY_EXP_HSIZE };
+		knot_db_val_t val = { NULL, 0 };
+		const uint32_t deadline = wire_read_u32((const uint8_t *)expkey.data + 1);
+		bool keep_index = false;
+		if (cache_op(cache, read, &key, &val, 1) == 0 && val.len >= sizeof(struct kr_cache_entry)) {
+			struct kr_cache_entry *entry = val.data;
+			const bool dead = now > entry->timestamp && now - entry->timestamp > entry->ttl;
+			if (dead || (pressure && entry->rank < KR_RANK_AUTH)) {
+				bool is_dup = false;
+				for (int k = 0; k < dropped; ++k) {
+					if (drop[k].len == key.len && memcmp(drop[k].data, key.data, key.len) == 0) {
+						is_dup = true;
+						break;
+					}
+				}
+				if (!is_dup) {
+					drop[dropped++] = key;
+				}
+			} else if (deadline > now) {
+				/* Surviving a pressure sweep; the index entry
+				 * still points to a live record, keep it. */
+				keep_index = true;
+			}
+		}
+		if (!keep_index) {
+			drop[dropped++] = expkey;
+		}
+	}
+	if (dropped > 0) {
+		int ret = cache_op(cache, remove, drop, dropped);
+		if (ret != 0) {
+			return ret;
+		}
+		cache->stats.delete += 1;
+	}
+	return dropped;
+}
+
+/** @internal Stream live records in the snapshot format, skipping entries
+ * below the rank floor or with less remaining lifetime than @a min_ttl. */
+static int cache_dump(struct kr_cache *cache, FILE *fp, uint8_t min_rank, uint32_t min_ttl)
+{
+	int maxcount = cache_op(cache, count);
+	if (maxcount <= 0) {
+		return maxcount;
+	}
+	if (maxcount > SNAPSHOT_MAXCOUNT) {
+		maxcount = SNAPSHOT_MAXCOUNT;
+	}
+	knot_db_val_t *found = malloc(maxcount * sizeof(*found));
+	auto_free uint8_t *keys = malloc((size_t)maxcount * KEY_SIZE);
+	if (!found || !keys) {
+		free(found);
+		return kr_error(ENOMEM);
+	}
+
+	int ret = fwrite(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC) - 1, 1, fp) == 1 ? 0 : kr_error(EIO);
+	int written = 0;
+	uint32_t now = time(NULL);
+	const uint8_t tags[] = { KR_CACHE_RR, KR_CACHE_SIG, KR_CACHE_PKT };
+	for (unsigned t = 0; ret == 0 && t < sizeof(tags); ++t) {
+		knot_db_val_t prefix = { (void *)&tags[t], sizeof(uint8_t) };
+		int count = cache_op(cache, match, &prefix, found, maxcount);
+		if (count == kr_error(ENOENT)) {
+			continue; /* Nothing in this namespace. */
+		}
+		if (count < 0) {
+			ret = count;
+			break;
+		}
+		/* The keys are copied out, as the reads below invalidate
+		 * values returned by the match. */
+		int scanned = 0;
+		for (int i = 0; i < count; ++i) {
+			if (found[i].len == 0 || found[i].len > KEY_SIZE) {
+				continue;
+			}
+			memcpy(keys + scanned * KEY_SIZE, found[i].data, found[i].len);
+			found[scanned].len = found[i].len;
+			scanned += 1;
+		}
+		for (int i = 0; ret == 0 && i < scanned; ++i) {
+			knot_db_val_t key = { keys + i * KEY_SIZE, found[i].len };
+			knot_db_val_t val = { NULL, 0 };
+			if (cache_op(cache, read, &key, &val, 1) != 0 ||
+			    val.len < sizeof(struct kr_cache_entry)) {
+				continue;
+			}
+			struct kr_cache_entry header;
+			memcpy(&header, val.data, sizeof(header));
+			if (now > header.timestamp && now - header.timestamp > header.ttl) {
+				continue; /* Dead records aren't worth carrying over. */
+			}
+			if (header.rank < min_rank ||
+			    header.timestamp + header.ttl < now + min_ttl) {
+				continue; /* Below the requested floor. */
+			}
+			uint16_t key_len = key.len;
+			uint32_t entry_len = val.len;
+			if (fwrite(&key_len, sizeof(key_len), 1, fp) != 1 ||
+			    fwrite(&entry_len, sizeof(entry_len), 1, fp) != 1 ||
+			    fwrite(key.data, key.len, 1, fp) != 1 ||
+			    fwrite(val.data, val.len, 1, fp) != 1) {
+				ret = kr_error(EIO);
+			} else {
+				written += 1;
+			}
+		}
+	}
+	free(found);
+	if (fflush(fp) != 0 && ret == 0) {
+		ret = kr_error(errno);
+	}
+	return ret == 0 ? written : ret;
+}
+
+int kr_cache_snapshot(struct kr_cache *cache, const char *path)
+{
+	if (!cache_isvalid(cache) || !path) {
+		return kr_error(EINVAL);
+	}
+	if (!cache->api->match) {
+		return kr_error(ENOSYS);
+	}
+	if (cache->defer.count > 0) {
+		(void) kr_cache_commit(cache, 0);
+	}
+
+	FILE *fp = fopen(path, "w");
+	if (!fp) {
+		return kr_error(errno);
+	}
+	int ret = cache_dump(cache, fp, 0, 0);
+	if (fclose(fp) != 0 && ret >= 0) {
+		ret = kr_error(errno);
+	}
+	if (ret < 0) {
+		unlink(path);
+	}
+	return ret;
+}
+
+/** @internal Bulk-load a record stream written by cache_dump().
+ * Records arrive in the dumped (sorted) key order, which keeps the load
+ * append-friendly for the LMDB backend.  Insertions go through the
+ * write-behind queue, so the storage sees large vectored batches instead
+ * of one transaction per record. */
+static int cache_load(struct kr_cache *cache, FILE *fp)
+{
+	char magic[sizeof(SNAPSHOT_MAGIC) - 1];
+	if (fread(magic, sizeof(magic), 1, fp) != 1 ||
+	    memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) != 0) {
+		return kr_error(EILSEQ);
+	}
+
+	uint32_t now = time(NULL);
+	int loaded = 0;
+	for (;;) {
+		uint16_t key_len = 0;
+		uint32_t entry_len = 0;
+		if (fread(&key_len, sizeof(key_len), 1, fp) != 1 ||
+		    fread(&entry_len, sizeof(entry_len), 1, fp) != 1) {
+			break; /* Clean end of the snapshot. */
+		}
+		if (key_len == 0 || key_len > KEY_SIZE || entry_len < sizeof(struct kr_cache_entry)) {
+			break; /* Corrupted record, keep what's loaded so far. */
+		}
+		uint8_t keybuf[KEY_SIZE];
+		auto_free char *buffer = malloc(entry_len);
+		if (!buffer) {
+			break;
+		}
+		if (fread(keybuf, key_len, 1, fp) != 1 || fread(buffer, entry_len, 1, fp) != 1) {
+			break;
+		}
+		/* Records may have died between the dump and now. */
+		struct kr_cache_entry header;
+		memcpy(&header, buffer, sizeof(header));
+		if (now > header.timestamp && now - header.timestamp > header.ttl) {
+			continue;
+		}
+		if (cache->defer.count >= KR_CACHE_DEFER_MAXOPS &&
+		    kr_cache_commit(cache, 0) <= 0) {
+			break; /* Storage rejects the batch, don't spin. */
+		}
+		knot_db_val_t data = { (uint8_t *)buffer + sizeof(header),
+				       entry_len - sizeof(header) };
+		if (defer_push(cache, keybuf, key_len, &header, data) == 0) {
+			/* Mirror the key into the negative-lookup filter like any
+			 * other insertion, or lookups would never see the record. */
+			if (cache->filter) {
+				filter_add(cache, keybuf, key_len);
+			}
+			loaded += 1;
+		}
+	}
+	if (cache->defer.count > 0) {
+		(void) kr_cache_commit(cache, 0);
+	}
+	return loaded;
+}
+
+static int cache_restore(struct kr_cache *cache, const char *path)
+{
+	FILE *fp = fopen(path, "r");
+	if (!fp) {
+		return kr_error(errno);
+	}
+	int ret = cache_load(cache, fp);
+	fclose(fp);
+	return ret;
+}
+
+int kr_cache_export(struct kr_cache *cache, int fd, uint8_t min_rank, uint32_t min_ttl)
+{
+	if (!cache_isvalid(cache) || fd < 0) {
+		return kr_error(EINVAL);
+	}
+	if (!cache->api->match) {
+		return kr_error(ENOSYS);
+	}
+	if (cache->defer.count > 0) {
+		(void) kr_cache_commit(cache, 0);
+	}
+
+	/* The descriptor is borrowed, stdio gets its own duplicate. */
+	int duped = dup(fd);
+	if (duped < 0) {
+		return kr_error(errno);
+	}
+	FILE *fp = fdopen(duped, "w");
+	if (!fp) {
+		close(duped);
+		return kr_error(errno);
+	}
+	int ret = cache_dump(cache, fp, min_rank, min_ttl);
+	if (fclose(fp) != 0 && ret >= 0) {
+		ret = kr_error(errno);
+	}
+	return ret;
+}
+
+int kr_cache_import(struct kr_cache *cache, int fd)
+{
+	if (!cache_isvalid(cache) || fd < 0) {
+		return kr_error(EINVAL);
+	}
+
+	int duped = dup(fd);
+	if (duped < 0) {
+		return kr_error(errno);
+	}
+	FILE *fp = fdopen(duped, "r");
+	if (!fp) {
+		close(duped);
+		return kr_error(errno);
+	}
+	int ret = cache_load(cache, fp);
+	fclose(fp);
+	if (ret > 0) {
+		kr_cache_sync(cache);
+	}
 	return ret;
 }
 
@@ -278,26 +1049,130 @@ int kr_cache_match(struct kr_cache *cache, uint8_t tag, const knot_dname_t *name
 	}
 
 	uint8_t keybuf[KEY_SIZE];
-	size_t key_len = cache_key(keybuf, tag, name, 0);
+	size_t key_len = cache_key(cache, keybuf, tag, name, 0);
 	if (key_len == 0) {
 		return kr_error(EILSEQ);
 	}
 
-	/* Trim type from the search key */ 
+	/* Trim type from the search key */
 	knot_db_val_t key = { keybuf, key_len - 2 };
 	return cache_op(cache, match, &key, val, maxcount);
 }
 
+/** @internal Collect subtree keys into a private copy, as any subsequent
+ * write/remove invalidates values returned by the prefix match. */
+static int subtree_keys(struct kr_cache *cache, uint8_t tag, const knot_dname_t *name,
+                        knot_db_val_t *found, uint8_t *keys, int maxcount)
+{
+	int count = kr_cache_match(cache, tag, name, found, maxcount);
+	if (count <= 0) {
+		return count == kr_error(ENOENT) ? 0 : count;
+	}
+	int copied = 0;
+	for (int i = 0; i < count; ++i) {
+		if (found[i].len == 0 || found[i].len > KEY_SIZE) {
+			continue;
+		}
+		memcpy(keys + copied * KEY_SIZE, found[i].data, found[i].len);
+		found[copied].data = keys + copied * KEY_SIZE;
+		found[copied].len = found[i].len;
+		copied += 1;
+	}
+	return copied;
+}
+
+int kr_cache_remove_subtree(struct kr_cache *cache, uint8_t tag, const knot_dname_t *name, int maxcount)
+{
+	if (!cache_isvalid(cache) || !name || maxcount <= 0) {
+		return kr_error(EINVAL);
+	}
+	if (!cache->api->remove) {
+		return kr_error(ENOSYS);
+	}
+
+	knot_db_val_t *found = malloc(maxcount * sizeof(*found));
+	auto_free uint8_t *keys = malloc((size_t)maxcount * KEY_SIZE);
+	if (!found || !keys) {
+		free(found);
+		return kr_error(ENOMEM);
+	}
+	int count = subtree_keys(cache, tag, name, found, keys, maxcount);
+	if (count > 0) {
+		int ret = cache_op(cache, remove, found, count);
+		if (ret != 0) {
+			count = ret;
+		} else {
+			cache->stats.delete += 1;
+		}
+	}
+	free(found);
+	/* Stale expiry index entries are collected by the GC. */
+	return count;
+}
+
+int kr_cache_ttl_subtree(struct kr_cache *cache, uint8_t tag, const knot_dname_t *name,
+                         uint32_t maxttl, int maxcount)
+{
+	if (!cache_isvalid(cache) || !name || maxcount <= 0) {
+		return kr_error(EINVAL);
+	}
+
+	knot_db_val_t *found = malloc(maxcount * sizeof(*found));
+	auto_free uint8_t *keys = malloc((size_t)maxcount * KEY_SIZE);
+	if (!found || !keys) {
+		free(found);
+		return kr_error(ENOMEM);
+	}
+	int count = subtree_keys(cache, tag, name, found, keys, maxcount);
+
+	uint32_t now = time(NULL);
+	int adjusted = 0;
+	int ret = count < 0 ? count : 0;
+	for (int i = 0; ret == 0 && i < count; ++i) {
+		knot_db_val_t val = { NULL, 0 };
+		if (cache_op(cache, read, &found[i], &val, 1) != 0 ||
+		    val.len < sizeof(struct kr_cache_entry)) {
+			continue;
+		}
+		struct kr_cache_entry header;
+		memcpy(&header, val.data, sizeof(header));
+		uint32_t deadline = header.timestamp + header.ttl;
+		if (deadline <= now || deadline - now <= maxttl) {
+			continue; /* Dies soon enough already. */
+		}
+		/* The value is backend-owned, rewrite a private copy. */
+		auto_free char *buffer = malloc(val.len);
+		if (!buffer) {
+			ret = kr_error(ENOMEM);
+			break;
+		}
+		memcpy(buffer, val.data, val.len);
+		header.ttl = now - header.timestamp + maxttl;
+		memcpy(buffer, &header, sizeof(header));
+		knot_db_val_t entry = { buffer, val.len };
+		ret = cache_op(cache, write, &found[i], &entry, 1);
+		if (ret == 0) {
+			/* Make the GC see the earlier deadline. */
+			write_expiry(cache, found[i].data, found[i].len, &header);
+			adjusted += 1;
+		}
+	}
+	free(found);
+	return ret == 0 ? adjusted : ret;
+}
+
 int kr_cache_peek_rr(struct kr_cache *cache, knot_rrset_t *rr, uint8_t *rank, uint8_t *flags, uint32_t *timestamp)
 {
 	if (!cache_isvalid(cache) || !rr || !timestamp) {
 		return kr_error(EINVAL);
 	}
 
-	/* Check if the RRSet is in the cache. */
+	/* Check if the RRSet is in the cache.
+	 * Expired entries are still described to the caller (with ESTALE),
+	 * so it may decide to serve them stale. */
 	struct kr_cache_entry *entry = NULL;
 	int ret = kr_cache_peek(cache, KR_CACHE_RR, rr->owner, rr->type, &entry, timestamp);
-	if (ret != 0) {
+	if (ret != 0 && (ret != kr_error(ESTALE) || !entry)) {
 		return ret;
 	}
 	if (rank) {
@@ -308,7 +1183,7 @@ int kr_cache_peek_rr(struct kr_cache *cache, knot_rrset_t *rr, uint8_t *rank, ui
 	}
 	rr->rrs.rr_count = entry->count;
 	rr->rrs.data = entry->data;
-	return kr_ok();
+	return ret;
 }
 
 int kr_cache_peek_rank(struct kr_cache *cache, uint8_t tag, const knot_dname_t *name, uint16_t type, uint32_t timestamp)
@@ -326,6 +1201,29 @@ int kr_cache_peek_rank(struct kr_cache *cache, uint8_t tag, const knot_dname_t *
 	return found->rank;
 }
 
+int kr_cache_materialize_ref(knot_rrset_t *dst, const knot_rrset_t *src, uint32_t drift)
+{
+	if (!dst || !src || dst == src) {
+		return kr_error(EINVAL);
+	}
+
+	/* All records must survive the drift, otherwise some
+	 * must be dropped and that requires a copy. */
+	knot_rdata_t *rd = src->rrs.data;
+	for (uint16_t i = 0; i < src->rrs.rr_count; ++i) {
+		if (knot_rdata_ttl(rd) < drift) {
+			return kr_error(ESTALE);
+		}
+		rd = kr_rdataset_next(rd);
+	}
+
+	/* Borrow the rdataset as-is, TTL decay is left to the caller. */
+	knot_rrset_init(dst, src->owner, src->type, src->rclass);
+	dst->rrs.rr_count = src->rrs.rr_count;
+	dst->rrs.data = src->rrs.data;
+	return kr_ok();
+}
+
 int kr_cache_materialize(knot_rrset_t *dst, const knot_rrset_t *src, uint32_t drift, knot_mm_t *mm)
 {
 	if (!dst || !src || dst == src) {
@@ -391,16 +1289,91 @@ int kr_cache_insert_rr(struct kr_cache *cache, const knot_rrset_t *rr, uint8_t r
 	return kr_cache_insert(cache, KR_CACHE_RR, rr->owner, rr->type, &header, data);
 }
 
+int kr_cache_insert_rr_sigs(struct kr_cache *cache, const knot_rrset_t *rr, const knot_rrset_t *sigs,
+                            uint8_t rank, uint8_t sig_rank, uint8_t flags, uint32_t timestamp)
+{
+	if (!cache_isvalid(cache) || !rr) {
+		return kr_error(EINVAL);
+	}
+
+	/* Without signatures this is a plain insertion. */
+	if (!sigs || knot_rrset_empty(sigs)) {
+		return kr_cache_insert_rr(cache, rr, rank, flags, timestamp);
+	}
+
+	/* Ignore empty records */
+	if (knot_rrset_empty(rr)) {
+		return kr_ok();
+	}
+
+	/* Prepare header to write */
+	struct kr_cache_entry header = {
+		.timestamp = timestamp,
+		.ttl = 0,
+		.rank = rank,
+		.flags = flags | KR_CACHE_FLAG_HAS_SIG,
+		.count = rr->rrs.rr_count
+	};
+	knot_rdata_t *rd = rr->rrs.data;
+	for (uint16_t i = 0; i < rr->rrs.rr_count; ++i) {
+		if (knot_rdata_ttl(rd) > header.ttl) {
+			header.ttl = knot_rdata_ttl(rd);
+		}
+		rd = kr_rdataset_next(rd);
+	}
+
+	/* Serialize record data followed by the signature section. */
+	const size_t rr_len = knot_rdataset_size(&rr->rrs);
+	const size_t sig_len = knot_rdataset_size(&sigs->rrs);
+	struct kr_cache_sig sig_header = {
+		.count = sigs->rrs.rr_count,
+		.rank = sig_rank,
+		.flags = KR_CACHE_FLAG_NONE
+	};
+	auto_free char *buffer = malloc(rr_len + sizeof(sig_header) + sig_len);
+	if (!buffer) {
+		return kr_error(ENOMEM);
+	}
+	memcpy(buffer, rr->rrs.data, rr_len);
+	memcpy(buffer + rr_len, &sig_header, sizeof(sig_header));
+	memcpy(buffer + rr_len + sizeof(sig_header), sigs->rrs.data, sig_len);
+
+	knot_db_val_t data = { buffer, rr_len + sizeof(sig_header) + sig_len };
+	return kr_cache_insert(cache, KR_CACHE_RR, rr->owner, rr->type, &header, data);
+}
+
+int kr_cache_sig_section(const knot_rrset_t *rr, uint8_t flags, knot_rrset_t *sigs, uint8_t *rank)
+{
+	if (!rr || !sigs) {
+		return kr_error(EINVAL);
+	}
+	if (!(flags & KR_CACHE_FLAG_HAS_SIG) || !rr->rrs.data) {
+		return kr_error(ENOENT);
+	}
+
+	/* The section follows the record data, unaligned. */
+	const uint8_t *base = (const uint8_t *)rr->rrs.data + knot_rdataset_size(&rr->rrs);
+	struct kr_cache_sig sig_header;
+	memcpy(&sig_header, base, sizeof(sig_header));
+	knot_rrset_init(sigs, rr->owner, KNOT_RRTYPE_RRSIG, rr->rclass);
+	sigs->rrs.rr_count = sig_header.count;
+	sigs->rrs.data = (knot_rdata_t *)(base + sizeof(sig_header));
+	if (rank) {
+		*rank = sig_header.rank;
+	}
+	return kr_ok();
+}
+
 int kr_cache_peek_rrsig(struct kr_cache *cache, knot_rrset_t *rr, uint8_t *rank, uint8_t *flags, uint32_t *timestamp)
 {
 	if (!cache_isvalid(cache) || !rr || !timestamp) {
 		return kr_error(EINVAL);
 	}
 
-	/* Check if the RRSet is in the cache. */
+	/* Check if the RRSet is in the cache, see kr_cache_peek_rr() about ESTALE. */
 	struct kr_cache_entry *entry = NULL;
 	int ret = kr_cache_peek(cache, KR_CACHE_SIG, rr->owner, rr->type, &entry, timestamp);
-	if (ret != 0) {
+	if (ret != 0 && (ret != kr_error(ESTALE) || !entry)) {
 		return ret;
 	}
 	assert(entry);
@@ -413,7 +1386,7 @@ int kr_cache_peek_rrsig(struct kr_cache *cache, knot_rrset_t *rr, uint8_t *rank,
 	rr->type = KNOT_RRTYPE_RRSIG;
 	rr->rrs.rr_count = entry->count;
 	rr->rrs.data = entry->data;
-	return kr_ok();
+	return ret;
 }
 
 int kr_cache_insert_rrsig(struct kr_cache *cache, const knot_rrset_t *rr, uint8_t rank, uint8_t flags, uint32_t timestamp)
@@ -446,3 +1419,138 @@ int kr_cache_insert_rrsig(struct kr_cache *cache, const knot_rrset_t *rr, uint8_
 	knot_db_val_t data = { rr->rrs.data, knot_rdataset_size(&rr->rrs) };
 	return kr_cache_insert(cache, KR_CACHE_SIG, rr->owner, covered, &header, data);
 }
+
+int kr_cache_insert_nsec(struct kr_cache *cache, const knot_dname_t *zone,
+                         const knot_dname_t *owner, uint32_t ttl, uint32_t timestamp)
+{
+	if (!cache_isvalid(cache) || !zone || !owner) {
+		return kr_error(EINVAL);
+	}
+	const int owner_len = knot_dname_size(owner);
+	if (owner_len <= 0) {
+		return kr_error(EILSEQ);
+	}
+
+	/* Rebuild the index from the current entry, oldest owners go first.
+	 * The entry is copied out as insertion may move the peeked memory. */
+	uint8_t buf[KR_CACHE_NSEC_MAXOWNERS * KNOT_DNAME_MAXLEN];
+	size_t buf_len = 0;
+	uint16_t count = 0;
+	struct kr_cache_entry *entry = NULL;
+	uint32_t drift = timestamp;
+	if (kr_cache_peek(cache, KR_CACHE_NSEC, zone, KNOT_RRTYPE_NSEC, &entry, &drift) == 0) {
+		const uint8_t *name = entry->data;
+		unsigned skip = (entry->count >= KR_CACHE_NSEC_MAXOWNERS)
+		              ? entry->count - KR_CACHE_NSEC_MAXOWNERS + 1 : 0;
+		for (uint16_t i = 0; i < entry->count; ++i) {
+			const int len = knot_dname_size(name);
+			if (len <= 0) {
+				return kr_error(EILSEQ);
+			}
+			if (knot_dname_is_equal(name, owner)) {
+				return kr_ok(); /* Already indexed. */
+			}
+			if (i >= skip) {
+				memcpy(buf + buf_len, name, len);
+				buf_len += len;
+				count += 1;
+			}
+			name += len;
+		}
+		/* Keep the longer remaining lifetime of the two. */
+		if (entry->ttl - drift > ttl) {
+			ttl = entry->ttl - drift;
+		}
+	}
+	memcpy(buf + buf_len, owner, owner_len);
+	buf_len += owner_len;
+	count += 1;
+
+	struct kr_cache_entry header = {
+		.timestamp = timestamp,
+		.ttl = ttl,
+		.rank = KR_RANK_AUTH,
+		.flags = KR_CACHE_FLAG_NONE,
+		.count = count
+	};
+	knot_db_val_t data = { buf, buf_len };
+	return kr_cache_insert(cache, KR_CACHE_NSEC, zone, KNOT_RRTYPE_NSEC, &header, data);
+}
+
+int kr_cache_peek_nsec(struct kr_cache *cache, const knot_dname_t *zone,
+                       const knot_dname_t *name, const knot_dname_t **owner,
+                       uint32_t timestamp)
+{
+	if (!cache_isvalid(cache) || !zone || !name || !owner) {
+		return kr_error(EINVAL);
+	}
+	struct kr_cache_entry *entry = NULL;
+	uint32_t drift = timestamp;
+	int ret = kr_cache_peek(cache, KR_CACHE_NSEC, zone, KNOT_RRTYPE_NSEC, &entry, &drift);
+	if (ret != 0) {
+		return ret;
+	}
+
+	/* Select the canonically closest preceding owner. */
+	const uint8_t *candidate = entry->data;
+	const knot_dname_t *best = NULL;
+	for (uint16_t i = 0; i < entry->count; ++i) {
+		const int len = knot_dname_size(candidate);
+		if (len <= 0) {
+			return kr_error(EILSEQ);
+		}
+		const int cmp = knot_dname_cmp(candidate, name);
+		if (cmp == 0) {
+			return kr_error(EEXIST); /* The name itself provably exists. */
+		}
+		if (cmp < 0 && (!best || knot_dname_cmp(candidate, best) > 0)) {
+			best = candidate;
+		}
+		candidate += len;
+	}
+	if (!best) {
+		return kr_error(ENOENT);
+	}
+	*owner = best;
+	return kr_ok();
+}
+
+int kr_cache_peek_lame(struct kr_cache *cache, const knot_dname_t *zone, uint32_t timestamp)
+{
+	if (!cache_isvalid(cache) || !zone) {
+		return kr_error(EINVAL);
+	}
+	struct kr_cache_entry *entry = NULL;
+	uint32_t drift = timestamp;
+	int ret = kr_cache_peek(cache, KR_CACHE_LAME, zone, 0, &entry, &drift);
+	if (ret != 0) {
+		return 0; /* No live entry, the cut is not known to fail. */
+	}
+	uint32_t fails = 0;
+	memcpy(&fails, entry->data, sizeof(fails));
+	return fails < INT32_MAX ? (int)fails : INT32_MAX;
+}
+
+int kr_cache_report_lame(struct kr_cache *cache, const knot_dname_t *zone, uint32_t timestamp)
+{
+	if (!cache_isvalid(cache) || !zone) {
+		return kr_error(EINVAL);
+	}
+	/* Accumulate over failures within the entry lifetime;
+	 * the counter expires as a whole, there is no decay. */
+	uint32_t fails = kr_cache_peek_lame(cache, zone, timestamp);
+	fails += 1;
+	struct kr_cache_entry header = {
+		.timestamp = timestamp,
+		.ttl = KR_CACHE_LAME_TTL,
+		.rank = KR_RANK_BAD,
+		.flags = KR_CACHE_FLAG_NONE,
+		.count = 1
+	};
+	knot_db_val_t data = { &fails, sizeof(fails) };
+	int ret = kr_cache_insert(cache, KR_CACHE_LAME, zone, 0, &header, data);
+	if (ret != 0) {
+		return ret;
+	}
+	return fails < INT32_MAX ? (int)fails : INT32_MAX;
+}
@@ -25,6 +25,9 @@ enum kr_cache_tag {
 	KR_CACHE_RR   = 'R',
 	KR_CACHE_PKT  = 'P',
 	KR_CACHE_SIG  = 'G',
+	KR_CACHE_NSEC = 'N', /**< Proven NSEC range index, keyed by zone name. */
+	KR_CACHE_EXP  = 'E', /**< TTL-ordered expiry index (internal). */
+	KR_CACHE_LAME = 'L', /**< Zone cut failure state, see kr_cache_report_lame(). */
 	KR_CACHE_USER = 0x80
 };
 
@@ -50,6 +53,9 @@ enum kr_cache_flag {
 	KR_CACHE_FLAG_WCARD_PROOF = 1, /* Entry contains either packet with wildcard
 	                                * answer either record for which wildcard
 	                                * expansion proof is needed */
+	KR_CACHE_FLAG_HAS_SIG     = 2, /* Entry carries the covering RRSIG set
+	                                * adjacent to the record data, see
+	                                * struct kr_cache_sig */
 };
 
 
@@ -66,6 +72,39 @@ struct kr_cache_entry
 	uint8_t  data[];
 };
 
+/**
+ * Covering RRSIG section appended after the record data when the entry
+ * has KR_CACHE_FLAG_HAS_SIG set. It shares the entry timestamp and TTL.
+ * @note The section is unaligned, read/write the header with memcpy.
+ */
+struct kr_cache_sig
+{
+	uint16_t count;
+	uint8_t  rank;
+	uint8_t  flags;
+	uint8_t  data[];
+};
+
+/** Maximum number of zone anchors for key compression, see kr_cache_anchor(). */
+#define KR_CACHE_ANCHOR_MAX 16
+
+/** Maximum number of queued insertions, see kr_cache_defer(). */
+#define KR_CACHE_DEFER_MAXOPS 128
+
+/** Number of per-tag statistics buckets. */
+#define KR_CACHE_TAGCOUNT 4
+
+/** Map entry tag to a statistics bucket, unlisted tags share the last one. */
+static inline unsigned kr_cache_tag_index(uint8_t tag)
+{
+	switch (tag) {
+	case KR_CACHE_RR:  return 0;
+	case KR_CACHE_PKT: return 1;
+	case KR_CACHE_SIG: return 2;
+	default:           return 3;
+	}
+}
+
 /**
  * Cache structure, keeps API, instance and metadata.
  */
@@ -73,11 +112,34 @@ struct kr_cache
 {
 	knot_db_t *db;		      /**< Storage instance */
 	const struct kr_cdb_api *api; /**< Storage engine */
+	uint8_t *filter;	      /**< Negative-lookup filter bitmap (NULL when disabled) */
+	struct {
+		bool enabled;         /**< Insertions are queued instead of applied immediately */
+		uint16_t count;       /**< Number of queued insertions */
+		void *ops[KR_CACHE_DEFER_MAXOPS]; /**< Serialized insertions (internal layout) */
+	} defer;
+	uint8_t scope[16];	      /**< Optional key partition (ECS client prefix) */
+	uint8_t scope_len;	      /**< Partition prefix length in bits, 0 = shared cache */
+	struct {
+		uint8_t lf[KR_CACHE_ANCHOR_MAX][255]; /**< Anchor names in lookup format. */
+		uint8_t len[KR_CACHE_ANCHOR_MAX];
+		unsigned count;
+	} anchors;		      /**< Zone anchors for key compression, see kr_cache_anchor() */
+	struct {
+		unsigned usage;       /**< Cached storage occupancy in percent */
+		unsigned tick;        /**< Insertions since the last occupancy refresh */
+	} admit;		      /**< Rank-aware admission control state */
 	struct {
 		uint32_t hit;         /**< Number of cache hits */
 		uint32_t miss;        /**< Number of cache misses */
 		uint32_t insert;      /**< Number of insertions */
 		uint32_t delete;      /**< Number of deletions */
+		struct {
+			uint32_t hit;
+			uint32_t miss;
+			uint32_t insert;
+			uint32_t delete;
+		} tag[KR_CACHE_TAGCOUNT]; /**< Breakdown by entry tag, see kr_cache_tag_index() */
 	} stats;
 };
 
@@ -107,6 +169,76 @@ void kr_cache_close(struct kr_cache *cache);
 KR_EXPORT
 void kr_cache_sync(struct kr_cache *cache);
 
+/**
+ * Enable or disable write-behind insertions.
+ * When enabled, kr_cache_insert() copies the entry into a bounded
+ * in-memory queue instead of writing to the backing store, so storage
+ * latency doesn't add to response time. The queue is applied by
+ * kr_cache_commit(), typically from loop idle time; when it fills up,
+ * insertions fall back to being synchronous.
+ * @param cache cache structure
+ * @param enable true to enable, false to disable (drops the queue)
+ * @return 0 or an error code
+ */
+KR_EXPORT
+int kr_cache_defer(struct kr_cache *cache, bool enable);
+
+/**
+ * Apply queued write-behind insertions.
+ * @param cache cache structure
+ * @param maxops maximum number of insertions to apply (0 for all)
+ * @return number of applied insertions or an errcode
+ */
+KR_EXPORT
+int kr_cache_commit(struct kr_cache *cache, int maxops);
+
+/**
+ * Enable or disable the in-memory negative-lookup filter.
+ * When enabled, definite cache misses are answered from a small bloom
+ * filter over inserted keys without touching the backing store.
+ * It can only be enabled over an empty cache, as pre-existing records
+ * are not reflected in the filter, and it doesn't observe inserts made
+ * by other processes sharing the store.
+ * @param cache cache structure
+ * @param enable true to enable, false to disable
+ * @return 0 or an error code (EEXIST if the cache is not empty)
+ */
+KR_EXPORT
+int kr_cache_filter(struct kr_cache *cache, bool enable);
+
+/**
+ * Set the key partition for subsequent operations.
+ *
+ * With a non-zero scope, all keys are suffixed with the given prefix, so
+ * entries live in a per-subnet partition (used for EDNS client subnet).
+ * A zero scope restores the shared cache; callers must reset it after the
+ * partitioned operations, the scope is not tied to a request.
+ *
+ * @param cache cache structure
+ * @param scope prefix bytes (network order), NULL to clear
+ * @param scope_len prefix length in bits, 0 to clear
+ */
+KR_EXPORT
+void kr_cache_scope_set(struct kr_cache *cache, const uint8_t *scope, uint8_t scope_len);
+
+/**
+ * Register a zone anchor for cache key compression.
+ *
+ * Keys of names at or below the anchor drop the shared suffix and carry
+ * the anchor index instead, so deep trees (e.g. reverse DNS) stop repeating
+ * long suffixes in every entry.  Anchors must be configured identically on
+ * every restart and process sharing the database - changing them orphans
+ * the compressed entries, which is safe for a cache but wastes space until
+ * they expire.  Prefix scans above an anchor do not see its entries.
+ *
+ * @param cache cache structure
+ * @param zone  anchor zone name
+ * @return 0 or an error code
+ */
+KR_EXPORT
+int kr_cache_anchor(struct kr_cache *cache, const knot_dname_t *zone);
+
+
 /**
  * Return true if cache is open and enabled.
  */
@@ -165,6 +297,59 @@ int kr_cache_remove(struct kr_cache *cache, uint8_t tag, const knot_dname_t *nam
 KR_EXPORT
 int kr_cache_clear(struct kr_cache *cache);
 
+/**
+ * Incrementally collect expired records.
+ * Walks the TTL-ordered expiry index from the oldest deadline and removes
+ * dead records in one small batch, so it can run from a timer without
+ * blocking the event loop.  When the store runs out of headroom the sweep
+ * also evicts soon-to-expire records below authoritative rank, so junk
+ * makes room for records worth keeping.
+ * @param cache cache structure
+ * @param batch maximum number of index entries to process (0 for default)
+ * @return number of removed entries or an errcode
+ */
+KR_EXPORT
+int kr_cache_gc(struct kr_cache *cache, int batch);
+
+/**
+ * Dump a warmup snapshot of live records.
+ * Records are dumped in sorted key order, so the bulk load is
+ * append-friendly for the LMDB backend. A file named 'warmup.snapshot'
+ * in the cache directory is loaded (and consumed) by kr_cache_open()
+ * when the store is empty, warming up a freshly restarted instance.
+ * @param cache cache structure
+ * @param path snapshot file path
+ * @return number of dumped records or an errcode
+ */
+KR_EXPORT
+int kr_cache_snapshot(struct kr_cache *cache, const char *path);
+
+/**
+ * Stream live records to an open descriptor.
+ * The stream uses the warmup snapshot format, so it can be piped over a
+ * socket to another instance and applied there with kr_cache_import().
+ * Records below the rank floor, or with less remaining lifetime than
+ * min_ttl seconds, are skipped.
+ * @param cache cache structure
+ * @param fd writable descriptor (borrowed, stays open)
+ * @param min_rank minimum entry rank (0 for all)
+ * @param min_ttl minimum remaining TTL in seconds (0 for all)
+ * @return number of exported records or an errcode
+ */
+KR_EXPORT
+int kr_cache_export(struct kr_cache *cache, int fd, uint8_t min_rank, uint32_t min_ttl);
+
+/**
+ * Bulk-load a record stream written by kr_cache_export().
+ * Insertions are applied in large vectored batches; records that expired
+ * since the export are skipped.
+ * @param cache cache structure
+ * @param fd readable descriptor (borrowed, stays open)
+ * @return number of imported records or an errcode
+ */
+KR_EXPORT
+int kr_cache_import(struct kr_cache *cache, int fd);
+
 /**
  * Prefix scan on cached items.
  * @param cache cache structure
@@ -177,6 +362,36 @@ int kr_cache_clear(struct kr_cache *cache);
 KR_EXPORT
 int kr_cache_match(struct kr_cache *cache, uint8_t tag, const knot_dname_t *name, knot_db_val_t *vals, int valcnt);
 
+/**
+ * Remove all records at or below given name.
+ * The keys are name-ordered with reversed labels, so the whole subtree
+ * (including names reachable only through empty non-terminals) is a single
+ * contiguous key range removed with one vectored operation.
+ * @param cache cache structure
+ * @param tag asset tag
+ * @param name subtree apex
+ * @param maxcount maximum number of removed records
+ * @return number of removed records or an errcode
+ */
+KR_EXPORT
+int kr_cache_remove_subtree(struct kr_cache *cache, uint8_t tag, const knot_dname_t *name, int maxcount);
+
+/**
+ * Clamp the remaining lifetime of all records at or below given name.
+ * Records that would outlive @a maxttl seconds are rewritten to expire by
+ * then; records dying sooner are left alone.  A clamp of 0 expires the
+ * subtree on the next lookup while keeping the records available for
+ * stale-serving, which is gentler than deleting them outright.
+ * @param cache cache structure
+ * @param tag asset tag
+ * @param name subtree apex
+ * @param maxttl remaining lifetime ceiling in seconds
+ * @param maxcount maximum number of inspected records
+ * @return number of adjusted records or an errcode
+ */
+KR_EXPORT
+int kr_cache_ttl_subtree(struct kr_cache *cache, uint8_t tag, const knot_dname_t *name, uint32_t maxttl, int maxcount);
+
 /**
  * Peek the cache for given key and retrieve it's rank.
  * @param cache cache structure
@@ -197,11 +412,28 @@ int kr_cache_peek_rank(struct kr_cache *cache, uint8_t tag, const knot_dname_t *
  * @param rank entry rank will be stored in this variable
  * @param flags entry flags
  * @param timestamp current time (will be replaced with drift if successful)
- * @return 0 or an errcode
+ * @return 0 or an errcode; on ESTALE the outputs are still filled with the
+ *         expired entry, so the caller may decide to serve it stale
  */
 KR_EXPORT
 int kr_cache_peek_rr(struct kr_cache *cache, knot_rrset_t *rr, uint8_t *rank, uint8_t *flags, uint32_t *timestamp);
 
+/**
+ * Borrow a read-only RRSet from cache memory without copying rdata.
+ * Fails with ESTALE if any record wouldn't survive the drift, in which
+ * case the caller must fall back to kr_cache_materialize().
+ * @note The borrowed rdata points into the cache memory map and must be
+ *       consumed before the next cache write or sync. TTLs are NOT
+ *       decayed, as the mapped memory must not be modified; the caller
+ *       has to adjust them in the serialized form.
+ * @param dst destination for the borrowed RRSet
+ * @param src read-only RRSet
+ * @param drift time passed between cache time and now
+ * @return 0 or an errcode
+ */
+KR_EXPORT
+int kr_cache_materialize_ref(knot_rrset_t *dst, const knot_rrset_t *src, uint32_t drift);
+
 /**
  * Clone read-only RRSet and adjust TTLs.
  * @param dst destination for materialized RRSet
@@ -225,6 +457,35 @@ int kr_cache_materialize(knot_rrset_t *dst, const knot_rrset_t *src, uint32_t dr
 KR_EXPORT
 int kr_cache_insert_rr(struct kr_cache *cache, const knot_rrset_t *rr, uint8_t rank, uint8_t flags, uint32_t timestamp);
 
+/**
+ * Insert RRSet together with its covering RRSIG set under one key.
+ * The signatures are stored adjacent to the record data, so a validated
+ * cache hit needs a single lookup. Falls back to a plain insertion when
+ * the signature set is empty.
+ * @param cache cache structure
+ * @param rr inserted RRSet
+ * @param sigs covering RRSIG RRSet (may be NULL or empty)
+ * @param rank rank of the record data
+ * @param sig_rank rank of the signatures
+ * @param flags additional flags for the data
+ * @param timestamp current time
+ * @return 0 or an errcode
+ */
+KR_EXPORT
+int kr_cache_insert_rr_sigs(struct kr_cache *cache, const knot_rrset_t *rr, const knot_rrset_t *sigs,
+                            uint8_t rank, uint8_t sig_rank, uint8_t flags, uint32_t timestamp);
+
+/**
+ * Borrow the adjacent RRSIG section of an entry peeked with kr_cache_peek_rr().
+ * @param rr RRSet as filled by the peek (rdata must still point into the cache)
+ * @param flags entry flags as returned by the peek
+ * @param sigs destination for the borrowed RRSIG RRSet
+ * @param rank signature rank will be stored in this variable (may be NULL)
+ * @return 0, ENOENT when the entry has no adjacent signatures, or an errcode
+ */
+KR_EXPORT
+int kr_cache_sig_section(const knot_rrset_t *rr, uint8_t flags, knot_rrset_t *sigs, uint8_t *rank);
+
 /**
  * Peek the cache for the given RRset signature (name, type)
  * @note The RRset type must not be RRSIG but instead it must equal the type covered field of the sought RRSIG.
@@ -250,3 +511,65 @@ int kr_cache_peek_rrsig(struct kr_cache *cache, knot_rrset_t *rr, uint8_t *rank,
  */
 KR_EXPORT
 int kr_cache_insert_rrsig(struct kr_cache *cache, const knot_rrset_t *rr, uint8_t rank, uint8_t flags, uint32_t timestamp);
+
+/** Maximum number of NSEC owner names indexed per zone. */
+#define KR_CACHE_NSEC_MAXOWNERS 32
+
+/**
+ * Index a proven NSEC range owner under its zone, so nonexistence of novel
+ * names falling into the range can later be answered from cache.
+ * @note The NSEC RRSet itself is expected to live in the record cache under
+ *       its owner name; the index only records which owners are worth probing.
+ * @param cache cache structure
+ * @param zone name of the zone the NSEC chain belongs to
+ * @param owner owner name of the validated NSEC record
+ * @param ttl lifetime of the index entry
+ * @param timestamp current time
+ * @return 0 or an errcode
+ */
+KR_EXPORT
+int kr_cache_insert_nsec(struct kr_cache *cache, const knot_dname_t *zone,
+                         const knot_dname_t *owner, uint32_t ttl, uint32_t timestamp);
+
+/**
+ * Find the indexed NSEC owner name canonically preceding the given name.
+ * @note The returned pointer borrows cache memory, copy it out before
+ *       performing further cache operations.
+ * @param cache cache structure
+ * @param zone name of the zone to search
+ * @param name name to be denied
+ * @param owner closest preceding indexed owner will be stored in this variable
+ * @param timestamp current time
+ * @return 0, kr_error(EEXIST) if the name itself is indexed (so it provably
+ *         exists), or an errcode
+ */
+KR_EXPORT
+int kr_cache_peek_nsec(struct kr_cache *cache, const knot_dname_t *zone,
+                       const knot_dname_t *name, const knot_dname_t **owner,
+                       uint32_t timestamp);
+
+/** Lifetime of zone cut failure entries, see kr_cache_report_lame(). */
+#define KR_CACHE_LAME_TTL 30
+
+/**
+ * Record a failed recursion into a zone cut.
+ * Failures within KR_CACHE_LAME_TTL accumulate in a counter, so the
+ * resolver can fail fast on cuts that keep failing instead of running
+ * the full timeout gauntlet for every query.
+ * @param cache cache structure
+ * @param zone zone cut name
+ * @param timestamp current time
+ * @return new failure count or an errcode
+ */
+KR_EXPORT
+int kr_cache_report_lame(struct kr_cache *cache, const knot_dname_t *zone, uint32_t timestamp);
+
+/**
+ * Get the current failure count of a zone cut.
+ * @param cache cache structure
+ * @param zone zone cut name
+ * @param timestamp current time
+ * @return failure count (0 when there is no live entry) or an errcode
+ */
+KR_EXPORT
+int kr_cache_peek_lame(struct kr_cache *cache, const knot_dname_t *zone, uint32_t timestamp);
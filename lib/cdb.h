@@ -16,12 +16,34 @@
 
 #pragma once
 
+#include <stdbool.h>
+
 #include <libknot/db/db.h>
 
 /* Cache options. */
 struct kr_cdb_opts {
 	const char *path; /*!< Cache URI path. */
 	size_t maxsize;   /*!< Suggested cache size in bytes. */
+	unsigned shards;  /*!< Suggested number of storage shards (0 or 1 disables sharding).
+	                   *   Remote backends with their own key distribution may
+	                   *   interpret this as the number of key replicas instead. */
+	bool hugepages;   /*!< Advise transparent hugepages on memory-mapped storage
+	                   *   (and round the map size accordingly); advisory only,
+	                   *   backends without a memory map ignore it. */
+	bool prefetch;    /*!< Queue readahead over populated storage at open time,
+	                   *   so a cache-warm restart faults pages in batched file
+	                   *   order instead of one by one from lookups. Advisory. */
+};
+
+/*! Storage utilization counters, see kr_cdb_api::stats. */
+struct kr_cdb_stats {
+	size_t capacity;   /*!< Configured size limit in bytes. */
+	size_t used;       /*!< Bytes occupied by live data pages. */
+	size_t fragmented; /*!< Bytes in allocated but currently unused pages. */
+	size_t commits;    /*!< Committed write transactions. */
+	size_t failed;     /*!< Write transaction commits that failed. */
+	size_t hugepages;  /*!< Bytes of the map currently backed by huge pages,
+	                    *   0 unless kr_cdb_opts::hugepages was requested. */
 };
 
 /*! Cache database API.
@@ -49,4 +71,6 @@ struct kr_cdb_api {
 
 	int (*match)(knot_db_t *db, knot_db_val_t *key, knot_db_val_t *val, int maxcount);
 	int (*prune)(knot_db_t *db, int maxcount);
+	/*! Fill storage utilization counters (optional). */
+	int (*stats)(knot_db_t *db, struct kr_cdb_stats *stats);
 };
@@ -15,14 +15,17 @@
 */
 
 #include <assert.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <lmdb.h>
 
 #include "contrib/cleanup.h"
+#include "contrib/murmurhash3/murmurhash3.h"
 #include "lib/cdb_lmdb.h"
 #include "lib/cache.h"
 #include "lib/utils.h"
@@ -31,16 +34,66 @@
 /* Defines */
 #define LMDB_DIR_MODE   0770
 #define LMDB_FILE_MODE  0660
+#define LMDB_MAXSHARDS  64
+
+/* Write transactions are coalesced into batches to amortise the commit
+ * overhead, a batch is committed when it grows too large or too old.
+ * Readers may not see staged writes until the batch commits, which is
+ * an acceptable trade-off for a cache. */
+#define LMDB_BATCH_MAXOPS 64
+#define LMDB_BATCH_MAXAGE 100 /* ms */
+
+/* Size of the expiry index key header, see lib/cache.c */
+#define EXP_KEY_HSIZE (sizeof(uint8_t) + sizeof(uint32_t))
+
+/* Transparent hugepage size assumed for map alignment; the advice is
+ * harmless if the kernel uses a different (or no) huge page size. */
+#define LMDB_HUGEPAGE_SIZE (2 * 1024 * 1024)
 
 struct lmdb_env
 {
 	size_t mapsize;
 	MDB_dbi dbi;
 	MDB_env *env;
-	MDB_txn *rdtxn;
+	MDB_txn *rdtxn;         /*!< Cached read transaction, kept in reset state. */
+	MDB_cursor *rdcur;      /*!< Cached read cursor, renewed with the transaction. */
 	MDB_txn *wrtxn;
+	unsigned wrops;         /*!< Operations staged in the write batch. */
+	struct timeval wrstamp; /*!< Time of the first staged operation. */
+	size_t commits;         /*!< Committed write transactions. */
+	size_t failed;          /*!< Failed write transaction commits. */
+	bool hugepages;         /*!< MADV_HUGEPAGE advised on the map. */
+	char *path;             /*!< Environment directory, for /proc map lookups. */
 };
 
+/** Database optionally sharded into several environments, so that
+ * writers in different processes rarely contend on the single LMDB
+ * write lock. Keys are distributed by hash, prefix scans visit all
+ * shards. */
+struct lmdb_db
+{
+	unsigned count;
+	struct lmdb_env shard[];
+};
+
+/** @internal Pick the shard environment holding given key.
+ * Expiry index entries are co-located with the record they track. */
+static struct lmdb_env *shard_for(struct lmdb_db *db, const knot_db_val_t *key)
+{
+	if (db->count == 1) {
+		return &db->shard[0];
+	}
+	const uint8_t *data = key->data;
+	size_t len = key->len;
+	if (len > EXP_KEY_HSIZE && data[0] == KR_CACHE_EXP) {
+		data += EXP_KEY_HSIZE;
+		len -= EXP_KEY_HSIZE;
+	}
+	/* Shard choice is persisted on disk, so it must stay on the stable
+	 * unkeyed hash; never switch this to hash_keyed()/hash_fast(). */
+	return &db->shard[hash((const char *)data, len) % db->count];
+}
+
 /** @brief Convert LMDB error code. */
 static int lmdb_error(int error)
 {
@@ -59,12 +112,16 @@ static int lmdb_error(int error)
 /*! \brief Set the environment map size.
  * \note This also sets the maximum database size, see \fn mdb_env_set_mapsize
  */
-static int set_mapsize(MDB_env *env, size_t map_size)
+static int set_mapsize(MDB_env *env, size_t map_size, bool hugepages)
 {
 	long page_size = sysconf(_SC_PAGESIZE);
 	if (page_size <= 0) {
 		return KNOT_ERROR;
 	}
+	if (hugepages) {
+		/* Huge-page aligned maps can be backed whole by THP. */
+		page_size = LMDB_HUGEPAGE_SIZE;
+	}
 
 	/* Round to page size. */
 	map_size = (map_size / page_size) * page_size;
@@ -76,25 +133,178 @@ static int set_mapsize(MDB_env *env, size_t map_size)
 	return 0;
 }
 
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+/*! \brief Huge-page advice and adoption accounting for the data file map.
+ * The LMDB API doesn't expose the map address, so the range is found in
+ * /proc/self/smaps by file name. With advise set, MADV_HUGEPAGE is given
+ * for the whole range; either way returns the bytes currently backed by
+ * huge pages (AnonHugePages/FilePmdMapped/ShmemPmdMapped). */
+static size_t thp_map(struct lmdb_env *env, bool advise)
+{
+	char real[PATH_MAX];
+	if (!env->path || !realpath(env->path, real)) {
+		return 0;
+	}
+	auto_free char *needle = kr_strcatdup(2, real, "/data.mdb");
+	FILE *fp = needle ? fopen("/proc/self/smaps", "r") : NULL;
+	if (!fp) {
+		return 0;
+	}
+	const size_t needle_len = strlen(needle);
+	size_t total = 0;
+	bool in_map = false;
+	char line[512];
+	while (fgets(line, sizeof(line), fp)) {
+		unsigned long start = 0, end = 0;
+		size_t kb = 0;
+		if (sscanf(line, "%lx-%lx ", &start, &end) == 2) {
+			size_t len = strlen(line);
+			while (len > 0 && line[len - 1] == '\n') {
+				line[--len] = '\0';
+			}
+			in_map = len >= needle_len &&
+			         strcmp(line + len - needle_len, needle) == 0;
+			if (in_map && advise) {
+				(void) madvise((void *)start, end - start, MADV_HUGEPAGE);
+			}
+			continue;
+		}
+		if (in_map && (sscanf(line, "AnonHugePages: %zu kB", &kb) == 1 ||
+		               sscanf(line, "FilePmdMapped: %zu kB", &kb) == 1 ||
+		               sscanf(line, "ShmemPmdMapped: %zu kB", &kb) == 1)) {
+			total += kb * 1024;
+		}
+	}
+	fclose(fp);
+	return total;
+}
+#else
+static size_t thp_map(struct lmdb_env *env, bool advise)
+{
+	(void) env; (void) advise;
+	return 0; /* Not supported on this platform. */
+}
+#endif
+
+#if defined(__linux__) && defined(MADV_WILLNEED)
+/*! \brief Queue readahead for the populated prefix of the data file map.
+ * After a restart the map is cold and the random access order of lookups
+ * defeats kernel readahead, so the first touch of every page takes a major
+ * fault. MADV_WILLNEED issues the reads up front in file order and batched;
+ * the kernel performs them asynchronously, the call doesn't block on I/O. */
+static void prefetch_map(struct lmdb_env *env)
+{
+	MDB_envinfo info;
+	MDB_stat stat;
+	if (!env->env ||
+	    mdb_env_info(env->env, &info) != MDB_SUCCESS ||
+	    mdb_env_stat(env->env, &stat) != MDB_SUCCESS) {
+		return;
+	}
+	/* Only pages up to the last used one are worth faulting in. */
+	size_t used = (info.me_last_pgno + 1) * (size_t)stat.ms_psize;
+	char real[PATH_MAX];
+	if (!env->path || !realpath(env->path, real)) {
+		return;
+	}
+	/* The LMDB API doesn't expose the map address, find it by file name. */
+	auto_free char *needle = kr_strcatdup(2, real, "/data.mdb");
+	FILE *fp = needle ? fopen("/proc/self/maps", "r") : NULL;
+	if (!fp) {
+		return;
+	}
+	const size_t needle_len = strlen(needle);
+	char line[512];
+	while (fgets(line, sizeof(line), fp) && used > 0) {
+		unsigned long start = 0, end = 0;
+		if (sscanf(line, "%lx-%lx ", &start, &end) != 2) {
+			continue;
+		}
+		size_t len = strlen(line);
+		while (len > 0 && line[len - 1] == '\n') {
+			line[--len] = '\0';
+		}
+		if (len < needle_len ||
+		    strcmp(line + len - needle_len, needle) != 0) {
+			continue;
+		}
+		size_t want = end - start;
+		if (want > used) {
+			want = used;
+		}
+		(void) madvise((void *)start, want, MADV_WILLNEED);
+		used -= want;
+	}
+	fclose(fp);
+}
+#else
+static void prefetch_map(struct lmdb_env *env)
+{
+	(void) env; /* Not supported on this platform. */
+}
+#endif
+
+/*! \brief Commit transaction and reset write batch accounting. */
+static int txn_commit(struct lmdb_env *env, MDB_txn *txn)
+{
+	assert(env && txn);
+	env->wrtxn = NULL;
+	env->wrops = 0;
+	/* The cached reader is kept in reset state, so it pins no pages
+	 * and its renewal will observe this commit. */
+	int ret = lmdb_error(mdb_txn_commit(txn));
+	env->commits += 1;
+	if (ret != 0) {
+		env->failed += 1;
+	}
+	return ret;
+}
+
+/*! \brief Commit staged write batch (if any). */
+static int batch_commit(struct lmdb_env *env)
+{
+	if (!env->wrtxn) {
+		return 0;
+	}
+	return txn_commit(env, env->wrtxn);
+}
+
+/*! \brief Check if the staged write batch is due for commit. */
+static bool batch_due(struct lmdb_env *env)
+{
+	if (!env->wrtxn) {
+		return false;
+	}
+	if (env->wrops >= LMDB_BATCH_MAXOPS) {
+		return true;
+	}
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	uint64_t elapsed = (now.tv_sec - env->wrstamp.tv_sec) * (uint64_t)1000
+	                 + (now.tv_usec - env->wrstamp.tv_usec) / 1000;
+	return elapsed >= LMDB_BATCH_MAXAGE;
+}
+
 static int txn_begin(struct lmdb_env *env, MDB_txn **txn, bool rdonly)
 {
-	/* Always barrier for write transaction. */
 	assert(env && txn);
-	if (env->wrtxn) {
-		mdb_txn_abort(env->wrtxn);
+	/* Reuse staged write transaction to coalesce writes,
+	 * readers leave it untouched and read the last committed batch. */
+	if (env->wrtxn && !rdonly) {
+		*txn = env->wrtxn;
 		env->wrtxn = NULL;
+		return 0;
 	}
-	/* Renew pending read-only transaction 
-	 * or abort it to clear reader slot before writing. */
-	if (env->rdtxn) {
-		if (rdonly) {
-			*txn = env->rdtxn;
-			env->rdtxn = NULL;
+	/* Renew the cached read-only transaction; it is kept reset, so the
+	 * renewal just pins the current snapshot instead of a full setup. */
+	if (rdonly && env->rdtxn) {
+		MDB_txn *cached = env->rdtxn;
+		env->rdtxn = NULL;
+		if (mdb_txn_renew(cached) == MDB_SUCCESS) {
+			*txn = cached;
 			return 0;
-		} else {
-			mdb_txn_abort(env->rdtxn);
-			env->rdtxn = NULL;
 		}
+		mdb_txn_abort(cached);
 	}
 	unsigned flags = rdonly ? MDB_RDONLY : 0;
 	return lmdb_error(mdb_txn_begin(env->env, NULL, flags, txn));
@@ -103,8 +313,10 @@ static int txn_begin(struct lmdb_env *env, MDB_txn **txn, bool rdonly)
 static int txn_end(struct lmdb_env *env, MDB_txn *txn)
 {
 	assert(env && txn);
-	/* Cache read transactions */
+	/* Cache read transactions in reset state: the reader slot is kept,
+	 * but no snapshot is pinned between operations. */
 	if (!env->rdtxn) {
+		mdb_txn_reset(txn);
 		env->rdtxn = txn;
 	} else {
 		mdb_txn_abort(txn);
@@ -112,13 +324,12 @@ static int txn_end(struct lmdb_env *env, MDB_txn *txn)
 	return 0;
 }
 
-static int cdb_sync(knot_db_t *db)
+static int cdb_sync_env(struct lmdb_env *env)
 {
-	struct lmdb_env *env = db;
-	int ret = 0;
-	if (env->wrtxn) {
-		ret = lmdb_error(mdb_txn_commit(env->wrtxn));
-		env->wrtxn = NULL; /* In-flight transaction is committed. */
+	int ret = batch_commit(env); /* In-flight batch is committed. */
+	if (env->rdcur) {
+		mdb_cursor_close(env->rdcur);
+		env->rdcur = NULL;
 	}
 	if (env->rdtxn) {
 		mdb_txn_abort(env->rdtxn);
@@ -127,19 +338,37 @@ static int cdb_sync(knot_db_t *db)
 	return ret;
 }
 
+static int cdb_sync(knot_db_t *db)
+{
+	struct lmdb_db *lmdb = db;
+	int ret = 0;
+	for (unsigned i = 0; i < lmdb->count; ++i) {
+		/* Commit staged batches only; cached readers stay - they are
+		 * kept reset, so their renewal observes the commit anyway.
+		 * This keeps a no-op sync cheap enough to run every loop turn. */
+		int err = batch_commit(&lmdb->shard[i]);
+		if (err != 0) {
+			ret = err;
+		}
+	}
+	return ret;
+}
+
 /*! \brief Close the database. */
 static void cdb_close_env(struct lmdb_env *env)
 {
 	assert(env && env->env);
-	cdb_sync(env);
+	cdb_sync_env(env);
 	mdb_env_sync(env->env, 1);
 	mdb_dbi_close(env->env, env->dbi);
 	mdb_env_close(env->env);
+	free(env->path);
 	memset(env, 0, sizeof(*env));
 }
 
 /*! \brief Open database environment. */
-static int cdb_open_env(struct lmdb_env *env, unsigned flags, const char *path, size_t mapsize)
+static int cdb_open_env(struct lmdb_env *env, unsigned flags, const char *path,
+                        size_t mapsize, bool hugepages)
 {
 	int ret = mkdir(path, LMDB_DIR_MODE);
 	if (ret == -1 && errno != EEXIST) {
@@ -152,7 +381,7 @@ static int cdb_open_env(struct lmdb_env *env, unsigned flags, const char *path,
 		return lmdb_error(ret);
 	}
 
-	ret = set_mapsize(mdb_env, mapsize);
+	ret = set_mapsize(mdb_env, mapsize, hugepages);
 	if (ret != 0) {
 		mdb_env_close(mdb_env);
 		return ret;
@@ -167,15 +396,20 @@ static int cdb_open_env(struct lmdb_env *env, unsigned flags, const char *path,
 	/* Keep the environment pointer. */
 	env->env = mdb_env;
 	env->mapsize = mapsize;
+	env->path = strdup(path);
+	env->hugepages = hugepages;
+	if (hugepages) {
+		(void) thp_map(env, true);
+	}
 	return 0;
 }
 
-static int cdb_open(struct lmdb_env *env, const char *path, size_t mapsize)
+static int cdb_open(struct lmdb_env *env, const char *path, size_t mapsize, bool hugepages)
 {
 	/* Cache doesn't require durability, we can be
 	 * loose with the requirements as a tradeoff for speed. */
 	const unsigned flags = MDB_WRITEMAP | MDB_MAPASYNC | MDB_NOTLS;
-	int ret = cdb_open_env(env, flags, path, mapsize);
+	int ret = cdb_open_env(env, flags, path, mapsize, hugepages);
 	if (ret != 0) {
 		return ret;
 	}
@@ -204,46 +438,91 @@ static int cdb_open(struct lmdb_env *env, const char *path, size_t mapsize)
 	return 0;
 }
 
+/*! \brief Open a single shard environment in given directory. */
+static int cdb_init_env(struct lmdb_env *env, const char *path, size_t mapsize, bool hugepages)
+{
+	/* Clear stale lockfiles. */
+	auto_free char *lockfile = kr_strcatdup(2, path, "/.cachelock");
+	if (lockfile && access(lockfile, R_OK) == 0) {
+		kr_log_info("[system] cache: clearing stale lockfile '%s'\n", lockfile);
+		unlink(lockfile);
+	}
+
+	return cdb_open(env, path, mapsize, hugepages);
+}
+
 static int cdb_init(knot_db_t **db, struct kr_cdb_opts *opts, knot_mm_t *pool)
 {
 	if (!db || !opts) {
 		return kr_error(EINVAL);
 	}
 
-	struct lmdb_env *env = malloc(sizeof(*env));
-	if (!env) {
-		return kr_error(ENOMEM);
+	unsigned count = opts->shards;
+	if (count < 1) {
+		count = 1;
+	} else if (count > LMDB_MAXSHARDS) {
+		count = LMDB_MAXSHARDS;
 	}
-	memset(env, 0, sizeof(struct lmdb_env));
 
-	/* Clear stale lockfiles. */
-	auto_free char *lockfile = kr_strcatdup(2, opts->path, "/.cachelock");
-	if (lockfile && access(lockfile, R_OK) == 0) {
-		kr_log_info("[system] cache: clearing stale lockfile '%s'\n", lockfile);
-		unlink(lockfile);
+	struct lmdb_db *lmdb = malloc(sizeof(*lmdb) + count * sizeof(struct lmdb_env));
+	if (!lmdb) {
+		return kr_error(ENOMEM);
 	}
+	memset(lmdb, 0, sizeof(*lmdb) + count * sizeof(struct lmdb_env));
+	lmdb->count = count;
 
-	/* Open the database. */
-	int ret = cdb_open(env, opts->path, opts->maxsize);
+	/* Single shard keeps the old flat layout, shards live in
+	 * subdirectories so the map can be reopened either way. */
+	int ret = 0;
+	if (count == 1) {
+		ret = cdb_init_env(&lmdb->shard[0], opts->path, opts->maxsize, opts->hugepages);
+	} else {
+		ret = mkdir(opts->path, LMDB_DIR_MODE);
+		ret = (ret == -1 && errno != EEXIST) ? kr_error(errno) : 0;
+		for (unsigned i = 0; ret == 0 && i < count; ++i) {
+			char subdir[16];
+			snprintf(subdir, sizeof(subdir), "/shard%u", i);
+			auto_free char *path = kr_strcatdup(2, opts->path, subdir);
+			if (!path) {
+				ret = kr_error(ENOMEM);
+				break;
+			}
+			ret = cdb_init_env(&lmdb->shard[i], path, opts->maxsize / count, opts->hugepages);
+		}
+	}
 	if (ret != 0) {
-		free(env);
+		for (unsigned i = 0; i < count; ++i) {
+			if (lmdb->shard[i].env) {
+				cdb_close_env(&lmdb->shard[i]);
+			}
+		}
+		free(lmdb);
 		return ret;
 	}
 
-	*db = env;
+	/* Warm the maps before serving; entries bulk-loaded from a warmup
+	 * snapshot later become resident from the writes themselves. */
+	if (opts->prefetch) {
+		for (unsigned i = 0; i < count; ++i) {
+			prefetch_map(&lmdb->shard[i]);
+		}
+	}
+
+	*db = lmdb;
 	return 0;
 }
 
 static void cdb_deinit(knot_db_t *db)
 {
-	struct lmdb_env *env = db;
-	cdb_close_env(env);
-	free(env);
+	struct lmdb_db *lmdb = db;
+	for (unsigned i = 0; i < lmdb->count; ++i) {
+		cdb_close_env(&lmdb->shard[i]);
+	}
+	free(lmdb);
 }
 
-static int cdb_count(knot_db_t *db)
+static int cdb_count_env(struct lmdb_env *env)
 {
-	struct lmdb_env *env = db;
 	MDB_txn *txn = NULL;
 	int ret = txn_begin(env, &txn, true);
 	if (ret != 0) {
@@ -258,11 +537,24 @@ static int cdb_count(knot_db_t *db)
 	return (ret == MDB_SUCCESS) ? stat.ms_entries : lmdb_error(ret);
 }
 
-static int cdb_clear(knot_db_t *db)
+static int cdb_count(knot_db_t *db)
+{
+	struct lmdb_db *lmdb = db;
+	int count = 0;
+	for (unsigned i = 0; i < lmdb->count; ++i) {
+		int ret = cdb_count_env(&lmdb->shard[i]);
+		if (ret < 0) {
+			return ret;
+		}
+		count += ret;
+	}
+	return count;
+}
+
+static int cdb_clear_env(struct lmdb_env *env)
 {
-	struct lmdb_env *env = db;
 	/* Always attempt to commit write transactions in-flight. */
-	(void) cdb_sync(db);
+	(void) cdb_sync_env(env);
 
 	/* Since there is no guarantee that there will be free
 	 * pages to hold whole dirtied db for transaction-safe clear,
@@ -327,16 +619,31 @@ static int cdb_clear(knot_db_t *db)
 	return ret;
 }
 
-static int cdb_readv(knot_db_t *db, knot_db_val_t *key, knot_db_val_t *val, int maxcount)
+static int cdb_clear(knot_db_t *db)
 {
-	struct lmdb_env *env = db;
-	MDB_txn *txn = NULL;
-	int ret = txn_begin(env, &txn, true);
-	if (ret != 0) {
-		return ret;
+	struct lmdb_db *lmdb = db;
+	int ret = 0;
+	for (unsigned i = 0; i < lmdb->count; ++i) {
+		int err = cdb_clear_env(&lmdb->shard[i]);
+		if (err != 0) {
+			ret = err;
+		}
 	}
+	return ret;
+}
+
+static int cdb_readv(knot_db_t *db, knot_db_val_t *key, knot_db_val_t *val, int maxcount)
+{
+	struct lmdb_db *lmdb = db;
+	int ret = 0;
 
 	for (int i = 0; i < maxcount; ++i) {
+		struct lmdb_env *env = shard_for(lmdb, &key[i]);
+		MDB_txn *txn = NULL;
+		ret = txn_begin(env, &txn, true);
+		if (ret != 0) {
+			return ret;
+		}
 		/* Convert key structs */
 		MDB_val _key = { .mv_size = key[i].len, .mv_data = key[i].data };
 		MDB_val _val = { .mv_size = val[i].len, .mv_data = val[i].data };
@@ -344,10 +651,11 @@ static int cdb_readv(knot_db_t *db, knot_db_val_t *key, knot_db_val_t *val, int
 		/* Update the result. */
 		val[i].data = _val.mv_data;
 		val[i].len = _val.mv_size;
+		txn_end(env, txn);
+		ret = lmdb_error(ret);
 	}
 
-	txn_end(env, txn);
-	return lmdb_error(ret);
+	return ret;
 }
 
 static int cdb_write(struct lmdb_env *env, MDB_txn *txn, knot_db_val_t *key, knot_db_val_t *val, unsigned flags)
@@ -367,15 +675,28 @@ static int cdb_write(struct lmdb_env *env, MDB_txn *txn, knot_db_val_t *key, kno
 
 static int cdb_writev(knot_db_t *db, knot_db_val_t *key, knot_db_val_t *val, int maxcount)
 {
-	struct lmdb_env *env = db;
-	MDB_txn *txn = NULL;
-	int ret = txn_begin(env, &txn, false);
-	if (ret != 0) {
-		return ret;
-	}
+	struct lmdb_db *lmdb = db;
+	int ret = 0;
 
-	bool reserved = false;
 	for (int i = 0; i < maxcount; ++i) {
+		struct lmdb_env *env = shard_for(lmdb, &key[i]);
+
+		/* Commit batch that is due before staging more writes.
+		 * This is a safe point, as callers of the previous batch have
+		 * already filled their reserved entries. */
+		if (batch_due(env)) {
+			ret = batch_commit(env);
+			if (ret != 0) {
+				return ret;
+			}
+		}
+
+		MDB_txn *txn = NULL;
+		ret = txn_begin(env, &txn, false);
+		if (ret != 0) {
+			return ret;
+		}
+
 		/* This is LMDB specific optimisation,
 		 * if caller specifies value with NULL data and non-zero length,
 		 * LMDB will preallocate the entry for caller and leave write
@@ -384,74 +705,101 @@ static int cdb_writev(knot_db_t *db, knot_db_val_t *key, knot_db_val_t *val, int
 		unsigned mdb_flags = 0;
 		if (val[i].len > 0 && val[i].data == NULL) {
 			mdb_flags |= MDB_RESERVE;
-			reserved = true;
 		}
 		ret = cdb_write(env, txn, &key[i], &val[i], mdb_flags);
 		if (ret != 0) {
 			mdb_txn_abort(txn);
+			env->wrops = 0;
 			return ret;
 		}
-	}
 
-	/* Leave transaction open if reserved. */
-	if (reserved) {
-		assert(env->wrtxn == NULL);
+		/* Stage the batch, it is committed either when it grows
+		 * too large or too old, or on explicit sync. Reserved entries
+		 * are filled by the caller after return, so the commit is always
+		 * deferred to a later operation. */
+		if (env->wrops == 0) {
+			gettimeofday(&env->wrstamp, NULL);
+		}
 		env->wrtxn = txn;
-	} else {
-		ret = lmdb_error(mdb_txn_commit(txn));
+		env->wrops += 1;
 	}
+
 	return ret;
 }
 
 static int cdb_remove(knot_db_t *db, knot_db_val_t *key, int maxcount)
 {
-	struct lmdb_env *env = db;
-	MDB_txn *txn = NULL;
-	int ret = txn_begin(env, &txn, false);
-	if (ret != 0) {
-		return ret;
-	}
+	struct lmdb_db *lmdb = db;
+	int ret = 0;
 
+	/* Removals are staged into the write batch like insertions,
+	 * the commit granularity is the same for both. */
 	for (int i = 0; i < maxcount; ++i) {
+		struct lmdb_env *env = shard_for(lmdb, &key[i]);
+		if (batch_due(env)) {
+			ret = batch_commit(env);
+			if (ret != 0) {
+				return ret;
+			}
+		}
+
+		MDB_txn *txn = NULL;
+		ret = txn_begin(env, &txn, false);
+		if (ret != 0) {
+			return ret;
+		}
+
 		MDB_val _key = { key[i].len, key[i].data };
 		MDB_val val = { 0, NULL };
 		ret = mdb_del(txn, env->dbi, &_key, &val);
-		if (ret != 0) {
+		if (ret == MDB_NOTFOUND) {
+			/* Reported, but mustn't tear down the staged batch. */
+			ret = lmdb_error(ret);
+		} else if (ret != 0) {
 			mdb_txn_abort(txn);
+			env->wrops = 0;
 			return lmdb_error(ret);
 		}
+
+		if (env->wrops == 0) {
+			gettimeofday(&env->wrstamp, NULL);
+		}
+		env->wrtxn = txn;
+		env->wrops += 1;
 	}
 
-	return lmdb_error(mdb_txn_commit(txn));
+	return ret;
 }
 
-static int cdb_match(knot_db_t *db, knot_db_val_t *key, knot_db_val_t *val, int maxcount)
+static int cdb_match_env(struct lmdb_env *env, knot_db_val_t *key, knot_db_val_t *val, int maxcount)
 {
-	struct lmdb_env *env = db;
 	MDB_txn *txn = NULL;
 	int ret = txn_begin(env, &txn, true);
 	if (ret != 0) {
 		return ret;
 	}
 
-	/* Turn wildcard into prefix scan. */
-	const uint8_t *endp = (const uint8_t *)key->data + (key->len - 2);
-	if (key->len > 2 && endp[0] == '*' && endp[1] == '\0') {
-		key->len -= 2; /* Skip '*' label */
+	/* Rebind the cached cursor to this transaction, read-only cursors
+	 * outlive their transaction and renewal skips the allocation. */
+	MDB_cursor *cur = env->rdcur;
+	env->rdcur = NULL;
+	if (cur && mdb_cursor_renew(txn, cur) != MDB_SUCCESS) {
+		mdb_cursor_close(cur);
+		cur = NULL;
 	}
-
-	MDB_cursor *cur = NULL;
-	ret = mdb_cursor_open(txn, env->dbi, &cur);
-	if (ret != 0) {
-		mdb_txn_abort(txn);
-		return lmdb_error(ret);
+	if (!cur) {
+		ret = mdb_cursor_open(txn, env->dbi, &cur);
+		if (ret != 0) {
+			mdb_txn_abort(txn);
+			return lmdb_error(ret);
+		}
 	}
 
 	MDB_val cur_key = { key->len, key->data }, cur_val = { 0, NULL };
 	ret = mdb_cursor_get(cur, &cur_key, &cur_val, MDB_SET_RANGE);
 	if (ret != 0) {
-		mdb_cursor_close(cur);
-		mdb_txn_abort(txn);
+		env->rdcur = cur;
+		txn_end(env, txn);
 		return lmdb_error(ret);
 	}
 
@@ -472,19 +820,44 @@ static int cdb_match(knot_db_t *db, knot_db_val_t *key, knot_db_val_t *val, int
 		ret = mdb_cursor_get(cur, &cur_key, &cur_val, MDB_NEXT);
 	}
 
-	mdb_cursor_close(cur);
+	env->rdcur = cur;
 	txn_end(env, txn);
 	return results;
 }
 
+static int cdb_match(knot_db_t *db, knot_db_val_t *key, knot_db_val_t *val, int maxcount)
+{
+	struct lmdb_db *lmdb = db;
 
-static int cdb_prune(knot_db_t *db, int limit)
+	/* Turn wildcard into prefix scan. */
+	const uint8_t *endp = (const uint8_t *)key->data + (key->len - 2);
+	if (key->len > 2 && endp[0] == '*' && endp[1] == '\0') {
+		key->len -= 2; /* Skip '*' label */
+	}
+
+	/* Prefixed keys are scattered by the key hash,
+	 * so a prefix scan must visit every shard. */
+	int results = 0;
+	for (unsigned i = 0; i < lmdb->count && results < maxcount; ++i) {
+		int ret = cdb_match_env(&lmdb->shard[i], key, val + results, maxcount - results);
+		if (ret == kr_error(ENOENT)) {
+			continue; /* Next shard may still match. */
+		}
+		if (ret < 0) {
+			return ret;
+		}
+		results += ret;
+	}
+	return results;
+}
+
+
+static int cdb_prune_env(struct lmdb_env *env, int limit)
 {
 	/* Sync in-flight transactions */
-	cdb_sync(db);
+	cdb_sync_env(env);
 
 	/* Prune old records */
-	struct lmdb_env *env = db;
 	MDB_txn *txn = NULL;
 	int ret = txn_begin(env, &txn, false);
 	if (ret != 0) {
@@ -510,8 +883,9 @@ static int cdb_prune(knot_db_t *db, int limit)
 	struct timeval now;
 	gettimeofday(&now, NULL);
 	while (ret == 0 && results < limit) {
-		/* Ignore special namespaces. */
-		if (cur_key.mv_size < 2 || ((const char *)cur_key.mv_data)[0] == 'V') {
+		/* Ignore special namespaces, values there aren't cache entries. */
+		if (cur_key.mv_size < 2 || ((const char *)cur_key.mv_data)[0] == 'V'
+		    || ((const char *)cur_key.mv_data)[0] == 'E') {
 			ret = mdb_cursor_get(cur, &cur_key, &cur_val, MDB_NEXT);
 			continue;
 		}
@@ -528,17 +902,76 @@ static int cdb_prune(knot_db_t *db, int limit)
 		ret = mdb_cursor_get(cur, &cur_key, &cur_val, MDB_NEXT);
 	}
 	mdb_cursor_close(cur);
-	ret = lmdb_error(mdb_txn_commit(txn));
+	ret = txn_commit(env, txn);
 	return ret < 0 ? ret : results;
 }
 
+static int cdb_prune(knot_db_t *db, int limit)
+{
+	struct lmdb_db *lmdb = db;
+	int results = 0;
+	for (unsigned i = 0; i < lmdb->count && results < limit; ++i) {
+		int ret = cdb_prune_env(&lmdb->shard[i], limit - results);
+		if (ret == kr_error(ENOENT)) {
+			continue; /* Empty shard. */
+		}
+		if (ret < 0) {
+			return ret;
+		}
+		results += ret;
+	}
+	return results;
+}
+
+static int cdb_stats_env(struct lmdb_env *env, struct kr_cdb_stats *stats)
+{
+	MDB_envinfo info;
+	MDB_stat st;
+	int ret = mdb_env_info(env->env, &info);
+	if (ret == MDB_SUCCESS) {
+		ret = mdb_env_stat(env->env, &st);
+	}
+	if (ret != MDB_SUCCESS) {
+		return lmdb_error(ret);
+	}
+	/* Pages allocated in the map but not holding live data
+	 * sit on the freelist, i.e. internal fragmentation. */
+	size_t live = (st.ms_branch_pages + st.ms_leaf_pages + st.ms_overflow_pages) * st.ms_psize;
+	size_t allocated = (info.me_last_pgno + 1) * st.ms_psize;
+	stats->capacity += env->mapsize;
+	stats->used += live;
+	stats->fragmented += allocated > live ? allocated - live : 0;
+	stats->commits += env->commits;
+	stats->failed += env->failed;
+	if (env->hugepages) {
+		stats->hugepages += thp_map(env, false);
+	}
+	return 0;
+}
+
+static int cdb_stats(knot_db_t *db, struct kr_cdb_stats *stats)
+{
+	if (!db || !stats) {
+		return kr_error(EINVAL);
+	}
+	struct lmdb_db *lmdb = db;
+	memset(stats, 0, sizeof(*stats));
+	for (unsigned i = 0; i < lmdb->count; ++i) {
+		int ret = cdb_stats_env(&lmdb->shard[i], stats);
+		if (ret != 0) {
+			return ret;
+		}
+	}
+	return 0;
+}
+
 const struct kr_cdb_api *kr_cdb_lmdb(void)
 {
 	static const struct kr_cdb_api api = {
 		"lmdb",
 		cdb_init, cdb_deinit, cdb_count, cdb_clear, cdb_sync,
 		cdb_readv, cdb_writev, cdb_remove,
-		cdb_match, cdb_prune
+		cdb_match, cdb_prune, cdb_stats
 	};
 
 	return &api;
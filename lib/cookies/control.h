@@ -37,6 +37,8 @@ struct kr_cookie_comp {
 /** Holds settings that control client/server cookie behaviour. */
 struct kr_cookie_settings {
 	bool enabled; /**< Enable/disables DNS cookies functionality. */
+	uint32_t generation; /**< Bumped on every update, invalidates cached verdicts. */
+	uint32_t rotation; /**< Automatic secret rotation period [s], 0 is off. */
 
 	struct kr_cookie_comp current; /**< Current cookie settings. */
 	struct kr_cookie_comp recent; /**< Recent cookie settings. */
@@ -70,3 +70,65 @@ int kr_cookie_lru_set(kr_cookie_lru_t *cache, const struct sockaddr *sa,
 
 	return kr_ok();
 }
+
+/** @internal Compute option size and check it fits an entry. */
+static uint16_t checked_opt_size(const uint8_t *opt)
+{
+	uint16_t opt_size = KNOT_EDNS_OPTION_HDRLEN +
+	                    knot_edns_opt_get_length(opt);
+	return (opt_size <= KR_COOKIE_OPT_MAX_LEN) ? opt_size : 0;
+}
+
+bool kr_cookie_lru_checked(kr_cookie_lru_t *cache, const struct sockaddr *sa,
+                           const uint8_t *opt, uint32_t tag)
+{
+	if (!cache || !sa || !opt) {
+		return false;
+	}
+
+	int addr_len = kr_inaddr_len(sa);
+	const char *addr = kr_inaddr(sa);
+	if (!addr || addr_len <= 0) {
+		return false;
+	}
+
+	uint16_t opt_size = checked_opt_size(opt);
+	if (opt_size == 0) {
+		return false;
+	}
+
+	struct cookie_opt_data *cached = lru_get(cache, addr, addr_len);
+	return cached && cached->checked_len == opt_size &&
+	       cached->checked_tag == tag &&
+	       memcmp(cached->checked_opt, opt, opt_size) == 0;
+}
+
+int kr_cookie_lru_mark_checked(kr_cookie_lru_t *cache, const struct sockaddr *sa,
+                               const uint8_t *opt, uint32_t tag)
+{
+	if (!cache || !sa || !opt) {
+		return kr_error(EINVAL);
+	}
+
+	int addr_len = kr_inaddr_len(sa);
+	const char *addr = kr_inaddr(sa);
+	if (!addr || addr_len <= 0) {
+		return kr_error(EINVAL);
+	}
+
+	uint16_t opt_size = checked_opt_size(opt);
+	if (opt_size == 0) {
+		return kr_error(EINVAL);
+	}
+
+	struct cookie_opt_data *cached = lru_set(cache, addr, addr_len);
+	if (!cached) {
+		return kr_error(ENOMEM);
+	}
+
+	memcpy(cached->checked_opt, opt, opt_size);
+	cached->checked_len = opt_size;
+	cached->checked_tag = tag;
+
+	return kr_ok();
+}
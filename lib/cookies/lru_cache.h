@@ -17,6 +17,7 @@
 #pragma once
 
 #include <netinet/in.h>
+#include <stdbool.h>
 #include <stdint.h>
 
 #if defined(ENABLE_COOKIES)
@@ -38,6 +39,11 @@
  */
 struct cookie_opt_data {
 	uint8_t opt_data[KR_COOKIE_OPT_MAX_LEN];
+	/* Verification verdict for the ingress path -- the last inbound cookie
+	 * option from this address that passed the server cookie check. */
+	uint8_t checked_opt[KR_COOKIE_OPT_MAX_LEN];
+	uint16_t checked_len; /*!< Verified option size, 0 when no verdict. */
+	uint32_t checked_tag; /*!< Settings generation the verdict belongs to. */
 };
 
 /**
@@ -67,3 +73,33 @@ const uint8_t *kr_cookie_lru_get(kr_cookie_lru_t *cache,
 KR_EXPORT
 int kr_cookie_lru_set(kr_cookie_lru_t *cache, const struct sockaddr *sa,
                       uint8_t *opt);
+
+/**
+ * @brief Check whether the identical cookie option from this address has
+ *        already passed verification under the given settings generation.
+ *
+ * Verification is deterministic in the secret, client address and cookie
+ * bytes, so an exact match lets repeat clients skip the HMAC computation.
+ *
+ * @param cache cookie LRU cache
+ * @param sa client socket address serving as key
+ * @param opt entire cookie option from the packet
+ * @param tag cookie settings generation
+ * @return true when a cached verdict applies
+ */
+KR_EXPORT
+bool kr_cookie_lru_checked(kr_cookie_lru_t *cache, const struct sockaddr *sa,
+                           const uint8_t *opt, uint32_t tag);
+
+/**
+ * @brief Remember that a cookie option from an address has been verified.
+ *
+ * @param cache cookie LRU cache
+ * @param sa client socket address serving as key
+ * @param opt entire cookie option that passed verification
+ * @param tag cookie settings generation
+ * @return kr_ok() or error code
+ */
+KR_EXPORT
+int kr_cookie_lru_mark_checked(kr_cookie_lru_t *cache, const struct sockaddr *sa,
+                               const uint8_t *opt, uint32_t tag);
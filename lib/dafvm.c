@@ -0,0 +1,274 @@
+/*  Copyright (C) 2016 CZ.NIC, z.s.p.o. <knot-dns@labs.nic.cz>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "lib/dafvm.h"
+#include "lib/suffixmatch.h"
+#include "lib/utils.h"
+#include "lib/generic/array.h"
+#include "lib/generic/lru.h"
+
+/* Instruction = { u8 op, u24 operand }. The interpreter is a tiny stack
+ * machine, programs are emitted in postfix order by the rule compiler. */
+#define INSTR(op, operand) (((uint32_t)(op) << 24) | ((uint32_t)(operand) & 0xffffff))
+#define INSTR_OP(ins)      ((ins) >> 24)
+#define INSTR_ARG(ins)     ((ins) & 0xffffff)
+#define STACK_MAX 64
+
+/** @internal Parsed subnet operand. */
+struct dafvm_subnet {
+	uint8_t addr[16];
+	int family;
+	int bitlen;
+};
+
+/** @internal Memoized verdict, valid for a single program generation. */
+struct memo_entry {
+	int verdict;
+	uint32_t epoch;
+};
+
+/** @internal Verdict memo, keyed by { qname lookup format, addresses }. */
+typedef lru_hash(struct memo_entry) memo_hash_t;
+
+struct kr_dafvm {
+	array_t(uint32_t) code;
+	array_t(struct kr_suffix_set *) sets;
+	array_t(struct dafvm_subnet) subnets;
+	memo_hash_t *memo;
+	uint32_t epoch; /**< Bumped on program change, invalidates the memo. */
+};
+
+struct kr_dafvm *kr_dafvm_create(unsigned memo_size)
+{
+	struct kr_dafvm *vm = calloc(1, sizeof(*vm));
+	if (!vm) {
+		return NULL;
+	}
+	array_init(vm->code);
+	array_init(vm->sets);
+	array_init(vm->subnets);
+	if (memo_size > 0) {
+		vm->memo = malloc(lru_size(memo_hash_t, memo_size));
+		if (vm->memo) {
+			lru_init(vm->memo, memo_size);
+		}
+	}
+	return vm;
+}
+
+void kr_dafvm_clear(struct kr_dafvm *vm)
+{
+	if (!vm) {
+		return;
+	}
+	for (size_t i = 0; i < vm->sets.len; ++i) {
+		kr_suffix_set_free(vm->sets.at[i]);
+	}
+	array_clear(vm->code);
+	array_clear(vm->sets);
+	array_clear(vm->subnets);
+	vm->epoch += 1;
+}
+
+void kr_dafvm_free(struct kr_dafvm *vm)
+{
+	if (!vm) {
+		return;
+	}
+	kr_dafvm_clear(vm);
+	if (vm->memo) {
+		lru_deinit(vm->memo);
+		free(vm->memo);
+	}
+	free(vm);
+}
+
+int kr_dafvm_suffix(struct kr_dafvm *vm, const knot_dname_t *name)
+{
+	if (!vm || !name) {
+		return kr_error(EINVAL);
+	}
+	struct kr_suffix_set *set = kr_suffix_set_create();
+	if (!set) {
+		return kr_error(ENOMEM);
+	}
+	int ret = kr_suffix_set_add(set, name);
+	if (ret == 0) {
+		ret = kr_suffix_set_compile(set);
+	}
+	if (ret == 0 && array_push(vm->sets, set) < 0) {
+		ret = kr_error(ENOMEM);
+	}
+	if (ret != 0) {
+		kr_suffix_set_free(set);
+		return ret;
+	}
+	vm->epoch += 1;
+	return vm->sets.len - 1;
+}
+
+int kr_dafvm_subnet(struct kr_dafvm *vm, const char *subnet)
+{
+	if (!vm || !subnet) {
+		return kr_error(EINVAL);
+	}
+	struct dafvm_subnet parsed;
+	memset(&parsed, 0, sizeof(parsed));
+	parsed.family = kr_straddr_family(subnet);
+	parsed.bitlen = kr_straddr_subnet(parsed.addr, subnet);
+	if (parsed.family < 0 || parsed.bitlen < 0) {
+		return kr_error(EINVAL);
+	}
+	if (array_push(vm->subnets, parsed) < 0) {
+		return kr_error(ENOMEM);
+	}
+	vm->epoch += 1;
+	return vm->subnets.len - 1;
+}
+
+int kr_dafvm_emit(struct kr_dafvm *vm, int op, int operand)
+{
+	if (!vm || op < KR_DAFVM_TRUE || op > KR_DAFVM_RET ||
+	    operand < 0 || operand > 0xffffff) {
+		return kr_error(EINVAL);
+	}
+	/* Validate operand ranges at compile time, not per query */
+	if (op == KR_DAFVM_QNAME && operand >= vm->sets.len) {
+		return kr_error(EINVAL);
+	}
+	if ((op == KR_DAFVM_SRC || op == KR_DAFVM_DST) && operand >= vm->subnets.len) {
+		return kr_error(EINVAL);
+	}
+	if (array_push(vm->code, INSTR(op, operand)) < 0) {
+		return kr_error(ENOMEM);
+	}
+	vm->epoch += 1;
+	return kr_ok();
+}
+
+/** @internal Match address against parsed subnet. */
+static bool subnet_match(const struct dafvm_subnet *subnet, const struct sockaddr *addr)
+{
+	if (!addr || addr->sa_family != subnet->family) {
+		return false;
+	}
+	return kr_bitcmp((const char *)subnet->addr, kr_inaddr(addr), subnet->bitlen) == 0;
+}
+
+/** @internal Run the program (memo lookups are done by the caller). */
+static int interpret(struct kr_dafvm *vm, const knot_dname_t *qname,
+                     const struct sockaddr *src, const struct sockaddr *dst)
+{
+	bool stack[STACK_MAX];
+	int sp = 0;
+	for (size_t pc = 0; pc < vm->code.len; ++pc) {
+		const uint32_t ins = vm->code.at[pc];
+		const uint32_t arg = INSTR_ARG(ins);
+		switch (INSTR_OP(ins)) {
+		case KR_DAFVM_TRUE:
+			if (sp >= STACK_MAX) return kr_error(ENOSPC);
+			stack[sp++] = true;
+			break;
+		case KR_DAFVM_QNAME:
+			if (sp >= STACK_MAX) return kr_error(ENOSPC);
+			stack[sp++] = kr_suffix_set_match(vm->sets.at[arg], qname) == 1;
+			break;
+		case KR_DAFVM_SRC:
+			if (sp >= STACK_MAX) return kr_error(ENOSPC);
+			stack[sp++] = subnet_match(&vm->subnets.at[arg], src);
+			break;
+		case KR_DAFVM_DST:
+			if (sp >= STACK_MAX) return kr_error(ENOSPC);
+			stack[sp++] = subnet_match(&vm->subnets.at[arg], dst);
+			break;
+		case KR_DAFVM_AND:
+			if (sp < 2) return kr_error(EINVAL);
+			stack[sp - 2] = stack[sp - 2] && stack[sp - 1];
+			sp -= 1;
+			break;
+		case KR_DAFVM_OR:
+			if (sp < 2) return kr_error(EINVAL);
+			stack[sp - 2] = stack[sp - 2] || stack[sp - 1];
+			sp -= 1;
+			break;
+		case KR_DAFVM_RET:
+			if (sp < 1) return kr_error(EINVAL);
+			if (stack[--sp]) {
+				return arg;
+			}
+			break;
+		default:
+			return kr_error(EINVAL);
+		}
+	}
+	return -1; /* Nothing matched */
+}
+
+/** @internal Memo key = { qname lookup format, src address, dst address }. */
+static int memo_key(char *buf, const knot_dname_t *qname,
+                    const struct sockaddr *src, const struct sockaddr *dst)
+{
+	uint8_t lf[KNOT_DNAME_MAXLEN];
+	if (knot_dname_lf(lf, qname, NULL) != 0) {
+		return kr_error(EINVAL);
+	}
+	int len = lf[0];
+	memcpy(buf, lf + 1, len);
+	if (src) {
+		int addr_len = kr_inaddr_len(src);
+		memcpy(buf + len, kr_inaddr(src), addr_len);
+		len += addr_len;
+	}
+	if (dst) {
+		int addr_len = kr_inaddr_len(dst);
+		memcpy(buf + len, kr_inaddr(dst), addr_len);
+		len += addr_len;
+	}
+	return len;
+}
+
+int kr_dafvm_match(struct kr_dafvm *vm, const knot_dname_t *qname,
+                   const struct sockaddr *src, const struct sockaddr *dst)
+{
+	if (!vm || !qname) {
+		return kr_error(EINVAL);
+	}
+	/* Check memoized verdict */
+	char key[KNOT_DNAME_MAXLEN + 2 * sizeof(struct dafvm_subnet)];
+	int key_len = 0;
+	if (vm->memo) {
+		key_len = memo_key(key, qname, src, dst);
+		if (key_len > 0) {
+			struct memo_entry *entry = lru_get(vm->memo, key, key_len);
+			if (entry && entry->epoch == vm->epoch) {
+				return entry->verdict;
+			}
+		}
+	}
+	int verdict = interpret(vm, qname, src, dst);
+	if (verdict >= -1 && vm->memo && key_len > 0) {
+		struct memo_entry *entry = lru_set(vm->memo, key, key_len);
+		if (entry) {
+			entry->verdict = verdict;
+			entry->epoch = vm->epoch;
+		}
+	}
+	return verdict;
+}
@@ -0,0 +1,92 @@
+/*  Copyright (C) 2016 CZ.NIC, z.s.p.o. <knot-dns@labs.nic.cz>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file dafvm.h
+ * @brief Bytecode engine for packet filter rules.
+ *
+ * Filter rules are compiled into a compact stack-machine bytecode over
+ * match primitives (qname suffix set, source/destination subnet) and
+ * evaluated by a small interpreter, so a whole rule chain costs a single
+ * call per query instead of one Lua closure per rule. Verdicts are
+ * memoized in a LRU keyed by the qname and client address, repeated
+ * queries skip the interpretation entirely. Used by the daf module
+ * through the Lua bindings.
+ */
+
+#pragma once
+
+#include <sys/socket.h>
+#include <libknot/dname.h>
+#include "lib/defines.h"
+
+/** Bytecode operations, see kr_dafvm_emit(). */
+enum kr_dafvm_op {
+	KR_DAFVM_TRUE = 1, /**< Push true. */
+	KR_DAFVM_QNAME,    /**< Push 'qname is in suffix set [operand]'. */
+	KR_DAFVM_SRC,      /**< Push 'source address is in subnet [operand]'. */
+	KR_DAFVM_DST,      /**< Push 'destination address is in subnet [operand]'. */
+	KR_DAFVM_AND,      /**< Pop two values, push conjunction. */
+	KR_DAFVM_OR,       /**< Pop two values, push disjunction. */
+	KR_DAFVM_RET,      /**< Pop value, if true terminate with rule [operand]. */
+};
+
+struct kr_dafvm;
+
+/** Create an engine, verdicts are memoized in a LRU of given size (0 = no memo). */
+KR_EXPORT
+struct kr_dafvm *kr_dafvm_create(unsigned memo_size);
+
+/** Destroy an engine. */
+KR_EXPORT
+void kr_dafvm_free(struct kr_dafvm *vm);
+
+/**
+ * Compile a name into a suffix set usable as KR_DAFVM_QNAME operand.
+ * @return set index or an error code
+ */
+KR_EXPORT
+int kr_dafvm_suffix(struct kr_dafvm *vm, const knot_dname_t *name);
+
+/**
+ * Parse a subnet string ('addr' or 'addr/len') usable as subnet operand.
+ * @return subnet index or an error code
+ */
+KR_EXPORT
+int kr_dafvm_subnet(struct kr_dafvm *vm, const char *subnet);
+
+/**
+ * Append an instruction to the program.
+ * @return 0 or an error code
+ */
+KR_EXPORT
+int kr_dafvm_emit(struct kr_dafvm *vm, int op, int operand);
+
+/** Drop the program, suffix sets and subnets (rule updates recompile). */
+KR_EXPORT
+void kr_dafvm_clear(struct kr_dafvm *vm);
+
+/**
+ * Evaluate the program for given query.
+ * @param  qname queried name
+ * @param  src   client address (may be NULL)
+ * @param  dst   destination address (may be NULL)
+ * @return matched rule (KR_DAFVM_RET operand), -1 when nothing matched,
+ *         or an error code lower than -1
+ */
+KR_EXPORT
+int kr_dafvm_match(struct kr_dafvm *vm, const knot_dname_t *qname,
+                   const struct sockaddr *src, const struct sockaddr *dst);
@@ -36,6 +36,11 @@
 #define KR_COLD
 #endif
 
+/** Compile-time invariant check, usable at file scope.
+  * Produces a negative array size (with the tag in the error) on failure. */
+#define KR_STATIC_ASSERT(cond, tag) \
+	typedef char kr_static_assert_ ## tag[(cond) ? 1 : -1]
+
 /*
  * Error codes.
  */
@@ -15,6 +15,7 @@
  */
 
 #include <assert.h>
+#include <string.h>
 #include <dnssec/binary.h>
 #include <dnssec/crypto.h>
 #include <dnssec/error.h>
@@ -37,6 +38,9 @@
 
 #define DEBUG_MSG(fmt...) fprintf(stderr, fmt)
 
+/** @internal Signatures verified per batch, the rest goes in further rounds. */
+#define SIG_BATCH_MAX 8
+
 void kr_crypto_init(void)
 {
 	dnssec_crypto_init();
@@ -129,6 +133,44 @@ static int wildcard_radix_len_diff(const knot_dname_t *expanded,
 	return knot_dname_labels(expanded, NULL) - knot_rrsig_labels(&rrsigs->rrs, sig_pos);
 }
 
+/** @internal Upper bound on DNSKEY rdata worth caching, fits RSA-4096. */
+#define DNSKEY_RDATA_MAXLEN 1024
+
+/**
+ * Fetch a parsed key from the cache, parsing and inserting it on a miss.
+ * The parsed key is fully determined by the owner name and the rdata (which
+ * embeds the algorithm and determines the keytag), so those form the lookup key.
+ * @return Key borrowed from the cache or NULL (the caller then parses its own copy).
+ */
+static struct dseckey *cached_key_get(kr_dnskey_lru_t *cache, const knot_dname_t *kown,
+                                      const uint8_t *rdata, size_t rdlen)
+{
+	const int kown_len = knot_dname_size(kown);
+	if (!cache || kown_len <= 0 || rdlen > DNSKEY_RDATA_MAXLEN) {
+		return NULL;
+	}
+	char buf[KNOT_DNAME_MAXLEN + DNSKEY_RDATA_MAXLEN];
+	memcpy(buf, kown, kown_len);
+	memcpy(buf + kown_len, rdata, rdlen);
+	const uint16_t buf_len = kown_len + rdlen;
+	struct dseckey **found = lru_get(cache, buf, buf_len);
+	if (found) {
+		return *found;
+	}
+	struct dseckey *key = NULL;
+	if (kr_dnssec_key_from_rdata(&key, kown, rdata, rdlen) != 0) {
+		return NULL;
+	}
+	struct dseckey **slot = lru_set(cache, buf, buf_len);
+	if (!slot) {
+		/* Couldn't joust the current occupant, keep the key uncached. */
+		kr_dnssec_key_free(&key);
+		return NULL;
+	}
+	*slot = key;
+	return key;
+}
+
 int kr_rrset_validate(kr_rrset_validation_ctx_t *vctx, const knot_rrset_t *covered)
 {
 	if (!vctx) {
@@ -159,6 +201,11 @@ int kr_rrset_validate_with_key(kr_rrset_validation_ctx_t *vctx,
 	uint32_t timestamp            = vctx->timestamp;
 	bool has_nsec3		      = vctx->has_nsec3;
 	struct dseckey *created_key = NULL;
+	if (key == NULL) {
+		const knot_rdata_t *krr = knot_rdataset_at(&keys->rrs, key_pos);
+		key = cached_key_get(vctx->cache_key, keys->owner,
+		                     knot_rdata_data(krr), knot_rdata_rdlen(krr));
+	}
 	if (key == NULL) {
 		const knot_rdata_t *krr = knot_rdataset_at(&keys->rrs, key_pos);
 		int ret = kr_dnssec_key_from_rdata(&created_key, keys->owner,
@@ -186,42 +233,67 @@ int kr_rrset_validate_with_key(kr_rrset_validation_ctx_t *vctx,
 		if ((covered->rclass != rrsig->rclass) || !knot_dname_is_equal(covered->owner, rrsig->owner)) {
 			continue;
 		}
-		for (uint16_t j = 0; j < rrsig->rrs.rr_count; ++j) {
-			int val_flgs = 0;
-			int trim_labels = 0;
-			if (knot_rrsig_type_covered(&rrsig->rrs, j) != covered->type) {
-				continue;
-			}
-			if (validate_rrsig_rr(&val_flgs, covered_labels, rrsig, j,
-			                      keys, key_pos, keytag,
-			                      zone_name, timestamp) != 0) {
-				continue;
-			}
-			if (val_flgs & FLG_WILDCARD_EXPANSION) {
-				trim_labels = wildcard_radix_len_diff(covered->owner, rrsig, j);
-				if (trim_labels < 0) {
-					break;
+		/* Gather the applicable signatures, then verify them in one
+		 * batch, sharing the verification context setup. */
+		bool skip_rest = false;
+		uint16_t j = 0;
+		while (j < rrsig->rrs.rr_count && !skip_rest) {
+			struct kr_sig_check batch[SIG_BATCH_MAX];
+			int batch_flgs[SIG_BATCH_MAX];
+			size_t batch_len = 0;
+			for (; j < rrsig->rrs.rr_count && batch_len < SIG_BATCH_MAX; ++j) {
+				int val_flgs = 0;
+				int trim_labels = 0;
+				if (knot_rrsig_type_covered(&rrsig->rrs, j) != covered->type) {
+					continue;
+				}
+				if (validate_rrsig_rr(&val_flgs, covered_labels, rrsig, j,
+				                      keys, key_pos, keytag,
+				                      zone_name, timestamp) != 0) {
+					continue;
+				}
+				if (val_flgs & FLG_WILDCARD_EXPANSION) {
+					trim_labels = wildcard_radix_len_diff(covered->owner, rrsig, j);
+					if (trim_labels < 0) {
+						skip_rest = true;
+						break;
+					}
 				}
+				batch[batch_len] = (struct kr_sig_check){
+					.rrsigs = rrsig,
+					.pos = j,
+					.key = (dnssec_key_t *) key,
+					.covered = covered,
+					.trim_labels = trim_labels
+				};
+				batch_flgs[batch_len] = val_flgs;
+				batch_len += 1;
 			}
-			if (kr_check_signature(rrsig, j, (dnssec_key_t *) key, covered, trim_labels) != 0) {
+			if (batch_len == 0) {
 				continue;
 			}
-			if (val_flgs & FLG_WILDCARD_EXPANSION) {
-				int ret = 0;
-				if (!has_nsec3) {
-					ret = kr_nsec_wildcard_answer_response_check(pkt, KNOT_AUTHORITY, covered->owner);
-				} else {
-					ret = kr_nsec3_wildcard_answer_response_check(pkt, KNOT_AUTHORITY, covered->owner, trim_labels - 1);
-				}
-				if (ret != 0) {
+			kr_check_signatures(batch, batch_len);
+			for (size_t k = 0; k < batch_len; ++k) {
+				if (batch[k].result != 0) {
 					continue;
 				}
-				vctx->flags |= KR_DNSSEC_VFLG_WEXPAND;
+				if (batch_flgs[k] & FLG_WILDCARD_EXPANSION) {
+					int ret = 0;
+					if (!has_nsec3) {
+						ret = kr_nsec_wildcard_answer_response_check(pkt, KNOT_AUTHORITY, covered->owner);
+					} else {
+						ret = kr_nsec3_wildcard_answer_response_check(pkt, KNOT_AUTHORITY, covered->owner, batch[k].trim_labels - 1);
+					}
+					if (ret != 0) {
+						continue;
+					}
+					vctx->flags |= KR_DNSSEC_VFLG_WEXPAND;
+				}
+				/* Validated with current key, OK */
+				kr_dnssec_key_free(&created_key);
+				vctx->result = kr_ok();
+				return vctx->result;
 			}
-			/* Validated with current key, OK */
-			kr_dnssec_key_free(&created_key);
-			vctx->result = kr_ok();
-			return vctx->result;
 		}
 	}
 	/* No applicable key found, cannot be validated. */
@@ -251,19 +323,25 @@ int kr_dnskeys_trusted(kr_rrset_validation_ctx_t *vctx, const knot_rrset_t *ta)
 			continue;
 		}
 		
-		struct dseckey *key;
-		if (kr_dnssec_key_from_rdata(&key, keys->owner, key_data, knot_rdata_rdlen(krr)) != 0) {
-			continue;
+		struct dseckey *created_key = NULL;
+		const struct dseckey *key = cached_key_get(vctx->cache_key, keys->owner,
+		                                           key_data, knot_rdata_rdlen(krr));
+		if (!key) {
+			if (kr_dnssec_key_from_rdata(&created_key, keys->owner,
+			                             key_data, knot_rdata_rdlen(krr)) != 0) {
+				continue;
+			}
+			key = created_key;
 		}
 		if (kr_authenticate_referral(ta, (dnssec_key_t *) key) != 0) {
-			kr_dnssec_key_free(&key);
+			kr_dnssec_key_free(&created_key);
 			continue;
 		}
 		if (kr_rrset_validate_with_key(vctx, keys, i, key) != 0) {
-			kr_dnssec_key_free(&key);
+			kr_dnssec_key_free(&created_key);
 			continue;
 		}
-		kr_dnssec_key_free(&key);
+		kr_dnssec_key_free(&created_key);
 		assert (vctx->result == 0);
 		return vctx->result;
 	}
@@ -17,6 +17,7 @@
 #pragma once
 
 #include "lib/defines.h"
+#include "lib/generic/lru.h"
 #include <libknot/packet/pkt.h>
 
 /**
@@ -41,6 +42,10 @@ void kr_crypto_reinit(void);
 /** Opaque DNSSEC key pointer. */
 struct dseckey;
 
+/** Cache of parsed DNSSEC keys, keyed by owner name and DNSKEY rdata.
+  * Cached keys are owned by the cache and freed on eviction. */
+typedef lru_hash(struct dseckey *) kr_dnskey_lru_t;
+
 #define KR_DNSSEC_VFLG_WEXPAND 0x01
 
 /** DNSSEC validation context. */
@@ -51,6 +56,7 @@ struct kr_rrset_validation_ctx {
         const knot_dname_t *zone_name;	/*!< Name of the zone containing the RRSIG RRSet. */
 	uint32_t timestamp;		/*!< Validation time. */
         bool has_nsec3;			/*!< Whether to use NSEC3 validation. */
+	kr_dnskey_lru_t *cache_key;	/*!< Cache of parsed keys, may be NULL. */
 	uint32_t flags;			/*!< Output - Flags. */
 	int result;			/*!< Output - 0 or error code. */
 };
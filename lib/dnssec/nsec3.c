@@ -28,6 +28,7 @@
 #include "lib/defines.h"
 #include "lib/dnssec/nsec.h"
 #include "lib/dnssec/nsec3.h"
+#include "lib/generic/lru.h"
 
 #define OPT_OUT_BIT 0x01
 
@@ -68,7 +69,45 @@ static int nsec3_parameters(dnssec_nsec3_params_t *params, const knot_rrset_t *n
 }
 
 /**
- * Computes a hash of a given domain name.
+ * @internal Memo of computed NSEC3 hashes.
+ *
+ * Iterated hashing dominates the cost of negative-answer validation in zones
+ * with high iteration counts, and the same (name, salt, iterations) inputs
+ * recur whenever proofs from the same zone are checked. The memo is local
+ * to the process, which matches the daemon's process-per-worker model; it
+ * never goes stale, as the hash is a pure function of the memoized inputs.
+ */
+#define NSEC3_MEMO_SIZE 2048
+#define NSEC3_MEMO_HASH_MAX 32 /* dnssec_nsec3_hash() computes SHA-1, 20 octets. */
+struct nsec3_hashed {
+	uint8_t size;
+	uint8_t hash[NSEC3_MEMO_HASH_MAX];
+};
+typedef lru_hash(struct nsec3_hashed) nsec3_memo_t;
+static nsec3_memo_t *nsec3_memo = NULL;
+
+/** @internal Build memo lookup key: name wire | algorithm | iterations | salt. */
+static int nsec3_memo_key(char *buf, const dnssec_nsec3_params_t *params,
+                          const knot_dname_t *name)
+{
+	const int name_len = knot_dname_size(name);
+	if (name_len <= 0 || params->salt.size > UINT8_MAX) {
+		return kr_error(EINVAL);
+	}
+	char *p = buf;
+	memcpy(p, name, name_len);
+	p += name_len;
+	memcpy(p, &params->algorithm, sizeof(params->algorithm));
+	p += sizeof(params->algorithm);
+	memcpy(p, &params->iterations, sizeof(params->iterations));
+	p += sizeof(params->iterations);
+	memcpy(p, params->salt.data, params->salt.size);
+	p += params->salt.size;
+	return p - buf;
+}
+
+/**
+ * Computes a hash of a given domain name, memoizing the result.
  * @param hash   Resulting hash, must be freed.
  * @param params NSEC3 parameters.
  * @param name   Domain name to be hashed.
@@ -81,6 +120,27 @@ static int hash_name(dnssec_binary_t *hash, const dnssec_nsec3_params_t *params,
 	if (!name)
 		return kr_error(EINVAL);
 
+	/* Consult the memo first, computation proceeds without it on OOM. */
+	if (!nsec3_memo) {
+		nsec3_memo = malloc(lru_size(nsec3_memo_t, NSEC3_MEMO_SIZE));
+		if (nsec3_memo) {
+			lru_init(nsec3_memo, NSEC3_MEMO_SIZE);
+		}
+	}
+	char key[KNOT_DNAME_MAXLEN + 3 + UINT8_MAX];
+	int key_len = nsec3_memo ? nsec3_memo_key(key, params, name) : kr_error(EINVAL);
+	if (key_len > 0) {
+		const struct nsec3_hashed *found = lru_get(nsec3_memo, key, key_len);
+		if (found) {
+			const dnssec_binary_t cached = { .size = found->size,
+			                                 .data = (uint8_t *) found->hash };
+			if (dnssec_binary_dup(&cached, hash) != DNSSEC_EOK) {
+				return kr_error(ENOMEM);
+			}
+			return kr_ok();
+		}
+	}
+
 	dnssec_binary_t dname = {0, };
 	dname.size = knot_dname_size(name);
 	dname.data = (uint8_t *) name;
@@ -90,6 +150,14 @@ static int hash_name(dnssec_binary_t *hash, const dnssec_nsec3_params_t *params,
 		return kr_error(EINVAL);
 	}
 
+	if (key_len > 0 && hash->size <= NSEC3_MEMO_HASH_MAX) {
+		struct nsec3_hashed *slot = lru_set(nsec3_memo, key, key_len);
+		if (slot) {
+			slot->size = hash->size;
+			memcpy(slot->hash, hash->data, hash->size);
+		}
+	}
+
 	return kr_ok();
 }
 
@@ -232,46 +232,75 @@ static int sign_ctx_add_data(dnssec_sign_ctx_t *ctx, const uint8_t *rrsig_rdata,
 	return sign_ctx_add_records(ctx, covered, orig_ttl, trim_labels);
 }
 
-int kr_check_signature(const knot_rrset_t *rrsigs, size_t pos,
-                       const dnssec_key_t *key, const knot_rrset_t *covered,
-                       int trim_labels)
+/** @internal Verify a single prepared check with the supplied context. */
+static int check_signature(dnssec_sign_ctx_t *sign_ctx, const struct kr_sig_check *c)
 {
-	if (!rrsigs || !key || !dnssec_key_can_verify(key)) {
-		return kr_error(EINVAL);
-	}
-
-	int ret = 0;
-	dnssec_sign_ctx_t *sign_ctx = NULL;
 	dnssec_binary_t signature = {0, };
-
-	knot_rrsig_signature(&rrsigs->rrs, pos, &signature.data, &signature.size);
+	knot_rrsig_signature(&c->rrsigs->rrs, c->pos, &signature.data, &signature.size);
 	if (!signature.data || !signature.size) {
-		ret = kr_error(EINVAL);
-		goto fail;
-	}
-
-	if (dnssec_sign_new(&sign_ctx, key) != 0) {
-		ret = kr_error(ENOMEM);
-		goto fail;
+		return kr_error(EINVAL);
 	}
 
-	uint32_t orig_ttl = knot_rrsig_original_ttl(&rrsigs->rrs, pos);
-	const knot_rdata_t *rr_data = knot_rdataset_at(&rrsigs->rrs, pos);
+	uint32_t orig_ttl = knot_rrsig_original_ttl(&c->rrsigs->rrs, c->pos);
+	const knot_rdata_t *rr_data = knot_rdataset_at(&c->rrsigs->rrs, c->pos);
 	uint8_t *rdata = knot_rdata_data(rr_data);
 
-	if (sign_ctx_add_data(sign_ctx, rdata, covered, orig_ttl, trim_labels) != 0) {
-		ret = kr_error(ENOMEM);
-		goto fail;
+	if (sign_ctx_add_data(sign_ctx, rdata, c->covered, orig_ttl, c->trim_labels) != 0) {
+		return kr_error(ENOMEM);
 	}
 
 	if (dnssec_sign_verify(sign_ctx, &signature) != 0) {
-		ret = kr_error(EBADMSG);
-		goto fail;
+		return kr_error(EBADMSG);
 	}
 
-	ret = kr_ok();
+	return kr_ok();
+}
+
+int kr_check_signatures(struct kr_sig_check *batch, size_t count)
+{
+	int ret = kr_ok();
+	dnssec_sign_ctx_t *sign_ctx = NULL;
+	const dnssec_key_t *ctx_key = NULL;
+
+	for (size_t i = 0; i < count; ++i) {
+		struct kr_sig_check *c = &batch[i];
+		/* Fail fast on the cheapest checks. */
+		if (!c->rrsigs || !c->key || !dnssec_key_can_verify(c->key)) {
+			c->result = kr_error(EINVAL);
+		} else if (c->key == ctx_key && dnssec_sign_init(sign_ctx) == DNSSEC_EOK) {
+			/* Context setup is paid once per run of checks with the same key. */
+			c->result = check_signature(sign_ctx, c);
+		} else {
+			dnssec_sign_free(sign_ctx);
+			sign_ctx = NULL;
+			ctx_key = NULL;
+			if (dnssec_sign_new(&sign_ctx, c->key) != 0) {
+				c->result = kr_error(ENOMEM);
+			} else {
+				ctx_key = c->key;
+				c->result = check_signature(sign_ctx, c);
+			}
+		}
+		if (ret == 0 && c->result != 0) {
+			ret = c->result;
+		}
+	}
 
-fail:
 	dnssec_sign_free(sign_ctx);
 	return ret;
 }
+
+int kr_check_signature(const knot_rrset_t *rrsigs, size_t pos,
+                       const dnssec_key_t *key, const knot_rrset_t *covered,
+                       int trim_labels)
+{
+	struct kr_sig_check check = {
+		.rrsigs = rrsigs,
+		.pos = pos,
+		.key = key,
+		.covered = covered,
+		.trim_labels = trim_labels
+	};
+	kr_check_signatures(&check, 1);
+	return check.result;
+}
@@ -39,3 +39,26 @@ int kr_authenticate_referral(const knot_rrset_t *ref, const dnssec_key_t *key);
 int kr_check_signature(const knot_rrset_t *rrsigs, size_t pos,
                        const dnssec_key_t *key, const knot_rrset_t *covered,
                        int trim_labels);
+
+/** A single signature check of a batch, see kr_check_signatures(). */
+struct kr_sig_check {
+	const knot_rrset_t *rrsigs;  /**< RRSet containing the signatures. */
+	size_t pos;                  /**< Index of the signature record. */
+	const dnssec_key_t *key;     /**< Already parsed key. */
+	const knot_rrset_t *covered; /**< The covered RRSet. */
+	int trim_labels;             /**< Leftmost labels to replace with '*.'. */
+	int result;                  /**< Output - 0 if the signature is valid. */
+};
+
+/**
+ * Check a batch of signatures in one pass.
+ *
+ * Consecutive checks against the same key share one verification context,
+ * so batching the (rrset, rrsig, key) triples of a response pays the
+ * context setup once. The cheapest checks run first and every item
+ * records its own result.
+ * @param batch array of checks, results are filled in
+ * @param count number of checks
+ * @return      0 if all signatures are valid, else the first error.
+ */
+int kr_check_signatures(struct kr_sig_check *batch, size_t count);
@@ -64,6 +64,7 @@
 
 #pragma once
 #include <stdlib.h>
+#include <string.h>
 
 /** Simplified Qt containers growth strategy. */
 static inline size_t array_next_count(size_t want)
@@ -151,4 +152,68 @@ static inline void array_std_free(void *baton, void *p)
 #define array_tail(array) \
     (array).at[(array).len - 1]
 
+/*
+ * Small-buffer variant: keeps a fixed number of elements inline and spills
+ * into allocated memory only when it outgrows them, so the dominant tiny
+ * arrays cost no allocation at all. The leading members mirror array_t(),
+ * only init/reserve/clear differ; push/pop/del/tail work unchanged.
+ */
+
+/** Declare an array with inline storage for 'count' elements. */
+#define sb_array_t(type, count) \
+	struct { type *at; size_t len; size_t cap; type inl[count]; }
+
+/** Initialize the array pointing at its inline storage. */
+#define sb_array_init(array) \
+	((array).at = (array).inl, (array).len = 0, \
+	 (array).cap = sizeof((array).inl) / sizeof((array).inl[0]))
+
+/** @internal Reserve that copies out of the inline storage on first spill. */
+static inline int array_sb_reserve(char **mem, char *inl, size_t len, size_t elm_size,
+                                   size_t want, size_t *have,
+                                   int (*reserve)(void *, char **, size_t, size_t, size_t *),
+                                   void *baton)
+{
+	if (*have >= want) {
+		return 0;
+	}
+	if (*mem != inl) {
+		return reserve(baton, mem, elm_size, want, have);
+	}
+	/* Spill out of the inline storage, it must not be reallocated. */
+	char *spill = NULL;
+	size_t cap = 0;
+	if (reserve(baton, &spill, elm_size, want, &cap) != 0) {
+		return -1;
+	}
+	memcpy(spill, inl, len * elm_size);
+	*mem = spill;
+	*have = cap;
+	return 0;
+}
+
+/** @internal Reserve capacity using callback. */
+#define sb_array_reserve_mm(array, n, reserve, baton) \
+	array_sb_reserve((char **)&(array).at, (char *)(array).inl, (array).len, \
+	                 sizeof((array).at[0]), (n), &(array).cap, (reserve), (baton))
+
+/** Reserve capacity up to 'n' elements. */
+#define sb_array_reserve(array, n) \
+	sb_array_reserve_mm(array, n, array_std_reserve, NULL)
+
+/** @internal Clear array with a callback, inline storage is never freed. */
+#define sb_array_clear_mm(array, free, baton) \
+	(((void *)(array).at != (void *)(array).inl ? (free)((baton), (array).at) : (void)0), \
+	 sb_array_init(array))
+
+/** Free spilled storage and reset to inline. */
+#define sb_array_clear(array) \
+	sb_array_clear_mm(array, array_std_free, NULL)
+
+/** Push value at the end of the array, spill out of inline storage if needed. */
+#define sb_array_push(array, val) \
+	(int)((array).len < (array).cap ? ((array).at[(array).len] = val, (array).len++) \
+		: (sb_array_reserve(array, ((array).cap + 1)) < 0 ? -1 \
+			: ((array).at[(array).len] = val, (array).len++)))
+
 /** @} */
@@ -17,10 +17,12 @@
  * @file lru.h
  * @brief LRU-like cache.
  *
- * @note This is a naive LRU implementation with a simple slot stickiness counting.
- *       Each write access increases stickiness on success, and decreases on collision.
- *       A slot is freed if the stickiness decreases to zero. This makes it less likely,
- *       that often-updated entries are jousted out of cache.
+ * @note Open addressing with a short linear probe window. Each key hashes to
+ *       a window of LRU_PROBE_LEN consecutive slots; the full hashes are kept
+ *       in a separate dense tag array, so probing scans tags without touching
+ *       slot memory or chasing the key pointer until a tag matches. On a full
+ *       window the least recently bumped slot is evicted, and hit/miss
+ *       counters are kept so the real hit rate can be observed.
  *
  * # Example usage:
  *
@@ -67,12 +69,17 @@
 
 #include <stdlib.h>
 #include <stdint.h>
-#include "contrib/murmurhash3/murmurhash3.h"
+#include "contrib/hash/hash.h"
+
+/** @brief Length of the linear probe window. */
+#ifndef LRU_PROBE_LEN
+#define LRU_PROBE_LEN 8
+#endif
 
 #define lru_slot_struct \
 	char *key;    /**< Slot key */ \
 	uint16_t len; /**< Slot length */ \
-	uint16_t refs; /**< Slot importance (#writes - #collisions) */ \
+	uint16_t refs; /**< Slot recency (bumped on access, saturating) */ \
 /** @brief Slot header. */
 struct lru_slot {
 	lru_slot_struct
@@ -95,6 +102,9 @@ typedef void (*lru_free_f)(void *baton, void *ptr);
 	uint32_t size;      /**< Number of slots */ \
 	uint32_t evictions; /**< Number of evictions. */ \
 	uint32_t stride;    /**< Stride of the 'slots' array */ \
+	uint32_t hits;      /**< Number of lookup hits. */ \
+	uint32_t misses;    /**< Number of lookup misses. */ \
+	uint32_t key_max;   /**< Inline key capacity; 0 = keys on the heap. */ \
 	lru_free_f evict;   /**< Eviction function */ \
 	void *baton;        /**< Passed to eviction function */
 /** @internal Object base of any other lru_hash type. */
@@ -113,6 +123,18 @@ struct { \
 	} slots[]; \
 }
 
+/** @internal Tag array with full hashes, laid out densely after the slots. */
+static inline uint32_t *lru_tag_base(struct lru_hash_base *lru)
+{
+	return (uint32_t *)(lru->slots + ((size_t)lru->size * lru->stride));
+}
+
+/** @internal Inline key arena, laid out after the tag array (key_max > 0 only). */
+static inline char *lru_key_base(struct lru_hash_base *lru)
+{
+	return (char *)(lru_tag_base(lru) + lru->size);
+}
+
 /** Get slot at given index. */
 static inline void *lru_slot_at(struct lru_hash_base *lru, uint32_t id)
 {
@@ -134,11 +156,24 @@ static inline void *lru_slot_get(struct lru_hash_base *lru, const char *key, uin
 	if (!lru || !key || len == 0) {
 		return NULL;
 	}
-	uint32_t id = hash(key, len) % lru->size;
-	struct lru_slot *slot = lru_slot_at(lru, id);
-	if (lru_slot_match(slot, key, len)) {
-		return lru_slot_val(slot, offset);
+	const uint32_t tag = hash_keyed(key, len);
+	const uint32_t *tags = lru_tag_base(lru);
+	const uint32_t base = tag % lru->size;
+	for (uint32_t i = 0; i < LRU_PROBE_LEN; ++i) {
+		const uint32_t id = (base + i) % lru->size;
+		if (tags[id] != tag) {
+			continue; /* Tag scan, no slot memory touched. */
+		}
+		struct lru_slot *slot = lru_slot_at(lru, id);
+		if (slot->key && lru_slot_match(slot, key, len)) {
+			if (slot->refs < UINT16_MAX) {
+				slot->refs += 1;
+			}
+			lru->hits += 1;
+			return lru_slot_val(slot, offset);
+		}
 	}
+	lru->misses += 1;
 	return NULL;
 }
 
@@ -149,11 +184,14 @@ static inline int lru_slot_evict(struct lru_hash_base *lru, uint32_t id, size_t
 		return -1;
 	}
 	lru->evictions += 1;
-	free(slot->key);
+	if (lru->key_max == 0) {
+		free(slot->key);
+	}
 	if (lru->evict) {
 		lru->evict(lru->baton, lru_slot_val(slot, offset));
 	}
 	memset(slot, 0, lru->stride);
+	lru_tag_base(lru)[id] = 0;
 	return 0;
 }
 
@@ -163,30 +201,72 @@ static inline void *lru_slot_set(struct lru_hash_base *lru, const char *key, uin
 	if (!lru || !key || len == 0) {
 		return NULL;
 	}
-	uint32_t id = hash(key, len) % lru->size;
-	struct lru_slot *slot = lru_slot_at(lru, id);
-	if (lru_slot_match(slot, key, len)) {
-		slot->refs += 1; /* Increase slot significance */
-	} else {
+	const uint32_t tag = hash_keyed(key, len);
+	uint32_t *tags = lru_tag_base(lru);
+	const uint32_t base = tag % lru->size;
+	struct lru_slot *best = NULL;
+	uint32_t best_id = 0;
+	for (uint32_t i = 0; i < LRU_PROBE_LEN; ++i) {
+		const uint32_t id = (base + i) % lru->size;
+		struct lru_slot *slot = lru_slot_at(lru, id);
 		if (slot->key) {
-			slot->refs -= 1; /* Decrease slot significance */
-			if (slot->refs > 0) {
-				return NULL; /* Couldn't joust former key. */
+			if (tags[id] == tag && lru_slot_match(slot, key, len)) {
+				if (slot->refs < UINT16_MAX) {
+					slot->refs += 1;
+				}
+				return lru_slot_val(slot, offset);
 			}
-			if (lru_slot_evict(lru, id, offset) < 0) {
-				return NULL;
+			/* Track the least recently bumped occupied slot. */
+			if (!best || (best->key && slot->refs < best->refs)) {
+				best = slot;
+				best_id = id;
 			}
+		} else if (!best || best->key) {
+			/* Free slot takes precedence over eviction. */
+			best = slot;
+			best_id = id;
 		}
-		memset(slot, 0, lru->stride);
-		slot->key = malloc(len);
-		if (!slot->key) {
+	}
+	if (best->key && lru_slot_evict(lru, best_id, offset) < 0) {
+		return NULL;
+	}
+	memset(best, 0, lru->stride);
+	if (lru->key_max > 0) {
+		if (len > lru->key_max) {
+			return NULL;
+		}
+		best->key = lru_key_base(lru) + (size_t)best_id * lru->key_max;
+	} else {
+		best->key = malloc(len);
+		if (!best->key) {
 			return NULL;
 		}
-		memcpy(slot->key, key, len);
-		slot->len = len;
-		slot->refs = 1;
 	}
-	return lru_slot_val(slot, offset);
+	memcpy(best->key, key, len);
+	best->len = len;
+	best->refs = 1;
+	tags[best_id] = tag;
+	return lru_slot_val(best, offset);
+}
+
+/** @internal Clear all slots but keep the table geometry and key mode. */
+static inline void lru_slot_reset(struct lru_hash_base *lru, size_t offset)
+{
+	for (uint32_t i = 0; i < lru->size; ++i) {
+		struct lru_slot *slot = lru_slot_at(lru, i);
+		if (!slot->key) {
+			continue;
+		}
+		if (lru->evict) {
+			lru->evict(lru->baton, lru_slot_val(slot, offset));
+		}
+		if (lru->key_max == 0) {
+			free(slot->key);
+		}
+		memset(slot, 0, lru->stride);
+	}
+	memset(lru_tag_base(lru), 0, (size_t)lru->size * sizeof(uint32_t));
+	lru->hits = lru->misses = lru->evictions = 0;
 }
 
 /**
@@ -195,7 +275,7 @@ static inline void *lru_slot_set(struct lru_hash_base *lru, const char *key, uin
  * @param  max_slots number of slots
  */
 #define lru_size(type, max_slots) \
-	(sizeof(type) + (max_slots) * sizeof(((type *)NULL)->slots[0]))
+	(sizeof(type) + (max_slots) * (sizeof(((type *)NULL)->slots[0]) + sizeof(uint32_t)))
 
 /**
  * @brief Initialize hash table.
@@ -203,9 +283,40 @@ static inline void *lru_slot_set(struct lru_hash_base *lru, const char *key, uin
  * @param max_slots number of slots
  */
 #define lru_init(table, max_slots) \
- (memset((table), 0, sizeof(*table) + (max_slots) * sizeof((table)->slots[0])), \
+ (memset((table), 0, sizeof(*table) + (max_slots) * (sizeof((table)->slots[0]) + sizeof(uint32_t))), \
   (table)->stride = sizeof((table)->slots[0]), (table)->size = (max_slots))
 
+/**
+ * @brief Size of the LRU with keys stored inline, @see lru_init_inline().
+ * @param  type      type of LRU structure
+ * @param  max_slots number of slots
+ * @param  key_max_  inline key capacity in bytes
+ */
+#define lru_size_inline(type, max_slots, key_max_) \
+	(lru_size(type, max_slots) + (size_t)(max_slots) * (key_max_))
+
+/**
+ * @brief Initialize hash table with an inline key arena.
+ *
+ * Keys up to key_max_ bytes are copied into an arena behind the tag array
+ * instead of the heap, so the table is one flat block: placed in an
+ * anonymous shared mapping created before fork(), it is inherited at the
+ * same address and usable from every fork. Updates are unsynchronised;
+ * a torn concurrent write reads back as a tag or key mismatch (a miss)
+ * and the slot simply gets overwritten, acceptable for approximate caches.
+ */
+#define lru_init_inline(table, max_slots, key_max_) \
+ (lru_init((table), (max_slots)), (table)->key_max = (key_max_), \
+  memset(lru_key_base((struct lru_hash_base *)(table)), 0, (size_t)(max_slots) * (key_max_)))
+
+/**
+ * @brief Evict all entries but keep the table initialized.
+ * Unlike lru_deinit() + lru_init(), this preserves the inline key mode.
+ * @param table hash table
+ */
+#define lru_reset(table) \
+	lru_slot_reset((struct lru_hash_base *)(table), lru_slot_offset(table))
+
 /**
  * @brief Free all keys and evict all values.
  * @param table hash table
@@ -216,7 +327,9 @@ static inline void *lru_slot_set(struct lru_hash_base *lru, const char *key, uin
 			if ((table)->evict) { \
 				(table)->evict((table)->baton, &(table)->slots[i].data); \
 			} \
-			free((table)->slots[i].key); \
+			if ((table)->key_max == 0) { \
+				free((table)->slots[i].key); \
+			} \
 		} \
 	} \
 }
@@ -1,19 +1,21 @@
 /*
- * critbit89 - A crit-bit tree implementation for strings in C89
- * Written by Jonas Gehring <jonas@jgehring.net>
- * Implemented key-value storing by Marek Vavrusa <marek.vavrusa@nic.cz>
+ * A qp-trie key-value map for strings.
+ * Based on the qp-trie design by Tony Finch <dot@dotat.at> (public domain),
+ * adapted to the original critbit89 map interface and allocator hooks.
  *
- * The code makes the assumption that malloc returns pointers aligned at at
- * least a two-byte boundary. Since the C standard requires that malloc return
- * pointers that can store any type, there are no commonly-used toolchains for
- * which this assumption is false.
+ * Branches test one nibble of the key at a time and keep their children in
+ * a popcount-compressed twig array, so a lookup touches a node per nibble
+ * of the shared prefix instead of a node per differing bit, and each node
+ * is a single allocation with the children laid out contiguously.
  *
- * See https://github.com/agl/critbit/blob/master/critbit.pdf for reference.
+ * The code makes the assumption that malloc returns pointers aligned at at
+ * least a two-byte boundary, the low pointer bit tags branch references.
  */
 
 #include <errno.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
 
 #include "map.h"
 
@@ -24,39 +26,60 @@
   #define EXPORT __attribute__ ((visibility ("default")))
 #endif
 
-#ifdef _MSC_VER /* MSVC */
- typedef unsigned __int8 uint8_t;
- typedef unsigned __int32 uint32_t;
- #ifdef _WIN64
-  typedef signed __int64 intptr_t;
- #else
-  typedef _W64 signed int intptr_t;
- #endif
-#else /* Not MSVC */
- #include <stdint.h>
-#endif
-
 typedef struct {
 	void* value;
 	uint8_t key[];
-} cb_data_t;
+} qp_leaf_t;
 
 typedef struct {
-	void *child[2];
-	uint32_t byte;
-	uint8_t otherbits;
-} cb_node_t;
-
-/* Return true if ptr is internal node. */
-static inline int ref_is_internal(uint8_t *p)
+	uint32_t index;  /* Byte offset tested in the key. */
+	uint16_t bitmap; /* Which nibble values have a twig. */
+	uint8_t shift;   /* 4 tests the upper nibble, 0 the lower. */
+	void *twigs[];   /* Popcount-compressed twig array. */
+} qp_node_t;
+
+/* Return true if ptr is a branch reference. */
+static inline int ref_is_branch(const uint8_t *p)
 {
 	return 1 & (intptr_t)p;
 }
 
-/* Get internal node. */
-static inline cb_node_t *ref_get_internal(uint8_t *p)
+/* Get branch node from its reference. */
+static inline qp_node_t *ref_get_branch(const uint8_t *p)
+{
+	return (qp_node_t *)(p - 1);
+}
+
+/* Make a reference from a branch node. */
+static inline void *ref_make_branch(qp_node_t *q)
+{
+	return (void *)(1 + (char *)q);
+}
+
+/* Extract the tested nibble from a key, bytes past the end read as zero.
+ * The terminating NUL is part of the key, so no key is a prefix of another. */
+static inline unsigned qp_nibble(const qp_node_t *q, const uint8_t *key, size_t len)
+{
+	uint8_t c = (q->index < len) ? key[q->index] : 0;
+	return (c >> q->shift) & 0xf;
+}
+
+/* Number of twigs in a branch. */
+static inline unsigned qp_width(const qp_node_t *q)
+{
+	return __builtin_popcount(q->bitmap);
+}
+
+/* Position of the twig for given nibble value. */
+static inline unsigned qp_twig(const qp_node_t *q, unsigned nib)
 {
-	return (cb_node_t *)(p - 1);
+	return __builtin_popcount(q->bitmap & ((1 << nib) - 1));
+}
+
+/* Ordering of tested positions, upper nibble comes first. */
+static inline uint64_t qp_pos(uint32_t index, uint8_t shift)
+{
+	return ((uint64_t)index << 1) | (shift == 0);
 }
 
 /* Standard memory allocation functions */
@@ -71,46 +94,44 @@ static void free_std(void *baton, void *ptr) {
 }
 
 /* Static helper functions */
-static void cbt_traverse_delete(map_t *map, void *top)
+static void qp_traverse_delete(map_t *map, void *top)
 {
 	uint8_t *p = top;
-	if (ref_is_internal(p)) {
-		cb_node_t *q = ref_get_internal(p);
-		cbt_traverse_delete(map, q->child[0]);
-		cbt_traverse_delete(map, q->child[1]);
+	if (ref_is_branch(p)) {
+		qp_node_t *q = ref_get_branch(p);
+		unsigned width = qp_width(q);
+		for (unsigned i = 0; i < width; ++i) {
+			qp_traverse_delete(map, q->twigs[i]);
+		}
 		map->free(map->baton, q);
 	} else {
 		map->free(map->baton, p);
 	}
 }
 
-static int cbt_traverse_prefixed(void *top,
+static int qp_traverse_prefixed(void *top,
 	int (*callback)(const char *, void *, void *), void *baton)
 {
 	uint8_t *p = top;
-	cb_data_t *x = (cb_data_t *)top;
-
-	if (ref_is_internal(p)) {
-		cb_node_t *q = ref_get_internal(p);
-		int ret = 0;
-
-		ret = cbt_traverse_prefixed(q->child[0], callback, baton);
-		if (ret != 0) {
-			return ret;
-		}
-		ret = cbt_traverse_prefixed(q->child[1], callback, baton);
-		if (ret != 0) {
-			return ret;
+	if (ref_is_branch(p)) {
+		qp_node_t *q = ref_get_branch(p);
+		unsigned width = qp_width(q);
+		for (unsigned i = 0; i < width; ++i) {
+			int ret = qp_traverse_prefixed(q->twigs[i], callback, baton);
+			if (ret != 0) {
+				return ret;
+			}
 		}
 		return 0;
 	}
 
+	qp_leaf_t *x = (qp_leaf_t *)p;
 	return (callback)((const char *)x->key, x->value, baton);
 }
 
-static cb_data_t *cbt_make_data(map_t *map, const uint8_t *str, size_t len, void *value)
+static qp_leaf_t *qp_make_leaf(map_t *map, const uint8_t *str, size_t len, void *value)
 {
-	cb_data_t *x = map->malloc(map->baton, sizeof(cb_data_t) + len);
+	qp_leaf_t *x = map->malloc(map->baton, sizeof(qp_leaf_t) + len);
 	if (x != NULL) {
 		x->value = value;
 		memcpy(x->key, str, len);
@@ -118,7 +139,21 @@ static cb_data_t *cbt_make_data(map_t *map, const uint8_t *str, size_t len, void
 	return x;
 }
 
-/*! Creates a new, empty critbit map */
+/* Descend to the leaf nearest to the key, any twig stands in
+ * when the key diverges from the trie on the way down. */
+static qp_leaf_t *qp_nearest_leaf(void *root, const uint8_t *ubytes, size_t ulen)
+{
+	uint8_t *p = root;
+	while (ref_is_branch(p)) {
+		qp_node_t *q = ref_get_branch(p);
+		unsigned nib = qp_nibble(q, ubytes, ulen);
+		unsigned i = (q->bitmap & (1 << nib)) ? qp_twig(q, nib) : 0;
+		p = q->twigs[i];
+	}
+	return (qp_leaf_t *)p;
+}
+
+/*! Creates a new, empty map */
 EXPORT map_t map_make(void)
 {
 	map_t map;
@@ -140,26 +175,21 @@ EXPORT void *map_get(map_t *map, const char *str)
 	const uint8_t *ubytes = (void *)str;
 	const size_t ulen = strlen(str);
 	uint8_t *p = map->root;
-	cb_data_t *x = NULL;
 
 	if (p == NULL) {
 		return NULL;
 	}
 
-	while (ref_is_internal(p)) {
-		cb_node_t *q = ref_get_internal(p);
-		uint8_t c = 0;
-		int direction;
-
-		if (q->byte < ulen) {
-			c = ubytes[q->byte];
+	while (ref_is_branch(p)) {
+		qp_node_t *q = ref_get_branch(p);
+		unsigned nib = qp_nibble(q, ubytes, ulen);
+		if (!(q->bitmap & (1 << nib))) {
+			return NULL;
 		}
-		direction = (1 + (q->otherbits | c)) >> 8;
-
-		p = q->child[direction];
+		p = q->twigs[qp_twig(q, nib)];
 	}
 
-	x = (cb_data_t *)p;
+	qp_leaf_t *x = (qp_leaf_t *)p;
 	if (strcmp(str, (const char *)x->key) == 0) {
 		return x->value;
 	}
@@ -172,99 +202,89 @@ EXPORT int map_set(map_t *map, const char *str, void *value)
 {
 	const uint8_t *const ubytes = (void *)str;
 	const size_t ulen = strlen(str);
-	uint8_t *p = map->root;
-	uint8_t c = 0, *x = NULL;
-	uint32_t newbyte = 0;
-	uint32_t newotherbits = 0;
-	int direction = 0, newdirection = 0;
-	cb_node_t *newnode = NULL;
-	cb_data_t *data = NULL;
-	void **wherep = NULL;
 
-	if (p == NULL) {
-		map->root = cbt_make_data(map, (const uint8_t *)str, ulen + 1, value);
+	if (map->root == NULL) {
+		map->root = qp_make_leaf(map, ubytes, ulen + 1, value);
 		if (map->root == NULL) {
 			return ENOMEM;
 		}
 		return 0;
 	}
 
-	while (ref_is_internal(p)) {
-		cb_node_t *q = ref_get_internal(p);
-		c = 0;
-		if (q->byte < ulen) {
-			c = ubytes[q->byte];
-		}
-		direction = (1 + (q->otherbits | c)) >> 8;
-
-		p = q->child[direction];
-	}
-
-	data = (cb_data_t *)p;
-	for (newbyte = 0; newbyte < ulen; ++newbyte) {
-		if (data->key[newbyte] != ubytes[newbyte]) {
-			newotherbits = data->key[newbyte] ^ ubytes[newbyte];
-			goto different_byte_found;
+	/* Find the nearest existing key and the first differing nibble. */
+	qp_leaf_t *data = qp_nearest_leaf(map->root, ubytes, ulen);
+	uint32_t newbyte = 0;
+	uint8_t a = 0, b = 0;
+	for (newbyte = 0; newbyte <= ulen; ++newbyte) {
+		a = data->key[newbyte];
+		b = ubytes[newbyte]; /* Includes the terminating NUL. */
+		if (a != b) {
+			break;
 		}
 	}
-
-	if (data->key[newbyte] != 0) {
-		newotherbits = data->key[newbyte];
-		goto different_byte_found;
-	}
-	data->value = value;
-	return 1;
-
-different_byte_found:
-	newotherbits |= newotherbits >> 1;
-	newotherbits |= newotherbits >> 2;
-	newotherbits |= newotherbits >> 4;
-	newotherbits = (newotherbits & ~(newotherbits >> 1)) ^ 255;
-	c = data->key[newbyte];
-	newdirection = (1 + (newotherbits | c)) >> 8;
-
-	newnode = map->malloc(map->baton, sizeof(cb_node_t));
-	if (newnode == NULL) {
-		return ENOMEM;
+	if (newbyte > ulen) {
+		data->value = value;
+		return 1;
 	}
+	const uint8_t newshift = ((a ^ b) & 0xf0) ? 4 : 0;
+	const unsigned newnib = (b >> newshift) & 0xf;
+	const unsigned oldnib = (a >> newshift) & 0xf;
+	const uint64_t newpos = qp_pos(newbyte, newshift);
 
-	x = (uint8_t *)cbt_make_data(map, ubytes, ulen + 1, value);
-	if (x == NULL) {
-		map->free(map->baton, newnode);
+	qp_leaf_t *leaf = qp_make_leaf(map, ubytes, ulen + 1, value);
+	if (leaf == NULL) {
 		return ENOMEM;
 	}
 
-	newnode->byte = newbyte;
-	newnode->otherbits = newotherbits;
-	newnode->child[1 - newdirection] = x;
-
-	/* Insert into map */
-	wherep = &map->root;
+	/* Walk down to the insertion point. */
+	void **wherep = &map->root;
 	for (;;) {
-		cb_node_t *q;
-		p = *wherep;
-		if (!ref_is_internal(p)) {
+		uint8_t *p = *wherep;
+		if (!ref_is_branch(p)) {
 			break;
 		}
-
-		q = ref_get_internal(p);
-		if (q->byte > newbyte) {
-			break;
-		}
-		if (q->byte == newbyte && q->otherbits > newotherbits) {
+		qp_node_t *q = ref_get_branch(p);
+		const uint64_t pos = qp_pos(q->index, q->shift);
+		if (pos > newpos) {
 			break;
 		}
-
-		c = 0;
-		if (q->byte < ulen) {
-			c = ubytes[q->byte];
+		if (pos == newpos) {
+			/* Branch tests the differing nibble, grow its twig array. */
+			unsigned width = qp_width(q);
+			qp_node_t *bigger = map->malloc(map->baton,
+				sizeof(*q) + (width + 1) * sizeof(void *));
+			if (bigger == NULL) {
+				map->free(map->baton, leaf);
+				return ENOMEM;
+			}
+			bigger->index = q->index;
+			bigger->shift = q->shift;
+			bigger->bitmap = q->bitmap | (1 << newnib);
+			unsigned at = qp_twig(bigger, newnib);
+			memcpy(bigger->twigs, q->twigs, at * sizeof(void *));
+			bigger->twigs[at] = leaf;
+			memcpy(bigger->twigs + at + 1, q->twigs + at,
+			       (width - at) * sizeof(void *));
+			*wherep = ref_make_branch(bigger);
+			map->free(map->baton, q);
+			return 0;
 		}
-		direction = (1 + (q->otherbits | c)) >> 8;
-		wherep = q->child + direction;
+		/* The nearest leaf shares this prefix, so the twig exists. */
+		wherep = &q->twigs[qp_twig(q, qp_nibble(q, ubytes, ulen))];
 	}
 
-	newnode->child[newdirection] = *wherep;
-	*wherep = (void *)(1 + (char *)newnode);
+	/* Split here with a fresh two-twig branch. */
+	qp_node_t *newnode = map->malloc(map->baton, sizeof(*newnode) + 2 * sizeof(void *));
+	if (newnode == NULL) {
+		map->free(map->baton, leaf);
+		return ENOMEM;
+	}
+	newnode->index = newbyte;
+	newnode->shift = newshift;
+	newnode->bitmap = (1 << newnib) | (1 << oldnib);
+	newnode->twigs[newnib < oldnib ? 0 : 1] = leaf;
+	newnode->twigs[newnib < oldnib ? 1 : 0] = *wherep;
+	*wherep = ref_make_branch(newnode);
 	return 0;
 }
 
@@ -274,42 +294,59 @@ EXPORT int map_del(map_t *map, const char *str)
 	const uint8_t *ubytes = (void *)str;
 	const size_t ulen = strlen(str);
 	uint8_t *p = map->root;
-	void **wherep = NULL, **whereq = NULL;
-	cb_node_t *q = NULL;
-	cb_data_t *data = NULL;
-	int direction = 0;
+	void **wherep = &map->root;
+	qp_node_t *q = NULL;
+	unsigned twig = 0;
 
-	if (map->root == NULL) {
+	if (p == NULL) {
 		return 1;
 	}
-	wherep = &map->root;
-
-	while (ref_is_internal(p)) {
-		uint8_t c = 0;
-		whereq = wherep;
-		q = ref_get_internal(p);
 
-		if (q->byte < ulen) {
-			c = ubytes[q->byte];
+	while (ref_is_branch(p)) {
+		q = ref_get_branch(p);
+		unsigned nib = qp_nibble(q, ubytes, ulen);
+		if (!(q->bitmap & (1 << nib))) {
+			return 1;
 		}
-		direction = (1 + (q->otherbits | c)) >> 8;
-		wherep = q->child + direction;
+		twig = qp_twig(q, nib);
+		wherep = &q->twigs[twig];
 		p = *wherep;
 	}
 
-	data = (cb_data_t *)p;
+	qp_leaf_t *data = (qp_leaf_t *)p;
 	if (strcmp(str, (const char *)data->key) != 0) {
 		return 1;
 	}
 	map->free(map->baton, p);
 
-	if (!whereq) {
+	if (!q) {
 		map->root = NULL;
 		return 0;
 	}
 
-	*whereq = q->child[1 - direction];
-	map->free(map->baton, q);
+	unsigned width = qp_width(q);
+	if (width == 2) {
+		/* Collapse the branch into the remaining twig.
+		 * Find its reference from the parent again. */
+		void *rest = q->twigs[1 - twig];
+		void **parentp = &map->root;
+		while (*parentp != ref_make_branch(q)) {
+			qp_node_t *n = ref_get_branch(*parentp);
+			parentp = &n->twigs[qp_twig(n, qp_nibble(n, ubytes, ulen))];
+		}
+		*parentp = rest;
+		map->free(map->baton, q);
+		return 0;
+	}
+	/* Shrink the twig array in place, stale capacity is kept. */
+	for (unsigned nib = 0; nib < 16; ++nib) {
+		if ((q->bitmap & (1 << nib)) && qp_twig(q, nib) == twig) {
+			q->bitmap &= ~(1 << nib);
+			break;
+		}
+	}
+	memmove(q->twigs + twig, q->twigs + twig + 1,
+	        (width - twig - 1) * sizeof(void *));
 	return 0;
 }
 
@@ -317,7 +354,7 @@ EXPORT int map_del(map_t *map, const char *str)
 EXPORT void map_clear(map_t *map)
 {
 	if (map->root) {
-		cbt_traverse_delete(map, map->root);
+		qp_traverse_delete(map, map->root);
 	}
 	map->root = NULL;
 }
@@ -329,33 +366,33 @@ EXPORT int map_walk_prefixed(map_t *map, const char *prefix,
 	const uint8_t *ubytes = (void *)prefix;
 	const size_t ulen = strlen(prefix);
 	uint8_t *p = map->root;
-	uint8_t *top = (uint8_t *)p;
-	cb_data_t *data = NULL;
+	uint8_t *top = p;
 
 	if (p == NULL) {
 		return 0;
 	}
 
-	while (ref_is_internal(p)) {
-		cb_node_t *q = ref_get_internal(p);
-		uint8_t c = 0;
-		int direction;
-
-		if (q->byte < ulen) {
-			c = ubytes[q->byte];
-		}
-		direction = (1 + (q->otherbits | c)) >> 8;
-
-		p = q->child[direction];
-		if (q->byte < ulen) {
+	while (ref_is_branch(p)) {
+		qp_node_t *q = ref_get_branch(p);
+		if (q->index < ulen) {
+			/* Position determined by the prefix, follow it. */
+			unsigned nib = qp_nibble(q, ubytes, ulen);
+			if (!(q->bitmap & (1 << nib))) {
+				return 0; /* No strings match */
+			}
+			p = q->twigs[qp_twig(q, nib)];
 			top = p;
+		} else {
+			/* Whole subtrie shares the prefix bytes, any
+			 * twig leads to a representative leaf. */
+			p = q->twigs[0];
 		}
 	}
 
-	data = (cb_data_t *)p;
+	qp_leaf_t *data = (qp_leaf_t *)p;
 	if (strlen((const char *)data->key) < ulen || memcmp(data->key, prefix, ulen) != 0) {
 		return 0; /* No strings match */
 	}
 
-	return cbt_traverse_prefixed(top, callback, baton);
+	return qp_traverse_prefixed(top, callback, baton);
 }
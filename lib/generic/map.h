@@ -1,11 +1,14 @@
 /*
- * critbit89 - A crit-bit map implementation for strings in C89
- * Written by Jonas Gehring <jonas@jgehring.net>
+ * A qp-trie key-value map for strings, after the critbit89 interface
+ * by Jonas Gehring <jonas@jgehring.net>.
  */
 
 /**
  * @file map.h
- * @brief A Crit-bit tree key-value map implementation.
+ * @brief A qp-trie key-value map implementation.
+ *
+ * Branches test a nibble at a time with popcount-compressed children,
+ * so lookups chase a pointer per differing nibble rather than per bit.
  *
  * @warning If the user provides a custom allocator, it must return addresses aligned to 2B boundary.
  *
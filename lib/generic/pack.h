@@ -70,6 +70,24 @@ typedef uint16_t pack_objlen_t;
 /** Pack is defined as an array of bytes */
 typedef array_t(uint8_t) pack_t;
 
+/** Pack with 'bytes' of inline storage before spilling, see sb_array_t().
+  * The leading members mirror pack_t, so a pointer to it can be treated
+  * as pack_t for everything except init/reserve/clear. */
+#define pack_sb_t(bytes) sb_array_t(uint8_t, bytes)
+
+/** View a small-buffer pack as a plain pack. */
+#define pack_sb(pack) ((pack_t *)(pack))
+
+/** Initialize a small-buffer pack. */
+#define pack_sb_init(pack) \
+	sb_array_init(pack)
+/** @internal Clear a small-buffer pack with a callback. */
+#define pack_sb_clear_mm(pack, free, baton) \
+	sb_array_clear_mm((pack), (free), (baton))
+/** @internal Small-buffer reservation with a callback. */
+#define pack_sb_reserve_mm(pack, objs_count, objs_len, reserve, baton) \
+	sb_array_reserve_mm((pack), (pack).len + (sizeof(pack_objlen_t)*(objs_count) + (objs_len)), (reserve), (baton))
+
 /** Zero-initialize the pack. */
 #define pack_init(pack) \
 	array_init(pack)
@@ -0,0 +1,191 @@
+/*  Copyright (C) 2016 CZ.NIC, z.s.p.o. <knot-dns@labs.nic.cz>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/**
+ * @file queue.h
+ * @brief Bounded lock-free multi-producer single-consumer queue.
+ *
+ * @note The queue is a ring of slots guarded by sequence numbers. Producers
+ *       claim a ticket with a compare-and-swap on the tail, copy the value in
+ *       and publish the slot; the single consumer reads the head without any
+ *       atomic operation. Values are copied in and out, so the queue is
+ *       suitable for small items like pointers or handles. The structure is
+ *       self-contained (no internal allocation), so it may also be placed in
+ *       shared memory.
+ *
+ * # Example usage:
+ *
+ * @code{.c}
+ * 	// Define new queue type
+ * 	typedef queue_t(struct job *) job_queue_t;
+ *
+ * 	// Create a queue for at least 512 jobs
+ * 	job_queue_t *q = malloc(queue_size(job_queue_t, 512));
+ * 	queue_init(q, 512);
+ *
+ * 	// Producer threads hand over work and wake the event loop,
+ * 	// e.g. with a uv_async_t registered on the consumer's loop:
+ * 	if (queue_push(q, &job) == 0) {
+ * 		uv_async_send(&async); // else the queue is full, handle locally
+ * 	}
+ *
+ * 	// Consumer, in the uv_async_t callback on the loop thread:
+ * 	struct job *job = NULL;
+ * 	while (queue_pop(q, &job) == 0) {
+ * 		process(job);
+ * 	}
+ *
+ * 	// We're done
+ * 	free(q);
+ * @endcode
+ *
+ * \addtogroup generics
+ * @{
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** @brief Queue structure base. */
+#define queue_struct \
+	size_t cap;  /**< Number of slots, a power of two. */ \
+	size_t tail; /**< Producer ticket, claimed with CAS. */ \
+	size_t head; /**< Consumer position, single reader. */
+/** @internal Object base of any other queue type. */
+struct queue_base {
+	queue_struct
+	char slots[];
+};
+
+/** @brief User-defined queue. */
+#define queue_t(type) \
+struct { \
+	queue_struct \
+	struct { \
+		size_t seq; /**< Slot state, see queue_slot_push(). */ \
+		type val; \
+	} slots[]; \
+}
+
+#define queue_slot_offset(q) \
+	(size_t)((void *)&((q)->slots[0].val) - (void *)&((q)->slots[0]))
+
+/** @internal Round up to the next power of two, at least 4. */
+static inline size_t queue_pow2(size_t want)
+{
+	size_t n = 4;
+	while (n < want) {
+		n *= 2;
+	}
+	return n;
+}
+
+/** @internal Slot at ring position. */
+static inline size_t *queue_slot_at(struct queue_base *q, size_t stride, size_t pos)
+{
+	return (size_t *)(q->slots + (pos & (q->cap - 1)) * stride);
+}
+
+/** @internal Claim a producer ticket, copy the value in and publish the slot.
+ * A slot is free for ticket N while its sequence equals N, and holds a value
+ * for the consumer once it equals N + 1. Any thread may produce. */
+static inline int queue_slot_push(struct queue_base *q, size_t stride, size_t offset,
+                                  const void *val, size_t val_size)
+{
+	size_t pos = q->tail;
+	for (;;) {
+		size_t *seq = queue_slot_at(q, stride, pos);
+		__sync_synchronize();
+		intptr_t dif = (intptr_t)*seq - (intptr_t)pos;
+		if (dif == 0) {
+			if (__sync_bool_compare_and_swap(&q->tail, pos, pos + 1)) {
+				memcpy((char *)seq + offset, val, val_size);
+				__sync_synchronize();
+				*seq = pos + 1;
+				return 0;
+			}
+		} else if (dif < 0) {
+			return -1; /* Full. */
+		}
+		pos = q->tail;
+	}
+}
+
+/** @internal Copy the oldest value out and recycle the slot.
+ * Only a single consumer thread may pop. */
+static inline int queue_slot_pop(struct queue_base *q, size_t stride, size_t offset,
+                                 void *dst, size_t val_size)
+{
+	size_t pos = q->head;
+	size_t *seq = queue_slot_at(q, stride, pos);
+	if ((intptr_t)*seq - (intptr_t)(pos + 1) < 0) {
+		return -1; /* Empty. */
+	}
+	__sync_synchronize();
+	memcpy(dst, (char *)seq + offset, val_size);
+	__sync_synchronize();
+	*seq = pos + q->cap; /* Free for the producer one revolution later. */
+	q->head = pos + 1;
+	return 0;
+}
+
+/**
+ * @brief Calculate size of the queue structure.
+ * @param type queue type
+ * @param max_slots number of slots, rounded up to a power of two
+ */
+#define queue_size(type, max_slots) \
+	(sizeof(type) + queue_pow2(max_slots) * sizeof(((type *)NULL)->slots[0]))
+
+/**
+ * @brief Initialize the queue on caller-provided memory.
+ * @param q queue
+ * @param max_slots number of slots, rounded up to a power of two
+ */
+#define queue_init(q, max_slots) do { \
+	(q)->cap = queue_pow2(max_slots); \
+	(q)->tail = (q)->head = 0; \
+	for (size_t i = 0; i < (q)->cap; ++i) { \
+		(q)->slots[i].seq = i; \
+	} \
+} while (0)
+
+/**
+ * @brief Push a value, any thread may call this.
+ * @param q queue
+ * @param val_ptr pointer to the value to be copied in
+ * @return 0 if successful, negative integer if the queue is full
+ */
+#define queue_push(q, val_ptr) \
+	queue_slot_push((struct queue_base *)(q), sizeof((q)->slots[0]), \
+	                queue_slot_offset(q), (val_ptr), sizeof((q)->slots[0].val))
+
+/**
+ * @brief Pop the oldest value, only the single consumer may call this.
+ * @param q queue
+ * @param dst_ptr pointer the value is copied to
+ * @return 0 if successful, negative integer if the queue is empty
+ */
+#define queue_pop(q, dst_ptr) \
+	queue_slot_pop((struct queue_base *)(q), sizeof((q)->slots[0]), \
+	               queue_slot_offset(q), (dst_ptr), sizeof((q)->slots[0].val))
+
+/** @brief Approximate number of queued values (exact only for the consumer). */
+#define queue_count(q) ((q)->tail - (q)->head)
+
+/** @} */
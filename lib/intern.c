@@ -0,0 +1,99 @@
+/*  Copyright (C) 2016 CZ.NIC, z.s.p.o. <knot-dns@labs.nic.cz>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "lib/intern.h"
+#include "lib/utils.h"
+#include "contrib/hash/hash.h"
+
+/** Initial number of slots, must be a power of two. */
+#define INTERN_MINSIZE 16
+
+void kr_dname_intern_init(struct kr_dname_intern *tbl, knot_mm_t *pool)
+{
+	if (!tbl) {
+		return;
+	}
+	memset(tbl, 0, sizeof(*tbl));
+	tbl->pool = pool;
+}
+
+/** Hash the lowercased wire name, names interned equal must hash equal. */
+static uint32_t intern_hash(const knot_dname_t *name, size_t len)
+{
+	uint8_t low[KNOT_DNAME_MAXLEN];
+	memcpy(low, name, len);
+	kr_bytes_tolower(low, len);
+	return hash_keyed((const char *)low, len);
+}
+
+/** Insert into the table, the caller guarantees a free slot exists. */
+static void intern_insert(knot_dname_t **slots, uint32_t size, knot_dname_t *name)
+{
+	uint32_t id = intern_hash(name, knot_dname_size(name)) & (size - 1);
+	while (slots[id]) {
+		id = (id + 1) & (size - 1);
+	}
+	slots[id] = name;
+}
+
+/** Grow (or create) the slot table. The old one stays in the pool. */
+static int intern_grow(struct kr_dname_intern *tbl)
+{
+	const uint32_t next_size = tbl->size > 0 ? tbl->size * 2 : INTERN_MINSIZE;
+	knot_dname_t **next = mm_alloc(tbl->pool, next_size * sizeof(*next));
+	if (!next) {
+		return kr_error(ENOMEM);
+	}
+	memset(next, 0, next_size * sizeof(*next));
+	for (uint32_t i = 0; i < tbl->size; ++i) {
+		if (tbl->slots[i]) {
+			intern_insert(next, next_size, tbl->slots[i]);
+		}
+	}
+	mm_free(tbl->pool, tbl->slots);
+	tbl->slots = next;
+	tbl->size = next_size;
+	return kr_ok();
+}
+
+knot_dname_t *kr_dname_intern(struct kr_dname_intern *tbl, const knot_dname_t *name)
+{
+	if (!tbl || !name) {
+		return NULL;
+	}
+	/* Keep the table under 3/4 full; degrade to a plain copy when
+	 * it cannot grow, the caller never has to care. */
+	if (4 * (tbl->used + 1) > 3 * tbl->size && intern_grow(tbl) != 0) {
+		return knot_dname_copy(name, tbl->pool);
+	}
+	const int len = knot_dname_size(name);
+	uint32_t id = intern_hash(name, len) & (tbl->size - 1);
+	while (tbl->slots[id]) {
+		if (kr_dname_equal_fold(tbl->slots[id], name)) {
+			return tbl->slots[id];
+		}
+		id = (id + 1) & (tbl->size - 1);
+	}
+	knot_dname_t *copy = knot_dname_copy(name, tbl->pool);
+	if (!copy) {
+		return NULL;
+	}
+	tbl->slots[id] = copy;
+	tbl->used += 1;
+	return copy;
+}
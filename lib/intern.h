@@ -0,0 +1,57 @@
+/*  Copyright (C) 2016 CZ.NIC, z.s.p.o. <knot-dns@labs.nic.cz>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <libknot/dname.h>
+
+#include "lib/defines.h"
+
+/**
+ * Per-request dname intern table.
+ *
+ * Deduplicates owner name copies made into the request mempool, so the
+ * same name interned twice yields the same canonical pointer and equality
+ * checks may compare pointers first. Names are matched case-insensitively,
+ * the first interned spelling wins.
+ *
+ * The table is open-addressed and mempool-backed; it is never freed
+ * explicitly, it goes away with the request pool. Interned names are
+ * shared: callers must not modify or free them.
+ */
+struct kr_dname_intern {
+	knot_dname_t **slots; /**< Open-addressed table, power-of-two size. */
+	uint32_t size;        /**< Number of slots. */
+	uint32_t used;        /**< Number of occupied slots. */
+	knot_mm_t *pool;      /**< Backing memory pool. */
+};
+
+/**
+ * Initialize an empty intern table over given pool.
+ * @param tbl  intern table
+ * @param pool backing pool (request mempool)
+ */
+KR_EXPORT
+void kr_dname_intern_init(struct kr_dname_intern *tbl, knot_mm_t *pool);
+
+/**
+ * Return the canonical pooled copy of the name, creating it if needed.
+ * Falls back to a plain pooled copy when the table cannot grow, so the
+ * result is usable whenever knot_dname_copy() would be.
+ * @return canonical copy or NULL on allocation failure
+ */
+KR_EXPORT
+knot_dname_t *kr_dname_intern(struct kr_dname_intern *tbl, const knot_dname_t *name);
@@ -24,6 +24,7 @@
 #include "lib/layer/iterate.h"
 #include "lib/resolve.h"
 #include "lib/rplan.h"
+#include "lib/utils.h"
 #include "lib/defines.h"
 #include "lib/nsrep.h"
 #include "lib/module.h"
@@ -43,12 +44,13 @@ static const knot_dname_t *minimized_qname(struct kr_query *query, uint16_t *qty
 		return qname;
 	}
 
-	/* Minimize name to contain current zone cut + 1 label. */
+	/* Minimize name to contain current zone cut + 1 label.
+	 * Label boundaries are precomputed in sname_view, so stripping
+	 * is an offset jump instead of a label-by-label walk. */
 	int cut_labels = knot_dname_labels(query->zone_cut.name, NULL);
-	int qname_labels = knot_dname_labels(qname, NULL);
-	while(qname[0] && qname_labels > cut_labels + 1) {
-		qname = knot_wire_next_label(qname, NULL);
-		qname_labels -= 1;
+	int strip = (int)query->sname_view.labels - (cut_labels + 1);
+	if (strip > 0 && strip < query->sname_view.labels) {
+		qname += query->sname_view.label_off[strip];
 	}
 
 	/* Hide QTYPE if minimized. */
@@ -69,7 +71,7 @@ static bool is_paired_to_query(const knot_pkt_t *answer, struct kr_query *query)
 	       knot_wire_get_qdcount(answer->wire) > 0 &&
 	       (query->sclass == KNOT_CLASS_ANY || query->sclass  == knot_pkt_qclass(answer)) &&
 	       qtype          == knot_pkt_qtype(answer) &&
-	       knot_dname_is_equal(qname, knot_pkt_qname(answer));
+	       kr_dname_equal_fold(qname, knot_pkt_qname(answer));
 }
 
 /** Relaxed rule for AA, either AA=1 or SOA matching zone cut is required. */
@@ -89,7 +91,7 @@ static bool is_authoritative(const knot_pkt_t *answer, struct kr_query *query)
 
 #ifndef STRICT_MODE
 	/* Last resort to work around broken auths, if the zone cut is at/parent of the QNAME. */
-	if (knot_dname_is_equal(query->zone_cut.name, knot_pkt_qname(answer))) {
+	if (kr_dname_equal_fold(query->zone_cut.name, knot_pkt_qname(answer))) {
 		return true;
 	}
 #endif
@@ -180,7 +182,7 @@ static void fetch_glue(knot_pkt_t *pkt, const knot_dname_t *ns, struct kr_reques
 		const knot_pktsection_t *sec = knot_pkt_section(pkt, i);
 		for (unsigned k = 0; k < sec->count; ++k) {
 			const knot_rrset_t *rr = knot_pkt_rr(sec, k);
-			if (knot_dname_is_equal(ns, rr->owner)) {
+			if (kr_dname_equal_fold(ns, rr->owner)) {
 				(void) update_nsaddr(rr, req->current_query);
 				used_glue = true;
 			}
@@ -202,7 +204,7 @@ static int has_glue(knot_pkt_t *pkt, const knot_dname_t *ns)
 		const knot_pktsection_t *sec = knot_pkt_section(pkt, i);
 		for (unsigned k = 0; k < sec->count; ++k) {
 			const knot_rrset_t *rr = knot_pkt_rr(sec, k);
-			if (knot_dname_is_equal(ns, rr->owner) &&
+			if (kr_dname_equal_fold(ns, rr->owner) &&
 			    (rr->type == KNOT_RRTYPE_A || rr->type == KNOT_RRTYPE_AAAA)) {
 				return 1;
 			}
@@ -236,7 +238,7 @@ static int update_cut(knot_pkt_t *pkt, const knot_rrset_t *rr, struct kr_request
 	/* Remember current bailiwick for NS processing. */
 	const knot_dname_t *current_cut = cut->name;
 	/* Update zone cut name */
-	if (!knot_dname_is_equal(rr->owner, cut->name)) {
+	if (!kr_dname_equal_fold(rr->owner, cut->name)) {
 		/* Remember parent cut and descend to new (keep keys and TA). */
 		struct kr_zonecut *parent = mm_alloc(&req->pool, sizeof(*parent));
 		if (parent) {
@@ -317,7 +319,7 @@ static int process_authority(knot_pkt_t *pkt, struct kr_request *req)
 			}
 		} else if (rr->type == KNOT_RRTYPE_SOA && knot_dname_is_sub(rr->owner, qry->zone_cut.name)) {
 			/* SOA below cut in authority indicates different authority, but same NS set. */
-			qry->zone_cut.name = knot_dname_copy(rr->owner, &req->pool);
+			qry->zone_cut.name = kr_dname_intern(&req->intern, rr->owner);
 		}
 	}
 
@@ -375,7 +377,7 @@ static int process_answer(knot_pkt_t *pkt, struct kr_request *req)
 	 */
 	bool is_final = (query->parent == NULL);
 	int pkt_class = kr_response_classify(pkt);
-	if (!knot_dname_is_equal(knot_pkt_qname(pkt), query->sname) &&
+	if (!kr_dname_equal_fold(knot_pkt_qname(pkt), query->sname) &&
 	    (pkt_class & (PKT_NOERROR|PKT_NXDOMAIN|PKT_REFUSED|PKT_NODATA))) {
 		DEBUG_MSG("<= found cut, retrying with non-minimized name\n");
 		query->flags |= QUERY_NO_MINIMIZE;
@@ -406,12 +408,12 @@ static int process_answer(knot_pkt_t *pkt, struct kr_request *req)
 		can_follow = !(query->flags & QUERY_DNSSEC_WANT) || (query->flags & QUERY_STUB);
 		for (unsigned i = 0; i < an->count; ++i) {
 			const knot_rrset_t *rr = knot_pkt_rr(an, i);
-			if (!knot_dname_is_equal(rr->owner, cname)) {
+			if (!kr_dname_equal_fold(rr->owner, cname)) {
 				continue;
 			}
 			/* Process records matching current SNAME */
 			unsigned hint = 0;
-			if(knot_dname_is_equal(cname, knot_pkt_qname(req->answer))) {
+			if(kr_dname_equal_fold(cname, knot_pkt_qname(req->answer))) {
 				hint = KNOT_COMPR_HINT_QNAME;
 			}
 			int state = is_final ? update_answer(rr, hint, req->answer) : update_parent(rr, query);
@@ -452,13 +454,13 @@ static int process_answer(knot_pkt_t *pkt, struct kr_request *req)
 	/* Either way it resolves current query. */
 	query->flags |= QUERY_RESOLVED;
 	/* Follow canonical name as next SNAME. */
-	if (!knot_dname_is_equal(cname, query->sname)) {
+	if (!kr_dname_equal_fold(cname, query->sname)) {
 		/* Check if target record has been already copied */
 		if (is_final) {
 			const knot_pktsection_t *an = knot_pkt_section(req->answer, KNOT_ANSWER);
 			for (unsigned i = 0; i < an->count; ++i) {
 				const knot_rrset_t *rr = knot_pkt_rr(an, i);
-				if (!knot_dname_is_equal(rr->owner, cname)) {
+				if (!kr_dname_equal_fold(rr->owner, cname)) {
 					continue;
 				}
 				if ((rr->rclass != query->sclass) ||
@@ -475,7 +477,7 @@ static int process_answer(knot_pkt_t *pkt, struct kr_request *req)
 			struct kr_query * q = req->rplan.resolved.at[i];
 			if (q->sclass == query->sclass &&
 			    q->stype == query->stype   &&
-			    knot_dname_is_equal(q->sname, cname)) {
+			    kr_dname_equal_fold(q->sname, cname)) {
 				DEBUG_MSG("<= cname chain loop\n");
 				return KNOT_STATE_FAIL;
 			}
@@ -540,7 +542,9 @@ int kr_make_query(struct kr_query *query, knot_pkt_t *pkt)
 	}
 
 	/* Query built, expect answer. */
-	query->id = kr_rand_uint(UINT16_MAX);
+	uint16_t id = 0;
+	kr_rand_bytes((uint8_t *)&id, sizeof(id));
+	query->id = id;
 	knot_wire_set_id(pkt->wire, query->id);
 	pkt->parsed = pkt->size;
 	return kr_ok();
@@ -595,7 +599,7 @@ static int resolve(knot_layer_t *ctx, knot_pkt_t *pkt)
 	/* Check for packet processing errors first.
 	 * Note - we *MUST* check if it has at least a QUESTION,
 	 * otherwise it would crash on accessing QNAME. */
-	if (pkt->parsed < pkt->size || pkt->parsed <= KNOT_WIRE_HEADER_SIZE) {
+	if (pkt->parsed <= KNOT_WIRE_HEADER_SIZE) {
 		DEBUG_MSG("<= malformed response\n");
 		return resolve_badmsg(pkt, req, query);
 	} else if (!is_paired_to_query(pkt, query)) {
@@ -617,6 +621,35 @@ static int resolve(knot_layer_t *ctx, knot_pkt_t *pkt)
 		return KNOT_STATE_CONSUME;
 	}
 
+	/* Verify the randomized QNAME case survived the round trip; the consume
+	 * path has decoded it back already, so a faithful echo compares equal
+	 * to the sent name byte for byte (the cheap folded compare above only
+	 * proves it's the same name).  A mismatch is either a spoof attempt or
+	 * a server rewriting the case - remember the server and ask again
+	 * without the randomization instead of failing hard. */
+	if (query->secret != 0) {
+		uint16_t qtype = query->stype;
+		const knot_dname_t *sent = minimized_qname(query, &qtype);
+		const knot_dname_t *echoed = knot_pkt_qname(pkt);
+		if (echoed && memcmp(sent, echoed, knot_dname_size(sent)) != 0) {
+			DEBUG_MSG("<= QNAME case mismatch, disabling 0x20 for this server\n");
+			query->ns.reputation |= KR_NS_NOCASE;
+			kr_nsrep_update_rep(&query->ns, query->ns.reputation, req->ctx->cache_rep);
+			return KNOT_STATE_CONSUME;
+		}
+	}
+
+	/* The answer arrived with only its question parsed (see the daemon),
+	 * fill in the sections now that the cheap checks have passed.
+	 * Spoofed, truncated and misdirected responses never pay this cost. */
+	if (pkt->parsed < pkt->size) {
+		if (knot_pkt_parse_payload(pkt, 0) != KNOT_EOK ||
+		    pkt->parsed < pkt->size) {
+			DEBUG_MSG("<= malformed response\n");
+			return resolve_badmsg(pkt, req, query);
+		}
+	}
+
 #ifndef NDEBUG
 	const knot_lookup_t *rcode = knot_lookup_by_id(knot_rcode_names, knot_wire_get_rcode(pkt->wire));
 #endif
@@ -233,16 +233,46 @@ static int pktcache_stash(knot_layer_t *ctx, knot_pkt_t *pkt)
 	if (ret == 0) {
 		DEBUG_MSG(qry, "=> answer cached for TTL=%u\n", ttl);
 	}
-	kr_cache_sync(cache);
+	/* The insert is committed by the backend in batches. */
 	return ctx->state;
 }
 
+
+/** @internal Scope the shared cache to the request's client subnet for the
+  * duration of one layer call.  Only the primary query chain is partitioned;
+  * infrastructure subqueries keep using the shared (unscoped) entries. */
+static int scoped_pktcache_peek(knot_layer_t *ctx, knot_pkt_t *pkt)
+{
+	struct kr_request *req = ctx->data;
+	struct kr_query *qry = req->current_query;
+	struct kr_cache *cache = &req->ctx->cache;
+	if (req->ecs.source_len > 0 && qry && qry->parent == NULL) {
+		kr_cache_scope_set(cache, req->ecs.addr, req->ecs.source_len);
+	}
+	int state = pktcache_peek(ctx, pkt);
+	kr_cache_scope_set(cache, NULL, 0);
+	return state;
+}
+
+static int scoped_pktcache_stash(knot_layer_t *ctx, knot_pkt_t *pkt)
+{
+	struct kr_request *req = ctx->data;
+	struct kr_query *qry = req->current_query;
+	struct kr_cache *cache = &req->ctx->cache;
+	if (req->ecs.source_len > 0 && qry && qry->parent == NULL) {
+		kr_cache_scope_set(cache, req->ecs.addr, req->ecs.source_len);
+	}
+	int state = pktcache_stash(ctx, pkt);
+	kr_cache_scope_set(cache, NULL, 0);
+	return state;
+}
+
 /** Module implementation. */
 const knot_layer_api_t *pktcache_layer(struct kr_module *module)
 {
 	static const knot_layer_api_t _layer = {
-		.produce = &pktcache_peek,
-		.consume = &pktcache_stash
+		.produce = &scoped_pktcache_peek,
+		.consume = &scoped_pktcache_stash
 	};
 
 	return &_layer;
@@ -21,9 +21,12 @@
 #include <libknot/rrset.h>
 #include <libknot/rrtype/rrsig.h>
 #include <libknot/rrtype/rdname.h>
+#include <libknot/rrtype/nsec.h>
 #include <ucw/config.h>
 #include <ucw/lib.h>
 
+#include "contrib/wire.h"
+#include "lib/dnssec/nsec.h"
 #include "lib/layer/iterate.h"
 #include "lib/cache.h"
 #include "lib/module.h"
@@ -32,6 +35,7 @@
 
 #define DEBUG_MSG(qry, fmt...) QRDEBUG((qry), " rc ",  fmt)
 #define DEFAULT_MINTTL (5) /* Short-time "no data" retention to avoid bursts */
+#define DEFAULT_STALETTL (30) /* TTL given to records served past expiration */
 
 /** Record is expiring if it has less than 1% TTL (or less than 5s) */
 static inline bool is_expiring(const knot_rrset_t *rr, uint32_t drift)
@@ -39,9 +43,80 @@ static inline bool is_expiring(const knot_rrset_t *rr, uint32_t drift)
 	return 100 * (drift + 5) > 99 * knot_rrset_ttl(rr);
 }
 
+/** @internal Skip a possibly compressed dname in wire, returns next offset or 0. */
+static size_t skip_dname(const uint8_t *wire, size_t pos, size_t max)
+{
+	while (pos < max) {
+		const uint8_t label = wire[pos];
+		if (label == 0) {
+			return pos + 1;
+		}
+		if ((label & 0xc0) == 0xc0) { /* Compression pointer ends the name. */
+			return pos + 2 <= max ? pos + 2 : 0;
+		}
+		pos += 1 + label;
+	}
+	return 0;
+}
+
+/** @internal Decay TTLs of records appended at given wire position. */
+static void adjust_wire_ttl(knot_pkt_t *pkt, size_t pos, uint16_t count, uint32_t drift)
+{
+	uint8_t *wire = pkt->wire;
+	for (uint16_t i = 0; i < count; ++i) {
+		pos = skip_dname(wire, pos, pkt->size);
+		/* Fixed part is TYPE, CLASS, TTL, RDLENGTH */
+		if (pos == 0 || pos + 10 > pkt->size) {
+			return;
+		}
+		wire_write_u32(wire + pos + 4, wire_read_u32(wire + pos + 4) - drift);
+		pos += 10 + wire_read_u16(wire + pos + 8);
+	}
+}
+
+/** @internal Append a peeked RRSet to the packet, borrowing rdata when possible. */
+static int put_rr(knot_pkt_t *pkt, const knot_rrset_t *cache_rr, uint32_t drift, bool stale)
+{
+	/* Fresh records are borrowed straight from the cache memory and
+	 * the TTL decay is done on the serialized form, so the rdata copy
+	 * into the mempool is skipped. Stale mode rewrites TTLs in the
+	 * rdata and must work on a copy. */
+	knot_rrset_t rr_copy;
+	bool borrowed = false;
+	int ret = kr_error(ESTALE);
+	if (!stale) {
+		ret = kr_cache_materialize_ref(&rr_copy, cache_rr, drift);
+		borrowed = (ret == 0);
+	}
+	if (ret != 0) {
+		ret = kr_cache_materialize(&rr_copy, cache_rr, drift, &pkt->mm);
+	}
+	if (ret != 0) {
+		return ret;
+	}
+	if (stale) {
+		/* Serve with a short TTL, the daemon schedules a refresh. */
+		knot_rdata_t *rd = rr_copy.rrs.data;
+		for (uint16_t i = 0; i < rr_copy.rrs.rr_count; ++i) {
+			knot_rdata_set_ttl(rd, DEFAULT_STALETTL);
+			rd = kr_rdataset_next(rd);
+		}
+	}
+	size_t wire_pos = pkt->size;
+	ret = knot_pkt_put(pkt, KNOT_COMPR_HINT_QNAME, &rr_copy, borrowed ? 0 : KNOT_PF_FREE);
+	if (ret != 0) {
+		if (!borrowed) {
+			knot_rrset_clear(&rr_copy, &pkt->mm);
+		}
+	} else if (borrowed && drift > 0) {
+		adjust_wire_ttl(pkt, wire_pos, rr_copy.rrs.rr_count, drift);
+	}
+	return ret;
+}
+
 static int loot_rr(struct kr_cache *cache, knot_pkt_t *pkt, const knot_dname_t *name,
                   uint16_t rrclass, uint16_t rrtype, struct kr_query *qry,
-                  uint8_t *rank, uint8_t *flags, bool fetch_rrsig)
+                  uint8_t *rank, uint8_t *flags, bool fetch_rrsig, bool *sigs_done)
 {
 	/* Check if record exists in cache */
 	int ret = 0;
@@ -53,12 +128,22 @@ static int loot_rr(struct kr_cache *cache, knot_pkt_t *pkt, const knot_dname_t *
 	} else {
 		ret = kr_cache_peek_rr(cache, &cache_rr, rank, flags, &drift);
 	}
-	if (ret != 0) {
+	/* Expired records may be served stale (with a short TTL) while the
+	 * daemon refreshes them asynchronously. This is limited to answers
+	 * that don't need DNSSEC proofs, as stale signatures are worthless. */
+	const bool stale = (ret == kr_error(ESTALE));
+	if (stale) {
+		if (!(qry->flags & QUERY_SERVE_STALE) || fetch_rrsig ||
+		    (qry->flags & QUERY_DNSSEC_WANT)) {
+			return ret;
+		}
+		drift = 0; /* Materialize all records, TTLs are clamped below. */
+	} else if (ret != 0) {
 		return ret;
 	}
 
 	/* Mark as expiring if it has less than 1% TTL (or less than 5s) */
-	if (is_expiring(&cache_rr, drift)) {
+	if (stale || is_expiring(&cache_rr, drift)) {
 		qry->flags |= QUERY_EXPIRING;
 	}
 
@@ -77,13 +162,19 @@ static int loot_rr(struct kr_cache *cache, knot_pkt_t *pkt, const knot_dname_t *
 	}
 
 	/* Update packet answer */
-	knot_rrset_t rr_copy;
-	ret = kr_cache_materialize(&rr_copy, &cache_rr, drift, &pkt->mm);
-	if (ret == 0) {
-		ret = knot_pkt_put(pkt, KNOT_COMPR_HINT_QNAME, &rr_copy, KNOT_PF_FREE);
-		if (ret != 0) {
-			knot_rrset_clear(&rr_copy, &pkt->mm);
-		}
+	ret = put_rr(pkt, &cache_rr, drift, stale);
+	if (ret == 0 && stale) {
+		/* Mark the query, so the daemon can schedule
+		 * an asynchronous refresh. */
+		qry->flags |= QUERY_STALE;
+	}
+
+	/* Records stored with the combined layout carry their covering
+	 * RRSIG set adjacent, saving the second cache descent. */
+	if (ret == 0 && sigs_done) {
+		knot_rrset_t sig_rr;
+		*sigs_done = kr_cache_sig_section(&cache_rr, *flags, &sig_rr, NULL) == 0 &&
+		             put_rr(pkt, &sig_rr, drift, false) == 0;
 	}
 	return ret;
 }
@@ -91,25 +182,152 @@ static int loot_rr(struct kr_cache *cache, knot_pkt_t *pkt, const knot_dname_t *
 /** @internal Try to find a shortcut directly to searched record. */
 static int loot_rrcache(struct kr_cache *cache, knot_pkt_t *pkt, struct kr_query *qry, uint16_t rrtype, bool dobit)
 {
-	/* Lookup direct match first */
+	/* Lookup direct match first. When signatures are wanted, prefer the
+	 * adjacent RRSIG section of the combined entry layout. */
 	uint8_t rank  = 0;
 	uint8_t flags = 0;
-	int ret = loot_rr(cache, pkt, qry->sname, qry->sclass, rrtype, qry, &rank, &flags, 0);
+	bool sigs_done = false;
+	int ret = loot_rr(cache, pkt, qry->sname, qry->sclass, rrtype, qry, &rank, &flags, 0,
+			  dobit ? &sigs_done : NULL);
 	if (ret != 0 && rrtype != KNOT_RRTYPE_CNAME) { /* Chase CNAME if no direct hit */
 		rrtype = KNOT_RRTYPE_CNAME;
-		ret = loot_rr(cache, pkt, qry->sname, qry->sclass, rrtype, qry, &rank, &flags, 0);
+		ret = loot_rr(cache, pkt, qry->sname, qry->sclass, rrtype, qry, &rank, &flags, 0,
+			      dobit ? &sigs_done : NULL);
 	}
 	/* Record is flagged as INSECURE => doesn't have RRSIG. */
 	if (ret == 0 && (rank & KR_RANK_INSECURE)) {
 		qry->flags |= QUERY_DNSSEC_INSECURE;
 		qry->flags &= ~QUERY_DNSSEC_WANT;
 	/* Record may have RRSIG, try to find it. */
-	} else if (ret == 0 && dobit) {
-		ret = loot_rr(cache, pkt, qry->sname, qry->sclass, rrtype, qry, &rank, &flags, true);
+	} else if (ret == 0 && dobit && !sigs_done) {
+		ret = loot_rr(cache, pkt, qry->sname, qry->sclass, rrtype, qry, &rank, &flags, true, NULL);
 	}
 	return ret;
 }
 
+/** @internal Check canonical-order coverage owner < name < next (wrap at zone end). */
+static bool nsec_covers(const knot_dname_t *owner, const knot_dname_t *next, const knot_dname_t *name)
+{
+	if (knot_dname_cmp(owner, name) >= 0) {
+		return false;
+	}
+	/* If 'owner' >= 'next', this is the last NSEC and nothing sorts after 'owner'. */
+	return (knot_dname_cmp(owner, next) >= 0) || (knot_dname_cmp(name, next) < 0);
+}
+
+/** @internal Return the suffix of name shared with the other name. */
+static const knot_dname_t *shared_suffix(const knot_dname_t *name, const knot_dname_t *other)
+{
+	int skip = knot_dname_labels(name, NULL) - knot_dname_matched_labels(name, other);
+	for (int i = 0; i < skip; ++i) {
+		name = knot_wire_next_label(name, NULL);
+	}
+	return name;
+}
+
+/** @internal Materialize the cached NSEC whose proven range covers the name, if any. */
+static int loot_nsec_range(struct kr_cache *cache, struct kr_query *qry, const knot_dname_t *name,
+                           knot_rrset_t *nsec, uint8_t *owner, uint8_t *flags, uint32_t *drift)
+{
+	const knot_dname_t *found = NULL;
+	int ret = kr_cache_peek_nsec(cache, qry->zone_cut.name, name, &found, qry->timestamp.tv_sec);
+	if (ret != 0) {
+		return ret;
+	}
+	/* The index borrows cache memory which may move under further peeks. */
+	if (knot_dname_to_wire(owner, found, KNOT_DNAME_MAXLEN) <= 0) {
+		return kr_error(EILSEQ);
+	}
+	uint8_t rank = 0;
+	*drift = qry->timestamp.tv_sec;
+	knot_rrset_init(nsec, owner, KNOT_RRTYPE_NSEC, qry->sclass);
+	ret = kr_cache_peek_rr(cache, nsec, &rank, flags, drift);
+	if (ret != 0 || !(rank & KR_RANK_SECURE)) {
+		return kr_error(ENOENT);
+	}
+	const knot_dname_t *next = knot_nsec_next(&nsec->rrs);
+	if (!next || !nsec_covers(owner, next, name)) {
+		return kr_error(ENOENT);
+	}
+	return kr_ok();
+}
+
+/** @internal Deny a novel name from proven NSEC ranges (aggressive negative caching). */
+static int loot_nxdomain(struct kr_cache *cache, knot_pkt_t *pkt, struct kr_query *qry)
+{
+	/* Meaningful only below a known zone cut; DS belongs to the parent side. */
+	if (qry->sclass != KNOT_CLASS_IN || qry->stype == KNOT_RRTYPE_DS ||
+	    !qry->zone_cut.name || !knot_dname_in(qry->zone_cut.name, qry->sname)) {
+		return kr_error(ENOENT);
+	}
+	uint8_t owner[KNOT_DNAME_MAXLEN];
+	uint8_t flags = 0;
+	uint32_t drift = 0;
+	knot_rrset_t nsec;
+	int ret = loot_nsec_range(cache, qry, qry->sname, &nsec, owner, &flags, &drift);
+	if (ret != 0) {
+		return kr_error(ENOENT);
+	}
+	/* Ranges at delegation or redirection points must not deny names below them. */
+	uint8_t *bm = NULL;
+	uint16_t bm_size = 0;
+	knot_nsec_bitmap(&nsec.rrs, &bm, &bm_size);
+	if (!bm || kr_nsec_bitmap_contains_type(bm, bm_size, KNOT_RRTYPE_DNAME) ||
+	    (kr_nsec_bitmap_contains_type(bm, bm_size, KNOT_RRTYPE_NS) &&
+	     !kr_nsec_bitmap_contains_type(bm, bm_size, KNOT_RRTYPE_SOA))) {
+		return kr_error(ENOENT);
+	}
+	/* A wildcard at the closest encloser would expand into a positive
+	 * answer instead, so its absence must be covered as well. */
+	const knot_dname_t *next = knot_nsec_next(&nsec.rrs);
+	const knot_dname_t *encloser = shared_suffix(qry->sname, owner);
+	const knot_dname_t *next_encloser = shared_suffix(qry->sname, next);
+	if (knot_dname_labels(next_encloser, NULL) > knot_dname_labels(encloser, NULL)) {
+		encloser = next_encloser;
+	}
+	uint8_t wildcard[KNOT_DNAME_MAXLEN];
+	const int encloser_len = knot_dname_size(encloser);
+	if (encloser_len <= 0 || encloser_len + 2 > (int) sizeof(wildcard)) {
+		return kr_error(ENOENT);
+	}
+	memcpy(wildcard, "\1*", 2);
+	memcpy(wildcard + 2, encloser, encloser_len);
+	uint8_t wc_owner[KNOT_DNAME_MAXLEN];
+	uint8_t wc_flags = 0;
+	uint32_t wc_drift = 0;
+	knot_rrset_t wc_nsec;
+	bool with_wc_nsec = false;
+	if (!nsec_covers(owner, next, wildcard)) {
+		if (loot_nsec_range(cache, qry, wildcard, &wc_nsec, wc_owner, &wc_flags, &wc_drift) != 0) {
+			return kr_error(ENOENT);
+		}
+		with_wc_nsec = true;
+	}
+
+	/* Write the borrowed proof into the AUTHORITY and deny the name. */
+	if (!knot_dname_is_equal(knot_pkt_qname(pkt), qry->sname)) {
+		kr_pkt_recycle(pkt);
+		knot_pkt_put_question(pkt, qry->sname, qry->sclass, qry->stype);
+	}
+	knot_pkt_begin(pkt, KNOT_AUTHORITY);
+	ret = put_rr(pkt, &nsec, drift, false);
+	if (ret != 0) {
+		return ret;
+	}
+	knot_rrset_t sig_rr;
+	if (kr_cache_sig_section(&nsec, flags, &sig_rr, NULL) == 0) {
+		put_rr(pkt, &sig_rr, drift, false);
+	}
+	if (with_wc_nsec) {
+		put_rr(pkt, &wc_nsec, wc_drift, false);
+		if (kr_cache_sig_section(&wc_nsec, wc_flags, &sig_rr, NULL) == 0) {
+			put_rr(pkt, &sig_rr, wc_drift, false);
+		}
+	}
+	knot_wire_set_rcode(pkt->wire, KNOT_RCODE_NXDOMAIN);
+	return kr_ok();
+}
+
 static int rrcache_peek(knot_layer_t *ctx, knot_pkt_t *pkt)
 {
 	struct kr_request *req = ctx->data;
@@ -139,6 +357,13 @@ static int rrcache_peek(knot_layer_t *ctx, knot_pkt_t *pkt)
 			}
 		}
 	}
+	if (ret != 0 && qry->stype != KNOT_RRTYPE_ANY) {
+		/* No direct hit, try to deny the name from a proven NSEC range. */
+		if (loot_nxdomain(cache, pkt, qry) == 0) {
+			DEBUG_MSG(qry, "=> denied from cached NSEC range\n");
+			ret = 0;
+		}
+	}
 	if (ret == 0) {
 		DEBUG_MSG(qry, "=> satisfied from cache\n");
 		qry->flags |= QUERY_CACHED|QUERY_NO_MINIMIZE;
@@ -156,6 +381,7 @@ struct rrcache_baton
 	struct kr_request *req;
 	struct kr_query *qry;
 	struct kr_cache *cache;
+	map_t *stash;
 	unsigned timestamp;
 	uint32_t min_ttl;
 };
@@ -210,6 +436,21 @@ static int commit_rr(const char *key, void *val, void *data)
 	if ((rank & KR_RANK_AUTH) && (baton->qry->flags & QUERY_DNSSEC_WEXPAND)) {
 		flags |= KR_CACHE_FLAG_WCARD_PROOF;
 	}
+
+	/* Store the covering RRSIG set adjacent to the record, so a
+	 * validated hit costs one lookup. The signatures are kept in the
+	 * separate namespace as well for consumers that fetch them alone. */
+	if (baton->qry->flags & QUERY_DNSSEC_WANT) {
+		char sig_key[KR_RRKEY_LEN];
+		size_t key_len = strlen(key);
+		memcpy(sig_key, key, key_len + 1);
+		sig_key[0] |= KEY_FLAG_RRSIG;
+		knot_rrset_t *sigs = map_get(baton->stash, sig_key);
+		if (sigs) {
+			return kr_cache_insert_rr_sigs(baton->cache, rr, sigs, rank,
+						       rank, flags, baton->timestamp);
+		}
+	}
 	return kr_cache_insert_rr(baton->cache, rr, rank, flags, baton->timestamp);
 }
 
@@ -219,6 +460,7 @@ static int stash_commit(map_t *stash, struct kr_query *qry, struct kr_cache *cac
 		.req = req,
 		.qry = qry,
 		.cache = cache,
+		.stash = stash,
 		.timestamp = qry->timestamp.tv_sec,
 		.min_ttl = DEFAULT_MINTTL
 	};
@@ -370,17 +612,47 @@ static int rrcache_stash(knot_layer_t *ctx, knot_pkt_t *pkt)
 				kr_log_error("[cache] failed to clear cache: %s\n", kr_strerror(ret));
 			}
 		}
-		kr_cache_sync(cache);
+		/* Stashed records are committed by the backend in batches. */
 	}
 	return ctx->state;
 }
 
+
+/** @internal Scope the shared cache to the request's client subnet for the
+  * duration of one layer call.  Only the primary query chain is partitioned;
+  * infrastructure subqueries keep using the shared (unscoped) entries. */
+static int scoped_rrcache_peek(knot_layer_t *ctx, knot_pkt_t *pkt)
+{
+	struct kr_request *req = ctx->data;
+	struct kr_query *qry = req->current_query;
+	struct kr_cache *cache = &req->ctx->cache;
+	if (req->ecs.source_len > 0 && qry && qry->parent == NULL) {
+		kr_cache_scope_set(cache, req->ecs.addr, req->ecs.source_len);
+	}
+	int state = rrcache_peek(ctx, pkt);
+	kr_cache_scope_set(cache, NULL, 0);
+	return state;
+}
+
+static int scoped_rrcache_stash(knot_layer_t *ctx, knot_pkt_t *pkt)
+{
+	struct kr_request *req = ctx->data;
+	struct kr_query *qry = req->current_query;
+	struct kr_cache *cache = &req->ctx->cache;
+	if (req->ecs.source_len > 0 && qry && qry->parent == NULL) {
+		kr_cache_scope_set(cache, req->ecs.addr, req->ecs.source_len);
+	}
+	int state = rrcache_stash(ctx, pkt);
+	kr_cache_scope_set(cache, NULL, 0);
+	return state;
+}
+
 /** Module implementation. */
 const knot_layer_api_t *rrcache_layer(struct kr_module *module)
 {
 	static const knot_layer_api_t _layer = {
-		.produce = &rrcache_peek,
-		.consume = &rrcache_stash
+		.produce = &scoped_rrcache_peek,
+		.consume = &scoped_rrcache_stash
 	};
 
 	return &_layer;
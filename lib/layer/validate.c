@@ -34,6 +34,7 @@
 #include "lib/utils.h"
 #include "lib/defines.h"
 #include "lib/module.h"
+#include "contrib/hash/hash.h"
 
 #define DEBUG_MSG(qry, fmt...) QRDEBUG(qry, "vldr", fmt)
 
@@ -74,18 +75,69 @@ static bool pkt_has_type(const knot_pkt_t *pkt, uint16_t type)
 	return section_has_type(knot_pkt_section(pkt, KNOT_ADDITIONAL), type);
 }
 
+/** @internal Memo entry for a successfully verified rrset, see validate_rrset().
+  * Only successes are remembered, a failed signature must fail again. */
+struct vld_memo_entry {
+	uint32_t flags; /**< Validation flags the rrset contributed (e.g. wildcard expansion). */
+};
+
+/** @internal Memo key = rrkey + hex hash of rdata and signer, as map keys must not contain 0x00. */
+static int vld_memo_key(char *key, size_t maxlen, const knot_rrset_t *rr, const knot_dname_t *signer)
+{
+	if (!signer) {
+		return kr_error(EINVAL);
+	}
+	int len = kr_rrkey(key, rr->owner, rr->type, 0);
+	if (len <= 0) {
+		return kr_error(EILSEQ);
+	}
+	/* Keyed hash, as the rdata is attacker-controlled and a crafted
+	 * collision would let a bogus copy ride on a verified one. */
+	uint32_t rr_hash = hash_keyed((const char *)rr->rrs.data, knot_rdataset_size(&rr->rrs));
+	rr_hash ^= hash_keyed((const char *)signer, knot_dname_size(signer));
+	return snprintf(key + len, maxlen - len, "%08x", rr_hash);
+}
+
+/** @internal Walk baton for validate_rrset(). */
+struct validate_baton {
+	kr_rrset_validation_ctx_t *vctx;
+	struct kr_request *req;
+};
+
 static int validate_rrset(const char *key, void *val, void *data)
 {
 	knot_rrset_t *rr = val;
-	kr_rrset_validation_ctx_t *vctx = data;
+	struct validate_baton *baton = data;
+	kr_rrset_validation_ctx_t *vctx = baton->vctx;
 	if (vctx->result != 0) {
 		return vctx->result;
 	}
 
-	return kr_rrset_validate(vctx, rr);
+	/* CNAME chains walk the same rrsets through several subrequests,
+	 * skip signatures this request has already verified. */
+	char memo_key[KR_RRKEY_LEN + 9];
+	const bool keyed = vld_memo_key(memo_key, sizeof(memo_key), rr, vctx->zone_name) > 0;
+	if (keyed) {
+		struct vld_memo_entry *found = map_get(&baton->req->vld_memo, memo_key);
+		if (found) {
+			vctx->flags |= found->flags;
+			return kr_ok();
+		}
+	}
+
+	const uint32_t flags_prev = vctx->flags;
+	int ret = kr_rrset_validate(vctx, rr);
+	if (ret == 0 && keyed) {
+		struct vld_memo_entry *entry = mm_alloc(&baton->req->pool, sizeof(*entry));
+		if (entry) {
+			entry->flags = vctx->flags & ~flags_prev;
+			map_set(&baton->req->vld_memo, memo_key, entry);
+		}
+	}
+	return ret;
 }
 
-static int validate_section(kr_rrset_validation_ctx_t *vctx, knot_mm_t *pool)
+static int validate_section(kr_rrset_validation_ctx_t *vctx, struct kr_request *req, knot_mm_t *pool)
 {
 	if (!vctx) {
 		return kr_error(EINVAL);
@@ -128,7 +180,8 @@ static int validate_section(kr_rrset_validation_ctx_t *vctx, knot_mm_t *pool)
 	 */
 	vctx->zone_name = vctx->keys ? vctx->keys->owner  : NULL;
 
-	ret = map_walk(&stash, &validate_rrset, vctx);
+	struct validate_baton baton = { vctx, req };
+	ret = map_walk(&stash, &validate_rrset, &baton);
 	if (ret != 0) {
 		return ret;
 	}
@@ -138,7 +191,7 @@ fail:
 	return ret;
 }
 
-static int validate_records(struct kr_query *qry, knot_pkt_t *answer, knot_mm_t *pool, bool has_nsec3)
+static int validate_records(struct kr_request *req, struct kr_query *qry, knot_pkt_t *answer, knot_mm_t *pool, bool has_nsec3)
 {
 	if (!qry->zone_cut.key) {
 		DEBUG_MSG(qry, "<= no DNSKEY, can't validate\n");
@@ -152,11 +205,12 @@ static int validate_records(struct kr_query *qry, knot_pkt_t *answer, knot_mm_t
 		.zone_name	= qry->zone_cut.name,
 		.timestamp	= qry->timestamp.tv_sec,
 		.has_nsec3	= has_nsec3,
+		.cache_key	= req->ctx->cache_dnskey,
 		.flags		= 0,
 		.result		= 0
 	};
 
-	int ret = validate_section(&vctx, pool);
+	int ret = validate_section(&vctx, req, pool);
 	if (ret != 0) {
 		return ret;
 	}
@@ -168,7 +222,7 @@ static int validate_records(struct kr_query *qry, knot_pkt_t *answer, knot_mm_t
 	vctx.flags	  = 0;
 	vctx.result	  = 0;
 
-	ret = validate_section(&vctx, pool);
+	ret = validate_section(&vctx, req, pool);
 	if (ret != 0) {
 		return ret;
 	}
@@ -183,7 +237,24 @@ static int validate_records(struct kr_query *qry, knot_pkt_t *answer, knot_mm_t
 	return ret;
 }
 
-static int validate_keyset(struct kr_query *qry, knot_pkt_t *answer, bool has_nsec3)
+/** Index proven NSEC ranges, so novel names inside them can be denied from cache. */
+static void stash_nsec_ranges(struct kr_request *req, struct kr_query *qry, knot_pkt_t *pkt)
+{
+	const knot_pktsection_t *sec = knot_pkt_section(pkt, KNOT_AUTHORITY);
+	for (unsigned i = 0; i < sec->count; ++i) {
+		const knot_rrset_t *rr = knot_pkt_rr(sec, i);
+		if (rr->type != KNOT_RRTYPE_NSEC ||
+		    !knot_dname_in(qry->zone_cut.name, rr->owner)) {
+			continue;
+		}
+		/* The record itself is stashed by the rrcache layer, the index
+		 * only remembers which owners are worth probing on a miss. */
+		kr_cache_insert_nsec(&req->ctx->cache, qry->zone_cut.name, rr->owner,
+		                     knot_rrset_ttl(rr), qry->timestamp.tv_sec);
+	}
+}
+
+static int validate_keyset(struct kr_request *req, struct kr_query *qry, knot_pkt_t *answer, bool has_nsec3)
 {
 	/* Merge DNSKEY records from answer that are below/at current cut. */
 	bool updated_key = false;
@@ -221,6 +292,7 @@ static int validate_keyset(struct kr_query *qry, knot_pkt_t *answer, bool has_ns
 			.zone_name	= qry->zone_cut.name,
 			.timestamp	= qry->timestamp.tv_sec,
 			.has_nsec3	= has_nsec3,
+			.cache_key	= req->ctx->cache_dnskey,
 			.flags		= 0,
 			.result		= 0
 		};
@@ -355,6 +427,42 @@ static int update_delegation(struct kr_request *req, struct kr_query *qry, knot_
 	return ret;
 }
 
+/** Plan the child DNSKEY fetch as soon as a validated referral provides its DS.
+ * The keys then resolve over the fresh delegation instead of being discovered
+ * one answer later, which would yield that answer, fetch the keys and
+ * revalidate - serializing an extra step into every cold validated walk.
+ * The DS itself can't be co-scheduled the same way: the keyset is validated
+ * against it, so it must be in hand (from the referral or a subrequest) first. */
+static int prefetch_keys(struct kr_request *req, struct kr_query *qry)
+{
+	struct kr_zonecut *cut = &qry->zone_cut;
+	if (!(qry->flags & QUERY_DNSSEC_WANT) || (qry->flags & (QUERY_CACHED|QUERY_STUB))) {
+		return kr_ok();
+	}
+	/* Keys must be missing or stale, the DS fresh for this cut,
+	 * and nothing in the resolution chain resolving them already. */
+	const bool have_ta = cut->trust_anchor &&
+		knot_dname_is_equal(cut->trust_anchor->owner, cut->name);
+	const bool stale_key = !cut->key ||
+		!knot_dname_is_equal(cut->key->owner, cut->name);
+	if (!have_ta || !stale_key ||
+	    kr_rplan_satisfies(qry, cut->name, qry->sclass, KNOT_RRTYPE_DNSKEY)) {
+		return kr_ok();
+	}
+	struct kr_query *next = kr_rplan_push(&req->rplan, qry, cut->name,
+	                                      qry->sclass, KNOT_RRTYPE_DNSKEY);
+	if (!next) {
+		return kr_error(ENOMEM);
+	}
+	kr_zonecut_set(&next->zone_cut, cut->name);
+	if (kr_zonecut_copy(&next->zone_cut, cut) != 0 ||
+	    kr_zonecut_copy_trust(&next->zone_cut, cut) != 0) {
+		return kr_error(ENOMEM);
+	}
+	next->flags |= QUERY_NO_MINIMIZE|QUERY_DNSSEC_WANT;
+	return kr_ok();
+}
+
 static const knot_dname_t *signature_authority(knot_pkt_t *pkt)
 {
 	for (knot_section_t i = KNOT_ANSWER; i <= KNOT_AUTHORITY; ++i) {
@@ -407,7 +515,7 @@ static int validate(knot_layer_t *ctx, knot_pkt_t *pkt)
 			/* Not a DNSSEC-signed response, ask parent for DS to prove transition to INSECURE. */
 		} else if (knot_dname_is_sub(signer, qry->zone_cut.name)) {
 			/* Key signer is below current cut, advance and refetch keys. */
-			qry->zone_cut.name = knot_dname_copy(signer, &req->pool);
+			qry->zone_cut.name = kr_dname_intern(&req->intern, signer);
 		} else if (!knot_dname_is_equal(signer, qry->zone_cut.name)) {
 			/* Key signer is above the current cut, so we can't validate it. This happens when
 			   a server is authoritative for both grandparent, parent and child zone.
@@ -417,7 +525,7 @@ static int validate(knot_layer_t *ctx, knot_pkt_t *pkt)
 			} else {
 				qry->flags |= QUERY_AWAIT_CUT;
 			}
-			qry->zone_cut.name = knot_dname_copy(signer, &req->pool);
+			qry->zone_cut.name = kr_dname_intern(&req->intern, signer);
 		} /* else zone cut matches, but DS/DNSKEY doesn't => refetch. */
 		return KNOT_STATE_YIELD;
 	}
@@ -427,7 +535,7 @@ static int validate(knot_layer_t *ctx, knot_pkt_t *pkt)
 	uint16_t qtype = knot_pkt_qtype(pkt);
 	bool has_nsec3 = pkt_has_type(pkt, KNOT_RRTYPE_NSEC3);
 	if (knot_wire_get_aa(pkt->wire) && qtype == KNOT_RRTYPE_DNSKEY) {
-		ret = validate_keyset(qry, pkt, has_nsec3);
+		ret = validate_keyset(req, qry, pkt, has_nsec3);
 		if (ret != 0) {
 			DEBUG_MSG(qry, "<= bad keys, broken trust chain\n");
 			qry->flags |= QUERY_DNSSEC_BOGUS;
@@ -482,12 +590,16 @@ static int validate(knot_layer_t *ctx, knot_pkt_t *pkt)
 	/* Validate all records, fail as bogus if it doesn't match.
 	 * Do not revalidate data from cache, as it's already trusted. */
 	if (!(qry->flags & QUERY_CACHED)) {
-		ret = validate_records(qry, pkt, req->rplan.pool, has_nsec3);
+		ret = validate_records(req, qry, pkt, req->rplan.pool, has_nsec3);
 		if (ret != 0) {
 			DEBUG_MSG(qry, "<= couldn't validate RRSIGs\n");
 			qry->flags |= QUERY_DNSSEC_BOGUS;
 			return KNOT_STATE_FAIL;
 		}
+		/* Both the NXDOMAIN proof and its signatures checked out. */
+		if (pkt_rcode == KNOT_RCODE_NXDOMAIN && !has_nsec3) {
+			stash_nsec_ranges(req, qry, pkt);
+		}
 	}
 
 	/* Check if wildcard expansion detected for final query.
@@ -505,6 +617,10 @@ static int validate(knot_layer_t *ctx, knot_pkt_t *pkt)
 	if (ret != 0) {
 		return KNOT_STATE_FAIL;
 	}
+	/* Piggyback the child keyset fetch on a secure referral. */
+	if (!knot_wire_get_aa(pkt->wire) && prefetch_keys(req, qry) != 0) {
+		return KNOT_STATE_FAIL;
+	}
 	/* Update parent query zone cut */
 	if (qry->parent) {
 		if (update_parent_keys(qry, qtype) != 0) {
@@ -16,6 +16,11 @@ libkres_SOURCES := \
 	lib/zonecut.c          \
 	lib/rplan.c            \
 	lib/cache.c            \
+	lib/suffixmatch.c      \
+	lib/intern.c           \
+	lib/dafvm.c            \
+	lib/lpm.c              \
+	lib/renumber.c         \
 	lib/cdb_lmdb.c
 
 libkres_HEADERS := \
@@ -35,6 +40,12 @@ libkres_HEADERS := \
 	lib/zonecut.h          \
 	lib/rplan.h            \
 	lib/cache.h            \
+	lib/suffixmatch.h      \
+	lib/intern.h           \
+	lib/probes.h           \
+	lib/dafvm.h            \
+	lib/lpm.h              \
+	lib/renumber.h         \
 	lib/cdb.h              \
 	lib/cdb_lmdb.h
 
@@ -0,0 +1,225 @@
+/*  Copyright (C) 2016 CZ.NIC, z.s.p.o. <knot-dns@labs.nic.cz>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "lib/lpm.h"
+#include "lib/utils.h"
+
+/*
+ * Compiled image = flat array of nodes in preorder, so a lookup walks
+ * mostly forward through a contiguous block. Node = { i32 value (-1 =
+ * no prefix ends here), u32 left, u32 right }, child offsets are byte
+ * offsets into the image, NODE_NONE marks a missing child.
+ */
+
+#define NODE_SIZE 12
+#define NODE_NONE 0xffffffff
+
+/** @internal Unaligned scalar read. */
+#define load_num(var, base) memcpy(&(var), (base), sizeof(var))
+
+/** @internal Build-time trie node. */
+struct build_node {
+	struct build_node *child[2];
+	uint32_t off;
+	int32_t value;
+};
+
+/** @internal Per-family bit trie. */
+struct lpm_trie {
+	struct build_node root;
+	uint8_t *image;
+	size_t image_len;
+	bool empty;
+};
+
+struct kr_lpm {
+	struct lpm_trie v4;
+	struct lpm_trie v6;
+};
+
+static void trie_init(struct lpm_trie *trie)
+{
+	memset(trie, 0, sizeof(*trie));
+	trie->root.value = -1;
+	trie->empty = true;
+}
+
+static void free_node(struct build_node *node)
+{
+	for (int i = 0; i < 2; ++i) {
+		if (node->child[i]) {
+			free_node(node->child[i]);
+			free(node->child[i]);
+			node->child[i] = NULL;
+		}
+	}
+}
+
+static void trie_deinit(struct lpm_trie *trie)
+{
+	free_node(&trie->root);
+	free(trie->image);
+	trie->image = NULL;
+	trie->image_len = 0;
+}
+
+struct kr_lpm *kr_lpm_create(void)
+{
+	struct kr_lpm *lpm = malloc(sizeof(*lpm));
+	if (lpm) {
+		trie_init(&lpm->v4);
+		trie_init(&lpm->v6);
+	}
+	return lpm;
+}
+
+void kr_lpm_free(struct kr_lpm *lpm)
+{
+	if (lpm) {
+		trie_deinit(&lpm->v4);
+		trie_deinit(&lpm->v6);
+		free(lpm);
+	}
+}
+
+int kr_lpm_add(struct kr_lpm *lpm, const char *subnet, int value)
+{
+	if (!lpm || !subnet || value < 0) {
+		return kr_error(EINVAL);
+	}
+	/* Parse subnet string */
+	uint8_t addr[16] = { 0 };
+	const int family = kr_straddr_family(subnet);
+	const int bitlen = kr_straddr_subnet(addr, subnet);
+	if (family < 0 || bitlen < 0) {
+		return kr_error(EINVAL);
+	}
+	struct lpm_trie *trie = (family == AF_INET6) ? &lpm->v6 : &lpm->v4;
+	/* Descend by prefix bits, creating nodes on the way */
+	struct build_node *node = &trie->root;
+	for (int i = 0; i < bitlen; ++i) {
+		const int bit = (addr[i / 8] >> (7 - i % 8)) & 1;
+		if (!node->child[bit]) {
+			struct build_node *next = malloc(sizeof(*next));
+			if (!next) {
+				return kr_error(ENOMEM);
+			}
+			memset(next, 0, sizeof(*next));
+			next->value = -1;
+			node->child[bit] = next;
+		}
+		node = node->child[bit];
+	}
+	/* First insertion for an exact prefix wins */
+	if (node->value < 0) {
+		node->value = value;
+	}
+	trie->empty = false;
+	return kr_ok();
+}
+
+static void assign_offsets(struct build_node *node, uint32_t *cur)
+{
+	node->off = *cur;
+	*cur += NODE_SIZE;
+	for (int i = 0; i < 2; ++i) {
+		if (node->child[i]) {
+			assign_offsets(node->child[i], cur);
+		}
+	}
+}
+
+static void write_node(uint8_t *base, const struct build_node *node)
+{
+	uint8_t *wp = base + node->off;
+	memcpy(wp, &node->value, sizeof(node->value));
+	for (int i = 0; i < 2; ++i) {
+		const uint32_t off = node->child[i] ? node->child[i]->off : NODE_NONE;
+		memcpy(wp + 4 + i * 4, &off, sizeof(off));
+		if (node->child[i]) {
+			write_node(base, node->child[i]);
+		}
+	}
+}
+
+static int trie_compile(struct lpm_trie *trie)
+{
+	uint32_t size = 0;
+	assign_offsets(&trie->root, &size);
+	uint8_t *image = malloc(size);
+	if (!image) {
+		return kr_error(ENOMEM);
+	}
+	write_node(image, &trie->root);
+	free(trie->image);
+	trie->image = image;
+	trie->image_len = size;
+	return kr_ok();
+}
+
+int kr_lpm_compile(struct kr_lpm *lpm)
+{
+	if (!lpm) {
+		return kr_error(EINVAL);
+	}
+	int ret = trie_compile(&lpm->v4);
+	if (ret == 0) {
+		ret = trie_compile(&lpm->v6);
+	}
+	return ret;
+}
+
+int kr_lpm_match(const struct kr_lpm *lpm, const struct sockaddr *addr)
+{
+	if (!lpm || !addr) {
+		return kr_error(EINVAL);
+	}
+	const struct lpm_trie *trie = (addr->sa_family == AF_INET6) ? &lpm->v6 : &lpm->v4;
+	if (trie->empty) {
+		return -1;
+	}
+	if (!trie->image) {
+		return kr_error(EINVAL); /* Not compiled */
+	}
+	const uint8_t *bytes = (const uint8_t *)kr_inaddr(addr);
+	const int maxbits = (addr->sa_family == AF_INET6) ? 128 : 32;
+	const uint8_t *base = trie->image;
+	uint32_t off = 0;
+	int best = -1;
+	for (int i = 0; i <= maxbits; ++i) {
+		int32_t value = 0;
+		load_num(value, base + off);
+		if (value >= 0) {
+			best = value;
+		}
+		if (i == maxbits) {
+			break;
+		}
+		const int bit = (bytes[i / 8] >> (7 - i % 8)) & 1;
+		uint32_t next = 0;
+		load_num(next, base + off + 4 + bit * 4);
+		if (next == NODE_NONE) {
+			break;
+		}
+		off = next;
+	}
+	return best;
+}
@@ -0,0 +1,64 @@
+/*  Copyright (C) 2016 CZ.NIC, z.s.p.o. <knot-dns@labs.nic.cz>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file lpm.h
+ * @brief Longest-prefix-match subnet index.
+ *
+ * Subnets are inserted into per-family bit tries that compile into flat
+ * preorder arrays, so classifying an address is a short branch-free-ish
+ * walk over a contiguous block instead of a linear scan over all
+ * registered subnets. Used by the view module through the Lua bindings
+ * to classify client addresses in the begin layer.
+ */
+
+#pragma once
+
+#include <sys/socket.h>
+#include "lib/defines.h"
+
+struct kr_lpm;
+
+/** Create an empty subnet index. */
+KR_EXPORT
+struct kr_lpm *kr_lpm_create(void);
+
+/** Destroy a subnet index. */
+KR_EXPORT
+void kr_lpm_free(struct kr_lpm *lpm);
+
+/**
+ * Insert a subnet ('addr' or 'addr/len') with associated value.
+ * The first value inserted for an exact prefix wins, a more specific
+ * prefix always beats a less specific one on lookup.
+ * @return 0 or an error code
+ */
+KR_EXPORT
+int kr_lpm_add(struct kr_lpm *lpm, const char *subnet, int value);
+
+/**
+ * Compile inserted subnets into the flat matching structure.
+ * @return 0 or an error code
+ */
+KR_EXPORT
+int kr_lpm_compile(struct kr_lpm *lpm);
+
+/**
+ * Find the value of the longest matching prefix for given address.
+ * @return value, -1 when no prefix matches, or an error code lower than -1
+ */
+KR_EXPORT
+int kr_lpm_match(const struct kr_lpm *lpm, const struct sockaddr *addr);
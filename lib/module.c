@@ -136,19 +136,24 @@ int kr_module_load(struct kr_module *module, const char *name, const char *path)
 		return kr_error(ENOMEM);
 	}
 
-	/* Search for module library, use current namespace if not found. */
-	if (load_library(module, name, path) != 0) {
-		/* Expand HOME env variable, as the linker may not expand it. */
-		auto_free char *local_path = kr_strcatdup(2, getenv("HOME"), "/.local/lib/kdns_modules");
-		if (load_library(module, name, local_path) != 0) {
-			if (load_library(module, name, MODULEDIR) != 0) {
-				module->lib = RTLD_DEFAULT;
+	/* Try the program itself first: embedded layers and modules compiled
+	 * into the binary (EMBED_MODULES) resolve right away, skipping the
+	 * dlopen() searches and relocation entirely. */
+	module->lib = RTLD_DEFAULT;
+	int ret = load_sym_c(module, KR_MODULE_API);
+	if (ret != 0) {
+		/* Search for module library, use current namespace if not found. */
+		if (load_library(module, name, path) != 0) {
+			/* Expand HOME env variable, as the linker may not expand it. */
+			auto_free char *local_path = kr_strcatdup(2, getenv("HOME"), "/.local/lib/kdns_modules");
+			if (load_library(module, name, local_path) != 0) {
+				if (load_library(module, name, MODULEDIR) != 0) {
+					module->lib = RTLD_DEFAULT;
+				}
 			}
 		}
+		ret = load_sym_c(module, KR_MODULE_API);
 	}
-
-	/* Try to load module ABI. */
-	int ret = load_sym_c(module, KR_MODULE_API);
 	if (ret == 0 && module->init) {
 		ret = module->init(module);
 	}
@@ -15,6 +15,7 @@
  */
 
 #include <assert.h>
+#include <time.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <netdb.h>
@@ -80,8 +81,9 @@ static void update_nsrep_set(struct kr_nsrep *ns, const knot_dname_t *name, uint
 
 #undef ADDR_SET
 
-static unsigned eval_addr_set(pack_t *addr_set, kr_nsrep_lru_t *rttcache, unsigned score, uint8_t *addr[], uint32_t opts)
+static unsigned eval_addr_set(pack_t *addr_set, kr_nsrep_rtt_lru_t *rttcache, unsigned score, uint8_t *addr[], uint32_t opts)
 {
+	uint32_t now = time(NULL);
 	/* Name server is better candidate if it has address record. */
 	uint8_t *it = pack_head(*addr_set);
 	while (it != pack_tail(*addr_set)) {
@@ -96,10 +98,10 @@ static unsigned eval_addr_set(pack_t *addr_set, kr_nsrep_lru_t *rttcache, unsign
 		} else {
 			is_valid = !(opts & QUERY_NO_IPV4);
 		}
-		/* Get RTT for this address (if known) */
+		/* Get expected completion time for this address (if known) */
 		if (is_valid) {
-			unsigned *cached = rttcache ? lru_get(rttcache, val, len) : NULL;
-			unsigned addr_score = (cached) ? *cached : KR_NS_GLUED;
+			struct kr_ns_rtt *cached = rttcache ? lru_get(rttcache, val, len) : NULL;
+			unsigned addr_score = (cached) ? kr_nsrep_rtt_score(cached, now) : KR_NS_GLUED;
 			if (addr_score < score + favour) {
 				/* Shake down previous contenders */
 				for (size_t i = KR_NSREP_MAXADDR - 1; i > 0; --i)
@@ -185,12 +187,12 @@ int kr_nsrep_set(struct kr_query *qry, size_t index, uint8_t *addr, size_t addr_
 		qry->ns.score = KR_NS_UNKNOWN;
 		qry->ns.reputation = 0;
 	}
-	/* Retrieve RTT from cache */
+	/* Retrieve RTT estimate from cache */
 	if (addr && addr_len > 0) {
 		struct kr_context *ctx = qry->ns.ctx;
-		unsigned *score = ctx ? lru_get(ctx->cache_rtt, (const char *)addr, addr_len) : NULL;
-		if (score) {
-			qry->ns.score = MIN(qry->ns.score, *score);
+		struct kr_ns_rtt *rtt = ctx ? lru_get(ctx->cache_rtt, (const char *)addr, addr_len) : NULL;
+		if (rtt) {
+			qry->ns.score = MIN(qry->ns.score, kr_nsrep_rtt_score(rtt, time(NULL)));
 		}
 	}
 	update_nsrep(&qry->ns, index, addr, addr_len, port);
@@ -212,7 +214,19 @@ int kr_nsrep_elect(struct kr_query *qry, struct kr_context *ctx)
 
 	struct kr_nsrep *ns = &qry->ns;
 	ELECT_INIT(ns, ctx);
-	return map_walk(&qry->zone_cut.nsset, eval_nsrep, qry);
+	/* Scan the flat candidate view instead of walking the map. */
+	kr_nscand_array_t *cands = kr_zonecut_candidates(&qry->zone_cut);
+	if (!cands) {
+		return map_walk(&qry->zone_cut.nsset, eval_nsrep, qry);
+	}
+	for (size_t i = 0; i < cands->len; ++i) {
+		struct kr_nscand *cand = &cands->at[i];
+		int ret = eval_nsrep((const char *)cand->name, cand->addrs, qry);
+		if (ret != 0) { /* Early stop mirrors map_walk semantics. */
+			return ret;
+		}
+	}
+	return kr_ok();
 }
 
 int kr_nsrep_elect_addr(struct kr_query *qry, struct kr_context *ctx)
@@ -237,8 +251,30 @@ int kr_nsrep_elect_addr(struct kr_query *qry, struct kr_context *ctx)
 
 #undef ELECT_INIT
 
+unsigned kr_nsrep_rtt_score(const struct kr_ns_rtt *rtt, uint32_t now)
+{
+	if (!rtt || (rtt->srtt == 0 && rtt->rttvar == 0)) {
+		return KR_NS_UNKNOWN;
+	}
+	/* Expected completion time, jittery servers pay for the spread. */
+	unsigned score = rtt->srtt + 4 * (unsigned)rtt->rttvar;
+	if (score > KR_NS_MAX_SCORE) {
+		score = KR_NS_MAX_SCORE;
+	}
+	/* Decay toward the prior for unknown servers, so neither one slow
+	 * probe nor a timeout poisons an address forever. */
+	unsigned periods = now > rtt->stamp ? (now - rtt->stamp) / KR_NS_DECAY_HORIZON : 0;
+	if (periods > 16) {
+		periods = 16;
+	}
+	while (periods-- > 0) {
+		score = (score + KR_NS_UNKNOWN) / 2;
+	}
+	return score;
+}
+
 int kr_nsrep_update_rtt(struct kr_nsrep *ns, const struct sockaddr *addr,
-			unsigned score, kr_nsrep_lru_t *cache, int umode)
+			unsigned score, kr_nsrep_rtt_lru_t *cache, int umode)
 {
 	if (!ns || !cache || ns->addr[0].ip.sa_family == AF_UNSPEC) {
 		return kr_error(EINVAL);
@@ -255,7 +291,7 @@ int kr_nsrep_update_rtt(struct kr_nsrep *ns, const struct sockaddr *addr,
 			addr_len = sizeof(struct in6_addr);
 		}
 	}
-	unsigned *cur = lru_set(cache, addr_in, addr_len);
+	struct kr_ns_rtt *cur = lru_set(cache, addr_in, addr_len);
 	if (!cur) {
 		return kr_error(ENOMEM);
 	}
@@ -266,18 +302,31 @@ int kr_nsrep_update_rtt(struct kr_nsrep *ns, const struct sockaddr *addr,
 	if (score <= KR_NS_GLUED) {
 		score = KR_NS_GLUED + 1;
 	}
-	/* First update is always set. */
-	if (*cur == 0) {
+	/* First measurement seeds the estimator. */
+	if (cur->srtt == 0 && cur->rttvar == 0) {
 		umode = KR_NS_RESET;
 	}
-	/* Update score, by default smooth over last two measurements. */
+	/* Update estimator, by default smooth with the RFC 6298 weights. */
 	switch (umode) {
-	case KR_NS_UPDATE: *cur = (*cur + score) / 2; break;
-	case KR_NS_RESET:  *cur = score; break;
-	case KR_NS_ADD:    *cur = MIN(KR_NS_MAX_SCORE - 1, *cur + score); break;
-	case KR_NS_MAX:    *cur = MAX(*cur, score); break;
+	case KR_NS_UPDATE: {
+		unsigned delta = cur->srtt > score ? cur->srtt - score : score - cur->srtt;
+		cur->rttvar = (3 * cur->rttvar + delta) / 4;
+		cur->srtt = (7 * cur->srtt + score) / 8;
+		break;
+	}
+	case KR_NS_RESET:
+		cur->srtt = score;
+		cur->rttvar = score / 2;
+		break;
+	case KR_NS_ADD:
+		cur->srtt = MIN(KR_NS_MAX_SCORE - 1, cur->srtt + score);
+		break;
+	case KR_NS_MAX:
+		cur->srtt = MAX(cur->srtt, score);
+		break;
 	default: break;
 	}
+	cur->stamp = time(NULL);
 	return kr_ok();
 }
 
@@ -46,7 +46,8 @@ enum kr_ns_score {
 enum kr_ns_rep {
 	KR_NS_NOIP4  = 1 << 0, /**< NS has no IPv4 */
 	KR_NS_NOIP6  = 1 << 1, /**< NS has no IPv6 */
-	KR_NS_NOEDNS = 1 << 2  /**< NS has no EDNS support */
+	KR_NS_NOEDNS = 1 << 2, /**< NS has no EDNS support */
+	KR_NS_NOCASE = 1 << 3  /**< NS doesn't preserve QNAME case (no 0x20). */
 };
 
 /**
@@ -60,10 +61,29 @@ enum kr_ns_update_mode {
 };
 
 /**
- * NS reputation/QoS tracking.
+ * NS reputation tracking.
  */
 typedef lru_hash(unsigned) kr_nsrep_lru_t;
 
+/** Seconds without a measurement after which the RTT estimate
+  * decays halfway toward the prior for unknown servers. */
+#define KR_NS_DECAY_HORIZON 60
+
+/**
+ * Smoothed per-address RTT estimator.
+ * @note All times are in milliseconds, see kr_nsrep_rtt_score().
+ */
+struct kr_ns_rtt {
+	uint16_t srtt;   /**< Smoothed RTT estimate */
+	uint16_t rttvar; /**< RTT variation estimate */
+	uint32_t stamp;  /**< Time of the last measurement (seconds) */
+};
+
+/**
+ * NS RTT tracking.
+ */
+typedef lru_hash(struct kr_ns_rtt) kr_nsrep_rtt_lru_t;
+
 /* Maximum count of addresses probed in one go (last is left empty) */
 #define KR_NSREP_MAXADDR 4
 
@@ -122,11 +142,27 @@ int kr_nsrep_elect(struct kr_query *qry, struct kr_context *ctx);
 KR_EXPORT
 int kr_nsrep_elect_addr(struct kr_query *qry, struct kr_context *ctx);
 
+/**
+ * Expected completion time for given RTT estimate.
+ *
+ * @brief Computed as srtt + 4 * rttvar, so jittery servers pay for the
+ * spread, and decayed toward the prior for unknown servers with the time
+ * since the last measurement. This way neither one slow probe nor a
+ * timeout poisons an address forever.
+ *
+ * @param  rtt          RTT estimator entry (NULL yields the prior)
+ * @param  now          current time (seconds)
+ * @return              score, see enum kr_ns_score
+ */
+KR_EXPORT
+unsigned kr_nsrep_rtt_score(const struct kr_ns_rtt *rtt, uint32_t now);
+
 /**
  * Update NS address RTT information.
  *
- * @brief In KR_NS_UPDATE mode reputation is smoothed over last N measurements.
- * 
+ * @brief In KR_NS_UPDATE mode the estimator is smoothed with the standard
+ * RFC 6298 weights (srtt 7/8, rttvar 3/4).
+ *
  * @param  ns           updated NS representation
  * @param  addr         chosen address (NULL for first)
  * @param  score        new score (i.e. RTT), see enum kr_ns_score
@@ -136,7 +172,7 @@ int kr_nsrep_elect_addr(struct kr_query *qry, struct kr_context *ctx);
  */
 KR_EXPORT
 int kr_nsrep_update_rtt(struct kr_nsrep *ns, const struct sockaddr *addr,
-			unsigned score, kr_nsrep_lru_t *cache, int umode);
+			unsigned score, kr_nsrep_rtt_lru_t *cache, int umode);
 
 /**
  * Update NSSET reputation information.
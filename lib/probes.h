@@ -0,0 +1,41 @@
+/*  Copyright (C) 2016 CZ.NIC, z.s.p.o. <knot-dns@labs.nic.cz>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/** @file probes.h
+ * USDT static tracepoints (systemtap/bpf) under the 'kresd' provider.
+ * Probes compile to a single nop when no tracer is attached and to
+ * nothing at all when <sys/sdt.h> is unavailable at build time, so they
+ * are safe on every hot path they annotate.
+ *
+ * List available probes with e.g.:
+ *     readelf -n kresd | grep -A2 stapsdt
+ */
+#pragma once
+
+#if defined(ENABLE_USDT)
+#include <sys/sdt.h>
+#define KR_PROBE(probe)                 DTRACE_PROBE(kresd, probe)
+#define KR_PROBE1(probe, a)             DTRACE_PROBE1(kresd, probe, a)
+#define KR_PROBE2(probe, a, b)          DTRACE_PROBE2(kresd, probe, a, b)
+#define KR_PROBE3(probe, a, b, c)       DTRACE_PROBE3(kresd, probe, a, b, c)
+#define KR_PROBE4(probe, a, b, c, d)    DTRACE_PROBE4(kresd, probe, a, b, c, d)
+#else
+#define KR_PROBE(probe)
+#define KR_PROBE1(probe, a)
+#define KR_PROBE2(probe, a, b)
+#define KR_PROBE3(probe, a, b, c)
+#define KR_PROBE4(probe, a, b, c, d)
+#endif
@@ -0,0 +1,209 @@
+/*  Copyright (C) 2016 CZ.NIC, z.s.p.o. <knot-dns@labs.nic.cz>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libknot/descriptor.h>
+
+#include "lib/renumber.h"
+#include "lib/generic/array.h"
+#include "lib/utils.h"
+#include "lib/defines.h"
+
+/** @internal One compiled rewrite rule. */
+struct renumber_rule {
+	uint8_t subnet[16];  /**< Matched prefix (prefix rules). */
+	uint8_t target[16];  /**< Replacement address. */
+	knot_dname_t *owner; /**< Matched owner, NULL for prefix rules. */
+	int bitlen;          /**< Number of prefix bits to replace. */
+	uint16_t type;       /**< Record type the rule applies to. */
+};
+
+struct kr_renumber {
+	array_t(struct renumber_rule) rules;
+};
+
+struct kr_renumber *kr_renumber_create(void)
+{
+	struct kr_renumber *r = malloc(sizeof(*r));
+	if (r) {
+		array_init(r->rules);
+	}
+	return r;
+}
+
+void kr_renumber_free(struct kr_renumber *r)
+{
+	if (!r) {
+		return;
+	}
+	for (size_t i = 0; i < r->rules.len; ++i) {
+		free(r->rules.at[i].owner);
+	}
+	array_clear(r->rules);
+	free(r);
+}
+
+/** @internal Append an empty rule with the given target, or NULL. */
+static struct renumber_rule *rule_push(struct kr_renumber *r, const uint8_t *target, int target_len)
+{
+	if (!r || !target || (target_len != 4 && target_len != 16)) {
+		return NULL;
+	}
+	struct renumber_rule rule;
+	memset(&rule, 0, sizeof(rule));
+	rule.type = (target_len == 4) ? KNOT_RRTYPE_A : KNOT_RRTYPE_AAAA;
+	memcpy(rule.target, target, target_len);
+	if (array_push(r->rules, rule) < 0) {
+		return NULL;
+	}
+	return &array_tail(r->rules);
+}
+
+int kr_renumber_prefix(struct kr_renumber *r, const uint8_t *subnet, int bitlen,
+                       const uint8_t *target, int target_len)
+{
+	if (!subnet || bitlen <= 0 || bitlen > target_len * 8) {
+		return kr_error(EINVAL);
+	}
+	struct renumber_rule *rule = rule_push(r, target, target_len);
+	if (!rule) {
+		return kr_error(ENOMEM);
+	}
+	memcpy(rule->subnet, subnet, (bitlen + 7) / 8);
+	rule->bitlen = bitlen;
+	return kr_ok();
+}
+
+int kr_renumber_name(struct kr_renumber *r, const knot_dname_t *owner,
+                     const uint8_t *target, int target_len)
+{
+	if (!owner) {
+		return kr_error(EINVAL);
+	}
+	struct renumber_rule *rule = rule_push(r, target, target_len);
+	if (!rule) {
+		return kr_error(ENOMEM);
+	}
+	rule->owner = knot_dname_copy(owner, NULL);
+	if (!rule->owner) {
+		array_pop(r->rules);
+		return kr_error(ENOMEM);
+	}
+	rule->bitlen = target_len * 8;
+	return kr_ok();
+}
+
+/** @internal Find first rule matching the rdata, rules keep insertion order. */
+static const struct renumber_rule *rule_match(struct kr_renumber *r, const knot_rrset_t *rr,
+                                              const knot_rdata_t *rd)
+{
+	for (size_t i = 0; i < r->rules.len; ++i) {
+		const struct renumber_rule *rule = &r->rules.at[i];
+		if (rule->type != rr->type) {
+			continue;
+		}
+		if (rule->owner) {
+			if (knot_dname_is_equal(rule->owner, rr->owner)) {
+				return rule;
+			}
+		} else if (knot_rdata_rdlen(rd) * 8 >= rule->bitlen &&
+		           kr_bitcmp((const char *)rule->subnet,
+		                     (const char *)knot_rdata_data(rd), rule->bitlen) == 0) {
+			return rule;
+		}
+	}
+	return NULL;
+}
+
+/** @internal Replace the matched prefix bits in place, including partial bytes. */
+static void rule_apply(const struct renumber_rule *rule, knot_rdata_t *rd)
+{
+	uint8_t *data = knot_rdata_data(rd);
+	const int whole = rule->bitlen / 8;
+	const int rest = rule->bitlen % 8;
+	memcpy(data, rule->target, whole);
+	if (rest > 0) {
+		const uint8_t mask = 0xff << (8 - rest);
+		data[whole] = (rule->target[whole] & mask) | (data[whole] & ~mask);
+	}
+}
+
+int kr_renumber_answer(struct kr_renumber *r, knot_pkt_t *answer)
+{
+	if (!r || !answer) {
+		return kr_error(EINVAL);
+	}
+	const knot_pktsection_t *an = knot_pkt_section(answer, KNOT_ANSWER);
+	if (r->rules.len == 0 || an->count == 0) {
+		return 0;
+	}
+	/* First pass - rewrite only when something matches */
+	bool changed = false;
+	for (unsigned i = 0; i < an->count && !changed; ++i) {
+		const knot_rrset_t *rr = knot_pkt_rr(an, i);
+		if (rr->type != KNOT_RRTYPE_A && rr->type != KNOT_RRTYPE_AAAA) {
+			continue;
+		}
+		for (uint16_t j = 0; j < rr->rrs.rr_count && !changed; ++j) {
+			changed = rule_match(r, rr, knot_rdataset_at(&rr->rrs, j)) != NULL;
+		}
+	}
+	if (!changed) {
+		return 0;
+	}
+	/* Copy the section (sans signatures, rewritten data can not be
+	 * validated) and rewrite all rdatas of each matched rrset in one pass. */
+	knot_rrset_t **copies = malloc(an->count * sizeof(*copies));
+	if (!copies) {
+		return kr_error(ENOMEM);
+	}
+	unsigned ncopies = 0;
+	for (unsigned i = 0; i < an->count; ++i) {
+		const knot_rrset_t *rr = knot_pkt_rr(an, i);
+		if (rr->type == KNOT_RRTYPE_RRSIG) {
+			continue;
+		}
+		knot_rrset_t *copy = knot_rrset_copy(rr, &answer->mm);
+		if (!copy) {
+			free(copies);
+			return kr_error(ENOMEM);
+		}
+		if (copy->type == KNOT_RRTYPE_A || copy->type == KNOT_RRTYPE_AAAA) {
+			for (uint16_t j = 0; j < copy->rrs.rr_count; ++j) {
+				knot_rdata_t *rd = knot_rdataset_at(&copy->rrs, j);
+				const struct renumber_rule *rule = rule_match(r, copy, rd);
+				if (rule) {
+					rule_apply(rule, rd);
+				}
+			}
+		}
+		copies[ncopies++] = copy;
+	}
+	/* Rebuild the packet with the saved question and rewritten section */
+	knot_dname_t qname[KNOT_DNAME_MAXLEN];
+	knot_dname_to_wire(qname, knot_pkt_qname(answer), sizeof(qname));
+	const uint16_t qclass = knot_pkt_qclass(answer);
+	const uint16_t qtype = knot_pkt_qtype(answer);
+	kr_pkt_recycle(answer);
+	knot_pkt_put_question(answer, qname, qclass, qtype);
+	for (unsigned i = 0; i < ncopies; ++i) {
+		knot_pkt_put(answer, 0, copies[i], KNOT_PF_FREE);
+	}
+	free(copies);
+	return 1;
+}
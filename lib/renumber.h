@@ -0,0 +1,68 @@
+/*  Copyright (C) 2016 CZ.NIC, z.s.p.o. <knot-dns@labs.nic.cz>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file renumber.h
+ * @brief Compiled address-renumbering rule set.
+ *
+ * Rules are compiled once into a compact array; rewriting an answer is
+ * a single C pass over the packet that handles all rdatas of an rrset
+ * at once, replaces the matched prefix bits in place and strips
+ * signatures when something changed. Used by the renumber module (and
+ * policy.REROUTE) through the Lua bindings.
+ */
+
+#pragma once
+
+#include <libknot/packet/pkt.h>
+#include "lib/defines.h"
+
+struct kr_renumber;
+
+/** Create an empty rule set. */
+KR_EXPORT
+struct kr_renumber *kr_renumber_create(void);
+
+/** Destroy a rule set. */
+KR_EXPORT
+void kr_renumber_free(struct kr_renumber *r);
+
+/**
+ * Add a prefix rewrite rule. Record family is derived from target length
+ * (4 = A, 16 = AAAA), bitlen prefix bits are replaced on match.
+ * @return 0 or an error code
+ */
+KR_EXPORT
+int kr_renumber_prefix(struct kr_renumber *r, const uint8_t *subnet, int bitlen,
+                       const uint8_t *target, int target_len);
+
+/**
+ * Add an owner-name rewrite rule, the whole address is replaced on match.
+ * @return 0 or an error code
+ */
+KR_EXPORT
+int kr_renumber_name(struct kr_renumber *r, const knot_dname_t *owner,
+                     const uint8_t *target, int target_len);
+
+/**
+ * Rewrite address records in the answer section. Rules are matched in
+ * insertion order, first match wins. When anything is rewritten the
+ * section is rebuilt without signatures, as rewritten data can not be
+ * validated.
+ * @return 1 when the answer was rewritten, 0 when untouched, or an error code
+ */
+KR_EXPORT
+int kr_renumber_answer(struct kr_renumber *r, knot_pkt_t *answer);
@@ -16,6 +16,7 @@
 
 #include <ctype.h>
 #include <stdio.h>
+#include <time.h>
 #include <fcntl.h>
 #include <assert.h>
 #include <arpa/inet.h>
@@ -27,6 +28,7 @@
 #include "lib/rplan.h"
 #include "lib/layer/iterate.h"
 #include "lib/dnssec/ta.h"
+#include "lib/probes.h"
 #if defined(ENABLE_COOKIES)
 #include "lib/cookies/control.h"
 #include "lib/cookies/helper.h"
@@ -37,6 +39,16 @@
 
 #define DEBUG_MSG(qry, fmt...) QRDEBUG((qry), "resl",  fmt)
 
+/* EDNS client subnet, see QUERY_CLIENT_SUBNET. */
+#ifndef KNOT_EDNS_OPTION_CLIENT_SUBNET
+#define KNOT_EDNS_OPTION_CLIENT_SUBNET 8
+#endif
+#define ECS_SOURCE_V4 24 /**< Announced IPv4 source prefix length. */
+#define ECS_SOURCE_V6 56 /**< Announced IPv6 source prefix length. */
+
+#define LAME_FAILS_FAST 3   /**< Failures after which a cut is answered SERVFAIL from cache. */
+#define LAME_INFLIGHT_MAX 8 /**< Concurrent recursions allowed into a cut that started to fail. */
+
 /**
  * @internal Defer execution of current query.
  * The current layer state and input will be pushed to a stack and resumed on next iteration.
@@ -62,39 +74,197 @@ static int reset_yield(knot_layer_t *ctx) { return kr_ok(); }
 static int finish_yield(knot_layer_t *ctx) { return kr_ok(); }
 static int produce_yield(knot_layer_t *ctx, knot_pkt_t *pkt) { return kr_ok(); }
 
-/** @internal Macro for iterating module layers. */
+volatile sig_atomic_t kr_activity = KR_ACTIVITY_idle;
+uint64_t kr_activity_samples[KR_ACTIVITY_COUNT];
+
+/** @internal Monotonic nanoseconds for the optional layer timing. */
+static inline uint64_t layer_ticks(void)
+{
+	struct timespec ts = { 0 };
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/** @internal Macro for iterating module layers.
+  * Walks the request's pinned dispatch generation, so only modules
+  * that registered the hook are visited and a module reload cannot
+  * change the tables under a query in flight, see kr_context_compile_layers().
+  * With layers.timing set, each invocation is accounted into the
+  * parallel timing table; the switch branch predicts away otherwise. */
 #define RESUME_LAYERS(from, req, qry, func, ...) \
     (req)->current_query = (qry); \
-	for (size_t i = (from); i < (req)->ctx->modules->len; ++i) { \
-		struct kr_module *mod = (req)->ctx->modules->at[i]; \
-		if (mod->layer) { \
-			struct knot_layer layer = {.state = (req)->state, .api = mod->layer(mod), .data = (req)}; \
-			if (layer.api && layer.api->func) { \
-				(req)->state = layer.api->func(&layer, ##__VA_ARGS__); \
-				if ((req)->state == KNOT_STATE_YIELD) { \
-					func ## _yield(&layer, ##__VA_ARGS__); \
-					break; \
-				} \
-			} \
+	kr_activity = KR_ACTIVITY_ ## func; \
+	for (size_t i = (from); (req)->layers && i < (req)->layers->func.len; ++i) { \
+		struct knot_layer layer = {.state = (req)->state, .api = (req)->layers->func.at[i], .data = (req)}; \
+		if ((req)->layers->timing) { \
+			const uint64_t t0 = layer_ticks(); \
+			(req)->state = layer.api->func(&layer, ##__VA_ARGS__); \
+			struct kr_layer_timing *t = &(req)->layers->time_ ## func.at[i]; \
+			t->ns += layer_ticks() - t0; \
+			t->calls += 1; \
+		} else { \
+			(req)->state = layer.api->func(&layer, ##__VA_ARGS__); \
+		} \
+		if ((req)->state == KNOT_STATE_YIELD) { \
+			func ## _yield(&layer, ##__VA_ARGS__); \
+			break; \
 		} \
 	} /* Invalidate current query. */ \
+	kr_activity = KR_ACTIVITY_idle; \
 	(req)->current_query = NULL
 
 /** @internal Macro for starting module iteration. */
 #define ITERATE_LAYERS(req, qry, func, ...) RESUME_LAYERS(0, req, qry, func, ##__VA_ARGS__)
 
-/** @internal Find layer id matching API. */
+/** @internal Find consume layer id matching API. */
 static inline size_t layer_id(struct kr_request *req, const struct knot_layer_api *api) {
-	module_array_t *modules = req->ctx->modules;
-	for (size_t i = 0; i < modules->len; ++i) {
-		struct kr_module *mod = modules->at[i];
-		if (mod->layer && mod->layer(mod) == api) {
+	if (!req->layers) {
+		return 0;
+	}
+	layer_array_t *layers = &req->layers->consume;
+	for (size_t i = 0; i < layers->len; ++i) {
+		if (layers->at[i] == api) {
 			return i;
 		}
 	}
 	return 0; /* Not found, try all. */
 }
 
+/** @internal Free one dispatch generation. */
+static void layer_set_free(struct kr_layer_set *set)
+{
+	if (!set) {
+		return;
+	}
+	array_clear(set->begin);
+	array_clear(set->reset);
+	array_clear(set->finish);
+	array_clear(set->consume);
+	array_clear(set->produce);
+	array_clear(set->time_begin);
+	array_clear(set->time_reset);
+	array_clear(set->time_finish);
+	array_clear(set->time_consume);
+	array_clear(set->time_produce);
+	free(set);
+}
+
+/** @internal Unload modules parked until the retired generations drain. */
+static void retired_modules_flush(struct kr_context *ctx)
+{
+	for (size_t i = 0; i < ctx->modules_retired.len; ++i) {
+		struct kr_module *mod = ctx->modules_retired.at[i];
+		kr_module_unload(mod);
+		free(mod);
+	}
+	array_clear(ctx->modules_retired);
+}
+
+/** @internal Drop one pinned reference, freeing drained retired generations. */
+static void layer_set_release(struct kr_context *ctx, struct kr_layer_set *set)
+{
+	if (!set || --set->refs > 0 || set == ctx->layers) {
+		return;
+	}
+	struct kr_layer_set **prev = &ctx->layers_old;
+	while (*prev && *prev != set) {
+		prev = &(*prev)->next;
+	}
+	if (*prev) {
+		*prev = set->next;
+	}
+	layer_set_free(set);
+	if (!ctx->layers_old) {
+		retired_modules_flush(ctx);
+	}
+}
+
+int kr_context_compile_layers(struct kr_context *ctx)
+{
+	if (!ctx || !ctx->modules) {
+		return kr_error(EINVAL);
+	}
+	struct kr_layer_set *set = calloc(1, sizeof(*set));
+	if (!set) {
+		return kr_error(ENOMEM);
+	}
+	for (size_t i = 0; i < ctx->modules->len; ++i) {
+		struct kr_module *mod = ctx->modules->at[i];
+		const knot_layer_api_t *api = mod->layer ? mod->layer(mod) : NULL;
+		if (!api) {
+			continue;
+		}
+		const struct kr_layer_timing timing = { .module = mod };
+		int ret = 0;
+		if (api->begin) {
+			ret |= array_push(set->begin, api) < 0;
+			ret |= array_push(set->time_begin, timing) < 0;
+		}
+		if (api->reset) {
+			ret |= array_push(set->reset, api) < 0;
+			ret |= array_push(set->time_reset, timing) < 0;
+		}
+		if (api->finish) {
+			ret |= array_push(set->finish, api) < 0;
+			ret |= array_push(set->time_finish, timing) < 0;
+		}
+		if (api->consume) {
+			ret |= array_push(set->consume, api) < 0;
+			ret |= array_push(set->time_consume, timing) < 0;
+		}
+		if (api->produce) {
+			ret |= array_push(set->produce, api) < 0;
+			ret |= array_push(set->time_produce, timing) < 0;
+		}
+		if (ret != 0) {
+			layer_set_free(set);
+			return kr_error(ENOMEM);
+		}
+	}
+	/* Flip the generation; in-flight requests keep the one they pinned. */
+	struct kr_layer_set *old = ctx->layers;
+	set->timing = old ? old->timing : false;
+	ctx->layers = set;
+	if (old) {
+		if (old->refs == 0) {
+			layer_set_free(old);
+		} else {
+			old->next = ctx->layers_old;
+			ctx->layers_old = old;
+		}
+	}
+	return kr_ok();
+}
+
+int kr_context_retire_module(struct kr_context *ctx, struct kr_module *module)
+{
+	if (!ctx || !module) {
+		return kr_error(EINVAL);
+	}
+	/* Park only while some retired generation may still dispatch into it. */
+	if (ctx->layers_old && array_push(ctx->modules_retired, module) >= 0) {
+		return kr_ok();
+	}
+	kr_module_unload(module);
+	free(module);
+	return kr_ok();
+}
+
+void kr_context_free_layers(struct kr_context *ctx)
+{
+	if (!ctx) {
+		return;
+	}
+	layer_set_free(ctx->layers);
+	ctx->layers = NULL;
+	while (ctx->layers_old) {
+		struct kr_layer_set *set = ctx->layers_old;
+		ctx->layers_old = set->next;
+		layer_set_free(set);
+	}
+	retired_modules_flush(ctx);
+}
+
 /* @internal We don't need to deal with locale here */
 KR_CONST static inline bool isletter(unsigned chr)
 { return (chr | 0x20 /* tolower */) - 'a' <= 'z' - 'a'; }
@@ -146,10 +316,11 @@ static void check_empty_nonterms(struct kr_query *qry, knot_pkt_t *pkt, struct k
 	struct kr_cache_entry *entry = NULL;
 	/* @note: The non-terminal must be direct child of zone cut (e.g. label distance <= 2),
 	 *        otherwise this would risk leaking information to parent if the NODATA TTD > zone cut TTD. */
-	int labels = knot_dname_labels(target, NULL) - knot_dname_labels(cut_name, NULL);
-	while (target[0] && labels > 2) {
-		target = knot_wire_next_label(target, NULL);
-		--labels;
+	int labels = qry->sname_view.labels - knot_dname_labels(cut_name, NULL);
+	if (labels > 2 && labels - 2 < qry->sname_view.labels) {
+		/* Jump straight to the direct child of the cut. */
+		target += qry->sname_view.label_off[labels - 2];
+		labels = 2;
 	}
 	for (int i = 0; i < labels; ++i) {
 		int ret = kr_cache_peek(cache, KR_CACHE_PKT, target, KNOT_RRTYPE_NS, &entry, &timestamp);
@@ -164,6 +335,51 @@ static void check_empty_nonterms(struct kr_query *qry, knot_pkt_t *pkt, struct k
 	}
 }
 
+/** @internal Memoized result of a zone cut search, see ns_fetch_cut(). */
+struct cut_memo_entry {
+	struct kr_zonecut cut;
+	bool want_secured;
+	bool secured;
+};
+
+/** @internal Fetch a zone cut found earlier in this request. */
+static int ns_fetch_cut_memo(struct kr_request *req, struct kr_query *qry,
+                             const knot_dname_t *name, bool want_secured, bool *secured)
+{
+	struct cut_memo_entry *found = map_get(&req->cut_memo, (const char *)name);
+	if (!found || found->want_secured != want_secured) {
+		return kr_error(ENOENT);
+	}
+	kr_zonecut_set(&qry->zone_cut, found->cut.name);
+	int ret = kr_zonecut_copy(&qry->zone_cut, &found->cut);
+	if (ret == 0) {
+		ret = kr_zonecut_copy_trust(&qry->zone_cut, &found->cut);
+	}
+	if (ret == 0) {
+		*secured = found->secured;
+	}
+	return ret;
+}
+
+/** @internal Remember a found zone cut for sibling subqueries (best effort). */
+static void ns_memoize_cut(struct kr_request *req, struct kr_query *qry,
+                           const knot_dname_t *name, bool want_secured, bool secured)
+{
+	struct cut_memo_entry *entry = mm_alloc(&req->pool, sizeof(*entry));
+	if (!entry) {
+		return;
+	}
+	entry->want_secured = want_secured;
+	entry->secured = secured;
+	if (kr_zonecut_init(&entry->cut, qry->zone_cut.name, &req->pool) != 0 ||
+	    kr_zonecut_copy(&entry->cut, &qry->zone_cut) != 0 ||
+	    kr_zonecut_copy_trust(&entry->cut, &qry->zone_cut) != 0) {
+		return; /* Pool memory, freed with the whole request. */
+	}
+	entry->cut.intern = &req->intern;
+	map_set(&req->cut_memo, (const char *)name, entry);
+}
+
 static int ns_fetch_cut(struct kr_query *qry, struct kr_request *req, knot_pkt_t *pkt)
 {
 	int ret = 0;
@@ -174,12 +390,20 @@ static int ns_fetch_cut(struct kr_query *qry, struct kr_request *req, knot_pkt_t
 		/* If at/subdomain of parent zone cut, start from its encloser.
 		 * This is for case when we get to a dead end (and need glue from parent), or DS refetch. */
 		struct kr_query *parent = qry->parent;
-		bool secured = (qry->flags & QUERY_DNSSEC_WANT);
+		const bool want_secured = (qry->flags & QUERY_DNSSEC_WANT);
+		bool secured = want_secured;
+		const knot_dname_t *name = qry->sname;
 		if (parent && parent->zone_cut.name[0] != '\0' && knot_dname_in(parent->zone_cut.name, qry->sname)) {
-			const knot_dname_t *encloser = knot_wire_next_label(parent->zone_cut.name, NULL);
-			ret = kr_zonecut_find_cached(req->ctx, &qry->zone_cut, encloser, qry->timestamp.tv_sec, &secured);
-		} else {
-			ret = kr_zonecut_find_cached(req->ctx, &qry->zone_cut, qry->sname, qry->timestamp.tv_sec, &secured);
+			name = knot_wire_next_label(parent->zone_cut.name, NULL);
+		}
+		/* Sibling subqueries repeat the same label-by-label descent, reuse it. */
+		ret = ns_fetch_cut_memo(req, qry, name, want_secured, &secured);
+		if (ret != 0) {
+			ret = kr_zonecut_find_cached(req->ctx, &qry->zone_cut, name,
+			                             qry->timestamp.tv_sec, &secured);
+			if (ret == 0) {
+				ns_memoize_cut(req, qry, name, want_secured, secured);
+			}
 		}
 		/* Check if there's a non-terminal between target and current cut. */
 		if (ret == 0) {
@@ -298,9 +522,43 @@ static int edns_erase_and_reserve(knot_pkt_t *pkt)
 	return knot_pkt_reserve(pkt, len);
 }
 
+/** @internal Instantiate the context OPT template into a packet.
+  * The template shape is fixed for the lifetime of the context, so a flat
+  * copy of the pre-built rdata replaces the generic knot_rrset_copy() walk;
+  * variable fields (DO bit, payload, per-query options) are patched on the
+  * copy afterwards as before. */
+static knot_rrset_t *edns_dup(const knot_rrset_t *tpl, knot_mm_t *mm)
+{
+	knot_rrset_t *opt = mm_alloc(mm, sizeof(*opt));
+	if (!opt) {
+		return NULL;
+	}
+	/* The OPT owner is always the root name. */
+	knot_dname_t *owner = mm_alloc(mm, 1);
+	if (!owner) {
+		mm_free(mm, opt);
+		return NULL;
+	}
+	owner[0] = '\0';
+	knot_rrset_init(opt, owner, tpl->type, tpl->rclass);
+	const size_t size = knot_rdataset_size(&tpl->rrs);
+	opt->rrs.data = mm_alloc(mm, size);
+	if (!opt->rrs.data) {
+		mm_free(mm, owner);
+		mm_free(mm, opt);
+		return NULL;
+	}
+	memcpy(opt->rrs.data, tpl->rrs.data, size);
+	opt->rrs.rr_count = tpl->rrs.rr_count;
+	return opt;
+}
+
 static int edns_create(knot_pkt_t *pkt, knot_pkt_t *template, struct kr_request *req)
 {
-	pkt->opt_rr = knot_rrset_copy(req->ctx->opt_rr, &pkt->mm);
+	pkt->opt_rr = edns_dup(req->ctx->opt_rr, &pkt->mm);
+	if (!pkt->opt_rr) {
+		return kr_error(ENOMEM);
+	}
 	size_t wire_size = knot_edns_wire_size(pkt->opt_rr);
 #if defined(ENABLE_COOKIES)
 	if (req->ctx->cookie_ctx.clnt.enabled ||
@@ -330,11 +588,16 @@ static int answer_prepare(knot_pkt_t *answer, knot_pkt_t *query, struct kr_reque
 	return kr_ok();
 }
 
-static void write_extra_records(rr_array_t *arr, knot_pkt_t *answer)
+/** @internal Write an array of extra records, stopping at the space budget.
+  * @return true when all records fit */
+static bool write_extra_records(rr_array_t *arr, knot_pkt_t *answer)
 {
 	for (size_t i = 0; i < arr->len; ++i) {
-		knot_pkt_put(answer, 0, arr->at[i], 0);
+		if (knot_pkt_put(answer, 0, arr->at[i], 0) != KNOT_EOK) {
+			return false;
+		}
 	}
+	return true;
 }
 
 static int answer_fail(knot_pkt_t *answer)
@@ -368,11 +631,21 @@ static int answer_finalize(struct kr_request *request, int state)
 	if (answer->current < KNOT_AUTHORITY) {
 		knot_pkt_begin(answer, KNOT_AUTHORITY);
 	}
-	write_extra_records(&request->authority, answer);
-	/* Write additional records. */
+	const bool authority_fit = write_extra_records(&request->authority, answer);
+	/* Write additional records. They are a pure optimisation, so once the
+	 * authority didn't fit they are dropped whole - a shorter answer that
+	 * the client can use beats a truncated one it has to retry over TCP. */
 	knot_pkt_begin(answer, KNOT_ADDITIONAL);
-	write_extra_records(&request->additional, answer);
-	/* Write EDNS information */
+	if (authority_fit) {
+		write_extra_records(&request->additional, answer);
+	}
+	/* A positive answer is complete without its extras, the client can
+	 * look up anything dropped. Only an empty answer depends on the
+	 * authority (SOA, referral), so only there force the TCP retry. */
+	if (!authority_fit && knot_wire_get_ancount(answer->wire) == 0) {
+		knot_wire_set_tc(answer->wire);
+	}
+	/* Write EDNS information, its space is reserved since answer_prepare(). */
 	int ret = 0;
 	if (answer->opt_rr) {
 		knot_pkt_begin(answer, KNOT_ADDITIONAL);
@@ -416,22 +689,87 @@ static int query_finalize(struct kr_request *request, struct kr_query *qry, knot
 				knot_edns_set_do(pkt->opt_rr);
 				knot_wire_set_cd(pkt->wire);
 			}
-			ret = edns_put(pkt);
+			/* Announce the client subnet, but not for infrastructure
+			 * subqueries - their answers do not depend on the client. */
+			if (ret == 0 && request->ecs.source_len > 0 && qry->parent == NULL) {
+				uint8_t ecs_buf[4 + 16];
+				const size_t addr_len = (request->ecs.source_len + 7) / 8;
+				ecs_buf[0] = 0;
+				ecs_buf[1] = request->ecs.family;
+				ecs_buf[2] = request->ecs.source_len;
+				ecs_buf[3] = 0; /* Scope, always 0 in queries. */
+				memcpy(ecs_buf + 4, request->ecs.addr, addr_len);
+				ret = knot_edns_add_option(pkt->opt_rr, KNOT_EDNS_OPTION_CLIENT_SUBNET,
+				                           4 + addr_len, ecs_buf, &pkt->mm);
+			}
+			if (ret == 0) {
+				ret = edns_put(pkt);
+			}
 		}
 	}
 	return ret;
 }
 
+/** @internal Derive the announced client subnet from the query source.
+  * The address is truncated to the announced prefix, so all clients of
+  * one subnet share the same ECS option and cache partition. */
+static void ecs_init(struct kr_request *request)
+{
+	memset(&request->ecs, 0, sizeof(request->ecs));
+	const struct sockaddr *addr = request->qsource.addr;
+	if (!(request->options & QUERY_CLIENT_SUBNET) || !addr) {
+		return;
+	}
+	switch (addr->sa_family) {
+	case AF_INET:
+		request->ecs.family = 1;
+		request->ecs.source_len = ECS_SOURCE_V4;
+		break;
+	case AF_INET6:
+		request->ecs.family = 2;
+		request->ecs.source_len = ECS_SOURCE_V6;
+		break;
+	default:
+		return;
+	}
+	const size_t used = (request->ecs.source_len + 7) / 8;
+	memcpy(request->ecs.addr, kr_inaddr(addr), used);
+	/* Zero the bits past the prefix. */
+	const unsigned tail = request->ecs.source_len % 8;
+	if (tail != 0) {
+		request->ecs.addr[used - 1] &= (uint8_t)(0xff << (8 - tail));
+	}
+}
+
 int kr_resolve_begin(struct kr_request *request, struct kr_context *ctx, knot_pkt_t *answer)
 {
 	/* Initialize request */
 	request->ctx = ctx;
 	request->answer = answer;
+	/* Pin the current layer dispatch generation, compiling it on first use. */
+	request->layers = NULL;
+	if (!ctx->layers && kr_context_compile_layers(ctx) != 0) {
+		return KNOT_STATE_FAIL;
+	}
+	request->layers = ctx->layers;
+	request->layers->refs += 1;
 	request->options = ctx->options;
 	request->state = KNOT_STATE_CONSUME;
 	request->current_query = NULL;
 	array_init(request->authority);
 	array_init(request->additional);
+	request->cut_memo = map_make();
+	request->cut_memo.malloc = (map_alloc_f) mm_alloc;
+	request->cut_memo.free = (map_free_f) mm_free;
+	request->cut_memo.baton = &request->pool;
+	request->vld_memo = map_make();
+	request->vld_memo.malloc = (map_alloc_f) mm_alloc;
+	request->vld_memo.free = (map_free_f) mm_free;
+	request->vld_memo.baton = &request->pool;
+	kr_dname_intern_init(&request->intern, &request->pool);
+	ecs_init(request);
+	memset(&request->async, 0, sizeof(request->async));
+	memset(&request->trace, 0, sizeof(request->trace));
 
 	/* Expect first query */
 	kr_rplan_init(&request->rplan, request, &request->pool);
@@ -522,9 +860,7 @@ static void update_nslist_rtt(struct kr_context *ctx, struct kr_query *qry, cons
 		if (kr_inaddr_equal(src, addr)) {
 			kr_nsrep_update_rtt(&qry->ns, addr, elapsed, ctx->cache_rtt, KR_NS_UPDATE);
 			WITH_DEBUG {
-				char addr_str[INET6_ADDRSTRLEN];
-				inet_ntop(addr->sa_family, kr_inaddr(addr), addr_str, sizeof(addr_str));
-				DEBUG_MSG(qry, "<= server: '%s' rtt: %ld ms\n", addr_str, elapsed);
+				DEBUG_MSG(qry, "<= server: '%s' rtt: %ld ms\n", kr_straddr(addr), elapsed);
 			}
 		} else {
 			/* Response didn't come from this IP, but we know the RTT must be at least
@@ -534,9 +870,7 @@ static void update_nslist_rtt(struct kr_context *ctx, struct kr_query *qry, cons
 			 * its RTT is 50ms, but we can say that its score shouldn't be less than 50. */
 			 kr_nsrep_update_rtt(&qry->ns, addr, elapsed, ctx->cache_rtt, KR_NS_MAX);
 			 WITH_DEBUG {
-			 	char addr_str[INET6_ADDRSTRLEN];
-			 	inet_ntop(addr->sa_family, kr_inaddr(addr), addr_str, sizeof(addr_str));
-			 	DEBUG_MSG(qry, "<= server: '%s' rtt: >=%ld ms\n", addr_str, elapsed);
+			 	DEBUG_MSG(qry, "<= server: '%s' rtt: >=%ld ms\n", kr_straddr(addr), elapsed);
 			 }
 		}
 		/* Subtract query start time from elapsed time */
@@ -565,16 +899,44 @@ static void update_nslist_score(struct kr_request *request, struct kr_query *qry
 	} else if (!(qry->flags & QUERY_DNSSEC_BOGUS)) {
 		kr_nsrep_update_rtt(&qry->ns, src, KR_NS_TIMEOUT, ctx->cache_rtt, KR_NS_RESET);
 		WITH_DEBUG {
-			char addr_str[INET6_ADDRSTRLEN];
-			inet_ntop(src->sa_family, kr_inaddr(src), addr_str, sizeof(addr_str));
-			DEBUG_MSG(qry, "=> server: '%s' flagged as 'bad'\n", addr_str);
+			DEBUG_MSG(qry, "=> server: '%s' flagged as 'bad'\n", kr_straddr(src));
+		}
+	}
+}
+
+int kr_resolve_trace(struct kr_request *request)
+{
+	if (!request) {
+		return kr_error(EINVAL);
+	}
+	if (!request->trace.ev) {
+		request->trace.ev = mm_alloc(&request->pool,
+				KR_TRACE_LEN * sizeof(struct kr_trace_event));
+		if (!request->trace.ev) {
+			return kr_error(ENOMEM);
 		}
 	}
+	request->trace.len = 0;
+	request->trace.t0 = layer_ticks();
+	kr_resolve_trace_add(request, KR_TRACE_SUBMIT);
+	return kr_ok();
+}
+
+void kr_resolve_trace_add(struct kr_request *request, unsigned phase)
+{
+	if (!request || !request->trace.ev || request->trace.len >= KR_TRACE_LEN) {
+		return;
+	}
+	struct kr_trace_event *ev = &request->trace.ev[request->trace.len];
+	ev->us = (layer_ticks() - request->trace.t0) / 1000;
+	ev->phase = phase;
+	request->trace.len += 1;
 }
 
 int kr_resolve_consume(struct kr_request *request, const struct sockaddr *src, knot_pkt_t *packet)
 {
 	struct kr_rplan *rplan = &request->rplan;
+	kr_resolve_trace_add(request, KR_TRACE_CONSUME);
 
 	/* Empty resolution plan, push packet as the new query */
 	if (packet && kr_rplan_empty(rplan)) {
@@ -586,6 +948,7 @@ int kr_resolve_consume(struct kr_request *request, const struct sockaddr *src, k
 
 	/* Different processing for network error */
 	struct kr_query *qry = array_tail(rplan->pending);
+	KR_PROBE3(resolve_consume, request, qry->sname, qry->stype);
 	bool tried_tcp = (qry->flags & QUERY_TCP);
 	if (!packet || packet->size == 0) {
 		if (tried_tcp) {
@@ -757,6 +1120,30 @@ static int zone_cut_check(struct kr_request *request, struct kr_query *qry, knot
 				return KNOT_STATE_FAIL;
 			}
 		}
+		/* Cuts that keep failing answer SERVFAIL straight from the
+		 * failure cache, and concurrent recursions into a cut that
+		 * started to fail are capped, so a dead zone cannot
+		 * monopolize the task capacity. */
+		int fails = kr_cache_peek_lame(&request->ctx->cache, qry->zone_cut.name,
+		                               qry->timestamp.tv_sec);
+		if (fails >= LAME_FAILS_FAST) {
+			DEBUG_MSG(qry, "=> zone cut keeps failing, answering early\n");
+			return KNOT_STATE_FAIL;
+		}
+		if (fails > 0 && request->ctx->cache_busy) {
+			unsigned *inflight = lru_set(request->ctx->cache_busy,
+					(const char *)qry->zone_cut.name,
+					knot_dname_size(qry->zone_cut.name));
+			if (inflight) {
+				if (*inflight >= LAME_INFLIGHT_MAX) {
+					DEBUG_MSG(qry, "=> too many recursions into failing cut\n");
+					return KNOT_STATE_FAIL;
+				}
+				*inflight += 1;
+				qry->busy_cut = qry->zone_cut.name;
+				qry->flags |= QUERY_CUT_BUSY;
+			}
+		}
 		/* Update minimized QNAME if zone cut changed */
 		if (qry->zone_cut.name[0] != '\0' && !(qry->flags & QUERY_NO_MINIMIZE)) {
 			if (kr_make_query(qry, packet) != 0) {
@@ -781,6 +1168,13 @@ int kr_resolve_produce(struct kr_request *request, struct sockaddr **dst, int *t
 	}
 	/* If we have deferred answers, resume them. */
 	struct kr_query *qry = array_tail(rplan->pending);
+	KR_PROBE3(resolve_produce, request, qry->sname, qry->stype);
+	kr_resolve_trace_add(request, KR_TRACE_PRODUCE);
+	/* A layer awaits an external operation; hold the deferred answers
+	 * until the driver resumes us, see kr_resolve_await(). */
+	if (request->async.pending) {
+		return KNOT_STATE_YIELD;
+	}
 	if (qry->deferred != NULL) {
 		/* @todo: Refactoring validator, check trust chain before resuming. */
 		switch(trust_chain_check(request, qry)) {
@@ -882,8 +1276,9 @@ ns_election:
 		return KNOT_STATE_PRODUCE;
 	}
 
-	/* Randomize query case (if not in safemode) */
-	qry->secret = (qry->flags & QUERY_SAFEMODE) ? 0 : kr_rand_uint(UINT32_MAX);
+	/* Randomize query case (if not in safemode or for servers known to break it) */
+	qry->secret = (qry->flags & QUERY_SAFEMODE) || (qry->ns.reputation & KR_NS_NOCASE)
+		? 0 : kr_rand_uint(UINT32_MAX);
 	knot_dname_t *qname_raw = (knot_dname_t *)knot_pkt_qname(packet);
 	randomized_qname_case(qname_raw, qry->secret);
 
@@ -988,11 +1383,53 @@ int kr_resolve_checkout(struct kr_request *request, struct sockaddr *src,
 	return kr_ok();
 }
 
+int kr_resolve_graft(struct kr_request *request, const knot_pkt_t *source)
+{
+	if (!request || !request->answer || !source) {
+		return kr_error(EINVAL);
+	}
+	knot_pkt_t *answer = request->answer;
+	if (source->size < KNOT_WIRE_HEADER_SIZE || source->size > answer->max_size) {
+		return kr_error(EMSGSIZE);
+	}
+	kr_resolve_trace_add(request, KR_TRACE_FINISH);
+	/* The wire is taken over whole, bypassing answer_finalize();
+	 * the request never consumed anything so there is nothing of
+	 * its own to merge in. */
+	memcpy(answer->wire, source->wire, source->size);
+	answer->size = source->size;
+	request->state = KNOT_STATE_DONE;
+	ITERATE_LAYERS(request, NULL, finish);
+	/* Unpin the dispatch generation, possibly freeing a drained one. */
+	layer_set_release(request->ctx, request->layers);
+	request->layers = NULL;
+	return KNOT_STATE_DONE;
+}
+
 int kr_resolve_finish(struct kr_request *request, int state)
 {
-#ifndef NDEBUG
 	struct kr_rplan *rplan = &request->rplan;
-#endif
+	kr_resolve_trace_add(request, KR_TRACE_FINISH);
+	/* Cancel a parked module operation, the request is going away. */
+	if (request->async.op && request->async.cancel) {
+		request->async.cancel(request->async.op);
+	}
+	memset(&request->async, 0, sizeof(request->async));
+	/* Remember cuts that fail, so follow-up queries into them can
+	 * fail fast instead of running the full timeout gauntlet. */
+	if (state == KNOT_STATE_FAIL) {
+		struct kr_query *last = NULL;
+		if (rplan->pending.len > 0) {
+			last = array_tail(rplan->pending);
+		} else if (rplan->resolved.len > 0) {
+			last = array_tail(rplan->resolved);
+		}
+		if (last && last->zone_cut.name && last->zone_cut.name[0] != '\0' &&
+		    !(last->flags & (QUERY_CACHED|QUERY_STUB))) {
+			kr_cache_report_lame(&request->ctx->cache, last->zone_cut.name,
+			                     last->timestamp.tv_sec);
+		}
+	}
 	/* Finalize answer */
 	if (answer_finalize(request, state) != 0) {
 		state = KNOT_STATE_FAIL;
@@ -1009,9 +1446,36 @@ int kr_resolve_finish(struct kr_request *request, int state)
 	ITERATE_LAYERS(request, NULL, finish);
 	DEBUG_MSG(NULL, "finished: %d, queries: %zu, mempool: %zu B\n",
 	          request->state, rplan->resolved.len, (size_t) mp_total_size(request->pool.ctx));
+	/* Unpin the dispatch generation, possibly freeing a drained one. */
+	layer_set_release(request->ctx, request->layers);
+	request->layers = NULL;
 	return KNOT_STATE_DONE;
 }
 
+int kr_resolve_await(struct kr_request *request, void *op, void (*cancel)(void *op))
+{
+	if (!request || !op || !request->current_query) {
+		return kr_error(EINVAL);
+	}
+	if (request->async.pending) {
+		return kr_error(EBUSY);
+	}
+	request->async.op = op;
+	request->async.cancel = cancel;
+	request->async.pending = true;
+	return kr_ok();
+}
+
+void *kr_resolve_complete(struct kr_request *request)
+{
+	if (!request || !request->async.op) {
+		return NULL;
+	}
+	void *op = request->async.op;
+	memset(&request->async, 0, sizeof(request->async));
+	return op;
+}
+
 struct kr_rplan *kr_resolve_plan(struct kr_request *request)
 {
 	if (request) {
@@ -1028,5 +1492,13 @@ knot_mm_t *kr_resolve_pool(struct kr_request *request)
 	return NULL;
 }
 
+void *kr_request_scratch(struct kr_request *request, size_t size)
+{
+	if (request == NULL || size == 0) {
+		return NULL;
+	}
+	return mm_alloc(&request->pool, size);
+}
+
 #undef DEBUG_MSG
 
@@ -17,6 +17,7 @@
 #pragma once
 
 #include <netinet/in.h>
+#include <signal.h>
 #include <sys/socket.h>
 #include <libknot/packet/pkt.h>
 
@@ -27,8 +28,10 @@
 #include "lib/generic/array.h"
 #include "lib/nsrep.h"
 #include "lib/rplan.h"
+#include "lib/intern.h"
 #include "lib/module.h"
 #include "lib/cache.h"
+#include "lib/dnssec.h"
 
 /**
  * @file resolve.h
@@ -74,8 +77,75 @@
 
 /** @cond internal Array of modules. */
 typedef array_t(struct kr_module *) module_array_t;
+/** @internal Array of layer APIs. */
+typedef array_t(const knot_layer_api_t *) layer_array_t;
+/** @internal Timing accumulator for one module's hook, see kr_context_compile_layers(). */
+struct kr_layer_timing {
+	const struct kr_module *module; /**< Owning module. */
+	uint64_t ns;                    /**< Accumulated wall-clock time. */
+	uint64_t calls;
+};
+typedef array_t(struct kr_layer_timing) layer_timing_array_t;
 /* @endcond */
 
+/**
+ * One compiled generation of the per-hook layer dispatch.
+ *
+ * Requests pin the generation that is current at kr_resolve_begin() for
+ * their whole lifetime, so modules can be loaded and unloaded without
+ * touching queries in flight: kr_context_compile_layers() builds a fresh
+ * generation and flips the context pointer, the previous one is kept on
+ * a retired list until its last pinned request finishes. Modules handed
+ * to kr_context_retire_module() are unloaded only once every retired
+ * generation has drained.
+ */
+struct kr_layer_set {
+	layer_array_t begin, reset, finish, consume, produce;
+	/** Optional per-hook timing, indexed like the dispatch tables. */
+	layer_timing_array_t time_begin, time_reset, time_finish, time_consume, time_produce;
+	bool timing;              /**< Runtime switch for the timing accounting. */
+	unsigned refs;            /**< Requests pinned to this generation. */
+	struct kr_layer_set *next; /**< Link in the retired list. */
+};
+
+/** Resolution phases for the sampling profiler.
+  * The lowercase suffixes are pasted from hook names in the layer
+  * iteration macro, see RESUME_LAYERS in resolve.c. */
+enum kr_activity_phase {
+	KR_ACTIVITY_idle = 0,
+	KR_ACTIVITY_begin,
+	KR_ACTIVITY_reset,
+	KR_ACTIVITY_finish,
+	KR_ACTIVITY_consume,
+	KR_ACTIVITY_produce,
+	KR_ACTIVITY_COUNT
+};
+
+/** Phases recorded by the per-request timing trace, see kr_resolve_trace(). */
+enum kr_trace_phase {
+	KR_TRACE_SUBMIT = 0, /**< Client query accepted. */
+	KR_TRACE_CONSUME,    /**< An answer (or the query itself) entered the layers. */
+	KR_TRACE_PRODUCE,    /**< A subquery was produced. */
+	KR_TRACE_SEND,       /**< A subquery was handed to the network. */
+	KR_TRACE_FINISH,     /**< The answer was finalized. */
+	KR_TRACE_COUNT
+};
+
+/** One timing trace event. */
+struct kr_trace_event {
+	uint32_t us;   /**< Microseconds since the trace was armed. */
+	uint8_t phase; /**< enum kr_trace_phase. */
+};
+
+/** Fixed trace capacity per request, excess events are dropped. */
+#define KR_TRACE_LEN 48
+
+/** Current resolution phase, a single store at each layer boundary.
+  * Sampled asynchronously by the profiler signal handler. */
+KR_EXPORT extern volatile sig_atomic_t kr_activity;
+/** Per-phase sample counters, written only from the signal handler. */
+KR_EXPORT extern uint64_t kr_activity_samples[KR_ACTIVITY_COUNT];
+
 /**
  * Name resolution context.
  *
@@ -92,13 +162,19 @@ struct kr_context
 	map_t negative_anchors;
 	struct kr_zonecut root_hints;
 	struct kr_cache cache;
-	kr_nsrep_lru_t *cache_rtt;
+	kr_nsrep_rtt_lru_t *cache_rtt;
 	kr_nsrep_lru_t *cache_rep;
+	kr_zonecut_busy_lru_t *cache_busy; /**< In-flight recursions into failing cuts (optional). */
 	module_array_t *modules;
+	/** Current layer dispatch generation, see kr_context_compile_layers(). */
+	struct kr_layer_set *layers;
+	struct kr_layer_set *layers_old; /**< Retired generations with requests still in flight. */
+	module_array_t modules_retired;  /**< Unloaded when the last retired generation drains. */
 	/* The cookie context structure should not be held within the cookies
 	 * module because of better access. */
 	struct kr_cookie_ctx cookie_ctx;
 	kr_cookie_lru_t *cache_cookie;
+	kr_dnskey_lru_t *cache_dnskey;
 	knot_mm_t *pool;
 };
 
@@ -111,30 +187,95 @@ struct kr_context
  * multiplexing or custom I/O.
  *
  * @note All data for this request must be allocated from the given pool.
+ * @note Laid out hot/cold: the dispatch fields the layer pipeline reads on
+ *       every hook lead the struct, per-phase and per-answer state follows.
+ *       Mirrored up to the upstream info in daemon/lua/kres.lua, keep in sync.
  */
 struct kr_request {
     struct kr_context *ctx;
     knot_pkt_t *answer;
     struct kr_query *current_query;    /**< Current evaluated query. */
+    struct kr_layer_set *layers;       /**< Dispatch generation pinned at kr_resolve_begin(). */
+    uint32_t options;
+    int state;
     struct {
         const knot_rrset_t *key;
         const struct sockaddr *addr;
         const struct sockaddr *dst_addr;
         const knot_pkt_t *packet;
         const knot_rrset_t *opt;
+        bool tcp;                      /**< true if the request is on TCP; only meaningful if (dst_addr). */
     } qsource;
     struct {
         unsigned rtt;                  /**< Current upstream RTT */
         const struct sockaddr *addr;   /**< Current upstream address */
     } upstream;                        /**< Upstream information, valid only in consume() phase */
-    uint32_t options;
-    int state;
     rr_array_t authority;
     rr_array_t additional;
     struct kr_rplan rplan;
+    map_t cut_memo;                    /**< Memo of zone cuts found for this request. */
+    map_t vld_memo;                    /**< Memo of verified signatures (see layer/validate). */
     knot_mm_t pool;
+    struct kr_dname_intern intern;     /**< Request-wide dname intern table. */
+    struct {
+        uint8_t addr[16];              /**< Client prefix, zero-padded to whole bytes. */
+        uint8_t family;                /**< ECS address family: 1 = IPv4, 2 = IPv6, 0 = none. */
+        uint8_t source_len;            /**< Announced source prefix length (bits). */
+    } ecs;                             /**< EDNS client subnet state, see QUERY_CLIENT_SUBNET. */
+    struct {
+        void *op;                      /**< Module-owned pending operation, see kr_resolve_await(). */
+        void (*cancel)(void *op);      /**< Invoked if the request is torn down while parked. */
+        bool pending;                  /**< Parked between await and resume. */
+    } async;                           /**< Pending external operation a layer awaits. */
+    struct {
+        struct kr_trace_event *ev;     /**< Pool-allocated when armed, NULL otherwise. */
+        uint8_t len;                   /**< Recorded events, up to KR_TRACE_LEN. */
+        uint64_t t0;                   /**< Monotonic nanoseconds at arming. */
+    } trace;                           /**< Timing trace, see kr_resolve_trace(). */
 };
 
+/** @internal The dispatch fields above must stay within the first cache line. */
+KR_STATIC_ASSERT(offsetof(struct kr_request, qsource) <= 64, kr_request_hot_line);
+
+/**
+ * Compile a new generation of the per-hook layer dispatch tables.
+ *
+ * Only modules that registered a given hook are visited during resolution,
+ * so the tables must be recompiled whenever modules are loaded, unloaded
+ * or reordered. The new generation takes effect for requests beginning
+ * after the call; requests in flight keep the generation they pinned.
+ *
+ * @param ctx resolution context
+ * @return 0 or an error code
+ */
+KR_EXPORT
+int kr_context_compile_layers(struct kr_context *ctx);
+
+/**
+ * Hand over an unregistered module for deferred teardown.
+ *
+ * If retired dispatch generations still reference the module's layers,
+ * it is parked and unloaded when the last of them drains; otherwise it
+ * is unloaded immediately. Call after recompiling the dispatch tables
+ * without the module.
+ *
+ * @param ctx    resolution context
+ * @param module module removed from the context's module list
+ * @return 0 or an error code
+ */
+KR_EXPORT
+int kr_context_retire_module(struct kr_context *ctx, struct kr_module *module);
+
+/**
+ * Free all dispatch generations and unload parked modules.
+ *
+ * @note Ignores pinned references, use only when tearing down the context.
+ *
+ * @param ctx resolution context
+ */
+KR_EXPORT
+void kr_context_free_layers(struct kr_context *ctx);
+
 /**
  * Begin name resolution.
  *
@@ -207,6 +348,78 @@ int kr_resolve_checkout(struct kr_request *request, struct sockaddr *src,
 KR_EXPORT
 int kr_resolve_finish(struct kr_request *request, int state);
 
+/**
+ * Finish resolution with an answer grafted from an identical finished request.
+ *
+ * The source answer wire is copied into the request answer verbatim instead
+ * of re-running the consume/produce machinery, so N duplicates cost one
+ * resolution plus N sends. The caller must ensure the question (case
+ * included) and EDNS expectations of both clients match, and is responsible
+ * for patching the message ID afterwards. Layer finish hooks still run, so
+ * per-request accounting stays balanced.
+ *
+ * @param  request request state, begun but not yet consumed
+ * @param  source  finished answer of the identical request
+ * @return         DONE or an error code (the request is then still live)
+ */
+KR_EXPORT
+int kr_resolve_graft(struct kr_request *request, const knot_pkt_t *source);
+
+/**
+ * Arm the per-request timing trace.
+ *
+ * The trace array is allocated from the request pool, so it costs nothing
+ * after the request finishes. Phase boundaries inside the resolver record
+ * themselves; the daemon adds submit and send events. Call after
+ * kr_resolve_begin().
+ *
+ * @param  request request state
+ * @return         kr_ok() or an error code
+ */
+KR_EXPORT
+int kr_resolve_trace(struct kr_request *request);
+
+/**
+ * Record one trace event, a no-op when the trace is not armed or full.
+ *
+ * @param  request request state
+ * @param  phase   event tag, see enum kr_trace_phase
+ */
+KR_EXPORT
+void kr_resolve_trace_add(struct kr_request *request, unsigned phase);
+
+/**
+ * Park the request on an external operation from inside a layer hook.
+ *
+ * The async contract for C modules: the hook registers its operation
+ * handle with this call and returns KNOT_STATE_YIELD.  The layer state is
+ * pickled (as for subquery yields), the driver parks the task without
+ * touching its mempool, and once the operation completes - on the loop
+ * thread, e.g. from a uv_async or thread-pool done callback - the driver
+ * is asked to resume (worker_resume() in the daemon).  The same hook is
+ * then re-entered with the pickled packet; it takes the finished handle
+ * with kr_resolve_complete() and returns a real state.
+ *
+ * The module must guarantee exactly one of resume or completion of the
+ * request; if the request is torn down first, @a cancel is invoked with
+ * the handle and the module must no longer touch the request.
+ *
+ * @param request request state inside a layer hook
+ * @param op      module-owned operation handle
+ * @param cancel  teardown callback (may be NULL)
+ * @return        0, EBUSY if an operation is already pending
+ */
+KR_EXPORT
+int kr_resolve_await(struct kr_request *request, void *op, void (*cancel)(void *op));
+
+/**
+ * Take the completed operation handle registered by kr_resolve_await().
+ * @param  request request state
+ * @return         the handle, or NULL when nothing was awaited
+ */
+KR_EXPORT
+void *kr_resolve_complete(struct kr_request *request);
+
 /**
  * Return resolution plan.
  * @param  request request state
@@ -223,3 +436,12 @@ struct kr_rplan *kr_resolve_plan(struct kr_request *request);
 KR_EXPORT KR_PURE
 knot_mm_t *kr_resolve_pool(struct kr_request *request);
 
+/**
+ * Allocate per-request scratch memory, released together with the request.
+ * @param  request request state
+ * @param  size    allocation size
+ * @return         allocated memory or NULL
+ */
+KR_EXPORT
+void *kr_request_scratch(struct kr_request *request, size_t size);
+
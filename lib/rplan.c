@@ -19,13 +19,14 @@
 
 #include "lib/rplan.h"
 #include "lib/resolve.h"
+#include "lib/utils.h"
 #include "lib/cache.h"
 #include "lib/defines.h"
 #include "lib/layer.h"
 
 #define DEBUG_MSG(qry, fmt...) QRDEBUG(qry, "plan",  fmt)
 #define QUERY_PROVIDES(q, name, cls, type) \
-    ((q)->sclass == (cls) && (q)->stype == type && knot_dname_is_equal((q)->sname, name))
+    ((q)->sclass == (cls) && (q)->stype == type && kr_dname_equal_fold((q)->sname, name))
 
 /** @internal LUT of query flag names. */
 const knot_lookup_t query_flag_names[] = {
@@ -42,31 +43,56 @@ const knot_lookup_t *kr_query_flag_names(void)
 
 static struct kr_query *query_create(knot_mm_t *pool, const knot_dname_t *name)
 {
-	struct kr_query *qry = mm_alloc(pool, sizeof(struct kr_query));
+	/* Embed the name in the same block to save a pool allocation per query.
+	 * Queries cannot be recycled for siblings, as popped ones stay
+	 * reachable from the resolved list until the request is finished. */
+	int name_len = 0;
+	if (name != NULL) {
+		name_len = knot_dname_size(name);
+		if (name_len < 0) {
+			return NULL;
+		}
+	}
+	struct kr_query *qry = mm_alloc(pool, sizeof(struct kr_query) + name_len);
 	if (qry == NULL) {
 		return NULL;
 	}
 
 	memset(qry, 0, sizeof(struct kr_query));
 	if (name != NULL) {
-		qry->sname = knot_dname_copy(name, pool);
-		if (qry->sname == NULL) {
-			mm_free(pool, qry);
-			return NULL;
-		}
+		qry->sname = (knot_dname_t *)(qry + 1);
+		memcpy(qry->sname, name, name_len);
+		knot_dname_to_lower(qry->sname);
+		/* sname is already the case-folded copy; derive label
+		 * boundaries and the key hash from it in the same pass. */
+		kr_qname_view_set(&qry->sname_view, qry->sname);
 	}
 
-	knot_dname_to_lower(qry->sname);
 	return qry;
 }
 
 static void query_free(knot_mm_t *pool, struct kr_query *qry)
 {
 	kr_zonecut_deinit(&qry->zone_cut);
-	mm_free(pool, qry->sname);
 	mm_free(pool, qry);
 }
 
+/** @internal Release the slot held in the failing-cut concurrency cap. */
+static void busy_cut_release(struct kr_rplan *rplan, struct kr_query *qry)
+{
+	if (!(qry->flags & QUERY_CUT_BUSY)) {
+		return;
+	}
+	qry->flags &= ~QUERY_CUT_BUSY;
+	struct kr_context *ctx = rplan->request ? rplan->request->ctx : NULL;
+	unsigned *count = (ctx && ctx->cache_busy && qry->busy_cut)
+		? lru_get(ctx->cache_busy, (const char *)qry->busy_cut,
+		          knot_dname_size(qry->busy_cut)) : NULL;
+	if (count && *count > 0) {
+		*count -= 1;
+	}
+}
+
 int kr_rplan_init(struct kr_rplan *rplan, struct kr_request *request, knot_mm_t *pool)
 {
 	if (rplan == NULL) {
@@ -89,6 +115,7 @@ void kr_rplan_deinit(struct kr_rplan *rplan)
 	}
 
 	for (size_t i = 0; i < rplan->pending.len; ++i) {
+		busy_cut_release(rplan, rplan->pending.at[i]);
 		query_free(rplan->pool, rplan->pending.at[i]);
 	}
 	for (size_t i = 0; i < rplan->resolved.len; ++i) {
@@ -107,6 +134,40 @@ bool kr_rplan_empty(struct kr_rplan *rplan)
 	return rplan->pending.len == 0;
 }
 
+/** @internal Scheduling weight of a query type.
+  * Zone infrastructure fetches tend to be cached or answered from few labels,
+  * and the parent is blocked on them anyway, so they go first. */
+static unsigned query_type_weight(uint16_t type)
+{
+	switch (type) {
+	case KNOT_RRTYPE_DS:     return 4;
+	case KNOT_RRTYPE_DNSKEY: return 3;
+	case KNOT_RRTYPE_A:      return 2;
+	case KNOT_RRTYPE_AAAA:   return 1;
+	default:                 return 0;
+	}
+}
+
+/** @internal Sink the freshly pushed query into its priority position, so that
+  * the array tail is always the best next step. Subqueries stay above their
+  * ancestors as they are always deeper, and ties keep the push order. */
+static void query_prioritize(struct kr_rplan *rplan, struct kr_query *qry)
+{
+	unsigned depth = 0;
+	for (struct kr_query *up = qry->parent; up != NULL; up = up->parent) {
+		depth += 1;
+	}
+	qry->priority = (depth << 3) | query_type_weight(qry->stype);
+	for (size_t i = rplan->pending.len - 1; i > 0; --i) {
+		struct kr_query *below = rplan->pending.at[i - 1];
+		if (below->priority <= qry->priority) {
+			break;
+		}
+		rplan->pending.at[i] = below;
+		rplan->pending.at[i - 1] = qry;
+	}
+}
+
 static struct kr_query *kr_rplan_push_query(struct kr_rplan *rplan,
                                             struct kr_query *parent,
                                             const knot_dname_t *name)
@@ -132,6 +193,7 @@ static struct kr_query *kr_rplan_push_query(struct kr_rplan *rplan,
 	qry->ns.addr[0].ip.sa_family = AF_UNSPEC;
 	gettimeofday(&qry->timestamp, NULL);
 	kr_zonecut_init(&qry->zone_cut, (const uint8_t *)"", rplan->pool);
+	qry->zone_cut.intern = &rplan->request->intern;
 	array_push(rplan->pending, qry);
 
 	return qry;
@@ -147,6 +209,7 @@ struct kr_query *kr_rplan_push_empty(struct kr_rplan *rplan, struct kr_query *pa
 	if (qry == NULL) {
 		return NULL;
 	}
+	query_prioritize(rplan, qry);
 
 	WITH_DEBUG {
 	DEBUG_MSG(parent, "plan '%s' type '%s'\n", "", "");
@@ -168,6 +231,7 @@ struct kr_query *kr_rplan_push(struct kr_rplan *rplan, struct kr_query *parent,
 
 	qry->sclass = cls;
 	qry->stype = type;
+	query_prioritize(rplan, qry);
 
 	WITH_DEBUG {
 	char name_str[KNOT_DNAME_MAXLEN], type_str[16];
@@ -193,8 +257,14 @@ int kr_rplan_pop(struct kr_rplan *rplan, struct kr_query *qry)
 	/* Find the query, it will likely be on top */
 	for (size_t i = rplan->pending.len; i --> 0;) {
 		if (rplan->pending.at[i] == qry) {
-			array_del(rplan->pending, i);
+			/* Shift the rest down, array_del() would swap in the
+			 * tail and break the priority order. */
+			for (size_t j = i + 1; j < rplan->pending.len; ++j) {
+				rplan->pending.at[j - 1] = rplan->pending.at[j];
+			}
+			array_pop(rplan->pending);
 			array_push(rplan->resolved, qry);
+			busy_cut_release(rplan, qry);
 			break;
 		}
 	}
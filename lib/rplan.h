@@ -16,11 +16,13 @@
 
 #pragma once
 
+#include <stddef.h>
 #include <sys/time.h>
 #include <libknot/dname.h>
 #include <libknot/codes.h>
 
 #include "lib/cache.h"
+#include "lib/utils.h"
 #include "lib/zonecut.h"
 #include "lib/nsrep.h"
 
@@ -47,7 +49,11 @@
 	X(DNSSEC_WEXPAND,  1 << 19) /**< Query response has wildcard expansion. */ \
 	X(PERMISSIVE,      1 << 20) /**< Permissive resolver mode. */ \
 	X(STRICT,          1 << 21) /**< Strict resolver mode. */ \
-	X(BADCOOKIE_AGAIN, 1 << 22) /**< Query again because bad cookie returned. */
+	X(BADCOOKIE_AGAIN, 1 << 22) /**< Query again because bad cookie returned. */ \
+	X(SERVE_STALE,     1 << 23) /**< Allow expired records in answers. */ \
+	X(STALE,           1 << 24) /**< Query was answered from expired cache. */ \
+	X(CLIENT_SUBNET,   1 << 25) /**< Attach EDNS client subnet to upstream queries. */ \
+	X(CUT_BUSY,        1 << 26) /**< Query holds a slot in the failing-cut cap. */
 
 /** Query flags */
 enum kr_query_flag {
@@ -62,6 +68,12 @@ const knot_lookup_t *kr_query_flag_names(void);
 
 /**
  * Single query representation.
+ *
+ * The layout is split hot/cold: the state-machine fields every layer
+ * invocation reads come first so they share the leading cache line with
+ * the zone cut name, while server-selection scratch and members written
+ * once per query (or read once per answer) sit at the tail.  Mirrored
+ * up to the zone cut in daemon/lua/kres.lua, keep the two in sync.
  */
 struct kr_query {
 	struct kr_query *parent;
@@ -72,12 +84,19 @@ struct kr_query {
 	uint32_t flags;
 	uint32_t secret;
 	uint16_t fails;
-	struct timeval timestamp;
+	uint16_t priority;
 	struct kr_zonecut zone_cut;
+	/* Cold section. */
 	struct kr_nsrep ns;
+	struct timeval timestamp;
 	struct kr_layer_pickle *deferred;
+	const knot_dname_t *busy_cut; /**< Cut counted by QUERY_CUT_BUSY, see kr_rplan_pop(). */
+	struct kr_qname_view sname_view; /**< Label offsets and hash of sname, set at query creation. */
 };
 
+/** @internal The hot section above must stay within the first cache line. */
+KR_STATIC_ASSERT(offsetof(struct kr_query, zone_cut) <= 64, kr_query_hot_line);
+
 /** @cond internal Array of queries. */
 typedef array_t(struct kr_query *) kr_qarray_t;
 /* @endcond */
@@ -133,7 +152,10 @@ struct kr_query *kr_rplan_push_empty(struct kr_rplan *rplan,
 
 /**
  * Push a query to the top of the resolution plan.
- * @note This means that this query takes precedence before all pending queries.
+ * @note The pending list is kept ordered by priority - subqueries are scheduled
+ *       above their ancestors and cheap infrastructure fetches (DS, DNSKEY,
+ *       addresses) above other siblings, so the query takes precedence before
+ *       all pending queries it doesn't depend on.
  * @param rplan plan instance
  * @param parent query parent (or NULL)
  * @param name resolved name
@@ -0,0 +1,230 @@
+/*  Copyright (C) 2016 CZ.NIC, z.s.p.o. <knot-dns@labs.nic.cz>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "lib/suffixmatch.h"
+
+/*
+ * Compiled image = flat array of nodes, referenced by byte offset.
+ * Node = { u16 child count, u16 flags, count * { u8 byte, u32 offset } },
+ * children sorted by byte. A name is in the set iff the walk over its
+ * lookup-format bytes passes a terminal node right after a label separator
+ * (the separator is part of the inserted key, so 'cz' can not match 'czz').
+ */
+
+#define NODE_SIZE     4
+#define CHILD_SIZE    5
+#define NODE_TERMINAL 0x0001
+
+/** @internal Unaligned scalar read. */
+#define load_num(var, base) memcpy(&(var), (base), sizeof(var))
+
+/** @internal Build-time trie node. */
+struct build_node {
+	struct build_node **child;
+	uint8_t *bytes;
+	uint32_t off;
+	uint16_t count;
+	bool terminal;
+};
+
+struct kr_suffix_set {
+	struct build_node root;  /**< Build-time trie. */
+	uint8_t *image;          /**< Compiled node array. */
+	size_t image_len;
+	bool match_all;          /**< Root name inserted, everything matches. */
+};
+
+static struct build_node *node_child(struct build_node *node, uint8_t byte)
+{
+	uint16_t lo = 0, hi = node->count;
+	while (lo < hi) {
+		uint16_t mid = (lo + hi) / 2;
+		if (node->bytes[mid] < byte) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	if (lo < node->count && node->bytes[lo] == byte) {
+		return node->child[lo];
+	}
+	/* Insert new child */
+	struct build_node *next = calloc(1, sizeof(*next));
+	struct build_node **child = realloc(node->child, (node->count + 1) * sizeof(*child));
+	uint8_t *bytes = realloc(node->bytes, node->count + 1);
+	if (!next || !child || !bytes) {
+		free(next);
+		node->child = child ? child : node->child;
+		node->bytes = bytes ? bytes : node->bytes;
+		return NULL;
+	}
+	node->child = child;
+	node->bytes = bytes;
+	memmove(node->child + lo + 1, node->child + lo, (node->count - lo) * sizeof(*child));
+	memmove(node->bytes + lo + 1, node->bytes + lo, node->count - lo);
+	node->child[lo] = next;
+	node->bytes[lo] = byte;
+	node->count += 1;
+	return next;
+}
+
+static void free_node(struct build_node *node)
+{
+	for (uint16_t i = 0; i < node->count; ++i) {
+		free_node(node->child[i]);
+		free(node->child[i]);
+	}
+	free(node->child);
+	free(node->bytes);
+	node->child = NULL;
+	node->bytes = NULL;
+	node->count = 0;
+}
+
+struct kr_suffix_set *kr_suffix_set_create(void)
+{
+	return calloc(1, sizeof(struct kr_suffix_set));
+}
+
+void kr_suffix_set_free(struct kr_suffix_set *set)
+{
+	if (set) {
+		free_node(&set->root);
+		free(set->image);
+		free(set);
+	}
+}
+
+int kr_suffix_set_add(struct kr_suffix_set *set, const knot_dname_t *name)
+{
+	if (!set || !name) {
+		return kr_error(EINVAL);
+	}
+	/* Convert to lookup format, the trailing label separator stays
+	 * in the key so a suffix can only end on a label boundary. */
+	uint8_t lf[KNOT_DNAME_MAXLEN];
+	if (knot_dname_lf(lf, name, NULL) != 0) {
+		return kr_error(EINVAL);
+	}
+	if (lf[0] == 0) { /* Root name matches everything */
+		set->match_all = true;
+		return kr_ok();
+	}
+	struct build_node *node = &set->root;
+	for (uint8_t i = 0; i < lf[0]; ++i) {
+		node = node_child(node, lf[1 + i]);
+		if (!node) {
+			return kr_error(ENOMEM);
+		}
+	}
+	node->terminal = true;
+	/* Invalidate previous compilation */
+	free(set->image);
+	set->image = NULL;
+	set->image_len = 0;
+	return kr_ok();
+}
+
+static void assign_offsets(struct build_node *node, uint32_t *cur)
+{
+	node->off = *cur;
+	*cur += NODE_SIZE + node->count * CHILD_SIZE;
+	for (uint16_t i = 0; i < node->count; ++i) {
+		assign_offsets(node->child[i], cur);
+	}
+}
+
+static void write_node(uint8_t *base, const struct build_node *node)
+{
+	uint8_t *wp = base + node->off;
+	const uint16_t flags = node->terminal ? NODE_TERMINAL : 0;
+	memcpy(wp, &node->count, sizeof(node->count));
+	memcpy(wp + 2, &flags, sizeof(flags));
+	wp += NODE_SIZE;
+	for (uint16_t i = 0; i < node->count; ++i) {
+		wp[0] = node->bytes[i];
+		memcpy(wp + 1, &node->child[i]->off, sizeof(uint32_t));
+		wp += CHILD_SIZE;
+		write_node(base, node->child[i]);
+	}
+}
+
+int kr_suffix_set_compile(struct kr_suffix_set *set)
+{
+	if (!set) {
+		return kr_error(EINVAL);
+	}
+	uint32_t size = 0;
+	assign_offsets(&set->root, &size);
+	uint8_t *image = malloc(size);
+	if (!image) {
+		return kr_error(ENOMEM);
+	}
+	write_node(image, &set->root);
+	free(set->image);
+	set->image = image;
+	set->image_len = size;
+	return kr_ok();
+}
+
+int kr_suffix_set_match(const struct kr_suffix_set *set, const knot_dname_t *name)
+{
+	if (!set || !name) {
+		return kr_error(EINVAL);
+	}
+	if (set->match_all) {
+		return 1;
+	}
+	if (!set->image) {
+		return kr_error(EINVAL); /* Not compiled */
+	}
+	uint8_t lf[KNOT_DNAME_MAXLEN];
+	if (knot_dname_lf(lf, name, NULL) != 0) {
+		return kr_error(EINVAL);
+	}
+	const uint8_t *base = set->image;
+	uint32_t off = 0;
+	for (uint8_t i = 0; i < lf[0]; ++i) {
+		uint16_t count = 0, flags = 0;
+		load_num(count, base + off);
+		/* Binary search among children */
+		const uint8_t *child = base + off + NODE_SIZE;
+		const uint8_t byte = lf[1 + i];
+		uint16_t lo = 0, hi = count;
+		while (lo < hi) {
+			uint16_t mid = (lo + hi) / 2;
+			if (child[mid * CHILD_SIZE] < byte) {
+				lo = mid + 1;
+			} else {
+				hi = mid;
+			}
+		}
+		if (lo >= count || child[lo * CHILD_SIZE] != byte) {
+			return 0;
+		}
+		load_num(off, child + lo * CHILD_SIZE + 1);
+		/* A terminal node right after a label separator is a match. */
+		load_num(flags, base + off + 2);
+		if ((flags & NODE_TERMINAL) && byte == 0) {
+			return 1;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,63 @@
+/*  Copyright (C) 2016 CZ.NIC, z.s.p.o. <knot-dns@labs.nic.cz>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file suffixmatch.h
+ * @brief Compiled domain name suffix set.
+ *
+ * A set of names is compiled into a flat byte trie over the name lookup
+ * format (lowercased, reversed label order), where a suffix match becomes
+ * a prefix walk. Matching a name costs O(name length) with no allocation
+ * or case conversion, independent of the set size, so it scales to policy
+ * lists with many thousands of rules. Used by the policy module through
+ * the Lua bindings as a backend for suffix rules.
+ */
+
+#pragma once
+
+#include <libknot/dname.h>
+#include "lib/defines.h"
+
+struct kr_suffix_set;
+
+/** Create an empty suffix set. */
+KR_EXPORT
+struct kr_suffix_set *kr_suffix_set_create(void);
+
+/** Destroy a suffix set. */
+KR_EXPORT
+void kr_suffix_set_free(struct kr_suffix_set *set);
+
+/**
+ * Add a name to the set (invalidates previous compilation).
+ * @return 0 or an error code
+ */
+KR_EXPORT
+int kr_suffix_set_add(struct kr_suffix_set *set, const knot_dname_t *name);
+
+/**
+ * Compile added names into the flat matching structure.
+ * @return 0 or an error code
+ */
+KR_EXPORT
+int kr_suffix_set_compile(struct kr_suffix_set *set);
+
+/**
+ * Check whether the name equals or is a subdomain of any name in the set.
+ * @return 1 on match, 0 otherwise, error code on failure
+ */
+KR_EXPORT
+int kr_suffix_set_match(const struct kr_suffix_set *set, const knot_dname_t *name);
@@ -18,9 +18,11 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <math.h>
 #include <arpa/inet.h>
 #include <sys/time.h>
 #include <contrib/cleanup.h>
+#include <contrib/hash/hash.h>
 #include <ccan/isaac/isaac.h>
 #include <libknot/descriptor.h>
 #include <libknot/dname.h>
@@ -41,6 +43,17 @@ static isaac_ctx ISAAC;
 static bool isaac_seeded = false;
 #define SEED_SIZE 256
 
+/* Buffered random pool.  Workers are processes in this tree, so the
+ * process-global pool is naturally per-worker and needs no locking.
+ * Consumers draw from the pool by pointer bump; it is refilled from the
+ * isaac generator a batch at a time, and the generator itself is reseeded
+ * from the system after a bounded amount of output. */
+#define RAND_POOL_SIZE 4096
+#define RAND_POOL_RESEED 256 /* Refills between system reseeds (~1 MiB). */
+static uint8_t rand_pool[RAND_POOL_SIZE];
+static size_t rand_pool_pos = sizeof(rand_pool);
+static unsigned rand_pool_refills = 0;
+
 /*
  * Macros.
  */
@@ -163,16 +176,55 @@ int kr_rand_reseed(void)
 	uint8_t seed[SEED_SIZE];
 	randseed((char *)seed, sizeof(seed));
 	isaac_reseed(&ISAAC, seed, sizeof(seed));
+	isaac_seeded = true;
+	rand_pool_pos = sizeof(rand_pool); /* Discard pre-reseed output. */
 	return kr_ok();
 }
 
-unsigned kr_rand_uint(unsigned max)
+/** @internal Refill the pool in one batch, reseeding when it is due. */
+static void rand_pool_refill(void)
 {
-	if (!isaac_seeded) {
+	if (!isaac_seeded || ++rand_pool_refills >= RAND_POOL_RESEED) {
 		kr_rand_reseed();
-		isaac_seeded = true;
+		rand_pool_refills = 0;
 	}
-	return isaac_next_uint(&ISAAC, max);
+	uint32_t *word = (uint32_t *)rand_pool;
+	for (size_t i = 0; i < sizeof(rand_pool) / sizeof(uint32_t); ++i) {
+		word[i] = isaac_next_uint32(&ISAAC);
+	}
+	rand_pool_pos = 0;
+}
+
+void kr_rand_bytes(uint8_t *buf, size_t len)
+{
+	while (len > 0) {
+		if (rand_pool_pos >= sizeof(rand_pool)) {
+			rand_pool_refill();
+		}
+		size_t take = sizeof(rand_pool) - rand_pool_pos;
+		if (take > len) {
+			take = len;
+		}
+		memcpy(buf, rand_pool + rand_pool_pos, take);
+		rand_pool_pos += take;
+		buf += take;
+		len -= take;
+	}
+}
+
+unsigned kr_rand_uint(unsigned max)
+{
+	if (max == 0) {
+		return 0;
+	}
+	/* Rejection sampling keeps the distribution uniform, like the
+	 * isaac_next_uint() this replaces on the pooled fast path. */
+	const uint32_t min = (uint32_t)(-max) % max;
+	uint32_t r = 0;
+	do {
+		kr_rand_bytes((uint8_t *)&r, sizeof(r));
+	} while (r < min);
+	return r % max;
 }
 
 int kr_memreserve(void *baton, char **mem, size_t elm_size, size_t want, size_t *have)
@@ -194,6 +246,98 @@ int kr_memreserve(void *baton, char **mem, size_t elm_size, size_t want, size_t
     return -1;
 }
 
+/** @internal 0x01 resp. 0x80 in every byte. */
+#define SWAR_ONES 0x0101010101010101ULL
+#define SWAR_HIGH 0x8080808080808080ULL
+
+/** @internal Fold ASCII 'A'-'Z' to lowercase in all eight bytes at once. */
+static inline uint64_t swar_tolower(uint64_t v)
+{
+	const uint64_t low7 = v & ~SWAR_HIGH;
+	const uint64_t ge_a = low7 + (0x80 - 'A') * SWAR_ONES;
+	const uint64_t gt_z = low7 + (0x7f - 'Z') * SWAR_ONES;
+	const uint64_t is_upper = ge_a & ~gt_z & ~v & SWAR_HIGH;
+	return v | (is_upper >> 2);
+}
+
+/** @internal Unaligned word load, compiles to a single read where allowed. */
+static inline uint64_t swar_load(const uint8_t *p)
+{
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+bool kr_bytes_equal_fold(const uint8_t *a, const uint8_t *b, size_t len)
+{
+	for (; len >= sizeof(uint64_t); len -= sizeof(uint64_t)) {
+		if (swar_tolower(swar_load(a)) != swar_tolower(swar_load(b))) {
+			return false;
+		}
+		a += sizeof(uint64_t);
+		b += sizeof(uint64_t);
+	}
+	while (len-- > 0) {
+		uint8_t ca = *a++, cb = *b++;
+		if (ca >= 'A' && ca <= 'Z') ca += 'a' - 'A';
+		if (cb >= 'A' && cb <= 'Z') cb += 'a' - 'A';
+		if (ca != cb) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void kr_bytes_tolower(uint8_t *buf, size_t len)
+{
+	for (; len >= sizeof(uint64_t); len -= sizeof(uint64_t)) {
+		const uint64_t v = swar_tolower(swar_load(buf));
+		memcpy(buf, &v, sizeof(v));
+		buf += sizeof(uint64_t);
+	}
+	while (len-- > 0) {
+		if (*buf >= 'A' && *buf <= 'Z') {
+			*buf += 'a' - 'A';
+		}
+		buf += 1;
+	}
+}
+
+bool kr_dname_equal_fold(const knot_dname_t *a, const knot_dname_t *b)
+{
+	if (a == b) { /* Interned names resolve by pointer. */
+		return a != NULL;
+	}
+	if (!a || !b) {
+		return false;
+	}
+	/* Folding never changes the wire length, and label length bytes
+	 * (< 0x40) sit below 'A', so whole-wire folded compare is exact. */
+	const int len = knot_dname_size(a);
+	if (len != knot_dname_size(b)) {
+		return false;
+	}
+	return kr_bytes_equal_fold(a, b, len);
+}
+
+void kr_qname_view_set(struct kr_qname_view *view, const knot_dname_t *name)
+{
+	if (!view) {
+		return;
+	}
+	view->labels = 0;
+	if (!name) {
+		view->hash = 0;
+		return;
+	}
+	size_t off = 0;
+	while (name[off] != '\0' && view->labels < KR_QNAME_MAXLABELS) {
+		view->label_off[view->labels++] = off;
+		off += name[off] + 1;
+	}
+	view->hash = hash_keyed((const char *)name, off + 1);
+}
+
 int kr_pkt_recycle(knot_pkt_t *pkt)
 {
 	pkt->rrset_count = 0;
@@ -270,6 +414,21 @@ int kr_inaddr_len(const struct sockaddr *addr)
 	return kr_family_len(addr->sa_family);
 }
 
+const char *kr_straddr_buf(const struct sockaddr *addr, char *buf, size_t maxlen)
+{
+	if (!addr || !buf || maxlen < INET6_ADDRSTRLEN) {
+		return NULL;
+	}
+	return inet_ntop(addr->sa_family, kr_inaddr(addr), buf, maxlen);
+}
+
+const char *kr_straddr(const struct sockaddr *addr)
+{
+	/* Per-thread buffer, valid until the next call on this thread. */
+	static __thread char buf[INET6_ADDRSTRLEN];
+	return kr_straddr_buf(addr, buf, sizeof(buf));
+}
+
 int kr_straddr_family(const char *addr)
 {
 	if (!addr) {
@@ -439,3 +598,132 @@ char *kr_module_call(struct kr_context *ctx, const char *module, const char *pro
 	}
 	return NULL;
 }
+
+/** @internal Grow the writer buffer for at least extra more bytes. */
+static bool jsonw_reserve(struct kr_jsonw *w, size_t extra)
+{
+	if (w->oom) {
+		return false;
+	}
+	if (w->len + extra >= w->cap) {
+		size_t cap = w->cap > 0 ? w->cap : 512;
+		while (w->len + extra >= cap) {
+			cap *= 2;
+		}
+		char *buf = realloc(w->buf, cap);
+		if (!buf) {
+			free(w->buf);
+			w->buf = NULL;
+			w->oom = true;
+			return false;
+		}
+		w->buf = buf;
+		w->cap = cap;
+	}
+	return true;
+}
+
+static void jsonw_putc(struct kr_jsonw *w, char c)
+{
+	if (jsonw_reserve(w, 1)) {
+		w->buf[w->len++] = c;
+	}
+}
+
+static void jsonw_puts(struct kr_jsonw *w, const char *str)
+{
+	size_t len = strlen(str);
+	if (jsonw_reserve(w, len)) {
+		memcpy(w->buf + w->len, str, len);
+		w->len += len;
+	}
+}
+
+/** @internal Separator before the next value in the current container. */
+static void jsonw_sep(struct kr_jsonw *w)
+{
+	if (w->comma) {
+		jsonw_putc(w, ',');
+	}
+	w->comma = true;
+}
+
+/** @internal Escaping matches ccan/json emit_string: named escapes for the
+  * usual characters, \u00XX for other control bytes, the rest verbatim. */
+static void jsonw_string(struct kr_jsonw *w, const char *str)
+{
+	jsonw_putc(w, '"');
+	for (const unsigned char *s = (const unsigned char *)str; *s; ++s) {
+		switch (*s) {
+		case '"':  jsonw_puts(w, "\\\""); break;
+		case '\\': jsonw_puts(w, "\\\\"); break;
+		case '\b': jsonw_puts(w, "\\b"); break;
+		case '\f': jsonw_puts(w, "\\f"); break;
+		case '\n': jsonw_puts(w, "\\n"); break;
+		case '\r': jsonw_puts(w, "\\r"); break;
+		case '\t': jsonw_puts(w, "\\t"); break;
+		default:
+			if (*s < 0x20) {
+				char esc[8];
+				snprintf(esc, sizeof(esc), "\\u%04x", *s);
+				jsonw_puts(w, esc);
+			} else {
+				jsonw_putc(w, *s);
+			}
+		}
+	}
+	jsonw_putc(w, '"');
+}
+
+void kr_jsonw_init(struct kr_jsonw *w)
+{
+	memset(w, 0, sizeof(*w));
+}
+
+void kr_jsonw_open(struct kr_jsonw *w, char bracket)
+{
+	jsonw_sep(w);
+	jsonw_putc(w, bracket);
+	w->comma = false;
+}
+
+void kr_jsonw_close(struct kr_jsonw *w, char bracket)
+{
+	jsonw_putc(w, bracket);
+	w->comma = true;
+}
+
+void kr_jsonw_key(struct kr_jsonw *w, const char *key)
+{
+	jsonw_sep(w);
+	jsonw_string(w, key);
+	jsonw_putc(w, ':');
+	w->comma = false;
+}
+
+void kr_jsonw_str(struct kr_jsonw *w, const char *val)
+{
+	jsonw_sep(w);
+	jsonw_string(w, val);
+}
+
+void kr_jsonw_num(struct kr_jsonw *w, double val)
+{
+	jsonw_sep(w);
+	char buf[64];
+	if (isfinite(val)) {
+		snprintf(buf, sizeof(buf), "%.16g", val);
+	} else { /* Like ccan/json, JSON has no encoding for these. */
+		snprintf(buf, sizeof(buf), "null");
+	}
+	jsonw_puts(w, buf);
+}
+
+char *kr_jsonw_finish(struct kr_jsonw *w)
+{
+	if (!jsonw_reserve(w, 1)) {
+		return NULL;
+	}
+	w->buf[w->len] = '\0';
+	return w->buf;
+}
@@ -91,14 +91,52 @@ char* kr_strcatdup(unsigned n, ...);
 /** Reseed CSPRNG context. */
 int kr_rand_reseed(void);
 
-/** Get pseudo-random value. */
+/** Get pseudo-random value less than max (0 returns 0). */
 KR_EXPORT
 unsigned kr_rand_uint(unsigned max);
 
+/** Fill a buffer with pseudo-random bytes from the buffered pool.
+  * Cheaper than repeated kr_rand_uint() for IDs, nonces and the like. */
+KR_EXPORT
+void kr_rand_bytes(uint8_t *buf, size_t len);
+
 /** Memory reservation routine for knot_mm_t */
 KR_EXPORT
 int kr_memreserve(void *baton, char **mem, size_t elm_size, size_t want, size_t *have);
 
+/** Case-insensitive byte equality, folding a word at a time. */
+KR_EXPORT KR_PURE
+bool kr_bytes_equal_fold(const uint8_t *a, const uint8_t *b, size_t len);
+
+/** Lowercase ASCII in place, folding a word at a time. */
+KR_EXPORT
+void kr_bytes_tolower(uint8_t *buf, size_t len);
+
+/** Case-insensitive dname equality over the whole wire at once.
+  * Label lengths never collide with 'A'-'Z', so folding is safe. */
+KR_EXPORT KR_PURE
+bool kr_dname_equal_fold(const knot_dname_t *a, const knot_dname_t *b);
+
+/** @internal Maximum number of labels in a wire dname (each takes >= 2 octets). */
+#define KR_QNAME_MAXLABELS 127
+/** Precomputed view of a wire dname.
+  *
+  * Derived properties of a query name - label boundaries and a key hash -
+  * are computed in a single pass when the name is first seen, so the walks
+  * that repeatedly strip leading labels (qname minimization, empty
+  * non-terminal checks) can jump by offset instead of re-scanning. */
+struct kr_qname_view {
+	uint32_t hash;  /**< hash_keyed() over the wire form, for LRU/cache key producers. */
+	uint8_t labels; /**< Number of labels, root excluded. */
+	uint8_t label_off[KR_QNAME_MAXLABELS]; /**< Offset of the i-th label from the start. */
+};
+
+/** Compute the view of 'name' in one pass; name + label_off[k] is the name
+  * with 'k' leading labels stripped, for k < labels.
+  * @note The name is hashed as-is, fold it first if lookups compare folded. */
+KR_EXPORT
+void kr_qname_view_set(struct kr_qname_view *view, const knot_dname_t *name);
+
 /** @internal Fast packet reset. */
 KR_EXPORT
 int kr_pkt_recycle(knot_pkt_t *pkt);
@@ -121,6 +159,13 @@ int kr_inaddr_family(const struct sockaddr *addr);
 /** Address length for given family. */
 KR_EXPORT KR_PURE
 int kr_inaddr_len(const struct sockaddr *addr);
+/** Render address into a caller buffer (at least INET6_ADDRSTRLEN long).
+  * @return buf or NULL */
+KR_EXPORT
+const char *kr_straddr_buf(const struct sockaddr *addr, char *buf, size_t maxlen);
+/** Render address into a per-thread buffer, valid until the next call. */
+KR_EXPORT
+const char *kr_straddr(const struct sockaddr *addr);
 /** Return address type for string. */
 KR_EXPORT KR_PURE
 int kr_straddr_family(const char *addr);
@@ -166,3 +211,40 @@ int kr_rrarray_add(rr_array_t *array, const knot_rrset_t *rr, knot_mm_t *pool);
  */
 KR_EXPORT
 char *kr_module_call(struct kr_context *ctx, const char *module, const char *prop, const char *input);
+
+/*
+ * Streaming JSON writer.
+ *
+ * Append-only alternative to building a ccan/json node tree and then
+ * stringifying it: values are escaped and written straight into a growing
+ * buffer, so a dump costs amortised one allocation instead of one per
+ * node.  The caller emits structure in document order (open, keys, values,
+ * close); separators are inserted automatically.
+ */
+struct kr_jsonw {
+	char *buf;   /**< Growing output buffer. */
+	size_t len;  /**< Bytes written. */
+	size_t cap;  /**< Buffer capacity. */
+	bool comma;  /**< A separator is due before the next value. */
+	bool oom;    /**< An allocation failed, the document is void. */
+};
+
+KR_EXPORT
+void kr_jsonw_init(struct kr_jsonw *w);
+/** Open an object '{' or array '[', also valid as a value after a key. */
+KR_EXPORT
+void kr_jsonw_open(struct kr_jsonw *w, char bracket);
+/** Close the current object '}' or array ']'. */
+KR_EXPORT
+void kr_jsonw_close(struct kr_jsonw *w, char bracket);
+/** Write a member key; the next emitted value belongs to it. */
+KR_EXPORT
+void kr_jsonw_key(struct kr_jsonw *w, const char *key);
+KR_EXPORT
+void kr_jsonw_str(struct kr_jsonw *w, const char *val);
+KR_EXPORT
+void kr_jsonw_num(struct kr_jsonw *w, double val);
+/** Terminate and return the malloc'd document, NULL on allocation failure.
+  * The writer must not be reused afterwards. */
+KR_EXPORT
+char *kr_jsonw_finish(struct kr_jsonw *w);
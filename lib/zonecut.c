@@ -21,6 +21,8 @@
 #include <libknot/rrtype/aaaa.h>
 
 #include "lib/zonecut.h"
+#include "lib/intern.h"
+#include "lib/utils.h"
 #include "lib/rplan.h"
 #include "lib/defines.h"
 #include "lib/layer.h"
@@ -68,14 +70,29 @@ static const struct hint_info SBELT[HINT_COUNT] = {
 #undef I4
 #undef I6
 
+/** @internal Address pack with inline room for a typical NS: one AAAA
+  * and one A record (or three A records) fit without spilling. */
+typedef pack_sb_t(24) addr_pack_t;
+
+
+/** Copy the cut name, through the request intern table when available. */
+static knot_dname_t *cut_name_copy(struct kr_zonecut *cut, const knot_dname_t *name)
+{
+	if (cut->intern) {
+		return kr_dname_intern(cut->intern, name);
+	}
+	return knot_dname_copy(name, cut->pool);
+}
 
 static void update_cut_name(struct kr_zonecut *cut, const knot_dname_t *name)
 {
-	if (knot_dname_is_equal(name, cut->name)) {
+	if (kr_dname_equal_fold(name, cut->name)) {
 		return;
 	}
-	knot_dname_t *next_name = knot_dname_copy(name, cut->pool);
-	mm_free(cut->pool, cut->name);
+	knot_dname_t *next_name = cut_name_copy(cut, name);
+	if (!cut->intern) { /* Interned names are shared, don't free those. */
+		mm_free(cut->pool, cut->name);
+	}
 	cut->name = next_name;
 }
 
@@ -90,17 +107,20 @@ int kr_zonecut_init(struct kr_zonecut *cut, const knot_dname_t *name, knot_mm_t
 	cut->key  = NULL;
 	cut->trust_anchor = NULL;
 	cut->parent = NULL;
+	cut->intern = NULL;
 	cut->nsset = map_make();
 	cut->nsset.malloc = (map_alloc_f) mm_alloc;
 	cut->nsset.free = (map_free_f) mm_free;
 	cut->nsset.baton = pool;
+	array_init(cut->candidates);
+	cut->candidates_fresh = false;
 	return kr_ok();
 }
 
 static int free_addr_set(const char *k, void *v, void *baton)
 {
-	pack_t *pack = v;
-	pack_clear_mm(*pack, mm_free, baton);
+	addr_pack_t *pack = v;
+	pack_sb_clear_mm(*pack, mm_free, baton);
 	mm_free(baton, pack);
 	return kr_ok();
 }
@@ -110,11 +130,16 @@ void kr_zonecut_deinit(struct kr_zonecut *cut)
 	if (!cut) {
 		return;
 	}
-	mm_free(cut->pool, cut->name);
+	if (!cut->intern) { /* Interned names are shared, don't free those. */
+		mm_free(cut->pool, cut->name);
+	}
 	map_walk(&cut->nsset, free_addr_set, cut->pool);
 	map_clear(&cut->nsset);
 	knot_rrset_free(&cut->key, cut->pool);
 	knot_rrset_free(&cut->trust_anchor, cut->pool);
+	/* The candidate view memory belongs to the pool. */
+	array_init(cut->candidates);
+	cut->candidates_fresh = false;
 	cut->name = NULL;
 }
 
@@ -126,36 +151,36 @@ void kr_zonecut_set(struct kr_zonecut *cut, const knot_dname_t *name)
 	knot_rrset_t *key, *ta;
 	key = cut->key; cut->key = NULL;
 	ta = cut->trust_anchor; cut->trust_anchor = NULL;
+	struct kr_dname_intern *intern = cut->intern;
 	kr_zonecut_deinit(cut);
 	kr_zonecut_init(cut, name, cut->pool);
 	cut->key = key;
 	cut->trust_anchor = ta;
+	cut->intern = intern;
 }
 
 static int copy_addr_set(const char *k, void *v, void *baton)
 {
 	pack_t *addr_set = v;
 	struct kr_zonecut *dst = baton;
-	/* Clone addr_set pack */
-	pack_t *new_set = mm_alloc(dst->pool, sizeof(*new_set));
+	/* Clone addr_set pack, small sets stay in the inline storage */
+	addr_pack_t *new_set = mm_alloc(dst->pool, sizeof(*new_set));
 	if (!new_set) {
 		return kr_error(ENOMEM);
 	}
-	pack_init(*new_set);
+	pack_sb_init(*new_set);
 	/* Clone data only if needed */
 	if (addr_set->len > 0) {
-		new_set->at = mm_alloc(dst->pool, addr_set->len);
-		if (!new_set->at) {
+		if (sb_array_reserve_mm(*new_set, addr_set->len, kr_memreserve, dst->pool) != 0) {
 			mm_free(dst->pool, new_set);
 			return kr_error(ENOMEM);
 		}
 		memcpy(new_set->at, addr_set->at, addr_set->len);
 		new_set->len = addr_set->len;
-		new_set->cap = addr_set->len;
 	}
 	/* Reinsert */
 	if (map_set(&dst->nsset, k, new_set) != 0) {
-		pack_clear_mm(*new_set, mm_free, dst->pool);
+		pack_sb_clear_mm(*new_set, mm_free, dst->pool);
 		mm_free(dst->pool, new_set);
 		return kr_error(ENOMEM);
 	}
@@ -167,6 +192,7 @@ int kr_zonecut_copy(struct kr_zonecut *dst, const struct kr_zonecut *src)
 	if (!dst || !src) {
 		return kr_error(EINVAL);
 	}
+	dst->candidates_fresh = false;
 	/* We're not touching src nsset, I promise */
 	return map_walk((map_t *)&src->nsset, copy_addr_set, dst);
 }
@@ -205,15 +231,16 @@ int kr_zonecut_add(struct kr_zonecut *cut, const knot_dname_t *ns, const knot_rd
 		return kr_error(EINVAL);
 	}
 	/* Fetch/insert nameserver. */
-	pack_t *pack = kr_zonecut_find(cut, ns);
+	addr_pack_t *pack = (addr_pack_t *)kr_zonecut_find(cut, ns);
 	if (pack == NULL) {
 		pack = mm_alloc(cut->pool, sizeof(*pack));
 		if (!pack || (map_set(&cut->nsset, (const char *)ns, pack) != 0)) {
 			mm_free(cut->pool, pack);
 			return kr_error(ENOMEM);
 		}
-		pack_init(*pack);
+		pack_sb_init(*pack);
 	}
+	cut->candidates_fresh = false;
 	/* Insert data (if has any) */
 	if (rdata == NULL) {
 		return kr_ok();
@@ -221,15 +248,15 @@ int kr_zonecut_add(struct kr_zonecut *cut, const knot_dname_t *ns, const knot_rd
 	/* Check for duplicates */
 	uint16_t rdlen = knot_rdata_rdlen(rdata);
 	uint8_t *raw_addr = knot_rdata_data(rdata);
-	if (pack_obj_find(pack, raw_addr, rdlen)) {
+	if (pack_obj_find(pack_sb(pack), raw_addr, rdlen)) {
 		return kr_ok();
 	}
 	/* Push new address */
-	int ret = pack_reserve_mm(*pack, 1, rdlen, kr_memreserve, cut->pool);
+	int ret = pack_sb_reserve_mm(*pack, 1, rdlen, kr_memreserve, cut->pool);
 	if (ret != 0) {
 		return kr_error(ENOMEM);
 	}
-	return pack_obj_push(pack, raw_addr, rdlen);
+	return pack_obj_push(pack_sb(pack), raw_addr, rdlen);
 }
 
 int kr_zonecut_del(struct kr_zonecut *cut, const knot_dname_t *ns, const knot_rdata_t *rdata)
@@ -244,6 +271,7 @@ int kr_zonecut_del(struct kr_zonecut *cut, const knot_dname_t *ns, const knot_rd
 	if (pack == NULL) {
 		return kr_error(ENOENT);
 	}
+	cut->candidates_fresh = false;
 	/* Remove address from the pack. */
 	if (rdata) {
 		ret = pack_obj_del(pack, knot_rdata_data(rdata), knot_rdata_rdlen(rdata));
@@ -268,34 +296,77 @@ pack_t *kr_zonecut_find(struct kr_zonecut *cut, const knot_dname_t *ns)
 	return map_get(nsset, key);
 }
 
+static int collect_candidate(const char *k, void *v, void *baton)
+{
+	struct kr_zonecut *cut = baton;
+	if (array_reserve_mm(cut->candidates, cut->candidates.len + 1,
+	                     kr_memreserve, cut->pool) < 0) {
+		return kr_error(ENOMEM);
+	}
+	struct kr_nscand cand = { (const knot_dname_t *)k, (pack_t *)v };
+	array_push(cut->candidates, cand);
+	return kr_ok();
+}
+
+kr_nscand_array_t *kr_zonecut_candidates(struct kr_zonecut *cut)
+{
+	if (!cut) {
+		return NULL;
+	}
+	if (!cut->candidates_fresh) {
+		cut->candidates.len = 0;
+		if (map_walk(&cut->nsset, collect_candidate, cut) != 0) {
+			return NULL;
+		}
+		cut->candidates_fresh = true;
+	}
+	return &cut->candidates;
+}
+
+/** @internal Prime a hint cut from the compiled-in belt. */
+static int sbelt_prime(struct kr_zonecut *hints)
+{
+	/* @warning _NOT_ thread-safe */
+	static knot_rdata_t rdata_arr[RDATA_ARR_MAX];
+	int ret = 0;
+	for (unsigned i = 0; i < HINT_COUNT; ++i) {
+		const struct hint_info *hint = &SBELT[i];
+		knot_rdata_init(rdata_arr, hint->len, hint->addr, 0);
+		ret = kr_zonecut_add(hints, hint->name, rdata_arr);
+		if (ret != 0) {
+			break;
+		}
+	}
+	return ret;
+}
+
 int kr_zonecut_set_sbelt(struct kr_context *ctx, struct kr_zonecut *cut)
 {
 	if (!ctx || !cut) {
 		return kr_error(EINVAL);
 	}
-	/* @warning _NOT_ thread-safe */
-	static knot_rdata_t rdata_arr[RDATA_ARR_MAX];
+
+	/* The fallback set is cached per context: primed from the compiled-in
+	 * belt on first use and rewritten in place by configured hints, so
+	 * every later fallback just takes a copy instead of re-packing the
+	 * table.  No preference is baked into the copy order; the election
+	 * in kr_nsrep_elect() re-scores each candidate from the shared RTT
+	 * cache, so failover starts with the measured-fastest root server. */
+	struct kr_zonecut *hints = &ctx->root_hints;
+	if (!hints->nsset.root) {
+		int ret = sbelt_prime(hints);
+		if (ret != 0) {
+			return ret;
+		}
+	}
+	if (cut == hints) { /* Priming the context cache itself, see engine init. */
+		return kr_ok();
+	}
 
 	update_cut_name(cut, U8(""));
 	map_walk(&cut->nsset, free_addr_set, cut->pool);
 	map_clear(&cut->nsset);
-
-	/* Copy root hints from resolution context. */
-	int ret = 0;
-	if (ctx->root_hints.nsset.root) {
-		ret = kr_zonecut_copy(cut, &ctx->root_hints);
-	} else {
-		/* Copy compiled-in root hints */
-		for (unsigned i = 0; i < HINT_COUNT; ++i) {
-			const struct hint_info *hint = &SBELT[i];
-			knot_rdata_init(rdata_arr, hint->len, hint->addr, 0);
-			ret = kr_zonecut_add(cut, hint->name, rdata_arr);
-			if (ret != 0) {
-				break;
-			}
-		}
-	}
-	return ret;
+	return kr_zonecut_copy(cut, hints);
 }
 
 /** Fetch address for zone cut. */
@@ -16,6 +16,7 @@
 
 #pragma once
 
+#include "lib/generic/lru.h"
 #include "lib/generic/map.h"
 #include "lib/generic/pack.h"
 #include "lib/defines.h"
@@ -23,6 +24,19 @@
 
 struct kr_rplan;
 struct kr_context;
+struct kr_dname_intern;
+
+/** @internal Flat nameserver election candidate, see kr_zonecut_candidates(). */
+struct kr_nscand {
+	const knot_dname_t *name; /**< Key owned by the nameserver map. */
+	pack_t *addrs;            /**< Address pack owned by the nameserver map. */
+};
+typedef array_t(struct kr_nscand) kr_nscand_array_t;
+
+/** In-flight recursion counters for failing zone cuts, keyed by cut name.
+  * @note Only cuts with a live failure entry (see kr_cache_report_lame())
+  *       are counted, healthy cuts never touch the table. */
+typedef lru_hash(unsigned) kr_zonecut_busy_lru_t;
 
 /**
  * Current zone cut representation.
@@ -33,7 +47,10 @@ struct kr_zonecut {
 	knot_rrset_t* trust_anchor; /**< Current trust anchor. */
 	struct kr_zonecut *parent; /**< Parent zone cut. */
     map_t nsset;        /**< Map of nameserver => address_set. */
+	kr_nscand_array_t candidates; /**< Flat election view of nsset, rebuilt lazily. */
+	bool candidates_fresh; /**< The view matches current nsset contents. */
 	knot_mm_t *pool;     /**< Memory pool. */
+	struct kr_dname_intern *intern; /**< Optional request-wide dname intern table. */
 };
 
 /**
@@ -117,6 +134,19 @@ int kr_zonecut_del(struct kr_zonecut *cut, const knot_dname_t *ns, const knot_rd
 KR_EXPORT KR_PURE
 pack_t *kr_zonecut_find(struct kr_zonecut *cut, const knot_dname_t *ns);
 
+/**
+ * Return the flat array of election candidates for the cut.
+ *
+ * The view is rebuilt lazily from the nameserver map after mutations, so
+ * repeated elections over one cut scan a linear array instead of walking
+ * the tree.  Entries point into the map and any mutation invalidates them.
+ *
+ * @param  cut
+ * @return candidate array or NULL on allocation failure
+ */
+KR_EXPORT
+kr_nscand_array_t *kr_zonecut_candidates(struct kr_zonecut *cut);
+
 /**
  * Populate zone cut with a root zone using SBELT :rfc:`1034`
  *
@@ -23,6 +23,7 @@
 #include <string.h>
 
 #include "lib/cookies/alg_containers.h"
+#include "lib/utils.h"
 #include "modules/cookies/cookiectl.h"
 
 #define NAME_CLIENT_ENABLED "client_enabled"
@@ -32,6 +33,7 @@
 
 #define NAME_SERVER_ENABLED "server_enabled"
 #define NAME_SERVER_SECRET "server_secret"
+#define NAME_SERVER_ROTATION "server_rotation"
 #define NAME_SERVER_COOKIE_ALG "server_cookie_alg"
 #define NAME_AVAILABLE_SERVER_COOKIE_ALGS "available_server_cookie_algs"
 
@@ -93,6 +95,18 @@ static bool secret_ok(const JsonNode *node)
 	return true;
 }
 
+/**
+ * @brief Check whether node holds proper 'rotation' value.
+ * @patam node JSON node holding the value
+ * @return true if value OK
+ */
+static bool rotation_ok(const JsonNode *node)
+{
+	assert(node);
+
+	return node->tag == JSON_NUMBER && node->number_ >= 0;
+}
+
 /**
  * @brief Find hash function with given name.
  * @param node JSON node holding the value
@@ -304,6 +318,8 @@ static bool configuration_node_ok(const JsonNode *node)
 		return enabled_ok(node);
 	} else if (strcmp(node->key, NAME_SERVER_SECRET) == 0) {
 		return secret_ok(node);
+	} else if (strcmp(node->key, NAME_SERVER_ROTATION) == 0) {
+		return rotation_ok(node);
 	} else if (strcmp(node->key, NAME_SERVER_COOKIE_ALG) == 0) {
 		return hash_func_lookup(node, kr_sc_alg_names) != NULL;
 	}
@@ -449,6 +465,8 @@ static void update_running(struct kr_cookie_settings *running,
 	assert(running && secret);
 	assert(*secret || alg_lookup);
 
+	running->generation += 1; /* Cached verification verdicts go stale. */
+
 	running->recent.alg_id = -1;
 	free(running->recent.secr);
 	running->recent.secr = NULL;
@@ -530,6 +548,12 @@ static bool config_apply_json(struct kr_cookie_ctx *ctx, JsonNode *root_node)
 	apply_changes(&ctx->clnt, &new_clnt_secret, clnt_lookup, clnt_enabled_node);
 	apply_changes(&ctx->srvr, &new_srvr_secret, srvr_lookup, srvr_enabled_node);
 
+	const JsonNode *rotation_node = json_find_member(root_node,
+	                                                 NAME_SERVER_ROTATION);
+	if (rotation_node) {
+		ctx->srvr.rotation = rotation_node->number_;
+	}
+
 	/*
 	 * Allocated secrets should be already consumed. There is no need to
 	 * free them.
@@ -609,6 +633,9 @@ char *config_read(struct kr_cookie_ctx *ctx)
 
 	read_secret(root_node, NAME_SERVER_SECRET, ctx->srvr.current.secr);
 
+	json_append_member(root_node, NAME_SERVER_ROTATION,
+	                   json_mknumber(ctx->srvr.rotation));
+
 	lookup = knot_lookup_by_id(kr_sc_alg_names, ctx->srvr.current.alg_id);
 	if (lookup) {
 		json_append_member(root_node, NAME_SERVER_COOKIE_ALG,
@@ -623,6 +650,34 @@ char *config_read(struct kr_cookie_ctx *ctx)
 	return result;
 }
 
+bool config_rotate(struct kr_cookie_ctx *ctx)
+{
+	if (!ctx || !ctx->srvr.current.secr) {
+		return false;
+	}
+
+	/*
+	 * The fresh secret replaces the current one, which moves into the
+	 * recent slot; update_running() also bumps the settings generation.
+	 * Cookies issued before the rotation keep verifying against the
+	 * recent secret for one more period, and cached verdicts are not
+	 * flushed -- they simply re-validate on their first use under the
+	 * new generation.  Clients never see the old secret disappear, so
+	 * there is no re-establishment burst at the rotation instant.
+	 */
+	struct kr_cookie_secret *sq =
+		new_cookie_secret(ctx->srvr.current.secr->size, false);
+	if (!sq) {
+		return false;
+	}
+	kr_rand_bytes(sq->data, sq->size);
+
+	update_running(&ctx->srvr, &sq, NULL);
+
+	assert(sq == NULL); /* Consumed by update_running(). */
+	return true;
+}
+
 int config_init(struct kr_cookie_ctx *ctx)
 {
 	if (!ctx) {
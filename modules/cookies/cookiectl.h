@@ -33,6 +33,15 @@ bool config_apply(struct kr_cookie_ctx *ctx, const char *args);
  */
 char *config_read(struct kr_cookie_ctx *ctx);
 
+/**
+ * @brief Replaces the current server secret with fresh random material.
+ * @note The previous secret remains valid for verification (recent slot),
+ *       only the settings generation is bumped.
+ * @param ctx cookie control context
+ * @return true if the secret was rotated
+ */
+bool config_rotate(struct kr_cookie_ctx *ctx);
+
 /**
  * @brief Initialises cookie control context to default values.
  * @param ctx cookie control context
@@ -425,7 +425,15 @@ int check_request(knot_layer_t *ctx, void *module_param)
 		goto answer_add_cookies;
 	}
 
-	/* Check server cookie obtained in request. */
+	/* Check server cookie obtained in request.
+	 * Verification is deterministic, so a repeat client sending the very
+	 * same option can reuse the cached verdict and skip the HMAC. */
+
+	kr_cookie_lru_t *cookie_cache = req->ctx->cache_cookie;
+	if (kr_cookie_lru_checked(cookie_cache, req->qsource.addr,
+	                          req_cookie_opt, srvr_sett->generation)) {
+		goto answer_add_cookies;
+	}
 
 	ret = knot_sc_check(KR_NONCE_LEN, &cookies, &srvr_data, current_sc_alg);
 	if (ret == KNOT_EINVAL && srvr_sett->recent.secr) {
@@ -451,7 +459,9 @@ int check_request(knot_layer_t *ctx, void *module_param)
 		goto answer_add_cookies;
 	}
 
-	/* Server cookie is OK. */
+	/* Server cookie is OK, remember the verdict for this client. */
+	kr_cookie_lru_mark_checked(cookie_cache, req->qsource.addr,
+	                           req_cookie_opt, srvr_sett->generation);
 
 answer_add_cookies:
 	/* Add server cookie into response. */
@@ -15,12 +15,38 @@
  */
 
 #include <assert.h>
+#include <uv.h>
 
 #include "daemon/engine.h"
 #include "lib/layer.h"
 #include "modules/cookies/cookiectl.h"
 #include "modules/cookies/cookiemonster.h"
 
+/* Timer driving automatic server secret rotation (see 'server_rotation').
+ * The cookie context is engine-owned and single, so is the timer. */
+static uv_timer_t *rotation_timer = NULL;
+
+static void rotate_secret(uv_timer_t *timer)
+{
+	struct kr_cookie_ctx *cookie_ctx = timer->data;
+	if (!config_rotate(cookie_ctx)) {
+		kr_log_error("[cookies] secret rotation failed\n");
+	}
+}
+
+/** (Re)arm the rotation timer to match the configured period. */
+static void rotation_reschedule(struct kr_cookie_ctx *cookie_ctx)
+{
+	if (!rotation_timer) {
+		return;
+	}
+	uv_timer_stop(rotation_timer);
+	if (cookie_ctx->srvr.rotation > 0) {
+		uint64_t period = (uint64_t)cookie_ctx->srvr.rotation * 1000;
+		uv_timer_start(rotation_timer, rotate_secret, period, period);
+	}
+}
+
 /**
  * Get/set DNS cookie related stuff.
  *
@@ -35,6 +61,7 @@ static char *cookies_config(void *env, struct kr_module *module,
 
 	/* Apply configuration, if any. */
 	config_apply(cookie_ctx, args);
+	rotation_reschedule(cookie_ctx);
 
 	/* Return current configuration. */
 	return config_read(cookie_ctx);
@@ -59,6 +86,12 @@ int cookies_init(struct kr_module *module)
 	/* Replace engine pointer. */
 	module->data = cookie_ctx;
 
+	rotation_timer = malloc(sizeof(*rotation_timer));
+	if (rotation_timer) {
+		uv_timer_init(uv_default_loop(), rotation_timer);
+		rotation_timer->data = cookie_ctx;
+	}
+
 	return kr_ok();
 }
 
@@ -67,6 +100,12 @@ int cookies_deinit(struct kr_module *module)
 {
 	struct kr_cookie_ctx *cookie_ctx = module->data;
 
+	if (rotation_timer) {
+		uv_timer_stop(rotation_timer);
+		uv_close((uv_handle_t *)rotation_timer, (uv_close_cb)free);
+		rotation_timer = NULL;
+	}
+
 	config_deinit(cookie_ctx);
 
 	return kr_ok();
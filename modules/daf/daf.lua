@@ -2,6 +2,9 @@
 if not view then modules.load('view') end
 if not policy then modules.load('policy') end
 
+local ffi = require('ffi')
+local C = ffi.C
+
 -- Actions
 local actions = {
 	pass = 1, deny = 2, drop = 3, tc = 4, truncate = 4,
@@ -63,6 +66,109 @@ local filters = {
 	end,
 }
 
+-- Native rule engine (see lib/dafvm.h). Rules combining qname suffix
+-- and src/dst subnet filters with simple actions compile to a bytecode
+-- program evaluated by the C interpreter with a (qname, client) verdict
+-- memo, so the whole chain costs one call per query regardless of the
+-- rule count. Anything else (patterns, forward, mirror, reroute, ...)
+-- falls back to the Lua closures below.
+local vm = {
+	prog = nil,
+	rules = {},
+	actions = { pass = 1, deny = 2, drop = 3, tc = 4, truncate = 4 },
+}
+
+-- @function Try to compile a rule into native instructions (nil = not native)
+local function vm_compile(query)
+	local g = string.gmatch(query, '%S+')
+	local code = {}
+	local function filter(tok)
+		local key = tok and tok:lower()
+		if key ~= 'qname' and key ~= 'src' and key ~= 'dst' then
+			return false
+		end
+		local op, val = g(), g()
+		if op ~= '=' or not val then
+			return false
+		end
+		table.insert(code, {key, val})
+		return true
+	end
+	local tok = g()
+	if filter(tok) then
+		tok = g()
+		while tok do
+			local conj = tok:lower()
+			if conj ~= 'and' and conj ~= 'or' then break end
+			if not filter(g()) then return nil end
+			table.insert(code, {conj})
+			tok = g()
+		end
+	else
+		table.insert(code, {'true'}) -- Allow action without filter
+	end
+	local action = tok and vm.actions[tok:lower()]
+	if not action or g() then -- Trailing tokens have no native meaning
+		return nil
+	end
+	return code, action
+end
+
+-- @function Rebuild the native program from active native rules
+local function vm_recompile()
+	C.kr_dafvm_clear(vm.prog)
+	for i, r in ipairs(vm.rules) do
+		if r.rule.suspended ~= true then
+			for _, ins in ipairs(r.code) do
+				local op = ins[1]
+				if op == 'true' then
+					C.kr_dafvm_emit(vm.prog, C.KR_DAFVM_TRUE, 0)
+				elseif op == 'qname' then
+					C.kr_dafvm_emit(vm.prog, C.KR_DAFVM_QNAME,
+						C.kr_dafvm_suffix(vm.prog, todname(ins[2])))
+				elseif op == 'src' then
+					C.kr_dafvm_emit(vm.prog, C.KR_DAFVM_SRC,
+						C.kr_dafvm_subnet(vm.prog, ins[2]))
+				elseif op == 'dst' then
+					C.kr_dafvm_emit(vm.prog, C.KR_DAFVM_DST,
+						C.kr_dafvm_subnet(vm.prog, ins[2]))
+				elseif op == 'and' then
+					C.kr_dafvm_emit(vm.prog, C.KR_DAFVM_AND, 0)
+				elseif op == 'or' then
+					C.kr_dafvm_emit(vm.prog, C.KR_DAFVM_OR, 0)
+				end
+			end
+			C.kr_dafvm_emit(vm.prog, C.KR_DAFVM_RET, i - 1)
+		end
+	end
+end
+
+-- @function Evaluate the native program (one policy rule covers all native rules)
+local function vm_policy(req, qry)
+	local id = C.kr_dafvm_match(vm.prog, qry:name(), req.qsource.addr, req.qsource.dst_addr)
+	if id >= 0 then
+		local r = vm.rules[id + 1]
+		if r then
+			r.rule.count = r.rule.count + 1
+			return r.action
+		end
+	end
+	return nil
+end
+
+-- @function Add a native rule
+local function vm_add(info, code, action)
+	if not vm.prog then
+		vm.prog = ffi.gc(C.kr_dafvm_create(8192), C.kr_dafvm_free)
+		policy.add(vm_policy)
+	end
+	local desc = {info=info, policy=vm_policy, code=code, action=action,
+	              rule={id=policy.getruleid(), count=0}}
+	table.insert(vm.rules, desc)
+	vm_recompile()
+	return desc
+end
+
 local function parse_filter(tok, g, prev)
 	if not tok then error(string.format('expected filter after "%s"', prev)) end
 	local filter = filters[tok:lower()]
@@ -148,6 +254,13 @@ function M.add(rule)
 	for _, r in ipairs(M.rules) do
 		if r.info == rule then return r end
 	end
+	-- Prefer the native engine, fall back to Lua closures
+	local code, vmaction = vm_compile(rule)
+	if code then
+		local desc = vm_add(rule, code, vmaction)
+		table.insert(M.rules, desc)
+		return desc
+	end
 	local id, action, filter = compile(rule)
 	if not id then error(action) end
 	-- Combine filter and action into policy
@@ -176,8 +289,18 @@ end
 function M.del(id)
 	for i, r in ipairs(M.rules) do
 		if r.rule.id == id then
-			policy.del(id)
-			table.remove(M.rules, id)
+			if r.code then
+				for j, n in ipairs(vm.rules) do
+					if n == r then
+						table.remove(vm.rules, j)
+						break
+					end
+				end
+				vm_recompile()
+			else
+				policy.del(id)
+			end
+			table.remove(M.rules, i)
 			return true
 		end
 	end
@@ -197,6 +320,9 @@ function M.toggle(id, val)
 	for i, r in ipairs(M.rules) do
 		if r.rule.id == id then
 			r.rule.suspended = not val
+			if r.code then
+				vm_recompile()
+			end
 			return true
 		end
 	end
@@ -0,0 +1,169 @@
+/*  Copyright (C) 2016 CZ.NIC, z.s.p.o. <knot-dns@labs.nic.cz>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file dns64.c
+ * @brief RFC 6147 DNS64 AAAA-from-A synthesis.
+ *
+ * The configured prefix is precompiled into a 16-byte address template,
+ * synthesis blits the IPv4 address at the fixed offset and emits whole
+ * rrsets at once, so the cost per answer is a few memcpys in the consume
+ * layer instead of per-record work in Lua.
+ */
+
+#include <arpa/inet.h>
+#include <libknot/packet/pkt.h>
+#include <libknot/descriptor.h>
+
+#include "lib/module.h"
+#include "lib/layer.h"
+#include "lib/resolve.h"
+
+#define DEBUG_MSG(qry, fmt...) QRDEBUG(qry, "d64 ",  fmt)
+
+/* RFC 6052 well-known prefix, used when no prefix is configured. */
+#define DEFAULT_PREFIX "64:ff9b::"
+
+/** @internal Module-private mark for planned A sub-requests,
+  * the top flag bit is not used by the resolver itself. */
+#define DNS64_MARK (1U << 31)
+
+/** @internal Module state: precompiled synthesis template. */
+struct dns64_data {
+	uint8_t synth_template[16]; /**< Prefix with the IPv4 slot zeroed. */
+	bool configured;
+};
+
+/** @internal Synthesize one AAAA rrset from an A rrset into the answer. */
+static int synth_aaaa(struct dns64_data *data, knot_pkt_t *answer, const knot_rrset_t *rr)
+{
+	knot_rrset_t synth;
+	knot_rrset_init(&synth, knot_dname_copy(rr->owner, &answer->mm),
+	                KNOT_RRTYPE_AAAA, rr->rclass);
+	/* Blit each IPv4 address into the template slot */
+	uint8_t addr[16];
+	memcpy(addr, data->synth_template, sizeof(addr));
+	const uint32_t ttl = knot_rrset_ttl(rr);
+	for (uint16_t i = 0; i < rr->rrs.rr_count; ++i) {
+		const knot_rdata_t *rd = knot_rdataset_at(&rr->rrs, i);
+		if (knot_rdata_rdlen(rd) == sizeof(struct in_addr)) {
+			memcpy(addr + 12, knot_rdata_data(rd), sizeof(struct in_addr));
+			knot_rrset_add_rdata(&synth, addr, sizeof(addr), ttl, &answer->mm);
+		}
+	}
+	if (knot_rrset_empty(&synth)) {
+		knot_rrset_clear(&synth, &answer->mm);
+		return kr_ok();
+	}
+	int ret = knot_pkt_put(answer, 0, &synth, KNOT_PF_FREE);
+	if (ret != 0) {
+		knot_rrset_clear(&synth, &answer->mm);
+	}
+	return ret;
+}
+
+static int consume(knot_layer_t *ctx, knot_pkt_t *pkt)
+{
+	struct kr_request *req = ctx->data;
+	struct kr_module *module = ctx->api->data;
+	struct dns64_data *data = module->data;
+	struct kr_query *qry = req->current_query;
+	/* Observe only authoritative answers */
+	if (ctx->state == KNOT_STATE_FAIL || !data || !data->configured ||
+	    !qry || !(qry->flags & QUERY_RESOLVED)) {
+		return ctx->state;
+	}
+
+	const knot_pktsection_t *an = knot_pkt_section(pkt, KNOT_ANSWER);
+	if (qry->flags & DNS64_MARK) {
+		/* Synthetic AAAA from marked A responses, whole rrsets at once */
+		for (unsigned i = 0; i < an->count; ++i) {
+			const knot_rrset_t *rr = knot_pkt_rr(an, i);
+			if (rr->type == KNOT_RRTYPE_A) {
+				synth_aaaa(data, req->answer, rr);
+			}
+		}
+	} else if (an->count == 0 && qry->parent == NULL &&
+	           knot_wire_get_rcode(pkt->wire) == KNOT_RCODE_NOERROR &&
+	           knot_pkt_qtype(pkt) == KNOT_RRTYPE_AAAA &&
+	           knot_dname_is_equal(knot_pkt_qname(pkt), qry->sname)) {
+		/* Observed AAAA NODATA, plan the marked A sub-request */
+		struct kr_query *next = kr_rplan_push(&req->rplan, qry, qry->sname,
+		                                      KNOT_CLASS_IN, KNOT_RRTYPE_A);
+		if (next) {
+			next->flags = (qry->flags & QUERY_DNSSEC_WANT)
+			            | QUERY_AWAIT_CUT | DNS64_MARK;
+			DEBUG_MSG(qry, "<= AAAA NODATA, planning A for synthesis\n");
+		}
+	}
+	return ctx->state;
+}
+
+/*
+ * Module implementation.
+ */
+
+KR_EXPORT
+const knot_layer_api_t *dns64_layer(struct kr_module *module)
+{
+	static knot_layer_api_t _layer = {
+		.consume = &consume,
+	};
+	/* Store module reference */
+	_layer.data = module;
+	return &_layer;
+}
+
+KR_EXPORT
+int dns64_init(struct kr_module *module)
+{
+	struct dns64_data *data = malloc(sizeof(*data));
+	if (!data) {
+		return kr_error(ENOMEM);
+	}
+	memset(data, 0, sizeof(*data));
+	module->data = data;
+	return kr_ok();
+}
+
+KR_EXPORT
+int dns64_config(struct kr_module *module, const char *conf)
+{
+	struct dns64_data *data = module->data;
+	if (!conf || strlen(conf) < 1) {
+		conf = DEFAULT_PREFIX;
+	}
+	/* Precompile the prefix into the synthesis template */
+	uint8_t prefix[16];
+	if (inet_pton(AF_INET6, conf, prefix) < 1) {
+		DEBUG_MSG(NULL, "'%s' is not a valid IPv6 prefix\n", conf);
+		return kr_error(EINVAL);
+	}
+	memcpy(data->synth_template, prefix, 12);
+	memset(data->synth_template + 12, 0, 4);
+	data->configured = true;
+	return kr_ok();
+}
+
+KR_EXPORT
+int dns64_deinit(struct kr_module *module)
+{
+	free(module->data);
+	module->data = NULL;
+	return kr_ok();
+}
+
+KR_MODULE_EXPORT(dns64)
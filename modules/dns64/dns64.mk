@@ -1,2 +1,5 @@
-dns64_SOURCES := dns64.lua
-$(call make_lua_module,dns64)
+dns64_CFLAGS := -fvisibility=hidden -fPIC
+dns64_SOURCES := modules/dns64/dns64.c
+dns64_DEPEND := $(libkres)
+dns64_LIBS := $(contrib_TARGET) $(libkres_TARGET) $(libkres_LIBS)
+$(call make_c_module,dns64)
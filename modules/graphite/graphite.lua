@@ -52,25 +52,64 @@ local function merge(results)
 	return t
 end
 
--- Send the metrics in a table to multiple Graphite consumers
-local function publish_table(metrics, prefix, now)
-	for key,val in pairs(metrics) do
-		local msg = key..' '..val..' '..now..'\n'
+-- Serialize a metrics table into plaintext protocol lines
+local function serialize(metrics, prefix, now, out)
+	for key, val in pairs(metrics) do
 		if prefix then
-			msg = prefix..'.'..msg
+			table.insert(out, prefix..'.'..key..' '..val..' '..now..'\n')
+		else
+			table.insert(out, key..' '..val..' '..now..'\n')
 		end
-		for i in ipairs(M.cli) do
-			local ok, err = M.cli[i]:send(msg)
-			if not ok then
-				-- Best-effort reconnect once per two tries
-				local tcp = M.cli[i]['connect'] ~= nil
-				local host = M.info[i]
-				if tcp and host.seen + 2 * M.interval / 1000 <= now then
-					print(string.format('[graphite] reconnecting: %s#%d reason: %s',
-						  host.addr, host.port, err))
-					M.cli[i] = make_tcp(host.addr, host.port)
-					host.seen = now
-				end
+	end
+end
+
+-- Datagram payload budget, keeps UDP export fragmentation-safe
+local UDP_CHUNK = 1400
+
+-- Coalesce lines into datagram-sized chunks, cut on line boundaries
+local function chunked(lines)
+	local chunks, cur, len = {}, {}, 0
+	for _, line in ipairs(lines) do
+		if len > 0 and len + #line > UDP_CHUNK then
+			table.insert(chunks, table.concat(cur))
+			cur, len = {}, 0
+		end
+		table.insert(cur, line)
+		len = len + #line
+	end
+	if len > 0 then
+		table.insert(chunks, table.concat(cur))
+	end
+	return chunks
+end
+
+-- Send one serialized snapshot to multiple Graphite consumers.
+-- The whole cycle costs a single write per TCP consumer and a handful
+-- of datagrams per UDP one, instead of one send per metric.
+local function flush(lines, now)
+	local payload = table.concat(lines)
+	local chunks = nil
+	for i in ipairs(M.cli) do
+		local cli = M.cli[i]
+		local tcp = cli['connect'] ~= nil
+		local ok, err = true, nil
+		if tcp then
+			ok, err = cli:send(payload)
+		else
+			if not chunks then chunks = chunked(lines) end
+			for _, chunk in ipairs(chunks) do
+				ok, err = cli:send(chunk)
+				if not ok then break end
+			end
+		end
+		if not ok then
+			-- Best-effort reconnect once per two tries
+			local host = M.info[i]
+			if tcp and host.seen + 2 * M.interval / 1000 <= now then
+				print(string.format('[graphite] reconnecting: %s#%d reason: %s',
+					  host.addr, host.port, err))
+				M.cli[i] = make_tcp(host.addr, host.port)
+				host.seen = now
 			end
 		end
 	end
@@ -93,12 +132,14 @@ end
 -- @function Publish results to the Graphite server(s)
 function M.publish()
 	local now = os.time()
-	-- Publish built-in statistics
 	if not M.cli then error("no graphite server configured") end
-	publish_table(merge(map 'cache.stats()'), M.prefix..'.cache', now)
-	publish_table(merge(map 'worker.stats()'), M.prefix..'.worker', now)
-	-- Publish extended statistics if available
-	publish_table(merge(map 'stats.list()'), M.prefix, now)
+	-- Serialize one snapshot of all statistics, then write it out batched
+	local lines = {}
+	serialize(merge(map 'cache.stats()'), M.prefix..'.cache', now, lines)
+	serialize(merge(map 'worker.stats()'), M.prefix..'.worker', now, lines)
+	-- Extended statistics if available
+	serialize(merge(map 'stats.list()'), M.prefix, now, lines)
+	flush(lines, now)
 	return 0
 end
 
@@ -21,6 +21,8 @@
  * The module provides an override for queried address records.
  */
 
+#include <limits.h>
+
 #include <libknot/packet/pkt.h>
 #include <libknot/descriptor.h>
 #include <libknot/rrtype/aaaa.h>
@@ -29,6 +31,7 @@
 #include <contrib/cleanup.h>
 
 #include "daemon/engine.h"
+#include "modules/hints/trie.h"
 #include "lib/zonecut.h"
 #include "lib/module.h"
 #include "lib/layer.h"
@@ -37,6 +40,13 @@
 #define DEFAULT_FILE "/etc/hosts"
 #define DEBUG_MSG(qry, fmt...) QRDEBUG(qry, "hint",  fmt)
 
+/** @internal Module state: dynamic hint map and optional compiled set. */
+struct hints_data {
+	struct kr_zonecut *map;  /**< Dynamic hints, owns its backing pool and is
+	                          *   swapped wholesale on bulk load, see hint_load(). */
+	struct hints_trie trie;  /**< Compiled read-only set, shared between forks. */
+};
+
 /* Structure for reverse search (address to domain) */
 struct rev_search_baton {
 	knot_pkt_t *pkt;
@@ -54,25 +64,27 @@ static int begin(knot_layer_t *ctx, void *module_param)
 	return ctx->state;
 }
 
+/** @internal Scratch rdata for a synthesised answer.
+ * Lookups run on the single loop thread and the wire is rendered before the
+ * next lookup can overwrite it, so one static buffer per process is enough
+ * (same pattern as add_pair() below).
+ * @warning _NOT_ thread-safe */
+static knot_rdata_t answer_rdata[RDATA_ARR_MAX];
+
 static int put_answer(knot_pkt_t *pkt, knot_rrset_t *rr)
 {
-	int ret = 0;
-	if (!knot_rrset_empty(rr)) {
-		/* Update packet question */
-		if (!knot_dname_is_equal(knot_pkt_qname(pkt), rr->owner)) {
-			kr_pkt_recycle(pkt);
-			knot_pkt_put_question(pkt, rr->owner, rr->rclass, rr->type);
-		}
-		/* Append to packet */
-		ret = knot_pkt_put(pkt, KNOT_COMPR_HINT_QNAME, rr, KNOT_PF_FREE);
-	} else {
-		ret = kr_error(ENOENT);
+	if (knot_rrset_empty(rr)) {
+		return kr_error(ENOENT);
 	}
-	/* Clear RR if failed */
-	if (ret != 0) {
-		knot_rrset_clear(rr, &pkt->mm);
+	/* Update packet question */
+	if (!knot_dname_is_equal(knot_pkt_qname(pkt), rr->owner)) {
+		kr_pkt_recycle(pkt);
+		knot_pkt_put_question(pkt, rr->owner, rr->rclass, rr->type);
 	}
-	return ret;
+	/* Append to packet. The owner compresses to the question name and
+	 * the rdata bytes are copied onto the wire right here, so the
+	 * borrowed owner and scratch rdata are not kept past this call. */
+	return knot_pkt_put(pkt, KNOT_COMPR_HINT_QNAME, rr, 0);
 }
 
 static int find_reverse(const char *k, void *v, void *baton)
@@ -94,10 +106,11 @@ static int find_reverse(const char *k, void *v, void *baton)
 		return 0;
 	}
 	knot_pkt_t *pkt = search->pkt;
-	knot_dname_t *qname = knot_dname_copy(search->name, &pkt->mm);
 	knot_rrset_t rr;
-	knot_rrset_init(&rr, qname, KNOT_RRTYPE_PTR, KNOT_CLASS_IN);
-	knot_rrset_add_rdata(&rr, domain, knot_dname_size(domain), 0, &pkt->mm);
+	knot_rrset_init(&rr, (knot_dname_t *)search->name, KNOT_RRTYPE_PTR, KNOT_CLASS_IN);
+	knot_rdata_init(answer_rdata, knot_dname_size(domain), domain, 0);
+	rr.rrs.rr_count = 1;
+	rr.rrs.data = answer_rdata;
 	/* Insert into packet */
 	int ret = put_answer(pkt, &rr);
 	if (ret == 0) {
@@ -157,24 +170,58 @@ static int satisfy_forward(struct kr_zonecut *hints, knot_pkt_t *pkt, struct kr_
 	if (!addr_set || addr_set->len == 0) {
 		return kr_error(ENOENT);
 	}
-	knot_dname_t *qname = knot_dname_copy(qry->sname, &pkt->mm);
 	knot_rrset_t rr;
-	knot_rrset_init(&rr, qname, qry->stype, qry->sclass);
+	knot_rrset_init(&rr, qry->sname, qry->stype, qry->sclass);
 	size_t family_len = sizeof(struct in_addr);
 	if (rr.type == KNOT_RRTYPE_AAAA) {
 		family_len = sizeof(struct in6_addr);
 	}
 
-	/* Append address records from hints */
+	/* Render address records into the scratch, no allocation */
+	uint8_t *scratch = (uint8_t *)answer_rdata;
 	uint8_t *addr = pack_head(*addr_set);
 	while (addr != pack_tail(*addr_set)) {
 		size_t len = pack_obj_len(addr);
 		void *addr_val = pack_obj_val(addr);
-		if (len == family_len) {
-			knot_rrset_add_rdata(&rr, addr_val, len, 0, &pkt->mm);
+		if (len == family_len &&
+		    scratch - (uint8_t *)answer_rdata + knot_rdata_array_size(len) <= sizeof(answer_rdata)) {
+			knot_rdata_init((knot_rdata_t *)scratch, len, addr_val, 0);
+			scratch += knot_rdata_array_size(len);
+			rr.rrs.rr_count += 1;
 		}
 		addr = pack_obj_next(addr);
 	}
+	rr.rrs.data = answer_rdata;
+
+	return put_answer(pkt, &rr);
+}
+
+static int satisfy_forward_trie(const struct hints_trie *trie, knot_pkt_t *pkt, struct kr_query *qry)
+{
+	/* Find a matching name */
+	uint16_t val_len = 0;
+	const uint8_t *val = hints_trie_get(trie, qry->sname, &val_len);
+	if (!val) {
+		return kr_error(ENOENT);
+	}
+	knot_rrset_t rr;
+	knot_rrset_init(&rr, qry->sname, qry->stype, qry->sclass);
+	size_t family_len = sizeof(struct in_addr);
+	if (rr.type == KNOT_RRTYPE_AAAA) {
+		family_len = sizeof(struct in6_addr);
+	}
+
+	/* Render address records from the compiled set, no allocation */
+	uint8_t *scratch = (uint8_t *)answer_rdata;
+	for (uint16_t i = 0; i < val_len; i += 1 + val[i]) {
+		if (val[i] == family_len &&
+		    scratch - (uint8_t *)answer_rdata + knot_rdata_array_size(val[i]) <= sizeof(answer_rdata)) {
+			knot_rdata_init((knot_rdata_t *)scratch, val[i], val + i + 1, 0);
+			scratch += knot_rdata_array_size(val[i]);
+			rr.rrs.rr_count += 1;
+		}
+	}
+	rr.rrs.data = answer_rdata;
 
 	return put_answer(pkt, &rr);
 }
@@ -188,15 +235,19 @@ static int query(knot_layer_t *ctx, knot_pkt_t *pkt)
 	}
 
 	struct kr_module *module = ctx->api->data;
-	struct kr_zonecut *hint_map = module->data;
+	struct hints_data *data = module->data;
+	if (!data) {
+		return ctx->state;
+	}
 	switch(qry->stype) {
 	case KNOT_RRTYPE_A:
 	case KNOT_RRTYPE_AAAA: /* Find forward record hints */
-		if (satisfy_forward(hint_map, pkt, qry) != 0)
+		if (satisfy_forward_trie(&data->trie, pkt, qry) != 0 &&
+		    satisfy_forward(data->map, pkt, qry) != 0)
 			return ctx->state;
 		break;
 	case KNOT_RRTYPE_PTR: /* Find PTR record */
-		if (satisfy_reverse(hint_map, pkt, qry) != 0)
+		if (satisfy_reverse(data->map, pkt, qry) != 0)
 			return ctx->state;
 		break;
 	default:
@@ -268,7 +319,47 @@ static int load_map(struct kr_zonecut *hints, FILE *fp)
 	}
 
 	DEBUG_MSG(NULL, "loaded %zu hints\n", count);
-	return kr_ok();
+	return count > INT_MAX ? INT_MAX : (int)count;
+}
+
+/** @internal Create a dynamic hint map backed by its own pool, so a bulk
+  * load can build a fresh one aside and swap it in, see hint_load(). */
+static struct kr_zonecut *map_create(void)
+{
+	/* Create pool and copy itself */
+	knot_mm_t _pool = {
+		.ctx = mp_new(4096),
+		.alloc = (knot_mm_alloc_t) mp_alloc
+	};
+	knot_mm_t *pool = mm_alloc(&_pool, sizeof(*pool));
+	if (!pool) {
+		return NULL;
+	}
+	memcpy(pool, &_pool, sizeof(*pool));
+	struct kr_zonecut *map = mm_alloc(pool, sizeof(*map));
+	if (!map) {
+		mp_delete(_pool.ctx);
+		return NULL;
+	}
+	kr_zonecut_init(map, (const uint8_t *)(""), pool);
+	return map;
+}
+
+static void map_free(struct kr_zonecut *map)
+{
+	if (map) {
+		kr_zonecut_deinit(map);
+		mp_delete(map->pool->ctx);
+	}
+}
+
+static void data_free(struct hints_data *data)
+{
+	if (data) {
+		hints_trie_close(&data->trie);
+		map_free(data->map);
+		free(data);
+	}
 }
 
 static int load(struct kr_module *module, const char *path)
@@ -281,32 +372,31 @@ static int load(struct kr_module *module, const char *path)
 		DEBUG_MSG(NULL, "reading '%s'\n", path);
 	}
 
-	/* Create pool and copy itself */
-	knot_mm_t _pool = {
-		.ctx = mp_new(4096),
-		.alloc = (knot_mm_alloc_t) mp_alloc
-	};
-	knot_mm_t *pool = mm_alloc(&_pool, sizeof(*pool));
-	if (!pool) {
+	/* Create module state with an empty dynamic map */
+	struct hints_data *data = calloc(1, sizeof(*data));
+	if (!data) {
+		return kr_error(ENOMEM);
+	}
+	data->map = map_create();
+	if (!data->map) {
+		free(data);
 		return kr_error(ENOMEM);
 	}
-	memcpy(pool, &_pool, sizeof(*pool));
 
-	/* Load file to map */
-	struct kr_zonecut *hints = mm_alloc(pool, sizeof(*hints));
-	kr_zonecut_init(hints, (const uint8_t *)(""), pool);
-	module->data = hints;
-	return load_map(hints, fp);
+	/* Compiled sets are mapped as-is, anything else parses as hosts file */
+	if (hints_trie_open(&data->trie, path) == 0) {
+		DEBUG_MSG(NULL, "mapped compiled hints '%s'\n", path);
+	} else {
+		load_map(data->map, fp);
+	}
+	module->data = data;
+	return kr_ok();
 }
 
 static void unload(struct kr_module *module)
 {
-	struct kr_zonecut *hints = module->data;
-	if (hints) {
-		kr_zonecut_deinit(hints);
-		mp_delete(hints->pool->ctx);
-		module->data = NULL;
-	}
+	data_free(module->data);
+	module->data = NULL;
 }
 
 /**
@@ -318,14 +408,14 @@ static void unload(struct kr_module *module)
  */
 static char* hint_set(void *env, struct kr_module *module, const char *args)
 {
-	struct kr_zonecut *hints = module->data;
+	struct hints_data *data = module->data;
 	auto_free char *args_copy = strdup(args);
 
 	int ret = -1;
 	char *addr = strchr(args_copy, ' ');
-	if (addr) {
+	if (data && addr) {
 		*addr = '\0';
-		ret = add_pair(hints, args_copy, addr + 1);
+		ret = add_pair(data->map, args_copy, addr + 1);
 	}
 
 	char *result = NULL;
@@ -334,6 +424,45 @@ static char* hint_set(void *env, struct kr_module *module, const char *args)
 	return result;
 }
 
+/**
+ * Bulk-load a hosts-like file into the dynamic hints.
+ *
+ * The replacement map is built aside in one pass (kr_zonecut_add() drops
+ * duplicate addresses) and swapped in whole, so queries keep being answered
+ * from the previous hints for the entire load instead of seeing a window
+ * with the set half-built.
+ *
+ * Input:  path
+ * Output: { result: bool, count: int }
+ */
+static char* hint_load(void *env, struct kr_module *module, const char *args)
+{
+	struct hints_data *data = module->data;
+	int count = kr_error(EINVAL);
+	if (data && args && strlen(args) > 0) {
+		auto_fclose FILE *fp = fopen(args, "r");
+		if (!fp) {
+			count = kr_error(errno);
+		} else {
+			struct kr_zonecut *new_map = map_create();
+			if (!new_map) {
+				count = kr_error(ENOMEM);
+			} else {
+				count = load_map(new_map, fp);
+				struct kr_zonecut *old_map = data->map;
+				data->map = new_map;
+				map_free(old_map);
+			}
+		}
+	}
+
+	char *result = NULL;
+	if (-1 == asprintf(&result, "{ \"result\": %s, \"count\": %d }",
+	                   count >= 0 ? "true" : "false", count >= 0 ? count : 0))
+		result = NULL;
+	return result;
+}
+
 /** @internal Pack address list into JSON array. */
 static JsonNode *pack_addrs(pack_t *pack)
 {
@@ -360,11 +489,11 @@ static JsonNode *pack_addrs(pack_t *pack)
  */
 static char* hint_get(void *env, struct kr_module *module, const char *args)
 {
-	struct kr_zonecut *hints = module->data;
+	struct hints_data *data = module->data;
 	knot_dname_t key[KNOT_DNAME_MAXLEN];
 	pack_t *pack = NULL;
-	if (knot_dname_from_str(key, args, sizeof(key))) {
-		pack = kr_zonecut_find(hints, key);
+	if (data && knot_dname_from_str(key, args, sizeof(key))) {
+		pack = kr_zonecut_find(data->map, key);
 	}
 	if (!pack || pack->len == 0) {
 		return NULL;
@@ -379,6 +508,30 @@ static char* hint_get(void *env, struct kr_module *module, const char *args)
 	return result;
 }
 
+/**
+ * Compile hosts-like file into a mmapable trie, see @trie.h.
+ *
+ * Input:  { source destination }
+ * Output: { result: bool, count: int }
+ */
+static char* hint_compile(void *env, struct kr_module *module, const char *args)
+{
+	auto_free char *args_copy = strdup(args ? args : "");
+
+	int ret = kr_error(EINVAL);
+	char *dst = strchr(args_copy, ' ');
+	if (dst) {
+		*dst = '\0';
+		ret = hints_trie_compile(args_copy, dst + 1);
+	}
+
+	char *result = NULL;
+	if (-1 == asprintf(&result, "{ \"result\": %s, \"count\": %d }",
+	                   ret >= 0 ? "true" : "false", ret >= 0 ? ret : 0))
+		result = NULL;
+	return result;
+}
+
 /** Retrieve hint list. */
 static int pack_hint(const char *k, void *v, void *baton)
 {
@@ -460,11 +613,18 @@ int hints_init(struct kr_module *module)
 KR_EXPORT
 int hints_config(struct kr_module *module, const char *conf)
 {
-	unload(module);
 	if (!conf || strlen(conf) < 1) {
 		conf = DEFAULT_FILE;
 	}
-	return load(module, conf);
+	/* Build the new set aside and swap, queries are answered from the
+	 * previous hints for the whole load (and kept on a failed reload). */
+	struct hints_data *old = module->data;
+	int ret = load(module, conf);
+	if (ret != 0) {
+		return ret;
+	}
+	data_free(old);
+	return kr_ok();
 }
 
 KR_EXPORT
@@ -480,6 +640,8 @@ struct kr_prop *hints_props(void)
 	static struct kr_prop prop_list[] = {
 	    { &hint_set,    "set", "Set {name, address} hint.", },
 	    { &hint_get,    "get", "Retrieve hint for given name.", },
+	    { &hint_load,   "load", "Bulk-load a hosts-like file, swapped in whole.", },
+	    { &hint_compile, "compile", "Compile {source, destination} hosts-like file into a mmapable trie.", },
 	    { &hint_root,   "root", "Replace root hints set (empty value to return current list).", },
 	    { NULL, NULL, NULL }
 	};
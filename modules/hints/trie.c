@@ -0,0 +1,389 @@
+/*  Copyright (C) 2016 CZ.NIC, z.s.p.o. <knot-dns@labs.nic.cz>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <contrib/cleanup.h>
+
+#include "modules/hints/trie.h"
+#include "lib/defines.h"
+
+/*
+ * File image = { header, nodes, values }, all offsets are u32 from the start.
+ * Header = { u8[4] magic, u32 version, u32 root offset, u32 total size }.
+ * Node   = { u32 value offset (0 = none), u16 value length, u16 child count,
+ *            child count * { u8 byte, u32 child offset } }, children sorted.
+ * Value  = concatenated { u8 length, address } items.
+ * Multi-byte fields are host order, the file is not meant to be portable
+ * between architectures (it is rebuilt from the source file when needed).
+ */
+
+#define TRIE_MAGIC   "KrHT"
+#define TRIE_VERSION 1
+#define HDR_SIZE     16
+#define NODE_SIZE    8 /* Node header without children */
+#define CHILD_SIZE   5
+
+/** @internal Unaligned scalar read. */
+#define load_num(var, base) memcpy(&(var), (base), sizeof(var))
+
+/*
+ * Compilation.
+ */
+
+/** @internal In-memory trie node, serialized depth-first. */
+struct build_node {
+	struct build_node **child; /**< Child nodes, sorted by byte. */
+	uint8_t *bytes;            /**< Edge byte for each child. */
+	uint8_t *val;              /**< Concatenated { u8 length, address }. */
+	uint32_t off;              /**< Assigned file offset. */
+	uint16_t val_len;
+	uint16_t count;
+};
+
+/** @internal Builder context, tracks region sizes for offset assignment. */
+struct builder {
+	struct build_node root;
+	size_t node_bytes;
+	size_t val_bytes;
+	size_t count;
+};
+
+static struct build_node *node_child(struct build_node *node, uint8_t byte)
+{
+	/* Find insertion point */
+	uint16_t lo = 0, hi = node->count;
+	while (lo < hi) {
+		uint16_t mid = (lo + hi) / 2;
+		if (node->bytes[mid] < byte) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	if (lo < node->count && node->bytes[lo] == byte) {
+		return node->child[lo];
+	}
+	/* Insert new child */
+	struct build_node *next = calloc(1, sizeof(*next));
+	struct build_node **child = realloc(node->child, (node->count + 1) * sizeof(*child));
+	uint8_t *bytes = realloc(node->bytes, node->count + 1);
+	if (!next || !child || !bytes) {
+		free(next);
+		node->child = child ? child : node->child;
+		node->bytes = bytes ? bytes : node->bytes;
+		return NULL;
+	}
+	node->child = child;
+	node->bytes = bytes;
+	memmove(node->child + lo + 1, node->child + lo, (node->count - lo) * sizeof(*child));
+	memmove(node->bytes + lo + 1, node->bytes + lo, node->count - lo);
+	node->child[lo] = next;
+	node->bytes[lo] = byte;
+	node->count += 1;
+	return next;
+}
+
+static int node_add_val(struct builder *ctx, struct build_node *node, const uint8_t *addr, uint8_t addr_len)
+{
+	/* Skip duplicate addresses */
+	for (uint16_t i = 0; i < node->val_len; i += 1 + node->val[i]) {
+		if (node->val[i] == addr_len && memcmp(node->val + i + 1, addr, addr_len) == 0) {
+			return kr_ok();
+		}
+	}
+	if (node->val_len + 1 + addr_len > UINT16_MAX) {
+		return kr_error(ENOSPC);
+	}
+	uint8_t *val = realloc(node->val, node->val_len + 1 + addr_len);
+	if (!val) {
+		return kr_error(ENOMEM);
+	}
+	val[node->val_len] = addr_len;
+	memcpy(val + node->val_len + 1, addr, addr_len);
+	node->val = val;
+	node->val_len += 1 + addr_len;
+	ctx->val_bytes += 1 + addr_len;
+	ctx->count += 1;
+	return kr_ok();
+}
+
+static int builder_insert(struct builder *ctx, const char *name, const char *addr)
+{
+	/* Convert name to lookup format */
+	knot_dname_t dname[KNOT_DNAME_MAXLEN];
+	if (!knot_dname_from_str(dname, name, sizeof(dname))) {
+		return kr_error(EINVAL);
+	}
+	uint8_t lf[KNOT_DNAME_MAXLEN];
+	if (knot_dname_lf(lf, dname, NULL) != 0) {
+		return kr_error(EINVAL);
+	}
+
+	/* Parse address */
+	uint8_t raw_addr[sizeof(struct in6_addr)];
+	int family = strchr(addr, ':') ? AF_INET6 : AF_INET;
+	if (inet_pton(family, addr, raw_addr) < 1) {
+		return kr_error(EILSEQ);
+	}
+
+	/* Descend to the leaf, creating nodes on the way */
+	struct build_node *node = &ctx->root;
+	for (uint8_t i = 0; i < lf[0]; ++i) {
+		struct build_node *next = node_child(node, lf[1 + i]);
+		if (!next) {
+			return kr_error(ENOMEM);
+		}
+		node = next;
+	}
+	size_t addr_len = (family == AF_INET6) ? sizeof(struct in6_addr) : sizeof(struct in_addr);
+	return node_add_val(ctx, node, raw_addr, addr_len);
+}
+
+static void assign_offsets(struct builder *ctx, struct build_node *node, uint32_t *node_cur, uint32_t *val_cur)
+{
+	node->off = *node_cur;
+	*node_cur += NODE_SIZE + node->count * CHILD_SIZE;
+	if (node->val_len > 0) {
+		*val_cur += node->val_len;
+	}
+	for (uint16_t i = 0; i < node->count; ++i) {
+		assign_offsets(ctx, node->child[i], node_cur, val_cur);
+	}
+}
+
+static void write_node(uint8_t *base, const struct build_node *node, uint32_t *val_cur)
+{
+	uint8_t *wp = base + node->off;
+	uint32_t val_off = 0;
+	if (node->val_len > 0) {
+		val_off = *val_cur;
+		memcpy(base + val_off, node->val, node->val_len);
+		*val_cur += node->val_len;
+	}
+	memcpy(wp, &val_off, sizeof(val_off));
+	memcpy(wp + 4, &node->val_len, sizeof(node->val_len));
+	memcpy(wp + 6, &node->count, sizeof(node->count));
+	wp += NODE_SIZE;
+	for (uint16_t i = 0; i < node->count; ++i) {
+		wp[0] = node->bytes[i];
+		memcpy(wp + 1, &node->child[i]->off, sizeof(uint32_t));
+		wp += CHILD_SIZE;
+		write_node(base, node->child[i], val_cur);
+	}
+}
+
+static void free_node(struct build_node *node)
+{
+	for (uint16_t i = 0; i < node->count; ++i) {
+		free_node(node->child[i]);
+		free(node->child[i]);
+	}
+	free(node->child);
+	free(node->bytes);
+	free(node->val);
+}
+
+static int builder_write(struct builder *ctx, const char *dst)
+{
+	size_t node_bytes = 0, total = 0;
+	/* First pass assigns offsets and sizes the image */
+	uint32_t node_cur = HDR_SIZE, val_cur = 0;
+	assign_offsets(ctx, &ctx->root, &node_cur, &val_cur);
+	node_bytes = node_cur - HDR_SIZE;
+	total = HDR_SIZE + node_bytes + ctx->val_bytes;
+	if (total > UINT32_MAX) {
+		return kr_error(ENOSPC);
+	}
+
+	uint8_t *base = calloc(1, total);
+	if (!base) {
+		return kr_error(ENOMEM);
+	}
+	/* Header */
+	const uint32_t version = TRIE_VERSION;
+	const uint32_t root = HDR_SIZE;
+	const uint32_t size = total;
+	memcpy(base, TRIE_MAGIC, 4);
+	memcpy(base + 4, &version, sizeof(version));
+	memcpy(base + 8, &root, sizeof(root));
+	memcpy(base + 12, &size, sizeof(size));
+	/* Nodes and values */
+	val_cur = HDR_SIZE + node_bytes;
+	write_node(base, &ctx->root, &val_cur);
+
+	auto_fclose FILE *fp = fopen(dst, "w");
+	if (!fp || fwrite(base, total, 1, fp) != 1) {
+		free(base);
+		return kr_error(errno);
+	}
+	free(base);
+	return kr_ok();
+}
+
+int hints_trie_compile(const char *src, const char *dst)
+{
+	if (!src || !dst) {
+		return kr_error(EINVAL);
+	}
+	auto_fclose FILE *fp = fopen(src, "r");
+	if (!fp) {
+		return kr_error(errno);
+	}
+
+	struct builder ctx;
+	memset(&ctx, 0, sizeof(ctx));
+
+	/* Parse source as in load_map() in @hints.c */
+	size_t line_len = 0;
+	auto_free char *line = NULL;
+	while (getline(&line, &line_len, fp) > 0) {
+		char *saveptr = NULL;
+		char *tok = strtok_r(line, " \t\r", &saveptr);
+		if (tok == NULL || strchr(tok, '#') || strlen(tok) == 0) {
+			continue;
+		}
+		char *name_tok = strtok_r(NULL, " \t\n", &saveptr);
+		while (name_tok != NULL) {
+			builder_insert(&ctx, name_tok, tok);
+			name_tok = strtok_r(NULL, " \t\n", &saveptr);
+		}
+	}
+
+	int ret = builder_write(&ctx, dst);
+	free_node(&ctx.root);
+	if (ret != 0) {
+		return ret;
+	}
+	return ctx.count < INT32_MAX ? (int)ctx.count : INT32_MAX;
+}
+
+/*
+ * Mapped lookups.
+ */
+
+int hints_trie_open(struct hints_trie *t, const char *path)
+{
+	if (!t || !path) {
+		return kr_error(EINVAL);
+	}
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return kr_error(errno);
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < HDR_SIZE) {
+		close(fd);
+		return kr_error(EILSEQ);
+	}
+	/* Forks created after this point share the mapping. */
+	void *base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		return kr_error(errno);
+	}
+	/* Validate header */
+	uint32_t version = 0, root = 0, size = 0;
+	load_num(version, (uint8_t *)base + 4);
+	load_num(root, (uint8_t *)base + 8);
+	load_num(size, (uint8_t *)base + 12);
+	if (memcmp(base, TRIE_MAGIC, 4) != 0 || version != TRIE_VERSION ||
+	    size != st.st_size || root + NODE_SIZE > size) {
+		munmap(base, st.st_size);
+		return kr_error(EILSEQ);
+	}
+	t->base = base;
+	t->len = st.st_size;
+	return kr_ok();
+}
+
+void hints_trie_close(struct hints_trie *t)
+{
+	if (t && t->base) {
+		munmap((void *)t->base, t->len);
+		t->base = NULL;
+		t->len = 0;
+	}
+}
+
+/** @internal Find child offset for given byte (0 = no such child). */
+static uint32_t find_child(const uint8_t *node, uint16_t count, uint8_t byte)
+{
+	const uint8_t *child = node + NODE_SIZE;
+	uint16_t lo = 0, hi = count;
+	while (lo < hi) {
+		uint16_t mid = (lo + hi) / 2;
+		if (child[mid * CHILD_SIZE] < byte) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	if (lo < count && child[lo * CHILD_SIZE] == byte) {
+		uint32_t off = 0;
+		load_num(off, child + lo * CHILD_SIZE + 1);
+		return off;
+	}
+	return 0;
+}
+
+const uint8_t *hints_trie_get(const struct hints_trie *t, const knot_dname_t *name, uint16_t *val_len)
+{
+	if (!t || !t->base || !name || !val_len) {
+		return NULL;
+	}
+	/* Convert to lookup format */
+	uint8_t lf[KNOT_DNAME_MAXLEN];
+	if (knot_dname_lf(lf, name, NULL) != 0) {
+		return NULL;
+	}
+	/* Walk from the root, one node per name byte */
+	uint32_t off = 0;
+	load_num(off, t->base + 8);
+	for (uint8_t i = 0; i < lf[0]; ++i) {
+		if (off + NODE_SIZE > t->len) {
+			return NULL;
+		}
+		uint16_t count = 0;
+		load_num(count, t->base + off + 6);
+		if (off + NODE_SIZE + count * CHILD_SIZE > t->len) {
+			return NULL;
+		}
+		off = find_child(t->base + off, count, lf[1 + i]);
+		if (off == 0) {
+			return NULL;
+		}
+	}
+	if (off + NODE_SIZE > t->len) {
+		return NULL;
+	}
+	uint32_t val = 0;
+	uint16_t len = 0;
+	load_num(val, t->base + off);
+	load_num(len, t->base + off + 4);
+	if (val == 0 || len == 0 || val + len > t->len) {
+		return NULL;
+	}
+	*val_len = len;
+	return t->base + val;
+}
@@ -0,0 +1,66 @@
+/*  Copyright (C) 2016 CZ.NIC, z.s.p.o. <knot-dns@labs.nic.cz>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file trie.h
+ * @brief Compiled read-only hint set, mmapable and shared between forks.
+ *
+ * A hosts-like file is compiled ahead of time into a byte trie over names
+ * in lookup format (lowercased, reversed label order, as in @cache.c).
+ * The resulting file is position independent, activation is a single mmap
+ * and lookups cost O(name length) with no allocation, so even multi-million
+ * entry sets load instantly and share their memory between forks.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <libknot/dname.h>
+
+/** Mapped compiled hint set. */
+struct hints_trie {
+	const uint8_t *base; /**< Mapped image (NULL if not open). */
+	size_t len;          /**< Mapped length. */
+};
+
+/**
+ * Compile hosts-like file into a trie file.
+ * @param  src path to source file in hosts format
+ * @param  dst path to output file
+ * @return number of compiled addresses or an error code
+ */
+int hints_trie_compile(const char *src, const char *dst);
+
+/**
+ * Map a compiled trie file.
+ * @param  t    trie to open
+ * @param  path path to file created by hints_trie_compile()
+ * @return 0 or an error code (EILSEQ if the file is not a compiled trie)
+ */
+int hints_trie_open(struct hints_trie *t, const char *path);
+
+/** Unmap a compiled trie file (no-op if not open). */
+void hints_trie_close(struct hints_trie *t);
+
+/**
+ * Find address list for given name.
+ * @param  t       opened trie
+ * @param  name    searched name
+ * @param  val_len address list length
+ * @return address list as concatenated { u8 length, address } items, or NULL
+ */
+const uint8_t *hints_trie_get(const struct hints_trie *t, const knot_dname_t *name, uint16_t *val_len);
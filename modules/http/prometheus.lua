@@ -106,24 +106,44 @@ local function stream_stats(h, ws)
 	end
 end
 
+-- Prometheus metric registry: every counter keeps its preformatted
+-- '# TYPE ...' prefix and a stable slot in the reused output buffer,
+-- so a scrape re-stringifies only values that changed since the last
+-- one instead of regenerating the whole exposition from scratch.
+local prom = {
+	registry = {}, -- metric key -> {slot, prefix, value}
+	buffer = {},   -- output line per slot, in registration order
+}
+
 -- Render stats in Prometheus text format
 local function serve_prometheus()
-	-- First aggregate metrics list and print counters
-	local slist, render = getstats(), {}
+	local slist = getstats()
 	local latency = {}
-	local counter = '# TYPE %s counter\n%s %f'
 	for k,v in pairs(slist) do
-		k = select(1, k:gsub('%.', '_'))
 		-- Aggregate histograms
-		local band = k:match('answer_([%d]+)ms')
+		local band = k:match('^answer%.([%d]+)ms$')
 		if band then
 			table.insert(latency, {band, v})
-		elseif k == 'answer_slow' then
+		elseif k == 'answer.slow' then
 			table.insert(latency, {'+Inf', v})
 		-- Counter as a fallback
-		else table.insert(render, string.format(counter, k, k, v)) end
+		else
+			local entry = prom.registry[k]
+			if not entry then
+				local name = select(1, k:gsub('%.', '_'))
+				entry = {slot = #prom.buffer + 1,
+				         prefix = string.format('# TYPE %s counter\n%s ', name, name)}
+				prom.registry[k] = entry
+				table.insert(prom.buffer, '')
+			end
+			if entry.value ~= v then
+				entry.value = v
+				prom.buffer[entry.slot] = entry.prefix..string.format('%f', v)
+			end
+		end
 	end
-	-- Fill in latency histogram
+	-- Fill in latency histogram (a dozen bands, rendered per scrape)
+	local render = {table.concat(prom.buffer, '\n')}
 	local function kweight(x) return tonumber(x) or math.huge end
 	table.sort(latency, function (a,b) return kweight(a[1]) < kweight(b[1]) end)
 	table.insert(render, '# TYPE latency histogram')
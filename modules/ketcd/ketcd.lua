@@ -1,29 +1,43 @@
 --- @module ketcd
 local ketcd = {}
 
--- @function update subtree configuration
-local function update_subtree(tree)
+-- Last applied value per key, so unchanged keys cost nothing
+local applied = {}
+
+-- @function collect single key change (skips no-ops)
+local function collect_change(changes, key, value)
+	if applied[key] == value then return end
+	local modname, opt = key:gmatch('([^/]+)/([^/]+)$')()
+	if not modname or not opt or _G[modname] == nil then return end
+	applied[key] = value
+	table.insert(changes, string.format('_G[%q][%q] = %q', modname, opt, value))
+end
+
+-- @function diff subtree configuration against what is already applied
+local function diff_subtree(changes, tree)
 	if not tree then return end
-	for i,k in pairs(tree) do
+	for _, k in pairs(tree) do
 		if k.dir then
-			update_subtree(k.nodes)
+			diff_subtree(changes, k.nodes)
 		else
-			local key,opt = k.key:gmatch('([^/]+)/([^/]+)$')()
-			if _G[key][opt] ~= k.value then
-				_G[key][opt] = k.value
-			end
+			collect_change(changes, k.key, k.value)
 		end
 	end
 end
 
--- @function reload whole configuration
+-- @function reload configuration, applying only changed keys
 function ketcd.reload()
-	local ketcd = _G['ketcd']
 	local res, err = ketcd.cli:readdir('/', true)
 	if err then
 		error(err)
 	end
-	update_subtree(res.body.node.nodes)	
+	-- Apply all changes in one batched IPC round, so the forks
+	-- converge without talking to etcd themselves
+	local changes = {}
+	diff_subtree(changes, res.body.node.nodes)
+	if #changes > 0 then
+		map(table.concat(changes, '; '))
+	end
 end
 
 function ketcd.init(module)
@@ -40,15 +54,17 @@ function ketcd.config(conf)
 	if type(conf) == 'table' then
 		for k,v in pairs(conf) do options[k] = v end
 	end
+	-- only the leader polls etcd, changes propagate over IPC
+	if worker.id > 0 then return end
 	-- create connection
 	local cli, err = ketcd.Etcd.new(options)
 	if err then
-		error(err) 
+		error(err)
 	end
 	ketcd.cli = cli
 	-- schedule recurrent polling
-	-- @todo: the etcd has watch() API, but this requires
-	--        coroutines on socket operations
+	-- @todo: the etcd watch() API needs a coroutine-aware HTTP client,
+	--        etcd.luasocket blocks the whole event loop on a long poll
 	if ketcd.ev then event.cancel(ketcd.ev) end
 	ketcd.ev = event.recurrent(5 * sec, ketcd.reload)
 end
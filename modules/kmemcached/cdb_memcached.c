@@ -21,6 +21,7 @@
  */
 
 #include <assert.h>
+#include <stdlib.h>
 #include <string.h>
 #include <limits.h>
 #include <libmemcached/memcached.h>
@@ -31,12 +32,31 @@
 #include "lib/cache.h"
 #include "lib/utils.h"
 
+/* Default number of buffered writes before a forced flush. */
+#define WRITE_WINDOW_DEFAULT 64
+
 /* memcached client */
 struct memcached_cli {
 	memcached_st *handle;
 	memcached_result_st res;
+	unsigned window;   /**< Buffered writes allowed in flight, 1 disables buffering. */
+	unsigned buffered; /**< Writes currently sitting in the send buffer. */
 };
 
+/* Cut the resolver-specific --WINDOW=<n> knob out of the configuration
+ * string, the libmemcached parser rejects options it doesn't know. */
+static unsigned isolate_window(char *conf)
+{
+	char *tok = strstr(conf, "--WINDOW=");
+	if (!tok) {
+		return WRITE_WINDOW_DEFAULT;
+	}
+	char *end = NULL;
+	unsigned long window = strtoul(tok + strlen("--WINDOW="), &end, 10);
+	memmove(tok, end, strlen(end) + 1);
+	return window > 0 ? window : 1;
+}
+
 static int cdb_init(knot_db_t **db, struct kr_cdb_opts *opts, knot_mm_t *pool)
 {
 	if (!db || !opts) {
@@ -52,12 +72,34 @@ static int cdb_init(knot_db_t **db, struct kr_cdb_opts *opts, knot_mm_t *pool)
 	/* Make sure we're running on binary protocol, as the
 	 * textual protocol is broken for binary keys. */
 	auto_free char *config_str = kr_strcatdup(2, opts->path, " --BINARY-PROTOCOL");
+	cli->window = isolate_window(config_str);
 	cli->handle = memcached(config_str, strlen(config_str));
 	if (!cli->handle) {
 		free(cli);
 		return kr_error(EIO);
 	}
 
+	/* Spread keys over the configured server pool (multiple --SERVER
+	 * entries) by consistent hashing, so adding or losing a node only
+	 * remaps its arc of the ring instead of rehashing everything. */
+	memcached_behavior_set(cli->handle, MEMCACHED_BEHAVIOR_DISTRIBUTION,
+			       MEMCACHED_DISTRIBUTION_CONSISTENT);
+	memcached_behavior_set(cli->handle, MEMCACHED_BEHAVIOR_HASH, MEMCACHED_HASH_MURMUR);
+	/* For remote pools the shard count is used as the replication
+	 * factor, keeping entries available when a node drops out. */
+	if (opts->shards > 1) {
+		memcached_behavior_set(cli->handle, MEMCACHED_BEHAVIOR_NUMBER_OF_REPLICAS,
+				       opts->shards - 1);
+	}
+
+	/* Pipeline writes: quiet binary ops collect in the send buffer and go
+	 * out as one batch per window (or before the next read), so a burst
+	 * of cache stores costs a single round trip. */
+	memcached_behavior_set(cli->handle, MEMCACHED_BEHAVIOR_TCP_NODELAY, 1);
+	if (cli->window > 1) {
+		memcached_behavior_set(cli->handle, MEMCACHED_BEHAVIOR_BUFFER_REQUESTS, 1);
+	}
+
 	/* Create result set */
 	memcached_result_st *res = memcached_result_create(cli->handle, &cli->res);
 	if (!res) {
@@ -80,6 +122,13 @@ static void cdb_deinit(knot_db_t *db)
 
 static int cdb_sync(knot_db_t *db)
 {
+	struct memcached_cli *cli = db;
+	if (cli->buffered > 0) {
+		cli->buffered = 0;
+		if (memcached_flush_buffers(cli->handle) != MEMCACHED_SUCCESS) {
+			return kr_error(EIO);
+		}
+	}
 	return 0;
 }
 
@@ -123,6 +172,12 @@ static int cdb_readv(knot_db_t *db, knot_db_val_t *key, knot_db_val_t *val, int
 		lengths[i] = key[i].len;
 	}
 
+	/* Push out buffered writes first so reads observe them. */
+	if (cli->buffered > 0) {
+		cli->buffered = 0;
+		memcached_flush_buffers(cli->handle);
+	}
+
 	/* Execute multiple get and retrieve results */
 	memcached_return_t status = memcached_mget(cli->handle, keys, lengths, maxcount);
 	memcached_result_free(&cli->res);
@@ -157,6 +212,15 @@ static int cdb_writev(knot_db_t *db, knot_db_val_t *key, knot_db_val_t *val, int
 			struct kr_cache_entry *entry = val[i].data;
 			ret = memcached_set(cli->handle, key[i].data, key[i].len, val[i].data, val[i].len, entry->ttl, 0);
 		}
+		if (ret == MEMCACHED_BUFFERED) { /* Queued, not yet on the wire. */
+			ret = 0;
+			if (++cli->buffered >= cli->window) {
+				cli->buffered = 0;
+				if (memcached_flush_buffers(cli->handle) != MEMCACHED_SUCCESS) {
+					ret = MEMCACHED_WRITE_FAILURE;
+				}
+			}
+		}
 		if (ret != 0) {
 			break;
 		}
@@ -173,7 +237,16 @@ static int cdb_remove(knot_db_t *db, knot_db_val_t *key, int maxcount)
 	struct memcached_cli *cli = db;
 	memcached_return_t ret = 0;
 	for (int i = 0; i < maxcount; ++i) {
-		memcached_return_t ret = memcached_delete(cli->handle, key[i].data, key[i].len, 0);
+		ret = memcached_delete(cli->handle, key[i].data, key[i].len, 0);
+		if (ret == MEMCACHED_BUFFERED) { /* Queued, not yet on the wire. */
+			ret = 0;
+			if (++cli->buffered >= cli->window) {
+				cli->buffered = 0;
+				if (memcached_flush_buffers(cli->handle) != MEMCACHED_SUCCESS) {
+					ret = MEMCACHED_WRITE_FAILURE;
+				}
+			}
+		}
 		if (ret != 0) {
 			break;
 		}
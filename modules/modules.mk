@@ -1,6 +1,9 @@
 # List of built-in modules
 modules_TARGETS := hints \
-                   stats
+                   stats \
+                   prefetch \
+                   revalidate \
+                   dns64
 
 # DNS cookies
 ifeq ($(ENABLE_COOKIES),yes)
@@ -23,12 +26,15 @@ modules_TARGETS += ketcd \
                    policy \
                    view \
                    predict \
-                   dns64 \
+                   warmup \
                    renumber \
                    http \
                    daf
 endif
 
+# Modules compiled into the daemon need no shared object
+modules_TARGETS := $(filter-out $(EMBED_MODULES),$(modules_TARGETS))
+
 # Make C module
 define make_c_module
 $(1)-install: $(DESTDIR)$(MODULEDIR)
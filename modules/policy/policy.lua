@@ -9,6 +9,20 @@ local function getruleid()
 	return newid
 end
 
+-- Verdict memo, keyed by qname wire form. Only sound when every
+-- registered rule is a function of the qname alone, so rule builders
+-- mark their callbacks and any unmarked rule disables the memo.
+local VERDICT_MAX = 8192
+local qname_pure = setmetatable({}, {__mode = 'k'})
+local verdict_cache, verdict_count, cache_pure = {}, 0, true
+local function pure(cb)
+	qname_pure[cb] = true
+	return cb
+end
+local function verdict_flush()
+	verdict_cache, verdict_count = {}, 0
+end
+
 -- Support for client sockets from inside policy actions
 local socket_client = function () return error("missing luasocket, can't create socket client") end
 local has_socket, socket = pcall(require, 'socket')
@@ -101,58 +115,54 @@ local policy = {
 	ANY = 0,
 }
 
+-- Allocate rule id from the shared counter (e.g. for rules
+-- that other modules enforce outside of the policy lists)
+function policy.getruleid()
+	return getruleid()
+end
+
 -- All requests
 function policy.all(action)
-	return function(req, query) return action end
+	return pure(function(req, query) return action end)
 end
 
 -- Requests which QNAME matches given zone list (i.e. suffix match)
+-- The list is compiled once into a C byte trie (see lib/suffixmatch.h),
+-- matching is then O(qname length) regardless of the list size.
 function policy.suffix(action, zone_list)
-	local AC = require('aho-corasick')
-	local tree = AC.build(zone_list)
-	return function(req, query)
-		local match = AC.match(tree, query:name(), false)
-		if match[1] ~= nil then
+	local C = ffi.C
+	local set = ffi.gc(C.kr_suffix_set_create(), C.kr_suffix_set_free)
+	for i = 1, #zone_list do
+		C.kr_suffix_set_add(set, zone_list[i])
+	end
+	C.kr_suffix_set_compile(set)
+	return pure(function(req, query)
+		if C.kr_suffix_set_match(set, query:name()) == 1 then
 			return action
 		end
 		return nil
-	end
+	end)
 end
 
 -- Check for common suffix first, then suffix match (specialized version of suffix match)
 function policy.suffix_common(action, suffix_list, common_suffix)
-	local common_len = string.len(common_suffix)
-	local suffix_count = #suffix_list
-	return function(req, query)
-		-- Preliminary check
-		local qname = query:name()
-		if not string.find(qname, common_suffix, -common_len, true) then
-			return nil
-		end
-		-- String match
-		for i = 1, suffix_count do
-			local zone = suffix_list[i]
-			if string.find(qname, zone, -string.len(zone), true) then
-				return action
-			end
-		end
-		return nil
-	end
+	-- The compiled set matches in O(qname length) already,
+	-- so a preliminary common-suffix check no longer pays for itself.
+	return policy.suffix(action, suffix_list)
 end
 
 -- Filter QNAME pattern
 function policy.pattern(action, pattern)
-	return function(req, query)
+	return pure(function(req, query)
 		if string.find(query:name(), pattern) then
 			return action
 		end
 		return nil
-	end
+	end)
 end
 
-local function rpz_parse(action, path)
-	local rules = {}
-	local action_map = {
+local function rpz_action_map(action)
+	return {
 		-- RPZ Policy Actions
 		['\0'] = action,
 		['\1*\0'] = action, -- deviates from RPZ spec
@@ -161,6 +171,18 @@ local function rpz_parse(action, path)
 		['\012rpz-tcp-only\0'] = policy.TC,
 		-- Policy triggers @NYI@
 	}
+end
+
+-- Records parsed (or stale keys swept) per event-loop tick during a reload,
+-- bounds how long one step may occupy the loop.
+local rpz_chunk = 10000
+
+-- Reload progress and counters per zonefile, see policy.rpz().
+policy.rpz_status = {}
+
+local function rpz_parse(action, path)
+	local rules = {}
+	local action_map = rpz_action_map(action)
 	local parser = require('zonefile').new()
 	if not parser:open(path) then error(string.format('failed to parse "%s"', path)) end
 	while parser:parse() do
@@ -175,11 +197,86 @@ local function rpz_parse(action, path)
 	return rules
 end
 
+-- Drop rules that disappeared from the feed, a chunk of keys per tick.
+local function rpz_sweep(rules, seen, status)
+	local sweep = coroutine.wrap(function ()
+		local scanned, stale = 0, {}
+		for name in pairs(rules) do
+			if not seen[name] then table.insert(stale, name) end
+			scanned = scanned + 1
+			if scanned % rpz_chunk == 0 then coroutine.yield(true) end
+		end
+		for i, name in ipairs(stale) do
+			rules[name] = nil
+			if i % rpz_chunk == 0 then coroutine.yield(true) end
+		end
+		status.removed = #stale
+		status.generation = status.generation + 1
+		status.loading = false
+		return false
+	end)
+	local step
+	step = function () if sweep() then event.after(0, step) end end
+	step()
+end
+
+-- Re-parse the feed incrementally: a chunk of records per event-loop tick,
+-- and only entries that actually changed touch the live rule table.
+local function rpz_reload(action, path, rules, status)
+	if status.loading then return end
+	local parser = require('zonefile').new()
+	local ok, err = parser:open(path)
+	if not ok then
+		status.errors = status.errors + 1
+		status.last_error = err or 'open failed'
+		return
+	end
+	status.loading = true
+	status.updated = 0
+	local action_map = rpz_action_map(action)
+	local seen = {}
+	local records = 0
+	local step
+	step = function ()
+		for _ = 1, rpz_chunk do
+			local more, perr = parser:parse()
+			if not more then
+				if perr then
+					status.errors = status.errors + 1
+					status.last_error = perr
+				end
+				status.records = records
+				rpz_sweep(rules, seen, status)
+				return
+			end
+			local name = ffi.string(parser.r_owner, parser.r_owner_length)
+			local act = action_map[ffi.string(parser.r_data, parser.r_data_length)]
+			seen[name] = true
+			if rules[name] ~= act then
+				rules[name] = act
+				status.updated = status.updated + 1
+			end
+			records = records + 1
+		end
+		event.after(0, step)
+	end
+	event.after(0, step)
+end
+
 -- Create RPZ from zone file
-local function rpz_zonefile(action, path)
+local function rpz_zonefile(action, path, interval)
 	local rules = rpz_parse(action, path)
 	collectgarbage()
-	return function(req, query)
+	local status = { records = 0, updated = 0, removed = 0, errors = 0,
+	                 generation = 1, loading = false }
+	for _ in pairs(rules) do status.records = status.records + 1 end
+	policy.rpz_status[path] = status
+	if interval and interval > 0 then
+		status.ev = event.recurrent(interval, function ()
+			rpz_reload(action, path, rules, status)
+		end)
+	end
+	return pure(function(req, query)
 		local label = query:name()
 		local action = rules[label]
 		while action == nil and string.len(label) > 0 do
@@ -187,16 +284,19 @@ local function rpz_zonefile(action, path)
 			action = rules['\1*'..label]
 		end
 		return action
-	end
+	end)
 end
 
 -- RPZ policy set
-function policy.rpz(action, path)
-	return rpz_zonefile(action, path)
+function policy.rpz(action, path, interval)
+	return rpz_zonefile(action, path, interval)
 end
 
 -- Evaluate packet in given rules to determine policy action
+-- Returns the resulting state, and the matched rule with its action
+-- when the verdict came from a single non-chained rule (memoizable).
 function policy.evaluate(rules, req, query, state)
+	local chained = false
 	for i = 1, #rules do
 		local rule = rules[i]
 		if not rule.suspended then
@@ -205,12 +305,13 @@ function policy.evaluate(rules, req, query, state)
 				rule.count = rule.count + 1
 				local next_state = policy.enforce(state, req, action)
 				if next_state then    -- Not a chain rule,
-					return next_state -- stop on first match
+					return next_state, rule, action, chained -- stop on first match
 				end
+				chained = true
 			end
 		end
 	end
-	return state
+	return state, nil, nil, chained
 end
 
 -- Enforce policy action
@@ -245,7 +346,27 @@ end
 policy.layer = {
 	begin = function(state, req)
 		req = kres.request_t(req)
-		return policy.evaluate(policy.rules, req, req:current(), state)
+		local query = req:current()
+		if not cache_pure then
+			return policy.evaluate(policy.rules, req, query, state)
+		end
+		-- Consult the verdict memo before walking the rule lists
+		local key = query:name()
+		local entry = verdict_cache[key]
+		if entry ~= nil then
+			if entry == false then return state end
+			entry[1].count = entry[1].count + 1
+			return policy.enforce(state, req, entry[2]) or state
+		end
+		local next_state, rule, action, chained = policy.evaluate(policy.rules, req, query, state)
+		if not chained then -- Chained verdicts are not memoizable
+			if verdict_count >= VERDICT_MAX then
+				verdict_flush()
+			end
+			verdict_cache[key] = rule and {rule, action} or false
+			verdict_count = verdict_count + 1
+		end
+		return next_state
 	end,
 	finish = function(state, req)
 		req = kres.request_t(req)
@@ -264,6 +385,11 @@ function policy.add(rule, postrule)
 	-- End of compatibility shim
 	local desc = {id=getruleid(), cb=rule, count=0}
 	table.insert(postrule and policy.postrules or policy.rules, desc)
+	-- Begin-layer rules that depend on more than the qname disable the memo
+	if not postrule and not qname_pure[rule] then
+		cache_pure = false
+	end
+	verdict_flush()
 	return desc
 end
 
@@ -285,6 +411,15 @@ function policy.del(id)
 			return false
 		end
 	end
+	-- Re-check memo eligibility of the remaining rules
+	cache_pure = true
+	for _, r in ipairs(policy.rules) do
+		if not qname_pure[r.cb] then
+			cache_pure = false
+			break
+		end
+	end
+	verdict_flush()
 	return true
 end
 
@@ -0,0 +1,223 @@
+/*  Copyright (C) 2016 CZ.NIC, z.s.p.o. <knot-dns@labs.nic.cz>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file prefetch.c
+ * @brief Refreshes hot records shortly before they expire from the cache.
+ *
+ * Answered questions are counted in a fixed-size LRU together with the time
+ * their records expire; eviction keeps an approximate top-K of the traffic.
+ * A periodic timer re-resolves hot names just before their expiration, so
+ * frequent names rarely go cold.
+ */
+
+#include <libknot/packet/pkt.h>
+#include <libknot/descriptor.h>
+#include <uv.h>
+#include <time.h>
+
+#include "lib/module.h"
+#include "lib/layer.h"
+#include "lib/resolve.h"
+#include "lib/generic/lru.h"
+#include "daemon/worker.h"
+
+/* Defaults */
+#define PREFETCH_COUNT     50000 /* Tracked names */
+#define PREFETCH_THRESHOLD 2     /* Minimal hits before a name is refreshed */
+#define PREFETCH_WINDOW    30    /* Refresh entries expiring within N seconds */
+#define PREFETCH_INTERVAL  5000  /* Timer period in milliseconds */
+#define PREFETCH_BATCH     64    /* Refresh at most N names per tick */
+
+/** @internal Tracked name: hit counter and expiration of its records. */
+struct hot_entry {
+	unsigned count;
+	uint32_t expire;
+};
+
+/** @internal LRU of hot names, keyed by query type and name. */
+typedef lru_hash(struct hot_entry) namehash_t;
+
+/** @internal Module state. */
+struct prefetch_data {
+	namehash_t *hot;
+	uv_timer_t *timer;
+};
+
+/** @internal Sample key = {[2] type, [1-255] owner}, as in the stats module. */
+static inline int hot_key(char *key, const knot_dname_t *name, uint16_t type)
+{
+	memcpy(key, &type, sizeof(type));
+	int key_len = knot_dname_to_wire((uint8_t *)key + sizeof(type), name, KNOT_DNAME_MAXLEN);
+	if (key_len > 0) {
+		return key_len + sizeof(type);
+	}
+	return key_len;
+}
+
+/** @internal Shortest time before some answer record expires (0 = nothing to refresh). */
+static uint32_t answer_ttl(const knot_pkt_t *pkt)
+{
+	uint32_t ttl = 0;
+	const knot_pktsection_t *an = knot_pkt_section(pkt, KNOT_ANSWER);
+	for (unsigned i = 0; i < an->count; ++i) {
+		const uint32_t rr_ttl = knot_rrset_ttl(knot_pkt_rr(an, i));
+		if (ttl == 0 || rr_ttl < ttl) {
+			ttl = rr_ttl;
+		}
+	}
+	return ttl;
+}
+
+static int count_answer(knot_layer_t *ctx)
+{
+	struct kr_request *req = ctx->data;
+	struct kr_module *module = ctx->api->data;
+	struct prefetch_data *data = module->data;
+	struct kr_rplan *rplan = &req->rplan;
+	if (!data->hot || req->state != KNOT_STATE_DONE || rplan->resolved.len == 0) {
+		return ctx->state;
+	}
+
+	/* Track the original question only, subqueries expire on their own. */
+	struct kr_query *first = NULL;
+	for (size_t i = 0; i < rplan->resolved.len; ++i) {
+		if (rplan->resolved.at[i]->parent == NULL) {
+			first = rplan->resolved.at[i];
+			break;
+		}
+	}
+	if (!first || first->sclass != KNOT_CLASS_IN || knot_rrtype_is_metatype(first->stype)) {
+		return ctx->state;
+	}
+	/* Negative answers have no records to refresh. */
+	const uint32_t ttl = answer_ttl(req->answer);
+	if (ttl == 0) {
+		return ctx->state;
+	}
+
+	char key[sizeof(uint16_t) + KNOT_DNAME_MAXLEN];
+	int key_len = hot_key(key, first->sname, first->stype);
+	if (key_len <= 0) {
+		return ctx->state;
+	}
+	/* Internal requests (including our own refreshes) only re-arm
+	 * known entries, otherwise prefetching would feed itself. */
+	const bool internal = (req->qsource.addr == NULL);
+	struct hot_entry *entry = internal ? lru_get(data->hot, key, key_len)
+	                                   : lru_set(data->hot, key, key_len);
+	if (!entry) {
+		return ctx->state;
+	}
+	if (!internal) {
+		entry->count += 1;
+	}
+	entry->expire = first->timestamp.tv_sec + ttl;
+	return ctx->state;
+}
+
+static void refresh_hot(uv_timer_t *timer)
+{
+	struct kr_module *module = timer->data;
+	struct prefetch_data *data = module->data;
+	struct worker_ctx *worker = timer->loop->data;
+	if (!worker || !data->hot) {
+		return;
+	}
+
+	const uint32_t deadline = time(NULL) + PREFETCH_WINDOW;
+	unsigned scheduled = 0;
+	for (unsigned i = 0; i < data->hot->size && scheduled < PREFETCH_BATCH; ++i) {
+		struct lru_slot *slot = lru_slot_at((struct lru_hash_base *)data->hot, i);
+		if (!slot->key) {
+			continue;
+		}
+		struct hot_entry *entry = lru_slot_val(slot, lru_slot_offset(data->hot));
+		if (entry->count < PREFETCH_THRESHOLD ||
+		    entry->expire == 0 || entry->expire > deadline) {
+			continue;
+		}
+		/* The refresh bypasses cache lookups, so it can not be
+		 * answered from the very entry it is trying to replace. */
+		uint16_t qtype = 0;
+		memcpy(&qtype, slot->key, sizeof(qtype));
+		const knot_dname_t *qname = (const uint8_t *)slot->key + sizeof(qtype);
+		knot_pkt_t *query = knot_pkt_new(NULL, KNOT_WIRE_MIN_PKTSIZE, &worker->pkt_pool);
+		if (!query) {
+			return;
+		}
+		knot_pkt_put_question(query, qname, KNOT_CLASS_IN, qtype);
+		knot_wire_set_rd(query->wire);
+		worker_resolve(worker, query, QUERY_NO_CACHE, NULL, NULL);
+		entry->expire = 0; /* Re-armed when the fresh answer arrives. */
+		scheduled += 1;
+	}
+}
+
+/*
+ * Module implementation.
+ */
+
+KR_EXPORT
+const knot_layer_api_t *prefetch_layer(struct kr_module *module)
+{
+	static knot_layer_api_t _layer = {
+		.finish = &count_answer,
+	};
+	/* Store module reference */
+	_layer.data = module;
+	return &_layer;
+}
+
+KR_EXPORT
+int prefetch_init(struct kr_module *module)
+{
+	struct prefetch_data *data = malloc(sizeof(*data));
+	if (!data) {
+		return kr_error(ENOMEM);
+	}
+	memset(data, 0, sizeof(*data));
+	module->data = data;
+	data->hot = malloc(lru_size(namehash_t, PREFETCH_COUNT));
+	if (data->hot) {
+		lru_init(data->hot, PREFETCH_COUNT);
+	}
+	data->timer = malloc(sizeof(*data->timer));
+	if (data->timer) {
+		uv_timer_init(uv_default_loop(), data->timer);
+		data->timer->data = module;
+		uv_timer_start(data->timer, refresh_hot, PREFETCH_INTERVAL, PREFETCH_INTERVAL);
+	}
+	return kr_ok();
+}
+
+KR_EXPORT
+int prefetch_deinit(struct kr_module *module)
+{
+	struct prefetch_data *data = module->data;
+	if (data) {
+		if (data->timer) {
+			uv_timer_stop(data->timer);
+			uv_close((uv_handle_t *)data->timer, (uv_close_cb)free);
+		}
+		lru_deinit(data->hot);
+		free(data->hot);
+		free(data);
+	}
+	return kr_ok();
+}
+
+KR_MODULE_EXPORT(prefetch)
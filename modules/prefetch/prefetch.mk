@@ -0,0 +1,5 @@
+prefetch_CFLAGS := -fvisibility=hidden -fPIC
+prefetch_SOURCES := modules/prefetch/prefetch.c
+prefetch_DEPEND := $(libkres)
+prefetch_LIBS := $(contrib_TARGET) $(libkres_TARGET) $(libkres_LIBS) $(libuv_LIBS)
+$(call make_c_module,prefetch)
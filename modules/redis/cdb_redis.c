@@ -157,22 +157,15 @@ static void cdb_deinit(knot_db_t *cache)
 	cli_free(cli);
 }
 
-static int cdb_sync(knot_db_t *cache)
-{
-	if (!cache) {
-		return kr_error(EINVAL);
-	}
-	struct redis_cli *cli = cache;
-	cli_decommit(cli);
-	return 0;
-}
+static int cdb_sync(knot_db_t *cache);
 
 /* Disconnect client */
 #define CLI_DISCONNECT(cli) \
 	if ((cli)->handle->err != REDIS_ERR_OTHER) { \
 		redisFree((cli)->handle); \
 		(cli)->handle = NULL; \
-	}
+	} \
+	(cli)->pending = 0;
 /* Attempt to reconnect */
 #define CLI_KEEPALIVE(cli_) \
 	if ((cli_)->freelist.len > REDIS_MAXFREELIST) { \
@@ -185,6 +178,36 @@ static int cdb_sync(knot_db_t *cache)
 		} \
 	}
 
+/** @internal Collect replies of fire-and-forget commands still on the wire.
+ * Replies arrive in order, so this must run before any reply-bearing command. */
+static int cli_drain(struct redis_cli *cli)
+{
+	while (cli->pending > 0) {
+		redisReply *reply = NULL;
+		redisGetReply(cli->handle, (void **)&reply);
+		if (!reply) {
+			CLI_DISCONNECT(cli);
+			return kr_error(EIO);
+		}
+		freeReplyObject(reply);
+		cli->pending -= 1;
+	}
+	return kr_ok();
+}
+
+static int cdb_sync(knot_db_t *cache)
+{
+	if (!cache) {
+		return kr_error(EINVAL);
+	}
+	struct redis_cli *cli = cache;
+	if (cli->handle) {
+		(void) cli_drain(cli);
+	}
+	cli_decommit(cli);
+	return 0;
+}
+
 static int cdb_count(knot_db_t *cache)
 {
 	if (!cache) {
@@ -193,6 +216,10 @@ static int cdb_count(knot_db_t *cache)
 	int ret = 0;
 	struct redis_cli *cli = cache;
 	CLI_KEEPALIVE(cli);
+	ret = cli_drain(cli);
+	if (ret != 0) {
+		return ret;
+	}
 	redisReply *reply = redisCommand(cli->handle, "DBSIZE");
 	if (!reply) {
 		CLI_DISCONNECT(cli);
@@ -212,6 +239,10 @@ static int cdb_clear(knot_db_t *cache)
 	}
 	struct redis_cli *cli = cache;
 	CLI_KEEPALIVE(cli);
+	int ret = cli_drain(cli);
+	if (ret != 0) {
+		return ret;
+	}
 	redisReply *reply = redisCommand(cli->handle, "FLUSHDB");
 	if (!reply) {
 		CLI_DISCONNECT(cli);
@@ -228,8 +259,12 @@ static int cdb_readv(knot_db_t *cache, knot_db_val_t *key, knot_db_val_t *val, i
 	}
 	struct redis_cli *cli = cache;
 	CLI_KEEPALIVE(cli);
+	int ret = cli_drain(cli);
+	if (ret != 0) {
+		return ret;
+	}
 
-	/* Build command pipeline */
+	/* Build command pipeline, all keys are fetched in one round trip. */
 	for (int i = 0; i < maxcount; ++i) {
 		redisAppendCommand(cli->handle, "GET %b", key[i].data, key[i].len);
 	}
@@ -265,7 +300,9 @@ static int cdb_writev(knot_db_t *cache, knot_db_val_t *key, knot_db_val_t *val,
 	struct redis_cli *cli = cache;
 	CLI_KEEPALIVE(cli);
 
-	/* Build command pipeline */
+	/* Build command pipeline. Replies are just acknowledgements,
+	 * so they are left in flight and collected when the window fills
+	 * or before the next reply-bearing command, hiding the round trip. */
 	for (int i = 0; i < maxcount; ++i) {
 		if (val->len < 2) {
 			/* @note Special values/namespaces, not a RR entry with TTL. */
@@ -277,16 +314,13 @@ static int cdb_writev(knot_db_t *cache, knot_db_val_t *key, knot_db_val_t *val,
 			redisAppendCommand(cli->handle, "SETEX %b %d %b", key[i].data, key[i].len, entry->ttl, val[i].data, val[i].len);
 		}
 	}
-	/* Gather replies */
-	for (int i = 0; i < maxcount; ++i) {
-		redisReply *reply = NULL;
-		redisGetReply(cli->handle, (void **)&reply);
-		if (!reply) {
-			CLI_DISCONNECT(cli);
-			return kr_error(EIO);
-		}
-		freeReplyObject(reply);
+	cli->pending += maxcount;
+	if (cli->pending > REDIS_INFLIGHT) {
+		return cli_drain(cli);
 	}
+	/* Flush the output buffer without blocking on replies. */
+	int done = 0;
+	redisBufferWrite(cli->handle, &done);
 	return kr_ok();
 }
 
@@ -299,20 +333,16 @@ static int cdb_remove(knot_db_t *cache, knot_db_val_t *key, int maxcount)
 	struct redis_cli *cli = cache;
 	CLI_KEEPALIVE(cli);
 
-	/* Build command pipeline */
+	/* Build command pipeline, removals are fire-and-forget like writes. */
 	for (int i = 0; i < maxcount; ++i) {
 		redisAppendCommand(cli->handle, "DEL %b", key[i].data, key[i].len);
 	}
-	/* Gather replies */
-	for (int i = 0; i < maxcount; ++i) {
-		redisReply *reply = NULL;
-		redisGetReply(cli->handle, (void **)&reply);
-		if (!reply) {
-			CLI_DISCONNECT(cli);
-			return kr_error(EIO);
-		}
-		freeReplyObject(reply);
+	cli->pending += maxcount;
+	if (cli->pending > REDIS_INFLIGHT) {
+		return cli_drain(cli);
 	}
+	int done = 0;
+	redisBufferWrite(cli->handle, &done);
 	return kr_ok();
 }
 
@@ -330,29 +360,48 @@ static int cdb_match(knot_db_t *cache, knot_db_val_t *key, knot_db_val_t *val, i
 
 	struct redis_cli *cli = cache;
 	CLI_KEEPALIVE(cli);
-	redisReply *reply = redisCommand(cli->handle, "SCAN 0 MATCH %b COUNT 100", key->data, key->len);
-	if (!reply) {
-		CLI_DISCONNECT(cli);
-		return kr_error(EIO);
+	int ret = cli_drain(cli);
+	if (ret != 0) {
+		return ret;
 	}
-	/* Track reply in a freelist for this transaction */ 
-	if (array_push(cli->freelist, reply) < 0) {
-		freeReplyObject(reply); /* Can't track this, must free */
+
+	/* Follow the SCAN cursor until the result set or the keyspace is
+	 * exhausted, a single page used to return incomplete matches. */
+	int results = 0;
+	auto_free char *cursor = strdup("0");
+	if (!cursor) {
 		return kr_error(ENOMEM);
 	}
-	/* SCAN returns array of 2 elements, first is iterator 'next' and second an array of results. */
-	int results = 0;
-	if (reply->type == REDIS_REPLY_ARRAY && reply->elements == 2) {
+	do {
+		redisReply *reply = redisCommand(cli->handle, "SCAN %s MATCH %b COUNT 100", cursor, key->data, key->len);
+		if (!reply) {
+			CLI_DISCONNECT(cli);
+			return kr_error(EIO);
+		}
+		/* Track reply in a freelist for this transaction */
+		if (array_push(cli->freelist, reply) < 0) {
+			freeReplyObject(reply); /* Can't track this, must free */
+			return kr_error(ENOMEM);
+		}
+		/* SCAN returns array of 2 elements, first is iterator 'next' and second an array of results. */
+		if (reply->type != REDIS_REPLY_ARRAY || reply->elements != 2) {
+			break;
+		}
+		free(cursor);
+		cursor = strdup(reply->element[0]->str);
+		if (!cursor) {
+			return kr_error(ENOMEM);
+		}
 		redisReply *data = reply->element[1];
-		results = MIN(data->elements, maxcount);
 		assert(data->type == REDIS_REPLY_ARRAY);
-		for (size_t i = 0; i < results; ++i) {
+		for (size_t i = 0; i < data->elements && results < maxcount; ++i) {
 			redisReply *elem = data->element[i];
 			assert(elem->type == REDIS_REPLY_STRING);
-			val[i].data = elem->str;
-			val[i].len = elem->len;
+			val[results].data = elem->str;
+			val[results].len = elem->len;
+			++results;
 		}
-	}
+	} while (results < maxcount && strcmp(cursor, "0") != 0);
 	return results;
 }
 
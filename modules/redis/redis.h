@@ -23,6 +23,8 @@
 #define REDIS_MAXFREELIST 1024
 #define REDIS_BUFSIZE (1024 * 1024)
 #define REDIS_PORT 6379
+/** Maximum number of in-flight fire-and-forget commands */
+#define REDIS_INFLIGHT 512
 
 typedef array_t(redisReply *) redis_freelist_t;
 
@@ -33,4 +35,5 @@ struct redis_cli {
 	char *addr;
 	unsigned database;
 	unsigned port;
+	unsigned pending; /**< In-flight commands with uncollected replies. */
 };
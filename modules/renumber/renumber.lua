@@ -1,7 +1,6 @@
 -- Module interface
-local policy = require('policy')
 local ffi = require('ffi')
-local bit = require('bit')
+local C = ffi.C
 local prefixes = {}
 
 -- Create subnet prefix rule
@@ -10,7 +9,7 @@ local function matchprefix(subnet, addr)
 	if target == nil then error('[renumber] invalid address: '..addr) end
 	local addrtype = string.find(addr, ':', 1, true) and kres.type.AAAA or kres.type.A
 	local subnet_cd = ffi.new('char[16]')
-	local bitlen = ffi.C.kr_straddr_subnet(subnet_cd, subnet)
+	local bitlen = C.kr_straddr_subnet(subnet_cd, subnet)
 	-- Mask unspecified, renumber whole IP
 	if bitlen == 0 then
 		bitlen = #target * 8
@@ -33,74 +32,36 @@ local function add_prefix(subnet, addr)
 	table.insert(prefixes, matchprefix(subnet, addr))
 end
 
--- Match IP against given subnet or record owner
-local function match_subnet(subnet, bitlen, addrtype, rr)
-	local addr = rr.rdata
-	return addrtype == rr.type and
-	       ((bitlen and (#addr >= bitlen / 8) and (ffi.C.kr_bitcmp(subnet, addr, bitlen) == 0)) or subnet == rr.owner)
-end
-
--- Renumber address record
-local addr_buf = ffi.new('char[16]')
-local function renumber_record(tbl, rr)
+-- Compile rule table into the native rewriter (see lib/renumber.h)
+local function compile(tbl)
+	local set = ffi.gc(C.kr_renumber_create(), C.kr_renumber_free)
 	for i = 1, #tbl do
-		local prefix = tbl[i]
-		-- Match record type to address family and record address to given subnet
-		-- If provided, compare record owner to prefix name
-		if match_subnet(prefix[1], prefix[2], prefix[4], rr) then
-			-- Replace part or whole address
-			local to_copy = prefix[2] or (#prefix[3] * 8)
-			local chunks = to_copy / 8
-			local rdlen = #rr.rdata
-			if rdlen < chunks then return rr end -- Address length mismatch
-			ffi.copy(addr_buf, rr.rdata, rdlen)
-			ffi.copy(addr_buf, prefix[3], chunks)
-			-- @todo: CIDR not supported
-			to_copy = to_copy - chunks * 8
-			rr.rdata = ffi.string(addr_buf, rdlen)
-			return rr
+		local rule = tbl[i]
+		if rule[2] ~= nil then
+			C.kr_renumber_prefix(set, rule[1], rule[2], rule[3], #rule[3])
+		else
+			C.kr_renumber_name(set, rule[1], rule[3], #rule[3])
 		end
-	end	
-	return nil
+	end
+	return set
 end
 
 -- Renumber addresses based on config
 local function rule(prefixes)
+	local set, set_len = nil, 0
 	return function (state, req)
 		if state == kres.FAIL then return state end
-		req = kres.request_t(req)
-		pkt = kres.pkt_t(req.answer)
-		-- Only successful answers
-		local records = pkt:section(kres.section.ANSWER)
-		local ancount = #records
-		if ancount == 0 then return state end
-		-- Find renumber candidates
-		local changed = false
-		for i = 1, ancount do
-			local rr = records[i]
-			if rr.type == kres.type.A or rr.type == kres.type.AAAA then
-				local new_rr = renumber_record(prefixes, rr)
-				if new_rr ~= nil then
-					records[i] = new_rr
-					changed = true
-				end
-			end
+		-- Lazily (re)compile when rules were added since last answer
+		if set == nil or set_len ~= #prefixes then
+			set = compile(prefixes)
+			set_len = #prefixes
 		end
+		req = kres.request_t(req)
+		-- Rewrite happens in C over whole rrsets, signatures are
+		-- stripped when something changed as it can not be validated
+		local changed = C.kr_renumber_answer(set, req.answer)
 		-- If not rewritten, chain action
-		if not changed then return end
-		-- Replace section if renumbering
-		local qname = pkt:qname()
-		local qclass = pkt:qclass()
-		local qtype = pkt:qtype()
-		pkt:clear()
-		pkt:question(qname, qclass, qtype)
-		for i = 1, ancount do
-			local rr = records[i]
-			-- Strip signatures as rewritten data cannot be validated
-			if rr.type ~= kres.type.RRSIG then
-				pkt:put(rr.owner, rr.ttl, rr.class, rr.type, rr.rdata)
-			end
-		end
+		if changed ~= 1 then return end
 		return state
 	end
 end
@@ -118,7 +79,7 @@ function M.config (conf)
 	if type(conf) ~= 'table' or type(conf[1]) ~= 'table' then
 		error('[renumber] expected { {prefix, target}, ... }')
 	end
-	for i = 1, #conf do add_prefix(conf[i][1], conf[1][2]) end
+	for i = 1, #conf do add_prefix(conf[i][1], conf[i][2]) end
 end
 
 -- Layers
@@ -0,0 +1,228 @@
+/*  Copyright (C) 2016 CZ.NIC, z.s.p.o. <knot-dns@labs.nic.cz>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file revalidate.c
+ * @brief Upgrades hot low-rank cache entries during idle loop cycles.
+ *
+ * Answers served from cache without a secure rank are counted in a
+ * fixed-size LRU; names hit often enough queue for a fresh resolution
+ * that bypasses the cache, so the validated result replaces the insecure
+ * entry. The queue drains from a uv_idle handle that only runs while the
+ * event loop has spare cycles, moving validation cost off the query path.
+ */
+
+#include <libknot/packet/pkt.h>
+#include <libknot/descriptor.h>
+#include <uv.h>
+#include <time.h>
+
+#include "lib/module.h"
+#include "lib/layer.h"
+#include "lib/resolve.h"
+#include "lib/generic/lru.h"
+#include "daemon/worker.h"
+
+/* Defaults */
+#define REVALIDATE_COUNT     10000 /* Tracked names */
+#define REVALIDATE_THRESHOLD 2     /* Minimal hits before a name is revalidated */
+#define REVALIDATE_COOLDOWN  600   /* Seconds between revalidations of one name */
+#define REVALIDATE_QUEUE     256   /* Names queued for idle cycles */
+#define REVALIDATE_PRESSURE  8     /* Concurrent tasks considered busy, back off */
+
+/** @internal Tracked name: hit counter and last revalidation time. */
+struct seen_entry {
+	unsigned count;
+	uint32_t last;
+};
+
+/** @internal LRU of insecure cache hits, keyed by query type and name. */
+typedef lru_hash(struct seen_entry) namehash_t;
+
+/** @internal Queued revalidation. */
+struct reval_item {
+	uint16_t qtype;
+	uint8_t qname[KNOT_DNAME_MAXLEN];
+};
+
+/** @internal Module state. */
+struct revalidate_data {
+	namehash_t *seen;
+	uv_idle_t *idle;
+	struct reval_item queue[REVALIDATE_QUEUE];
+	size_t queue_head; /**< Next item to drain. */
+	size_t queue_len;
+};
+
+/** @internal Sample key = {[2] type, [1-255] owner}, as in the stats module. */
+static inline int seen_key(char *key, const knot_dname_t *name, uint16_t type)
+{
+	memcpy(key, &type, sizeof(type));
+	int key_len = knot_dname_to_wire((uint8_t *)key + sizeof(type), name, KNOT_DNAME_MAXLEN);
+	if (key_len > 0) {
+		return key_len + sizeof(type);
+	}
+	return key_len;
+}
+
+/** @internal Drain one queued name per idle cycle, while the loop is quiet. */
+static void drain_queue(uv_idle_t *idle)
+{
+	struct kr_module *module = idle->data;
+	struct revalidate_data *data = module->data;
+	struct worker_ctx *worker = idle->loop->data;
+	if (!worker || data->queue_len == 0) {
+		uv_idle_stop(idle);
+		return;
+	}
+	/* Never compete with live traffic, the queue picks up again
+	 * from the finish hook once the burst is answered. */
+	if (worker->stats.concurrent >= REVALIDATE_PRESSURE) {
+		uv_idle_stop(idle);
+		return;
+	}
+	struct reval_item *item = &data->queue[data->queue_head];
+	data->queue_head = (data->queue_head + 1) % REVALIDATE_QUEUE;
+	data->queue_len -= 1;
+	/* The resolution bypasses cache lookups, so it can not be answered
+	 * from the very entry it is trying to upgrade. */
+	knot_pkt_t *query = knot_pkt_new(NULL, KNOT_WIRE_MIN_PKTSIZE, &worker->pkt_pool);
+	if (!query) {
+		return;
+	}
+	knot_pkt_put_question(query, item->qname, KNOT_CLASS_IN, item->qtype);
+	knot_wire_set_rd(query->wire);
+	worker_resolve(worker, query, QUERY_NO_CACHE, NULL, NULL);
+	if (data->queue_len == 0) {
+		uv_idle_stop(idle);
+	}
+}
+
+static int track_answer(knot_layer_t *ctx)
+{
+	struct kr_request *req = ctx->data;
+	struct kr_module *module = ctx->api->data;
+	struct revalidate_data *data = module->data;
+	struct kr_rplan *rplan = &req->rplan;
+	if (!data->seen || !data->idle || rplan->resolved.len == 0) {
+		return ctx->state;
+	}
+	/* Keep the queue draining even if this answer adds nothing. */
+	if (data->queue_len > 0) {
+		uv_idle_start(data->idle, drain_queue);
+	}
+	/* Internal requests (including our own revalidations) are not
+	 * tracked, otherwise the module would feed itself. */
+	if (req->qsource.addr == NULL || req->state != KNOT_STATE_DONE) {
+		return ctx->state;
+	}
+	struct kr_query *first = NULL;
+	for (size_t i = 0; i < rplan->resolved.len; ++i) {
+		if (rplan->resolved.at[i]->parent == NULL) {
+			first = rplan->resolved.at[i];
+			break;
+		}
+	}
+	if (!first || first->sclass != KNOT_CLASS_IN || knot_rrtype_is_metatype(first->stype)) {
+		return ctx->state;
+	}
+	/* Only cache hits that came back without a secure rank are
+	 * worth a second look; fresh answers were just validated. */
+	if (!(first->flags & QUERY_CACHED) || !(first->flags & QUERY_DNSSEC_INSECURE)) {
+		return ctx->state;
+	}
+
+	char key[sizeof(uint16_t) + KNOT_DNAME_MAXLEN];
+	int key_len = seen_key(key, first->sname, first->stype);
+	if (key_len <= 0) {
+		return ctx->state;
+	}
+	struct seen_entry *entry = lru_set(data->seen, key, key_len);
+	if (!entry) {
+		return ctx->state;
+	}
+	entry->count += 1;
+	const uint32_t now = first->timestamp.tv_sec;
+	if (entry->count < REVALIDATE_THRESHOLD ||
+	    now - entry->last < REVALIDATE_COOLDOWN ||
+	    data->queue_len >= REVALIDATE_QUEUE) {
+		return ctx->state;
+	}
+	/* Genuinely insecure zones never upgrade, the cooldown bounds
+	 * how often they are retried. */
+	entry->last = now;
+	entry->count = 0;
+	struct reval_item *item = &data->queue[(data->queue_head + data->queue_len) % REVALIDATE_QUEUE];
+	item->qtype = first->stype;
+	memcpy(item->qname, key + sizeof(uint16_t), key_len - sizeof(uint16_t));
+	data->queue_len += 1;
+	uv_idle_start(data->idle, drain_queue);
+	return ctx->state;
+}
+
+/*
+ * Module implementation.
+ */
+
+KR_EXPORT
+const knot_layer_api_t *revalidate_layer(struct kr_module *module)
+{
+	static knot_layer_api_t _layer = {
+		.finish = &track_answer,
+	};
+	/* Store module reference */
+	_layer.data = module;
+	return &_layer;
+}
+
+KR_EXPORT
+int revalidate_init(struct kr_module *module)
+{
+	struct revalidate_data *data = malloc(sizeof(*data));
+	if (!data) {
+		return kr_error(ENOMEM);
+	}
+	memset(data, 0, sizeof(*data));
+	module->data = data;
+	data->seen = malloc(lru_size(namehash_t, REVALIDATE_COUNT));
+	if (data->seen) {
+		lru_init(data->seen, REVALIDATE_COUNT);
+	}
+	data->idle = malloc(sizeof(*data->idle));
+	if (data->idle) {
+		uv_idle_init(uv_default_loop(), data->idle);
+		data->idle->data = module;
+	}
+	return kr_ok();
+}
+
+KR_EXPORT
+int revalidate_deinit(struct kr_module *module)
+{
+	struct revalidate_data *data = module->data;
+	if (data) {
+		if (data->idle) {
+			uv_idle_stop(data->idle);
+			uv_close((uv_handle_t *)data->idle, (uv_close_cb)free);
+		}
+		lru_deinit(data->seen);
+		free(data->seen);
+		free(data);
+	}
+	return kr_ok();
+}
+
+KR_MODULE_EXPORT(revalidate)
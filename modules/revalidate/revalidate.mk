@@ -0,0 +1,5 @@
+revalidate_CFLAGS := -fvisibility=hidden -fPIC
+revalidate_SOURCES := modules/revalidate/revalidate.c
+revalidate_DEPEND := $(libkres)
+revalidate_LIBS := $(contrib_TARGET) $(libkres_TARGET) $(libkres_LIBS) $(libuv_LIBS)
+$(call make_c_module,revalidate)
@@ -33,6 +33,7 @@
 #include "lib/module.h"
 #include "lib/layer.h"
 #include "lib/resolve.h"
+#include "daemon/engine.h"
 
 /** @internal Compatibility wrapper for Lua < 5.2 */
 #if LUA_VERSION_NUM < 502
@@ -57,6 +58,8 @@
 	X(answer,cached) X(answer,1ms) X(answer,10ms) X(answer,50ms) X(answer,100ms) \
 	X(answer,250ms) X(answer,500ms) X(answer,1000ms) X(answer,1500ms) X(answer,slow) \
 	X(query,edns) X(query,dnssec) \
+	X(cache,hit) X(cache,miss) X(cache,insert) X(cache,delete) \
+	X(cache,capacity) X(cache,used) X(cache,fragmented) X(cache,commits) X(cache,failed) \
 	X(const,end)
 
 enum const_metric {
@@ -64,12 +67,8 @@ enum const_metric {
 	CONST_METRICS(X)
 	#undef X
 };
-struct const_metric_elm {
-	const char *key;
-	size_t val;
-};
-static struct const_metric_elm const_metrics[] = {
-	#define X(a,b) [metric_ ## a ## _ ## b] = { #a "." #b, 0 },
+static const char *const_metrics[] = {
+	#define X(a,b) [metric_ ## a ## _ ## b] = #a "." #b,
 	CONST_METRICS(X)
 	#undef X
 };
@@ -79,9 +78,43 @@ static struct const_metric_elm const_metrics[] = {
 typedef lru_hash(unsigned) namehash_t;
 typedef array_t(struct sockaddr_in6) addrlist_t;
 
+/** @internal Dynamic metric, the name is owned by the entry. */
+struct dyn_metric {
+	const char *name;
+	size_t val;
+};
+
+/** @cond internal Latency histograms with logarithmic buckets,
+ * bucket b covers answers up to 2^b milliseconds. Split by answer
+ * source and transport, so cheap cache hits don't mask recursion tails. */
+#define LATENCY_BUCKETS 16
+enum latency_class {
+	latency_udp_recursion = 0,
+	latency_udp_cached,
+	latency_tcp_recursion,
+	latency_tcp_cached,
+	latency_first_send, /**< Submit to first upstream send, from the timing trace. */
+	latency_class_end
+};
+static const char *latency_class_name[latency_class_end] = {
+	"udp.recursion", "udp.cached", "tcp.recursion", "tcp.cached", "firstsend"
+};
+struct latency_hist {
+	size_t bucket[LATENCY_BUCKETS];
+	size_t count;
+};
+/** @endcond */
+
 /** @internal Stats data structure. */
 struct stat_data {
-	map_t map;
+	map_t map; /**< Dynamic metric name => handle + 1, resolved once. */
+	array_t(struct dyn_metric) dyn; /**< Dynamic metric values, indexed by handle. */
+	struct engine *engine; /**< Daemon engine, carries the shared counter segment. */
+	size_t *vals; /**< Const metric values, this fork's shared slot when forked. */
+	size_t local_vals[metric_const_end]; /**< Fallback storage for a single process. */
+	int cache_tags[KR_CACHE_TAGCOUNT][4]; /**< Pre-resolved per-tag metric handles. */
+	struct latency_hist latency[latency_class_end];
+	int latency_pct[latency_class_end][3]; /**< Pre-resolved p50/p95/p99 handles. */
 	struct {
 		namehash_t *frequent;
 		namehash_t *expiring;
@@ -98,7 +131,100 @@ struct stat_data {
 /** @internal Add to const map counter */
 static inline void stat_const_add(struct stat_data *data, enum const_metric key, ssize_t incr)
 {
-	const_metrics[key].val += incr;
+	data->vals[key] += incr;
+}
+
+/** @internal Read a const metric, summing over all fork slots when shared.
+ * Cache occupancy metrics are gauges of the shared storage and every fork
+ * sees the same numbers, so the local slot stands for all of them. */
+static size_t stat_const_read(struct stat_data *data, unsigned key)
+{
+	struct engine *engine = data->engine;
+	if (engine && engine->shm_stats && data->vals != data->local_vals &&
+	    key != metric_cache_capacity && key != metric_cache_used &&
+	    key != metric_cache_fragmented) {
+		size_t sum = 0;
+		for (int i = 0; i < engine->shm_stats_len; ++i) {
+			sum += engine->shm_stats[i].counter[key];
+		}
+		return sum;
+	}
+	return data->vals[key];
+}
+
+/** @internal Resolve a dynamic metric name into a stable integer handle.
+ * The tree walk happens once per name, updates through the handle are
+ * then a plain array increment. Returns -1 on allocation failure. */
+static int stat_dyn_handle(struct stat_data *data, const char *key)
+{
+	void *found = map_get(&data->map, key);
+	if (found) {
+		return (int)((size_t)found - 1);
+	}
+	struct dyn_metric metric = { strdup(key), 0 };
+	if (!metric.name || array_push(data->dyn, metric) < 0) {
+		free((char *)metric.name);
+		return -1;
+	}
+	int handle = data->dyn.len - 1;
+	if (map_set(&data->map, key, (void *)(size_t)(handle + 1)) != 0) {
+		return -1;
+	}
+	return handle;
+}
+
+/** @internal Set a dynamic metric through its handle. */
+static inline void stat_dyn_set(struct stat_data *data, int handle, size_t val)
+{
+	if (handle >= 0) {
+		data->dyn.at[handle].val = val;
+	}
+}
+
+/** @internal Record one answer latency sample. */
+static void latency_record(struct latency_hist *hist, long elapsed)
+{
+	unsigned b = 0;
+	while (elapsed > 1 && b < LATENCY_BUCKETS - 1) {
+		elapsed >>= 1;
+		b += 1;
+	}
+	hist->bucket[b] += 1;
+	hist->count += 1;
+}
+
+static void latency_sample(struct stat_data *data, long elapsed, bool tcp, bool cached)
+{
+	latency_record(&data->latency[(tcp ? 2 : 0) + (cached ? 1 : 0)], elapsed);
+}
+
+/** @internal Bucket upper bound (ms) covering the given quantile. */
+static size_t latency_quantile(const struct latency_hist *hist, unsigned percent)
+{
+	const size_t rank = (hist->count * percent + 99) / 100;
+	size_t seen = 0;
+	for (unsigned b = 0; b < LATENCY_BUCKETS; ++b) {
+		seen += hist->bucket[b];
+		if (seen >= rank) {
+			return 1 << b;
+		}
+	}
+	return 1 << (LATENCY_BUCKETS - 1);
+}
+
+/** @internal Publish percentile gauges into the dynamic metrics,
+ * called lazily when the metrics are queried. */
+static void collect_latency(struct stat_data *data)
+{
+	for (unsigned i = 0; i < latency_class_end; ++i) {
+		const struct latency_hist *hist = &data->latency[i];
+		if (hist->count == 0) {
+			continue;
+		}
+		stat_dyn_set(data, data->latency_pct[i][0], latency_quantile(hist, 50));
+		stat_dyn_set(data, data->latency_pct[i][1], latency_quantile(hist, 95));
+		stat_dyn_set(data, data->latency_pct[i][2], latency_quantile(hist, 99));
+	}
 }
 
 static int collect_answer(struct stat_data *data, knot_pkt_t *pkt)
@@ -224,6 +350,18 @@ static int collect(knot_layer_t *ctx)
 		if (last->flags & QUERY_CACHED) {
 			stat_const_add(data, metric_answer_cached, 1);
 		}
+		latency_sample(data, elapsed, param->qsource.tcp,
+		               last->flags & QUERY_CACHED);
+	}
+	/* Time from submit to the first upstream send, when the timing
+	 * trace was armed. Growth here with flat upstream RTTs means the
+	 * slowness is ours (cache, scheduling), not the network's. */
+	for (unsigned i = 0; i < param->trace.len; ++i) {
+		if (param->trace.ev[i].phase == KR_TRACE_SEND) {
+			latency_record(&data->latency[latency_first_send],
+			               param->trace.ev[i].us / 1000);
+			break;
+		}
 	}
 	/* Query parameters and transport mode */
 	if (knot_pkt_has_edns(param->answer)) {
@@ -235,6 +373,40 @@ static int collect(knot_layer_t *ctx)
 	return ctx->state;
 }
 
+/** @internal Publish cache counters kept in struct kr_cache.
+ * The hot path only bumps plain per-fork counters there, so the copy-out
+ * happens lazily when the metrics are queried. */
+static void collect_cache(void *env, struct stat_data *data)
+{
+	if (!env) {
+		return;
+	}
+	struct engine *engine = env;
+	struct kr_cache *cache = &engine->resolver.cache;
+	data->vals[metric_cache_hit] = cache->stats.hit;
+	data->vals[metric_cache_miss] = cache->stats.miss;
+	data->vals[metric_cache_insert] = cache->stats.insert;
+	data->vals[metric_cache_delete] = cache->stats.delete;
+	/* Per-tag breakdown goes to the dynamic metrics, handles were
+	 * resolved once at init so this is four stores per tag. */
+	for (unsigned i = 0; i < KR_CACHE_TAGCOUNT; ++i) {
+		stat_dyn_set(data, data->cache_tags[i][0], cache->stats.tag[i].hit);
+		stat_dyn_set(data, data->cache_tags[i][1], cache->stats.tag[i].miss);
+		stat_dyn_set(data, data->cache_tags[i][2], cache->stats.tag[i].insert);
+		stat_dyn_set(data, data->cache_tags[i][3], cache->stats.tag[i].delete);
+	}
+	/* Storage occupancy, if the backend can report it. */
+	struct kr_cdb_stats backend;
+	if (kr_cache_is_open(cache) && cache->api->stats &&
+	    cache->api->stats(cache->db, &backend) == 0) {
+		data->vals[metric_cache_capacity] = backend.capacity;
+		data->vals[metric_cache_used] = backend.used;
+		data->vals[metric_cache_fragmented] = backend.fragmented;
+		data->vals[metric_cache_commits] = backend.commits;
+		data->vals[metric_cache_failed] = backend.failed;
+	}
+}
+
 /**
  * Set nominal value of a key.
  *
@@ -250,12 +422,12 @@ static char* stats_set(void *env, struct kr_module *module, const char *args)
 		*val = '\0';
 		size_t number = strtoul(val + 1, NULL, 10);
 		for (unsigned i = 0; i < metric_const_end; ++i) {
-			if (strcmp(const_metrics[i].key, pair) == 0) {
-				const_metrics[i].val = number;
+			if (strcmp(const_metrics[i], pair) == 0) {
+				data->vals[i] = number;
 				return NULL;
 			}
 		}
-		map_set(&data->map, pair, (void *)number);
+		stat_dyn_set(data, stat_dyn_handle(data, pair), number);
 	}
 
 	return NULL;
@@ -270,6 +442,8 @@ static char* stats_set(void *env, struct kr_module *module, const char *args)
 static char* stats_get(void *env, struct kr_module *module, const char *args)
 {
 	struct stat_data *data = module->data;
+	collect_cache(env, data);
+	collect_latency(data);
 
 	/* Expecting CHAR_BIT to be 8, this is a safe bet */
 	char *ret = malloc(3 * sizeof(size_t) + 2);
@@ -279,26 +453,33 @@ static char* stats_get(void *env, struct kr_module *module, const char *args)
 
 	/* Check if it exists in const map. */
 	for (unsigned i = 0; i < metric_const_end; ++i) {
-		if (strcmp(const_metrics[i].key, args) == 0) {
-			sprintf(ret, "%zu", const_metrics[i].val);
+		if (strcmp(const_metrics[i], args) == 0) {
+			sprintf(ret, "%zu", stat_const_read(data, i));
 			return ret;
 		}
 	}
-	/* Check in variable map */
-	if (!map_contains(&data->map, args)) {
+	/* Check in dynamic metrics */
+	void *found = map_get(&data->map, args);
+	if (!found) {
 		free(ret);
 		return NULL;
 	}
-	void *val = map_get(&data->map, args);
-	sprintf(ret, "%zu", (size_t) val);
+	sprintf(ret, "%zu", data->dyn.at[(size_t)found - 1].val);
 	return ret;
 }
 
+/** @internal Walk state for dynamic metric listing. */
+struct list_baton {
+	struct stat_data *data;
+	struct kr_jsonw *w;
+};
+
 static int list_entry(const char *key, void *val, void *baton)
 {
-	JsonNode *root = baton;
-	size_t number = (size_t) val;
-	json_append_member(root, key, json_mknumber(number));
+	struct list_baton *ctx = baton;
+	size_t number = ctx->data->dyn.at[(size_t)val - 1].val;
+	kr_jsonw_key(ctx->w, key);
+	kr_jsonw_num(ctx->w, number);
 	return 0;
 }
 
@@ -310,19 +491,23 @@ static int list_entry(const char *key, void *val, void *baton)
 static char* stats_list(void *env, struct kr_module *module, const char *args)
 {
 	struct stat_data *data = module->data;
-	JsonNode *root = json_mkobject();
+	collect_cache(env, data);
+	collect_latency(data);
+	struct kr_jsonw w;
+	kr_jsonw_init(&w);
+	kr_jsonw_open(&w, '{');
 	/* Walk const metrics map */
 	size_t args_len = args ? strlen(args) : 0;
 	for (unsigned i = 0; i < metric_const_end; ++i) {
-		struct const_metric_elm *elm = &const_metrics[i];
-		if (strncmp(elm->key, args, args_len) == 0) {
-			json_append_member(root, elm->key, json_mknumber(elm->val));
+		if (strncmp(const_metrics[i], args, args_len) == 0) {
+			kr_jsonw_key(&w, const_metrics[i]);
+			kr_jsonw_num(&w, stat_const_read(data, i));
 		}
 	}
-	map_walk_prefixed(&data->map, (args_len > 0) ? args : "", list_entry, root);
-	char *ret = json_encode(root);
-	json_delete(root);
-	return ret;
+	struct list_baton baton = { data, &w };
+	map_walk_prefixed(&data->map, (args_len > 0) ? args : "", list_entry, &baton);
+	kr_jsonw_close(&w, '}');
+	return kr_jsonw_finish(&w);
 }
 
 /**
@@ -337,7 +522,9 @@ static char* dump_list(void *env, struct kr_module *module, const char *args, na
 	}
 	uint16_t key_type = 0;
 	char key_name[KNOT_DNAME_MAXLEN], type_str[16];
-	JsonNode *root = json_mkarray();
+	struct kr_jsonw w;
+	kr_jsonw_init(&w);
+	kr_jsonw_open(&w, '[');
 	for (unsigned i = 0; i < table->size; ++i) {
 		struct lru_slot *slot = lru_slot_at((struct lru_hash_base *)table, i);
 		if (slot->key) {
@@ -346,17 +533,19 @@ static char* dump_list(void *env, struct kr_module *module, const char *args, na
 			knot_dname_to_str(key_name, (uint8_t *)slot->key + sizeof(key_type), sizeof(key_name));
 			knot_rrtype_to_string(key_type, type_str, sizeof(type_str));
 			unsigned *slot_val = lru_slot_val(slot, lru_slot_offset(table));
-			/* Convert to JSON object */
-			JsonNode *json_val = json_mkobject();
-			json_append_member(json_val, "count", json_mknumber(*slot_val));
-			json_append_member(json_val, "name",  json_mkstring(key_name));
-			json_append_member(json_val, "type",  json_mkstring(type_str));
-			json_append_element(root, json_val);
+			/* Stream as JSON object */
+			kr_jsonw_open(&w, '{');
+			kr_jsonw_key(&w, "count");
+			kr_jsonw_num(&w, *slot_val);
+			kr_jsonw_key(&w, "name");
+			kr_jsonw_str(&w, key_name);
+			kr_jsonw_key(&w, "type");
+			kr_jsonw_str(&w, type_str);
+			kr_jsonw_close(&w, '}');
 		}
 	}
-	char *ret = json_encode(root);
-	json_delete(root);
-	return ret;
+	kr_jsonw_close(&w, ']');
+	return kr_jsonw_finish(&w);
 }
 
 static char* dump_frequent(void *env, struct kr_module *module, const char *args)
@@ -387,6 +576,92 @@ static char* clear_expiring(void *env, struct kr_module *module, const char *arg
 	return NULL;
 }
 
+/**
+ * Dump latency histograms.
+ *
+ * Output: { class: { count: N, buckets: [..], p50: ms, p95: ms, p99: ms }, ... }
+ * Bucket b counts answers that took up to 2^b milliseconds.
+ */
+static char* dump_latency(void *env, struct kr_module *module, const char *args)
+{
+	struct stat_data *data = module->data;
+	struct kr_jsonw w;
+	kr_jsonw_init(&w);
+	kr_jsonw_open(&w, '{');
+	for (unsigned i = 0; i < latency_class_end; ++i) {
+		const struct latency_hist *hist = &data->latency[i];
+		kr_jsonw_key(&w, latency_class_name[i]);
+		kr_jsonw_open(&w, '{');
+		kr_jsonw_key(&w, "count");
+		kr_jsonw_num(&w, hist->count);
+		kr_jsonw_key(&w, "buckets");
+		kr_jsonw_open(&w, '[');
+		for (unsigned b = 0; b < LATENCY_BUCKETS; ++b) {
+			kr_jsonw_num(&w, hist->bucket[b]);
+		}
+		kr_jsonw_close(&w, ']');
+		if (hist->count > 0) {
+			kr_jsonw_key(&w, "p50");
+			kr_jsonw_num(&w, latency_quantile(hist, 50));
+			kr_jsonw_key(&w, "p95");
+			kr_jsonw_num(&w, latency_quantile(hist, 95));
+			kr_jsonw_key(&w, "p99");
+			kr_jsonw_num(&w, latency_quantile(hist, 99));
+		}
+		kr_jsonw_close(&w, '}');
+	}
+	kr_jsonw_close(&w, '}');
+	return kr_jsonw_finish(&w);
+}
+
+/** @internal Append one hook's timing table under "module.hook" keys. */
+static void timing_append(struct kr_jsonw *w, const char *hook, layer_timing_array_t *table)
+{
+	for (size_t i = 0; i < table->len; ++i) {
+		struct kr_layer_timing *t = &table->at[i];
+		char key[128];
+		snprintf(key, sizeof(key), "%s.%s", t->module->name, hook);
+		kr_jsonw_key(w, key);
+		kr_jsonw_open(w, '{');
+		kr_jsonw_key(w, "calls");
+		kr_jsonw_num(w, t->calls);
+		kr_jsonw_key(w, "us");
+		kr_jsonw_num(w, t->ns / 1000.0);
+		kr_jsonw_close(w, '}');
+	}
+}
+
+/**
+ * Per-layer timing breakdown.
+ *
+ * timing(true|false) toggles the accounting (and resets the counters on
+ * enable), timing() dumps { 'module.hook': { calls: N, us: N }, ... }.
+ */
+static char* dump_timing(void *env, struct kr_module *module, const char *args)
+{
+	struct engine *engine = env;
+	struct kr_context *ctx = &engine->resolver;
+	if (args && args[0] != '\0') {
+		const bool enable = strcmp(args, "true") == 0 || strcmp(args, "1") == 0;
+		if (enable) {
+			/* Counters restart with every enable. */
+			kr_context_compile_layers(ctx);
+		}
+		ctx->layers->timing = enable;
+		return NULL;
+	}
+	struct kr_jsonw w;
+	kr_jsonw_init(&w);
+	kr_jsonw_open(&w, '{');
+	timing_append(&w, "begin", &ctx->layers->time_begin);
+	timing_append(&w, "reset", &ctx->layers->time_reset);
+	timing_append(&w, "finish", &ctx->layers->time_finish);
+	timing_append(&w, "consume", &ctx->layers->time_consume);
+	timing_append(&w, "produce", &ctx->layers->time_produce);
+	kr_jsonw_close(&w, '}');
+	return kr_jsonw_finish(&w);
+}
+
 static char* dump_upstreams(void *env, struct kr_module *module, const char *args)
 {
 	struct stat_data *data = module->data;
@@ -394,7 +669,10 @@ static char* dump_upstreams(void *env, struct kr_module *module, const char *arg
 		return NULL;
 	}
 
-	/* Walk the ring backwards until AF_UNSPEC or we hit head. */
+	/* Walk the ring backwards until AF_UNSPEC or we hit head.
+	 * This dump keeps the ccan/json tree: entries for one address are
+	 * scattered around the ring and get grouped under a shared key,
+	 * which needs the random access a streaming writer cannot offer. */
 	JsonNode *root = json_mkobject();
 	size_t head = data->upstreams.head;
 	for (size_t i = 1; i < UPSTREAMS_COUNT; ++i) {
@@ -443,12 +721,42 @@ const knot_layer_api_t *stats_layer(struct kr_module *module)
 KR_EXPORT
 int stats_init(struct kr_module *module)
 {
+	struct engine *engine = module->data;
 	struct stat_data *data = malloc(sizeof(*data));
 	if (!data) {
 		return kr_error(ENOMEM);
 	}
 	memset(data, 0, sizeof(*data));
 	data->map = map_make();
+	array_init(data->dyn);
+	data->engine = engine;
+	/* Resolve handles for the per-tag cache metrics up front. */
+	static const char *tag_name[KR_CACHE_TAGCOUNT] = { "rr", "pkt", "sig", "other" };
+	static const char *tag_op[] = { "hit", "miss", "insert", "delete" };
+	for (unsigned i = 0; i < KR_CACHE_TAGCOUNT; ++i) {
+		for (unsigned op = 0; op < 4; ++op) {
+			char key[32];
+			snprintf(key, sizeof(key), "cache.%s.%s", tag_name[i], tag_op[op]);
+			data->cache_tags[i][op] = stat_dyn_handle(data, key);
+		}
+	}
+	/* Resolve handles for the latency percentile gauges. */
+	static const char *pct_name[] = { "p50", "p95", "p99" };
+	for (unsigned i = 0; i < latency_class_end; ++i) {
+		for (unsigned p = 0; p < 3; ++p) {
+			char key[48];
+			snprintf(key, sizeof(key), "latency.%s.%s",
+			         latency_class_name[i], pct_name[p]);
+			data->latency_pct[i][p] = stat_dyn_handle(data, key);
+		}
+	}
+	/* Bump counters in the shared segment when forked, so that any fork
+	 * can serve a merged view without asking its siblings. */
+	data->vals = data->local_vals;
+	if (engine && engine->shm_stats && metric_const_end <= ENGINE_SHM_COUNTERS &&
+	    engine->shm_stats_id < engine->shm_stats_len) {
+		data->vals = engine->shm_stats[engine->shm_stats_id].counter;
+	}
 	module->data = data;
 	data->queries.frequent = malloc(lru_size(namehash_t, FREQUENT_COUNT));
 	if (data->queries.frequent) {
@@ -476,6 +784,10 @@ int stats_deinit(struct kr_module *module)
 	struct stat_data *data = module->data;
 	if (data) {
 		map_clear(&data->map);
+		for (size_t i = 0; i < data->dyn.len; ++i) {
+			free((char *)data->dyn.at[i].name);
+		}
+		array_clear(data->dyn);
 		lru_deinit(data->queries.frequent);
 		lru_deinit(data->queries.expiring);
 		free(data->queries.frequent);
@@ -497,6 +809,8 @@ struct kr_prop *stats_props(void)
 	    { &clear_frequent,"clear_frequent", "Clear frequent queries log.", },
 	    { &dump_expiring, "expiring", "List expiring records.", },
 	    { &clear_expiring,"clear_expiring", "Clear expiring records log.", },
+	    { &dump_latency,  "latency", "Dump latency histograms.", },
+	    { &dump_timing,   "timing", "Toggle or dump per-layer timing.", },
 	    { &dump_upstreams,  "upstreams", "List recently seen authoritatives.", },
 	    { NULL, NULL, NULL }
 	};
@@ -8,6 +8,9 @@ local view = {
 	key = {},
 	src = {},
 	dst = {},
+	-- Compiled subnet indexes (see lib/lpm.h), longest prefix wins
+	src_index = nil,
+	dst_index = nil,
 }
 
 -- @function View based on TSIG key name.
@@ -21,7 +24,15 @@ function view.addr(view, subnet, policy, dst)
 	local family = C.kr_straddr_family(subnet)
 	local bitlen = C.kr_straddr_subnet(subnet_cd, subnet)
 	local t = {family, subnet_cd, bitlen, policy}
-	table.insert(dst and view.dst or view.src, t)
+	local list = dst and view.dst or view.src
+	table.insert(list, t)
+	-- Keep the compiled subnet index in sync
+	local index = dst and 'dst_index' or 'src_index'
+	if not view[index] then
+		view[index] = ffi.gc(C.kr_lpm_create(), C.kr_lpm_free)
+	end
+	C.kr_lpm_add(view[index], subnet, #list)
+	C.kr_lpm_compile(view[index])
 	return t
 end
 
@@ -34,23 +45,17 @@ end
 local function evaluate(view, req)
 	local client_key = req.qsource.key
 	local match_cb = (client_key ~= nil) and view.key[client_key:owner()] or nil
-	-- Search subnets otherwise
+	-- Search the compiled subnet indexes otherwise, longest prefix wins
 	if match_cb == nil then
-		if req.qsource.addr ~= nil then
-			for i = 1, #view.src do
-				local pair = view.src[i]
-				if match_subnet(pair[1], pair[2], pair[3], req.qsource.addr) then
-					match_cb = pair[4]
-					break
-				end
+		if req.qsource.addr ~= nil and view.src_index ~= nil then
+			local id = C.kr_lpm_match(view.src_index, req.qsource.addr)
+			if id > 0 then
+				match_cb = view.src[id][4]
 			end
-		elseif req.qsource.dst_addr ~= nil then
-			for i = 1, #view.dst do
-				local pair = view.dst[i]
-				if match_subnet(pair[1], pair[2], pair[3], req.qsource.dst_addr) then
-					match_cb = pair[4]
-					break
-				end
+		elseif req.qsource.dst_addr ~= nil and view.dst_index ~= nil then
+			local id = C.kr_lpm_match(view.dst_index, req.qsource.dst_addr)
+			if id > 0 then
+				match_cb = view.dst[id][4]
 			end
 		end
 	end
@@ -0,0 +1,117 @@
+-- Periodic snapshot of busy delegation points, preloaded after restart
+-- so the first queries walk no delegations.
+-- @module warmup
+-- @field file snapshot file path (relative to working directory)
+-- @field interval snapshot period in milliseconds
+-- @field maxzones maximum number of snapshotted zones
+-- @field batch number of warming queries issued per tick
+local warmup = {
+	file = 'warmup.lst',
+	interval = 10 * minute,
+	maxzones = 256,
+	batch = 16,
+	zones = {},
+	queue = {},
+}
+
+-- Reduce a query name to candidate delegation points (TLD and 2LD).
+local function cut_names(name)
+	local labels = {}
+	for label in name:gmatch('[^%.]+') do
+		table.insert(labels, label)
+	end
+	local cuts = {}
+	local n = #labels
+	if n >= 1 then table.insert(cuts, labels[n] .. '.') end
+	if n >= 2 then table.insert(cuts, labels[n - 1] .. '.' .. labels[n] .. '.') end
+	return cuts
+end
+
+-- Track delegation points of currently frequent names.
+function warmup.sample()
+	if not stats then error("'stats' module required") end
+	local queries = stats.frequent()
+	for i = 1, #queries do
+		for _, zone in ipairs(cut_names(queries[i].name)) do
+			warmup.zones[zone] = true
+		end
+	end
+	warmup.ev_sample = event.after(warmup.interval, warmup.sample)
+	return warmup.snapshot()
+end
+
+-- Write the tracked zones to disk, atomically via rename.
+function warmup.snapshot()
+	local zones = {}
+	for zone in pairs(warmup.zones) do
+		table.insert(zones, zone)
+		if #zones >= warmup.maxzones then break end
+	end
+	table.sort(zones)
+	local tmpname = warmup.file .. '.tmp'
+	local file, err = io.open(tmpname, 'w')
+	if not file then
+		log('[warmup] cannot write snapshot: %s', err)
+		return 0
+	end
+	file:write(table.concat(zones, '\n'))
+	file:write('\n')
+	file:close()
+	os.rename(tmpname, warmup.file)
+	return #zones
+end
+
+-- Issue a batch of NS warming queries, spread over time to avoid
+-- the startup burst the snapshot is meant to prevent.
+function warmup.drain()
+	local issued = 0
+	while issued < warmup.batch and #warmup.queue > 0 do
+		local zone = table.remove(warmup.queue)
+		worker.resolve(zone, kres.type.NS, 1)
+		issued = issued + 1
+	end
+	warmup.ev_drain = nil
+	if #warmup.queue > 0 then
+		warmup.ev_drain = event.after(1 * sec, warmup.drain)
+	end
+	return issued
+end
+
+-- Load the snapshot and schedule the warming queries.
+function warmup.preload()
+	warmup.queue = { '.' }
+	local file = io.open(warmup.file, 'r')
+	if file then
+		for zone in file:lines() do
+			if #zone > 0 and #warmup.queue <= warmup.maxzones then
+				table.insert(warmup.queue, zone)
+				warmup.zones[zone] = true
+			end
+		end
+		file:close()
+	end
+	warmup.ev_drain = event.after(0, warmup.drain)
+end
+
+function warmup.init(module)
+	warmup.preload()
+	warmup.ev_sample = event.after(warmup.interval, warmup.sample)
+end
+
+function warmup.deinit(module)
+	if warmup.ev_sample then event.cancel(warmup.ev_sample) end
+	if warmup.ev_drain then event.cancel(warmup.ev_drain) end
+	warmup.ev_sample = nil
+	warmup.ev_drain = nil
+	warmup.snapshot()
+end
+
+function warmup.config(config)
+	if type(config) ~= 'table' then return end
+	if config.file then warmup.file = config.file end
+	if config.interval then warmup.interval = config.interval end
+	if config.maxzones then warmup.maxzones = config.maxzones end
+	if config.batch then warmup.batch = config.batch end
+end
+
+return warmup
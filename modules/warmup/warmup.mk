@@ -0,0 +1,2 @@
+warmup_SOURCES := warmup.lua
+$(call make_lua_module,warmup)
@@ -0,0 +1,51 @@
+#
+# Microbenchmarks
+#
+
+benchs_BIN := \
+	bench_micro
+
+# Load-generation tools are built, not run (they need a resolver to shoot at)
+benchs_TOOLS :=
+ifeq ($(HAS_libuv), yes)
+benchs_TOOLS += bench_replay
+endif
+
+# Dependencies
+benchs_DEPEND := $(libkres)
+benchs_LIBS := $(libkres_TARGET) $(libkres_LIBS) $(lmdb_LIBS) $(libuv_LIBS)
+
+# Platform-specific library injection
+ifeq ($(PLATFORM),Darwin)
+	bench_preload_syms := DYLD_FORCE_FLAT_NAMESPACE=1 DYLD_LIBRARY_PATH="$(DYLD_LIBRARY_PATH):$(abspath lib)"
+else
+	bench_preload_syms := LD_LIBRARY_PATH="$(LD_LIBRARY_PATH):$(abspath lib)"
+endif
+
+# Make benchmark binaries
+define make_bench
+$(1)_CFLAGS := -fPIE
+$(1)_SOURCES := tests/$(1).c
+$(1)_LIBS := $(benchs_LIBS)
+$(1)_DEPEND := $(benchs_DEPEND)
+$(call make_bin,$(1),tests)
+$(1): $$($(1))
+	@$(bench_preload_syms) $$<
+.PHONY: $(1)
+endef
+
+define make_bench_tool
+$(1)_CFLAGS := -fPIE
+$(1)_SOURCES := tests/$(1).c
+$(1)_LIBS := $(benchs_LIBS)
+$(1)_DEPEND := $(benchs_DEPEND)
+$(call make_bin,$(1),tests)
+endef
+
+# Targets
+$(foreach bench,$(benchs_BIN),$(eval $(call make_bench,$(bench))))
+$(foreach tool,$(benchs_TOOLS),$(eval $(call make_bench_tool,$(tool))))
+bench: $(foreach bench,$(benchs_BIN),$(bench)) $(foreach tool,$(benchs_TOOLS),$($(tool)))
+bench-clean: $(foreach bench,$(benchs_BIN) $(benchs_TOOLS),$(bench)-clean)
+
+.PHONY: bench bench-clean
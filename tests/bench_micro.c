@@ -0,0 +1,239 @@
+/*  Copyright (C) 2016 CZ.NIC, z.s.p.o. <knot-dns@labs.nic.cz>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/** @file bench_micro.c
+ * Microbenchmarks for the generic structures, dname utilities and cache
+ * operations.  Results go to stdout, one tab-separated line per benchmark:
+ *
+ *     name <TAB> iterations <TAB> ns/op <TAB> Mops/s
+ *
+ * so runs can be diffed or fed to plotting scripts.  The cache benchmark
+ * runs against LMDB on tmpfs (/dev/shm when available) to measure the
+ * code, not the disk.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <libknot/dname.h>
+
+#include "lib/generic/array.h"
+#include "lib/generic/lru.h"
+#include "lib/generic/map.h"
+#include "lib/generic/pack.h"
+#include "lib/cache.h"
+#include "lib/cdb_lmdb.h"
+#include "lib/utils.h"
+
+#define KEY_COUNT 4096		/* Distinct keys per workload (power of two). */
+#define KEY_MAXLEN 32
+#define BENCH_ITERS (1 << 20)
+#define CACHE_ITERS (1 << 14)
+#define CACHE_MAXSIZE (64 * 1024 * 1024)
+
+typedef lru_hash(unsigned) lru_bench_t;
+
+static char keys[KEY_COUNT][KEY_MAXLEN + 1];
+static uint8_t key_len[KEY_COUNT];
+static uint8_t dnames[KEY_COUNT][KNOT_DNAME_MAXLEN];
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts = { 0 };
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void report(const char *name, size_t iters, uint64_t elapsed_ns)
+{
+	double ns_op = (double)elapsed_ns / iters;
+	double mops = iters / ((double)elapsed_ns / 1000);
+	printf("%s\t%zu\t%.2f\t%.3f\n", name, iters, ns_op, mops);
+}
+
+static void make_keys(void)
+{
+	for (unsigned i = 0; i < KEY_COUNT; ++i) {
+		unsigned len = 8 + rand() % (KEY_MAXLEN - 8);
+		for (unsigned k = 0; k < len; ++k) {
+			keys[i][k] = 'a' + rand() % 26;
+		}
+		keys[i][len] = '\0';
+		key_len[i] = len;
+		/* Matching dname: single random label under .bench. */
+		uint8_t *wire = dnames[i];
+		wire[0] = len;
+		memcpy(wire + 1, keys[i], len);
+		wire[len + 1] = 5;
+		memcpy(wire + len + 2, "bench", 5);
+		wire[len + 7] = '\0';
+	}
+}
+
+static void bench_lru(void)
+{
+	lru_bench_t *lru = malloc(lru_size(lru_bench_t, KEY_COUNT));
+	lru_init(lru, KEY_COUNT);
+	uint64_t start = now_ns();
+	for (size_t i = 0; i < BENCH_ITERS; ++i) {
+		unsigned k = i & (KEY_COUNT - 1);
+		unsigned *val = lru_set(lru, keys[k], key_len[k]);
+		if (val) {
+			*val = k;
+		}
+	}
+	report("lru_set", BENCH_ITERS, now_ns() - start);
+	start = now_ns();
+	for (size_t i = 0; i < BENCH_ITERS; ++i) {
+		unsigned k = i & (KEY_COUNT - 1);
+		(void)lru_get(lru, keys[k], key_len[k]);
+	}
+	report("lru_get", BENCH_ITERS, now_ns() - start);
+	lru_deinit(lru);
+	free(lru);
+}
+
+static void bench_map(void)
+{
+	map_t map = map_make();
+	uint64_t start = now_ns();
+	for (size_t i = 0; i < BENCH_ITERS; ++i) {
+		map_set(&map, keys[i & (KEY_COUNT - 1)], (void *)1);
+	}
+	report("map_set", BENCH_ITERS, now_ns() - start);
+	start = now_ns();
+	for (size_t i = 0; i < BENCH_ITERS; ++i) {
+		(void)map_get(&map, keys[i & (KEY_COUNT - 1)]);
+	}
+	report("map_get", BENCH_ITERS, now_ns() - start);
+	map_clear(&map);
+}
+
+static void bench_array(void)
+{
+	array_t(unsigned) arr;
+	array_init(arr);
+	uint64_t start = now_ns();
+	for (size_t i = 0; i < BENCH_ITERS; ++i) {
+		if (array_push(arr, (unsigned)i) < 0) {
+			break;
+		}
+	}
+	report("array_push", BENCH_ITERS, now_ns() - start);
+	array_clear(arr);
+}
+
+static void bench_pack(void)
+{
+	pack_t pack;
+	pack_init(pack);
+	pack_reserve(pack, KEY_COUNT, KEY_COUNT * KEY_MAXLEN);
+	for (unsigned i = 0; i < KEY_COUNT; ++i) {
+		pack_obj_push(&pack, (const uint8_t *)keys[i], key_len[i]);
+	}
+	uint64_t start = now_ns();
+	size_t iters = BENCH_ITERS / 64;
+	for (size_t i = 0; i < iters; ++i) {
+		unsigned k = i & (KEY_COUNT - 1);
+		(void)pack_obj_find(&pack, (const uint8_t *)keys[k], key_len[k]);
+	}
+	report("pack_find", iters, now_ns() - start);
+	pack_clear(pack);
+}
+
+static void bench_dname(void)
+{
+	uint64_t start = now_ns();
+	for (size_t i = 0; i < BENCH_ITERS; ++i) {
+		unsigned k = i & (KEY_COUNT - 1);
+		(void)kr_dname_equal_fold(dnames[k], dnames[(k + 1) & (KEY_COUNT - 1)]);
+	}
+	report("dname_equal_fold", BENCH_ITERS, now_ns() - start);
+	start = now_ns();
+	for (size_t i = 0; i < BENCH_ITERS; ++i) {
+		unsigned k = i & (KEY_COUNT - 1);
+		(void)knot_dname_size(dnames[k]);
+	}
+	report("dname_size", BENCH_ITERS, now_ns() - start);
+}
+
+static void bench_cache(void)
+{
+	char path[] = "/dev/shm/kresd-bench-XXXXXX";
+	if (!mkdtemp(path)) {
+		strcpy(path, "./kresd-bench-XXXXXX");
+		if (!mkdtemp(path)) {
+			fprintf(stderr, "bench_cache: mkdtemp failed, skipping\n");
+			return;
+		}
+	}
+	struct kr_cache cache;
+	struct kr_cdb_opts opts = { path, CACHE_MAXSIZE, 0 };
+	if (kr_cache_open(&cache, NULL, &opts, NULL) != 0) {
+		fprintf(stderr, "bench_cache: cannot open cache at %s, skipping\n", path);
+		return;
+	}
+	struct kr_cache_entry header = {
+		.timestamp = 0,
+		.ttl = 3600,
+		.count = 1,
+	};
+	uint8_t data_buf[256];
+	memset(data_buf, 0xa5, sizeof(data_buf));
+	knot_db_val_t data = { data_buf, sizeof(data_buf) };
+	uint64_t start = now_ns();
+	for (size_t i = 0; i < CACHE_ITERS; ++i) {
+		unsigned k = i & (KEY_COUNT - 1);
+		kr_cache_insert(&cache, KR_CACHE_USER, dnames[k],
+		                (uint16_t)(i / KEY_COUNT), &header, data);
+	}
+	kr_cache_sync(&cache);
+	report("cache_insert", CACHE_ITERS, now_ns() - start);
+	start = now_ns();
+	for (size_t i = 0; i < CACHE_ITERS; ++i) {
+		unsigned k = i & (KEY_COUNT - 1);
+		struct kr_cache_entry *entry = NULL;
+		(void)kr_cache_peek(&cache, KR_CACHE_USER, dnames[k], 0, &entry, NULL);
+	}
+	report("cache_peek", CACHE_ITERS, now_ns() - start);
+	kr_cache_close(&cache);
+	/* Sweep the scratch database. */
+	char file[sizeof(path) + 16];
+	snprintf(file, sizeof(file), "%s/data.mdb", path);
+	unlink(file);
+	snprintf(file, sizeof(file), "%s/lock.mdb", path);
+	unlink(file);
+	rmdir(path);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned seed = (argc > 1) ? atoi(argv[1]) : time(NULL);
+	srand(seed);
+	printf("# seed\t%u\n", seed);
+	printf("# name\titers\tns/op\tMops/s\n");
+	make_keys();
+	bench_lru();
+	bench_map();
+	bench_array();
+	bench_pack();
+	bench_dname();
+	bench_cache();
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,391 @@
+/*  Copyright (C) 2016 CZ.NIC, z.s.p.o. <knot-dns@labs.nic.cz>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/** @file bench_replay.c
+ * Query replay load generator.  It reads a captured query stream in the
+ * dnsperf text format (one "qname qtype" pair per line, '#' comments),
+ * drives it against a running resolver over UDP or TCP at a fixed rate
+ * and reports throughput and latency percentiles.  Queries whose
+ * qname/qtype repeats earlier in the stream are reported separately from
+ * first occurrences, which approximates the warm/cold cache split for
+ * production traffic shapes.
+ *
+ * Usage: bench_replay [-s addr] [-p port] [-r qps] [-T] [-d drain_ms] FILE
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <uv.h>
+
+#include <libknot/descriptor.h>
+#include <libknot/packet/pkt.h>
+
+#include "lib/generic/array.h"
+#include "lib/generic/map.h"
+#include "lib/utils.h"
+
+#define REPLAY_TICK 10		/* Pacing timer period (ms) */
+#define REPLAY_DRAIN 2000	/* Wait for trailing answers (ms) */
+#define REPLAY_MAXQ 65536	/* In-flight table size (message ID space) */
+
+struct replay_query {
+	uint8_t wire[KNOT_WIRE_MIN_PKTSIZE];
+	uint16_t size;
+	bool cold;		/* First occurrence of qname/qtype in the stream. */
+};
+
+struct replay_slot {
+	uint64_t sent_ns;	/* 0 when the slot is free. */
+	bool cold;
+};
+
+typedef array_t(uint32_t) lat_array_t;
+
+struct replay_ctx {
+	uv_loop_t *loop;
+	uv_udp_t udp;
+	uv_tcp_t tcp;
+	uv_timer_t pacer;
+	uv_timer_t drain;
+	struct sockaddr_storage server;
+	bool use_tcp;
+	unsigned rate;		/* Queries per second, 0 = as fast as possible. */
+	unsigned drain_ms;
+	/* Input stream */
+	array_t(struct replay_query *) queries;
+	size_t next;
+	/* In-flight and results */
+	struct replay_slot inflight[REPLAY_MAXQ];
+	uint16_t next_id;
+	lat_array_t lat_cold;	/* Latencies (us) */
+	lat_array_t lat_warm;
+	size_t sent, received, timeouts;
+	uint64_t start_ns, end_ns;
+	/* TCP reassembly */
+	uint8_t tcp_buf[REPLAY_MAXQ];
+	size_t tcp_have;
+};
+
+static void replay_finish(struct replay_ctx *ctx);
+static void on_tick(uv_timer_t *timer);
+
+static int load_stream(struct replay_ctx *ctx, const char *path)
+{
+	FILE *fp = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+	if (!fp) {
+		return kr_error(errno);
+	}
+	map_t seen = map_make();
+	char line[KNOT_DNAME_TXT_MAXLEN + 64];
+	while (fgets(line, sizeof(line), fp)) {
+		char qname[KNOT_DNAME_TXT_MAXLEN + 1], qtype[32];
+		if (line[0] == '#' || sscanf(line, "%255s %31s", qname, qtype) != 2) {
+			continue;
+		}
+		uint8_t dname[KNOT_DNAME_MAXLEN];
+		if (!knot_dname_from_str(dname, qname, sizeof(dname))) {
+			continue;
+		}
+		uint16_t type = 0;
+		if (knot_rrtype_from_string(qtype, &type) != 0) {
+			continue;
+		}
+		struct replay_query *qry = calloc(1, sizeof(*qry));
+		if (!qry) {
+			break;
+		}
+		/* Render wire format once, IDs are patched at send time. */
+		knot_pkt_t *pkt = knot_pkt_new(qry->wire, sizeof(qry->wire), NULL);
+		knot_pkt_put_question(pkt, dname, KNOT_CLASS_IN, type);
+		knot_wire_set_rd(pkt->wire);
+		qry->size = pkt->size;
+		knot_pkt_free(&pkt);
+		/* Repeats of a qname/qtype pair are a warm-cache proxy. */
+		char key[KNOT_DNAME_TXT_MAXLEN + 16];
+		snprintf(key, sizeof(key), "%s/%u", qname, type);
+		qry->cold = !map_contains(&seen, key);
+		if (qry->cold) {
+			map_set(&seen, key, (void *)1);
+		}
+		array_push(ctx->queries, qry);
+	}
+	map_clear(&seen);
+	if (fp != stdin) {
+		fclose(fp);
+	}
+	return ctx->queries.len > 0 ? kr_ok() : kr_error(ENOENT);
+}
+
+static void on_answer(struct replay_ctx *ctx, const uint8_t *wire, size_t len)
+{
+	if (len < KNOT_WIRE_HEADER_SIZE) {
+		return;
+	}
+	uint16_t id = knot_wire_get_id(wire);
+	struct replay_slot *slot = &ctx->inflight[id];
+	if (slot->sent_ns == 0) {
+		return; /* Duplicate or late answer. */
+	}
+	uint32_t lat_us = (uv_hrtime() - slot->sent_ns) / 1000;
+	if (slot->cold) {
+		array_push(ctx->lat_cold, lat_us);
+	} else {
+		array_push(ctx->lat_warm, lat_us);
+	}
+	slot->sent_ns = 0;
+	ctx->received += 1;
+	ctx->end_ns = uv_hrtime();
+	if (ctx->next >= ctx->queries.len && ctx->received + ctx->timeouts >= ctx->sent) {
+		replay_finish(ctx);
+	}
+}
+
+static void replay_getbuf(uv_handle_t *handle, size_t suggested, uv_buf_t *buf)
+{
+	static char static_buf[KNOT_WIRE_MAX_PKTSIZE];
+	buf->base = static_buf;
+	buf->len = sizeof(static_buf);
+}
+
+static void udp_on_recv(uv_udp_t *handle, ssize_t nread, const uv_buf_t *buf,
+                        const struct sockaddr *addr, unsigned flags)
+{
+	if (nread > 0) {
+		on_answer(handle->data, (const uint8_t *)buf->base, nread);
+	}
+}
+
+static void tcp_on_recv(uv_stream_t *handle, ssize_t nread, const uv_buf_t *buf)
+{
+	struct replay_ctx *ctx = handle->data;
+	if (nread <= 0) {
+		replay_finish(ctx);
+		return;
+	}
+	if (ctx->tcp_have + nread > sizeof(ctx->tcp_buf)) {
+		ctx->tcp_have = 0; /* Out of sync, drop the buffer. */
+		return;
+	}
+	memcpy(ctx->tcp_buf + ctx->tcp_have, buf->base, nread);
+	ctx->tcp_have += nread;
+	/* Pop length-framed messages. */
+	size_t off = 0;
+	while (ctx->tcp_have - off >= 2) {
+		uint16_t msg_len = (ctx->tcp_buf[off] << 8) | ctx->tcp_buf[off + 1];
+		if (ctx->tcp_have - off < 2u + msg_len) {
+			break;
+		}
+		on_answer(ctx, ctx->tcp_buf + off + 2, msg_len);
+		off += 2 + msg_len;
+	}
+	memmove(ctx->tcp_buf, ctx->tcp_buf + off, ctx->tcp_have - off);
+	ctx->tcp_have -= off;
+}
+
+static void on_send(uv_udp_send_t *req, int status)
+{
+	free(req);
+}
+
+static void on_write(uv_write_t *req, int status)
+{
+	free(req->data);
+	free(req);
+}
+
+static int send_one(struct replay_ctx *ctx)
+{
+	struct replay_query *qry = ctx->queries.at[ctx->next];
+	uint16_t id = ctx->next_id++;
+	struct replay_slot *slot = &ctx->inflight[id];
+	if (slot->sent_ns != 0) {
+		ctx->timeouts += 1; /* Evicted, never answered. */
+	}
+	slot->sent_ns = uv_hrtime();
+	slot->cold = qry->cold;
+	knot_wire_set_id(qry->wire, id);
+	if (ctx->use_tcp) {
+		/* Length-framed write, wire is copied so IDs can be reused. */
+		uint8_t *msg = malloc(2 + qry->size);
+		if (!msg) {
+			return kr_error(ENOMEM);
+		}
+		msg[0] = qry->size >> 8;
+		msg[1] = qry->size & 0xff;
+		memcpy(msg + 2, qry->wire, qry->size);
+		uv_write_t *req = malloc(sizeof(*req));
+		req->data = msg;
+		uv_buf_t buf = uv_buf_init((char *)msg, 2 + qry->size);
+		uv_write(req, (uv_stream_t *)&ctx->tcp, &buf, 1, on_write);
+	} else {
+		uv_udp_send_t *req = malloc(sizeof(*req));
+		uv_buf_t buf = uv_buf_init((char *)qry->wire, qry->size);
+		uv_udp_send(req, &ctx->udp, &buf, 1,
+		            (const struct sockaddr *)&ctx->server, on_send);
+	}
+	ctx->sent += 1;
+	ctx->next += 1;
+	return kr_ok();
+}
+
+static void replay_start(struct replay_ctx *ctx)
+{
+	ctx->pacer.data = ctx;
+	uv_timer_init(ctx->loop, &ctx->pacer);
+	uv_timer_start(&ctx->pacer, on_tick, 0, REPLAY_TICK);
+	ctx->start_ns = uv_hrtime();
+	ctx->end_ns = ctx->start_ns;
+}
+
+static void on_connect(uv_connect_t *req, int status)
+{
+	struct replay_ctx *ctx = req->handle->data;
+	if (status != 0) {
+		fprintf(stderr, "connect failed: %s\n", uv_strerror(status));
+		uv_stop(ctx->loop);
+		return;
+	}
+	uv_read_start(req->handle, &replay_getbuf, &tcp_on_recv);
+	/* Send only over the established connection. */
+	replay_start(ctx);
+}
+
+static void on_drain(uv_timer_t *timer)
+{
+	replay_finish(timer->data);
+}
+
+static void on_tick(uv_timer_t *timer)
+{
+	struct replay_ctx *ctx = timer->data;
+	size_t batch = ctx->rate ? (ctx->rate * REPLAY_TICK + 999) / 1000
+	                         : ctx->queries.len;
+	while (batch-- > 0 && ctx->next < ctx->queries.len) {
+		if (send_one(ctx) != 0) {
+			break;
+		}
+	}
+	if (ctx->next >= ctx->queries.len) {
+		uv_timer_stop(&ctx->pacer);
+		/* Give trailing answers a grace period. */
+		ctx->drain.data = ctx;
+		uv_timer_init(ctx->loop, &ctx->drain);
+		uv_timer_start(&ctx->drain, on_drain, ctx->drain_ms, 0);
+	}
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+static void report_latency(const char *name, lat_array_t *lat)
+{
+	if (lat->len == 0) {
+		printf("%s\t0\t-\t-\t-\t-\n", name);
+		return;
+	}
+	qsort(lat->at, lat->len, sizeof(uint32_t), cmp_u32);
+	size_t n = lat->len;
+	printf("%s\t%zu\t%u\t%u\t%u\t%u\n", name, n,
+	       lat->at[n / 2], lat->at[n * 9 / 10],
+	       lat->at[n * 99 / 100], lat->at[n - 1]);
+}
+
+static void replay_finish(struct replay_ctx *ctx)
+{
+	static bool done = false;
+	if (done) {
+		return;
+	}
+	done = true;
+	double elapsed = (ctx->end_ns - ctx->start_ns) / 1e9;
+	if (elapsed <= 0) {
+		elapsed = 1e-9;
+	}
+	printf("# sent\t%zu\n# received\t%zu\n# lost\t%zu\n# qps\t%.0f\n",
+	       ctx->sent, ctx->received, ctx->sent - ctx->received,
+	       ctx->received / elapsed);
+	printf("# split\tcount\tp50_us\tp90_us\tp99_us\tmax_us\n");
+	report_latency("cold", &ctx->lat_cold);
+	report_latency("warm", &ctx->lat_warm);
+	uv_stop(ctx->loop);
+}
+
+int main(int argc, char *argv[])
+{
+	struct replay_ctx ctx;
+	memset(&ctx, 0, sizeof(ctx));
+	array_init(ctx.queries);
+	array_init(ctx.lat_cold);
+	array_init(ctx.lat_warm);
+	const char *addr = "127.0.0.1";
+	unsigned port = 53;
+	ctx.drain_ms = REPLAY_DRAIN;
+	int c = 0;
+	while ((c = getopt(argc, argv, "s:p:r:d:T")) != -1) {
+		switch (c) {
+		case 's': addr = optarg; break;
+		case 'p': port = atoi(optarg); break;
+		case 'r': ctx.rate = atoi(optarg); break;
+		case 'd': ctx.drain_ms = atoi(optarg); break;
+		case 'T': ctx.use_tcp = true; break;
+		default:
+			fprintf(stderr, "usage: %s [-s addr] [-p port] [-r qps] [-d drain_ms] [-T] FILE\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (optind >= argc) {
+		fprintf(stderr, "%s: missing query stream file\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	if (load_stream(&ctx, argv[optind]) != 0) {
+		fprintf(stderr, "%s: cannot load queries from '%s'\n", argv[0], argv[optind]);
+		return EXIT_FAILURE;
+	}
+	if (uv_ip4_addr(addr, port, (struct sockaddr_in *)&ctx.server) != 0 &&
+	    uv_ip6_addr(addr, port, (struct sockaddr_in6 *)&ctx.server) != 0) {
+		fprintf(stderr, "%s: invalid server address '%s'\n", argv[0], addr);
+		return EXIT_FAILURE;
+	}
+
+	ctx.loop = uv_default_loop();
+	if (ctx.use_tcp) {
+		uv_tcp_init(ctx.loop, &ctx.tcp);
+		ctx.tcp.data = &ctx;
+		static uv_connect_t conn;
+		uv_tcp_connect(&conn, &ctx.tcp,
+		               (const struct sockaddr *)&ctx.server, on_connect);
+	} else {
+		uv_udp_init(ctx.loop, &ctx.udp);
+		ctx.udp.data = &ctx;
+		uv_udp_recv_start(&ctx.udp, &replay_getbuf, &udp_on_recv);
+		replay_start(&ctx);
+	}
+	uv_run(ctx.loop, UV_RUN_DEFAULT);
+
+	for (size_t i = 0; i < ctx.queries.len; ++i) {
+		free(ctx.queries.at[i]);
+	}
+	array_clear(ctx.queries);
+	array_clear(ctx.lat_cold);
+	array_clear(ctx.lat_warm);
+	return EXIT_SUCCESS;
+}
@@ -57,6 +57,41 @@ static void test_array(void **state)
 	array_clear(arr);
 }
 
+static void test_array_sb(void **state)
+{
+	int ret = 0;
+	sb_array_t(int, 4) arr;
+	sb_array_init(arr);
+
+	/* Stays inline within the small buffer. */
+	assert_int_equal(arr.len, 0);
+	assert_int_equal(arr.cap, 4);
+	for (unsigned i = 0; i < 4; ++i) {
+		ret = sb_array_push(arr, i);
+		assert_true(ret >= 0);
+	}
+	assert_true(arr.at == arr.inl);
+
+	/* Spills on overflow, contents survive. */
+	for (unsigned i = 4; i < 100; ++i) {
+		ret = sb_array_push(arr, i);
+		assert_true(ret >= 0);
+	}
+	assert_true(arr.at != arr.inl);
+	for (unsigned i = 0; i < 100; ++i) {
+		assert_int_equal(arr.at[i], i);
+	}
+
+	/* Clear resets back to the small buffer. */
+	sb_array_clear(arr);
+	assert_true(arr.at == arr.inl);
+	assert_int_equal(arr.cap, 4);
+
+	/* Clear without a spill must not free the small buffer. */
+	assert_int_equal(sb_array_push(arr, 5), 0);
+	sb_array_clear(arr);
+}
+
 /** Reservation through tracked memory allocator. */
 static int test_reserve(void *baton, char **mem, size_t elm_size, size_t want, size_t *have)
 {
@@ -104,6 +139,7 @@ int main(void)
 
 	const UnitTest tests[] = {
 		unit_test(test_array),
+		unit_test(test_array_sb),
 		unit_test(test_array_mm)
 	};
 
@@ -0,0 +1,80 @@
+/*  Copyright (C) 2016 CZ.NIC, z.s.p.o. <knot-dns@labs.nic.cz>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include "tests/test.h"
+#include "lib/lpm.h"
+
+static struct sockaddr_storage addr_of(const char *str)
+{
+	struct sockaddr_storage ss;
+	memset(&ss, 0, sizeof(ss));
+	int family = strchr(str, ':') ? AF_INET6 : AF_INET;
+	ss.ss_family = family;
+	if (family == AF_INET6) {
+		inet_pton(family, str, &((struct sockaddr_in6 *)&ss)->sin6_addr);
+	} else {
+		inet_pton(family, str, &((struct sockaddr_in *)&ss)->sin_addr);
+	}
+	return ss;
+}
+
+static void test_lpm_params(void **state)
+{
+	assert_int_not_equal(kr_lpm_add(NULL, "127.0.0.1", 1), 0);
+	assert_int_not_equal(kr_lpm_compile(NULL), 0);
+	assert_int_not_equal(kr_lpm_match(NULL, NULL), 0);
+	kr_lpm_free(NULL);
+}
+
+static void test_lpm_basic(void **state)
+{
+	struct kr_lpm *lpm = kr_lpm_create();
+	assert_non_null(lpm);
+	assert_int_equal(kr_lpm_add(lpm, "10.0.0.0/8", 1), 0);
+	assert_int_equal(kr_lpm_add(lpm, "10.0.0.0/24", 2), 0);
+	assert_int_equal(kr_lpm_add(lpm, "127.0.0.1", 3), 0);
+	assert_int_equal(kr_lpm_add(lpm, "fd00::/8", 4), 0);
+	assert_int_equal(kr_lpm_compile(lpm), 0);
+	/* Longest prefix wins */
+	struct sockaddr_storage ss = addr_of("10.0.0.1");
+	assert_int_equal(kr_lpm_match(lpm, (struct sockaddr *)&ss), 2);
+	ss = addr_of("10.1.0.1");
+	assert_int_equal(kr_lpm_match(lpm, (struct sockaddr *)&ss), 1);
+	/* Exact host match */
+	ss = addr_of("127.0.0.1");
+	assert_int_equal(kr_lpm_match(lpm, (struct sockaddr *)&ss), 3);
+	ss = addr_of("127.0.0.2");
+	assert_int_equal(kr_lpm_match(lpm, (struct sockaddr *)&ss), -1);
+	/* Families are separate */
+	ss = addr_of("fd12::1");
+	assert_int_equal(kr_lpm_match(lpm, (struct sockaddr *)&ss), 4);
+	ss = addr_of("2001:db8::1");
+	assert_int_equal(kr_lpm_match(lpm, (struct sockaddr *)&ss), -1);
+	kr_lpm_free(lpm);
+}
+
+int main(void)
+{
+	const UnitTest tests[] = {
+	        unit_test(test_lpm_params),
+	        unit_test(test_lpm_basic)
+	};
+
+	return run_tests(tests);
+}
@@ -0,0 +1,81 @@
+/*  Copyright (C) 2016 CZ.NIC, z.s.p.o. <knot-dns@labs.nic.cz>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "tests/test.h"
+#include "lib/generic/queue.h"
+
+typedef queue_t(int) int_queue_t;
+
+static void test_queue_basic(void **state)
+{
+	int_queue_t *q = malloc(queue_size(int_queue_t, 8));
+	assert_non_null(q);
+	queue_init(q, 8);
+
+	/* Empty queue. */
+	int val = -1;
+	assert_int_equal(queue_count(q), 0);
+	assert_true(queue_pop(q, &val) < 0);
+
+	/* FIFO ordering. */
+	for (int i = 0; i < 8; ++i) {
+		assert_int_equal(queue_push(q, &i), 0);
+	}
+	assert_int_equal(queue_count(q), 8);
+	for (int i = 0; i < 8; ++i) {
+		assert_int_equal(queue_pop(q, &val), 0);
+		assert_int_equal(val, i);
+	}
+	assert_true(queue_pop(q, &val) < 0);
+
+	free(q);
+}
+
+static void test_queue_bounds(void **state)
+{
+	/* Capacity is rounded up to a power of two. */
+	int_queue_t *q = malloc(queue_size(int_queue_t, 5));
+	assert_non_null(q);
+	queue_init(q, 5);
+	assert_int_equal(q->cap, 8);
+
+	/* Overfill is rejected. */
+	for (int i = 0; i < 8; ++i) {
+		assert_int_equal(queue_push(q, &i), 0);
+	}
+	int over = 100;
+	assert_true(queue_push(q, &over) < 0);
+
+	/* Wrap the ring several times. */
+	int val = -1;
+	for (int i = 0; i < 100; ++i) {
+		assert_int_equal(queue_pop(q, &val), 0);
+		assert_int_equal(queue_push(q, &i), 0);
+	}
+	assert_int_equal(queue_count(q), 8);
+
+	free(q);
+}
+
+int main(void)
+{
+	const UnitTest tests[] = {
+		unit_test(test_queue_basic),
+		unit_test(test_queue_bounds)
+	};
+
+	return run_tests(tests);
+}
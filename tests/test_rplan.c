@@ -56,11 +56,38 @@ static void test_rplan_push(void **state)
 	kr_rplan_deinit(&rplan);
 }
 
+static void test_rplan_priority(void **state)
+{
+	knot_mm_t mm;
+	test_mm_ctx_init(&mm);
+	struct kr_request request = {
+		.pool = mm,
+		.options = 0,
+	};
+
+	struct kr_rplan rplan;
+	kr_rplan_init(&rplan, &request, &mm);
+
+	/* Subqueries stay above their parent, A outranks a later AAAA. */
+	struct kr_query *parent = kr_rplan_push(&rplan, NULL, (knot_dname_t *)"", 0, KNOT_RRTYPE_NS);
+	assert_non_null(parent);
+	struct kr_query *qry_a = kr_rplan_push(&rplan, parent, (knot_dname_t *)"", 0, KNOT_RRTYPE_A);
+	struct kr_query *qry_aaaa = kr_rplan_push(&rplan, parent, (knot_dname_t *)"", 0, KNOT_RRTYPE_AAAA);
+	assert_ptr_equal(array_tail(rplan.pending), qry_a);
+	kr_rplan_pop(&rplan, qry_a);
+	assert_ptr_equal(array_tail(rplan.pending), qry_aaaa);
+	kr_rplan_pop(&rplan, qry_aaaa);
+	assert_ptr_equal(array_tail(rplan.pending), parent);
+
+	kr_rplan_deinit(&rplan);
+}
+
 int main(void)
 {
 	const UnitTest tests[] = {
 	        unit_test(test_rplan_params),
-	        unit_test(test_rplan_push)
+	        unit_test(test_rplan_push),
+	        unit_test(test_rplan_priority)
 	};
 
 	return run_tests(tests);
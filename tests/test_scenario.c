@@ -0,0 +1,364 @@
+/*  Copyright (C) 2016 CZ.NIC, z.s.p.o. <knot-dns@labs.nic.cz>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Resolution cost scenarios.
+ *
+ * Deckard asserts what the resolver answers, these tests assert what the
+ * answer costs.  Each scenario drives a full resolution through the
+ * produce/consume contract against scripted upstream replies and then
+ * checks the bill: upstream round trips, cache backend operations and the
+ * request mempool high-water mark.  A logic change that adds a round trip
+ * or makes cache lookups quadratic fails here instead of surfacing as a
+ * latency regression in production.
+ */
+
+#include <netinet/in.h>
+#include <ucw/mempool.h>
+#include <libknot/packet/pkt.h>
+#include <libknot/descriptor.h>
+#include <libknot/rrtype/opt.h>
+
+#include "tests/test.h"
+#include "lib/resolve.h"
+#include "lib/module.h"
+#include "lib/cache.h"
+#include "lib/cdb.h"
+
+/* Cost budgets; generous enough to survive legitimate drift, tight enough
+ * to catch a round-trip or lookup-count regression. */
+#define COST_MAX_ROUNDS 8                  /* Scenario runaway guard. */
+#define COST_MAX_CACHE_READS 64            /* Backend reads per resolution. */
+#define COST_MAX_POOL_SIZE (256 * 1024)    /* Request mempool high-water. */
+#define SCENARIO_TTL 3600
+
+/* Scripted zone data. */
+static const uint8_t dname_example[] = "\x07""example";
+static const uint8_t dname_example_ns[] = "\x03""ns1\x07""example";
+static const uint8_t dname_test[] = "\x04""test";
+
+/*
+ * Fake cache backend: every lookup misses, every operation is counted.
+ * Keeps the cache layers on their real code paths while making the
+ * backend traffic observable.
+ */
+
+static struct {
+	size_t reads;
+	size_t writes;
+} fake_cdb_ops;
+
+static int fake_cdb_open(knot_db_t **db, struct kr_cdb_opts *opts, knot_mm_t *mm)
+{
+	static char fake_db;
+	*db = &fake_db;
+	return 0;
+}
+
+static void fake_cdb_close(knot_db_t *db)
+{
+}
+
+static int fake_cdb_count(knot_db_t *db)
+{
+	return 0;
+}
+
+static int fake_cdb_clear(knot_db_t *db)
+{
+	return 0;
+}
+
+static int fake_cdb_sync(knot_db_t *db)
+{
+	return 0;
+}
+
+static int fake_cdb_read(knot_db_t *db, knot_db_val_t *key, knot_db_val_t *val, int maxcount)
+{
+	fake_cdb_ops.reads += 1;
+	return kr_error(ENOENT);
+}
+
+static int fake_cdb_write(knot_db_t *db, knot_db_val_t *key, knot_db_val_t *val, int maxcount)
+{
+	fake_cdb_ops.writes += 1;
+	return 0;
+}
+
+static int fake_cdb_remove(knot_db_t *db, knot_db_val_t *key, int maxcount)
+{
+	return 0;
+}
+
+static int fake_cdb_match(knot_db_t *db, knot_db_val_t *key, knot_db_val_t *val, int maxcount)
+{
+	return kr_error(ENOENT);
+}
+
+static int fake_cdb_prune(knot_db_t *db, int maxcount)
+{
+	return 0;
+}
+
+static const struct kr_cdb_api fake_cdb_api = {
+	"fake_counting_api",
+	fake_cdb_open, fake_cdb_close, fake_cdb_count, fake_cdb_clear, fake_cdb_sync,
+	fake_cdb_read, fake_cdb_write, fake_cdb_remove,
+	fake_cdb_match, fake_cdb_prune, NULL
+};
+
+/*
+ * Shared resolution context, set up once like engine_init() does it:
+ * the default layer pipeline, lazily primed root hints and empty
+ * reputation caches.
+ */
+
+static struct kr_context g_ctx;
+static knot_mm_t g_pool;
+static knot_rrset_t g_opt_rr;
+static module_array_t g_modules;
+static struct kr_module g_module[4];
+static const char *g_module_names[4] = { "iterate", "validate", "rrcache", "pktcache" };
+
+static void test_scenario_init(void **state)
+{
+	memset(&g_ctx, 0, sizeof(g_ctx));
+	memset(&g_pool, 0, sizeof(g_pool));
+	g_pool.ctx = mp_new(4096);
+	g_pool.alloc = (knot_mm_alloc_t) mp_alloc;
+	g_ctx.pool = &g_pool;
+	g_ctx.trust_anchors = map_make();
+	g_ctx.negative_anchors = map_make();
+	knot_edns_init(&g_opt_rr, KR_EDNS_PAYLOAD, 0, KR_EDNS_VERSION, &g_pool);
+	g_ctx.opt_rr = &g_opt_rr;
+	assert_int_equal(kr_zonecut_init(&g_ctx.root_hints, (const uint8_t *)"", &g_pool), 0);
+	g_ctx.cache_rtt = calloc(1, lru_size(kr_nsrep_rtt_lru_t, 64));
+	assert_non_null(g_ctx.cache_rtt);
+	lru_init(g_ctx.cache_rtt, 64);
+	g_ctx.cache_rep = calloc(1, lru_size(kr_nsrep_lru_t, 64));
+	assert_non_null(g_ctx.cache_rep);
+	lru_init(g_ctx.cache_rep, 64);
+	assert_int_equal(kr_cache_open(&g_ctx.cache, &fake_cdb_api, NULL, &g_pool), 0);
+	/* Default pipeline in shipped order. */
+	array_init(g_modules);
+	for (unsigned i = 0; i < 4; ++i) {
+		assert_int_equal(kr_module_load(&g_module[i], g_module_names[i], NULL), 0);
+		assert_int_equal(array_push(g_modules, &g_module[i]), i);
+	}
+	g_ctx.modules = &g_modules;
+	assert_int_equal(kr_context_compile_layers(&g_ctx), 0);
+}
+
+static void test_scenario_deinit(void **state)
+{
+	for (unsigned i = 0; i < 4; ++i) {
+		kr_module_unload(&g_module[i]);
+	}
+	array_clear(g_modules);
+	kr_cache_close(&g_ctx.cache);
+	lru_deinit(g_ctx.cache_rtt);
+	lru_deinit(g_ctx.cache_rep);
+	free(g_ctx.cache_rtt);
+	free(g_ctx.cache_rep);
+	mp_delete(g_pool.ctx);
+}
+
+/*
+ * Scenario driver: the same consume/produce/checkout loop the worker
+ * runs, with scripted reply builders standing in for upstreams.
+ */
+
+typedef int (*reply_script_t)(knot_pkt_t *reply);
+
+struct scenario_cost {
+	unsigned rounds;    /**< Upstream round trips (checkouts). */
+	size_t cache_reads; /**< Cache backend read operations. */
+	size_t pool_size;   /**< Request mempool total at the end. */
+	int state;          /**< Final resolution state. */
+};
+
+/** Render a scripted reply to the checked-out query and run it through
+  * the wire, so consume sees exactly what a parsed response looks like. */
+static knot_pkt_t *scripted_reply(const knot_pkt_t *query, reply_script_t script)
+{
+	knot_pkt_t *built = knot_pkt_new(NULL, KNOT_WIRE_MAX_PKTSIZE, NULL);
+	if (!built || knot_pkt_init_response(built, query) != 0 || script(built) != 0) {
+		knot_pkt_free(&built);
+		return NULL;
+	}
+	knot_pkt_t *wire = knot_pkt_new(NULL, built->size, NULL);
+	if (wire) {
+		memcpy(wire->wire, built->wire, built->size);
+		wire->size = built->size;
+		if (knot_pkt_parse(wire, 0) != 0) {
+			knot_pkt_free(&wire);
+		}
+	}
+	knot_pkt_free(&built);
+	return wire;
+}
+
+static void run_scenario(const knot_dname_t *qname, uint16_t qtype,
+                         const reply_script_t *script, unsigned script_len,
+                         struct scenario_cost *cost)
+{
+	memset(cost, 0, sizeof(*cost));
+	memset(&fake_cdb_ops, 0, sizeof(fake_cdb_ops));
+	memset(&g_ctx.cache.stats, 0, sizeof(g_ctx.cache.stats));
+
+	/* Client query over "UDP", no EDNS. */
+	knot_pkt_t *query = knot_pkt_new(NULL, KNOT_WIRE_MIN_PKTSIZE, NULL);
+	assert_non_null(query);
+	knot_wire_set_id(query->wire, 0x1234);
+	knot_wire_set_rd(query->wire);
+	assert_int_equal(knot_pkt_put_question(query, qname, KNOT_CLASS_IN, qtype), 0);
+
+	struct kr_request request;
+	memset(&request, 0, sizeof(request));
+	request.pool.ctx = mp_new(4096);
+	request.pool.alloc = (knot_mm_alloc_t) mp_alloc;
+	knot_pkt_t *answer = knot_pkt_new(NULL, KNOT_WIRE_MAX_PKTSIZE, &request.pool);
+	knot_pkt_t *pktbuf = knot_pkt_new(NULL, KR_EDNS_PAYLOAD, &request.pool);
+	assert_non_null(answer);
+	assert_non_null(pktbuf);
+	pktbuf->size = 0;
+
+	int state = kr_resolve_begin(&request, &g_ctx, answer);
+	assert_int_equal(state, KNOT_STATE_CONSUME);
+	state = kr_resolve_consume(&request, NULL, query);
+	while (cost->rounds < COST_MAX_ROUNDS) {
+		struct sockaddr *dst = NULL;
+		int sock_type = -1;
+		while (state == KNOT_STATE_PRODUCE) {
+			state = kr_resolve_produce(&request, &dst, &sock_type, pktbuf);
+		}
+		if (state != KNOT_STATE_CONSUME) {
+			break; /* Resolution finished (or failed). */
+		}
+		if (cost->rounds >= script_len ||
+		    kr_resolve_checkout(&request, NULL, dst, sock_type, pktbuf) != 0) {
+			state = KNOT_STATE_FAIL;
+			break;
+		}
+		knot_pkt_t *reply = scripted_reply(pktbuf, script[cost->rounds]);
+		assert_non_null(reply);
+		cost->rounds += 1;
+		state = kr_resolve_consume(&request, dst, reply);
+		knot_pkt_free(&reply);
+	}
+	cost->state = state;
+	cost->cache_reads = fake_cdb_ops.reads;
+	cost->pool_size = (size_t) mp_total_size(request.pool.ctx);
+	kr_resolve_finish(&request, state == KNOT_STATE_DONE ? state : KNOT_STATE_FAIL);
+	mp_delete(request.pool.ctx);
+	knot_pkt_free(&query);
+}
+
+/*
+ * Scripted upstreams.
+ */
+
+static int put_rr(knot_pkt_t *pkt, const uint8_t *owner, uint16_t type,
+                  const uint8_t *rdata, uint16_t rdlen)
+{
+	knot_rrset_t rr;
+	knot_rrset_init(&rr, (knot_dname_t *)owner, type, KNOT_CLASS_IN);
+	int ret = knot_rrset_add_rdata(&rr, rdata, rdlen, SCENARIO_TTL, &pkt->mm);
+	if (ret == 0) {
+		ret = knot_pkt_put(pkt, KNOT_COMPR_HINT_NONE, &rr, 0);
+	}
+	return ret;
+}
+
+/** Root server: referral to the example. cut with in-bailiwick glue. */
+static int reply_example_referral(knot_pkt_t *pkt)
+{
+	const uint8_t glue[4] = { 192, 0, 2, 1 };
+	knot_pkt_begin(pkt, KNOT_AUTHORITY);
+	int ret = put_rr(pkt, dname_example, KNOT_RRTYPE_NS,
+	                 dname_example_ns, sizeof(dname_example_ns));
+	if (ret == 0) {
+		knot_pkt_begin(pkt, KNOT_ADDITIONAL);
+		ret = put_rr(pkt, dname_example_ns, KNOT_RRTYPE_A, glue, sizeof(glue));
+	}
+	return ret;
+}
+
+/** example. server: authoritative answer. */
+static int reply_example_answer(knot_pkt_t *pkt)
+{
+	const uint8_t addr[4] = { 192, 0, 2, 53 };
+	knot_wire_set_aa(pkt->wire);
+	return put_rr(pkt, dname_example, KNOT_RRTYPE_A, addr, sizeof(addr));
+}
+
+/** Root server: authoritative NODATA right away. */
+static int reply_root_nodata(knot_pkt_t *pkt)
+{
+	/* SOA . with root mname/rname, serial and timers zeroed. */
+	uint8_t soa[22] = { '\0' };
+	knot_wire_set_aa(pkt->wire);
+	knot_pkt_begin(pkt, KNOT_AUTHORITY);
+	return put_rr(pkt, (const uint8_t *)"", KNOT_RRTYPE_SOA, soa, sizeof(soa));
+}
+
+/*
+ * Scenarios.
+ */
+
+static void test_scenario_referral_cost(void **state)
+{
+	const reply_script_t script[] = {
+		reply_example_referral,
+		reply_example_answer,
+	};
+	struct scenario_cost cost;
+	run_scenario(dname_example, KNOT_RRTYPE_A, script, 2, &cost);
+	assert_int_equal(cost.state, KNOT_STATE_DONE);
+	/* One referral deep costs exactly two round trips on a cold cache. */
+	assert_int_equal(cost.rounds, 2);
+	assert_true(cost.cache_reads > 0);
+	assert_true(cost.cache_reads <= COST_MAX_CACHE_READS);
+	assert_true(cost.pool_size <= COST_MAX_POOL_SIZE);
+	/* The answer was offered to the cache on the way out. */
+	assert_true(fake_cdb_ops.writes > 0);
+}
+
+static void test_scenario_nodata_cost(void **state)
+{
+	const reply_script_t script[] = {
+		reply_root_nodata,
+	};
+	struct scenario_cost cost;
+	run_scenario(dname_test, KNOT_RRTYPE_A, script, 1, &cost);
+	assert_int_equal(cost.state, KNOT_STATE_DONE);
+	/* An authoritative NODATA terminates after a single round trip. */
+	assert_int_equal(cost.rounds, 1);
+	assert_true(cost.cache_reads <= COST_MAX_CACHE_READS);
+	assert_true(cost.pool_size <= COST_MAX_POOL_SIZE);
+}
+
+int main(void)
+{
+	const UnitTest tests[] = {
+		unit_test(test_scenario_init),
+		unit_test(test_scenario_referral_cost),
+		unit_test(test_scenario_nodata_cost),
+		unit_test(test_scenario_deinit),
+	};
+
+	return run_tests(tests);
+}
@@ -0,0 +1,68 @@
+/*  Copyright (C) 2016 CZ.NIC, z.s.p.o. <knot-dns@labs.nic.cz>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "tests/test.h"
+#include "lib/suffixmatch.h"
+
+static void test_suffixmatch_params(void **state)
+{
+	const knot_dname_t *name = (const uint8_t *)"\2cz";
+	assert_int_not_equal(kr_suffix_set_add(NULL, name), 0);
+	assert_int_not_equal(kr_suffix_set_add(NULL, NULL), 0);
+	assert_int_not_equal(kr_suffix_set_compile(NULL), 0);
+	assert_int_not_equal(kr_suffix_set_match(NULL, name), 0);
+	kr_suffix_set_free(NULL);
+}
+
+static void test_suffixmatch_basic(void **state)
+{
+	struct kr_suffix_set *set = kr_suffix_set_create();
+	assert_non_null(set);
+	assert_int_equal(kr_suffix_set_add(set, (const uint8_t *)"\2cz"), 0);
+	assert_int_equal(kr_suffix_set_add(set, (const uint8_t *)"\3nic\2eu"), 0);
+	assert_int_equal(kr_suffix_set_compile(set), 0);
+	/* Exact and subdomain matches */
+	assert_int_equal(kr_suffix_set_match(set, (const uint8_t *)"\2cz"), 1);
+	assert_int_equal(kr_suffix_set_match(set, (const uint8_t *)"\3nic\2cz"), 1);
+	assert_int_equal(kr_suffix_set_match(set, (const uint8_t *)"\3NIC\2CZ"), 1);
+	assert_int_equal(kr_suffix_set_match(set, (const uint8_t *)"\4labs\3nic\2eu"), 1);
+	/* Non-matches, including a sibling label sharing a prefix */
+	assert_int_equal(kr_suffix_set_match(set, (const uint8_t *)"\3czz"), 0);
+	assert_int_equal(kr_suffix_set_match(set, (const uint8_t *)"\2eu"), 0);
+	assert_int_equal(kr_suffix_set_match(set, (const uint8_t *)""), 0);
+	kr_suffix_set_free(set);
+}
+
+static void test_suffixmatch_root(void **state)
+{
+	struct kr_suffix_set *set = kr_suffix_set_create();
+	assert_non_null(set);
+	/* Root name matches everything, even without compilation */
+	assert_int_equal(kr_suffix_set_add(set, (const uint8_t *)""), 0);
+	assert_int_equal(kr_suffix_set_match(set, (const uint8_t *)"\2cz"), 1);
+	kr_suffix_set_free(set);
+}
+
+int main(void)
+{
+	const UnitTest tests[] = {
+	        unit_test(test_suffixmatch_params),
+	        unit_test(test_suffixmatch_basic),
+	        unit_test(test_suffixmatch_root)
+	};
+
+	return run_tests(tests);
+}
@@ -79,11 +79,33 @@ static void test_straddr(void **state)
 	assert_int_not_equal(test_bitcmp(ip6_sub, ip6_out, 4), 0);
 }
 
+static void test_fold(void **state)
+{
+	const uint8_t *name = (const uint8_t *)"\x07""example""\x03""com";
+	const uint8_t *name_up = (const uint8_t *)"\x07""ExAmPlE""\x03""COM";
+	const uint8_t *other = (const uint8_t *)"\x07""exbmple""\x03""com";
+	const uint8_t *longer = (const uint8_t *)"\x03""www""\x07""example""\x03""com";
+	/* Byte equality with folding, across the word boundary. */
+	assert_true(kr_bytes_equal_fold(name, name_up, 13));
+	assert_false(kr_bytes_equal_fold(name, other, 13));
+	/* Dname equality, sizes and identity included. */
+	assert_true(kr_dname_equal_fold(name, name));
+	assert_true(kr_dname_equal_fold(name, name_up));
+	assert_false(kr_dname_equal_fold(name, longer));
+	assert_false(kr_dname_equal_fold(name, NULL));
+	/* In-place lowercase keeps non-letters (label lengths) intact. */
+	uint8_t buf[14];
+	memcpy(buf, name_up, 14);
+	kr_bytes_tolower(buf, 13);
+	assert_memory_equal(buf, name, 13);
+}
+
 int main(void)
 {
 	const UnitTest tests[] = {
 		unit_test(test_strcatdup),
 		unit_test(test_straddr),
+		unit_test(test_fold),
 	};
 
 	return run_tests(tests);
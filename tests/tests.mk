@@ -5,6 +5,9 @@ else
 $(warning cmocka not found, skipping unit tests)
 endif
 
+# Microbenchmarks
+include tests/bench.mk
+
 # Integration tests with Deckard
 deckard_DIR := tests/deckard
 TESTS := sets/resolver
@@ -18,6 +21,6 @@ deckard: check-integration
 
 # Targets
 tests: check-unit
-tests-clean: $(foreach test,$(tests_BIN),$(test)-clean) mock_cmodule-clean
+tests-clean: $(foreach test,$(tests_BIN),$(test)-clean) mock_cmodule-clean bench-clean
 
 .PHONY: tests tests-clean check-integration deckard
@@ -6,13 +6,17 @@ tests_BIN := \
 	test_set \
 	test_map \
 	test_array \
+	test_queue \
 	test_pack \
 	test_lru \
 	test_utils \
 	test_module \
 	test_cache \
 	test_zonecut \
-	test_rplan
+	test_rplan \
+	test_suffixmatch \
+	test_lpm \
+	test_scenario
 
 mock_cmodule_CFLAGS := -fPIC
 mock_cmodule_SOURCES := tests/mock_cmodule.c